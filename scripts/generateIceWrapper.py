@@ -35,7 +35,7 @@ def fix_lineEnding(text):
 def create_disclaimerComment():
     return "// This file was auto-generated by scripts/generateIceWrapper.py on " + datetime.now().strftime("%Y-%m-%d") + " -- DO NOT EDIT MANUALLY!\n"
 
-def generateFunction(className, functionName, wrapArgs, callArgs):
+def generateFunction(className, functionName, wrapArgs, callArgs, onServerThread):
     function = "void ::MumbleServer::" + className + "I::" + functionName + "_async(" + (", ".join(wrapArgs)) + ") {\n"
     function += "\t// qWarning() << \"" + functionName + "\" << meta->mp.qsIceSecretRead.isNull() << meta->mp.qsIceSecretRead.isEmpty();\n"
     function += "#ifndef ACCESS_" + className + "_" + functionName + "_ALL\n"
@@ -64,7 +64,12 @@ def generateFunction(className, functionName, wrapArgs, callArgs):
     function += "\t}\n"
     function += "#endif // ACCESS_" + className + "_" + functionName + "_ALL\n"
     function += "\n"
-    function += "\tExecEvent *ie = new ExecEvent(boost::bind(&impl_" + className + "_" + functionName + ", " + ", ".join(callArgs) + "));\n"
+    implCall = "boost::bind(&impl_" + className + "_" + functionName + ", " + ", ".join(callArgs) + ")"
+    if onServerThread:
+        # The call is handed over from the main thread to the thread of the virtual server. Wrapping the inner bind
+        # expression into a boost::function keeps the outer bind from evaluating it right away.
+        implCall = "boost::bind(&runOnServerThread, " + callArgs[1] + ", boost::function< void() >(" + implCall + "))"
+    function += "\tExecEvent *ie = new ExecEvent(" + implCall + ");\n"
     function += "\tQCoreApplication::instance()->postEvent(mi, ie);\n"
     function += "}\n"
 
@@ -181,7 +186,10 @@ def main():
 
             wrapArgs.append("const ::Ice::Current &current")
 
-            wrapperContent += generateFunction(targetClass, functionName, wrapArgs, callArgs) + "\n"
+            # Starting, stopping and deleting a server creates or destroys its thread, which is up to the main thread
+            onServerThread = targetClass == "Server" and functionName not in ["start", "stop", "delete"]
+
+            wrapperContent += generateFunction(targetClass, functionName, wrapArgs, callArgs, onServerThread) + "\n"
 
 
     wrapperContent += "void ::MumbleServer::MetaI::getSlice_async(const ::MumbleServer::AMD_Meta_getSlicePtr &cb, const Ice::Current&) {\n"
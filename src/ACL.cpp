@@ -9,6 +9,7 @@
 #include "User.h"
 
 #ifdef MURMUR
+#	include "ACLProgram.h"
 #	include "ServerUser.h"
 
 #	include <QtCore/QStack>
@@ -93,30 +94,24 @@ ChanACL::operator QString() const {
 
 #ifdef MURMUR
 
-bool ChanACL::hasPermission(ServerUser *p, Channel *chan, QFlags< Perm > perm, ACLCache *cache) {
+bool ChanACL::hasPermission(ServerUser *p, Channel *chan, QFlags< Perm > perm, PermissionCache *cache) {
 	Permissions granted = effectivePermissions(p, chan, cache);
 
 	return ((granted & perm) != None);
 }
 
 // Return effective permissions.
-QFlags< ChanACL::Perm > ChanACL::effectivePermissions(ServerUser *p, Channel *chan, ACLCache *cache) {
+QFlags< ChanACL::Perm > ChanACL::effectivePermissions(ServerUser *p, Channel *chan, PermissionCache *cache) {
 	// Superuser
 	if (p->iId == 0) {
 		return static_cast< Permissions >(All & ~(Speak | Whisper));
 	}
 
-	Permissions granted;
-
 	if (cache) {
-		QHash< Channel *, Permissions > *h = cache->value(p);
-		if (h)
-			granted = h->value(chan);
+		return cache->permissions(p->aclSubject(), chan);
 	}
 
-	if (granted & Cached) {
-		return granted;
-	}
+	// Evaluate the ACLs directly. ACLProgram mirrors this, so changes have to be made to both.
 
 	QStack< Channel * > chanstack;
 	Channel *ch = chan;
@@ -129,7 +124,7 @@ QFlags< ChanACL::Perm > ChanACL::effectivePermissions(ServerUser *p, Channel *ch
 	// Default permissions
 	Permissions def = Traverse | Enter | Speak | Whisper | TextMessage | Listen;
 
-	granted = def;
+	Permissions granted = def;
 
 	bool traverse = true;
 	bool write    = false;
@@ -183,13 +178,6 @@ QFlags< ChanACL::Perm > ChanACL::effectivePermissions(ServerUser *p, Channel *ch
 			granted |= Kick | Ban | ResetUserContent | Register | SelfRegister;
 	}
 
-	if (cache) {
-		if (!cache->contains(p))
-			cache->insert(p, new QHash< Channel *, Permissions >);
-
-		cache->value(p)->insert(chan, granted | Cached);
-	}
-
 	return granted;
 }
 
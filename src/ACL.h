@@ -12,6 +12,9 @@
 class Channel;
 class User;
 class ServerUser;
+#ifdef MURMUR
+class PermissionCache;
+#endif
 
 class ChanACL : public QObject {
 private:
@@ -47,9 +50,6 @@ public:
 
 	Q_DECLARE_FLAGS(Permissions, Perm)
 
-	typedef QHash< Channel *, Permissions > ChanCache;
-	typedef QHash< User *, ChanCache * > ACLCache;
-
 	Channel *c;
 	bool bApplyHere;
 	bool bApplySubs;
@@ -71,8 +71,9 @@ public:
 	explicit operator QString() const;
 
 #ifdef MURMUR
-	static bool hasPermission(ServerUser *p, Channel *c, QFlags< Perm > perm, ACLCache *cache);
-	static QFlags< Perm > effectivePermissions(ServerUser *p, Channel *c, ACLCache *cache);
+	/// If cache is nullptr, the ACLs are evaluated directly. Otherwise they are compiled and the result is cached.
+	static bool hasPermission(ServerUser *p, Channel *c, QFlags< Perm > perm, PermissionCache *cache);
+	static QFlags< Perm > effectivePermissions(ServerUser *p, Channel *c, PermissionCache *cache);
 #else
 	static QString whatsThis(Perm p);
 #endif
@@ -170,6 +170,12 @@ bool Channel::isFiltered() const {
 
 #endif // MUMBLE
 
+#ifdef MURMUR
+QString Channel::description() const {
+	return m_descriptionBlob.isNull() ? qsDesc : QString::fromUtf8(m_descriptionBlob.data());
+}
+#endif // MURMUR
+
 bool Channel::lessThan(const Channel *first, const Channel *second) {
 	if ((first->iPosition != second->iPosition) && (first->cParent == second->cParent))
 		return first->iPosition < second->iPosition;
@@ -18,6 +18,10 @@
 #	include "ChannelFilterMode.h"
 #endif
 
+#ifdef MURMUR
+#	include "BlobStore.h"
+#endif
+
 class User;
 class Group;
 class ChanACL;
@@ -88,6 +92,16 @@ public:
 
 	void addClientUser(ClientUser *p);
 #endif
+
+#ifdef MURMUR
+	/// The description, if it is large enough to be requested by its hash (see Server::hashAssign). qsDesc is empty
+	/// then.
+	BlobRef m_descriptionBlob;
+
+	/// @returns The description, wherever it is kept
+	QString description() const;
+#endif
+
 	static bool lessThan(const Channel *, const Channel *);
 
 	size_t getLevel() const;
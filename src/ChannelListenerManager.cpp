@@ -4,12 +4,12 @@
 // Mumble source tree or at <https://www.mumble.info/LICENSE>.
 
 #include "ChannelListenerManager.h"
-#include "Channel.h"
-#include "User.h"
 
 #include <QReadLocker>
 #include <QWriteLocker>
 
+#include <algorithm>
+
 std::size_t qHash(const ChannelListener &listener) {
 	return std::hash< ChannelListener >()(listener);
 }
@@ -23,24 +23,91 @@ ChannelListenerManager::ChannelListenerManager()
 	  m_listenerVolumeAdjustments() {
 }
 
+namespace {
+bool compareSession(const ChannelListenerManager::ListenerEntry &entry, unsigned int userSession) {
+	return entry.userSession < userSession;
+}
+
+/// @returns An iterator to the entry of the given user in the given (sorted) entries or the end iterator if there is
+/// no such entry
+template< typename Entries > auto findEntry(Entries &entries, unsigned int userSession) -> decltype(entries.begin()) {
+	auto it = std::lower_bound(entries.begin(), entries.end(), userSession, compareSession);
+
+	return (it != entries.end() && it->userSession == userSession) ? it : entries.end();
+}
+} // namespace
+
+const ChannelListenerManager::ListenerEntry *ChannelListenerManager::findListener(unsigned int userSession,
+																				  unsigned int channelID) const {
+	auto channelIt = m_listenedChannels.find(channelID);
+	if (channelIt == m_listenedChannels.end()) {
+		return nullptr;
+	}
+
+	const std::vector< ListenerEntry > &entries = channelIt->second;
+
+	auto it = findEntry(entries, userSession);
+
+	return it != entries.end() ? &(*it) : nullptr;
+}
+
+const VolumeAdjustment &ChannelListenerManager::lookupVolumeAdjustment(unsigned int userSession,
+																	   unsigned int channelID) const {
+	static VolumeAdjustment fallbackObj = VolumeAdjustment::fromFactor(1.0f);
+
+	ChannelListener key = {};
+	key.channelID       = channelID;
+	key.userSession     = userSession;
+
+	auto it = m_listenerVolumeAdjustments.find(key);
+
+	if (it == m_listenerVolumeAdjustments.end()) {
+		return fallbackObj;
+	} else {
+		return it->second;
+	}
+}
+
 void ChannelListenerManager::addListener(unsigned int userSession, unsigned int channelID) {
+	QReadLocker volumeLock(&m_volumeLock);
 	QWriteLocker lock(&m_listenerLock);
 
 	m_listeningUsers[userSession] << channelID;
-	m_listenedChannels[channelID] << userSession;
+
+	std::vector< ListenerEntry > &entries = m_listenedChannels[channelID];
+
+	auto it = std::lower_bound(entries.begin(), entries.end(), userSession, compareSession);
+	if (it == entries.end() || it->userSession != userSession) {
+		entries.insert(it, { userSession, lookupVolumeAdjustment(userSession, channelID) });
+	}
 }
 
 void ChannelListenerManager::removeListener(unsigned int userSession, unsigned int channelID) {
 	QWriteLocker lock(&m_listenerLock);
 
 	m_listeningUsers[userSession].remove(channelID);
-	m_listenedChannels[channelID].remove(userSession);
+
+	auto channelIt = m_listenedChannels.find(channelID);
+	if (channelIt == m_listenedChannels.end()) {
+		return;
+	}
+
+	std::vector< ListenerEntry > &entries = channelIt->second;
+
+	auto it = findEntry(entries, userSession);
+	if (it != entries.end()) {
+		entries.erase(it);
+	}
+
+	if (entries.empty()) {
+		m_listenedChannels.erase(channelIt);
+	}
 }
 
 bool ChannelListenerManager::isListening(unsigned int userSession, unsigned int channelID) const {
 	QReadLocker lock(&m_listenerLock);
 
-	return m_listenedChannels[channelID].contains(userSession);
+	return findListener(userSession, channelID) != nullptr;
 }
 
 bool ChannelListenerManager::isListeningToAny(unsigned int userSession) const {
@@ -52,13 +119,18 @@ bool ChannelListenerManager::isListeningToAny(unsigned int userSession) const {
 bool ChannelListenerManager::isListenedByAny(unsigned int channelID) const {
 	QReadLocker lock(&m_listenerLock);
 
-	return !m_listenedChannels[channelID].isEmpty();
+	// Channels without listeners are removed from the map
+	return m_listenedChannels.find(channelID) != m_listenedChannels.end();
 }
 
 const QSet< unsigned int > ChannelListenerManager::getListenersForChannel(unsigned int channelID) const {
-	QReadLocker lock(&m_listenerLock);
+	QSet< unsigned int > listeners;
 
-	return m_listenedChannels[channelID];
+	forEachListener(channelID, [&listeners](unsigned int userSession, const VolumeAdjustment &) {
+		listeners.insert(userSession);
+	});
+
+	return listeners;
 }
 
 const QSet< unsigned int > ChannelListenerManager::getListenedChannelsForUser(unsigned int userSession) const {
@@ -70,7 +142,9 @@ const QSet< unsigned int > ChannelListenerManager::getListenedChannelsForUser(un
 int ChannelListenerManager::getListenerCountForChannel(unsigned int channelID) const {
 	QReadLocker lock(&m_listenerLock);
 
-	return static_cast< int >(m_listenedChannels[channelID].size());
+	auto it = m_listenedChannels.find(channelID);
+
+	return it != m_listenedChannels.end() ? static_cast< int >(it->second.size()) : 0;
 }
 
 int ChannelListenerManager::getListenedChannelCountForUser(unsigned int userSession) const {
@@ -95,6 +169,18 @@ void ChannelListenerManager::setListenerVolumeAdjustment(unsigned int userSessio
 		}
 
 		m_listenerVolumeAdjustments[key] = volumeAdjustment;
+
+		// Keep the copy next to the listener up-to-date
+		QWriteLocker listenerLock(&m_listenerLock);
+
+		auto channelIt = m_listenedChannels.find(channelID);
+		if (channelIt != m_listenedChannels.end()) {
+			auto it = findEntry(channelIt->second, userSession);
+
+			if (it != channelIt->second.end()) {
+				it->volumeAdjustment = volumeAdjustment;
+			}
+		}
 	}
 
 	if (oldValue != volumeAdjustment.factor) {
@@ -104,21 +190,9 @@ void ChannelListenerManager::setListenerVolumeAdjustment(unsigned int userSessio
 
 const VolumeAdjustment &ChannelListenerManager::getListenerVolumeAdjustment(unsigned int userSession,
 																			unsigned int channelID) const {
-	static VolumeAdjustment fallbackObj = VolumeAdjustment::fromFactor(1.0f);
-
 	QReadLocker lock(&m_volumeLock);
 
-	ChannelListener key = {};
-	key.channelID       = channelID;
-	key.userSession     = userSession;
-
-	auto it = m_listenerVolumeAdjustments.find(key);
-
-	if (it == m_listenerVolumeAdjustments.end()) {
-		return fallbackObj;
-	} else {
-		return it->second;
-	}
+	return lookupVolumeAdjustment(userSession, channelID);
 }
 
 std::unordered_map< unsigned int, VolumeAdjustment >
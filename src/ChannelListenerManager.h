@@ -14,6 +14,7 @@
 #include <QtCore/QSet>
 
 #include <unordered_map>
+#include <vector>
 
 class User;
 class Channel;
@@ -43,19 +44,35 @@ private:
 	Q_OBJECT
 	Q_DISABLE_COPY(ChannelListenerManager)
 
+public:
+	struct ListenerEntry {
+		/// The session ID of the listening user
+		unsigned int userSession;
+		/// The volume adjustment the user has set for its listener (a copy of the value stored in
+		/// m_listenerVolumeAdjustments)
+		VolumeAdjustment volumeAdjustment;
+	};
+
 protected:
-	/// A lock for guarding m_listeningUsers as well as m_listenedChannels
+	/// A lock for guarding m_listeningUsers as well as m_listenedChannels. If both locks are needed, m_volumeLock
+	/// has to be locked first.
 	mutable QReadWriteLock m_listenerLock;
 	/// A map between a user's session and a list of IDs of all channels the user is listening to
 	QHash< unsigned int, QSet< unsigned int > > m_listeningUsers;
-	/// A map between a channel's ID and a list of all user-sessions of users listening to that channel
-	QHash< unsigned int, QSet< unsigned int > > m_listenedChannels;
+	/// A map between a channel's ID and all users listening to that channel (sorted by session ID)
+	std::unordered_map< unsigned int, std::vector< ListenerEntry > > m_listenedChannels;
 	/// A lock for guarding m_listenerVolumeAdjustments
 	mutable QReadWriteLock m_volumeLock;
 	/// A map between channel IDs and local volume adjustments to be made for ChannelListeners
 	/// in that channel
 	std::unordered_map< ChannelListener, VolumeAdjustment > m_listenerVolumeAdjustments;
 
+	/// @returns The entry of the given user in the given channel or nullptr if the user doesn't listen to it. Requires
+	/// m_listenerLock to be held.
+	const ListenerEntry *findListener(unsigned int userSession, unsigned int channelID) const;
+	/// @returns The volume adjustment for the given listener. Requires m_volumeLock to be held.
+	const VolumeAdjustment &lookupVolumeAdjustment(unsigned int userSession, unsigned int channelID) const;
+
 public:
 	/// Constructor
 	explicit ChannelListenerManager();
@@ -93,6 +110,48 @@ public:
 	/// @returns A set of channel IDs of channels the given user is listening to
 	const QSet< unsigned int > getListenedChannelsForUser(unsigned int userSession) const;
 
+	/// Calls the given visitor for every user listening to the given channel (in ascending order of the sessions)
+	/// without copying the listeners. The visitor is called as visitor(unsigned int userSession, const
+	/// VolumeAdjustment &volumeAdjustment) while a read lock is held, so it must not modify this manager.
+	///
+	/// @param channelID The ID of the channel
+	/// @param visitor The function to call for every listener
+	template< typename Visitor > void forEachListener(unsigned int channelID, Visitor &&visitor) const {
+		QReadLocker lock(&m_listenerLock);
+
+		auto it = m_listenedChannels.find(channelID);
+		if (it == m_listenedChannels.end()) {
+			return;
+		}
+
+		for (const ListenerEntry &entry : it->second) {
+			visitor(entry.userSession, entry.volumeAdjustment);
+		}
+	}
+
+	/// Calls the given visitor for every channel the given user is listening to without copying the channels. The
+	/// visitor is called as visitor(unsigned int channelID, const VolumeAdjustment &volumeAdjustment) while a read
+	/// lock is held, so it must not modify this manager.
+	///
+	/// @param userSession The session ID of the user
+	/// @param visitor The function to call for every listened channel
+	template< typename Visitor > void forEachListenedChannel(unsigned int userSession, Visitor &&visitor) const {
+		QReadLocker lock(&m_listenerLock);
+
+		auto it = m_listeningUsers.constFind(userSession);
+		if (it == m_listeningUsers.constEnd()) {
+			return;
+		}
+
+		for (unsigned int channelID : it.value()) {
+			const ListenerEntry *entry = findListener(userSession, channelID);
+
+			if (entry) {
+				visitor(channelID, entry->volumeAdjustment);
+			}
+		}
+	}
+
 	/// @param channelID The ID of the channel
 	/// @returns The amount of users that are listening to the given channel
 	int getListenerCountForChannel(unsigned int channelID) const;
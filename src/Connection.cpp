@@ -10,6 +10,8 @@
 #include <QtCore/QtEndian>
 #include <QtNetwork/QHostAddress>
 
+#include <atomic>
+
 #ifdef Q_OS_WIN
 #	include <qos2.h>
 #else
@@ -23,12 +25,24 @@
 HANDLE Connection::hQoS = nullptr;
 #endif
 
+namespace {
+// Connections may live in different threads (e.g. the client's ServerHandler), so these are shared atomically
+std::atomic< quint64 > outputMessages(0);
+std::atomic< quint64 > outputWrites(0);
+std::atomic< quint64 > outputBytes(0);
+std::atomic< quint64 > outputCoalescedMessages(0);
+} // namespace
+
 Connection::Connection(QObject *p, QSslSocket *qtsSock) : QObject(p) {
 	qtsSocket = qtsSock;
 	qtsSocket->setParent(this);
-	iPacketLength        = -1;
-	bDisconnectedEmitted = false;
-	csCrypt              = std::make_unique< CryptStateOCB2 >();
+	iPacketLength          = -1;
+	m_outputMessages       = 0;
+	m_outputFlushScheduled = false;
+	bDisconnectedEmitted   = false;
+#ifndef MURMUR
+	csCrypt = std::make_unique< CryptStateOCB2 >();
+#endif
 
 	static bool bDeclared = false;
 	if (!bDeclared) {
@@ -186,11 +200,62 @@ void Connection::sendMessage(const ::google::protobuf::Message &msg, Mumble::Pro
 }
 
 void Connection::sendMessage(const QByteArray &qbaMsg) {
-	if (!qbaMsg.isEmpty())
+	if (qbaMsg.isEmpty())
+		return;
+
+	outputMessages.fetch_add(1, std::memory_order_relaxed);
+
+	if (m_outputBuffer.isEmpty() && qbaMsg.size() >= OUTPUT_FLUSH_THRESHOLD) {
+		// Nothing to combine the message with, so it is written right away instead of being copied
 		qtsSocket->write(qbaMsg);
+		outputWrites.fetch_add(1, std::memory_order_relaxed);
+		outputBytes.fetch_add(static_cast< quint64 >(qbaMsg.size()), std::memory_order_relaxed);
+		return;
+	}
+
+	m_outputBuffer.append(qbaMsg);
+	++m_outputMessages;
+
+	if (m_outputBuffer.size() >= OUTPUT_FLUSH_THRESHOLD) {
+		flushOutput();
+	} else if (!m_outputFlushScheduled) {
+		m_outputFlushScheduled = true;
+		QMetaObject::invokeMethod(this, &Connection::flushOutput, Qt::QueuedConnection);
+	}
+}
+
+void Connection::flushOutput() {
+	m_outputFlushScheduled = false;
+
+	if (m_outputBuffer.isEmpty())
+		return;
+
+	qtsSocket->write(m_outputBuffer);
+	outputWrites.fetch_add(1, std::memory_order_relaxed);
+	outputBytes.fetch_add(static_cast< quint64 >(m_outputBuffer.size()), std::memory_order_relaxed);
+	outputCoalescedMessages.fetch_add(m_outputMessages - 1, std::memory_order_relaxed);
+
+	m_outputMessages = 0;
+	if (m_outputBuffer.capacity() > 2 * OUTPUT_FLUSH_THRESHOLD) {
+		// Don't keep the memory of a huge message around
+		m_outputBuffer.clear();
+	} else {
+		m_outputBuffer.resize(0);
+	}
+}
+
+ConnectionOutputMetrics Connection::outputMetrics() {
+	ConnectionOutputMetrics metrics;
+	metrics.messages          = outputMessages.load(std::memory_order_relaxed);
+	metrics.writes            = outputWrites.load(std::memory_order_relaxed);
+	metrics.bytes             = outputBytes.load(std::memory_order_relaxed);
+	metrics.coalescedMessages = outputCoalescedMessages.load(std::memory_order_relaxed);
+	return metrics;
 }
 
 void Connection::forceFlush() {
+	flushOutput();
+
 	if (qtsSocket->state() != QAbstractSocket::ConnectedState)
 		return;
 
@@ -206,10 +271,13 @@ void Connection::disconnectSocket(bool force) {
 		return;
 	}
 
-	if (force)
+	if (force) {
 		qtsSocket->abort();
-	else
+	} else {
+		// Messages sent right before disconnecting (e.g. the reason for it) still have to be delivered
+		flushOutput();
 		qtsSocket->disconnectFromHost();
+	}
 }
 
 QHostAddress Connection::peerAddress() const {
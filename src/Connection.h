@@ -28,6 +28,18 @@
 #	include <ws2tcpip.h>
 #endif
 
+/// The number of messages sent through all connections of the process and the number of socket writes they have been
+/// combined into (see Connection::sendMessage)
+struct ConnectionOutputMetrics {
+	quint64 messages = 0;
+	/// Every write is encrypted into TLS records of its own
+	quint64 writes = 0;
+	quint64 bytes  = 0;
+	/// The messages that have been written together with preceding ones, each of which would have needed a TLS
+	/// record and a write of its own otherwise
+	quint64 coalescedMessages = 0;
+};
+
 namespace google {
 namespace protobuf {
 	class Message;
@@ -43,6 +55,12 @@ protected:
 	QElapsedTimer qtLastPacket;
 	Mumble::Protocol::TCPMessageType m_type;
 	int iPacketLength;
+	/// Messages that have been sent but not yet written to the socket
+	QByteArray m_outputBuffer;
+	/// The number of messages in m_outputBuffer
+	quint64 m_outputMessages;
+	/// Whether a call to flushOutput has already been scheduled
+	bool m_outputFlushScheduled;
 #ifdef Q_OS_WIN
 	static HANDLE hQoS;
 	DWORD dwFlow;
@@ -52,6 +70,8 @@ protected slots:
 	void socketError(QAbstractSocket::SocketError);
 	void socketDisconnected();
 	void socketSslErrors(const QList< QSslError > &errors);
+	/// Writes the buffered messages to the socket
+	void flushOutput();
 public slots:
 	void proceedAnyway();
 signals:
@@ -61,23 +81,32 @@ signals:
 	void handleSslErrors(const QList< QSslError > &);
 
 public:
+	/// Messages are buffered until the buffer holds at least this many bytes, which is the largest amount of data a
+	/// TLS record carries, or until the current event loop iteration is done
+	static constexpr qsizetype OUTPUT_FLUSH_THRESHOLD = 16 * 1024;
+
 	Connection(QObject *parent, QSslSocket *qtsSocket);
 	~Connection();
 	static void messageToNetwork(const ::google::protobuf::Message &msg, Mumble::Protocol::TCPMessageType msgType,
 								 QByteArray &cache);
 	void sendMessage(const ::google::protobuf::Message &msg, Mumble::Protocol::TCPMessageType msgType,
 					 QByteArray &cache);
+	/// Sends the given framed message. Messages are collected and written to the socket together (and thus encrypted
+	/// into as few TLS records as possible) once the current event loop iteration is done, unless forceFlush is
+	/// called before.
 	void sendMessage(const QByteArray &qbaMsg);
 	void disconnectSocket(bool force = false);
+	/// Writes the buffered messages to the socket and the socket's buffer to the network
 	void forceFlush();
+	/// @returns The output metrics of all connections of the process
+	static ConnectionOutputMetrics outputMetrics();
 	qint64 activityTime() const;
 	void resetActivityTime();
 
-#ifdef MURMUR
-	/// qmCrypt locks access to csCrypt.
-	QMutex qmCrypt;
-#endif
+#ifndef MURMUR
+	/// The server uses a VoiceCryptState instead
 	std::unique_ptr< CryptState > csCrypt;
+#endif
 	/// Returns the peer's chain of digital certificates, starting with the peer's immediate certificate
 	/// and ending with the CA's certificate.
 	QList< QSslCertificate > peerCertificateChain() const;
@@ -5,44 +5,423 @@
 
 #include "HTMLFilter.h"
 
-#include <QtCore/QXmlStreamReader>
-
-QString HTMLFilter::escapeTags(const QString &in) {
-	QString out;
-	for (int i = 0; i < in.size(); i++) {
-		if (in.at(i) == QLatin1Char('<')) {
-			out += QLatin1String("&lt;");
-		} else if (in.at(i) == QLatin1Char('>')) {
-			out += QLatin1String("&gt;");
-		} else {
-			out += in.at(i);
+#include <QtCore/QVarLengthArray>
+
+namespace {
+
+/// The number of UTF-16 code units the given UTF-8 text decodes to. Every byte that doesn't continue a sequence
+/// starts a new character, characters outside of the BMP take two code units.
+qsizetype utf16Length(std::string_view text) {
+	qsizetype length = 0;
+	for (const char c : text) {
+		const auto byte = static_cast< unsigned char >(c);
+		if ((byte & 0xC0) != 0x80) {
+			length += byte >= 0xF0 ? 2 : 1;
 		}
 	}
-	return out;
+	return length;
 }
 
-bool HTMLFilter::filter(const QString &in, QString &out) {
-	if (!in.contains(QLatin1Char('<'))) {
-		out = in.simplified();
+/// Decodes the UTF-8 encoded character at pos and advances pos past it. Malformed sequences decode to U+FFFD one byte
+/// at a time.
+char32_t decodeUtf8(std::string_view text, std::size_t &pos) {
+	const auto lead = static_cast< unsigned char >(text[pos++]);
+	if (lead < 0x80) {
+		return lead;
+	}
+
+	int continuations;
+	char32_t cp;
+	if ((lead & 0xE0) == 0xC0) {
+		continuations = 1;
+		cp            = lead & 0x1F;
+	} else if ((lead & 0xF0) == 0xE0) {
+		continuations = 2;
+		cp            = lead & 0x0F;
+	} else if ((lead & 0xF8) == 0xF0) {
+		continuations = 3;
+		cp            = lead & 0x07;
 	} else {
-		QXmlStreamReader qxsr(QString::fromLatin1("<document>%1</document>").arg(in));
-		QString qs;
-		while (!qxsr.atEnd()) {
-			switch (qxsr.readNext()) {
-				case QXmlStreamReader::Invalid:
-					return false;
-				case QXmlStreamReader::Characters:
-					qs += qxsr.text();
-					break;
-				case QXmlStreamReader::EndElement:
-					if ((qxsr.name() == QLatin1String("br")) || (qxsr.name() == QLatin1String("p")))
-						qs += QLatin1Char('\n');
-					break;
-				default:
-					break;
-			}
-		}
-		out = escapeTags(qs.simplified());
+		return 0xFFFD;
+	}
+
+	if (pos + static_cast< std::size_t >(continuations) > text.size()) {
+		return 0xFFFD;
+	}
+	for (int i = 0; i < continuations; ++i) {
+		const auto byte = static_cast< unsigned char >(text[pos + static_cast< std::size_t >(i)]);
+		if ((byte & 0xC0) != 0x80) {
+			return 0xFFFD;
+		}
+		cp = (cp << 6) | (byte & 0x3F);
+	}
+	pos += static_cast< std::size_t >(continuations);
+	return cp;
+}
+
+/// Whether QChar::isSpace() is true for the given character
+bool isSpace(char32_t cp) {
+	return (cp >= 0x09 && cp <= 0x0D) || cp == 0x20 || cp == 0x85 || cp == 0xA0 || cp == 0x1680
+		   || (cp >= 0x2000 && cp <= 0x200A) || cp == 0x2028 || cp == 0x2029 || cp == 0x202F || cp == 0x205F
+		   || cp == 0x3000;
+}
+
+bool isAsciiSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool isAsciiLetter(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+bool isAsciiDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+bool isHexDigit(char c) {
+	return isAsciiDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+bool isNameStart(char c) {
+	return isAsciiLetter(c) || c == '_' || c == ':' || static_cast< unsigned char >(c) >= 0x80;
+}
+
+bool isNameChar(char c) {
+	return isNameStart(c) || isAsciiDigit(c) || c == '-' || c == '.';
+}
+
+bool equalsIgnoringCase(std::string_view a, std::string_view b) {
+	if (a.size() != b.size()) {
+		return false;
+	}
+	for (std::size_t i = 0; i < a.size(); ++i) {
+		const char ca = (a[i] >= 'A' && a[i] <= 'Z') ? static_cast< char >(a[i] - 'A' + 'a') : a[i];
+		const char cb = (b[i] >= 'A' && b[i] <= 'Z') ? static_cast< char >(b[i] - 'A' + 'a') : b[i];
+		if (ca != cb) {
+			return false;
+		}
 	}
 	return true;
 }
+
+/// Whether the end of the given element separates lines
+bool endsLine(std::string_view element) {
+	return equalsIgnoringCase(element, "br") || equalsIgnoringCase(element, "p");
+}
+
+/// Writes the plain-text representation of a document, simplifying whitespace on the fly
+class PlainTextWriter {
+public:
+	explicit PlainTextWriter(std::string *out) : m_out(out) {}
+
+	bool isEnabled() const { return m_out; }
+
+	qsizetype length() const { return m_length; }
+
+	void reset() {
+		m_out->clear();
+		m_length       = 0;
+		m_pendingSpace = false;
+	}
+
+	/// Appends the given text, escaping < and >
+	void appendText(std::string_view text) {
+		std::size_t pos = 0;
+		while (pos < text.size()) {
+			const std::size_t start = pos;
+			const char32_t cp       = decodeUtf8(text, pos);
+			if (isSpace(cp)) {
+				appendSpace();
+			} else if (cp == '<') {
+				append("&lt;", 4);
+			} else if (cp == '>') {
+				append("&gt;", 4);
+			} else {
+				append(text.substr(start, pos - start), cp >= 0x10000 ? 2 : 1);
+			}
+		}
+	}
+
+	/// Appends the given character or entity reference as it is
+	void appendReference(std::string_view reference) { append(reference, utf16Length(reference)); }
+
+	/// Separates the text before and after, unless at the start or end of the text
+	void appendSpace() { m_pendingSpace = m_length > 0; }
+
+private:
+	std::string *m_out;
+	qsizetype m_length  = 0;
+	bool m_pendingSpace = false;
+
+	void append(std::string_view text, qsizetype length) {
+		if (m_pendingSpace) {
+			m_out->push_back(' ');
+			++m_length;
+			m_pendingSpace = false;
+		}
+		m_out->append(text);
+		m_length += length;
+	}
+};
+
+/// Scans a document, see HTMLFilter::scan
+class Scanner {
+public:
+	Scanner(std::string_view in, std::string *plainText) : m_in(in), m_writer(plainText) {}
+
+	/// @returns Whether the document is well-formed
+	bool run() {
+		while (m_pos < m_in.size()) {
+			const std::size_t next = m_in.find_first_of("<&", m_pos);
+			const std::size_t end  = next == std::string_view::npos ? m_in.size() : next;
+
+			if (m_writer.isEnabled()) {
+				m_writer.appendText(m_in.substr(m_pos, end - m_pos));
+			}
+			m_pos = end;
+
+			if (m_pos == m_in.size()) {
+				break;
+			}
+
+			if (!(m_in[m_pos] == '&' ? reference(true) : markup())) {
+				return false;
+			}
+		}
+
+		return m_open.isEmpty();
+	}
+
+	/// The length of the src attributes of img elements
+	qsizetype imageLength() const { return m_imageLength; }
+
+	PlainTextWriter &writer() { return m_writer; }
+
+private:
+	std::string_view m_in;
+	std::size_t m_pos = 0;
+	PlainTextWriter m_writer;
+	/// The names of the elements that haven't been closed yet
+	QVarLengthArray< std::string_view, 32 > m_open;
+	qsizetype m_imageLength = 0;
+
+	bool startsWith(std::string_view prefix) const { return m_in.substr(m_pos, prefix.size()) == prefix; }
+
+	void skipSpace() {
+		while (m_pos < m_in.size() && isAsciiSpace(m_in[m_pos])) {
+			++m_pos;
+		}
+	}
+
+	std::string_view name() {
+		const std::size_t start = m_pos;
+		if (m_pos < m_in.size() && isNameStart(m_in[m_pos])) {
+			++m_pos;
+			while (m_pos < m_in.size() && isNameChar(m_in[m_pos])) {
+				++m_pos;
+			}
+		}
+		return m_in.substr(start, m_pos - start);
+	}
+
+	/// Skips past the given terminator
+	/// @returns The text before the terminator, or a null view if it is missing
+	std::string_view until(std::string_view terminator) {
+		const std::size_t end = m_in.find(terminator, m_pos);
+		if (end == std::string_view::npos) {
+			return std::string_view();
+		}
+
+		const std::string_view text = m_in.substr(m_pos, end - m_pos);
+		m_pos                       = end + terminator.size();
+		return text;
+	}
+
+	/// Checks the character or entity reference at the current position (e.g. "&amp;" or "&#60;") and skips it
+	bool reference(bool write) {
+		const std::size_t start = m_pos++;
+
+		if (m_pos < m_in.size() && m_in[m_pos] == '#') {
+			++m_pos;
+			const bool hex = m_pos < m_in.size() && (m_in[m_pos] == 'x' || m_in[m_pos] == 'X');
+			if (hex) {
+				++m_pos;
+			}
+			const std::size_t digits = m_pos;
+			while (m_pos < m_in.size() && (hex ? isHexDigit(m_in[m_pos]) : isAsciiDigit(m_in[m_pos]))) {
+				++m_pos;
+			}
+			if (m_pos == digits) {
+				return false;
+			}
+		} else {
+			if (m_pos >= m_in.size() || !isAsciiLetter(m_in[m_pos])) {
+				return false;
+			}
+			while (m_pos < m_in.size() && (isAsciiLetter(m_in[m_pos]) || isAsciiDigit(m_in[m_pos]))) {
+				++m_pos;
+			}
+		}
+
+		if (m_pos >= m_in.size() || m_in[m_pos] != ';') {
+			return false;
+		}
+		++m_pos;
+
+		if (write && m_writer.isEnabled()) {
+			m_writer.appendReference(m_in.substr(start, m_pos - start));
+		}
+		return true;
+	}
+
+	/// Checks the tag, comment, CDATA section or processing instruction at the current position and skips it
+	bool markup() {
+		if (startsWith("<!--")) {
+			m_pos += 4;
+			return until("-->").data();
+		}
+		if (startsWith("<![CDATA[")) {
+			m_pos += 9;
+			const std::string_view text = until("]]>");
+			if (!text.data()) {
+				return false;
+			}
+			if (m_writer.isEnabled()) {
+				m_writer.appendText(text);
+			}
+			return true;
+		}
+		if (startsWith("<?")) {
+			m_pos += 2;
+			return until("?>").data();
+		}
+		if (startsWith("</")) {
+			return endTag();
+		}
+		return startTag();
+	}
+
+	bool endTag() {
+		m_pos += 2;
+		const std::string_view element = name();
+		skipSpace();
+		if (element.empty() || m_pos >= m_in.size() || m_in[m_pos] != '>') {
+			return false;
+		}
+		++m_pos;
+
+		if (m_open.isEmpty() || m_open.back() != element) {
+			return false;
+		}
+		m_open.removeLast();
+
+		if (endsLine(element)) {
+			m_writer.appendSpace();
+		}
+		return true;
+	}
+
+	bool startTag() {
+		++m_pos;
+		const std::string_view element = name();
+		if (element.empty()) {
+			return false;
+		}
+		const bool image = equalsIgnoringCase(element, "img");
+
+		while (true) {
+			const std::size_t beforeSpace = m_pos;
+			skipSpace();
+			if (m_pos >= m_in.size()) {
+				return false;
+			}
+
+			if (m_in[m_pos] == '>') {
+				++m_pos;
+				m_open.append(element);
+				return true;
+			}
+			if (startsWith("/>")) {
+				m_pos += 2;
+				if (endsLine(element)) {
+					m_writer.appendSpace();
+				}
+				return true;
+			}
+
+			// Attributes are separated by whitespace
+			if (m_pos == beforeSpace || !attribute(image)) {
+				return false;
+			}
+		}
+	}
+
+	/// Checks the attribute at the current position (e.g. src="...") and skips it
+	bool attribute(bool image) {
+		const std::size_t start          = m_pos;
+		const std::string_view attribute = name();
+		if (attribute.empty()) {
+			return false;
+		}
+
+		skipSpace();
+		if (m_pos >= m_in.size() || m_in[m_pos] != '=') {
+			return false;
+		}
+		++m_pos;
+		skipSpace();
+		if (m_pos >= m_in.size() || (m_in[m_pos] != '"' && m_in[m_pos] != '\'')) {
+			return false;
+		}
+		const char quote = m_in[m_pos++];
+
+		while (true) {
+			const std::size_t next = m_in.find_first_of(quote == '"' ? "\"<&" : "'<&", m_pos);
+			if (next == std::string_view::npos || m_in[next] == '<') {
+				return false;
+			}
+			m_pos = next;
+			if (m_in[m_pos] == quote) {
+				++m_pos;
+				break;
+			}
+			if (!reference(false)) {
+				return false;
+			}
+		}
+
+		if (image && equalsIgnoringCase(attribute, "src")) {
+			m_imageLength += utf16Length(m_in.substr(start, m_pos - start));
+		}
+		return true;
+	}
+};
+
+} // namespace
+
+HTMLScan HTMLFilter::scan(std::string_view in, std::string *plainText) {
+	if (plainText) {
+		plainText->clear();
+		plainText->reserve(in.size());
+	}
+
+	HTMLScan result;
+	result.length = utf16Length(in);
+
+	Scanner scanner(in, plainText);
+	result.wellFormed = scanner.run();
+
+	if (result.wellFormed) {
+		result.textLength = result.length - scanner.imageLength();
+	} else {
+		result.textLength = result.length;
+
+		if (plainText) {
+			scanner.writer().reset();
+			scanner.writer().appendText(in);
+		}
+	}
+
+	result.plainTextLength = scanner.writer().length();
+	return result;
+}
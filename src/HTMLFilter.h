@@ -6,33 +6,54 @@
 #ifndef MUMBLE_HTMLFILTER_H_
 #define MUMBLE_HTMLFILTER_H_
 
-#include <QString>
+#include <QtGlobal>
 
-/// HTMLFilter provides utilitites for
-/// creating a plain text representaton
-/// of a HTML document.
+#include <string>
+#include <string_view>
+
+/// HTMLScan is the result of HTMLFilter::scan.
 ///
-/// It is used for converting Mumble
-/// text messages, comments, and more
-/// to plain text when a server is
+/// All lengths are counted in UTF-16 code units, which
+/// is what QString::length() returns for the same text.
+struct HTMLScan {
+	/// Whether the document is well-formed: every element
+	/// is closed in the right order, attribute values are
+	/// quoted and & only starts character or entity references.
+	bool wellFormed = false;
+	/// The length of the document.
+	qsizetype length = 0;
+	/// The length of the document without the src attributes
+	/// of img elements, i.e. without embedded images. Equal to
+	/// length if the document isn't well-formed.
+	qsizetype textLength = 0;
+	/// The length of the plain-text representation, if it
+	/// was requested.
+	qsizetype plainTextLength = 0;
+};
+
+/// HTMLFilter provides utilitites for
+/// checking Mumble text messages, comments,
+/// and more, and for creating a plain text
+/// representaton of them when a server is
 /// configured to disallow HTML.
 class HTMLFilter {
-	/// escapeTags returns the in HTML document
-	/// with all occurrences of > and <
-	/// replaced by &lt; and &gt;.
-	static QString escapeTags(const QString &in);
-
 public:
-	/// filter does a best-effort conversion of the
-	/// in HTML document to a plain-text representation.
+	/// scan checks and measures the in HTML document,
+	/// which is UTF-8 encoded (as it is received from
+	/// clients), in a single pass over it.
 	///
-	/// If the filtering process succeeded, the function
-	/// writes the filtered document as plain text to
-	/// out, and returns true.
+	/// If plainText isn't null, scan also writes a
+	/// best-effort plain-text representation of the
+	/// document to it: the text of the document with
+	/// whitespace simplified (as by QString::simplified)
+	/// and < and > escaped. Character and entity references
+	/// are kept as they are. A document that isn't
+	/// well-formed is treated as text as a whole.
 	///
-	/// If the filtering failed, the function returns false
-	/// and out is left unchanged.
-	static bool filter(const QString &in, QString &out);
+	/// scan doesn't allocate, except for the plain-text
+	/// representation and for elements nested deeper than
+	/// a few levels.
+	static HTMLScan scan(std::string_view in, std::string *plainText = nullptr);
 };
 
 #endif
@@ -20,34 +20,35 @@
  *
  * Warning: Only append to the end. Never insert in between or remove an existing entry.
  */
-#define MUMBLE_ALL_TCP_MESSAGES                         \
-	PROCESS_MUMBLE_TCP_MESSAGE(Version, 0)              \
-	PROCESS_MUMBLE_TCP_MESSAGE(UDPTunnel, 1)            \
-	PROCESS_MUMBLE_TCP_MESSAGE(Authenticate, 2)         \
-	PROCESS_MUMBLE_TCP_MESSAGE(Ping, 3)                 \
-	PROCESS_MUMBLE_TCP_MESSAGE(Reject, 4)               \
-	PROCESS_MUMBLE_TCP_MESSAGE(ServerSync, 5)           \
-	PROCESS_MUMBLE_TCP_MESSAGE(ChannelRemove, 6)        \
-	PROCESS_MUMBLE_TCP_MESSAGE(ChannelState, 7)         \
-	PROCESS_MUMBLE_TCP_MESSAGE(UserRemove, 8)           \
-	PROCESS_MUMBLE_TCP_MESSAGE(UserState, 9)            \
-	PROCESS_MUMBLE_TCP_MESSAGE(BanList, 10)             \
-	PROCESS_MUMBLE_TCP_MESSAGE(TextMessage, 11)         \
-	PROCESS_MUMBLE_TCP_MESSAGE(PermissionDenied, 12)    \
-	PROCESS_MUMBLE_TCP_MESSAGE(ACL, 13)                 \
-	PROCESS_MUMBLE_TCP_MESSAGE(QueryUsers, 14)          \
-	PROCESS_MUMBLE_TCP_MESSAGE(CryptSetup, 15)          \
-	PROCESS_MUMBLE_TCP_MESSAGE(ContextActionModify, 16) \
-	PROCESS_MUMBLE_TCP_MESSAGE(ContextAction, 17)       \
-	PROCESS_MUMBLE_TCP_MESSAGE(UserList, 18)            \
-	PROCESS_MUMBLE_TCP_MESSAGE(VoiceTarget, 19)         \
-	PROCESS_MUMBLE_TCP_MESSAGE(PermissionQuery, 20)     \
-	PROCESS_MUMBLE_TCP_MESSAGE(CodecVersion, 21)        \
-	PROCESS_MUMBLE_TCP_MESSAGE(UserStats, 22)           \
-	PROCESS_MUMBLE_TCP_MESSAGE(RequestBlob, 23)         \
-	PROCESS_MUMBLE_TCP_MESSAGE(ServerConfig, 24)        \
-	PROCESS_MUMBLE_TCP_MESSAGE(SuggestConfig, 25)       \
-	PROCESS_MUMBLE_TCP_MESSAGE(PluginDataTransmission, 26)
+#define MUMBLE_ALL_TCP_MESSAGES                            \
+	PROCESS_MUMBLE_TCP_MESSAGE(Version, 0)                 \
+	PROCESS_MUMBLE_TCP_MESSAGE(UDPTunnel, 1)               \
+	PROCESS_MUMBLE_TCP_MESSAGE(Authenticate, 2)            \
+	PROCESS_MUMBLE_TCP_MESSAGE(Ping, 3)                    \
+	PROCESS_MUMBLE_TCP_MESSAGE(Reject, 4)                  \
+	PROCESS_MUMBLE_TCP_MESSAGE(ServerSync, 5)              \
+	PROCESS_MUMBLE_TCP_MESSAGE(ChannelRemove, 6)           \
+	PROCESS_MUMBLE_TCP_MESSAGE(ChannelState, 7)            \
+	PROCESS_MUMBLE_TCP_MESSAGE(UserRemove, 8)              \
+	PROCESS_MUMBLE_TCP_MESSAGE(UserState, 9)               \
+	PROCESS_MUMBLE_TCP_MESSAGE(BanList, 10)                \
+	PROCESS_MUMBLE_TCP_MESSAGE(TextMessage, 11)            \
+	PROCESS_MUMBLE_TCP_MESSAGE(PermissionDenied, 12)       \
+	PROCESS_MUMBLE_TCP_MESSAGE(ACL, 13)                    \
+	PROCESS_MUMBLE_TCP_MESSAGE(QueryUsers, 14)             \
+	PROCESS_MUMBLE_TCP_MESSAGE(CryptSetup, 15)             \
+	PROCESS_MUMBLE_TCP_MESSAGE(ContextActionModify, 16)    \
+	PROCESS_MUMBLE_TCP_MESSAGE(ContextAction, 17)          \
+	PROCESS_MUMBLE_TCP_MESSAGE(UserList, 18)               \
+	PROCESS_MUMBLE_TCP_MESSAGE(VoiceTarget, 19)            \
+	PROCESS_MUMBLE_TCP_MESSAGE(PermissionQuery, 20)        \
+	PROCESS_MUMBLE_TCP_MESSAGE(CodecVersion, 21)           \
+	PROCESS_MUMBLE_TCP_MESSAGE(UserStats, 22)              \
+	PROCESS_MUMBLE_TCP_MESSAGE(RequestBlob, 23)            \
+	PROCESS_MUMBLE_TCP_MESSAGE(ServerConfig, 24)           \
+	PROCESS_MUMBLE_TCP_MESSAGE(SuggestConfig, 25)          \
+	PROCESS_MUMBLE_TCP_MESSAGE(PluginDataTransmission, 26) \
+	PROCESS_MUMBLE_TCP_MESSAGE(TextMessageImage, 27)
 
 /**
  * "X-macro" for all Mumble Protobuf UDP messages types.
@@ -66,6 +67,14 @@ namespace Protocol {
 	// The maximum allowed size in bytes of UDP packets (according to the Mumble protocol)
 	constexpr std::size_t MAX_UDP_PACKET_SIZE = 1024;
 
+	// The size in bytes of the token (see MumbleProto::CryptSetup::udp_token) that clients prefix their encrypted
+	// UDP packets with until the server knows their UDP address
+	constexpr std::size_t UDP_TOKEN_SIZE = 8;
+
+	// The URL scheme of the references ("mumble-image:<hex encoded SHA1 hash>") that replace images embedded in text
+	// messages sent to clients that fetch them on demand (see MumbleProto::Authenticate::image_references)
+	constexpr const char *TEXT_MESSAGE_IMAGE_SCHEME = "mumble-image";
+
 #define PROCESS_MUMBLE_TCP_MESSAGE(name, value) name = value,
 	/**
 	 * Enum holding all possible TCP message types
@@ -0,0 +1,187 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+// Measures the permission checks on a server with 5,000 channels and 2,000 users, every one of which has been told
+// about its permissions in a few channels. "FullClear" is what every change of an ACL or group used to cause:
+// discarding all cached permissions and evaluating them again. "SubtreeInvalidation" only discards the compiled ACLs
+// and permissions of the changed channel and its subchannels.
+
+#include <benchmark/benchmark.h>
+
+#include "ACL.h"
+#include "ACLProgram.h"
+#include "Channel.h"
+#include "Group.h"
+#include "User.h"
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+constexpr unsigned int CHANNEL_COUNT = 5000;
+constexpr int USER_COUNT             = 2000;
+/// The number of channels every user has been told about its permissions in (besides its own)
+constexpr int KNOWN_CHANNELS = 8;
+
+struct ChannelTree {
+	std::unique_ptr< Channel > root;
+	std::vector< Channel * > channels;
+	std::vector< std::unique_ptr< User > > users;
+	QStringList accessTokens;
+	/// The (user, channel) pairs whose permissions are cached
+	std::vector< std::pair< ACLSubject, const Channel * > > known;
+};
+
+static ChanACL *addACL(Channel *channel, const QString &group, ChanACL::Permissions allow, ChanACL::Permissions deny) {
+	ChanACL *acl = new ChanACL(channel);
+	acl->qsGroup = group;
+	acl->pAllow  = allow;
+	acl->pDeny   = deny;
+
+	return acl;
+}
+
+/// Builds a tree resembling the one of a large community server: a few categories with many (nested) channels, each
+/// of which restricts some permissions to its own groups
+static std::unique_ptr< ChannelTree > buildTree() {
+	std::mt19937 rng(42);
+	auto tree = std::make_unique< ChannelTree >();
+
+	tree->root = std::make_unique< Channel >(0, QLatin1String("Root"));
+	tree->channels.push_back(tree->root.get());
+
+	Group *admin = new Group(tree->root.get(), QLatin1String("admin"));
+	addACL(tree->root.get(), QLatin1String("admin"), ChanACL::Write, ChanACL::None);
+	addACL(tree->root.get(), QLatin1String("auth"), ChanACL::MakeTempChannel, ChanACL::None);
+	addACL(tree->root.get(), QLatin1String("all"), ChanACL::None, ChanACL::MakeChannel);
+
+	for (unsigned int id = 1; id < CHANNEL_COUNT; ++id) {
+		// Prefer recent channels as parents, which results in channels that are about 10 levels deep on average
+		const std::size_t window = std::min< std::size_t >(tree->channels.size(), 50);
+		Channel *parent          = tree->channels[tree->channels.size() - 1 - rng() % window];
+		if (rng() % 10 == 0) {
+			parent = tree->root.get();
+		}
+
+		Channel *channel = new Channel(id, QString::number(id), parent);
+		tree->channels.push_back(channel);
+
+		switch (rng() % 8) {
+			case 0: {
+				Group *members = new Group(channel, QLatin1String("members"));
+				for (int i = 0; i < 20; ++i) {
+					members->qsAdd << static_cast< int >(rng() % USER_COUNT) + 1;
+				}
+				addACL(channel, QLatin1String("all"), ChanACL::None, ChanACL::Enter | ChanACL::Speak);
+				addACL(channel, QLatin1String("members"), ChanACL::Enter | ChanACL::Speak, ChanACL::None);
+				break;
+			}
+			case 1:
+				addACL(channel, QLatin1String("~sub,0,1"), ChanACL::MakeTempChannel, ChanACL::None);
+				addACL(channel, QLatin1String("!~in"), ChanACL::None, ChanACL::TextMessage);
+				break;
+			case 2:
+				addACL(channel, QLatin1String("#secret"), ChanACL::Enter, ChanACL::None);
+				addACL(channel, QLatin1String("strong"), ChanACL::Whisper, ChanACL::None);
+				break;
+			default:
+				break;
+		}
+	}
+
+	for (int i = 0; i < 10; ++i) {
+		admin->qsAdd << static_cast< int >(rng() % USER_COUNT) + 1;
+	}
+
+	tree->accessTokens << QLatin1String("secret");
+	for (int i = 0; i < USER_COUNT; ++i) {
+		auto user       = std::make_unique< User >();
+		user->iId       = i % 4 == 0 ? -1 : i + 1;
+		user->uiSession = static_cast< unsigned int >(i) + 1;
+		user->cChannel  = tree->channels[rng() % tree->channels.size()];
+
+		const ACLSubject subject = { user.get(), i % 2 == 0, &tree->accessTokens };
+		tree->known.emplace_back(subject, user->cChannel);
+		for (int j = 0; j < KNOWN_CHANNELS; ++j) {
+			tree->known.emplace_back(subject, tree->channels[rng() % tree->channels.size()]);
+		}
+
+		tree->users.push_back(std::move(user));
+	}
+
+	return tree;
+}
+
+static void BM_compile(benchmark::State &state) {
+	const std::unique_ptr< ChannelTree > tree = buildTree();
+
+	std::mt19937 rng(7);
+	for (auto _ : state) {
+		ACLProgram program(tree->channels[rng() % tree->channels.size()]);
+		benchmark::DoNotOptimize(program);
+	}
+
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations()));
+}
+
+static void BM_evaluate(benchmark::State &state) {
+	const std::unique_ptr< ChannelTree > tree = buildTree();
+
+	std::vector< std::unique_ptr< ACLProgram > > programs;
+	for (const Channel *channel : tree->channels) {
+		programs.push_back(std::make_unique< ACLProgram >(channel));
+	}
+
+	std::mt19937 rng(7);
+	for (auto _ : state) {
+		const auto &known = tree->known[rng() % tree->known.size()];
+		benchmark::DoNotOptimize(programs[known.second->iId]->evaluate(known.first));
+	}
+
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations()));
+}
+
+/// Discards the cached permissions after a change of the ACLs of a random channel and refreshes all permissions
+/// the users have been told about
+template< bool subtree > static void invalidateAndRefresh(benchmark::State &state) {
+	const std::unique_ptr< ChannelTree > tree = buildTree();
+
+	PermissionCache cache;
+	for (const auto &known : tree->known) {
+		cache.permissions(known.first, known.second);
+	}
+
+	std::mt19937 rng(7);
+	for (auto _ : state) {
+		const Channel *changed = tree->channels[rng() % tree->channels.size()];
+		if (subtree) {
+			benchmark::DoNotOptimize(cache.invalidateChannel(changed));
+		} else {
+			cache.clear();
+		}
+
+		for (const auto &known : tree->known) {
+			benchmark::DoNotOptimize(cache.permissions(known.first, known.second));
+		}
+	}
+
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations()));
+}
+
+static void BM_fullClear(benchmark::State &state) {
+	invalidateAndRefresh< false >(state);
+}
+
+static void BM_subtreeInvalidation(benchmark::State &state) {
+	invalidateAndRefresh< true >(state);
+}
+
+BENCHMARK(BM_compile)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_evaluate)->Unit(benchmark::kNanosecond);
+BENCHMARK(BM_fullClear)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_subtreeInvalidation)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
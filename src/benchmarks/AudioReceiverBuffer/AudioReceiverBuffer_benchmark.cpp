@@ -9,7 +9,11 @@
 #include "MumbleProtocol.h"
 
 #include <algorithm>
+#include <cstdint>
+#include <memory>
 #include <random>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 std::random_device rd;
@@ -153,6 +157,173 @@ BENCHMARK_REGISTER_F(Fixture, BM_full)
 					{ 0, 10, 40, 80 } });
 
 
+// Regular speech in a channel that is linked to other channels and that has listeners. The speaker's audio has to
+// reach the members and the listeners of its own channel and of all linked channels. Some listeners are also members
+// of (or listeners in) one of the other channels, so the same receiver may be encountered multiple times.
+constexpr const std::size_t MEMBER_COUNT_RANGE = 0;
+constexpr const std::size_t LINK_COUNT_RANGE   = 1;
+
+struct ChannelTopology {
+	std::vector< std::unique_ptr< ServerUser > > users;
+	std::unordered_map< unsigned int, ServerUser * > usersBySession;
+	/// Index 0 is the speaker's channel, all others are linked to it
+	std::vector< std::vector< ServerUser * > > members;
+	std::vector< std::vector< unsigned int > > listenerSessions;
+	/// Maps (session << 32 | channel) to the listener's volume adjustment
+	std::unordered_map< std::uint64_t, VolumeAdjustment > listenerVolumes;
+
+	ServerUser *sender = nullptr;
+	/// The deduplicated receivers of the sender's regular speech, as precomputed by the server
+	std::vector< ReceiverData > fanOut;
+
+	/// Use a fixed seed, so that every run of a benchmark (and both benchmarks) route within the same topology
+	std::mt19937 topologyRng{ 42 };
+
+	ServerUser *createUser() {
+		const unsigned int session = static_cast< unsigned int >(users.size());
+
+		users.push_back(std::make_unique< ServerUser >(session, random_version(topologyRng)));
+		usersBySession[session] = users.back().get();
+
+		return users.back().get();
+	}
+
+	static std::uint64_t listenerKey(unsigned int session, std::size_t channel) {
+		return (static_cast< std::uint64_t >(session) << 32) | channel;
+	}
+
+	ChannelTopology(std::size_t membersPerChannel, std::size_t linkCount)
+		: members(linkCount + 1), listenerSessions(linkCount + 1) {
+		for (std::vector< ServerUser * > &channelMembers : members) {
+			for (std::size_t i = 0; i < membersPerChannel; ++i) {
+				channelMembers.push_back(createUser());
+			}
+		}
+
+		// Users in unrelated channels that only listen
+		for (std::size_t i = 0; i < membersPerChannel; ++i) {
+			createUser();
+		}
+
+		// Every channel is listened to by a quarter of its member count, picked from all users
+		std::uniform_int_distribution< std::size_t > random_user(0, users.size() - 1);
+		for (std::size_t channel = 0; channel < listenerSessions.size(); ++channel) {
+			for (std::size_t i = 0; i < std::max< std::size_t >(membersPerChannel / 4, 1); ++i) {
+				const unsigned int session = users[random_user(topologyRng)]->uiSession;
+
+				listenerSessions[channel].push_back(session);
+				listenerVolumes[listenerKey(session, channel)] =
+					VolumeAdjustment::fromDBAdjustment(random_volume_adjustment(topologyRng));
+			}
+		}
+
+		sender = members[0][0];
+
+		// Precompute the fan-out the way RoutingSnapshot::buildFanOuts does
+		std::unordered_map< const ServerUser *, std::size_t > indices;
+		auto add = [&](ServerUser *receiver, Mumble::Protocol::audio_context_t context,
+					   const VolumeAdjustment &volumeAdjustment) {
+			auto it = indices.find(receiver);
+			if (it == indices.end()) {
+				indices[receiver] = fanOut.size();
+				fanOut.push_back({ receiver, context, false, volumeAdjustment });
+			} else {
+				ReceiverData &entry = fanOut[it->second];
+
+				entry.context = std::min(entry.context, context);
+				if (entry.volumeAdjustment.factor < volumeAdjustment.factor) {
+					entry.volumeAdjustment = volumeAdjustment;
+				}
+			}
+		};
+
+		for (std::size_t channel = 0; channel < members.size(); ++channel) {
+			for (unsigned int session : listenerSessions[channel]) {
+				add(usersBySession[session], Mumble::Protocol::AudioContext::LISTEN,
+					listenerVolumes[listenerKey(session, channel)]);
+			}
+			for (ServerUser *member : members[channel]) {
+				add(member, Mumble::Protocol::AudioContext::NORMAL, VolumeAdjustment::fromFactor(1.0f));
+			}
+		}
+	}
+};
+
+std::unique_ptr< ChannelTopology > topology;
+
+class LinkedChannelFixture : public ::benchmark::Fixture {
+public:
+	void SetUp(const ::benchmark::State &state) {
+		topology = std::make_unique< ChannelTopology >(static_cast< std::size_t >(state.range(MEMBER_COUNT_RANGE)),
+													   static_cast< std::size_t >(state.range(LINK_COUNT_RANGE)));
+	}
+
+	void TearDown(const ::benchmark::State &) { topology.reset(); }
+};
+
+// Mirrors routing without a precomputed fan-out: the set of linked channels, the listeners (and their volume
+// adjustments) and the members are looked up for every single packet and duplicates are merged by the buffer.
+BENCHMARK_DEFINE_F(LinkedChannelFixture, BM_routeRecompute)(::benchmark::State &state) {
+	AudioReceiverBuffer buffer;
+
+	for (auto _ : state) {
+		std::unordered_set< std::size_t > linkedChannels;
+		for (std::size_t channel = 1; channel < topology->members.size(); ++channel) {
+			linkedChannels.insert(channel);
+		}
+
+		auto addChannel = [&](std::size_t channel) {
+			for (unsigned int session : topology->listenerSessions[channel]) {
+				auto it = topology->usersBySession.find(session);
+				if (it != topology->usersBySession.end()) {
+					buffer.addReceiver(*topology->sender, *it->second, Mumble::Protocol::AudioContext::LISTEN, false,
+									   topology->listenerVolumes[ChannelTopology::listenerKey(session, channel)]);
+				}
+			}
+
+			for (ServerUser *member : topology->members[channel]) {
+				buffer.addReceiver(*topology->sender, *member, Mumble::Protocol::AudioContext::NORMAL, false);
+			}
+		};
+
+		addChannel(0);
+		for (std::size_t channel : linkedChannels) {
+			addChannel(channel);
+		}
+
+		benchmark::DoNotOptimize(buffer.getReceivers(false).data());
+
+		buffer.clear();
+	}
+
+	state.counters["unique receivers"] = static_cast< double >(topology->fanOut.size() - 1);
+}
+
+BENCHMARK_REGISTER_F(LinkedChannelFixture, BM_routeRecompute)->ArgsProduct({ { 4, 16, 64 }, { 0, 2, 8 } });
+
+// Walks the precomputed, duplicate-free fan-out of the sender
+BENCHMARK_DEFINE_F(LinkedChannelFixture, BM_routeFanOut)(::benchmark::State &state) {
+	AudioReceiverBuffer buffer;
+
+	for (auto _ : state) {
+		for (const ReceiverData &receiver : topology->fanOut) {
+			if (receiver.receiver != topology->sender) {
+				buffer.addUniqueReceiver(*receiver.receiver, receiver.context, receiver.containsPositionalData,
+										 receiver.volumeAdjustment);
+			}
+		}
+
+		benchmark::DoNotOptimize(buffer.getReceivers(false).data());
+
+		buffer.clear();
+	}
+
+	state.counters["unique receivers"] = static_cast< double >(topology->fanOut.size() - 1);
+}
+
+BENCHMARK_REGISTER_F(LinkedChannelFixture, BM_routeFanOut)->ArgsProduct({ { 4, 16, 64 }, { 0, 2, 8 } });
+
+
 int main(int argc, char **argv) {
 	globalInit();
 
@@ -0,0 +1,119 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+// Compares the cost of checking a single connecting client against a list of bans (as imported from public block
+// lists: mostly IPv4 ranges, some IPv6 ranges and a share of temporary bans). "Linear" is what Server::newClient used
+// to do for every connection: copying the list, checking every ban for expiry and matching the address against every
+// ban. "Indexed" is the BanIndex lookup, including the check for expired bans.
+
+#include <benchmark/benchmark.h>
+
+#include "BanIndex.h"
+
+#include <QtCore/QDateTime>
+
+#include <cstdint>
+#include <random>
+
+constexpr std::size_t BAN_COUNT_RANGE = 0;
+
+static HostAddress randomAddress(std::mt19937 &rng, bool ipv6) {
+	HostAddress address;
+	if (ipv6) {
+		address.reset();
+		// Global unicast
+		address.setByte(0, static_cast< std::uint8_t >(0x20 | (rng() & 0x0F)));
+		for (std::size_t i = 1; i < 16; ++i) {
+			address.setByte(i, static_cast< std::uint8_t >(rng()));
+		}
+	} else {
+		address.fromIPv4(static_cast< std::uint32_t >(rng()));
+	}
+
+	return address;
+}
+
+static QList< Ban > generateBans(std::size_t count) {
+	std::mt19937 rng(42);
+	const QDateTime now = QDateTime::currentDateTimeUtc();
+
+	QList< Ban > bans;
+	bans.reserve(static_cast< qsizetype >(count));
+	for (std::size_t i = 0; i < count; ++i) {
+		const bool ipv6 = i % 10 == 0;
+
+		Ban ban;
+		ban.haAddress = randomAddress(rng, ipv6);
+		// IPv4 ranges between /16 and /32, IPv6 ranges between /32 and /128
+		ban.iMask     = ipv6 ? static_cast< int >(32 + rng() % 97) : static_cast< int >(96 + 16 + rng() % 17);
+		ban.qsReason  = QLatin1String("Imported");
+		ban.qdtStart  = now;
+		// Every fourth ban is temporary, but doesn't expire while the benchmark runs
+		ban.iDuration = i % 4 == 0 ? 86400 : 0;
+
+		bans << ban;
+	}
+
+	return bans;
+}
+
+static void BM_linearMatch(benchmark::State &state) {
+	const QList< Ban > bans = generateBans(static_cast< std::size_t >(state.range(BAN_COUNT_RANGE)));
+
+	std::mt19937 rng(7);
+	for (auto _ : state) {
+		const HostAddress address = randomAddress(rng, rng() % 10 == 0);
+
+		QList< Ban > tmpBans = bans;
+		foreach (const Ban &ban, bans) {
+			if (ban.isExpired())
+				tmpBans.removeOne(ban);
+		}
+
+		bool banned = false;
+		foreach (const Ban &ban, tmpBans) {
+			if (ban.haAddress.match(address, static_cast< unsigned int >(ban.iMask))) {
+				banned = true;
+				break;
+			}
+		}
+		benchmark::DoNotOptimize(banned);
+	}
+
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations()));
+}
+
+static void BM_indexedMatch(benchmark::State &state) {
+	BanIndex index;
+	index.rebuild(generateBans(static_cast< std::size_t >(state.range(BAN_COUNT_RANGE))));
+
+	std::mt19937 rng(7);
+	for (auto _ : state) {
+		const HostAddress address = randomAddress(rng, rng() % 10 == 0);
+
+		benchmark::DoNotOptimize(index.takeExpired(QDateTime::currentDateTimeUtc()));
+		benchmark::DoNotOptimize(index.match(address));
+	}
+
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations()));
+}
+
+static void BM_rebuild(benchmark::State &state) {
+	const QList< Ban > bans = generateBans(static_cast< std::size_t >(state.range(BAN_COUNT_RANGE)));
+
+	BanIndex index;
+	for (auto _ : state) {
+		index.rebuild(bans);
+		benchmark::DoNotOptimize(index.size());
+	}
+
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations()) * state.range(BAN_COUNT_RANGE));
+}
+
+BENCHMARK(BM_linearMatch)->RangeMultiplier(10)->Range(1000, 100000)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_indexedMatch)->RangeMultiplier(10)->Range(1000, 100000)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_rebuild)->RangeMultiplier(10)->Range(1000, 100000)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,334 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+// Measures reading the channel tree of a virtual server from a generated SQLite database. "PerChannelQueries" is how
+// the channels used to be read at boot: one query for the subchannels, the channel information, the groups and the
+// ACLs of every channel plus one query for the members of every group. "BulkLoad" reads every table with a single
+// query and assembles the tree with the ChannelTreeBuilder.
+
+#include <benchmark/benchmark.h>
+
+#include "ACL.h"
+#include "Channel.h"
+#include "ChannelTreeBuilder.h"
+#include "Group.h"
+#include "ServerDB.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QVariant>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+constexpr int SERVER_ID = 1;
+
+static QTemporaryDir *databaseDir = nullptr;
+
+static QString connectionName(int channelCount) {
+	return QString::fromLatin1("channels%1").arg(channelCount);
+}
+
+static void exec(QSqlQuery &query, const QString &sql) {
+	if (!query.exec(sql)) {
+		qFatal("Failed to execute \"%s\"", qPrintable(sql));
+	}
+}
+
+/// Creates a database with the schema of the server (as far as the channels are concerned) containing a tree that
+/// resembles the one of a large community server
+static void generateDatabase(const QString &connection, int channelCount) {
+	QSqlDatabase db = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"), connection);
+	db.setDatabaseName(databaseDir->filePath(connection + QLatin1String(".sqlite")));
+	if (!db.open()) {
+		qFatal("Failed to open the database");
+	}
+
+	QSqlQuery query(db);
+	exec(query, QLatin1String("CREATE TABLE channels (server_id INTEGER NOT NULL, channel_id INTEGER NOT NULL, "
+							  "parent_id INTEGER, name TEXT, inheritacl INTEGER)"));
+	exec(query, QLatin1String("CREATE UNIQUE INDEX channel_id ON channels(server_id, channel_id)"));
+	exec(query, QLatin1String("CREATE TABLE channel_info (server_id INTEGER NOT NULL, channel_id INTEGER NOT NULL, "
+							  "key INTEGER, value TEXT)"));
+	exec(query, QLatin1String("CREATE UNIQUE INDEX channel_info_id ON channel_info(server_id, channel_id, key)"));
+	exec(query, QLatin1String("CREATE TABLE groups (group_id INTEGER PRIMARY KEY AUTOINCREMENT, server_id INTEGER "
+							  "NOT NULL, name TEXT, channel_id INTEGER NOT NULL, inherit INTEGER, "
+							  "inheritable INTEGER)"));
+	exec(query, QLatin1String("CREATE UNIQUE INDEX groups_name_channels ON groups(server_id, channel_id, name)"));
+	exec(query, QLatin1String("CREATE TABLE group_members (group_id INTEGER NOT NULL, server_id INTEGER NOT NULL, "
+							  "user_id INTEGER NOT NULL, addit INTEGER)"));
+	exec(query, QLatin1String("CREATE TABLE acl (server_id INTEGER NOT NULL, channel_id INTEGER NOT NULL, priority "
+							  "INTEGER, user_id INTEGER, group_name TEXT, apply_here INTEGER, apply_sub INTEGER, "
+							  "grantpriv INTEGER, revokepriv INTEGER)"));
+	exec(query, QLatin1String("CREATE UNIQUE INDEX acl_channel_pri ON acl(server_id, channel_id, priority)"));
+
+	db.transaction();
+
+	std::mt19937 rng(42);
+
+	QSqlQuery channel(db);
+	channel.prepare(QLatin1String("INSERT INTO channels VALUES (?, ?, ?, ?, ?)"));
+	QSqlQuery info(db);
+	info.prepare(QLatin1String("INSERT INTO channel_info VALUES (?, ?, ?, ?)"));
+	QSqlQuery group(db);
+	group.prepare(QLatin1String(
+		"INSERT INTO groups (server_id, name, channel_id, inherit, inheritable) VALUES (?, 'members', ?, 1, 1)"));
+	QSqlQuery member(db);
+	member.prepare(QLatin1String("INSERT INTO group_members VALUES (?, ?, ?, 1)"));
+	QSqlQuery acl(db);
+	acl.prepare(QLatin1String("INSERT INTO acl VALUES (?, ?, ?, NULL, ?, 1, 1, ?, ?)"));
+
+	for (int id = 0; id < channelCount; ++id) {
+		channel.addBindValue(SERVER_ID);
+		channel.addBindValue(id);
+		// Prefer recent channels as parents, which results in deeply nested channels
+		if (id == 0) {
+			channel.addBindValue(QVariant());
+		} else if (rng() % 10 == 0) {
+			channel.addBindValue(0);
+		} else {
+			channel.addBindValue(id - 1 - static_cast< int >(rng() % static_cast< unsigned int >(std::min(id, 50))));
+		}
+		channel.addBindValue(QString::number(id));
+		channel.addBindValue(1);
+		channel.exec();
+
+		if (rng() % 2 == 0) {
+			info.addBindValue(SERVER_ID);
+			info.addBindValue(id);
+			info.addBindValue(ServerDB::Channel_Description);
+			info.addBindValue(QString::fromLatin1("Channel %1").arg(id));
+			info.exec();
+		}
+
+		if (rng() % 4 == 0) {
+			group.addBindValue(SERVER_ID);
+			group.addBindValue(id);
+			group.exec();
+
+			const QVariant groupId = group.lastInsertId();
+			for (int i = 0; i < 20; ++i) {
+				member.addBindValue(groupId);
+				member.addBindValue(SERVER_ID);
+				member.addBindValue(static_cast< int >(rng() % 5000) + 1);
+				member.exec();
+			}
+
+			acl.addBindValue(SERVER_ID);
+			acl.addBindValue(id);
+			acl.addBindValue(1);
+			acl.addBindValue(QLatin1String("all"));
+			acl.addBindValue(0);
+			acl.addBindValue(static_cast< int >(ChanACL::Enter | ChanACL::Speak));
+			acl.exec();
+
+			acl.addBindValue(SERVER_ID);
+			acl.addBindValue(id);
+			acl.addBindValue(2);
+			acl.addBindValue(QLatin1String("members"));
+			acl.addBindValue(static_cast< int >(ChanACL::Enter | ChanACL::Speak));
+			acl.addBindValue(0);
+			acl.exec();
+		}
+	}
+
+	db.commit();
+}
+
+static QSqlDatabase database(int channelCount) {
+	const QString connection = connectionName(channelCount);
+	if (!QSqlDatabase::contains(connection)) {
+		generateDatabase(connection, channelCount);
+	}
+
+	return QSqlDatabase::database(connection);
+}
+
+/// What Server::readChannelPrivs() used to do
+static void readChannelPrivs(const QSqlDatabase &db, Channel *c) {
+	QSqlQuery query(db);
+
+	query.prepare(QLatin1String("SELECT key, value FROM channel_info WHERE server_id = ? AND channel_id = ?"));
+	query.addBindValue(SERVER_ID);
+	query.addBindValue(c->iId);
+	query.exec();
+	while (query.next()) {
+		const int key = query.value(0).toInt();
+		if (key == ServerDB::Channel_Description) {
+			c->qsDesc = query.value(1).toString();
+		} else if (key == ServerDB::Channel_Position) {
+			c->iPosition = query.value(1).toInt();
+		} else if (key == ServerDB::Channel_Max_Users) {
+			c->uiMaxUsers = query.value(1).toUInt();
+		}
+	}
+
+	query.prepare(QLatin1String(
+		"SELECT group_id, name, inherit, inheritable FROM groups WHERE server_id = ? AND channel_id = ?"));
+	query.addBindValue(SERVER_ID);
+	query.addBindValue(c->iId);
+	query.exec();
+	while (query.next()) {
+		Group *g        = new Group(c, query.value(1).toString());
+		g->bInherit     = query.value(2).toBool();
+		g->bInheritable = query.value(3).toBool();
+
+		QSqlQuery mem(db);
+		mem.prepare(QLatin1String("SELECT user_id, addit FROM group_members WHERE group_id = ?"));
+		mem.addBindValue(query.value(0).toInt());
+		mem.exec();
+		while (mem.next()) {
+			if (mem.value(1).toBool())
+				g->qsAdd << mem.value(0).toInt();
+			else
+				g->qsRemove << mem.value(0).toInt();
+		}
+	}
+
+	query.prepare(QLatin1String("SELECT user_id, group_name, apply_here, apply_sub, grantpriv, revokepriv FROM acl "
+								"WHERE server_id = ? AND channel_id = ? ORDER BY priority"));
+	query.addBindValue(SERVER_ID);
+	query.addBindValue(c->iId);
+	query.exec();
+	while (query.next()) {
+		ChanACL *acl    = new ChanACL(c);
+		acl->iUserId    = query.value(0).isNull() ? -1 : query.value(0).toInt();
+		acl->qsGroup    = query.value(1).toString();
+		acl->bApplyHere = query.value(2).toBool();
+		acl->bApplySubs = query.value(3).toBool();
+		acl->pAllow     = static_cast< ChanACL::Permissions >(query.value(4).toInt());
+		acl->pDeny      = static_cast< ChanACL::Permissions >(query.value(5).toInt());
+	}
+}
+
+/// What Server::readChannels() used to do
+static void readChannels(const QSqlDatabase &db, QObject *owner, Channel *p, std::size_t &count) {
+	if (p) {
+		readChannelPrivs(db, p);
+	}
+
+	QList< Channel * > kids;
+	{
+		QSqlQuery query(db);
+		if (!p) {
+			query.prepare(QLatin1String("SELECT channel_id, name, inheritacl FROM channels WHERE server_id = ? AND "
+										"parent_id IS NULL ORDER BY name"));
+			query.addBindValue(SERVER_ID);
+		} else {
+			query.prepare(QLatin1String("SELECT channel_id, name, inheritacl FROM channels WHERE server_id = ? AND "
+										"parent_id = ? ORDER BY name"));
+			query.addBindValue(SERVER_ID);
+			query.addBindValue(p->iId);
+		}
+		query.exec();
+
+		while (query.next()) {
+			Channel *c = new Channel(query.value(0).toUInt(), query.value(1).toString(), p);
+			if (!p)
+				c->setParent(owner);
+			c->bInheritACL = query.value(2).toBool();
+			kids << c;
+		}
+	}
+
+	count += static_cast< std::size_t >(kids.size());
+	for (Channel *c : kids) {
+		readChannels(db, owner, c, count);
+	}
+}
+
+static void BM_perChannelQueries(benchmark::State &state) {
+	const QSqlDatabase db = database(static_cast< int >(state.range(0)));
+
+	for (auto _ : state) {
+		QObject owner;
+		std::size_t count = 0;
+		readChannels(db, &owner, nullptr, count);
+		benchmark::DoNotOptimize(count);
+	}
+
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * state.range(0)));
+}
+
+static void BM_bulkLoad(benchmark::State &state) {
+	const QSqlDatabase db = database(static_cast< int >(state.range(0)));
+
+	for (auto _ : state) {
+		ChannelTreeBuilder builder;
+
+		QSqlQuery query(db);
+		query.setForwardOnly(true);
+
+		query.prepare(QLatin1String(
+			"SELECT channel_id, parent_id, name, inheritacl FROM channels WHERE server_id = ? ORDER BY name"));
+		query.addBindValue(SERVER_ID);
+		query.exec();
+		while (query.next()) {
+			builder.addChannel(query.value(0).toUInt(), query.value(1).isNull() ? -1 : query.value(1).toInt(),
+							   query.value(2).toString(), query.value(3).toBool());
+		}
+
+		query.prepare(QLatin1String("SELECT channel_id, key, value FROM channel_info WHERE server_id = ?"));
+		query.addBindValue(SERVER_ID);
+		query.exec();
+		while (query.next()) {
+			builder.addInfo(query.value(0).toUInt(), query.value(1).toInt(), query.value(2).toString());
+		}
+
+		query.prepare(
+			QLatin1String("SELECT group_id, channel_id, name, inherit, inheritable FROM groups WHERE server_id = ?"));
+		query.addBindValue(SERVER_ID);
+		query.exec();
+		while (query.next()) {
+			builder.addGroup(query.value(0).toInt(), query.value(1).toUInt(), query.value(2).toString(),
+							 query.value(3).toBool(), query.value(4).toBool());
+		}
+
+		query.prepare(QLatin1String("SELECT group_id, user_id, addit FROM group_members WHERE server_id = ?"));
+		query.addBindValue(SERVER_ID);
+		query.exec();
+		while (query.next()) {
+			builder.addGroupMember(query.value(0).toInt(), query.value(1).toInt(), query.value(2).toBool());
+		}
+
+		query.prepare(QLatin1String("SELECT channel_id, user_id, group_name, apply_here, apply_sub, grantpriv, "
+									"revokepriv FROM acl WHERE server_id = ? ORDER BY channel_id, priority"));
+		query.addBindValue(SERVER_ID);
+		query.exec();
+		while (query.next()) {
+			builder.addACL(query.value(0).toUInt(), query.value(1).isNull() ? -1 : query.value(1).toInt(),
+						   query.value(2).toString(), query.value(3).toBool(), query.value(4).toBool(),
+						   query.value(5).toInt(), query.value(6).toInt());
+		}
+
+		QObject owner;
+		benchmark::DoNotOptimize(builder.build(&owner));
+	}
+
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * state.range(0)));
+}
+
+BENCHMARK(BM_perChannelQueries)->Arg(1000)->Arg(5000)->Arg(20000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_bulkLoad)->Arg(1000)->Arg(5000)->Arg(20000)->Unit(benchmark::kMillisecond);
+
+int main(int argc, char **argv) {
+	// Required for loading the SQLite driver
+	QCoreApplication app(argc, argv);
+
+	QTemporaryDir dir;
+	if (!dir.isValid()) {
+		std::fprintf(stderr, "Failed to create a temporary directory\n");
+		return 1;
+	}
+	databaseDir = &dir;
+
+	::benchmark::Initialize(&argc, argv);
+	::benchmark::RunSpecifiedBenchmarks();
+
+	return 0;
+}
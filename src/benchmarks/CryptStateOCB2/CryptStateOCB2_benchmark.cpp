@@ -0,0 +1,208 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+// Compares CryptStateOCB2 against the way OCB2 used to be implemented: every single block was passed through its own
+// EVP_EncryptInit_ex/EVP_EncryptUpdate/EVP_EncryptFinal_ex sequence, which meant that the AES key schedule was
+// recomputed for every block. Nowadays the key schedule is only computed when the key changes and all blocks of a
+// packet are passed through AES in a single call.
+
+#include <benchmark/benchmark.h>
+
+#include "ByteSwap.h"
+#include "crypto/CryptStateOCB2.h"
+
+#include <openssl/evp.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+constexpr const std::size_t PACKET_SIZE_RANGE = 0;
+
+/// The previous implementation of OCB2 (without the counter-cryptanalysis, which has no measurable cost)
+class PerBlockOCB2 {
+public:
+	explicit PerBlockOCB2(const std::string &rawKey) : m_ctx(EVP_CIPHER_CTX_new()) {
+		memcpy(m_key, rawKey.data(), AES_KEY_SIZE_BYTES);
+	}
+	~PerBlockOCB2() { EVP_CIPHER_CTX_free(m_ctx); }
+
+	PerBlockOCB2(const PerBlockOCB2 &) = delete;
+	PerBlockOCB2 &operator=(const PerBlockOCB2 &) = delete;
+
+	void encrypt(const unsigned char *plain, unsigned char *encrypted, unsigned int len, const unsigned char *nonce,
+				 unsigned char *tag) {
+		Block checksum = {}, delta, tmp, pad;
+
+		aes(nonce, delta, true);
+
+		while (len > AES_BLOCK_SIZE) {
+			S2(delta);
+			XOR(tmp, delta, reinterpret_cast< const std::uint64_t * >(plain));
+			aes(tmp, tmp, true);
+			XOR(reinterpret_cast< std::uint64_t * >(encrypted), delta, tmp);
+			XOR(checksum, checksum, reinterpret_cast< const std::uint64_t * >(plain));
+
+			len -= AES_BLOCK_SIZE;
+			plain += AES_BLOCK_SIZE;
+			encrypted += AES_BLOCK_SIZE;
+		}
+
+		S2(delta);
+		tmp[0] = 0;
+		tmp[1] = SWAP64(static_cast< std::uint64_t >(len * 8));
+		XOR(tmp, tmp, delta);
+		aes(tmp, pad, true);
+		memcpy(tmp, plain, len);
+		memcpy(reinterpret_cast< unsigned char * >(tmp) + len, reinterpret_cast< const unsigned char * >(pad) + len,
+			   AES_BLOCK_SIZE - len);
+		XOR(checksum, checksum, tmp);
+		XOR(tmp, pad, tmp);
+		memcpy(encrypted, tmp, len);
+
+		S3(delta);
+		XOR(tmp, delta, checksum);
+		aes(tmp, tag, true);
+	}
+
+	void decrypt(const unsigned char *encrypted, unsigned char *plain, unsigned int len, const unsigned char *nonce,
+				 unsigned char *tag) {
+		Block checksum = {}, delta, tmp, pad;
+
+		aes(nonce, delta, true);
+
+		while (len > AES_BLOCK_SIZE) {
+			S2(delta);
+			XOR(tmp, delta, reinterpret_cast< const std::uint64_t * >(encrypted));
+			aes(tmp, tmp, false);
+			XOR(reinterpret_cast< std::uint64_t * >(plain), delta, tmp);
+			XOR(checksum, checksum, reinterpret_cast< const std::uint64_t * >(plain));
+
+			len -= AES_BLOCK_SIZE;
+			plain += AES_BLOCK_SIZE;
+			encrypted += AES_BLOCK_SIZE;
+		}
+
+		S2(delta);
+		tmp[0] = 0;
+		tmp[1] = SWAP64(static_cast< std::uint64_t >(len * 8));
+		XOR(tmp, tmp, delta);
+		aes(tmp, pad, true);
+		memset(tmp, 0, AES_BLOCK_SIZE);
+		memcpy(tmp, encrypted, len);
+		XOR(tmp, tmp, pad);
+		XOR(checksum, checksum, tmp);
+		memcpy(plain, tmp, len);
+
+		S3(delta);
+		XOR(tmp, delta, checksum);
+		aes(tmp, tag, true);
+	}
+
+protected:
+	using Block = std::uint64_t[2];
+
+	unsigned char m_key[AES_KEY_SIZE_BYTES];
+	EVP_CIPHER_CTX *m_ctx;
+
+	void aes(const void *src, void *dst, bool encrypt) {
+		int outlen = 0;
+
+		EVP_CipherInit_ex(m_ctx, EVP_aes_128_ecb(), nullptr, m_key, nullptr, encrypt ? 1 : 0);
+		EVP_CIPHER_CTX_set_padding(m_ctx, 0);
+		EVP_CipherUpdate(m_ctx, reinterpret_cast< unsigned char * >(dst), &outlen,
+						 reinterpret_cast< const unsigned char * >(src), AES_BLOCK_SIZE);
+		EVP_CipherFinal_ex(m_ctx, reinterpret_cast< unsigned char * >(dst) + outlen, &outlen);
+	}
+
+	static void XOR(std::uint64_t *dst, const std::uint64_t *a, const std::uint64_t *b) {
+		dst[0] = a[0] ^ b[0];
+		dst[1] = a[1] ^ b[1];
+	}
+
+	static void S2(std::uint64_t *block) {
+		const std::uint64_t carry = SWAP64(block[0]) >> 63;
+		block[0]                  = SWAP64((SWAP64(block[0]) << 1) | (SWAP64(block[1]) >> 63));
+		block[1]                  = SWAP64((SWAP64(block[1]) << 1) ^ (carry * 0x87));
+	}
+
+	static void S3(std::uint64_t *block) {
+		const std::uint64_t carry = SWAP64(block[0]) >> 63;
+		block[0] ^= SWAP64((SWAP64(block[0]) << 1) | (SWAP64(block[1]) >> 63));
+		block[1] ^= SWAP64((SWAP64(block[1]) << 1) ^ (carry * 0x87));
+	}
+};
+
+class Fixture : public ::benchmark::Fixture {
+public:
+	CryptStateOCB2 crypt;
+	std::vector< unsigned char > plain;
+	std::vector< unsigned char > encrypted;
+	unsigned char nonce[AES_BLOCK_SIZE] = {};
+	unsigned char tag[AES_BLOCK_SIZE];
+
+	void SetUp(const ::benchmark::State &state) {
+		crypt.genKey();
+
+		const std::size_t size = static_cast< std::size_t >(state.range(PACKET_SIZE_RANGE));
+		plain.assign(size, 0x42);
+		encrypted.resize(size);
+	}
+
+	void report(::benchmark::State &state) {
+		state.SetBytesProcessed(state.iterations() * static_cast< int64_t >(plain.size()));
+	}
+};
+
+
+BENCHMARK_DEFINE_F(Fixture, BM_encryptPerBlock)(::benchmark::State &state) {
+	PerBlockOCB2 reference(crypt.getRawKey());
+
+	for (auto _ : state) {
+		reference.encrypt(plain.data(), encrypted.data(), static_cast< unsigned int >(plain.size()), nonce, tag);
+		benchmark::DoNotOptimize(tag);
+	}
+
+	report(state);
+}
+
+BENCHMARK_DEFINE_F(Fixture, BM_encrypt)(::benchmark::State &state) {
+	for (auto _ : state) {
+		crypt.ocb_encrypt(plain.data(), encrypted.data(), static_cast< unsigned int >(plain.size()), nonce, tag);
+		benchmark::DoNotOptimize(tag);
+	}
+
+	report(state);
+}
+
+BENCHMARK_DEFINE_F(Fixture, BM_decryptPerBlock)(::benchmark::State &state) {
+	PerBlockOCB2 reference(crypt.getRawKey());
+
+	for (auto _ : state) {
+		reference.decrypt(encrypted.data(), plain.data(), static_cast< unsigned int >(plain.size()), nonce, tag);
+		benchmark::DoNotOptimize(tag);
+	}
+
+	report(state);
+}
+
+BENCHMARK_DEFINE_F(Fixture, BM_decrypt)(::benchmark::State &state) {
+	for (auto _ : state) {
+		crypt.ocb_decrypt(encrypted.data(), plain.data(), static_cast< unsigned int >(plain.size()), nonce, tag);
+		benchmark::DoNotOptimize(tag);
+	}
+
+	report(state);
+}
+
+// 176 bytes roughly correspond to a 20ms Opus frame at 64 kbit/s (plus the protocol's header)
+BENCHMARK_REGISTER_F(Fixture, BM_encryptPerBlock)->Arg(16)->Arg(64)->Arg(176)->Arg(512)->Arg(1024);
+BENCHMARK_REGISTER_F(Fixture, BM_encrypt)->Arg(16)->Arg(64)->Arg(176)->Arg(512)->Arg(1024);
+BENCHMARK_REGISTER_F(Fixture, BM_decryptPerBlock)->Arg(16)->Arg(64)->Arg(176)->Arg(512)->Arg(1024);
+BENCHMARK_REGISTER_F(Fixture, BM_decrypt)->Arg(16)->Arg(64)->Arg(176)->Arg(512)->Arg(1024);
+
+
+BENCHMARK_MAIN();
@@ -0,0 +1,172 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+// Simulates a reconnect storm: a number of fake clients (running on their own threads) connect to a local TLS server
+// at once. The server sends every client a single message once its handshake completed, which stands in for the
+// ServerSync. The measured time is the time until all clients received that message. The handshakes are either
+// performed by the server's thread (0 handshake threads, which is what Server does by default) or by a
+// HandshakePool.
+//
+// The "max_stall_ms" counter is the longest time the server's thread didn't get to process a timer firing every
+// millisecond, i.e. how long messages of already connected clients would have had to wait.
+
+#include <benchmark/benchmark.h>
+
+#include "HandshakePool.h"
+#include "SelfSignedCertificate.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QEventLoop>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <QtNetwork/QSslSocket>
+#include <QtNetwork/QTcpServer>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+constexpr std::size_t CLIENT_COUNT_RANGE      = 0;
+constexpr std::size_t HANDSHAKE_THREADS_RANGE = 1;
+
+constexpr unsigned int CLIENT_THREADS = 4;
+constexpr int STORM_TIMEOUT           = 60000;
+
+static QSslCertificate certificate;
+static QSslKey key;
+
+/// Accepts TLS connections and sends a single byte to every client that completed its handshake
+class StormServer : public QTcpServer {
+public:
+	explicit StormServer(unsigned int handshakeThreads) {
+		if (handshakeThreads > 0) {
+			m_pool = std::make_unique< HandshakePool >(handshakeThreads, 64, STORM_TIMEOUT);
+			QObject::connect(m_pool.get(), &HandshakePool::handshakeCompleted, this,
+							 [this](QSslSocket *socket, bool) { synced(socket); });
+		}
+	}
+
+protected:
+	std::unique_ptr< HandshakePool > m_pool;
+
+	void incomingConnection(qintptr descriptor) override {
+		QSslSocket *socket = new QSslSocket(this);
+		socket->setSocketDescriptor(descriptor);
+		socket->setPrivateKey(key);
+		socket->setLocalCertificate(certificate);
+		socket->setProtocol(QSsl::TlsV1_2OrLater);
+
+		if (m_pool) {
+			m_pool->enqueue(socket);
+		} else {
+			QObject::connect(socket, &QSslSocket::encrypted, this, [this, socket]() { synced(socket); });
+			QObject::connect(socket, &QSslSocket::sslErrors, socket, [socket]() { socket->ignoreSslErrors(); });
+			socket->startServerEncryption();
+		}
+	}
+
+	void synced(QSslSocket *socket) {
+		socket->setParent(this);
+		socket->write("S", 1);
+	}
+};
+
+static void BM_reconnectStorm(benchmark::State &state) {
+	const int clientCount = static_cast< int >(state.range(CLIENT_COUNT_RANGE));
+
+	std::vector< QThread * > clientThreads;
+	std::vector< QObject * > clientContexts;
+	for (unsigned int i = 0; i < CLIENT_THREADS; ++i) {
+		clientThreads.push_back(new QThread());
+		clientContexts.push_back(new QObject());
+		clientContexts.back()->moveToThread(clientThreads.back());
+		clientThreads.back()->start();
+	}
+
+	qint64 maxStall = 0;
+
+	for (auto _ : state) {
+		StormServer server(static_cast< unsigned int >(state.range(HANDSHAKE_THREADS_RANGE)));
+		server.listen(QHostAddress::LocalHost);
+		const quint16 port = server.serverPort();
+
+		QEventLoop loop;
+		std::atomic< int > synced{ 0 };
+
+		QElapsedTimer sinceTick;
+		QTimer ticker;
+		ticker.setInterval(1);
+		QObject::connect(&ticker, &QTimer::timeout, [&]() {
+			maxStall = std::max(maxStall, sinceTick.elapsed());
+			sinceTick.restart();
+		});
+		QTimer::singleShot(STORM_TIMEOUT, &loop, [&]() {
+			state.SkipWithError("Not all clients synced in time");
+			loop.quit();
+		});
+
+		QElapsedTimer elapsed;
+		elapsed.start();
+		sinceTick.start();
+		ticker.start();
+
+		for (int i = 0; i < clientCount; ++i) {
+			QObject *context = clientContexts[static_cast< std::size_t >(i) % CLIENT_THREADS];
+			QMetaObject::invokeMethod(context, [context, port, clientCount, &synced, &loop]() {
+				QSslSocket *client = new QSslSocket(context);
+				client->setPeerVerifyMode(QSslSocket::VerifyNone);
+				QObject::connect(client, &QSslSocket::readyRead, client, [client, clientCount, &synced, &loop]() {
+					client->readAll();
+					if (synced.fetch_add(1) + 1 == clientCount) {
+						QMetaObject::invokeMethod(&loop, &QEventLoop::quit, Qt::QueuedConnection);
+					}
+				});
+				client->connectToHostEncrypted(QStringLiteral("127.0.0.1"), port);
+			});
+		}
+
+		loop.exec();
+
+		state.SetIterationTime(static_cast< double >(elapsed.nsecsElapsed()) / 1e9);
+		ticker.stop();
+
+		// Disconnect all clients before the next storm
+		for (QObject *context : clientContexts) {
+			QMetaObject::invokeMethod(
+				context, [context]() { qDeleteAll(context->children()); }, Qt::BlockingQueuedConnection);
+		}
+	}
+
+	for (std::size_t i = 0; i < clientThreads.size(); ++i) {
+		clientThreads[i]->quit();
+		clientThreads[i]->wait();
+		delete clientContexts[i];
+		delete clientThreads[i];
+	}
+
+	state.counters["max_stall_ms"] = static_cast< double >(maxStall);
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations()) * clientCount);
+}
+
+BENCHMARK(BM_reconnectStorm)
+	->Args({ 500, 0 })
+	->Args({ 500, 2 })
+	->Args({ 500, 4 })
+	->Iterations(3)
+	->UseManualTime()
+	->Unit(benchmark::kMillisecond);
+
+int main(int argc, char **argv) {
+	QCoreApplication app(argc, argv);
+
+	if (!SelfSignedCertificate::generateMurmurV2Certificate(certificate, key)) {
+		return 1;
+	}
+
+	::benchmark::Initialize(&argc, argv);
+	::benchmark::RunSpecifiedBenchmarks();
+}
@@ -0,0 +1,250 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+// Load test for the routing of regular speech while the main thread processes a join/leave storm. Every benchmark
+// thread plays the role of a voice thread routing packets, while an additional thread continuously moves users
+// between channels (the "storm"). The interesting numbers are the tail latencies (p99 and max) of routing a single
+// packet: with a reader-writer lock, readers have to wait for the writer, whereas they never block when reading a
+// published RoutingSnapshot.
+
+#include <benchmark/benchmark.h>
+
+#include "RoutingSnapshot.h"
+
+#include <QtCore/QReadWriteLock>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+constexpr const std::size_t USER_COUNT_RANGE = 0;
+
+constexpr unsigned int CHANNEL_COUNT = 50;
+constexpr int MAX_THREADS            = 8;
+
+/// The state of the server as seen by the main thread
+struct ServerModel {
+	std::vector< unsigned int > userChannels;
+	std::vector< std::vector< unsigned int > > channelMembers;
+
+	explicit ServerModel(unsigned int userCount) : userChannels(userCount), channelMembers(CHANNEL_COUNT) {
+		for (unsigned int session = 0; session < userCount; ++session) {
+			userChannels[session] = session % CHANNEL_COUNT;
+			channelMembers[session % CHANNEL_COUNT].push_back(session);
+		}
+	}
+
+	/// A user leaving and (re-)joining into another channel
+	void moveUser(unsigned int session, unsigned int channel) {
+		std::vector< unsigned int > &oldMembers = channelMembers[userChannels[session]];
+		oldMembers.erase(std::find(oldMembers.begin(), oldMembers.end(), session));
+
+		userChannels[session] = channel;
+		channelMembers[channel].push_back(session);
+	}
+
+	std::unique_ptr< RoutingSnapshot > buildSnapshot() const {
+		std::unique_ptr< RoutingSnapshot > snapshot = std::make_unique< RoutingSnapshot >();
+
+		snapshot->users.reserve(userChannels.size());
+		for (unsigned int session = 0; session < userChannels.size(); ++session) {
+			RoutingSnapshot::UserEntry entry;
+			entry.user     = nullptr;
+			entry.session  = session;
+			entry.channel  = userChannels[session];
+			entry.canSpeak = true;
+			entry.deaf     = false;
+
+			snapshot->users.emplace(session, std::move(entry));
+		}
+
+		for (unsigned int channel = 0; channel < CHANNEL_COUNT; ++channel) {
+			RoutingSnapshot::ChannelEntry &entry = snapshot->channels[channel];
+			entry.id                             = channel;
+
+			for (unsigned int session : channelMembers[channel]) {
+				entry.members.push_back(snapshot->findUser(session));
+			}
+		}
+
+		return snapshot;
+	}
+};
+
+/// Records the latency of every routed packet of a single benchmark thread
+class LatencyRecorder {
+public:
+	void record(std::chrono::steady_clock::duration duration) {
+		m_samples.push_back(std::chrono::duration_cast< std::chrono::nanoseconds >(duration).count());
+	}
+
+	void report(::benchmark::State &state) {
+		if (m_samples.empty()) {
+			return;
+		}
+
+		std::sort(m_samples.begin(), m_samples.end());
+
+		state.counters["p50_ns"] = benchmark::Counter(static_cast< double >(m_samples[m_samples.size() / 2]),
+													  benchmark::Counter::kAvgThreads);
+		state.counters["p99_ns"] = benchmark::Counter(static_cast< double >(m_samples[m_samples.size() * 99 / 100]),
+													  benchmark::Counter::kAvgThreads);
+		state.counters["max_ns"] =
+			benchmark::Counter(static_cast< double >(m_samples.back()), benchmark::Counter::kAvgThreads);
+	}
+
+protected:
+	std::vector< std::int64_t > m_samples;
+};
+
+/// Runs the join/leave storm on a separate thread for as long as it exists
+class Storm {
+public:
+	template< typename Function > explicit Storm(Function step) {
+		m_thread = std::thread([this, step]() mutable {
+			std::mt19937 rng(42);
+
+			while (!m_stop.load(std::memory_order_relaxed)) {
+				step(rng);
+				m_changes.fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+	}
+
+	~Storm() {
+		m_stop = true;
+		m_thread.join();
+	}
+
+	std::uint64_t changes() const { return m_changes.load(); }
+
+protected:
+	std::atomic< bool > m_stop{ false };
+	std::atomic< std::uint64_t > m_changes{ 0 };
+	std::thread m_thread;
+};
+
+
+// Mirrors the previous approach: the voice threads hold a read lock while routing and the main thread takes the write
+// lock for every change.
+QReadWriteLock lock;
+std::unique_ptr< ServerModel > lockedModel;
+std::unique_ptr< Storm > lockedStorm;
+
+static void BM_RouteWithLock(::benchmark::State &state) {
+	const unsigned int userCount = static_cast< unsigned int >(state.range(USER_COUNT_RANGE));
+
+	if (state.thread_index() == 0) {
+		lockedModel = std::make_unique< ServerModel >(userCount);
+		lockedStorm = std::make_unique< Storm >([userCount](std::mt19937 &rng) {
+			std::uniform_int_distribution< unsigned int > randomUser(0, userCount - 1);
+			std::uniform_int_distribution< unsigned int > randomChannel(0, CHANNEL_COUNT - 1);
+
+			QWriteLocker wl(&lock);
+			lockedModel->moveUser(randomUser(rng), randomChannel(rng));
+		});
+	}
+
+	std::mt19937 rng(static_cast< unsigned int >(state.thread_index()));
+	std::uniform_int_distribution< unsigned int > randomSender(0, userCount - 1);
+	LatencyRecorder latencies;
+
+	for (auto _ : state) {
+		const unsigned int sender = randomSender(rng);
+
+		const auto start = std::chrono::steady_clock::now();
+		{
+			QReadLocker rl(&lock);
+
+			unsigned int receivers = 0;
+			for (unsigned int session : lockedModel->channelMembers[lockedModel->userChannels[sender]]) {
+				receivers += (session != sender) ? 1 : 0;
+			}
+			benchmark::DoNotOptimize(receivers);
+		}
+		latencies.record(std::chrono::steady_clock::now() - start);
+	}
+
+	latencies.report(state);
+
+	if (state.thread_index() == 0) {
+		state.counters["changes"] = static_cast< double >(lockedStorm->changes());
+
+		lockedStorm.reset();
+		lockedModel.reset();
+	}
+}
+
+BENCHMARK(BM_RouteWithLock)->Arg(100)->Arg(1000)->ThreadRange(1, MAX_THREADS)->UseRealTime();
+
+
+// The voice threads read the published snapshot without any lock and the main thread publishes a new snapshot for
+// every change (without coalescing multiple changes, which makes this the worst case for the writer).
+std::unique_ptr< RoutingTable > routingTable;
+std::unique_ptr< ServerModel > snapshotModel;
+std::unique_ptr< Storm > snapshotStorm;
+
+static void BM_RouteWithSnapshot(::benchmark::State &state) {
+	const unsigned int userCount = static_cast< unsigned int >(state.range(USER_COUNT_RANGE));
+
+	if (state.thread_index() == 0) {
+		routingTable  = std::make_unique< RoutingTable >();
+		snapshotModel = std::make_unique< ServerModel >(userCount);
+		routingTable->publish(snapshotModel->buildSnapshot());
+
+		snapshotStorm = std::make_unique< Storm >([userCount](std::mt19937 &rng) {
+			std::uniform_int_distribution< unsigned int > randomUser(0, userCount - 1);
+			std::uniform_int_distribution< unsigned int > randomChannel(0, CHANNEL_COUNT - 1);
+
+			// The model is owned by the storm thread (just like the main thread owns the server's data)
+			snapshotModel->moveUser(randomUser(rng), randomChannel(rng));
+			routingTable->publish(snapshotModel->buildSnapshot());
+		});
+	}
+
+	const unsigned int readerIndex = static_cast< unsigned int >(state.thread_index());
+
+	std::mt19937 rng(readerIndex);
+	std::uniform_int_distribution< unsigned int > randomSender(0, userCount - 1);
+	LatencyRecorder latencies;
+
+	for (auto _ : state) {
+		const unsigned int sender = randomSender(rng);
+
+		const auto start = std::chrono::steady_clock::now();
+		{
+			RoutingTable::ReadGuard routing(*routingTable, readerIndex);
+
+			unsigned int receivers                       = 0;
+			const RoutingSnapshot::UserEntry *entry      = routing->findUser(sender);
+			const RoutingSnapshot::ChannelEntry *channel = routing->findChannel(entry->channel);
+			for (const RoutingSnapshot::UserEntry *member : channel->members) {
+				receivers += (member != entry) ? 1 : 0;
+			}
+			benchmark::DoNotOptimize(receivers);
+		}
+		latencies.record(std::chrono::steady_clock::now() - start);
+	}
+
+	latencies.report(state);
+
+	if (state.thread_index() == 0) {
+		state.counters["changes"] = static_cast< double >(snapshotStorm->changes());
+
+		snapshotStorm.reset();
+		snapshotModel.reset();
+		routingTable.reset();
+	}
+}
+
+BENCHMARK(BM_RouteWithSnapshot)->Arg(100)->Arg(1000)->ThreadRange(1, MAX_THREADS)->UseRealTime();
+
+
+BENCHMARK_MAIN();
@@ -0,0 +1,215 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <benchmark/benchmark.h>
+
+#include "HostAddress.h"
+#include "MumbleProtocol.h"
+#include "UDPBatch.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <vector>
+
+constexpr const std::size_t PACKET_COUNT_RANGE = 0;
+
+constexpr int MULTIPLIER         = 4;
+constexpr int PACKET_COUNT_BEGIN = 1;
+constexpr int PACKET_COUNT_END   = 1024;
+
+// Roughly the size of an encrypted 20ms Opus frame at 64 kbit/s
+constexpr std::size_t PACKET_SIZE = 180;
+
+class Fixture : public ::benchmark::Fixture {
+public:
+	int sender   = -1;
+	int receiver = -1;
+	sockaddr_storage receiverAddress;
+	HostAddress localAddress;
+
+	void SetUp(const ::benchmark::State &) {
+		sender   = createSocket();
+		receiver = createSocket();
+
+		// Make sure that the receiving end doesn't drop packets while a benchmark is filling it up
+		int bufferSize = 8 * 1024 * 1024;
+		setsockopt(receiver, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+		// If the kernel drops packets nonetheless (the buffer size is capped by net.core.rmem_max), the receiving
+		// benchmarks must not block forever
+		struct timeval timeout = { 0, 100000 };
+		setsockopt(receiver, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+		socklen_t addressLength = sizeof(receiverAddress);
+		memset(&receiverAddress, 0, sizeof(receiverAddress));
+		getsockname(receiver, reinterpret_cast< struct sockaddr * >(&receiverAddress), &addressLength);
+
+		localAddress = HostAddress(receiverAddress);
+	}
+
+	void TearDown(const ::benchmark::State &) {
+		::close(sender);
+		::close(receiver);
+	}
+
+	static int createSocket() {
+		int sock = ::socket(AF_INET, SOCK_DGRAM, 0);
+
+		int sockopt = 1;
+		setsockopt(sock, IPPROTO_IP, IP_PKTINFO, &sockopt, sizeof(sockopt));
+
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family      = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port        = 0;
+		::bind(sock, reinterpret_cast< struct sockaddr * >(&addr), sizeof(addr));
+
+		return sock;
+	}
+
+	void fillReceiver(std::size_t packetCount) {
+		unsigned char packet[PACKET_SIZE] = {};
+		for (std::size_t i = 0; i < packetCount; ++i) {
+			::sendto(sender, packet, sizeof(packet), 0, reinterpret_cast< struct sockaddr * >(&receiverAddress),
+					 sizeof(struct sockaddr_in));
+		}
+	}
+};
+
+
+BENCHMARK_DEFINE_F(Fixture, BM_sendmsg)(::benchmark::State &state) {
+	const std::size_t packetCount = static_cast< std::size_t >(state.range(PACKET_COUNT_RANGE));
+
+	unsigned char packet[PACKET_SIZE] = {};
+	uint8_t controldata[UDP_PKTINFO_SPACE];
+
+	for (auto _ : state) {
+		for (std::size_t i = 0; i < packetCount; ++i) {
+			// Mirrors what Server::sendMessage does for every single packet
+			struct msghdr msg;
+			struct iovec iov[1];
+
+			iov[0].iov_base = packet;
+			iov[0].iov_len  = sizeof(packet);
+
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_name    = reinterpret_cast< struct sockaddr * >(&receiverAddress);
+			msg.msg_namelen = sizeof(struct sockaddr_in);
+			msg.msg_iov     = iov;
+			msg.msg_iovlen  = 1;
+			msg.msg_control = controldata;
+
+			setUDPPacketInfo(msg, receiverAddress, localAddress);
+
+			benchmark::DoNotOptimize(::sendmsg(sender, &msg, 0));
+		}
+	}
+
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * packetCount));
+}
+
+BENCHMARK_REGISTER_F(Fixture, BM_sendmsg)
+	->RangeMultiplier(MULTIPLIER)
+	->Range(PACKET_COUNT_BEGIN, PACKET_COUNT_END);
+
+
+BENCHMARK_DEFINE_F(Fixture, BM_sendmmsg)(::benchmark::State &state) {
+	const std::size_t packetCount = static_cast< std::size_t >(state.range(PACKET_COUNT_RANGE));
+
+	UDPSendBatch batch(packetCount);
+
+	for (auto _ : state) {
+		for (std::size_t i = 0; i < packetCount; ++i) {
+			memset(batch.nextBuffer(), 0, PACKET_SIZE);
+			batch.commit(sender, PACKET_SIZE, receiverAddress, localAddress);
+		}
+
+		// In case the batch isn't full, flush it explicitly (no-op otherwise)
+		batch.flush();
+	}
+
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * packetCount));
+}
+
+BENCHMARK_REGISTER_F(Fixture, BM_sendmmsg)
+	->RangeMultiplier(MULTIPLIER)
+	->Range(PACKET_COUNT_BEGIN, PACKET_COUNT_END);
+
+
+BENCHMARK_DEFINE_F(Fixture, BM_recvmsg)(::benchmark::State &state) {
+	const std::size_t packetCount = static_cast< std::size_t >(state.range(PACKET_COUNT_RANGE));
+
+	unsigned char buffer[Mumble::Protocol::MAX_UDP_PACKET_SIZE];
+	uint8_t controldata[UDP_PKTINFO_SPACE];
+	sockaddr_storage from;
+
+	for (auto _ : state) {
+		state.PauseTiming();
+		fillReceiver(packetCount);
+		state.ResumeTiming();
+
+		for (std::size_t i = 0; i < packetCount; ++i) {
+			// Mirrors what Server::run does for every single packet
+			struct msghdr msg;
+			struct iovec iov[1];
+
+			iov[0].iov_base = buffer;
+			iov[0].iov_len  = sizeof(buffer);
+
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_name       = reinterpret_cast< struct sockaddr * >(&from);
+			msg.msg_namelen    = sizeof(from);
+			msg.msg_iov        = iov;
+			msg.msg_iovlen     = 1;
+			msg.msg_control    = controldata;
+			msg.msg_controllen = sizeof(controldata);
+
+			benchmark::DoNotOptimize(::recvmsg(receiver, &msg, MSG_TRUNC));
+		}
+	}
+
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * packetCount));
+}
+
+BENCHMARK_REGISTER_F(Fixture, BM_recvmsg)
+	->RangeMultiplier(MULTIPLIER)
+	->Range(PACKET_COUNT_BEGIN, PACKET_COUNT_END);
+
+
+BENCHMARK_DEFINE_F(Fixture, BM_recvmmsg)(::benchmark::State &state) {
+	const std::size_t packetCount = static_cast< std::size_t >(state.range(PACKET_COUNT_RANGE));
+
+	UDPReceiveBatch batch(packetCount);
+
+	for (auto _ : state) {
+		state.PauseTiming();
+		fillReceiver(packetCount);
+		state.ResumeTiming();
+
+		std::size_t received = 0;
+		while (received < packetCount) {
+			int count = batch.receive(receiver);
+			if (count <= 0) {
+				break;
+			}
+
+			received += static_cast< std::size_t >(count);
+		}
+	}
+
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * packetCount));
+}
+
+BENCHMARK_REGISTER_F(Fixture, BM_recvmmsg)
+	->RangeMultiplier(MULTIPLIER)
+	->Range(PACKET_COUNT_BEGIN, PACKET_COUNT_END);
+
+
+BENCHMARK_MAIN();
@@ -0,0 +1,180 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+// Measures the cost of forwarding a single audio packet to a range of receivers (that all get the same plaintext):
+// every copy has to be encrypted with the receiver's own key before being sent. The "per_receiver" counter is the
+// time spent per receiver.
+
+#include <benchmark/benchmark.h>
+
+#include "HostAddress.h"
+#include "MumbleProtocol.h"
+#include "UDPBatch.h"
+#include "crypto/CryptStateOCB2.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+constexpr const std::size_t RECEIVER_COUNT_RANGE = 0;
+
+// Roughly the size of a 20ms Opus frame at 64 kbit/s (plus the protocol's header)
+constexpr std::size_t PLAINTEXT_SIZE = 176;
+
+/// The state of a single receiver as far as sending to it is concerned (mirrors the relevant parts of ServerUser)
+struct Receiver {
+	CryptStateOCB2 crypt;
+	std::mutex cryptMutex;
+	sockaddr_storage udpAddress;
+	sockaddr_storage localAddress;
+	HostAddress haLocalAddress;
+};
+
+class Fixture : public ::benchmark::Fixture {
+public:
+	int sender   = -1;
+	int receiver = -1;
+	std::vector< std::unique_ptr< Receiver > > receivers;
+	unsigned char plaintext[PLAINTEXT_SIZE] = {};
+
+	void SetUp(const ::benchmark::State &state) {
+		sender   = createSocket();
+		receiver = createSocket();
+
+		sockaddr_storage receiverAddress;
+		socklen_t addressLength = sizeof(receiverAddress);
+		memset(&receiverAddress, 0, sizeof(receiverAddress));
+		getsockname(receiver, reinterpret_cast< struct sockaddr * >(&receiverAddress), &addressLength);
+
+		// All receivers share the same receiving socket. We don't care whether the kernel drops some of the
+		// datagrams, as only the sending side is measured.
+		receivers.clear();
+		for (int64_t i = 0; i < state.range(RECEIVER_COUNT_RANGE); ++i) {
+			std::unique_ptr< Receiver > current = std::make_unique< Receiver >();
+			current->crypt.genKey();
+			current->udpAddress     = receiverAddress;
+			current->localAddress   = receiverAddress;
+			current->haLocalAddress = HostAddress(receiverAddress);
+
+			receivers.push_back(std::move(current));
+		}
+	}
+
+	void TearDown(const ::benchmark::State &) {
+		receivers.clear();
+
+		::close(sender);
+		::close(receiver);
+	}
+
+	static int createSocket() {
+		int sock = ::socket(AF_INET, SOCK_DGRAM, 0);
+
+		int sockopt = 1;
+		setsockopt(sock, IPPROTO_IP, IP_PKTINFO, &sockopt, sizeof(sockopt));
+
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family      = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port        = 0;
+		::bind(sock, reinterpret_cast< struct sockaddr * >(&addr), sizeof(addr));
+
+		return sock;
+	}
+
+	void reportPerReceiver(::benchmark::State &state) {
+		const int64_t datagrams = state.iterations() * static_cast< int64_t >(receivers.size());
+
+		state.SetItemsProcessed(datagrams);
+		state.counters["per_receiver"] = benchmark::Counter(static_cast< double >(datagrams),
+															benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+	}
+};
+
+
+// Mirrors what Server::sendMessage does without a send batch: every copy gets its own encryption buffer, message
+// header, control data and system call.
+BENCHMARK_DEFINE_F(Fixture, BM_perReceiver)(::benchmark::State &state) {
+	for (auto _ : state) {
+		for (std::unique_ptr< Receiver > &current : receivers) {
+			thread_local std::vector< char > ebuffer;
+			ebuffer.resize(PLAINTEXT_SIZE + 4 + 16);
+			unsigned char *buffer = reinterpret_cast< unsigned char * >(
+				((reinterpret_cast< quint64 >(ebuffer.data()) + 8) & static_cast< quint64 >(~7)) + 4);
+
+			sockaddr_storage udpAddress;
+			{
+				std::lock_guard< std::mutex > lock(current->cryptMutex);
+
+				current->crypt.encrypt(plaintext, buffer, PLAINTEXT_SIZE);
+
+				udpAddress = current->udpAddress;
+			}
+
+			struct msghdr msg;
+			struct iovec iov[1];
+
+			iov[0].iov_base = buffer;
+			iov[0].iov_len  = PLAINTEXT_SIZE + 4;
+
+			uint8_t controldata[UDP_PKTINFO_SPACE];
+
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_name    = reinterpret_cast< struct sockaddr * >(&udpAddress);
+			msg.msg_namelen = sizeof(struct sockaddr_in);
+			msg.msg_iov     = iov;
+			msg.msg_iovlen  = 1;
+			msg.msg_control = controldata;
+
+			setUDPPacketInfo(msg, udpAddress, HostAddress(current->localAddress));
+
+			benchmark::DoNotOptimize(::sendmsg(sender, &msg, 0));
+		}
+	}
+
+	reportPerReceiver(state);
+}
+
+BENCHMARK_REGISTER_F(Fixture, BM_perReceiver)->Arg(1)->Arg(10)->Arg(100)->Arg(1000);
+
+
+// Mirrors the fan-out via a UDPSendBatch: every copy is encrypted into the batch's preallocated arena and all copies
+// are handed to the kernel with as few sendmmsg calls as possible.
+BENCHMARK_DEFINE_F(Fixture, BM_sendBatch)(::benchmark::State &state) {
+	UDPSendBatch batch(udpSendBatchCapacity(1));
+
+	for (auto _ : state) {
+		for (std::unique_ptr< Receiver > &current : receivers) {
+			unsigned char *buffer = batch.nextBuffer();
+
+			sockaddr_storage udpAddress;
+			{
+				std::lock_guard< std::mutex > lock(current->cryptMutex);
+
+				current->crypt.encrypt(plaintext, buffer, PLAINTEXT_SIZE);
+
+				udpAddress = current->udpAddress;
+			}
+
+			batch.commit(sender, PLAINTEXT_SIZE + 4, udpAddress, current->haLocalAddress);
+		}
+
+		batch.flush();
+	}
+
+	reportPerReceiver(state);
+}
+
+BENCHMARK_REGISTER_F(Fixture, BM_sendBatch)->Arg(1)->Arg(10)->Arg(100)->Arg(1000);
+
+
+BENCHMARK_MAIN();
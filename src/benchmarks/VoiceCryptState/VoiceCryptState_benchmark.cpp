@@ -0,0 +1,100 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+// Measures how encrypting packets for the same receivers scales with the number of voice threads doing so at the
+// same time (e.g. because the speakers of a channel are handled by different threads). Every thread encrypts one
+// packet for each receiver per iteration.
+
+#include <benchmark/benchmark.h>
+
+#include "VoiceCryptState.h"
+#include "crypto/CryptStateOCB2.h"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+constexpr std::size_t RECEIVER_COUNT = 20;
+
+// Roughly the size of a 20ms Opus frame at 64 kbit/s (plus the protocol's header)
+constexpr unsigned int PLAINTEXT_SIZE = 176;
+
+/// A receiver as it used to be: a single crypt state protected by a mutex
+struct LockedReceiver {
+	CryptStateOCB2 crypt;
+	std::mutex cryptMutex;
+};
+
+std::vector< std::unique_ptr< LockedReceiver > > &lockedReceivers() {
+	static std::vector< std::unique_ptr< LockedReceiver > > receivers = []() {
+		std::vector< std::unique_ptr< LockedReceiver > > created;
+		for (std::size_t i = 0; i < RECEIVER_COUNT; ++i) {
+			created.push_back(std::make_unique< LockedReceiver >());
+			created.back()->crypt.genKey();
+		}
+		return created;
+	}();
+
+	return receivers;
+}
+
+std::vector< std::unique_ptr< VoiceCryptState > > &voiceReceivers() {
+	static std::vector< std::unique_ptr< VoiceCryptState > > receivers = []() {
+		std::vector< std::unique_ptr< VoiceCryptState > > created;
+		for (std::size_t i = 0; i < RECEIVER_COUNT; ++i) {
+			created.push_back(std::make_unique< VoiceCryptState >());
+			created.back()->genKey();
+		}
+		return created;
+	}();
+
+	return receivers;
+}
+
+
+static void BM_mutex(::benchmark::State &state) {
+	std::vector< std::unique_ptr< LockedReceiver > > &receivers = lockedReceivers();
+
+	const unsigned char plaintext[PLAINTEXT_SIZE] = {};
+	unsigned char buffer[PLAINTEXT_SIZE + 4];
+
+	for (auto _ : state) {
+		for (std::unique_ptr< LockedReceiver > &receiver : receivers) {
+			std::lock_guard< std::mutex > lock(receiver->cryptMutex);
+
+			receiver->crypt.encrypt(plaintext, buffer, PLAINTEXT_SIZE);
+		}
+
+		benchmark::DoNotOptimize(buffer);
+	}
+
+	state.SetItemsProcessed(state.iterations() * static_cast< int64_t >(RECEIVER_COUNT));
+}
+
+BENCHMARK(BM_mutex)->ThreadRange(1, 8)->UseRealTime();
+
+
+static void BM_voiceCryptState(::benchmark::State &state) {
+	std::vector< std::unique_ptr< VoiceCryptState > > &receivers = voiceReceivers();
+
+	const unsigned int slot                       = static_cast< unsigned int >(state.thread_index());
+	const unsigned char plaintext[PLAINTEXT_SIZE] = {};
+	unsigned char buffer[PLAINTEXT_SIZE + 4];
+
+	for (auto _ : state) {
+		for (std::unique_ptr< VoiceCryptState > &receiver : receivers) {
+			receiver->encrypt(slot, plaintext, buffer, PLAINTEXT_SIZE);
+		}
+
+		benchmark::DoNotOptimize(buffer);
+	}
+
+	state.SetItemsProcessed(state.iterations() * static_cast< int64_t >(RECEIVER_COUNT));
+}
+
+BENCHMARK(BM_voiceCryptState)->ThreadRange(1, 8)->UseRealTime();
+
+
+BENCHMARK_MAIN();
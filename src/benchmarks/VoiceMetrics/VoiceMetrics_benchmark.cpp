@@ -0,0 +1,58 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+// Measures what the voice metrics add to the processing of a single audio packet: the counters and histograms the
+// receiving thread records into plus the two clock reads needed for the latency. Every thread records into its own
+// slot, just like the voice threads do.
+
+#include <benchmark/benchmark.h>
+
+#include "VoiceMetrics.h"
+
+#include <chrono>
+#include <cstdint>
+
+constexpr unsigned int RECEIVER_COUNT = 20;
+
+// Roughly the size of an encrypted 20ms Opus frame at 64 kbit/s
+constexpr std::uint64_t PACKET_SIZE = 180;
+
+VoiceMetrics &metrics() {
+	static VoiceMetrics instance(64);
+	return instance;
+}
+
+static void BM_recordPacket(benchmark::State &state) {
+	VoiceThreadMetrics &slot = metrics().forSlot(static_cast< unsigned int >(state.thread_index()));
+
+	for (auto _ : state) {
+		const std::chrono::steady_clock::time_point received = std::chrono::steady_clock::now();
+
+		slot.add(VoiceCounter::UDPPacketsReceived);
+		slot.add(VoiceCounter::UDPBytesReceived, PACKET_SIZE);
+		slot.receivers.record(RECEIVER_COUNT);
+		for (unsigned int i = 0; i < RECEIVER_COUNT; ++i) {
+			slot.add(VoiceCounter::UDPPacketsSent);
+			slot.add(VoiceCounter::UDPBytesSent, PACKET_SIZE);
+		}
+
+		const std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - received;
+		slot.latency.record(
+			static_cast< std::uint64_t >(std::chrono::duration_cast< std::chrono::microseconds >(elapsed).count()));
+	}
+
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations()));
+}
+
+static void BM_snapshot(benchmark::State &state) {
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(metrics().snapshot());
+	}
+}
+
+BENCHMARK(BM_recordPacket)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_snapshot);
+
+BENCHMARK_MAIN();
@@ -25,104 +25,72 @@
 #include "CryptStateOCB2.h"
 #include "CryptographicRandom.h"
 
+#include <algorithm>
 #include <cstring>
 #include <openssl/rand.h>
 
-CryptStateOCB2::CryptStateOCB2()
-	: CryptState(), enc_ctx_ocb_enc(EVP_CIPHER_CTX_new()), dec_ctx_ocb_enc(EVP_CIPHER_CTX_new()),
-	  enc_ctx_ocb_dec(EVP_CIPHER_CTX_new()), dec_ctx_ocb_dec(EVP_CIPHER_CTX_new()) {
-	for (int i = 0; i < 0x100; i++)
-		decrypt_history[i] = 0;
-	memset(raw_key, 0, AES_KEY_SIZE_BYTES);
-	memset(encrypt_iv, 0, AES_BLOCK_SIZE);
-	memset(decrypt_iv, 0, AES_BLOCK_SIZE);
+CryptStateOCB2Encryptor::CryptStateOCB2Encryptor() : enc_ctx(EVP_CIPHER_CTX_new()) {
+	const unsigned char zeroKey[AES_KEY_SIZE_BYTES] = {};
+	setKey(zeroKey);
 }
 
-CryptStateOCB2::~CryptStateOCB2() noexcept {
-	EVP_CIPHER_CTX_free(enc_ctx_ocb_enc);
-	EVP_CIPHER_CTX_free(dec_ctx_ocb_enc);
-	EVP_CIPHER_CTX_free(enc_ctx_ocb_dec);
-	EVP_CIPHER_CTX_free(dec_ctx_ocb_dec);
+CryptStateOCB2Encryptor::~CryptStateOCB2Encryptor() noexcept {
+	EVP_CIPHER_CTX_free(enc_ctx);
 }
 
-bool CryptStateOCB2::isValid() const {
-	return bInit;
+void CryptStateOCB2Encryptor::setKey(const unsigned char *rawKey) {
+	// The key schedule is computed once per key instead of once per block. As padding is disabled and we only ever
+	// pass whole blocks, the context never holds back any data and can be used for any number of packets.
+	EVP_EncryptInit_ex(enc_ctx, EVP_aes_128_ecb(), nullptr, rawKey, nullptr);
+	EVP_CIPHER_CTX_set_padding(enc_ctx, 0);
 }
 
-void CryptStateOCB2::genKey() {
-	CryptographicRandom::fillBuffer(raw_key, AES_KEY_SIZE_BYTES);
-	CryptographicRandom::fillBuffer(encrypt_iv, AES_BLOCK_SIZE);
-	CryptographicRandom::fillBuffer(decrypt_iv, AES_BLOCK_SIZE);
-	bInit = true;
-}
+bool CryptStateOCB2Encryptor::encrypt(const unsigned char *source, unsigned char *dst, unsigned int plain_length,
+									  const unsigned char *iv) {
+	unsigned char tag[AES_BLOCK_SIZE];
 
-bool CryptStateOCB2::setKey(const std::string &rkey, const std::string &eiv, const std::string &div) {
-	if (rkey.length() == AES_KEY_SIZE_BYTES && eiv.length() == AES_BLOCK_SIZE && div.length() == AES_BLOCK_SIZE) {
-		memcpy(raw_key, rkey.data(), AES_KEY_SIZE_BYTES);
-		memcpy(encrypt_iv, eiv.data(), AES_BLOCK_SIZE);
-		memcpy(decrypt_iv, div.data(), AES_BLOCK_SIZE);
-		bInit = true;
-		return true;
+	if (!ocb_encrypt(source, dst + 4, plain_length, iv, tag)) {
+		return false;
 	}
-	return false;
-}
 
-bool CryptStateOCB2::setRawKey(const std::string &rkey) {
-	if (rkey.length() == AES_KEY_SIZE_BYTES) {
-		memcpy(raw_key, rkey.data(), AES_KEY_SIZE_BYTES);
-		return true;
-	}
-	return false;
+	dst[0] = iv[0];
+	dst[1] = tag[0];
+	dst[2] = tag[1];
+	dst[3] = tag[2];
+	return true;
 }
 
-bool CryptStateOCB2::setEncryptIV(const std::string &iv) {
-	if (iv.length() == AES_BLOCK_SIZE) {
-		memcpy(encrypt_iv, iv.data(), AES_BLOCK_SIZE);
-		return true;
-	}
-	return false;
-}
+CryptStateOCB2Decryptor::CryptStateOCB2Decryptor() : enc_ctx(EVP_CIPHER_CTX_new()), dec_ctx(EVP_CIPHER_CTX_new()) {
+	for (int i = 0; i < 0x100; i++)
+		decrypt_history[i] = 0;
+	memset(decrypt_iv, 0, AES_BLOCK_SIZE);
 
-bool CryptStateOCB2::setDecryptIV(const std::string &iv) {
-	if (iv.length() == AES_BLOCK_SIZE) {
-		memcpy(decrypt_iv, iv.data(), AES_BLOCK_SIZE);
-		return true;
-	}
-	return false;
+	const unsigned char zeroKey[AES_KEY_SIZE_BYTES] = {};
+	setKey(zeroKey);
 }
 
-std::string CryptStateOCB2::getRawKey() {
-	return std::string(reinterpret_cast< const char * >(raw_key), AES_KEY_SIZE_BYTES);
+CryptStateOCB2Decryptor::~CryptStateOCB2Decryptor() noexcept {
+	EVP_CIPHER_CTX_free(enc_ctx);
+	EVP_CIPHER_CTX_free(dec_ctx);
 }
 
-std::string CryptStateOCB2::getEncryptIV() {
-	return std::string(reinterpret_cast< const char * >(encrypt_iv), AES_BLOCK_SIZE);
+void CryptStateOCB2Decryptor::setKey(const unsigned char *rawKey) {
+	EVP_EncryptInit_ex(enc_ctx, EVP_aes_128_ecb(), nullptr, rawKey, nullptr);
+	EVP_CIPHER_CTX_set_padding(enc_ctx, 0);
+	EVP_DecryptInit_ex(dec_ctx, EVP_aes_128_ecb(), nullptr, rawKey, nullptr);
+	EVP_CIPHER_CTX_set_padding(dec_ctx, 0);
 }
 
-std::string CryptStateOCB2::getDecryptIV() {
-	return std::string(reinterpret_cast< const char * >(decrypt_iv), AES_BLOCK_SIZE);
+void CryptStateOCB2Decryptor::setIV(const unsigned char *iv) {
+	memcpy(decrypt_iv, iv, AES_BLOCK_SIZE);
 }
 
-bool CryptStateOCB2::encrypt(const unsigned char *source, unsigned char *dst, unsigned int plain_length) {
-	unsigned char tag[AES_BLOCK_SIZE];
-
-	// First, increase our IV.
-	for (int i = 0; i < AES_BLOCK_SIZE; i++)
-		if (++encrypt_iv[i])
-			break;
-
-	if (!ocb_encrypt(source, dst + 4, plain_length, encrypt_iv, tag)) {
-		return false;
-	}
-
-	dst[0] = encrypt_iv[0];
-	dst[1] = tag[0];
-	dst[2] = tag[1];
-	dst[3] = tag[2];
-	return true;
+const unsigned char *CryptStateOCB2Decryptor::getIV() const {
+	return decrypt_iv;
 }
 
-bool CryptStateOCB2::decrypt(const unsigned char *source, unsigned char *dst, unsigned int crypted_length) {
+bool CryptStateOCB2Decryptor::decrypt(const unsigned char *source, unsigned char *dst, unsigned int crypted_length,
+									  int &lost, int &late) {
 	if (crypted_length < 4)
 		return false;
 
@@ -133,8 +101,8 @@ bool CryptStateOCB2::decrypt(const unsigned char *source, unsigned char *dst, un
 	bool restore         = false;
 	unsigned char tag[AES_BLOCK_SIZE];
 
-	int lost = 0;
-	int late = 0;
+	lost = 0;
+	late = 0;
 
 	memcpy(saveiv, decrypt_iv, AES_BLOCK_SIZE);
 
@@ -206,6 +174,101 @@ bool CryptStateOCB2::decrypt(const unsigned char *source, unsigned char *dst, un
 	if (restore)
 		memcpy(decrypt_iv, saveiv, AES_BLOCK_SIZE);
 
+	return true;
+}
+
+CryptStateOCB2::CryptStateOCB2() : CryptState() {
+	memset(raw_key, 0, AES_KEY_SIZE_BYTES);
+	memset(encrypt_iv, 0, AES_BLOCK_SIZE);
+}
+
+CryptStateOCB2::~CryptStateOCB2() noexcept {
+}
+
+bool CryptStateOCB2::isValid() const {
+	return bInit;
+}
+
+void CryptStateOCB2::genKey() {
+	unsigned char decrypt_iv[AES_BLOCK_SIZE];
+
+	CryptographicRandom::fillBuffer(raw_key, AES_KEY_SIZE_BYTES);
+	CryptographicRandom::fillBuffer(encrypt_iv, AES_BLOCK_SIZE);
+	CryptographicRandom::fillBuffer(decrypt_iv, AES_BLOCK_SIZE);
+	encryptor.setKey(raw_key);
+	decryptor.setKey(raw_key);
+	decryptor.setIV(decrypt_iv);
+	bInit = true;
+}
+
+bool CryptStateOCB2::setKey(const std::string &rkey, const std::string &eiv, const std::string &div) {
+	if (rkey.length() == AES_KEY_SIZE_BYTES && eiv.length() == AES_BLOCK_SIZE && div.length() == AES_BLOCK_SIZE) {
+		memcpy(raw_key, rkey.data(), AES_KEY_SIZE_BYTES);
+		memcpy(encrypt_iv, eiv.data(), AES_BLOCK_SIZE);
+		encryptor.setKey(raw_key);
+		decryptor.setKey(raw_key);
+		decryptor.setIV(reinterpret_cast< const unsigned char * >(div.data()));
+		bInit = true;
+		return true;
+	}
+	return false;
+}
+
+bool CryptStateOCB2::setRawKey(const std::string &rkey) {
+	if (rkey.length() == AES_KEY_SIZE_BYTES) {
+		memcpy(raw_key, rkey.data(), AES_KEY_SIZE_BYTES);
+		encryptor.setKey(raw_key);
+		decryptor.setKey(raw_key);
+		return true;
+	}
+	return false;
+}
+
+bool CryptStateOCB2::setEncryptIV(const std::string &iv) {
+	if (iv.length() == AES_BLOCK_SIZE) {
+		memcpy(encrypt_iv, iv.data(), AES_BLOCK_SIZE);
+		return true;
+	}
+	return false;
+}
+
+bool CryptStateOCB2::setDecryptIV(const std::string &iv) {
+	if (iv.length() == AES_BLOCK_SIZE) {
+		decryptor.setIV(reinterpret_cast< const unsigned char * >(iv.data()));
+		return true;
+	}
+	return false;
+}
+
+std::string CryptStateOCB2::getRawKey() {
+	return std::string(reinterpret_cast< const char * >(raw_key), AES_KEY_SIZE_BYTES);
+}
+
+std::string CryptStateOCB2::getEncryptIV() {
+	return std::string(reinterpret_cast< const char * >(encrypt_iv), AES_BLOCK_SIZE);
+}
+
+std::string CryptStateOCB2::getDecryptIV() {
+	return std::string(reinterpret_cast< const char * >(decryptor.getIV()), AES_BLOCK_SIZE);
+}
+
+bool CryptStateOCB2::encrypt(const unsigned char *source, unsigned char *dst, unsigned int plain_length) {
+	// First, increase our IV.
+	for (int i = 0; i < AES_BLOCK_SIZE; i++)
+		if (++encrypt_iv[i])
+			break;
+
+	return encryptor.encrypt(source, dst, plain_length, encrypt_iv);
+}
+
+bool CryptStateOCB2::decrypt(const unsigned char *source, unsigned char *dst, unsigned int crypted_length) {
+	int lost = 0;
+	int late = 0;
+
+	if (!decryptor.decrypt(source, dst, crypted_length, lost, late)) {
+		return false;
+	}
+
 	uiGood++;
 	// uiLate += late, but we have to make sure we don't cause wrap-arounds on the unsigned lhs
 	if (late > 0) {
@@ -224,6 +287,16 @@ bool CryptStateOCB2::decrypt(const unsigned char *source, unsigned char *dst, un
 	return true;
 }
 
+bool CryptStateOCB2::ocb_encrypt(const unsigned char *plain, unsigned char *encrypted, unsigned int len,
+								 const unsigned char *nonce, unsigned char *tag, bool modifyPlainOnXEXStarAttack) {
+	return encryptor.ocb_encrypt(plain, encrypted, len, nonce, tag, modifyPlainOnXEXStarAttack);
+}
+
+bool CryptStateOCB2::ocb_decrypt(const unsigned char *encrypted, unsigned char *plain, unsigned int len,
+								 const unsigned char *nonce, unsigned char *tag) {
+	return decryptor.ocb_decrypt(encrypted, plain, len, nonce, tag);
+}
+
 #if defined(__LP64__)
 
 #	define BLOCKSIZE 2
@@ -269,83 +342,114 @@ static void inline ZERO(keyblock &block) {
 		block[i] = 0;
 }
 
-#define AESencrypt_ctx(src, dst, key, enc_ctx)                                                      \
-	{                                                                                               \
-		int outlen = 0;                                                                             \
-		EVP_EncryptInit_ex(enc_ctx, EVP_aes_128_ecb(), NULL, key, NULL);                            \
-		EVP_CIPHER_CTX_set_padding(enc_ctx, 0);                                                     \
-		EVP_EncryptUpdate(enc_ctx, reinterpret_cast< unsigned char * >(dst), &outlen,               \
-						  reinterpret_cast< const unsigned char * >(src), AES_BLOCK_SIZE);          \
-		EVP_EncryptFinal_ex(enc_ctx, reinterpret_cast< unsigned char * >((dst) + outlen), &outlen); \
-	}
-#define AESdecrypt_ctx(src, dst, key, dec_ctx)                                                      \
-	{                                                                                               \
-		int outlen = 0;                                                                             \
-		EVP_DecryptInit_ex(dec_ctx, EVP_aes_128_ecb(), NULL, key, NULL);                            \
-		EVP_CIPHER_CTX_set_padding(dec_ctx, 0);                                                     \
-		EVP_DecryptUpdate(dec_ctx, reinterpret_cast< unsigned char * >(dst), &outlen,               \
-						  reinterpret_cast< const unsigned char * >(src), AES_BLOCK_SIZE);          \
-		EVP_DecryptFinal_ex(dec_ctx, reinterpret_cast< unsigned char * >((dst) + outlen), &outlen); \
-	}
+static void inline COPY(keyblock &dst, const keyblock &src) {
+	for (int i = 0; i < BLOCKSIZE; i++)
+		dst[i] = src[i];
+}
 
-#define AESencrypt(src, dst, key) AESencrypt_ctx(src, dst, key, enc_ctx_ocb_enc)
-#define AESdecrypt(src, dst, key) AESdecrypt_ctx(src, dst, key, dec_ctx_ocb_enc)
+/// The maximum amount of blocks passed to OpenSSL at once. This covers every voice packet, longer messages are
+/// processed in multiple chunks.
+static constexpr unsigned int MAX_CHUNK_BLOCKS = 64;
 
-bool CryptStateOCB2::ocb_encrypt(const unsigned char *plain, unsigned char *encrypted, unsigned int len,
-								 const unsigned char *nonce, unsigned char *tag, bool modifyPlainOnXEXStarAttack) {
+/// Encrypts the given amount of consecutive blocks with a context that has been set up by setKey.
+/// Passing all blocks of a packet in a single call allows OpenSSL to pipeline them (e.g. using AES-NI).
+static void inline AESencryptBlocks(EVP_CIPHER_CTX *ctx, const void *src, void *dst, unsigned int blocks) {
+	int outlen = 0;
+	EVP_EncryptUpdate(ctx, reinterpret_cast< unsigned char * >(dst), &outlen,
+					  reinterpret_cast< const unsigned char * >(src), static_cast< int >(blocks * AES_BLOCK_SIZE));
+}
+
+/// Decrypts the given amount of consecutive blocks with a context that has been set up by setKey
+static void inline AESdecryptBlocks(EVP_CIPHER_CTX *ctx, const void *src, void *dst, unsigned int blocks) {
+	int outlen = 0;
+	EVP_DecryptUpdate(ctx, reinterpret_cast< unsigned char * >(dst), &outlen,
+					  reinterpret_cast< const unsigned char * >(src), static_cast< int >(blocks * AES_BLOCK_SIZE));
+}
+
+bool CryptStateOCB2Encryptor::ocb_encrypt(const unsigned char *plain, unsigned char *encrypted, unsigned int len,
+										  const unsigned char *nonce, unsigned char *tag,
+										  bool modifyPlainOnXEXStarAttack) {
 	keyblock checksum, delta, tmp, pad;
+	// The offsets of the blocks of the current chunk and the blocks to be passed through AES (one more than the
+	// chunk size for the pad of the final block)
+	keyblock deltas[MAX_CHUNK_BLOCKS];
+	keyblock blocks[MAX_CHUNK_BLOCKS + 1];
 	bool success = true;
 
 	// Initialize
-	AESencrypt(nonce, delta, raw_key);
+	AESencryptBlocks(enc_ctx, nonce, delta, 1);
 	ZERO(checksum);
 
-	while (len > AES_BLOCK_SIZE) {
-		// Counter-cryptanalysis described in section 9 of https://eprint.iacr.org/2019/311
-		// For an attack, the second to last block (i.e. the last iteration of this loop)
-		// must be all 0 except for the last byte (which may be 0 - 128).
-		bool flipABit = false; // *plain is const, so we can't directly modify it
-		if (len - AES_BLOCK_SIZE <= AES_BLOCK_SIZE) {
-			unsigned char sum = 0;
-			for (int i = 0; i < AES_BLOCK_SIZE - 1; ++i) {
-				sum |= plain[i];
-			}
-			if (sum == 0) {
-				if (modifyPlainOnXEXStarAttack) {
-					// The assumption that critical packets do not turn up by pure chance turned out to be incorrect
-					// since digital silence appears to produce them in mass.
-					// So instead we now modify the packet in a way which should not affect the audio but will
-					// prevent the attack.
-					flipABit = true;
-				} else {
-					// This option still exists but only to allow us to test ocb_decrypt's detection.
-					success = false;
+	// All blocks except for the final one (which may be partial) are full blocks
+	unsigned int remainingBlocks = (len > 0) ? (len - 1) / AES_BLOCK_SIZE : 0;
+	len -= remainingBlocks * AES_BLOCK_SIZE;
+
+	while (true) {
+		const unsigned int chunkBlocks = std::min(remainingBlocks, MAX_CHUNK_BLOCKS);
+		const bool isLastChunk         = chunkBlocks == remainingBlocks;
+
+		for (unsigned int i = 0; i < chunkBlocks; ++i) {
+			const unsigned char *plainBlock = plain + i * AES_BLOCK_SIZE;
+
+			// Counter-cryptanalysis described in section 9 of https://eprint.iacr.org/2019/311
+			// For an attack, the second to last block (i.e. the last full block) must be all 0 except for the
+			// last byte (which may be 0 - 128).
+			bool flipABit = false; // *plain is const, so we can't directly modify it
+			if (isLastChunk && i == chunkBlocks - 1) {
+				unsigned char sum = 0;
+				for (int j = 0; j < AES_BLOCK_SIZE - 1; ++j) {
+					sum |= plainBlock[j];
 				}
+				if (sum == 0) {
+					if (modifyPlainOnXEXStarAttack) {
+						// The assumption that critical packets do not turn up by pure chance turned out to be
+						// incorrect since digital silence appears to produce them in mass.
+						// So instead we now modify the packet in a way which should not affect the audio but will
+						// prevent the attack.
+						flipABit = true;
+					} else {
+						// This option still exists but only to allow us to test ocb_decrypt's detection.
+						success = false;
+					}
+				}
+			}
+
+			S2(delta);
+			COPY(deltas[i], delta);
+			XOR(blocks[i], delta, reinterpret_cast< const subblock * >(plainBlock));
+			XOR(checksum, checksum, reinterpret_cast< const subblock * >(plainBlock));
+			if (flipABit) {
+				*reinterpret_cast< unsigned char * >(blocks[i]) ^= 1;
+				*reinterpret_cast< unsigned char * >(checksum) ^= 1;
 			}
 		}
 
-		S2(delta);
-		XOR(tmp, delta, reinterpret_cast< const subblock * >(plain));
-		if (flipABit) {
-			*reinterpret_cast< unsigned char * >(tmp) ^= 1;
+		unsigned int aesBlocks = chunkBlocks;
+		if (isLastChunk) {
+			// The pad of the final block doesn't depend on the data, so it is encrypted in the same pass
+			S2(delta);
+			ZERO(blocks[chunkBlocks]);
+			blocks[chunkBlocks][BLOCKSIZE - 1] = SWAPPED(len * 8);
+			XOR(blocks[chunkBlocks], blocks[chunkBlocks], delta);
+			++aesBlocks;
 		}
-		AESencrypt(tmp, tmp, raw_key);
-		XOR(reinterpret_cast< subblock * >(encrypted), delta, tmp);
-		XOR(checksum, checksum, reinterpret_cast< const subblock * >(plain));
-		if (flipABit) {
-			*reinterpret_cast< unsigned char * >(checksum) ^= 1;
+
+		AESencryptBlocks(enc_ctx, blocks, blocks, aesBlocks);
+
+		for (unsigned int i = 0; i < chunkBlocks; ++i) {
+			XOR(reinterpret_cast< subblock * >(encrypted + i * AES_BLOCK_SIZE), deltas[i], blocks[i]);
 		}
 
-		len -= AES_BLOCK_SIZE;
-		plain += AES_BLOCK_SIZE;
-		encrypted += AES_BLOCK_SIZE;
+		plain += chunkBlocks * AES_BLOCK_SIZE;
+		encrypted += chunkBlocks * AES_BLOCK_SIZE;
+		remainingBlocks -= chunkBlocks;
+
+		if (isLastChunk) {
+			COPY(pad, blocks[chunkBlocks]);
+			break;
+		}
 	}
 
-	S2(delta);
-	ZERO(tmp);
-	tmp[BLOCKSIZE - 1] = SWAPPED(len * 8);
-	XOR(tmp, tmp, delta);
-	AESencrypt(tmp, pad, raw_key);
 	memcpy(tmp, plain, len);
 	memcpy(reinterpret_cast< unsigned char * >(tmp) + len, reinterpret_cast< const unsigned char * >(pad) + len,
 		   AES_BLOCK_SIZE - len);
@@ -355,42 +459,54 @@ bool CryptStateOCB2::ocb_encrypt(const unsigned char *plain, unsigned char *encr
 
 	S3(delta);
 	XOR(tmp, delta, checksum);
-	AESencrypt(tmp, tag, raw_key);
+	AESencryptBlocks(enc_ctx, tmp, tag, 1);
 
 	return success;
 }
 
-#undef AESencrypt
-#undef AESdecrypt
-
-#define AESencrypt(src, dst, key) AESencrypt_ctx(src, dst, key, enc_ctx_ocb_dec)
-#define AESdecrypt(src, dst, key) AESdecrypt_ctx(src, dst, key, dec_ctx_ocb_dec)
-
-bool CryptStateOCB2::ocb_decrypt(const unsigned char *encrypted, unsigned char *plain, unsigned int len,
-								 const unsigned char *nonce, unsigned char *tag) {
+bool CryptStateOCB2Decryptor::ocb_decrypt(const unsigned char *encrypted, unsigned char *plain, unsigned int len,
+										  const unsigned char *nonce, unsigned char *tag) {
 	keyblock checksum, delta, tmp, pad;
+	keyblock deltas[MAX_CHUNK_BLOCKS];
+	keyblock blocks[MAX_CHUNK_BLOCKS];
 	bool success = true;
 
 	// Initialize
-	AESencrypt(nonce, delta, raw_key);
+	AESencryptBlocks(enc_ctx, nonce, delta, 1);
 	ZERO(checksum);
 
-	while (len > AES_BLOCK_SIZE) {
-		S2(delta);
-		XOR(tmp, delta, reinterpret_cast< const subblock * >(encrypted));
-		AESdecrypt(tmp, tmp, raw_key);
-		XOR(reinterpret_cast< subblock * >(plain), delta, tmp);
-		XOR(checksum, checksum, reinterpret_cast< const subblock * >(plain));
-		len -= AES_BLOCK_SIZE;
-		plain += AES_BLOCK_SIZE;
-		encrypted += AES_BLOCK_SIZE;
+	// All blocks except for the final one (which may be partial) are full blocks
+	unsigned int remainingBlocks = (len > 0) ? (len - 1) / AES_BLOCK_SIZE : 0;
+	len -= remainingBlocks * AES_BLOCK_SIZE;
+
+	while (remainingBlocks > 0) {
+		const unsigned int chunkBlocks = std::min(remainingBlocks, MAX_CHUNK_BLOCKS);
+
+		for (unsigned int i = 0; i < chunkBlocks; ++i) {
+			S2(delta);
+			COPY(deltas[i], delta);
+			XOR(blocks[i], delta, reinterpret_cast< const subblock * >(encrypted + i * AES_BLOCK_SIZE));
+		}
+
+		AESdecryptBlocks(dec_ctx, blocks, blocks, chunkBlocks);
+
+		for (unsigned int i = 0; i < chunkBlocks; ++i) {
+			subblock *plainBlock = reinterpret_cast< subblock * >(plain + i * AES_BLOCK_SIZE);
+
+			XOR(plainBlock, deltas[i], blocks[i]);
+			XOR(checksum, checksum, plainBlock);
+		}
+
+		plain += chunkBlocks * AES_BLOCK_SIZE;
+		encrypted += chunkBlocks * AES_BLOCK_SIZE;
+		remainingBlocks -= chunkBlocks;
 	}
 
 	S2(delta);
 	ZERO(tmp);
 	tmp[BLOCKSIZE - 1] = SWAPPED(len * 8);
 	XOR(tmp, tmp, delta);
-	AESencrypt(tmp, pad, raw_key);
+	AESencryptBlocks(enc_ctx, tmp, pad, 1);
 	memset(tmp, 0, AES_BLOCK_SIZE);
 	memcpy(tmp, encrypted, len);
 	XOR(tmp, tmp, pad);
@@ -408,13 +524,11 @@ bool CryptStateOCB2::ocb_decrypt(const unsigned char *encrypted, unsigned char *
 
 	S3(delta);
 	XOR(tmp, delta, checksum);
-	AESencrypt(tmp, tag, raw_key);
+	AESencryptBlocks(enc_ctx, tmp, tag, 1);
 
 	return success;
 }
 
-#undef AESencrypt
-#undef AESdecrypt
 #undef BLOCKSIZE
 #undef SHIFTBITS
 #undef SWAPPED
@@ -15,6 +15,56 @@
 #define AES_KEY_SIZE_BYTES (AES_KEY_SIZE_BITS / 8)
 
 
+/// The encrypting half of an OCB2-AES128 crypt state. It only holds the key, which means that it can be combined with
+/// any source of IVs. An instance must not be used by multiple threads at the same time.
+class CryptStateOCB2Encryptor {
+private:
+	Q_DISABLE_COPY(CryptStateOCB2Encryptor)
+public:
+	CryptStateOCB2Encryptor();
+	~CryptStateOCB2Encryptor() noexcept;
+
+	void setKey(const unsigned char *rawKey);
+
+	/// Encrypts a packet using the given IV (which has to be different for every packet) and prefixes it with the
+	/// IV's first byte and the first three bytes of the tag. dst has to provide room for plain_length + 4 bytes.
+	bool encrypt(const unsigned char *source, unsigned char *dst, unsigned int plain_length, const unsigned char *iv);
+
+	bool ocb_encrypt(const unsigned char *plain, unsigned char *encrypted, unsigned int len, const unsigned char *nonce,
+					 unsigned char *tag, bool modifyPlainOnXEXStarAttack = true);
+
+private:
+	EVP_CIPHER_CTX *enc_ctx;
+};
+
+/// The decrypting half of an OCB2-AES128 crypt state: the key, the IV of the most recent packet and the history used
+/// to reject replayed packets. An instance must not be used by multiple threads at the same time.
+class CryptStateOCB2Decryptor {
+private:
+	Q_DISABLE_COPY(CryptStateOCB2Decryptor)
+public:
+	CryptStateOCB2Decryptor();
+	~CryptStateOCB2Decryptor() noexcept;
+
+	void setKey(const unsigned char *rawKey);
+	void setIV(const unsigned char *iv);
+	const unsigned char *getIV() const;
+
+	/// Decrypts a packet created by CryptStateOCB2Encryptor::encrypt. On success, lost and late are set to the amount
+	/// by which the number of lost and late packets changed (both may be negative).
+	bool decrypt(const unsigned char *source, unsigned char *dst, unsigned int crypted_length, int &lost, int &late);
+
+	bool ocb_decrypt(const unsigned char *encrypted, unsigned char *plain, unsigned int len, const unsigned char *nonce,
+					 unsigned char *tag);
+
+private:
+	unsigned char decrypt_iv[AES_BLOCK_SIZE];
+	unsigned char decrypt_history[0x100];
+
+	EVP_CIPHER_CTX *enc_ctx;
+	EVP_CIPHER_CTX *dec_ctx;
+};
+
 class CryptStateOCB2 : public CryptState {
 public:
 	CryptStateOCB2();
@@ -41,13 +91,9 @@ public:
 private:
 	unsigned char raw_key[AES_KEY_SIZE_BYTES];
 	unsigned char encrypt_iv[AES_BLOCK_SIZE];
-	unsigned char decrypt_iv[AES_BLOCK_SIZE];
-	unsigned char decrypt_history[0x100];
 
-	EVP_CIPHER_CTX *enc_ctx_ocb_enc;
-	EVP_CIPHER_CTX *dec_ctx_ocb_enc;
-	EVP_CIPHER_CTX *enc_ctx_ocb_dec;
-	EVP_CIPHER_CTX *dec_ctx_ocb_dec;
+	CryptStateOCB2Encryptor encryptor;
+	CryptStateOCB2Decryptor decryptor;
 };
 
 
@@ -10,6 +10,7 @@
 #include "AudioOutputSample.h"
 #include "AudioOutputToken.h"
 #include "Channel.h"
+#include "Database.h"
 #include "MainWindow.h"
 #include "NetworkConfig.h"
 #include "RichTextEditor.h"
@@ -682,10 +683,9 @@ QString Log::validHtml(const QString &html, QTextCursor *tc) {
 		}
 	}
 
-	int messageSize = static_cast< int >(s.width() * s.height());
-	int allowedSize = 2048 * 2048;
+	const qint64 messageSize = static_cast< qint64 >(s.width() * s.height());
 
-	if (messageSize > allowedSize) {
+	if (messageSize > MAX_DISPLAY_AREA) {
 		QString errorSizeMessage = tr("[[ Text object too large to display ]]");
 		if (tc) {
 			tc->insertText(errorSizeMessage);
@@ -954,6 +954,27 @@ QVariant LogDocument::loadResource(int type, const QUrl &url) {
 		return QTextDocument::loadResource(type, url);
 	}
 
+	// Images the server sent by reference are fetched from the server, unless they are cached
+	if (url.isValid() && url.scheme() == QLatin1String(Mumble::Protocol::TEXT_MESSAGE_IMAGE_SCHEME)) {
+		const QByteArray hash = QByteArray::fromHex(url.path().toLatin1());
+
+		QImage image;
+		if (image.loadFromData(Global::get().db->blob(hash))) {
+			if (static_cast< qint64 >(image.width()) * static_cast< qint64 >(image.height()) > Log::MAX_DISPLAY_AREA) {
+				// The size of the message has been checked with a placeholder in place of the image
+				image = QImage(1, 1, QImage::Format_Mono);
+			}
+			addResource(type, url, image);
+			return image;
+		}
+
+		if (Global::get().sh) {
+			Global::get().sh->requestTextMessageImage(hash);
+		}
+		// Not added as a resource, so that the image is loaded again once it has been received
+		return QImage(1, 1, QImage::Format_Mono);
+	}
+
 	QImage qi(1, 1, QImage::Format_Mono);
 	addResource(type, url, qi);
 
@@ -137,6 +137,9 @@ protected:
 	void postQtNotification(MsgType mt, const QString &plain);
 
 public:
+	/// The largest area (in pixels) a text object may take up in order to be displayed
+	static constexpr qint64 MAX_DISPLAY_AREA = 2048 * 2048;
+
 	Log(QObject *p = nullptr);
 	QString msgName(MsgType t) const;
 	void setIgnore(MsgType t, int ignore = 1 << 30);
@@ -1086,6 +1086,7 @@ void MainWindow::msgCryptSetup(const MumbleProto::CryptSetup &msg) {
 		if (!c->csCrypt->setKey(key, client_nonce, server_nonce)) {
 			qWarning("Messages: Cipher resync failed: Invalid key/nonce from the server!");
 		}
+		Global::get().sh->setUdpToken(msg.has_udp_token() ? msg.udp_token() : std::string());
 	} else if (msg.has_server_nonce()) {
 		const std::string &server_nonce = msg.server_nonce();
 		if (server_nonce.size() == AES_BLOCK_SIZE) {
@@ -1283,6 +1284,33 @@ void MainWindow::msgSuggestConfig(const MumbleProto::SuggestConfig &msg) {
 	}
 }
 
+void MainWindow::msgTextMessageImage(const MumbleProto::TextMessageImage &msg) {
+	if (!msg.has_image()) {
+		// The server doesn't have the image anymore, it stays a placeholder
+		return;
+	}
+
+	const QByteArray hash  = blob(msg.hash());
+	const QByteArray image = blob(msg.image());
+	if (sha1(image) != hash) {
+		return;
+	}
+
+	// The message has been checked by Log::validHtml with a placeholder in place of the image, so the size limit is
+	// enforced here. An image that is too large stays a placeholder.
+	const QImage decoded = QImage::fromData(image);
+	if (decoded.isNull()
+		|| static_cast< qint64 >(decoded.width()) * static_cast< qint64 >(decoded.height()) > Log::MAX_DISPLAY_AREA) {
+		return;
+	}
+
+	Global::get().db->setBlob(hash, image);
+
+	// Lays out the log again, which loads the image from the cache
+	QTextDocument *document = qteLog->document();
+	document->markContentsDirty(0, document->characterCount());
+}
+
 void MainWindow::msgPluginDataTransmission(const MumbleProto::PluginDataTransmission &msg) {
 	// Another client's plugin has sent us some data. Verify the necessary parts are there and delegate it to the
 	// PluginManager
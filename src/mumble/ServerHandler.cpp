@@ -253,6 +253,11 @@ void ServerHandler::udpReady() {
 			continue;
 		}
 
+		if (m_sendUdpToken.load(std::memory_order_relaxed)) {
+			// The server evidently knows our UDP address by now
+			m_sendUdpToken.store(false, std::memory_order_relaxed);
+		}
+
 		if (m_udpDecoder.decode(buffer.subspan(0, buflen - 4))) {
 			switch (m_udpDecoder.getMessageType()) {
 				case Mumble::Protocol::UDPMessageType::Ping: {
@@ -291,7 +296,6 @@ void ServerHandler::handleVoicePacket(const Mumble::Protocol::AudioData &audioDa
 
 void ServerHandler::sendMessage(const unsigned char *data, int len, bool force) {
 	static std::vector< unsigned char > crypto;
-	crypto.resize(static_cast< std::size_t >(len + 4));
 
 	QMutexLocker qml(&qmUdp);
 
@@ -315,11 +319,34 @@ void ServerHandler::sendMessage(const unsigned char *data, int len, bool force)
 		QApplication::postEvent(this,
 								new ServerHandlerMessageEvent(qba, Mumble::Protocol::TCPMessageType::UDPTunnel, true));
 	} else {
-		if (!connection->csCrypt->encrypt(reinterpret_cast< const unsigned char * >(data), crypto.data(),
+		// Until the server has associated our UDP address with us, the token tells it which user the packet belongs to
+		const std::size_t tokenSize =
+			(m_sendUdpToken.load(std::memory_order_relaxed)
+			 && static_cast< std::size_t >(len) + 4 + m_udpToken.size() <= Mumble::Protocol::MAX_UDP_PACKET_SIZE)
+				? m_udpToken.size()
+				: 0;
+		const int packetLength = len + 4 + static_cast< int >(tokenSize);
+		crypto.resize(static_cast< std::size_t >(packetLength));
+		memcpy(crypto.data(), m_udpToken.data(), tokenSize);
+
+		if (!connection->csCrypt->encrypt(reinterpret_cast< const unsigned char * >(data), crypto.data() + tokenSize,
 										  static_cast< unsigned int >(len))) {
 			return;
 		}
-		qusUdp->writeDatagram(reinterpret_cast< const char * >(crypto.data()), len + 4, qhaRemote, usResolvedPort);
+		qusUdp->writeDatagram(reinterpret_cast< const char * >(crypto.data()), packetLength, qhaRemote,
+							  usResolvedPort);
+	}
+}
+
+void ServerHandler::setUdpToken(const std::string &token) {
+	QMutexLocker qml(&qmUdp);
+
+	if (token.size() == Mumble::Protocol::UDP_TOKEN_SIZE) {
+		m_udpToken = token;
+		m_sendUdpToken.store(true, std::memory_order_relaxed);
+	} else {
+		m_udpToken.clear();
+		m_sendUdpToken.store(false, std::memory_order_relaxed);
 	}
 }
 
@@ -792,6 +819,7 @@ void ServerHandler::serverConnectionConnected() {
 		mpa.add_tokens(u8(qs));
 
 	mpa.set_opus(true);
+	mpa.set_image_references(true);
 	sendMessage(mpa);
 
 	{
@@ -970,6 +998,17 @@ void ServerHandler::requestUserList() {
 	sendMessage(mpul);
 }
 
+void ServerHandler::requestTextMessageImage(const QByteArray &hash) {
+	if (m_requestedImages.contains(hash)) {
+		return;
+	}
+	m_requestedImages.insert(hash);
+
+	MumbleProto::RequestBlob mprb;
+	mprb.add_text_message_image(blob(hash));
+	sendMessage(mprb);
+}
+
 void ServerHandler::requestACL(unsigned int channel) {
 	MumbleProto::ACL mpacl;
 	mpacl.set_channel_id(channel);
@@ -23,6 +23,7 @@
 #include <QtCore/QEvent>
 #include <QtCore/QMutex>
 #include <QtCore/QObject>
+#include <QtCore/QSet>
 #include <QtCore/QStringList>
 #include <QtCore/QThread>
 #include <QtCore/QTimer>
@@ -37,6 +38,9 @@
 #include "ServerAddress.h"
 #include "Timer.h"
 
+#include <atomic>
+#include <string>
+
 class Connection;
 class Database;
 class PacketDataStream;
@@ -90,6 +94,14 @@ protected:
 	QHostAddress qhaLocal;
 	QUdpSocket *qusUdp;
 	QMutex qmUdp;
+	/// The token our UDP packets are prefixed with until we receive the first UDP packet from the server (empty if the
+	/// server didn't provide one). Protected by qmUdp.
+	std::string m_udpToken;
+	/// Whether the server still needs m_udpToken in order to associate our UDP packets with us
+	std::atomic< bool > m_sendUdpToken{ false };
+	/// The images of text messages requested from the server. Each is only requested once per connection, as the
+	/// server doesn't have it anymore if it didn't send it. Only used by the GUI thread.
+	QSet< QByteArray > m_requestedImages;
 
 	void handleVoicePacket(const Mumble::Protocol::AudioData &audioData);
 
@@ -136,6 +148,8 @@ public:
 
 	void sendProtoMessage(const ::google::protobuf::Message &msg, Mumble::Protocol::TCPMessageType type);
 	void sendMessage(const unsigned char *data, int len, bool force = false);
+	/// Sets the token received in the server's CryptSetup (see MumbleProto::CryptSetup::udp_token)
+	void setUdpToken(const std::string &token);
 
 	/// @returns Whether this handler is currently connected to a server.
 	bool isConnected() const;
@@ -163,6 +177,9 @@ public:
 					   bool temporary, unsigned int maxUsers);
 	void requestBanList();
 	void requestUserList();
+	/// Requests the image of a text message the server sent by reference (see
+	/// MumbleProto::Authenticate::image_references), unless it has been requested already
+	void requestTextMessageImage(const QByteArray &hash);
 	void requestACL(unsigned int channel);
 	void registerUser(unsigned int uiSession);
 	void kickBanUser(unsigned int uiSession, const QString &reason, bool ban);
@@ -0,0 +1,379 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "ACLProgram.h"
+
+#include "Channel.h"
+#include "Group.h"
+#include "User.h"
+
+#include <QtCore/QPair>
+#include <QtCore/QVarLengthArray>
+
+#include <algorithm>
+
+namespace {
+/// The permissions that can only be granted in the root channel
+const ChanACL::Permissions ROOT_PERMISSIONS =
+	ChanACL::Kick | ChanACL::Ban | ChanACL::ResetUserContent | ChanACL::Register | ChanACL::SelfRegister;
+
+/// @returns The depth of the given channel (0 for the root channel)
+int depth(const Channel *channel) {
+	int depth = 0;
+	for (const Channel *parent = channel->cParent; parent; parent = parent->cParent) {
+		++depth;
+	}
+
+	return depth;
+}
+} // namespace
+
+ACLProgram::ACLProgram(const Channel *channel) : m_channel(channel) {
+	std::vector< const Channel * > chain;
+	for (const Channel *current = channel; current; current = current->cParent) {
+		chain.push_back(current);
+	}
+	std::reverse(chain.begin(), chain.end());
+
+	// Every distinct group specification (in the context it is evaluated in) becomes a single predicate
+	QHash< QPair< QString, const Channel * >, int > predicates;
+
+	for (const Channel *current : chain) {
+		for (const ChanACL *acl : current->qlACL) {
+			Instruction instruction;
+			instruction.userId    = acl->iUserId;
+			instruction.predicate = -1;
+			instruction.allow     = acl->pAllow;
+			instruction.deny      = acl->pDeny;
+
+			if (!acl->qsGroup.isEmpty()) {
+				// Only ACLs using "~" are evaluated in the context of the channel that defines them
+				const Channel *context = acl->qsGroup.contains(QLatin1Char('~')) ? current : channel;
+				const QPair< QString, const Channel * > key(acl->qsGroup, context);
+
+				auto it = predicates.constFind(key);
+				if (it == predicates.constEnd()) {
+					m_predicates.push_back(compilePredicate(acl->qsGroup, current, chain));
+					it = predicates.insert(key, static_cast< int >(m_predicates.size() - 1));
+				}
+				instruction.predicate = it.value();
+			}
+
+			const bool applies = (current == channel && acl->bApplyHere) || (current != channel && acl->bApplySubs);
+			if (applies) {
+				instruction.grant  = acl->pAllow & ~(ROOT_PERMISSIONS | ChanACL::Cached);
+				instruction.revoke = acl->pDeny;
+			}
+			if (current->iId == 0 && current == channel && acl->bApplyHere) {
+				instruction.grant |= acl->pAllow & ROOT_PERMISSIONS;
+			}
+
+			m_instructions.push_back(instruction);
+		}
+
+		m_segments.push_back({ current->bInheritACL, m_instructions.size() });
+	}
+}
+
+ChanACL::Permissions ACLProgram::evaluate(const ACLSubject &subject) const {
+	// Superuser
+	if (subject.user->iId == 0) {
+		return static_cast< ChanACL::Permissions >(ChanACL::All & ~(ChanACL::Speak | ChanACL::Whisper));
+	}
+
+	// Default permissions
+	const ChanACL::Permissions def = ChanACL::Traverse | ChanACL::Enter | ChanACL::Speak | ChanACL::Whisper
+									 | ChanACL::TextMessage | ChanACL::Listen;
+
+	// The results of the predicates evaluated so far (0 if not evaluated yet, 1 if matching, -1 otherwise)
+	QVarLengthArray< signed char, 64 > results(static_cast< qsizetype >(m_predicates.size()));
+	std::fill(results.begin(), results.end(), static_cast< signed char >(0));
+
+	ChanACL::Permissions granted = def;
+	bool traverse                = true;
+	bool write                   = false;
+
+	std::size_t i = 0;
+	for (const Segment &segment : m_segments) {
+		if (!segment.inherit) {
+			granted = def;
+		}
+
+		for (; i < segment.end; ++i) {
+			const Instruction &instruction = m_instructions[i];
+
+			bool match = instruction.userId != -1 && instruction.userId == subject.user->iId;
+			if (!match && instruction.predicate >= 0) {
+				signed char &result = results[instruction.predicate];
+				if (result == 0) {
+					result = matches(m_predicates[static_cast< std::size_t >(instruction.predicate)], subject) ? 1 : -1;
+				}
+				match = result > 0;
+			}
+			if (!match) {
+				continue;
+			}
+
+			if (instruction.allow & ChanACL::Traverse)
+				traverse = true;
+			if (instruction.deny & ChanACL::Traverse)
+				traverse = false;
+			if (instruction.allow & ChanACL::Write)
+				write = true;
+			if (instruction.deny & ChanACL::Write)
+				write = false;
+
+			granted |= instruction.grant;
+			granted &= ~instruction.revoke;
+		}
+
+		if (!traverse && !write) {
+			return ChanACL::None;
+		}
+	}
+
+	if (granted & ChanACL::Write) {
+		granted |= ChanACL::Traverse | ChanACL::Enter | ChanACL::MuteDeafen | ChanACL::Move | ChanACL::MakeChannel
+				   | ChanACL::LinkChannel | ChanACL::TextMessage | ChanACL::MakeTempChannel | ChanACL::Listen;
+		if (m_channel->iId == 0)
+			granted |= ROOT_PERMISSIONS;
+	}
+
+	return granted;
+}
+
+const Channel *ACLProgram::channel() const {
+	return m_channel;
+}
+
+// Mirrors Group::appliesToUser
+ACLProgram::Predicate ACLProgram::compilePredicate(QString specification, const Channel *aclChannel,
+												   const std::vector< const Channel * > &chain) const {
+	Predicate predicate;
+
+	bool isAccessToken     = false;
+	bool isCertHash        = false;
+	const Channel *context = m_channel;
+
+	while (!specification.isEmpty()) {
+		if (specification.startsWith(QLatin1Char('!'))) {
+			predicate.invert = true;
+		} else if (specification.startsWith(QLatin1Char('~'))) {
+			context = aclChannel;
+		} else if (specification.startsWith(QLatin1Char('#'))) {
+			isAccessToken = true;
+		} else if (specification.startsWith(QLatin1Char('$'))) {
+			isCertHash = true;
+		} else {
+			break;
+		}
+		specification.remove(0, 1);
+	}
+
+	if (specification.isEmpty()) {
+		// Never matches, not even if inverted
+		predicate.invert = false;
+		return predicate;
+	}
+
+	if (isAccessToken) {
+		predicate.kind     = Predicate::AccessToken;
+		predicate.argument = specification;
+	} else if (isCertHash) {
+		predicate.kind     = Predicate::CertHash;
+		predicate.argument = specification;
+	} else if (specification == QLatin1String("none")) {
+		predicate.value = false;
+	} else if (specification == QLatin1String("all")) {
+		predicate.value = true;
+	} else if (specification == QLatin1String("auth")) {
+		predicate.kind = Predicate::Auth;
+	} else if (specification == QLatin1String("strong")) {
+		predicate.kind = Predicate::Strong;
+	} else if (specification == QLatin1String("in")) {
+		predicate.kind    = Predicate::In;
+		predicate.channel = context;
+	} else if (specification == QLatin1String("out")) {
+		predicate.kind    = Predicate::Out;
+		predicate.channel = context;
+	} else if (specification == QLatin1String("sub") || specification.startsWith(QLatin1String("sub,"))) {
+		specification.remove(0, 4);
+
+		int requiredChannelOffset = 0;
+		int minDescendantLevel    = 1;
+		int maxDescendantLevel    = 1000;
+
+		const QStringList args = specification.split(QLatin1String(","));
+		if (args.count() >= 1 && !args[0].isEmpty()) {
+			requiredChannelOffset = args[0].toInt();
+		}
+		if (args.count() >= 2 && !args[1].isEmpty()) {
+			minDescendantLevel = args[1].toInt();
+		}
+		if (args.count() >= 3 && !args[2].isEmpty()) {
+			maxDescendantLevel = args[2].toInt();
+		}
+
+		// chain is the hierarchy from the root channel to the channel the program is compiled for, which contains
+		// the context
+		int requiredChannelIndex =
+			static_cast< int >(std::find(chain.begin(), chain.end(), context) - chain.begin()) + requiredChannelOffset;
+
+		if (requiredChannelIndex >= static_cast< int >(chain.size())) {
+			predicate.value = false;
+			return predicate;
+		} else if (requiredChannelIndex < 0) {
+			requiredChannelIndex = 0;
+		}
+
+		predicate.kind     = Predicate::Sub;
+		predicate.channel  = chain[static_cast< std::size_t >(requiredChannelIndex)];
+		predicate.minDepth = requiredChannelIndex + minDescendantLevel;
+		predicate.maxDepth = requiredChannelIndex + maxDescendantLevel;
+	} else {
+		// The group specification is an actual group name
+		predicate.kind = Predicate::Named;
+
+		for (const Channel *current = context; current; current = current->cParent) {
+			const Group *group = current->qhGroups.value(specification);
+
+			if (group) {
+				if ((current != context) && !group->bInheritable)
+					break;
+				predicate.groups.push_back(group);
+				if (!group->bInherit)
+					break;
+			}
+		}
+		std::reverse(predicate.groups.begin(), predicate.groups.end());
+	}
+
+	return predicate;
+}
+
+bool ACLProgram::matches(const Predicate &predicate, const ACLSubject &subject) const {
+	const User &user = *subject.user;
+
+	bool matches = false;
+	switch (predicate.kind) {
+		case Predicate::Constant:
+			matches = predicate.value;
+			break;
+		case Predicate::AccessToken:
+			matches = subject.accessTokens->contains(predicate.argument, Group::accessTokenCaseSensitivity);
+			break;
+		case Predicate::CertHash:
+			matches = user.qsHash == predicate.argument;
+			break;
+		case Predicate::Auth:
+			matches = user.iId >= 0;
+			break;
+		case Predicate::Strong:
+			matches = subject.verified;
+			break;
+		case Predicate::In:
+			matches = user.cChannel == predicate.channel;
+			break;
+		case Predicate::Out:
+			matches = user.cChannel != predicate.channel;
+			break;
+		case Predicate::Sub: {
+			bool below = false;
+			for (const Channel *current = user.cChannel; current && !below; current = current->cParent) {
+				below = current == predicate.channel;
+			}
+
+			if (below) {
+				const int userDepth = depth(user.cChannel);
+				matches             = userDepth >= predicate.minDepth && userDepth <= predicate.maxDepth;
+			}
+			break;
+		}
+		case Predicate::Named:
+			for (const Group *group : predicate.groups) {
+				if (group->qsAdd.contains(user.iId) || group->qsTemporary.contains(user.iId)
+					|| group->qsTemporary.contains(-static_cast< int >(user.uiSession)))
+					matches = true;
+				if (group->qsRemove.contains(user.iId))
+					matches = false;
+			}
+			break;
+	}
+
+	return predicate.invert ? !matches : matches;
+}
+
+ChanACL::Permissions PermissionCache::permissions(const ACLSubject &subject, const Channel *channel) {
+	QHash< const Channel *, ChanACL::Permissions > &cache = m_permissions[subject.user];
+
+	const auto it = cache.constFind(channel);
+	if (it != cache.constEnd()) {
+		return it.value();
+	}
+
+	const ChanACL::Permissions granted = program(channel).evaluate(subject);
+	cache.insert(channel, granted | ChanACL::Cached);
+
+	return granted;
+}
+
+ChanACL::Permissions PermissionCache::cachedPermissions(const ACLSubject &subject, const Channel *channel) {
+	return permissions(subject, channel) | ChanACL::Cached;
+}
+
+void PermissionCache::invalidateUser(const User *user) {
+	++m_generation;
+	m_permissions.remove(user);
+}
+
+QSet< const Channel * > PermissionCache::invalidateChannel(const Channel *channel) {
+	QSet< const Channel * > affected;
+	++m_generation;
+
+	std::vector< const Channel * > pending = { channel };
+	while (!pending.empty()) {
+		const Channel *current = pending.back();
+		pending.pop_back();
+
+		affected.insert(current);
+		m_programs.erase(current);
+		for (const Channel *child : current->qlChannels) {
+			pending.push_back(child);
+		}
+	}
+
+	for (QHash< const Channel *, ChanACL::Permissions > &cache : m_permissions) {
+		if (static_cast< qsizetype >(cache.size()) <= affected.size()) {
+			for (auto it = cache.begin(); it != cache.end();) {
+				it = affected.contains(it.key()) ? cache.erase(it) : std::next(it);
+			}
+		} else {
+			for (const Channel *current : affected) {
+				cache.remove(current);
+			}
+		}
+	}
+
+	return affected;
+}
+
+void PermissionCache::clear() {
+	++m_generation;
+	m_programs.clear();
+	m_permissions.clear();
+}
+
+std::size_t PermissionCache::programCount() const {
+	return m_programs.size();
+}
+
+const ACLProgram &PermissionCache::program(const Channel *channel) {
+	std::unique_ptr< ACLProgram > &program = m_programs[channel];
+	if (!program) {
+		program = std::make_unique< ACLProgram >(channel);
+	}
+
+	return *program;
+}
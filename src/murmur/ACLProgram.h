@@ -0,0 +1,145 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_ACLPROGRAM_H_
+#define MUMBLE_MURMUR_ACLPROGRAM_H_
+
+#include "ACL.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class Channel;
+class Group;
+class User;
+
+/// The properties of a user the ACLs are evaluated for
+struct ACLSubject {
+	const User *user;
+	/// Whether the certificate of the user is trusted (the "strong" group)
+	bool verified;
+	const QStringList *accessTokens;
+};
+
+/// The ACLs that apply to a channel (the ACLs of the channel itself and of all of its parents), compiled into a list
+/// of instructions that only modify bitmasks.
+///
+/// Evaluating the ACLs used to parse the group specification of every ACL (e.g. "~!sub,1" or "#token") and to look up
+/// named groups by walking up the channel tree for every single check. All of this only depends on the channel tree,
+/// so it is done once when compiling: every distinct group specification is turned into a predicate (named groups
+/// are resolved to the groups they consist of), which is evaluated at most once per evaluation of the program.
+///
+/// A program keeps pointers to the channels and groups it has been compiled from. It has to be discarded whenever
+/// the ACLs, groups or parents of one of these channels change (see PermissionCache::invalidateChannel). The members
+/// of the groups are read when evaluating, so these may change.
+class ACLProgram {
+public:
+	explicit ACLProgram(const Channel *channel);
+
+	/// @returns The permissions the given user has in the channel this program has been compiled for. They are the
+	/// 	same as the ones ChanACL::effectivePermissions determines without a cache.
+	ChanACL::Permissions evaluate(const ACLSubject &subject) const;
+
+	const Channel *channel() const;
+
+protected:
+	struct Predicate {
+		enum Kind { Constant, AccessToken, CertHash, Auth, Strong, In, Out, Sub, Named };
+
+		Kind kind   = Constant;
+		bool invert = false;
+		/// The result of Constant predicates (before inverting)
+		bool value = false;
+		/// The access token or certificate hash
+		QString argument;
+		/// The channel the user has to be in ("in" and "out") or below ("sub")
+		const Channel *channel = nullptr;
+		/// The range of depths the channel of the user has to be at ("sub")
+		int minDepth = 0;
+		int maxDepth = 0;
+		/// The groups a Named predicate consists of, outermost first
+		std::vector< const Group * > groups;
+	};
+
+	struct Instruction {
+		/// The ID of the user the ACL applies to (-1 if it applies to a group)
+		int userId;
+		/// The index of the predicate in m_predicates (-1 if the ACL doesn't apply to a group)
+		int predicate;
+		/// The permissions granted and denied by the ACL, which affect Traverse and Write in any case
+		ChanACL::Permissions allow;
+		ChanACL::Permissions deny;
+		/// The permissions added to and removed from the granted permissions if the ACL applies
+		ChanACL::Permissions grant;
+		ChanACL::Permissions revoke;
+	};
+
+	struct Segment {
+		/// Whether the channel inherits the permissions of its parent
+		bool inherit;
+		/// The index in m_instructions after the last instruction of the channel
+		std::size_t end;
+	};
+
+	const Channel *m_channel;
+	std::vector< Predicate > m_predicates;
+	std::vector< Instruction > m_instructions;
+	/// One segment per channel, starting at the root channel
+	std::vector< Segment > m_segments;
+
+	/// @returns The predicate for the given group specification of an ACL of aclChannel
+	Predicate compilePredicate(QString specification, const Channel *aclChannel,
+							   const std::vector< const Channel * > &chain) const;
+	bool matches(const Predicate &predicate, const ACLSubject &subject) const;
+};
+
+/// Caches the compiled ACLs of the channels and the permissions of the users in them.
+///
+/// Changes only invalidate what they affect: a change of a user (e.g. its ID, channel or access tokens) discards the
+/// permissions of that user, a change of the ACLs or groups of a channel discards the programs and permissions of the
+/// channel and its subchannels.
+///
+/// This class is not thread-safe.
+class PermissionCache {
+public:
+	/// @returns The permissions of the given user in the given channel. If they have been cached before, the Cached
+	/// 	flag is set.
+	ChanACL::Permissions permissions(const ACLSubject &subject, const Channel *channel);
+	/// @returns The permissions of the given user in the given channel with the Cached flag set, which are cached if
+	/// 	they haven't been already
+	ChanACL::Permissions cachedPermissions(const ACLSubject &subject, const Channel *channel);
+
+	/// Discards the permissions of the given user
+	void invalidateUser(const User *user);
+	/// Discards the compiled ACLs of the given channel and its subchannels and the permissions of all users in them.
+	/// Has to be called whenever the ACLs or groups of the channel change (including the creation or removal of a
+	/// group) and before the channel is deleted.
+	///
+	/// @returns The affected channels
+	QSet< const Channel * > invalidateChannel(const Channel *channel);
+	void clear();
+
+	/// @returns The number of compiled programs
+	std::size_t programCount() const;
+	/// @returns A number that changes whenever anything is invalidated, i.e. whenever any permission might have
+	/// 	changed
+	std::uint64_t generation() const { return m_generation; }
+
+protected:
+	std::uint64_t m_generation = 0;
+	std::unordered_map< const Channel *, std::unique_ptr< ACLProgram > > m_programs;
+	QHash< const User *, QHash< const Channel *, ChanACL::Permissions > > m_permissions;
+
+	const ACLProgram &program(const Channel *channel);
+};
+
+#endif // MUMBLE_MURMUR_ACLPROGRAM_H_
@@ -92,6 +92,14 @@ void AudioReceiverBuffer::forceAddReceiver(ServerUser &receiver, Mumble::Protoco
 	}
 }
 
+void AudioReceiverBuffer::addUniqueReceiver(ServerUser &receiver, Mumble::Protocol::audio_context_t context,
+											bool includePositionalData, const VolumeAdjustment &volumeAdjustment) {
+	std::vector< AudioReceiver > &receiverList = includePositionalData ? m_positionalReceivers : m_regularReceivers;
+
+	// Duplicates would be caught by the assertion in preprocessBuffer (in debug builds)
+	receiverList.emplace_back(receiver, context, volumeAdjustment);
+}
+
 void AudioReceiverBuffer::preprocessBuffer() {
 	ZoneScoped;
 
@@ -54,6 +54,14 @@ public:
 					 const VolumeAdjustment &volumeAdjustment = VolumeAdjustment::fromFactor(1.0f));
 	void forceAddReceiver(ServerUser &receiver, Mumble::Protocol::audio_context_t context, bool includePositionalData,
 						  const VolumeAdjustment &volumeAdjustment = VolumeAdjustment::fromFactor(1.0f));
+	/**
+	 * Adds the given receiver without checking whether it has been added before, which makes this cheaper than
+	 * forceAddReceiver. The caller has to guarantee that the receiver has not been added (by any of the add functions)
+	 * since the last call to clear() and must not add it again (e.g. when walking a precomputed, duplicate-free list
+	 * of receivers).
+	 */
+	void addUniqueReceiver(ServerUser &receiver, Mumble::Protocol::audio_context_t context, bool includePositionalData,
+						   const VolumeAdjustment &volumeAdjustment = VolumeAdjustment::fromFactor(1.0f));
 
 	void preprocessBuffer();
 
@@ -0,0 +1,129 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "AuthPool.h"
+
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+
+#include <tracy/Tracy.hpp>
+
+#include <atomic>
+#include <string>
+
+namespace {
+thread_local Server *currentAuthServer = nullptr;
+} // namespace
+
+struct AuthPool::Job {
+	Work work;
+	Callback done;
+	/// Set once the callback has been called (or is about to be). A worker skips jobs that timed out while queued.
+	std::atomic< bool > finished{ false };
+};
+
+AuthPool::AuthPool(Server *server, unsigned int threadCount, unsigned int limit, int timeout,
+				   const std::function< void() > &threadCleanup, QObject *parent)
+	: QObject(parent), m_server(server), m_limit(limit), m_timeout(timeout), m_threadCleanup(threadCleanup) {
+	for (unsigned int i = 0; i < qMax(threadCount, 1U); ++i) {
+		QThread *thread = QThread::create([this, i]() { runWorker(i); });
+		thread->start();
+
+		m_threads.push_back(thread);
+	}
+}
+
+AuthPool::~AuthPool() {
+	{
+		QMutexLocker lock(&m_queueMutex);
+		m_stopping = true;
+		m_queue.clear();
+	}
+	m_queueCondition.wakeAll();
+
+	for (QThread *thread : m_threads) {
+		thread->wait();
+		delete thread;
+	}
+}
+
+bool AuthPool::submit(const Work &work, const Callback &done) {
+	if (m_limit > 0 && m_pending >= m_limit) {
+		return false;
+	}
+
+	std::shared_ptr< Job > job = std::make_shared< Job >();
+	job->work                  = work;
+	job->done                  = done;
+
+	++m_pending;
+
+	QTimer::singleShot(m_timeout, this, [this, job]() {
+		AuthResult result;
+		result.id = -3;
+		finish(job, result);
+	});
+
+	{
+		QMutexLocker lock(&m_queueMutex);
+		m_queue.push_back(job);
+	}
+	m_queueCondition.wakeOne();
+
+	return true;
+}
+
+unsigned int AuthPool::pending() const {
+	return m_pending;
+}
+
+Server *AuthPool::currentServer() {
+	return currentAuthServer;
+}
+
+void AuthPool::runWorker(unsigned int index) {
+	const std::string threadName = "Auth " + std::to_string(index);
+	tracy::SetThreadName(threadName.c_str());
+
+	currentAuthServer = m_server;
+
+	forever {
+		std::shared_ptr< Job > job;
+		{
+			QMutexLocker lock(&m_queueMutex);
+			while (m_queue.empty() && !m_stopping) {
+				m_queueCondition.wait(&m_queueMutex);
+			}
+			if (m_stopping) {
+				break;
+			}
+
+			job = m_queue.front();
+			m_queue.pop_front();
+		}
+
+		if (job->finished.load()) {
+			continue;
+		}
+
+		const AuthResult result = job->work();
+		QMetaObject::invokeMethod(this, [this, job, result]() { finish(job, result); }, Qt::QueuedConnection);
+	}
+
+	currentAuthServer = nullptr;
+
+	if (m_threadCleanup) {
+		m_threadCleanup();
+	}
+}
+
+void AuthPool::finish(const std::shared_ptr< Job > &job, const AuthResult &result) {
+	if (job->finished.exchange(true)) {
+		return;
+	}
+
+	--m_pending;
+	job->done(result);
+}
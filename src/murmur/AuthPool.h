@@ -0,0 +1,118 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_AUTHPOOL_H_
+#define MUMBLE_MURMUR_AUTHPOOL_H_
+
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QWaitCondition>
+#include <QtNetwork/QSslCertificate>
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class QThread;
+class Server;
+
+/// The credentials of a single authentication attempt
+struct AuthRequest {
+	QString name;
+	QString password;
+	int sessionId = 0;
+	QStringList emails;
+	QString certHash;
+	bool strongCert = false;
+	QList< QSslCertificate > certs;
+	/// Whether only an RPC authenticator may accept the attempt (see Server::bForceExternalAuth)
+	bool forceExternal = false;
+};
+
+/// The outcome of the part of an authentication attempt that doesn't touch the state of the Server
+struct AuthResult {
+	/// The user ID, -1 for wrong credentials, -2 for unknown users (fallthrough) and -3 if the credentials could
+	/// (temporarily) not be verified
+	int id = -2;
+	/// The user's name as stored in the database or returned by the RPC authenticator
+	QString name;
+	/// Whether an RPC authenticator handled the attempt
+	bool external = false;
+	/// Temporary groups assigned by the RPC authenticator
+	QStringList groups;
+	/// Account info that has to be updated before the login may proceed (e.g. a password hash using outdated
+	/// parameters)
+	QMap< int, QString > update;
+	/// Logged if updating the account info fails, in which case the login is rejected
+	QString updateError;
+};
+
+/// Runs the expensive part of authentication attempts (password hashing, database lookups and calls to RPC
+/// authenticators) on a set of worker threads, so that a slow authenticator or a burst of logins doesn't stall the
+/// thread of the Server. The results are delivered back to the pool's thread.
+///
+/// The pool must only be used by the thread it lives on.
+class AuthPool : public QObject {
+private:
+	Q_DISABLE_COPY(AuthPool)
+
+public:
+	static constexpr unsigned int MAX_THREADS = 64;
+
+	using Work     = std::function< AuthResult() >;
+	using Callback = std::function< void(const AuthResult &) >;
+
+	/// @param server The Server the work is done for (see currentServer())
+	/// @param threadCount The number of worker threads (at least 1), which is also the number of attempts processed
+	/// 	at the same time
+	/// @param limit The maximum number of attempts waiting for or being processed or 0 for no limit
+	/// @param timeout The time in milliseconds an attempt may take including the time spent waiting for a thread
+	/// @param threadCleanup Called by every worker thread before it exits
+	AuthPool(Server *server, unsigned int threadCount, unsigned int limit, int timeout,
+			 const std::function< void() > &threadCleanup = {}, QObject *parent = nullptr);
+	/// Stops the worker threads after they finished their current work. The callbacks of pending attempts are not
+	/// called anymore.
+	~AuthPool() override;
+
+	/// Queues the given work. Once it completed, the callback is called on the pool's thread with its result. If the
+	/// work doesn't complete in time, the callback is called with an id of -3 instead and the late result is
+	/// discarded.
+	/// @returns Whether the work has been queued, which is not the case if the limit has been reached (and the
+	/// 	callback won't be called)
+	bool submit(const Work &work, const Callback &done);
+
+	/// @returns The number of attempts waiting for or being processed whose callback hasn't been called yet
+	unsigned int pending() const;
+
+	/// @returns The Server the calling thread does work for, or nullptr if it isn't a worker thread of an AuthPool
+	static Server *currentServer();
+
+protected:
+	struct Job;
+
+	Server *m_server;
+	unsigned int m_limit;
+	int m_timeout;
+	std::function< void() > m_threadCleanup;
+	std::vector< QThread * > m_threads;
+	unsigned int m_pending = 0;
+
+	/// Protects m_queue and m_stopping, which are shared with the worker threads
+	QMutex m_queueMutex;
+	QWaitCondition m_queueCondition;
+	std::deque< std::shared_ptr< Job > > m_queue;
+	bool m_stopping = false;
+
+	void runWorker(unsigned int index);
+	/// Calls the callback of the given job unless that already happened
+	void finish(const std::shared_ptr< Job > &job, const AuthResult &result);
+};
+
+#endif // MUMBLE_MURMUR_AUTHPOOL_H_
@@ -0,0 +1,209 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "BanIndex.h"
+
+#include <algorithm>
+
+namespace {
+using Address = std::array< std::uint8_t, 16 >;
+
+constexpr unsigned int ADDRESS_BITS = 128;
+
+unsigned int bitAt(const Address &address, unsigned int bit) {
+	return (address[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+/// @returns The given address with all bits beyond length cleared
+Address truncated(const Address &address, unsigned int length) {
+	Address result = {};
+	for (unsigned int i = 0; i < length / 8; ++i) {
+		result[i] = address[i];
+	}
+	if (length % 8 != 0) {
+		result[length / 8] = static_cast< std::uint8_t >(address[length / 8] & (0xFF << (8 - length % 8)));
+	}
+
+	return result;
+}
+
+/// @returns The number of leading bits (but at most limit) the given addresses have in common
+unsigned int commonPrefix(const Address &a, const Address &b, unsigned int limit) {
+	unsigned int length = 0;
+	for (std::size_t i = 0; i < a.size() && length < limit; ++i) {
+		const std::uint8_t difference = a[i] ^ b[i];
+		if (difference == 0) {
+			length += 8;
+			continue;
+		}
+
+		unsigned int bit = 0;
+		while (!(difference & (0x80 >> bit))) {
+			++bit;
+		}
+		length += bit;
+		break;
+	}
+
+	return std::min(length, limit);
+}
+} // namespace
+
+BanIndex::BanIndex() {
+	addNode(Address(), 0);
+}
+
+void BanIndex::rebuild(const QList< Ban > &bans) {
+	m_nodes.clear();
+	m_bans.clear();
+	m_banNodes.clear();
+	m_hashes.clear();
+	m_expiry = decltype(m_expiry)();
+	m_size   = 0;
+
+	addNode(Address(), 0);
+
+	m_bans.reserve(static_cast< std::size_t >(bans.size()));
+	m_banNodes.reserve(static_cast< std::size_t >(bans.size()));
+	for (const Ban &ban : bans) {
+		const std::uint32_t index = static_cast< std::uint32_t >(m_bans.size());
+		m_bans.push_back(ban);
+		m_banNodes.push_back(NO_NODE);
+
+		insert(index);
+	}
+}
+
+QList< Ban > BanIndex::takeExpired(const QDateTime &now) {
+	QList< Ban > expired;
+
+	const qint64 nowSecs = now.toSecsSinceEpoch();
+	while (!m_expiry.empty() && m_expiry.top().first < nowSecs) {
+		const std::uint32_t index = m_expiry.top().second;
+		m_expiry.pop();
+
+		expired << m_bans[index];
+		remove(index);
+	}
+
+	return expired;
+}
+
+const Ban *BanIndex::match(const HostAddress &address) const {
+	const Address &key = address.getByteRepresentation();
+
+	std::uint32_t current = 0;
+	while (current != NO_NODE) {
+		const Node &node = m_nodes[current];
+		// Children may skip bits, which have to be checked
+		if (commonPrefix(node.prefix, key, node.length) < node.length) {
+			return nullptr;
+		}
+		if (!node.bans.empty()) {
+			return &m_bans[node.bans.front()];
+		}
+		if (node.length == ADDRESS_BITS) {
+			return nullptr;
+		}
+
+		current = node.children[bitAt(key, node.length)];
+	}
+
+	return nullptr;
+}
+
+const Ban *BanIndex::matchHash(const QString &hash) const {
+	if (hash.isEmpty()) {
+		return nullptr;
+	}
+
+	const auto it = m_hashes.constFind(hash);
+	return it == m_hashes.constEnd() ? nullptr : &m_bans[it.value()];
+}
+
+std::size_t BanIndex::size() const {
+	return m_size;
+}
+
+void BanIndex::insert(std::uint32_t ban) {
+	const Ban &entry          = m_bans[ban];
+	const unsigned int length = static_cast< unsigned int >(std::clamp(entry.iMask, 0, 128));
+	const Address key         = truncated(entry.haAddress.getByteRepresentation(), length);
+
+	// The node the ban is stored at. The prefix of the current node is always a prefix of the key.
+	std::uint32_t target  = NO_NODE;
+	std::uint32_t current = 0;
+	forever {
+		if (m_nodes[current].length == length) {
+			target = current;
+			break;
+		}
+
+		const unsigned int branch = bitAt(key, m_nodes[current].length);
+		const std::uint32_t child = m_nodes[current].children[branch];
+		if (child == NO_NODE) {
+			target                            = addNode(key, length);
+			m_nodes[current].children[branch] = target;
+			break;
+		}
+
+		const unsigned int common = commonPrefix(key, m_nodes[child].prefix, std::min(length, m_nodes[child].length));
+		if (common == m_nodes[child].length) {
+			current = child;
+			continue;
+		}
+
+		// The key diverges from the child (or ends) within the bits the child skips, so a node has to be inserted
+		// where they diverge
+		const std::uint32_t split = addNode(key, common);
+		m_nodes[split].children[bitAt(m_nodes[child].prefix, common)] = child;
+		m_nodes[current].children[branch]                            = split;
+
+		if (common == length) {
+			target = split;
+		} else {
+			target                                      = addNode(key, length);
+			m_nodes[split].children[bitAt(key, common)] = target;
+		}
+		break;
+	}
+
+	m_nodes[target].bans.push_back(ban);
+	m_banNodes[ban] = target;
+	++m_size;
+
+	if (!entry.qsHash.isEmpty()) {
+		m_hashes.insert(entry.qsHash, ban);
+	}
+	if (entry.iDuration > 0) {
+		m_expiry.emplace(entry.qdtStart.toSecsSinceEpoch() + entry.iDuration, ban);
+	}
+}
+
+void BanIndex::remove(std::uint32_t ban) {
+	const std::uint32_t node = m_banNodes[ban];
+	if (node == NO_NODE) {
+		return;
+	}
+
+	std::vector< std::uint32_t > &bans = m_nodes[node].bans;
+	bans.erase(std::find(bans.begin(), bans.end(), ban));
+	m_banNodes[ban] = NO_NODE;
+	--m_size;
+
+	if (!m_bans[ban].qsHash.isEmpty()) {
+		m_hashes.remove(m_bans[ban].qsHash, ban);
+	}
+}
+
+std::uint32_t BanIndex::addNode(const Address &address, unsigned int length) {
+	Node node;
+	node.prefix = truncated(address, length);
+	node.length = length;
+
+	m_nodes.push_back(std::move(node));
+
+	return static_cast< std::uint32_t >(m_nodes.size() - 1);
+}
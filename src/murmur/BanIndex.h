@@ -0,0 +1,83 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_BANINDEX_H_
+#define MUMBLE_MURMUR_BANINDEX_H_
+
+#include "Ban.h"
+#include "HostAddress.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QList>
+#include <QtCore/QMultiHash>
+#include <QtCore/QString>
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+/// Indexes a list of bans, so that checking a connecting client doesn't have to look at every single ban.
+///
+/// The bans are stored in a compressed binary trie keyed by the 128 bits of their address. As IPv4 addresses are
+/// represented as IPv4-mapped IPv6 addresses (and IPv4 bans use a mask of 96 + the IPv4 prefix length), IPv4 and IPv6
+/// bans share the same trie. Looking up an address only visits the nodes along its path, i.e. at most 129 nodes no
+/// matter how many bans there are. Temporary bans are additionally kept in a min-heap ordered by the time they
+/// expire, so that finding the expired ones only looks at the ones that actually expired.
+class BanIndex {
+public:
+	BanIndex();
+
+	/// Replaces the indexed bans
+	void rebuild(const QList< Ban > &bans);
+
+	/// Removes the bans that expired by the given time from the index
+	/// @returns The removed bans
+	QList< Ban > takeExpired(const QDateTime &now);
+
+	/// @returns A ban whose range contains the given address or nullptr if there is none. The pointer stays valid
+	/// 	until the index is modified.
+	const Ban *match(const HostAddress &address) const;
+	/// @returns A ban of the given certificate hash or nullptr if there is none (or the hash is empty). The pointer
+	/// 	stays valid until the index is modified.
+	const Ban *matchHash(const QString &hash) const;
+
+	/// @returns The number of indexed bans
+	std::size_t size() const;
+
+protected:
+	static constexpr std::uint32_t NO_NODE = 0xFFFFFFFF;
+
+	struct Node {
+		/// The bits of the prefix beyond length are 0
+		std::array< std::uint8_t, 16 > prefix;
+		/// The length of the prefix in bits
+		unsigned int length;
+		std::array< std::uint32_t, 2 > children = { { NO_NODE, NO_NODE } };
+		/// The bans covering exactly this prefix (indices into m_bans)
+		std::vector< std::uint32_t > bans;
+	};
+
+	/// The node at index 0 is the root (prefix length 0)
+	std::vector< Node > m_nodes;
+	std::vector< Ban > m_bans;
+	/// The node every ban in m_bans is stored at (or NO_NODE if it has been removed)
+	std::vector< std::uint32_t > m_banNodes;
+	/// The certificate hashes of the bans that have one
+	QMultiHash< QString, std::uint32_t > m_hashes;
+	/// (expiry time in seconds since the epoch, index into m_bans) of all temporary bans
+	std::priority_queue< std::pair< qint64, std::uint32_t >, std::vector< std::pair< qint64, std::uint32_t > >,
+						 std::greater< std::pair< qint64, std::uint32_t > > >
+		m_expiry;
+	std::size_t m_size = 0;
+
+	void insert(std::uint32_t ban);
+	void remove(std::uint32_t ban);
+	std::uint32_t addNode(const std::array< std::uint8_t, 16 > &address, unsigned int length);
+};
+
+#endif // MUMBLE_MURMUR_BANINDEX_H_
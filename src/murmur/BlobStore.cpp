@@ -0,0 +1,282 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "BlobStore.h"
+
+#include "Metrics.h"
+#include "QtUtils.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+
+#include <utility>
+
+BlobRef::BlobRef(BlobStore *store, const QByteArray &hash) : m_store(store), m_hash(hash) {
+}
+
+BlobRef::BlobRef(const BlobRef &other) : m_store(other.m_store), m_hash(other.m_hash) {
+	if (m_store) {
+		m_store->acquire(m_hash);
+	}
+}
+
+BlobRef::BlobRef(BlobRef &&other) noexcept : m_store(other.m_store), m_hash(std::move(other.m_hash)) {
+	other.m_store = nullptr;
+	other.m_hash  = QByteArray();
+}
+
+BlobRef &BlobRef::operator=(const BlobRef &other) {
+	if (this != &other) {
+		// Acquire first, in case both refer to the same blob
+		if (other.m_store) {
+			other.m_store->acquire(other.m_hash);
+		}
+		reset();
+		m_store = other.m_store;
+		m_hash  = other.m_hash;
+	}
+	return *this;
+}
+
+BlobRef &BlobRef::operator=(BlobRef &&other) noexcept {
+	if (this != &other) {
+		reset();
+		m_store       = other.m_store;
+		m_hash        = std::move(other.m_hash);
+		other.m_store = nullptr;
+		other.m_hash  = QByteArray();
+	}
+	return *this;
+}
+
+BlobRef::~BlobRef() {
+	reset();
+}
+
+bool BlobRef::isNull() const {
+	return !m_store;
+}
+
+const QByteArray &BlobRef::hash() const {
+	return m_hash;
+}
+
+QByteArray BlobRef::data() const {
+	return m_store ? m_store->read(m_hash) : QByteArray();
+}
+
+void BlobRef::reset() {
+	if (m_store) {
+		m_store->release(m_hash);
+		m_store = nullptr;
+		m_hash  = QByteArray();
+	}
+}
+
+BlobStore::Entry::Entry() {
+}
+
+BlobStore::Entry::~Entry() {
+	if (file) {
+		file->close();
+		QFile::remove(file->fileName());
+	}
+}
+
+BlobStore::BlobStore(std::uint64_t memoryBudget, const QString &directory)
+	: m_memoryBudget(memoryBudget), m_directory(directory) {
+	if (m_directory.isEmpty()) {
+		return;
+	}
+
+	QDir dir(m_directory);
+	if (!dir.mkpath(QLatin1String("."))) {
+		qWarning("BlobStore: Failed to create %s, keeping all blobs in memory", qPrintable(m_directory));
+		m_directory.clear();
+		return;
+	}
+
+	// Spilled blobs don't outlive the server, as they are stored in the database as well
+	for (const QString &name : dir.entryList({ QLatin1String("*.blob") }, QDir::Files)) {
+		dir.remove(name);
+	}
+}
+
+BlobStore::~BlobStore() {
+	// The entries remove their spill files
+	m_entries.clear();
+}
+
+BlobRef BlobStore::insert(const QByteArray &data) {
+	const QByteArray hash = sha1(data);
+
+	QMutexLocker< QMutex > lock(&m_mutex);
+
+	++m_references;
+
+	std::shared_ptr< Entry > &entry = m_entries[hash];
+	if (entry) {
+		++entry->references;
+		++m_deduplicated;
+
+		if (!entry->file) {
+			m_lru.splice(m_lru.begin(), m_lru, entry->lruPosition);
+		}
+	} else {
+		entry              = std::make_shared< Entry >();
+		entry->data        = data;
+		entry->size        = static_cast< std::uint64_t >(data.size());
+		entry->references  = 1;
+		entry->lruPosition = m_lru.insert(m_lru.begin(), hash);
+
+		m_bytes += entry->size;
+		m_residentBytes += entry->size;
+
+		spill();
+	}
+
+	return BlobRef(this, hash);
+}
+
+BlobRef BlobStore::find(const QByteArray &hash) {
+	QMutexLocker< QMutex > lock(&m_mutex);
+
+	const auto it = m_entries.constFind(hash);
+	if (it == m_entries.constEnd()) {
+		return BlobRef();
+	}
+
+	++it.value()->references;
+	++m_references;
+
+	return BlobRef(this, hash);
+}
+
+BlobStoreMetrics BlobStore::metrics() const {
+	QMutexLocker< QMutex > lock(&m_mutex);
+
+	BlobStoreMetrics metrics;
+	metrics.blobs         = static_cast< std::uint64_t >(m_entries.size());
+	metrics.bytes         = m_bytes;
+	metrics.residentBytes = m_residentBytes;
+	metrics.spilledBlobs  = metrics.blobs - m_lru.size();
+	metrics.references    = m_references;
+	metrics.deduplicated  = m_deduplicated;
+	metrics.spills        = m_spills;
+	return metrics;
+}
+
+std::string BlobStore::toPrometheus(const BlobStoreMetrics &metrics) {
+	static const Prometheus::Metric< BlobStoreMetrics > metricList[] = {
+		{ "murmur_blobs", "Stored textures, comments and channel descriptions", "gauge", &BlobStoreMetrics::blobs },
+		{ "murmur_blob_bytes", "Size of the stored blobs", "gauge", &BlobStoreMetrics::bytes },
+		{ "murmur_blob_resident_bytes", "Size of the blobs kept in memory", "gauge", &BlobStoreMetrics::residentBytes },
+		{ "murmur_blobs_spilled", "Blobs spilled to disk", "gauge", &BlobStoreMetrics::spilledBlobs },
+		{ "murmur_blob_references", "References to the stored blobs", "gauge", &BlobStoreMetrics::references },
+		{ "murmur_blobs_deduplicated_total", "Blobs that were stored already when they were set", "counter",
+		  &BlobStoreMetrics::deduplicated },
+		{ "murmur_blob_spills_total", "Blobs spilled to disk because the memory budget was exceeded", "counter",
+		  &BlobStoreMetrics::spills },
+	};
+
+	std::string out;
+	Prometheus::appendMetrics(out, metricList, metrics);
+
+	return out;
+}
+
+void BlobStore::acquire(const QByteArray &hash) {
+	QMutexLocker< QMutex > lock(&m_mutex);
+
+	const auto it = m_entries.constFind(hash);
+	if (it != m_entries.constEnd()) {
+		++it.value()->references;
+		++m_references;
+	}
+}
+
+void BlobStore::release(const QByteArray &hash) {
+	QMutexLocker< QMutex > lock(&m_mutex);
+
+	const auto it = m_entries.find(hash);
+	if (it == m_entries.end()) {
+		return;
+	}
+
+	--m_references;
+
+	const std::shared_ptr< Entry > entry = it.value();
+	if (--entry->references > 0) {
+		return;
+	}
+
+	m_bytes -= entry->size;
+	if (!entry->file) {
+		m_residentBytes -= entry->size;
+		m_lru.erase(entry->lruPosition);
+	}
+	m_entries.erase(it);
+}
+
+QByteArray BlobStore::read(const QByteArray &hash) {
+	QMutexLocker< QMutex > lock(&m_mutex);
+
+	const auto it = m_entries.constFind(hash);
+	if (it == m_entries.constEnd()) {
+		return QByteArray();
+	}
+
+	const std::shared_ptr< Entry > &entry = it.value();
+	if (entry->file) {
+		return QByteArray(reinterpret_cast< const char * >(entry->mapped), static_cast< qsizetype >(entry->size));
+	}
+
+	m_lru.splice(m_lru.begin(), m_lru, entry->lruPosition);
+	return entry->data;
+}
+
+void BlobStore::spill() {
+	if (m_directory.isEmpty()) {
+		return;
+	}
+
+	while (m_residentBytes > m_memoryBudget && !m_lru.empty()) {
+		const QByteArray hash = m_lru.back();
+		Entry &entry          = *m_entries.value(hash);
+
+		auto file = std::make_unique< QFile >(spillPath(hash));
+		if (!file->open(QIODevice::ReadWrite | QIODevice::Truncate) || file->write(entry.data) != entry.data.size()
+			|| !file->flush()) {
+			qWarning("BlobStore: Failed to write %s: %s", qPrintable(file->fileName()),
+					 qPrintable(file->errorString()));
+			file->close();
+			QFile::remove(file->fileName());
+			// Don't try again for every blob that is stored
+			m_directory.clear();
+			return;
+		}
+
+		const uchar *mapped = entry.size > 0 ? file->map(0, static_cast< qint64 >(entry.size)) : nullptr;
+		if (!mapped && entry.size > 0) {
+			qWarning("BlobStore: Failed to map %s: %s", qPrintable(file->fileName()), qPrintable(file->errorString()));
+			file->close();
+			QFile::remove(file->fileName());
+			m_directory.clear();
+			return;
+		}
+
+		entry.mapped = mapped;
+		entry.file   = std::move(file);
+		entry.data   = QByteArray();
+
+		m_lru.pop_back();
+		m_residentBytes -= entry.size;
+		++m_spills;
+	}
+}
+
+QString BlobStore::spillPath(const QByteArray &hash) const {
+	return QDir(m_directory).filePath(QString::fromLatin1(hash.toHex()) + QLatin1String(".blob"));
+}
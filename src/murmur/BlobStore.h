@@ -0,0 +1,135 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_BLOBSTORE_H_
+#define MUMBLE_MURMUR_BLOBSTORE_H_
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+
+class BlobStore;
+class QFile;
+
+/// A reference to a blob in a BlobStore. Copies refer to the same blob, which is removed from the store once the last
+/// reference to it is gone. A reference must not outlive its store.
+class BlobRef {
+public:
+	BlobRef() = default;
+	BlobRef(const BlobRef &other);
+	BlobRef(BlobRef &&other) noexcept;
+	BlobRef &operator=(const BlobRef &other);
+	BlobRef &operator=(BlobRef &&other) noexcept;
+	~BlobRef();
+
+	bool isNull() const;
+	/// @returns The SHA1 hash of the blob (the one clients request it by)
+	const QByteArray &hash() const;
+	/// @returns The contents of the blob, which are read from disk if the blob has been spilled
+	QByteArray data() const;
+	/// Drops the reference
+	void reset();
+
+private:
+	friend class BlobStore;
+
+	BlobRef(BlobStore *store, const QByteArray &hash);
+
+	BlobStore *m_store = nullptr;
+	QByteArray m_hash;
+};
+
+/// The metrics of a BlobStore
+struct BlobStoreMetrics {
+	std::uint64_t blobs = 0;
+	/// The size of all blobs
+	std::uint64_t bytes = 0;
+	/// The size of the blobs kept in memory
+	std::uint64_t residentBytes = 0;
+	std::uint64_t spilledBlobs  = 0;
+	std::uint64_t references    = 0;
+	/// Blobs that were stored while an identical blob was stored already
+	std::uint64_t deduplicated = 0;
+	std::uint64_t spills       = 0;
+};
+
+/// Holds large user textures, user comments and channel descriptions of all virtual servers, which clients request
+/// by their SHA1 hash. Identical blobs (e.g. the same avatar used by many users) are only stored once.
+///
+/// Blobs are reference-counted (see BlobRef). Once the blobs kept in memory exceed the memory budget, the least
+/// recently used ones are written to a file in the spill directory and mapped into memory, so they only take up memory
+/// while the OS keeps their pages cached. A spilled blob stays spilled: reading it copies it out of the mapping, so
+/// only the reader holds it in memory.
+///
+/// All methods may be called from any thread.
+class BlobStore {
+private:
+	Q_DISABLE_COPY(BlobStore)
+
+public:
+	/// @param memoryBudget The size in bytes of the blobs kept in memory
+	/// @param directory The directory blobs are spilled to. It is created if it doesn't exist and files left over from
+	/// 	an earlier run are removed. If empty, all blobs are kept in memory.
+	BlobStore(std::uint64_t memoryBudget, const QString &directory);
+	/// Removes the spilled blobs. All references to the store's blobs have to be gone.
+	~BlobStore();
+
+	/// Stores the given blob, unless an identical one is stored already
+	BlobRef insert(const QByteArray &data);
+
+	/// @returns A reference to the blob with the given hash, or a null reference if there is no such blob
+	BlobRef find(const QByteArray &hash);
+
+	BlobStoreMetrics metrics() const;
+
+	/// Renders the given metrics in the Prometheus text exposition format
+	static std::string toPrometheus(const BlobStoreMetrics &metrics);
+
+protected:
+	friend class BlobRef;
+
+	struct Entry {
+		/// The contents of the blob while it is kept in memory
+		QByteArray data;
+		std::uint64_t size       = 0;
+		std::uint64_t references = 0;
+		/// The spill file, which is mapped at mapped, once the blob has been spilled
+		std::unique_ptr< QFile > file;
+		const uchar *mapped = nullptr;
+		/// The entry's position in m_lru, while the blob is kept in memory
+		std::list< QByteArray >::iterator lruPosition;
+
+		Entry();
+		~Entry();
+	};
+
+	std::uint64_t m_memoryBudget;
+	QString m_directory;
+
+	mutable QMutex m_mutex;
+	QHash< QByteArray, std::shared_ptr< Entry > > m_entries;
+	/// The hashes of the blobs kept in memory, from the most to the least recently used one
+	std::list< QByteArray > m_lru;
+	std::uint64_t m_bytes         = 0;
+	std::uint64_t m_residentBytes = 0;
+	std::uint64_t m_references    = 0;
+	std::uint64_t m_deduplicated  = 0;
+	std::uint64_t m_spills        = 0;
+
+	void acquire(const QByteArray &hash);
+	void release(const QByteArray &hash);
+	QByteArray read(const QByteArray &hash);
+	/// Spills the least recently used blobs until the blobs kept in memory fit into the memory budget
+	void spill();
+	QString spillPath(const QByteArray &hash) const;
+};
+
+#endif // MUMBLE_MURMUR_BLOBSTORE_H_
@@ -0,0 +1,202 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "CallbackQueue.h"
+
+#include "Metrics.h"
+
+CallbackQueueMetrics &CallbackQueueMetrics::operator+=(const CallbackQueueMetrics &other) {
+	subscribers += other.subscribers;
+	queued += other.queued;
+	enqueued += other.enqueued;
+	coalesced += other.coalesced;
+	dropped += other.dropped;
+	delivered += other.delivered;
+	removed += other.removed;
+	return *this;
+}
+
+CallbackQueue::CallbackQueue(unsigned int capacity, int timeout)
+	: m_capacity(qMax(capacity, 1U)), m_timeout(qMax(timeout, 0)) {
+}
+
+bool CallbackQueue::enqueue(const Call &call, const QString &key) {
+	QMutexLocker< QMutex > lock(&m_mutex);
+
+	if (!m_failed && isStalled()) {
+		fail();
+	}
+	if (m_failed) {
+		return false;
+	}
+
+	++m_enqueued;
+
+	if (!key.isEmpty()) {
+		const auto it = m_keys.find(key);
+		if (it != m_keys.end()) {
+			// The replaced call is dropped and the new one appended, so that it isn't delivered ahead of the calls
+			// queued in the meantime (e.g. a user moving into a channel created after the replaced call)
+			Entry &replaced = m_entries[static_cast< std::size_t >(it.value() - m_firstSequence)];
+			replaced.call   = nullptr;
+			replaced.key.clear();
+			m_keys.erase(it);
+
+			--m_queued;
+			++m_coalesced;
+		}
+	}
+
+	if (m_entries.size() >= m_capacity) {
+		removeReplaced();
+	}
+	if (m_entries.size() >= m_capacity) {
+		++m_dropped;
+		return true;
+	}
+
+	if (!key.isEmpty()) {
+		m_keys.insert(key, m_firstSequence + m_entries.size());
+	}
+	m_entries.push_back({ call, key });
+	++m_queued;
+
+	startCalls(lock);
+
+	return !m_failed;
+}
+
+bool CallbackQueue::hasFailed() const {
+	QMutexLocker< QMutex > lock(&m_mutex);
+
+	return m_failed || isStalled();
+}
+
+CallbackQueueMetrics CallbackQueue::metrics() const {
+	QMutexLocker< QMutex > lock(&m_mutex);
+
+	CallbackQueueMetrics metrics;
+	metrics.subscribers = 1;
+	metrics.queued      = m_queued;
+	metrics.enqueued    = m_enqueued;
+	metrics.coalesced   = m_coalesced;
+	metrics.dropped     = m_dropped;
+	metrics.delivered   = m_delivered;
+	return metrics;
+}
+
+std::string CallbackQueue::toPrometheus(const std::vector< std::pair< int, CallbackQueueMetrics > > &servers) {
+	static const Prometheus::Metric< CallbackQueueMetrics > metrics[] = {
+		{ "murmur_ice_callbacks", "Registered Ice server callbacks", "gauge", &CallbackQueueMetrics::subscribers },
+		{ "murmur_ice_callback_calls_queued", "Calls of Ice server callbacks waiting to be sent", "gauge",
+		  &CallbackQueueMetrics::queued },
+		{ "murmur_ice_callback_calls_enqueued_total", "Calls of Ice server callbacks queued", "counter",
+		  &CallbackQueueMetrics::enqueued },
+		{ "murmur_ice_callback_calls_coalesced_total",
+		  "Calls of Ice server callbacks replaced by a later call about the same user or channel", "counter",
+		  &CallbackQueueMetrics::coalesced },
+		{ "murmur_ice_callback_calls_dropped_total", "Calls of Ice server callbacks dropped because the queue was full",
+		  "counter", &CallbackQueueMetrics::dropped },
+		{ "murmur_ice_callback_calls_delivered_total", "Calls of Ice server callbacks sent", "counter",
+		  &CallbackQueueMetrics::delivered },
+		{ "murmur_ice_callbacks_removed_total", "Ice server callbacks removed because they failed or stayed behind",
+		  "counter", &CallbackQueueMetrics::removed },
+	};
+
+	std::string out;
+	Prometheus::appendMetrics(out, metrics, servers);
+
+	return out;
+}
+
+void CallbackQueue::startCalls(QMutexLocker< QMutex > &lock) {
+	// If a call completes right away (possibly on this very thread), the next one is started by the loop instead of
+	// recursing
+	if (m_starting) {
+		return;
+	}
+	m_starting = true;
+
+	while (!m_inFlight && !m_failed && !m_entries.empty()) {
+		const Entry entry = std::move(m_entries.front());
+		m_entries.pop_front();
+		++m_firstSequence;
+		if (!entry.call) {
+			// Replaced by a later call
+			continue;
+		}
+		--m_queued;
+		if (!entry.key.isEmpty()) {
+			m_keys.remove(entry.key);
+		}
+
+		const std::uint64_t callID = ++m_callID;
+		m_inFlight                 = true;
+		m_inFlightTimer.start();
+
+		lock.unlock();
+
+		std::shared_ptr< CallbackQueue > self = shared_from_this();
+		try {
+			entry.call([self, callID](bool success) { self->finished(callID, success); });
+		} catch (...) {
+			finished(callID, false);
+		}
+
+		lock.relock();
+	}
+
+	m_starting = false;
+}
+
+void CallbackQueue::finished(std::uint64_t callID, bool success) {
+	QMutexLocker< QMutex > lock(&m_mutex);
+
+	if (!success) {
+		// Also if the call has already been reported as sent, as the subscriber is gone either way
+		if (!m_failed) {
+			fail();
+		}
+		return;
+	}
+
+	if (!m_inFlight || callID != m_callID) {
+		return;
+	}
+	m_inFlight = false;
+	++m_delivered;
+
+	startCalls(lock);
+}
+
+bool CallbackQueue::isStalled() const {
+	return m_timeout > 0 && m_inFlight && m_inFlightTimer.hasExpired(m_timeout);
+}
+
+void CallbackQueue::removeReplaced() {
+	std::deque< Entry > entries;
+	m_keys.clear();
+
+	for (Entry &entry : m_entries) {
+		if (!entry.call) {
+			continue;
+		}
+
+		if (!entry.key.isEmpty()) {
+			m_keys.insert(entry.key, m_firstSequence + entries.size());
+		}
+		entries.push_back(std::move(entry));
+	}
+
+	m_entries.swap(entries);
+}
+
+void CallbackQueue::fail() {
+	m_failed   = true;
+	m_inFlight = false;
+	m_entries.clear();
+	m_keys.clear();
+	m_queued = 0;
+}
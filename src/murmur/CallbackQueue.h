@@ -0,0 +1,126 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_CALLBACKQUEUE_H_
+#define MUMBLE_MURMUR_CALLBACKQUEUE_H_
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// The metrics of one or more CallbackQueues
+struct CallbackQueueMetrics {
+	std::uint64_t subscribers = 0;
+	/// Calls waiting to be started
+	std::uint64_t queued   = 0;
+	std::uint64_t enqueued = 0;
+	/// Calls that were dropped because a later call with the same key replaced them
+	std::uint64_t coalesced = 0;
+	/// Calls that were dropped because the queue was full
+	std::uint64_t dropped   = 0;
+	std::uint64_t delivered = 0;
+	/// Subscribers that were removed because a call failed or they stayed behind
+	std::uint64_t removed = 0;
+
+	CallbackQueueMetrics &operator+=(const CallbackQueueMetrics &other);
+};
+
+/// Delivers the calls to a single RPC subscriber (e.g. an Ice ServerCallback) asynchronously, so that a slow or hung
+/// subscriber doesn't stall the thread making the calls.
+///
+/// Only one call is in flight at a time, so the subscriber receives the calls in the order they were queued. Once the
+/// queue is full, further calls are dropped. Calls may be given a key: a call with the same key as a call that is
+/// still waiting replaces it, e.g. because only the latest state of a user matters. The replacing call is queued
+/// after all calls queued so far, so that the subscriber never learns about a state before the events leading to it.
+///
+/// A subscriber has failed once a call failed or a call has been in flight for longer than the timeout. The queue
+/// doesn't accept any calls after that, its owner is expected to remove the subscriber.
+///
+/// Has to be created with std::make_shared, as the calls in flight keep the queue alive.
+class CallbackQueue : public std::enable_shared_from_this< CallbackQueue > {
+private:
+	Q_DISABLE_COPY(CallbackQueue)
+
+public:
+	/// Has to be called once the call has been sent (true) or failed (false). The next call is started once the call
+	/// has been sent, further successful invocations are ignored. A failure is never ignored though, as a call may
+	/// still fail after it has been sent (e.g. because the subscriber's object doesn't exist anymore). It may be
+	/// called from any thread, and also by the call itself.
+	using Done = std::function< void(bool) >;
+	/// Starts a call. Exceptions thrown by it are treated as failure.
+	using Call = std::function< void(const Done &) >;
+
+	/// @param capacity The maximum number of calls waiting to be started (at least 1)
+	/// @param timeout The time in milliseconds a call may be in flight (0 for no limit)
+	CallbackQueue(unsigned int capacity, int timeout);
+
+	/// Queues the given call and starts it right away if no other call is in flight
+	/// @param key Identifies the data the call replaces, or an empty string if it may not be coalesced with other
+	/// 	calls
+	/// @returns false if the subscriber has failed
+	bool enqueue(const Call &call, const QString &key = QString());
+
+	bool hasFailed() const;
+
+	/// @returns The metrics of the queue (with subscribers = 1)
+	CallbackQueueMetrics metrics() const;
+
+	/// Renders the given metrics of every virtual server in the Prometheus text exposition format
+	static std::string toPrometheus(const std::vector< std::pair< int, CallbackQueueMetrics > > &servers);
+
+protected:
+	struct Entry {
+		Call call;
+		QString key;
+	};
+
+	unsigned int m_capacity;
+	int m_timeout;
+
+	mutable QMutex m_mutex;
+	/// The waiting calls including the ones that have been replaced (with an empty call), whose number is bounded by
+	/// the capacity as well
+	std::deque< Entry > m_entries;
+	/// The number of calls in m_entries that haven't been replaced
+	std::size_t m_queued = 0;
+	/// The sequence number of the first entry
+	std::uint64_t m_firstSequence = 0;
+	/// The sequence numbers of the queued calls with a key
+	QHash< QString, std::uint64_t > m_keys;
+	/// Identifies the call in flight, so that late or repeated invocations of Done are ignored
+	std::uint64_t m_callID = 0;
+	bool m_inFlight        = false;
+	/// Measures the time the call in flight has been in flight
+	QElapsedTimer m_inFlightTimer;
+	/// Whether a thread is starting calls at the moment
+	bool m_starting = false;
+	bool m_failed   = false;
+
+	std::uint64_t m_enqueued  = 0;
+	std::uint64_t m_coalesced = 0;
+	std::uint64_t m_dropped   = 0;
+	std::uint64_t m_delivered = 0;
+
+	/// Starts the queued calls one after the other, as long as they complete right away
+	void startCalls(QMutexLocker< QMutex > &lock);
+	/// Removes the entries of replaced calls from m_entries
+	void removeReplaced();
+	/// Called by Done. A failure fails the queue even if callID isn't the call in flight anymore.
+	void finished(std::uint64_t callID, bool success);
+	/// @returns Whether the call in flight has been in flight for longer than the timeout
+	bool isStalled() const;
+	void fail();
+};
+
+#endif // MUMBLE_MURMUR_CALLBACKQUEUE_H_
@@ -0,0 +1,137 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "ChannelTreeBuilder.h"
+
+#include "ACL.h"
+#include "Channel.h"
+#include "Group.h"
+#include "ServerDB.h"
+
+#include <QtCore/QVariant>
+
+void ChannelTreeBuilder::addChannel(unsigned int id, int parentId, const QString &name, bool inheritACL) {
+	m_channels.push_back({ id, parentId, name, inheritACL });
+}
+
+void ChannelTreeBuilder::addInfo(unsigned int channelId, int key, const QString &value) {
+	m_info.push_back({ channelId, key, value });
+}
+
+void ChannelTreeBuilder::addGroup(int groupId, unsigned int channelId, const QString &name, bool inherit,
+								  bool inheritable) {
+	m_groups.push_back({ groupId, channelId, name, inherit, inheritable });
+}
+
+void ChannelTreeBuilder::addGroupMember(int groupId, int userId, bool add) {
+	m_members.push_back({ groupId, userId, add });
+}
+
+void ChannelTreeBuilder::addACL(unsigned int channelId, int userId, const QString &group, bool applyHere,
+								bool applySubs, int allow, int deny) {
+	m_acls.push_back({ channelId, userId, group, applyHere, applySubs, allow, deny });
+}
+
+QHash< unsigned int, Channel * > ChannelTreeBuilder::build(QObject *parent) const {
+	QHash< unsigned int, Channel * > channels;
+
+	// The indices of the rows of the subchannels of every channel (-1 for the root channels), ordered by name
+	QHash< int, std::vector< std::size_t > > children;
+	for (std::size_t i = 0; i < m_channels.size(); ++i) {
+		children[m_channels[i].parentId].push_back(i);
+	}
+
+	// Channels that aren't connected to a root channel (or whose parents form a cycle) are never reached
+	std::vector< Channel * > pending;
+	for (std::size_t i : children.value(-1)) {
+		const ChannelRow &row = m_channels[i];
+
+		Channel *channel = new Channel(row.id, row.name);
+		channel->setParent(parent);
+		channel->bInheritACL = row.inheritACL;
+		channels.insert(row.id, channel);
+		pending.push_back(channel);
+	}
+
+	while (!pending.empty()) {
+		Channel *channel = pending.back();
+		pending.pop_back();
+
+		const auto it = children.constFind(static_cast< int >(channel->iId));
+		if (it == children.constEnd()) {
+			continue;
+		}
+
+		for (std::size_t i : it.value()) {
+			const ChannelRow &row = m_channels[i];
+			if (channels.contains(row.id)) {
+				continue;
+			}
+
+			Channel *child     = new Channel(row.id, row.name, channel);
+			child->bInheritACL = row.inheritACL;
+			channels.insert(row.id, child);
+			pending.push_back(child);
+		}
+	}
+
+	for (const InfoRow &row : m_info) {
+		Channel *channel = channels.value(row.channelId);
+		if (!channel) {
+			continue;
+		}
+
+		if (row.key == ServerDB::Channel_Description) {
+			channel->qsDesc = row.value;
+		} else if (row.key == ServerDB::Channel_Position) {
+			// If the conversion fails it'll return the default value 0
+			channel->iPosition = QVariant(row.value).toInt();
+		} else if (row.key == ServerDB::Channel_Max_Users) {
+			channel->uiMaxUsers = QVariant(row.value).toUInt();
+		}
+	}
+
+	QHash< int, Group * > groups;
+	for (const GroupRow &row : m_groups) {
+		Channel *channel = channels.value(row.channelId);
+		if (!channel) {
+			continue;
+		}
+
+		Group *group        = new Group(channel, row.name);
+		group->bInherit     = row.inherit;
+		group->bInheritable = row.inheritable;
+		groups.insert(row.id, group);
+	}
+
+	for (const MemberRow &row : m_members) {
+		Group *group = groups.value(row.groupId);
+		if (!group) {
+			continue;
+		}
+
+		if (row.add)
+			group->qsAdd << row.userId;
+		else
+			group->qsRemove << row.userId;
+	}
+
+	for (const ACLRow &row : m_acls) {
+		Channel *channel = channels.value(row.channelId);
+		if (!channel) {
+			continue;
+		}
+
+		ChanACL *acl    = new ChanACL(channel);
+		acl->iUserId    = row.userId;
+		acl->qsGroup    = row.group;
+		acl->bApplyHere = row.applyHere;
+		acl->bApplySubs = row.applySubs;
+		acl->pAllow     = static_cast< ChanACL::Permissions >(row.allow);
+		acl->pDeny      = static_cast< ChanACL::Permissions >(row.deny);
+	}
+
+	return channels;
+}
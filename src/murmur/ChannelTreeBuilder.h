@@ -0,0 +1,88 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_CHANNELTREEBUILDER_H_
+#define MUMBLE_MURMUR_CHANNELTREEBUILDER_H_
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+
+#include <vector>
+
+class Channel;
+class QObject;
+
+/// Assembles the channels of a virtual server along with their groups and ACLs from the rows of the channels,
+/// channel_info, groups, group_members and acl tables.
+///
+/// This allows reading every table with a single query instead of issuing several queries per channel and group. The
+/// rows of the different tables may be added in any order, but the rows of the channels have to be ordered by name
+/// (which is the order of the subchannels) and the ones of the ACLs by priority.
+class ChannelTreeBuilder {
+public:
+	/// @param parentId The ID of the parent channel or -1 for the root channel
+	void addChannel(unsigned int id, int parentId, const QString &name, bool inheritACL);
+	/// @param key A ServerDB::ChannelInfo
+	void addInfo(unsigned int channelId, int key, const QString &value);
+	void addGroup(int groupId, unsigned int channelId, const QString &name, bool inherit, bool inheritable);
+	void addGroupMember(int groupId, int userId, bool add);
+	/// @param userId The ID of the user the ACL applies to or -1 if it applies to a group
+	void addACL(unsigned int channelId, int userId, const QString &group, bool applyHere, bool applySubs, int allow,
+				int deny);
+
+	/// Creates the channels that can be reached from a root channel, just like the channels have been read one level
+	/// at a time before. The rows referring to any other channel are ignored. The hashes of the descriptions aren't
+	/// computed.
+	///
+	/// @param parent The QObject parent of the root channels
+	/// @returns The created channels by ID
+	QHash< unsigned int, Channel * > build(QObject *parent) const;
+
+protected:
+	struct ChannelRow {
+		unsigned int id;
+		int parentId;
+		QString name;
+		bool inheritACL;
+	};
+
+	struct InfoRow {
+		unsigned int channelId;
+		int key;
+		QString value;
+	};
+
+	struct GroupRow {
+		int id;
+		unsigned int channelId;
+		QString name;
+		bool inherit;
+		bool inheritable;
+	};
+
+	struct MemberRow {
+		int groupId;
+		int userId;
+		bool add;
+	};
+
+	struct ACLRow {
+		unsigned int channelId;
+		int userId;
+		QString group;
+		bool applyHere;
+		bool applySubs;
+		int allow;
+		int deny;
+	};
+
+	std::vector< ChannelRow > m_channels;
+	std::vector< InfoRow > m_info;
+	std::vector< GroupRow > m_groups;
+	std::vector< MemberRow > m_members;
+	std::vector< ACLRow > m_acls;
+};
+
+#endif // MUMBLE_MURMUR_CHANNELTREEBUILDER_H_
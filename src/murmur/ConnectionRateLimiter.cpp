@@ -0,0 +1,254 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "ConnectionRateLimiter.h"
+
+#include "Metrics.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QRandomGenerator>
+
+#include <algorithm>
+
+namespace {
+using Address = std::array< std::uint8_t, 16 >;
+
+/// @returns The given address with all bits beyond length cleared
+Address truncated(const Address &address, unsigned int length) {
+	Address result = {};
+	for (unsigned int i = 0; i < length / 8; ++i) {
+		result[i] = address[i];
+	}
+	if (length % 8 != 0) {
+		result[length / 8] = static_cast< std::uint8_t >(address[length / 8] & (0xFF << (8 - length % 8)));
+	}
+
+	return result;
+}
+} // namespace
+
+ConnectionRateLimiter::ConnectionRateLimiter(const Settings &settings, std::size_t capacity)
+	: m_settings(settings), m_seed(static_cast< std::size_t >(QRandomGenerator::system()->generate64())) {
+	m_settings.ipv4Prefix = std::clamp(m_settings.ipv4Prefix, 1U, 32U);
+	m_settings.ipv6Prefix = std::clamp(m_settings.ipv6Prefix, 1U, 128U);
+	m_settings.timeframe  = std::max< quint64 >(m_settings.timeframe, 1);
+
+	std::size_t size = WAYS;
+	while (size < capacity) {
+		size *= 2;
+	}
+
+	m_entries.resize(size);
+	m_bucketMask = size / WAYS - 1;
+}
+
+bool ConnectionRateLimiter::check(const HostAddress &address, quint64 now) {
+	const Address &bytes      = address.getByteRepresentation();
+	const unsigned int subnet = subnetLength(address);
+	const bool limitSubnet    = m_settings.subnetAttempts > 0;
+
+	Entry &entry       = findOrInsert(bytes, 128, now, nullptr);
+	Entry *subnetEntry = limitSubnet ? &findOrInsert(truncated(bytes, subnet), subnet, now, &entry) : nullptr;
+
+	if (entry.bannedUntil > now || (subnetEntry && subnetEntry->bannedUntil > now)) {
+		++m_metrics.throttled;
+		return true;
+	}
+
+	bool banned = false;
+
+	advance(entry, now);
+	++entry.current;
+	if (m_settings.attempts > 0 && attempts(entry, now) > m_settings.attempts) {
+		entry.bannedUntil = now + m_settings.banTime;
+		++m_metrics.addressBans;
+		banned = true;
+	}
+
+	if (subnetEntry) {
+		advance(*subnetEntry, now);
+		++subnetEntry->current;
+		if (attempts(*subnetEntry, now) > m_settings.subnetAttempts) {
+			subnetEntry->bannedUntil = now + m_settings.banTime;
+			++m_metrics.subnetBans;
+			banned = true;
+		}
+	}
+
+	if (banned) {
+		++m_metrics.throttled;
+	}
+
+	return banned;
+}
+
+void ConnectionRateLimiter::succeeded(const HostAddress &address, quint64 now) {
+	const Address &bytes = address.getByteRepresentation();
+
+	if (Entry *entry = find(bytes, 128)) {
+		entry->previous = 0;
+		entry->current  = 0;
+	}
+
+	if (m_settings.subnetAttempts > 0) {
+		const unsigned int subnet = subnetLength(address);
+		if (Entry *entry = find(truncated(bytes, subnet), subnet)) {
+			advance(*entry, now);
+			if (entry->current > 0) {
+				--entry->current;
+			}
+		}
+	}
+}
+
+ConnectionRateLimiterMetrics ConnectionRateLimiter::metrics(quint64 now) const {
+	ConnectionRateLimiterMetrics metrics = m_metrics;
+
+	for (const Entry &entry : m_entries) {
+		if (!entry.used || isStale(entry, now)) {
+			continue;
+		}
+
+		++metrics.tracked;
+		if (entry.bannedUntil > now) {
+			++metrics.banned;
+		}
+	}
+
+	return metrics;
+}
+
+std::size_t ConnectionRateLimiter::capacity() const {
+	return m_entries.size();
+}
+
+std::string ConnectionRateLimiter::toPrometheus(const ConnectionRateLimiterMetrics &metrics) {
+	static const Prometheus::Metric< ConnectionRateLimiterMetrics > metricList[] = {
+		{ "murmur_autoban_throttled_total", "Connection attempts rejected by the autoban", "counter",
+		  &ConnectionRateLimiterMetrics::throttled },
+		{ "murmur_autoban_address_bans_total", "Addresses banned for making too many connection attempts", "counter",
+		  &ConnectionRateLimiterMetrics::addressBans },
+		{ "murmur_autoban_subnet_bans_total", "Subnets banned for making too many connection attempts", "counter",
+		  &ConnectionRateLimiterMetrics::subnetBans },
+		{ "murmur_autoban_evictions_total", "Sources whose attempts were forgotten to make room for new sources",
+		  "counter", &ConnectionRateLimiterMetrics::evictions },
+		{ "murmur_autoban_tracked_sources", "Addresses and subnets whose connection attempts are tracked", "gauge",
+		  &ConnectionRateLimiterMetrics::tracked },
+		{ "murmur_autoban_banned_sources", "Addresses and subnets that are currently banned", "gauge",
+		  &ConnectionRateLimiterMetrics::banned },
+	};
+
+	std::string out;
+	Prometheus::appendMetrics(out, metricList, metrics);
+
+	return out;
+}
+
+ConnectionRateLimiter::Entry *ConnectionRateLimiter::find(const Address &key, unsigned int length) {
+	const std::size_t first = bucket(key, length) * WAYS;
+	for (std::size_t i = first; i < first + WAYS; ++i) {
+		Entry &entry = m_entries[i];
+		if (entry.used && entry.length == length && entry.key == key) {
+			return &entry;
+		}
+	}
+
+	return nullptr;
+}
+
+ConnectionRateLimiter::Entry &ConnectionRateLimiter::findOrInsert(const Address &key, unsigned int length,
+																   quint64 now, const Entry *keep) {
+	const std::size_t first = bucket(key, length) * WAYS;
+
+	Entry *unused = nullptr;
+	Entry *victim = nullptr;
+	for (std::size_t i = first; i < first + WAYS; ++i) {
+		Entry &entry = m_entries[i];
+		if (!entry.used || &entry == keep) {
+			if (!entry.used && !unused) {
+				unused = &entry;
+			}
+			continue;
+		}
+		if (entry.length == length && entry.key == key) {
+			entry.lastSeen = now;
+			return entry;
+		}
+		if (isStale(entry, now)) {
+			if (!unused) {
+				unused = &entry;
+			}
+			continue;
+		}
+
+		// Prefer evicting sources that aren't banned, then the ones that haven't been seen for the longest time (or
+		// whose ban ends first)
+		if (!victim) {
+			victim = &entry;
+		} else {
+			const bool banned       = entry.bannedUntil > now;
+			const bool victimBanned = victim->bannedUntil > now;
+			if (banned != victimBanned) {
+				if (victimBanned) {
+					victim = &entry;
+				}
+			} else if (banned ? entry.bannedUntil < victim->bannedUntil : entry.lastSeen < victim->lastSeen) {
+				victim = &entry;
+			}
+		}
+	}
+
+	Entry *entry = unused;
+	if (!entry) {
+		// As WAYS > 1, there is always at least one entry besides keep
+		entry = victim;
+		++m_metrics.evictions;
+	}
+
+	*entry             = Entry();
+	entry->key         = key;
+	entry->length      = static_cast< std::uint8_t >(length);
+	entry->used        = true;
+	entry->windowStart = now;
+	entry->lastSeen    = now;
+
+	return *entry;
+}
+
+std::size_t ConnectionRateLimiter::bucket(const Address &key, unsigned int length) const {
+	return qHash(length, qHashBits(key.data(), key.size(), m_seed)) & m_bucketMask;
+}
+
+void ConnectionRateLimiter::advance(Entry &entry, quint64 now) const {
+	if (now < entry.windowStart + m_settings.timeframe) {
+		return;
+	}
+
+	if (now < entry.windowStart + 2 * m_settings.timeframe) {
+		entry.previous = entry.current;
+		entry.windowStart += m_settings.timeframe;
+	} else {
+		entry.previous    = 0;
+		entry.windowStart = now;
+	}
+	entry.current = 0;
+}
+
+quint64 ConnectionRateLimiter::attempts(const Entry &entry, quint64 now) const {
+	// The share of the previous timeframe that still overlaps the window
+	const double overlap =
+		1.0 - static_cast< double >(now - entry.windowStart) / static_cast< double >(m_settings.timeframe);
+
+	return entry.current + static_cast< quint64 >(static_cast< double >(entry.previous) * std::max(overlap, 0.0));
+}
+
+bool ConnectionRateLimiter::isStale(const Entry &entry, quint64 now) const {
+	return entry.bannedUntil <= now && now >= entry.windowStart + 2 * m_settings.timeframe;
+}
+
+unsigned int ConnectionRateLimiter::subnetLength(const HostAddress &address) const {
+	// IPv4 addresses are represented as IPv4-mapped IPv6 addresses
+	return address.isV6() ? m_settings.ipv6Prefix : 96 + m_settings.ipv4Prefix;
+}
@@ -0,0 +1,121 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_CONNECTIONRATELIMITER_H_
+#define MUMBLE_MURMUR_CONNECTIONRATELIMITER_H_
+
+#include "HostAddress.h"
+
+#include <QtCore/QtGlobal>
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// The counters of a ConnectionRateLimiter
+struct ConnectionRateLimiterMetrics {
+	/// Connection attempts that have been rejected
+	std::uint64_t throttled = 0;
+	/// Addresses that have been banned for making too many attempts
+	std::uint64_t addressBans = 0;
+	/// Subnets that have been banned for making too many attempts
+	std::uint64_t subnetBans = 0;
+	/// Sources that had to make room for new ones while their attempts still counted
+	std::uint64_t evictions = 0;
+	/// Sources (addresses and subnets) whose attempts are currently tracked
+	std::uint64_t tracked = 0;
+	/// Sources that are currently banned
+	std::uint64_t banned = 0;
+};
+
+/// Limits the rate of connection attempts per address and per subnet (the autoban feature) using a fixed amount of
+/// memory.
+///
+/// The attempts of every source are counted in a sliding window, approximated by the count of the current and the
+/// previous timeframe (weighted by how much of it still overlaps the window). Sources are stored in a set-associative
+/// table of a fixed capacity: every source can only be stored in one of WAYS slots. If these are all taken by sources
+/// whose attempts still count, the one that hasn't been seen for the longest time is evicted (banned sources are only
+/// evicted if all sources in these slots are banned). The hash selecting the slots is seeded randomly, so that the
+/// sources evicting each other can't be predicted.
+///
+/// This class is not thread-safe.
+class ConnectionRateLimiter {
+public:
+	/// The number of slots a source can be stored in
+	static constexpr std::size_t WAYS = 8;
+
+	struct Settings {
+		/// The number of attempts per address in a timeframe that lead to a ban if exceeded (0 disables the limit)
+		unsigned int attempts = 10;
+		/// The number of attempts per subnet in a timeframe that lead to a ban if exceeded (0 disables the limit)
+		unsigned int subnetAttempts = 0;
+		/// The prefix lengths of the subnets
+		unsigned int ipv4Prefix = 24;
+		unsigned int ipv6Prefix = 64;
+		/// In microseconds
+		quint64 timeframe = 120 * 1000000ULL;
+		/// In microseconds
+		quint64 banTime = 300 * 1000000ULL;
+	};
+
+	/// @param capacity The number of sources that can be tracked at the same time. It is rounded up to a power of two
+	/// 	(but at least WAYS).
+	ConnectionRateLimiter(const Settings &settings, std::size_t capacity);
+
+	/// Records a connection attempt from the given address
+	///
+	/// @param now The current time in microseconds (of a monotonic clock)
+	/// @returns Whether the attempt has to be rejected, because the address or its subnet is banned
+	bool check(const HostAddress &address, quint64 now);
+	/// Forgets the attempts of the given address. Its subnet only forgets the last attempt.
+	void succeeded(const HostAddress &address, quint64 now);
+
+	ConnectionRateLimiterMetrics metrics(quint64 now) const;
+	std::size_t capacity() const;
+
+	/// Renders the given metrics in the Prometheus text exposition format
+	static std::string toPrometheus(const ConnectionRateLimiterMetrics &metrics);
+
+protected:
+	struct Entry {
+		/// The address with all bits beyond length cleared
+		std::array< std::uint8_t, 16 > key;
+		/// The prefix length of key (128 for single addresses)
+		std::uint8_t length = 0;
+		bool used           = false;
+		/// The attempts in the previous and the current timeframe
+		std::uint32_t previous = 0;
+		std::uint32_t current  = 0;
+		quint64 windowStart    = 0;
+		quint64 bannedUntil    = 0;
+		quint64 lastSeen       = 0;
+	};
+
+	Settings m_settings;
+	std::vector< Entry > m_entries;
+	std::size_t m_bucketMask;
+	std::size_t m_seed;
+	ConnectionRateLimiterMetrics m_metrics;
+
+	/// @returns The entry of the given source, or nullptr if it isn't tracked
+	Entry *find(const std::array< std::uint8_t, 16 > &key, unsigned int length);
+	/// @returns The entry of the given source, which is added if it isn't tracked. The entry keep is never evicted.
+	Entry &findOrInsert(const std::array< std::uint8_t, 16 > &key, unsigned int length, quint64 now,
+						const Entry *keep);
+	std::size_t bucket(const std::array< std::uint8_t, 16 > &key, unsigned int length) const;
+
+	/// Moves the window of the given entry to now
+	void advance(Entry &entry, quint64 now) const;
+	/// @returns The number of attempts of the given entry in the window ending now
+	quint64 attempts(const Entry &entry, quint64 now) const;
+	/// @returns Whether the given entry doesn't hold any information that is still relevant
+	bool isStale(const Entry &entry, quint64 now) const;
+
+	/// @returns The length of the subnet prefix of the given address
+	unsigned int subnetLength(const HostAddress &address) const;
+};
+
+#endif // MUMBLE_MURMUR_CONNECTIONRATELIMITER_H_
@@ -0,0 +1,87 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "ControlThread.h"
+
+#include "Server.h"
+#include "ServerDB.h"
+
+#include <tracy/Tracy.hpp>
+
+#include <string>
+
+namespace {
+thread_local Server *currentControlServer = nullptr;
+} // namespace
+
+ControlThread::ControlThread(int serverNum) : m_serverNum(serverNum), m_context(new QObject()) {
+	m_context->moveToThread(this);
+	start();
+
+	runOnThreadOf(m_context, [this, serverNum]() {
+		Server *server = new Server(serverNum, nullptr);
+		if (!server->bValid) {
+			delete server;
+			return;
+		}
+
+		m_server             = server;
+		currentControlServer = server;
+	});
+}
+
+ControlThread::~ControlThread() {
+	runOnThreadOf(m_context, [this]() {
+		currentControlServer = nullptr;
+		delete m_server;
+		m_server = nullptr;
+
+		// The thread's database connection can't be used by any other thread
+		ServerDB::releaseThreadConnection();
+	});
+
+	quit();
+	wait();
+
+	// The thread isn't running anymore, so there is nothing that could still be using the context
+	delete m_context;
+}
+
+Server *ControlThread::server() const {
+	return m_server;
+}
+
+Server *ControlThread::currentServer() {
+	return currentControlServer;
+}
+
+void ControlThread::post(const std::function< void() > &function) {
+	QMetaObject::invokeMethod(m_context, function, Qt::QueuedConnection);
+}
+
+void ControlThread::runOnThreadOf(QObject *object, const std::function< void() > &function) {
+	if (object->thread() == QThread::currentThread()) {
+		function();
+	} else {
+		QMetaObject::invokeMethod(object, function, Qt::BlockingQueuedConnection);
+	}
+}
+
+void ControlThread::runFor(const QHash< int, ControlThread * > &threads, int serverNum,
+						   const std::function< void() > &function) {
+	ControlThread *thread = threads.value(serverNum);
+	if (thread) {
+		thread->post(function);
+	} else {
+		function();
+	}
+}
+
+void ControlThread::run() {
+	const std::string threadName = "Control " + std::to_string(m_serverNum);
+	tracy::SetThreadName(threadName.c_str());
+
+	exec();
+}
@@ -0,0 +1,62 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_CONTROLTHREAD_H_
+#define MUMBLE_MURMUR_CONTROLTHREAD_H_
+
+#include <QtCore/QHash>
+#include <QtCore/QThread>
+
+#include <functional>
+
+class Server;
+
+/// The thread running the control plane of a single Server (see the controlthreads setting): its TLS connections,
+/// the handling of its protobuf messages, its timers and the RPC calls referring to it. The Server is constructed
+/// and destroyed on this thread, so that everything it creates (listening sockets, client connections, timers)
+/// lives on this thread as well.
+///
+/// Without control threads, all Servers live on the main thread.
+class ControlThread : public QThread {
+private:
+	Q_DISABLE_COPY(ControlThread)
+
+public:
+	/// Starts the thread and boots the given virtual server on it
+	explicit ControlThread(int serverNum);
+	/// Destroys the Server (on this thread) and stops the thread
+	~ControlThread() override;
+
+	/// @returns The booted Server or nullptr if it failed to start (in which case the ControlThread should be
+	/// 	destroyed)
+	Server *server() const;
+
+	/// @returns The Server the calling thread is the control thread of, or nullptr if the calling thread isn't a
+	/// 	control thread
+	static Server *currentServer();
+
+	/// Queues the given function to be run on this thread. Functions queued before the ControlThread is destroyed are
+	/// still run before the Server is destroyed.
+	void post(const std::function< void() > &function);
+
+	/// Runs the given function on the thread the given object lives on and waits for it to return
+	static void runOnThreadOf(QObject *object, const std::function< void() > &function);
+
+	/// Queues the given function (e.g. an RPC call) on the control thread of the given virtual server, or runs it right
+	/// away if the server doesn't have one
+	/// @param threads The control threads by the number of their server
+	static void runFor(const QHash< int, ControlThread * > &threads, int serverNum,
+					   const std::function< void() > &function);
+
+protected:
+	int m_serverNum;
+	/// Lives on this thread. Used to run functions on this thread while there is no Server (yet).
+	QObject *m_context;
+	Server *m_server = nullptr;
+
+	void run() override;
+};
+
+#endif // MUMBLE_MURMUR_CONTROLTHREAD_H_
@@ -0,0 +1,195 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "DBWriter.h"
+
+#include <QtCore/QDeadlineTimer>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QThread>
+
+#include <tracy/Tracy.hpp>
+
+
+DBWriter::DBWriter(const Transaction &transaction, unsigned int capacity, int interval,
+				   const std::function< void() > &threadCleanup)
+	: m_transaction(transaction), m_capacity(qMax(capacity, 1U)), m_interval(qMax(interval, 0)),
+	  m_threadCleanup(threadCleanup) {
+	m_thread = QThread::create([this]() { run(); });
+	m_thread->start();
+}
+
+DBWriter::~DBWriter() {
+	{
+		QMutexLocker lock(&m_mutex);
+		m_stopping = true;
+	}
+	m_condition.wakeAll();
+
+	m_thread->wait();
+	delete m_thread;
+}
+
+void DBWriter::enqueue(const Write &write, const QString &key) {
+	{
+		QMutexLocker lock(&m_mutex);
+		m_enqueued.add();
+
+		if (m_entries.size() < m_capacity) {
+			const std::uint64_t sequence = m_firstSequence + m_entries.size();
+
+			if (!key.isEmpty()) {
+				const auto it = m_keys.find(key);
+				if (it != m_keys.end()) {
+					Entry &replaced = m_entries[static_cast< std::size_t >(it.value() - m_firstSequence)];
+					replaced.write  = nullptr;
+					replaced.key.clear();
+					it.value() = sequence;
+
+					--m_queued;
+					m_coalesced.add();
+				} else {
+					m_keys.insert(key, sequence);
+				}
+			}
+
+			m_entries.push_back({ write, key });
+			++m_queued;
+		} else {
+			m_overflows.add();
+
+			lock.unlock();
+			commit(write);
+			return;
+		}
+	}
+
+	m_condition.wakeOne();
+}
+
+unsigned int DBWriter::drain() {
+	std::deque< Entry > entries;
+	{
+		QMutexLocker lock(&m_mutex);
+		entries.swap(m_entries);
+		m_firstSequence += entries.size();
+		m_keys.clear();
+		m_queued = 0;
+	}
+
+	unsigned int executed = 0;
+	for (const Entry &entry : entries) {
+		if (entry.write) {
+			entry.write();
+			++executed;
+		}
+	}
+	m_committed.add(executed);
+
+	return executed;
+}
+
+void DBWriter::flush() {
+	commit();
+}
+
+DBWriterMetrics DBWriter::metrics() const {
+	DBWriterMetrics metrics;
+
+	QMutexLocker lock(&m_mutex);
+	metrics.queued    = m_queued;
+	metrics.enqueued  = m_enqueued.value();
+	metrics.coalesced = m_coalesced.value();
+	metrics.committed = m_committed.value();
+	metrics.overflows = m_overflows.value();
+	m_commitTime.addTo(metrics.commitTime);
+
+	return metrics;
+}
+
+std::string DBWriter::toPrometheus(const DBWriterMetrics &metrics) {
+	static const Prometheus::Metric< DBWriterMetrics > metricList[] = {
+		{ "murmur_db_writes_queued", "Database writes waiting to be committed", "gauge", &DBWriterMetrics::queued },
+		{ "murmur_db_writes_enqueued_total", "Database writes queued", "counter", &DBWriterMetrics::enqueued },
+		{ "murmur_db_writes_coalesced_total", "Queued database writes replaced by a later write of the same data",
+		  "counter", &DBWriterMetrics::coalesced },
+		{ "murmur_db_writes_committed_total", "Queued database writes that have been executed", "counter",
+		  &DBWriterMetrics::committed },
+		{ "murmur_db_write_overflows_total",
+		  "Database writes committed by the thread making them because the queue was full", "counter",
+		  &DBWriterMetrics::overflows },
+	};
+
+	std::string out;
+	Prometheus::appendMetrics(out, metricList, metrics);
+
+	const char *name              = "murmur_db_write_commit_seconds";
+	const HistogramSnapshot &time = metrics.commitTime;
+	Prometheus::appendHeader(out, name, "Time the transactions committing queued database writes took", "histogram");
+
+	std::uint64_t cumulative = 0;
+	// The last bucket also holds all values exceeding the histogram's range, so it is reported as +Inf
+	for (unsigned int i = 0; i + 1 < CommitHistogram::BUCKET_COUNT; ++i) {
+		cumulative += i < time.buckets.size() ? time.buckets[i] : 0;
+
+		out += std::string(name) + "_bucket{le=\"" + Prometheus::formatValue(CommitHistogram::bucketUpperBound(i), 1e6)
+			   + "\"} " + std::to_string(cumulative) + '\n';
+	}
+	out += std::string(name) + "_bucket{le=\"+Inf\"} " + std::to_string(time.count()) + '\n';
+
+	Prometheus::appendSample(out, (std::string(name) + "_sum").c_str(), Prometheus::formatValue(time.sum, 1e6));
+	Prometheus::appendSample(out, (std::string(name) + "_count").c_str(), std::to_string(time.count()));
+
+	return out;
+}
+
+void DBWriter::run() {
+	tracy::SetThreadName("DB writer");
+
+	QMutexLocker lock(&m_mutex);
+	forever {
+		while (m_entries.empty() && !m_stopping) {
+			m_condition.wait(&m_mutex);
+		}
+		if (m_entries.empty()) {
+			break;
+		}
+
+		// Give further writes the chance to join the batch, unless the queue is filling up
+		QDeadlineTimer deadline(m_interval);
+		while (!m_stopping && !m_entries.empty() && m_entries.size() < m_capacity / 2 && !deadline.hasExpired()) {
+			m_condition.wait(&m_mutex, deadline);
+		}
+
+		lock.unlock();
+		commit();
+		lock.relock();
+	}
+	lock.unlock();
+
+	if (m_threadCleanup) {
+		m_threadCleanup();
+	}
+}
+
+void DBWriter::commit(const Write &write) {
+	QElapsedTimer timer;
+	timer.start();
+
+	unsigned int executed = 0;
+	m_transaction([this, &write, &executed]() {
+		executed = drain();
+
+		if (write) {
+			write();
+			m_committed.add();
+			++executed;
+		}
+	});
+
+	if (executed > 0) {
+		QMutexLocker lock(&m_mutex);
+		m_commitTime.record(static_cast< std::uint64_t >(timer.nsecsElapsed() / 1000));
+	}
+}
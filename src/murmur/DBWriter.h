@@ -0,0 +1,128 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_DBWRITER_H_
+#define MUMBLE_MURMUR_DBWRITER_H_
+
+#include "Metrics.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QWaitCondition>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+
+class QThread;
+
+/// The metrics of a DBWriter
+struct DBWriterMetrics {
+	/// Writes waiting to be committed
+	std::uint64_t queued   = 0;
+	std::uint64_t enqueued = 0;
+	/// Writes that were dropped because a later write with the same key replaced them
+	std::uint64_t coalesced = 0;
+	std::uint64_t committed = 0;
+	/// Writes the enqueuing thread executed itself because the queue was full
+	std::uint64_t overflows = 0;
+	/// Time in microseconds the transactions of the writer took (executing the writes and committing them)
+	HistogramSnapshot commitTime;
+};
+
+/// Executes database writes that nobody waits for (e.g. log messages or the last channel of a user) on a thread of
+/// its own, so that the threads of the virtual servers don't wait for the database. Queued writes are committed in
+/// batches: once a write has been queued, the writer waits for further writes for a short time before it executes all
+/// of them in a single transaction.
+///
+/// Writes may be given a key. Queueing a write with the same key as a write that is still waiting discards the
+/// earlier one, so a write has to replace all effects of an earlier write with the same key (e.g. setting a column
+/// to a value).
+///
+/// Reads must see all writes queued before them, which is why every transaction has to call drain() first (see
+/// TransactionHolder). As the writer only takes writes from the queue within a transaction as well and all
+/// transactions are serialized, the writes are executed in the order they were queued in.
+class DBWriter {
+private:
+	Q_DISABLE_COPY(DBWriter)
+
+public:
+	using Write = std::function< void() >;
+	/// Calls the given function within a transaction while holding the lock that serializes all database access
+	using Transaction = std::function< void(const std::function< void() > &) >;
+
+	/// Commit times in microseconds
+	using CommitHistogram = MetricsHistogram< 24 >;
+
+	/// @param transaction Used for executing the writes
+	/// @param capacity The maximum number of writes waiting to be committed (at least 1)
+	/// @param interval The time in milliseconds the writer waits for further writes once one has been queued
+	/// @param threadCleanup Called by the writer's thread before it exits
+	DBWriter(const Transaction &transaction, unsigned int capacity, int interval,
+			 const std::function< void() > &threadCleanup = {});
+	/// Commits all queued writes and stops the writer's thread
+	~DBWriter();
+
+	/// Queues the given write. If the queue is full, the calling thread commits the queued writes along with the
+	/// given one itself.
+	/// @param key Identifies the data the write replaces, or an empty string if it may not be coalesced with other
+	/// 	writes
+	void enqueue(const Write &write, const QString &key = QString());
+
+	/// Executes all queued writes on the calling thread. Has to be called within a transaction.
+	/// @returns The number of executed writes
+	unsigned int drain();
+
+	/// Commits all queued writes on the calling thread
+	void flush();
+
+	DBWriterMetrics metrics() const;
+
+	/// Renders the given metrics in the Prometheus text exposition format
+	static std::string toPrometheus(const DBWriterMetrics &metrics);
+
+protected:
+	struct Entry {
+		/// Empty if the write has been replaced by a later one
+		Write write;
+		QString key;
+	};
+
+	Transaction m_transaction;
+	unsigned int m_capacity;
+	int m_interval;
+	std::function< void() > m_threadCleanup;
+	QThread *m_thread;
+
+	/// Protects everything below, except for the metrics
+	mutable QMutex m_mutex;
+	QWaitCondition m_condition;
+	/// The queued writes including the ones that have been replaced, whose number is bounded by the capacity as
+	/// well
+	std::deque< Entry > m_entries;
+	/// The sequence number of the first entry
+	std::uint64_t m_firstSequence = 0;
+	/// The sequence numbers of the queued writes with a key
+	QHash< QString, std::uint64_t > m_keys;
+	/// The number of writes that haven't been replaced
+	unsigned int m_queued = 0;
+	bool m_stopping       = false;
+
+	/// Written while holding m_mutex
+	MetricsCounter m_enqueued;
+	MetricsCounter m_coalesced;
+	MetricsCounter m_overflows;
+	CommitHistogram m_commitTime;
+	/// Written within transactions, which are serialized
+	MetricsCounter m_committed;
+
+	void run();
+	/// Runs a transaction that executes all queued writes followed by the given one (if any)
+	void commit(const Write &write = {});
+};
+
+#endif // MUMBLE_MURMUR_DBWRITER_H_
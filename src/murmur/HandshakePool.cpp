@@ -0,0 +1,323 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "HandshakePool.h"
+
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <QtNetwork/QSslSocket>
+
+#include <tracy/Tracy.hpp>
+
+#include <memory>
+
+namespace {
+/// Owns a socket while it is passed to another thread, so that it is destroyed if the call transferring it is never
+/// delivered (because the receiving thread or object is gone by then)
+class SocketTransfer {
+public:
+	explicit SocketTransfer(QSslSocket *socket) : m_socket(socket) {}
+	~SocketTransfer() { delete m_socket; }
+
+	QSslSocket *take() {
+		QSslSocket *socket = m_socket;
+		m_socket           = nullptr;
+		return socket;
+	}
+
+protected:
+	QSslSocket *m_socket;
+};
+} // namespace
+
+/// A single handshake running on a worker thread. Owns the socket until it is handed back to the pool.
+class HandshakeJob : public QObject {
+private:
+	Q_DISABLE_COPY(HandshakeJob)
+
+public:
+	HandshakeJob(HandshakePool *pool, QThread *home, QSslSocket *socket, QObject *context, qint64 queueTime,
+				 int timeout)
+		: QObject(context), m_pool(pool), m_home(home), m_socket(socket), m_address(socket->peerAddress()),
+		  m_port(socket->peerPort()), m_queueTime(queueTime), m_timer(new QTimer(this)) {
+		m_socket->setParent(this);
+
+		m_timer->setSingleShot(true);
+		m_timer->setInterval(timeout);
+	}
+
+	void start() {
+		connect(m_socket, &QSslSocket::sslErrors, this, &HandshakeJob::sslErrors);
+		// The socket is moved to another thread once the handshake completed, which must not happen while it is
+		// still emitting signals
+		connect(m_socket, &QSslSocket::encrypted, this, &HandshakeJob::handOver, Qt::QueuedConnection);
+		connect(m_socket, &QAbstractSocket::errorOccurred, this, [this]() { fail(m_socket->errorString()); });
+		connect(m_socket, &QAbstractSocket::disconnected, this, [this]() { fail(QStringLiteral("Disconnected")); });
+		connect(m_timer, &QTimer::timeout, this, [this]() { fail(QStringLiteral("Handshake timed out")); });
+
+		m_timer->start();
+		m_elapsed.start();
+		m_socket->startServerEncryption();
+	}
+
+protected:
+	HandshakePool *m_pool;
+	/// The thread of the pool
+	QThread *m_home;
+	QSslSocket *m_socket;
+	QHostAddress m_address;
+	quint16 m_port;
+	qint64 m_queueTime;
+	QTimer *m_timer;
+	QElapsedTimer m_elapsed;
+	bool m_verified = true;
+	bool m_done     = false;
+
+	void sslErrors(const QList< QSslError > &errors) {
+		QStringList fatalErrors;
+		if (HandshakePool::checkSslErrors(errors, m_verified, fatalErrors)) {
+			m_socket->ignoreSslErrors();
+		} else {
+			fail(QString::fromLatin1("SSL Error: %1").arg(fatalErrors.join(QLatin1String(", "))));
+			// Aborting the socket while it is inside its handshake crashes Qt (see Server::sslError)
+			m_socket->disconnectFromHost();
+		}
+	}
+
+	void handOver() {
+		if (m_done) {
+			return;
+		}
+		m_done = true;
+		m_timer->stop();
+		m_socket->disconnect(this);
+
+		const qint64 handshakeTime = m_elapsed.nsecsElapsed() / 1000;
+
+		m_socket->setParent(nullptr);
+		m_socket->moveToThread(m_home);
+		const std::shared_ptr< SocketTransfer > transfer = std::make_shared< SocketTransfer >(m_socket);
+		m_socket                                         = nullptr;
+
+		HandshakePool *pool        = m_pool;
+		const QHostAddress address = m_address;
+		const quint16 port         = m_port;
+		const bool verified        = m_verified;
+		const qint64 queued        = m_queueTime;
+		QMetaObject::invokeMethod(
+			pool,
+			[pool, transfer, address, port, verified, queued, handshakeTime]() {
+				pool->completed(transfer->take(), address, port, verified, queued, handshakeTime);
+			},
+			Qt::QueuedConnection);
+
+		deleteLater();
+	}
+
+	void fail(const QString &reason) {
+		if (m_done) {
+			return;
+		}
+		m_done = true;
+		m_timer->stop();
+		m_socket->disconnect(this);
+
+		HandshakePool *pool        = m_pool;
+		const QHostAddress address = m_address;
+		const quint16 port         = m_port;
+		const qint64 queued        = m_queueTime;
+		QMetaObject::invokeMethod(
+			pool, [pool, address, port, reason, queued]() { pool->failed(address, port, reason, queued); },
+			Qt::QueuedConnection);
+
+		// Also destroys the socket. This may be called while the socket emits a signal, so it can't be deleted
+		// right away.
+		deleteLater();
+	}
+};
+
+HandshakePool::HandshakePool(unsigned int threadCount, unsigned int limit, int timeout, QObject *parent)
+	: QObject(parent), m_limit(limit), m_timeout(timeout) {
+	for (unsigned int i = 0; i < qMax(threadCount, 1U); ++i) {
+		QThread *thread  = new QThread();
+		QObject *context = new QObject();
+		context->moveToThread(thread);
+		thread->start();
+
+		QMetaObject::invokeMethod(context, [i]() {
+			const std::string threadName = "TLS handshake " + std::to_string(i);
+			tracy::SetThreadName(threadName.c_str());
+		});
+
+		m_threads.push_back(thread);
+		m_contexts.push_back(context);
+	}
+}
+
+HandshakePool::~HandshakePool() {
+	for (QThread *thread : m_threads) {
+		thread->quit();
+	}
+
+	for (std::size_t i = 0; i < m_threads.size(); ++i) {
+		m_threads[i]->wait();
+
+		// Destroys the handshakes still in progress on this thread. Calls that didn't get delivered anymore destroy
+		// the sockets they carry.
+		delete m_contexts[i];
+		delete m_threads[i];
+	}
+
+	for (const PendingHandshake &pending : m_queue) {
+		delete pending.socket;
+	}
+}
+
+void HandshakePool::enqueue(QSslSocket *socket) {
+	// Objects with a parent can't be moved to another thread
+	socket->setParent(nullptr);
+
+	PendingHandshake pending;
+	pending.socket = socket;
+	pending.queued.start();
+	m_queue.enqueue(pending);
+
+	startQueued();
+}
+
+HandshakeMetricsSnapshot HandshakePool::metrics() const {
+	HandshakeMetricsSnapshot snapshot;
+	snapshot.queued        = m_queuedGauge.load(std::memory_order_relaxed);
+	snapshot.inProgress    = m_inProgressGauge.load(std::memory_order_relaxed);
+	snapshot.completed     = m_completed.value();
+	snapshot.failed        = m_failed.value();
+	snapshot.handshakeTime = m_handshakeTime.value();
+	snapshot.queueTime     = m_queueTime.value();
+
+	return snapshot;
+}
+
+std::string HandshakePool::toPrometheus(const std::vector< std::pair< int, HandshakeMetricsSnapshot > > &servers) {
+	static const Prometheus::Metric< HandshakeMetricsSnapshot > metrics[] = {
+		{ "murmur_tls_handshakes_queued", "Connections waiting for their TLS handshake to be started", "gauge",
+		  &HandshakeMetricsSnapshot::queued },
+		{ "murmur_tls_handshakes_in_progress", "TLS handshakes currently running on the handshake threads", "gauge",
+		  &HandshakeMetricsSnapshot::inProgress },
+		{ "murmur_tls_handshakes_completed_total", "TLS handshakes that completed", "counter",
+		  &HandshakeMetricsSnapshot::completed },
+		{ "murmur_tls_handshakes_failed_total", "TLS handshakes that failed or timed out", "counter",
+		  &HandshakeMetricsSnapshot::failed },
+		{ "murmur_tls_handshake_seconds_total", "Time completed TLS handshakes took on the handshake threads",
+		  "counter", &HandshakeMetricsSnapshot::handshakeTime, 1000000.0 },
+		{ "murmur_tls_handshake_queue_seconds_total", "Time connections waited for their TLS handshake to be started",
+		  "counter", &HandshakeMetricsSnapshot::queueTime, 1000000.0 },
+	};
+
+	std::string out;
+	Prometheus::appendMetrics(out, metrics, servers);
+
+	return out;
+}
+
+bool HandshakePool::checkSslErrors(const QList< QSslError > &errors, bool &verified, QStringList &fatalErrors) {
+	for (const QSslError &e : errors) {
+		switch (e.error()) {
+			case QSslError::InvalidPurpose:
+				// Allow email certificates.
+				break;
+			case QSslError::NoPeerCertificate:
+			case QSslError::SelfSignedCertificate:
+			case QSslError::SelfSignedCertificateInChain:
+			case QSslError::UnableToGetLocalIssuerCertificate:
+			case QSslError::UnableToVerifyFirstCertificate:
+			case QSslError::HostNameMismatch:
+			case QSslError::CertificateNotYetValid:
+			case QSslError::CertificateExpired:
+				verified = false;
+				break;
+			default:
+				fatalErrors << e.errorString();
+		}
+	}
+
+	return fatalErrors.isEmpty();
+}
+
+void HandshakePool::startQueued() {
+	while (!m_queue.isEmpty() && (m_limit == 0 || m_inProgress < m_limit)) {
+		PendingHandshake pending = m_queue.dequeue();
+
+		const qint64 queueTime = pending.queued.nsecsElapsed() / 1000;
+		if (queueTime >= static_cast< qint64 >(m_timeout) * 1000) {
+			const QHostAddress address = pending.socket->peerAddress();
+			const quint16 port         = pending.socket->peerPort();
+			delete pending.socket;
+
+			m_failed.add();
+			m_queueTime.add(static_cast< std::uint64_t >(queueTime));
+			emit handshakeFailed(address, port, QStringLiteral("Handshake timed out while queued"));
+			continue;
+		}
+
+		++m_inProgress;
+		start(pending.socket, queueTime);
+	}
+
+	updateGauges();
+}
+
+void HandshakePool::start(QSslSocket *socket, qint64 queueTime) {
+	const std::size_t index = m_nextThread++ % m_threads.size();
+	QThread *home           = thread();
+	QObject *context        = m_contexts[index];
+	const int timeout       = m_timeout - static_cast< int >(queueTime / 1000);
+
+	socket->moveToThread(m_threads[index]);
+	const std::shared_ptr< SocketTransfer > transfer = std::make_shared< SocketTransfer >(socket);
+
+	HandshakePool *pool = this;
+	QMetaObject::invokeMethod(
+		context,
+		[pool, home, context, transfer, queueTime, timeout]() {
+			HandshakeJob *job = new HandshakeJob(pool, home, transfer->take(), context, queueTime, timeout);
+			job->start();
+		},
+		Qt::QueuedConnection);
+}
+
+void HandshakePool::updateGauges() {
+	m_queuedGauge.store(static_cast< std::uint64_t >(m_queue.size()), std::memory_order_relaxed);
+	m_inProgressGauge.store(m_inProgress, std::memory_order_relaxed);
+}
+
+void HandshakePool::completed(QSslSocket *socket, const QHostAddress &address, quint16 port, bool verified,
+							  qint64 queueTime, qint64 handshakeTime) {
+	if (socket->state() != QAbstractSocket::ConnectedState) {
+		// The client disconnected after the socket stopped reporting to its HandshakeJob, so nobody has been told
+		// about it
+		socket->deleteLater();
+		failed(address, port, QStringLiteral("Disconnected right after the handshake"), queueTime);
+		return;
+	}
+
+	--m_inProgress;
+	m_completed.add();
+	m_handshakeTime.add(static_cast< std::uint64_t >(handshakeTime));
+	m_queueTime.add(static_cast< std::uint64_t >(queueTime));
+
+	emit handshakeCompleted(socket, verified);
+
+	startQueued();
+}
+
+void HandshakePool::failed(const QHostAddress &address, quint16 port, const QString &reason, qint64 queueTime) {
+	--m_inProgress;
+	m_failed.add();
+	m_queueTime.add(static_cast< std::uint64_t >(queueTime));
+
+	emit handshakeFailed(address, port, reason);
+
+	startQueued();
+}
@@ -0,0 +1,129 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_HANDSHAKEPOOL_H_
+#define MUMBLE_MURMUR_HANDSHAKEPOOL_H_
+
+#include "Metrics.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QList>
+#include <QtCore/QObject>
+#include <QtCore/QQueue>
+#include <QtCore/QStringList>
+#include <QtNetwork/QHostAddress>
+#include <QtNetwork/QSslError>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+class HandshakeJob;
+class QSslSocket;
+class QThread;
+
+/// The state of a HandshakePool at a single point in time
+struct HandshakeMetricsSnapshot {
+	/// Connections waiting for their handshake to be started
+	std::uint64_t queued = 0;
+	/// Handshakes currently running on the worker threads
+	std::uint64_t inProgress = 0;
+	std::uint64_t completed  = 0;
+	/// Handshakes that failed or timed out (including connections that timed out while queued)
+	std::uint64_t failed = 0;
+	/// The time all completed handshakes took on the worker threads in microseconds
+	std::uint64_t handshakeTime = 0;
+	/// The time all connections (completed or failed) spent in the queue in microseconds
+	std::uint64_t queueTime = 0;
+};
+
+/// Performs the TLS handshakes (including the verification of the client's certificate chain) of new connections on
+/// a set of worker threads, so that a burst of connecting clients (e.g. all clients reconnecting after a restart)
+/// doesn't stall the thread of the Server. At most a configurable number of handshakes run at once, further
+/// connections wait in a queue. Only sockets that completed their handshake are handed back.
+///
+/// The pool must only be used by the thread it lives on, which is also the thread the sockets are handed back to.
+class HandshakePool : public QObject {
+private:
+	Q_OBJECT
+	Q_DISABLE_COPY(HandshakePool)
+
+	friend class HandshakeJob;
+
+public:
+	static constexpr unsigned int MAX_THREADS = 64;
+
+	/// @param threadCount The number of worker threads (at least 1)
+	/// @param limit The maximum number of handshakes running at the same time or 0 for no limit
+	/// @param timeout The time in milliseconds a connection may take to complete its handshake, including the time
+	/// 	spent in the queue
+	HandshakePool(unsigned int threadCount, unsigned int limit, int timeout, QObject *parent = nullptr);
+	/// Stops the worker threads. Connections that haven't completed their handshake yet are closed.
+	~HandshakePool() override;
+
+	/// Queues the handshake of the given socket, which has to live on the pool's thread and must already be
+	/// configured (certificate, key, protocol). The pool takes ownership of it and starts the handshake as soon as
+	/// the limit permits.
+	void enqueue(QSslSocket *socket);
+
+	HandshakeMetricsSnapshot metrics() const;
+
+	/// Renders the given snapshots in the Prometheus text exposition format, labelled with the ID of their server
+	static std::string toPrometheus(const std::vector< std::pair< int, HandshakeMetricsSnapshot > > &servers);
+
+	/// Decides whether a handshake may proceed despite the given errors. Errors that merely mean that the client's
+	/// certificate can't be verified are accepted, but clear verified.
+	/// @param fatalErrors The descriptions of the errors that can't be accepted
+	/// @returns Whether all errors are acceptable
+	static bool checkSslErrors(const QList< QSslError > &errors, bool &verified, QStringList &fatalErrors);
+
+signals:
+	/// Emitted when the handshake of a socket completed. The socket lives on the pool's thread again, is still
+	/// connected and is owned by the receiver. Data the client sent right after the handshake may already be buffered
+	/// in it.
+	/// @param verified Whether the client's certificate could be verified
+	void handshakeCompleted(QSslSocket *socket, bool verified);
+	/// Emitted when a handshake failed or timed out. The socket has been destroyed already.
+	void handshakeFailed(const QHostAddress &address, quint16 port, const QString &reason);
+
+protected:
+	struct PendingHandshake {
+		QSslSocket *socket;
+		/// Started when the connection has been queued
+		QElapsedTimer queued;
+	};
+
+	std::vector< QThread * > m_threads;
+	/// One per worker thread and living on it. Parent of the HandshakeJobs running on that thread.
+	std::vector< QObject * > m_contexts;
+	unsigned int m_nextThread = 0;
+
+	QQueue< PendingHandshake > m_queue;
+	unsigned int m_limit;
+	int m_timeout;
+	unsigned int m_inProgress = 0;
+
+	/// Only written by the pool's thread, but read by the MetricsServer
+	std::atomic< std::uint64_t > m_queuedGauge{ 0 };
+	std::atomic< std::uint64_t > m_inProgressGauge{ 0 };
+	MetricsCounter m_completed;
+	MetricsCounter m_failed;
+	MetricsCounter m_handshakeTime;
+	MetricsCounter m_queueTime;
+
+	/// Starts as many queued handshakes as the limit permits
+	void startQueued();
+	void start(QSslSocket *socket, qint64 queueTime);
+	void updateGauges();
+
+	/// Called on the pool's thread by the HandshakeJobs
+	void completed(QSslSocket *socket, const QHostAddress &address, quint16 port, bool verified, qint64 queueTime,
+				   qint64 handshakeTime);
+	void failed(const QHostAddress &address, quint16 port, const QString &reason, qint64 queueTime);
+};
+
+#endif // MUMBLE_MURMUR_HANDSHAKEPOOL_H_
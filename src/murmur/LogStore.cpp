@@ -0,0 +1,403 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "LogStore.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QtEndian>
+
+#include <algorithm>
+
+namespace {
+/// A record in a log file starts with its time (int64) and the length of its message (uint32), both little endian
+constexpr std::int64_t HEADER_SIZE = 12;
+/// An entry of an index file consists of the offset of the record (uint32) and its time (int64), both little endian
+constexpr std::int64_t INDEX_ENTRY_SIZE = 12;
+/// Offsets are stored as 32 bit integers, so segments have to stay well below 4 GiB
+constexpr std::int64_t MAX_SEGMENT_SIZE = 1LL << 30;
+
+QByteArray indexEntry(std::uint32_t offset, std::int64_t time) {
+	QByteArray entry(INDEX_ENTRY_SIZE, Qt::Uninitialized);
+	qToLittleEndian< quint32 >(offset, entry.data());
+	qToLittleEndian< qint64 >(time, entry.data() + 4);
+	return entry;
+}
+} // namespace
+
+LogStore::Segment::Segment() = default;
+
+LogStore::Segment::~Segment() = default;
+
+LogStore::LogStore(const QString &directory, std::int64_t segmentSize)
+	: m_directory(directory), m_segmentSize(std::clamp< std::int64_t >(segmentSize, HEADER_SIZE, MAX_SEGMENT_SIZE)) {
+}
+
+LogStore::~LogStore() = default;
+
+bool LogStore::open() {
+	QMutexLocker lock(&m_mutex);
+
+	m_segments.clear();
+	m_nextSequence = 0;
+	m_nextRecord   = 0;
+	m_lastTime     = 0;
+
+	QDir dir(m_directory);
+	if (!dir.mkpath(QLatin1String("."))) {
+		qWarning("LogStore: Failed to create %s", qPrintable(m_directory));
+		return false;
+	}
+
+	std::vector< std::uint64_t > sequences;
+	for (const QString &name : dir.entryList(QStringList{ QLatin1String("*.log") }, QDir::Files)) {
+		bool ok;
+		const std::uint64_t sequence = QFileInfo(name).baseName().toULongLong(&ok, 16);
+		if (ok) {
+			sequences.push_back(sequence);
+		}
+	}
+	std::sort(sequences.begin(), sequences.end());
+
+	for (std::size_t i = 0; i < sequences.size(); ++i) {
+		const bool last                    = i + 1 == sequences.size();
+		std::unique_ptr< Segment > segment = loadSegment(sequences[i], last);
+		if (!segment) {
+			m_segments.clear();
+			return false;
+		}
+
+		if (segment->offsets.empty() && !last) {
+			deleteSegment(*segment);
+			continue;
+		}
+
+		// Records discarded from the end of a damaged segment leave a gap in the sequence numbers, which the
+		// positions of the records skip
+		if (!m_segments.empty() && segment->firstSequence > m_nextSequence) {
+			qWarning("LogStore: %llu records before %s are missing",
+					 static_cast< unsigned long long >(segment->firstSequence - m_nextSequence),
+					 qPrintable(segment->log->fileName()));
+		}
+
+		segment->firstRecord = m_nextRecord;
+		m_nextSequence       = segment->firstSequence + segment->offsets.size();
+		m_nextRecord         = segment->firstRecord + segment->offsets.size();
+		if (!segment->times.empty()) {
+			m_lastTime = std::max(m_lastTime, segment->times.back());
+		}
+		m_segments.push_back(std::move(segment));
+	}
+
+	if (m_segments.empty()) {
+		return startSegment();
+	}
+
+	for (std::size_t i = 0; i + 1 < m_segments.size(); ++i) {
+		seal(*m_segments[i]);
+	}
+
+	return true;
+}
+
+void LogStore::append(std::int64_t time, const QString &message) {
+	QMutexLocker lock(&m_mutex);
+
+	if (m_segments.empty()) {
+		return;
+	}
+
+	if (m_segments.back()->size >= m_segmentSize && !m_segments.back()->offsets.empty()) {
+		seal(*m_segments.back());
+		if (!startSegment()) {
+			return;
+		}
+	}
+	Segment &segment = *m_segments.back();
+
+	time = std::max(time, m_lastTime);
+
+	const QByteArray utf8 = message.toUtf8();
+	QByteArray record(HEADER_SIZE, Qt::Uninitialized);
+	qToLittleEndian< qint64 >(time, record.data());
+	qToLittleEndian< quint32 >(static_cast< quint32 >(utf8.size()), record.data() + 8);
+	record += utf8;
+
+	segment.log->seek(segment.size);
+	if (segment.log->write(record) != record.size() || !segment.log->flush()) {
+		qWarning("LogStore: Failed to write to %s: %s", qPrintable(segment.log->fileName()),
+				 qPrintable(segment.log->errorString()));
+		segment.log->resize(segment.size);
+		return;
+	}
+
+	// If this fails, the record is indexed again the next time the store is opened
+	const QByteArray entry = indexEntry(static_cast< std::uint32_t >(segment.size), time);
+	if (segment.index->write(entry) != entry.size() || !segment.index->flush()) {
+		qWarning("LogStore: Failed to write to %s: %s", qPrintable(segment.index->fileName()),
+				 qPrintable(segment.index->errorString()));
+	}
+
+	segment.offsets.push_back(static_cast< std::uint32_t >(segment.size));
+	segment.times.push_back(time);
+	segment.size += record.size();
+	++m_nextSequence;
+	++m_nextRecord;
+	m_lastTime = time;
+}
+
+std::uint64_t LogStore::size() const {
+	QMutexLocker lock(&m_mutex);
+
+	return m_segments.empty() ? 0 : m_nextRecord - m_segments.front()->firstRecord;
+}
+
+QList< LogStore::Record > LogStore::read(std::uint64_t offset, std::uint64_t count) const {
+	QMutexLocker lock(&m_mutex);
+
+	QList< Record > records;
+	if (m_segments.empty()) {
+		return records;
+	}
+
+	const std::uint64_t total = m_nextRecord - m_segments.front()->firstRecord;
+	if (offset >= total) {
+		return records;
+	}
+	count = std::min(count, total - offset);
+
+	records.reserve(static_cast< qsizetype >(count));
+	for (std::uint64_t i = 0; i < count; ++i) {
+		records.append(readRecord(m_nextRecord - 1 - offset - i));
+	}
+
+	return records;
+}
+
+std::uint64_t LogStore::countNewerThan(std::int64_t time) const {
+	QMutexLocker lock(&m_mutex);
+
+	if (m_segments.empty()) {
+		return 0;
+	}
+
+	const std::uint64_t total = m_nextRecord - m_segments.front()->firstRecord;
+
+	// Only the last segment may be empty, so treating an empty one as newer keeps the segments partitioned
+	auto segment = std::upper_bound(m_segments.begin(), m_segments.end(), time,
+									[](std::int64_t value, const std::unique_ptr< Segment > &candidate) {
+										return candidate->times.empty() || value < candidate->times.front();
+									});
+	if (segment == m_segments.begin()) {
+		return total;
+	}
+	--segment;
+
+	const auto &times = (*segment)->times;
+	const std::uint64_t notNewer =
+		((*segment)->firstRecord - m_segments.front()->firstRecord)
+		+ static_cast< std::uint64_t >(std::upper_bound(times.begin(), times.end(), time) - times.begin());
+
+	return total - std::min(notNewer, total);
+}
+
+void LogStore::removeOlderThan(std::int64_t time) {
+	QMutexLocker lock(&m_mutex);
+
+	while (m_segments.size() > 1
+		   && (m_segments.front()->times.empty() || m_segments.front()->times.back() < time)) {
+		deleteSegment(*m_segments.front());
+		m_segments.erase(m_segments.begin());
+	}
+}
+
+void LogStore::clear() {
+	QMutexLocker lock(&m_mutex);
+
+	for (const std::unique_ptr< Segment > &segment : m_segments) {
+		deleteSegment(*segment);
+	}
+	m_segments.clear();
+
+	// The sequence numbers keep increasing, so that a segment is never confused with a deleted one
+	startSegment();
+}
+
+void LogStore::remove() {
+	QMutexLocker lock(&m_mutex);
+
+	for (const std::unique_ptr< Segment > &segment : m_segments) {
+		deleteSegment(*segment);
+	}
+	m_segments.clear();
+
+	QDir().rmdir(m_directory);
+}
+
+QString LogStore::directory() const {
+	return m_directory;
+}
+
+QString LogStore::segmentPath(std::uint64_t firstSequence, const char *suffix) const {
+	return QString::fromLatin1("%1/%2.%3")
+		.arg(m_directory)
+		.arg(static_cast< qulonglong >(firstSequence), 16, 16, QLatin1Char('0'))
+		.arg(QLatin1String(suffix));
+}
+
+std::unique_ptr< LogStore::Segment > LogStore::loadSegment(std::uint64_t firstSequence, bool last) {
+	auto segment           = std::make_unique< Segment >();
+	segment->firstSequence = firstSequence;
+	segment->log           = std::make_unique< QFile >(segmentPath(firstSequence, "log"));
+	segment->index         = std::make_unique< QFile >(segmentPath(firstSequence, "idx"));
+
+	if (!segment->log->open(QIODevice::ReadWrite) || !segment->index->open(QIODevice::ReadWrite)) {
+		qWarning("LogStore: Failed to open segment %s: %s", qPrintable(segment->log->fileName()),
+				 qPrintable(segment->log->errorString()));
+		return nullptr;
+	}
+	segment->size = segment->log->size();
+
+	// @returns The length of the message of the record at the given offset or -1 if the record is incomplete
+	const auto messageLength = [&segment](std::int64_t offset) -> std::int64_t {
+		if (offset + HEADER_SIZE > segment->size || !segment->log->seek(offset)) {
+			return -1;
+		}
+		const QByteArray header = segment->log->read(HEADER_SIZE);
+		if (header.size() != HEADER_SIZE) {
+			return -1;
+		}
+		const std::int64_t length = qFromLittleEndian< quint32 >(header.constData() + 8);
+		return offset + HEADER_SIZE + length <= segment->size ? length : -1;
+	};
+
+	const QByteArray index  = segment->index->readAll();
+	const qsizetype entries = index.size() / INDEX_ENTRY_SIZE;
+	for (qsizetype i = 0; i < entries; ++i) {
+		const char *entry           = index.constData() + i * INDEX_ENTRY_SIZE;
+		const std::uint32_t offset  = qFromLittleEndian< quint32 >(entry);
+		const std::int64_t time     = qFromLittleEndian< qint64 >(entry + 4);
+		const bool offsetIncreasing = segment->offsets.empty() || offset > segment->offsets.back();
+		if (offset >= segment->size || !offsetIncreasing) {
+			break;
+		}
+
+		segment->offsets.push_back(offset);
+		segment->times.push_back(segment->times.empty() ? time : std::max(time, segment->times.back()));
+	}
+
+	// The offsets of consecutive entries delimit the records, so only the last indexed record has to be checked
+	std::int64_t end = 0;
+	while (!segment->offsets.empty()) {
+		const std::int64_t length = messageLength(segment->offsets.back());
+		if (length >= 0) {
+			end = segment->offsets.back() + HEADER_SIZE + length;
+			break;
+		}
+		segment->offsets.pop_back();
+		segment->times.pop_back();
+	}
+	bool rewriteIndex =
+		static_cast< qsizetype >(segment->offsets.size()) != entries || index.size() % INDEX_ENTRY_SIZE != 0;
+
+	for (std::int64_t length = messageLength(end); length >= 0; length = messageLength(end)) {
+		segment->log->seek(end);
+		const std::int64_t time = qFromLittleEndian< qint64 >(segment->log->read(HEADER_SIZE).constData());
+
+		segment->offsets.push_back(static_cast< std::uint32_t >(end));
+		segment->times.push_back(segment->times.empty() ? time : std::max(time, segment->times.back()));
+		end += HEADER_SIZE + length;
+		rewriteIndex = true;
+	}
+
+	if (end < segment->size) {
+		qWarning("LogStore: Discarding %lld bytes of incomplete records in %s",
+				 static_cast< long long >(segment->size - end), qPrintable(segment->log->fileName()));
+		// Segments other than the last one are never written to again, so there is no need to touch them
+		if (last) {
+			segment->log->resize(end);
+		}
+		segment->size = end;
+	}
+
+	if (rewriteIndex) {
+		segment->index->resize(0);
+		segment->index->seek(0);
+		for (std::size_t i = 0; i < segment->offsets.size(); ++i) {
+			segment->index->write(indexEntry(segment->offsets[i], segment->times[i]));
+		}
+		segment->index->flush();
+	}
+	segment->index->seek(segment->index->size());
+
+	return segment;
+}
+
+bool LogStore::startSegment() {
+	auto segment           = std::make_unique< Segment >();
+	segment->firstSequence = m_nextSequence;
+	segment->firstRecord   = m_nextRecord;
+	segment->log           = std::make_unique< QFile >(segmentPath(m_nextSequence, "log"));
+	segment->index         = std::make_unique< QFile >(segmentPath(m_nextSequence, "idx"));
+
+	const QIODevice::OpenMode mode = QIODevice::ReadWrite | QIODevice::Truncate;
+	if (!segment->log->open(mode) || !segment->index->open(mode)) {
+		qWarning("LogStore: Failed to create segment %s: %s", qPrintable(segment->log->fileName()),
+				 qPrintable(segment->log->errorString()));
+		return false;
+	}
+
+	m_segments.push_back(std::move(segment));
+	return true;
+}
+
+void LogStore::seal(Segment &segment) {
+	segment.index->close();
+
+	// If mapping fails, the records are read from the file instead
+	if (segment.size > 0) {
+		segment.mapped = segment.log->map(0, segment.size);
+	}
+}
+
+void LogStore::deleteSegment(const Segment &segment) {
+	segment.log->close();
+	segment.index->close();
+
+	QFile::remove(segment.log->fileName());
+	QFile::remove(segment.index->fileName());
+}
+
+LogStore::Record LogStore::readRecord(std::uint64_t position) const {
+	auto it = std::upper_bound(m_segments.begin(), m_segments.end(), position,
+							   [](std::uint64_t value, const std::unique_ptr< Segment > &candidate) {
+								   return value < candidate->firstRecord;
+							   });
+	if (it == m_segments.begin()) {
+		return { 0, QString() };
+	}
+	const Segment &segment = **(--it);
+
+	const std::uint64_t index = position - segment.firstRecord;
+	if (index >= segment.offsets.size()) {
+		return { 0, QString() };
+	}
+
+	const std::int64_t offset = segment.offsets[index];
+	const std::int64_t end    = index + 1 < segment.offsets.size() ? segment.offsets[index + 1] : segment.size;
+	const qsizetype length    = static_cast< qsizetype >(end - offset - HEADER_SIZE);
+
+	QString message;
+	if (segment.mapped) {
+		message = QString::fromUtf8(reinterpret_cast< const char * >(segment.mapped + offset + HEADER_SIZE), length);
+	} else {
+		segment.log->seek(offset + HEADER_SIZE);
+		message = QString::fromUtf8(segment.log->read(length));
+	}
+
+	return { segment.times[index], message };
+}
@@ -0,0 +1,129 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_LOGSTORE_H_
+#define MUMBLE_MURMUR_LOGSTORE_H_
+
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class QFile;
+
+/// Stores the log of a virtual server in a directory of append-only segment files, as an alternative to the slog
+/// table (see the logdir setting).
+///
+/// Every record gets a sequence number. A segment is named after the (hexadecimal) sequence number of its first
+/// record and consists of two files: "<sequence>.log" holding the records (time, length and UTF-8 message) and
+/// "<sequence>.idx" holding the offset and time of every record. The index of all segments is kept in memory, so
+/// looking up a record by its position or by its time is a binary search. Segments that are no longer appended to
+/// are memory-mapped.
+///
+/// Once a segment reaches the segment size, a new one is started. Old records are removed by deleting whole
+/// segments, which only takes a look at the oldest segment.
+///
+/// The times of the records never decrease: a record older than its predecessor (e.g. because the clock was set back)
+/// gets the time of its predecessor.
+class LogStore {
+private:
+	Q_DISABLE_COPY(LogStore)
+
+public:
+	struct Record {
+		/// Seconds since the epoch
+		std::int64_t time;
+		QString message;
+	};
+
+	/// @param directory The directory holding the segments. It is created if it doesn't exist.
+	/// @param segmentSize The size in bytes at which a new segment is started
+	LogStore(const QString &directory, std::int64_t segmentSize);
+	~LogStore();
+
+	/// Loads the index of the existing segments. Records that have been written only partially (e.g. because the
+	/// server crashed) are discarded.
+	/// @returns Whether the directory could be opened. If not, all records are discarded.
+	bool open();
+
+	void append(std::int64_t time, const QString &message);
+
+	/// @returns The number of stored records
+	std::uint64_t size() const;
+
+	/// @param offset The number of records to skip, starting at the latest one
+	/// @param count The maximum number of records to return
+	/// @returns The records from the latest to the oldest one
+	QList< Record > read(std::uint64_t offset, std::uint64_t count) const;
+
+	/// @returns The number of records newer than the given time, i.e. the offset (see read()) of the latest record
+	/// 	that is not newer than the given time
+	std::uint64_t countNewerThan(std::int64_t time) const;
+
+	/// Deletes the segments that only hold records older than the given time. The segment that is appended to is
+	/// never deleted, so some older records may remain.
+	void removeOlderThan(std::int64_t time);
+
+	/// Deletes all records
+	void clear();
+
+	/// Deletes all records and the directory
+	void remove();
+
+	QString directory() const;
+
+protected:
+	struct Segment {
+		/// The sequence number of the first record
+		std::uint64_t firstSequence;
+		/// The position of the first record among all records stored so far. Unlike the sequence numbers, the
+		/// positions have no gaps where the records of a damaged segment have been discarded.
+		std::uint64_t firstRecord = 0;
+		std::unique_ptr< QFile > log;
+		std::unique_ptr< QFile > index;
+		/// The log file's contents, once the segment is no longer appended to
+		const uchar *mapped = nullptr;
+		/// The size of the log file
+		std::int64_t size = 0;
+		/// The offset within the log file of every record
+		std::vector< std::uint32_t > offsets;
+		/// The time of every record
+		std::vector< std::int64_t > times;
+
+		Segment();
+		~Segment();
+	};
+
+	QString m_directory;
+	std::int64_t m_segmentSize;
+
+	mutable QMutex m_mutex;
+	/// Ordered by sequence number. The last one is the one appended to.
+	std::vector< std::unique_ptr< Segment > > m_segments;
+	/// The sequence number of the next record
+	std::uint64_t m_nextSequence = 0;
+	/// The position of the next record (see Segment::firstRecord)
+	std::uint64_t m_nextRecord = 0;
+	/// The time of the latest record
+	std::int64_t m_lastTime = 0;
+
+	QString segmentPath(std::uint64_t firstSequence, const char *suffix) const;
+	/// Loads the segment with the given first sequence number. Records missing in the index (the log file is written
+	/// first) are indexed again. Incomplete records at the end of a segment are discarded (and truncated in the last
+	/// one).
+	std::unique_ptr< Segment > loadSegment(std::uint64_t firstSequence, bool last);
+	/// Starts a new segment that is appended to
+	bool startSegment();
+	/// Maps the log file of the given segment, once it is no longer appended to
+	void seal(Segment &segment);
+	void deleteSegment(const Segment &segment);
+	/// @returns The record at the given position (see Segment::firstRecord), which has to exist
+	Record readRecord(std::uint64_t position) const;
+};
+
+#endif // MUMBLE_MURMUR_LOGSTORE_H_
@@ -4,6 +4,7 @@
 // Mumble source tree or at <https://www.mumble.info/LICENSE>.
 
 #include "ACL.h"
+#include "AuthPool.h"
 #include "Channel.h"
 #include "ChannelListenerManager.h"
 #include "ClientType.h"
@@ -16,10 +17,12 @@
 #include "Server.h"
 #include "ServerDB.h"
 #include "ServerUser.h"
+#include "TextMessageImages.h"
 #include "User.h"
 #include "Version.h"
 #include "crypto/CryptState.h"
 
+#include <algorithm>
 #include <cassert>
 #include <unordered_map>
 
@@ -194,30 +197,79 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 	}
 	MSG_SETUP(ServerUser::Connected);
 
+	if (uSource->uiAuthTicket != 0) {
+		// The credentials the client sent first are still being checked
+		return;
+	}
+
 	// As the first thing, assign a session ID to this client. Given that the client initiated
 	// the authentication procedure we can be sure that this is not just a random TCP connection.
 	// Thus it is about time we assign the ID to this client in order to be able to reference it
 	// in the following.
 	{
-		QWriteLocker wl(&qrwlVoiceThread);
+		VoiceThreadWriteLocker wl(this);
 		uSource->uiSession = qqIds.dequeue();
 		qhUsers.insert(uSource->uiSession, uSource);
 		qhHostUsers[uSource->haAddress].insert(uSource);
 	}
 
+	uSource->qsName = u8(msg.username()).trimmed();
+
+	AuthRequest request;
+	request.name          = uSource->qsName;
+	request.password      = u8(msg.password());
+	request.sessionId     = static_cast< int >(uSource->uiSession);
+	request.emails        = uSource->qslEmail;
+	request.certHash      = uSource->qsHash;
+	request.strongCert    = uSource->bVerified;
+	request.certs         = uSource->peerCertificateChain();
+	request.forceExternal = bForceExternalAuth;
+
+	if (!m_authPool) {
+		completeAuthentication(uSource, msg, lookupAuthentication(request));
+		return;
+	}
+
+	// The user stays in the Connected state until its credentials have been checked by the authentication threads.
+	// It may disconnect (and its session ID may be reused) in the meantime, so it is looked up again by its session
+	// and ticket.
+	const unsigned int session = uSource->uiSession;
+	const quint64 ticket       = ++m_lastAuthTicket;
+	uSource->uiAuthTicket      = ticket;
+
+	const bool queued = m_authPool->submit([this, request]() { return lookupAuthentication(request); },
+										   [this, session, ticket, msg](const AuthResult &result) {
+											   ServerUser *u = qhUsers.value(session);
+											   if (u && u->uiAuthTicket == ticket) {
+												   u->uiAuthTicket = 0;
+												   completeAuthentication(u, msg, result);
+											   }
+										   });
+	if (!queued) {
+		uSource->uiAuthTicket = 0;
+
+		AuthResult result;
+		result.id = -3;
+		completeAuthentication(uSource, msg, result);
+	}
+}
+
+void Server::completeAuthentication(ServerUser *uSource, const MumbleProto::Authenticate &msg,
+									const AuthResult &result) {
 	Channel *root = qhChannels.value(0);
 	Channel *c;
 
-	uSource->qsName = u8(msg.username()).trimmed();
-
 	bool ok     = false;
 	bool nameok = validateUserName(uSource->qsName);
 	QString pw  = u8(msg.password());
 
 	// Fetch ID and stored username.
 	// This function needs to support the fact that sessions may go away.
-	int id = authenticate(uSource->qsName, pw, static_cast< int >(uSource->uiSession), uSource->qslEmail,
-						  uSource->qsHash, uSource->bVerified, uSource->peerCertificateChain());
+	int id = applyAuthentication(result, static_cast< int >(uSource->uiSession));
+	if (!result.name.isEmpty()) {
+		// Attempts that timed out or have been rejected by the AuthPool don't carry a name
+		uSource->qsName = result.name;
+	}
 
 	uSource->iId = id >= 0 ? id : -1;
 
@@ -338,14 +390,17 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 
 	// Setup UDP encryption
 	{
-		QMutexLocker l(&uSource->qmCrypt);
-
-		uSource->csCrypt->genKey();
+		uSource->voiceCrypt.genKey();
 
 		MumbleProto::CryptSetup mpcrypt;
-		mpcrypt.set_key(uSource->csCrypt->getRawKey());
-		mpcrypt.set_server_nonce(uSource->csCrypt->getEncryptIV());
-		mpcrypt.set_client_nonce(uSource->csCrypt->getDecryptIV());
+		mpcrypt.set_key(uSource->voiceCrypt.getRawKey());
+		mpcrypt.set_server_nonce(uSource->voiceCrypt.getEncryptIV());
+		mpcrypt.set_client_nonce(uSource->voiceCrypt.getDecryptIV());
+		{
+			// The token doesn't affect routing, so there is no need for a new routing snapshot
+			QWriteLocker wl(&qrwlVoiceThread);
+			mpcrypt.set_udp_token(assignUdpToken(uSource));
+		}
 		sendMessage(uSource, mpcrypt);
 	}
 
@@ -357,7 +412,8 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 		uSource->qlCodecs.append(static_cast< qint32 >(0x8000000b));
 		fake_celt_support = true;
 	}
-	uSource->bOpus = msg.opus();
+	uSource->bOpus             = msg.opus();
+	uSource->m_imageReferences = msg.image_references();
 	recheckCodecVersions(uSource);
 
 	MumbleProto::CodecVersion mpcv;
@@ -398,6 +454,8 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 
 		if ((uSource->m_version >= Version::fromComponents(1, 2, 2)) && !c->qbaDescHash.isEmpty())
 			mpcs.set_description_hash(blob(c->qbaDescHash));
+		else if (!c->qbaDescHash.isEmpty())
+			mpcs.set_description(blob(c->m_descriptionBlob.data()));
 		else if (!c->qsDesc.isEmpty())
 			mpcs.set_description(u8(c->qsDesc));
 
@@ -433,7 +491,7 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 	userEnterChannel(uSource, lc, mpus);
 
 	{
-		QWriteLocker wl(&qrwlVoiceThread);
+		VoiceThreadWriteLocker wl(this);
 		uSource->sState = ServerUser::Authenticated;
 	}
 
@@ -442,7 +500,7 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 	if (uSource->iId >= 0) {
 		mpus.set_user_id(static_cast< unsigned int >(uSource->iId));
 
-		hashAssign(uSource->qbaTexture, uSource->qbaTextureHash, getUserTexture(uSource->iId));
+		hashAssign(uSource->qbaTexture, uSource->qbaTextureHash, uSource->m_textureBlob, getUserTexture(uSource->iId));
 
 		if (!uSource->qbaTextureHash.isEmpty())
 			mpus.set_texture_hash(blob(uSource->qbaTextureHash));
@@ -451,7 +509,8 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 
 		const QMap< int, QString > &info = getRegistration(uSource->iId);
 		if (info.contains(ServerDB::User_Comment)) {
-			hashAssign(uSource->qsComment, uSource->qbaCommentHash, info.value(ServerDB::User_Comment));
+			hashAssign(uSource->qsComment, uSource->qbaCommentHash, uSource->m_commentBlob,
+					   info.value(ServerDB::User_Comment));
 			if (!uSource->qbaCommentHash.isEmpty())
 				mpus.set_comment_hash(blob(uSource->qbaCommentHash));
 			else if (!uSource->qsComment.isEmpty())
@@ -465,11 +524,14 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 
 	sendAll(mpus, Version::fromComponents(1, 2, 2), Version::CompareMode::AtLeast);
 
-	if ((uSource->qbaTexture.length() >= 4)
-		&& (qFromBigEndian< unsigned int >(reinterpret_cast< const unsigned char * >(uSource->qbaTexture.constData()))
+	const QByteArray sourceTexture = uSource->texture();
+	if ((sourceTexture.length() >= 4)
+		&& (qFromBigEndian< unsigned int >(reinterpret_cast< const unsigned char * >(sourceTexture.constData()))
 			== 600 * 60 * 4))
-		mpus.set_texture(blob(uSource->qbaTexture));
-	if (!uSource->qsComment.isEmpty())
+		mpus.set_texture(blob(sourceTexture));
+	if (!uSource->qbaCommentHash.isEmpty())
+		mpus.set_comment(blob(uSource->m_commentBlob.data()));
+	else if (!uSource->qsComment.isEmpty())
 		mpus.set_comment(u8(uSource->qsComment));
 	sendAll(mpus, Version::fromComponents(1, 2, 2), Version::CompareMode::LessThan);
 
@@ -491,11 +553,11 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 				mpus.set_texture_hash(blob(u->qbaTextureHash));
 			else if (!u->qbaTexture.isEmpty())
 				mpus.set_texture(blob(u->qbaTexture));
-		} else if ((uSource->qbaTexture.length() >= 4)
+		} else if ((sourceTexture.length() >= 4)
 				   && (qFromBigEndian< unsigned int >(
-						   reinterpret_cast< const unsigned char * >(uSource->qbaTexture.constData()))
+						   reinterpret_cast< const unsigned char * >(sourceTexture.constData()))
 					   == 600 * 60 * 4)) {
-			mpus.set_texture(blob(u->qbaTexture));
+			mpus.set_texture(blob(u->texture()));
 		}
 		if (u->cChannel->iId != 0)
 			mpus.set_channel_id(u->cChannel->iId);
@@ -515,22 +577,24 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 			mpus.set_self_mute(true);
 		if ((uSource->m_version >= Version::fromComponents(1, 2, 2)) && !u->qbaCommentHash.isEmpty())
 			mpus.set_comment_hash(blob(u->qbaCommentHash));
+		else if (!u->qbaCommentHash.isEmpty())
+			mpus.set_comment(blob(u->m_commentBlob.data()));
 		else if (!u->qsComment.isEmpty())
 			mpus.set_comment(u8(u->qsComment));
 		if (!u->qsHash.isEmpty())
 			mpus.set_hash(u8(u->qsHash));
 
 
-		for (unsigned int channelID : m_channelListenerManager.getListenedChannelsForUser(u->uiSession)) {
-			mpus.add_listening_channel_add(channelID);
+		m_channelListenerManager.forEachListenedChannel(
+			u->uiSession, [&](unsigned int channelID, const VolumeAdjustment &volume) {
+				mpus.add_listening_channel_add(channelID);
 
-			if (broadcastListenerVolumeAdjustments) {
-				VolumeAdjustment volume = m_channelListenerManager.getListenerVolumeAdjustment(u->uiSession, channelID);
-				MumbleProto::UserState::VolumeAdjustment *adjustment = mpus.add_listening_volume_adjustment();
-				adjustment->set_listening_channel(channelID);
-				adjustment->set_volume_adjustment(volume.factor);
-			}
-		}
+				if (broadcastListenerVolumeAdjustments) {
+					MumbleProto::UserState::VolumeAdjustment *adjustment = mpus.add_listening_volume_adjustment();
+					adjustment->set_listening_channel(channelID);
+					adjustment->set_volume_adjustment(volume.factor);
+				}
+			});
 
 		sendMessage(uSource, mpus);
 	}
@@ -546,8 +610,7 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 		mpss.set_permissions(ChanACL::All);
 	} else {
 		QMutexLocker qml(&qmCache);
-		ChanACL::hasPermission(uSource, root, ChanACL::Enter, &acCache);
-		mpss.set_permissions(acCache.value(uSource)->value(root));
+		mpss.set_permissions(acCache.cachedPermissions(uSource->aclSubject(), root));
 	}
 
 	sendMessage(uSource, mpss);
@@ -853,26 +916,23 @@ void Server::msgUserState(ServerUser *uSource, MumbleProto::UserState &msg) {
 	QString comment;
 
 	if (msg.has_comment()) {
-		bool changed = false;
-		comment      = u8(msg.comment());
 		if (uSource != pDstServerUser) {
 			if (!hasPermission(uSource, root, ChanACL::ResetUserContent)) {
 				PERM_DENIED(uSource, root, ChanACL::ResetUserContent);
 				return;
 			}
-			if (comment.length() > 0) {
+			if (!msg.comment().empty()) {
 				PERM_DENIED_TYPE(TextTooLong);
 				return;
 			}
 		}
 
 
-		if (!isTextAllowed(comment, changed)) {
+		if (!isTextAllowed(*msg.mutable_comment())) {
 			PERM_DENIED_TYPE(TextTooLong);
 			return;
 		}
-		if (changed)
-			msg.set_comment(u8(comment));
+		comment = u8(msg.comment());
 	}
 
 	if (msg.has_texture()) {
@@ -928,7 +988,7 @@ void Server::msgUserState(ServerUser *uSource, MumbleProto::UserState &msg) {
 			}
 		} else {
 			// For unregistered users or SuperUser only get the hash
-			hashAssign(pDstServerUser->qbaTexture, pDstServerUser->qbaTextureHash, qba);
+			hashAssign(pDstServerUser->qbaTexture, pDstServerUser->qbaTextureHash, pDstServerUser->m_textureBlob, qba);
 		}
 
 		// The texture will be sent out later in this function
@@ -938,7 +998,7 @@ void Server::msgUserState(ServerUser *uSource, MumbleProto::UserState &msg) {
 	// Writing to bSelfMute, bSelfDeaf and ssContext
 	// requires holding a write lock on qrwlVoiceThread.
 	{
-		QWriteLocker wl(&qrwlVoiceThread);
+		VoiceThreadWriteLocker wl(this);
 
 		if (msg.has_self_deaf()) {
 			pDstServerUser->bSelfDeaf = msg.self_deaf();
@@ -971,11 +1031,11 @@ void Server::msgUserState(ServerUser *uSource, MumbleProto::UserState &msg) {
 	}
 
 	if (!comment.isNull()) {
-		hashAssign(pDstServerUser->qsComment, pDstServerUser->qbaCommentHash, comment);
+		hashAssign(pDstServerUser->qsComment, pDstServerUser->qbaCommentHash, pDstServerUser->m_commentBlob, comment);
 
 		if (pDstServerUser->iId >= 0) {
 			QMap< int, QString > info;
-			info.insert(ServerDB::User_Comment, pDstServerUser->qsComment);
+			info.insert(ServerDB::User_Comment, comment);
 			setInfo(pDstServerUser->iId, info);
 		}
 		bBroadcast = true;
@@ -986,7 +1046,7 @@ void Server::msgUserState(ServerUser *uSource, MumbleProto::UserState &msg) {
 	if (msg.has_mute() || msg.has_deaf() || msg.has_suppress() || msg.has_priority_speaker()) {
 		// Writing to bDeaf, bMute and bSuppress requires
 		// holding a write lock on qrwlVoiceThread.
-		QWriteLocker wl(&qrwlVoiceThread);
+		VoiceThreadWriteLocker wl(this);
 
 		if (msg.has_deaf()) {
 			pDstServerUser->bDeaf = msg.deaf();
@@ -1137,14 +1197,14 @@ void Server::msgUserState(ServerUser *uSource, MumbleProto::UserState &msg) {
 	if (bBroadcast) {
 		// Texture handling for clients < 1.2.2.
 		// Send the texture data in the message.
-		if (msg.has_texture() && (pDstServerUser->qbaTexture.length() >= 4)
-			&& (qFromBigEndian< unsigned int >(
-					reinterpret_cast< const unsigned char * >(pDstServerUser->qbaTexture.constData()))
+		const QByteArray texture = msg.has_texture() ? pDstServerUser->texture() : QByteArray();
+		if (msg.has_texture() && (texture.length() >= 4)
+			&& (qFromBigEndian< unsigned int >(reinterpret_cast< const unsigned char * >(texture.constData()))
 				!= 600 * 60 * 4)) {
 			// This is a new style texture, don't send it because the client doesn't handle it correctly / crashes.
 			msg.clear_texture();
 			sendAll(msg, Version::fromComponents(1, 2, 2), Version::CompareMode::LessThan);
-			msg.set_texture(blob(pDstServerUser->qbaTexture));
+			msg.set_texture(blob(texture));
 		} else {
 			// This is an old style texture, empty texture or there was no texture in this packet,
 			// send the message unchanged.
@@ -1254,14 +1314,11 @@ void Server::msgChannelState(ServerUser *uSource, MumbleProto::ChannelState &msg
 	QString qsName;
 	QString qsDesc;
 	if (msg.has_description()) {
-		qsDesc       = u8(msg.description());
-		bool changed = false;
-		if (!isTextAllowed(qsDesc, changed)) {
+		if (!isTextAllowed(*msg.mutable_description())) {
 			PERM_DENIED_TYPE(TextTooLong);
 			return;
 		}
-		if (changed)
-			msg.set_description(u8(qsDesc));
+		qsDesc = u8(msg.description());
 	}
 
 	if (msg.has_name()) {
@@ -1330,7 +1387,7 @@ void Server::msgChannelState(ServerUser *uSource, MumbleProto::ChannelState &msg
 		}
 
 		c = addChannel(p, qsName, msg.temporary(), msg.position(), msg.max_users());
-		hashAssign(c->qsDesc, c->qbaDescHash, qsDesc);
+		hashAssign(c->qsDesc, c->qbaDescHash, c->m_descriptionBlob, qsDesc);
 
 		if (uSource->iId >= 0) {
 			Group *g = new Group(c, "admin");
@@ -1348,7 +1405,7 @@ void Server::msgChannelState(ServerUser *uSource, MumbleProto::ChannelState &msg
 			a->pDeny  = ChanACL::None;
 			a->pAllow = ChanACL::Write | ChanACL::Traverse;
 
-			clearACLCache();
+			clearChannelACLCache(c);
 		}
 		updateChannel(c);
 
@@ -1478,17 +1535,20 @@ void Server::msgChannelState(ServerUser *uSource, MumbleProto::ChannelState &msg
 			log(uSource, QString("Moved channel %1 from %2 to %3").arg(QString(*c), QString(*c->cParent), QString(*p)));
 
 			{
-				QWriteLocker wl(&qrwlVoiceThread);
+				VoiceThreadWriteLocker wl(this);
 				c->cParent->removeChannel(c);
 				p->addChannel(c);
 			}
+
+			// The permissions in the moved channels and of the users in them ("sub") depend on the channel tree
+			clearACLCache();
 		}
 		if (!qsName.isNull()) {
 			log(uSource, QString("Renamed channel %1 to %2").arg(QString(*c), QString(qsName)));
 			c->qsName = qsName;
 		}
 		if (!qsDesc.isNull())
-			hashAssign(c->qsDesc, c->qbaDescHash, qsDesc);
+			hashAssign(c->qsDesc, c->qbaDescHash, c->m_descriptionBlob, qsDesc);
 
 		if (msg.has_position())
 			c->iPosition = msg.position();
@@ -1562,21 +1622,16 @@ void Server::msgTextMessage(ServerUser *uSource, MumbleProto::TextMessage &msg)
 			return;
 	}
 
-	QString text = u8(msg.message());
-	bool changed = false;
-
-	if (!isTextAllowed(text, changed)) {
+	if (!isTextAllowed(*msg.mutable_message())) {
 		PERM_DENIED_TYPE(TextTooLong);
 		return;
 	}
-	if (text.isEmpty()) {
+	if (msg.message().empty()) {
 		return;
 	}
-	if (changed) {
-		msg.set_message(u8(text));
-	}
 
-	tm.qsText = text;
+	const QString text = u8(msg.message());
+	tm.qsText          = text;
 
 	{ // Happy easter
 		char m[29] = { 0117, 0160, 0145, 0156, 040,  0164, 0150, 0145, 040, 0160, 0157, 0144, 040, 0142, 0141,
@@ -1675,8 +1730,21 @@ void Server::msgTextMessage(ServerUser *uSource, MumbleProto::TextMessage &msg)
 	// Remove the message sender from the list of users to send the message to
 	users.remove(uSource);
 
+	// Clients that fetch images on demand get the message with references instead of the embedded images
+	MumbleProto::TextMessage compactMsg;
+	bool compact = false;
+	if (m_textMessageImages->isEnabled()
+		&& std::any_of(users.cbegin(), users.cend(), [](const ServerUser *u) { return u->m_imageReferences; })) {
+		const QString compactText = m_textMessageImages->offload(text);
+		if (!compactText.isNull()) {
+			compactMsg = msg;
+			compactMsg.set_message(u8(compactText));
+			compact = true;
+		}
+	}
+
 	// Actually send the original message to the affected users
-	foreach (ServerUser *u, users) { sendMessage(u, msg); }
+	foreach (ServerUser *u, users) { sendMessage(u, compact && u->m_imageReferences ? compactMsg : msg); }
 
 	// Emit the signal for RPC consumers
 	emit userTextMessage(uSource, tm);
@@ -1845,7 +1913,7 @@ void Server::msgACL(ServerUser *uSource, MumbleProto::ACL &msg) {
 		ChanACL *a;
 
 		{
-			QWriteLocker wl(&qrwlVoiceThread);
+			VoiceThreadWriteLocker wl(this);
 
 			QHash< QString, QSet< int > > hOldTemp;
 
@@ -1857,6 +1925,8 @@ void Server::msgACL(ServerUser *uSource, MumbleProto::ACL &msg) {
 				logGroups(this, c, QLatin1String("These are the groups before applying the change:"));
 			}
 
+			discardChannelACLs(c);
+
 			foreach (g, c->qhGroups) {
 				hOldTemp.insert(g->qsName, g->qsTemporary);
 				delete g;
@@ -1916,11 +1986,11 @@ void Server::msgACL(ServerUser *uSource, MumbleProto::ACL &msg) {
 			}
 		}
 
-		clearACLCache();
+		clearChannelACLCache(c);
 
 		if (!hasPermission(uSource, c, ChanACL::Write) && ((uSource->iId >= 0) || !uSource->qsHash.isEmpty())) {
 			{
-				QWriteLocker wl(&qrwlVoiceThread);
+				VoiceThreadWriteLocker wl(this);
 
 				a             = new ChanACL(c);
 				a->bApplyHere = true;
@@ -1934,7 +2004,7 @@ void Server::msgACL(ServerUser *uSource, MumbleProto::ACL &msg) {
 				a->pAllow  = ChanACL::Write | ChanACL::Traverse;
 			}
 
-			clearACLCache();
+			clearChannelACLCache(c);
 		}
 
 
@@ -1988,12 +2058,10 @@ void Server::msgPing(ServerUser *uSource, MumbleProto::Ping &msg) {
 
 	MSG_SETUP_NO_UNIDLE(ServerUser::Authenticated);
 
-	QMutexLocker l(&uSource->qmCrypt);
-
-	uSource->csCrypt->uiRemoteGood   = msg.good();
-	uSource->csCrypt->uiRemoteLate   = msg.late();
-	uSource->csCrypt->uiRemoteLost   = msg.lost();
-	uSource->csCrypt->uiRemoteResync = msg.resync();
+	uSource->voiceCrypt.uiRemoteGood   = msg.good();
+	uSource->voiceCrypt.uiRemoteLate   = msg.late();
+	uSource->voiceCrypt.uiRemoteLost   = msg.lost();
+	uSource->voiceCrypt.uiRemoteResync = msg.resync();
 
 	uSource->dUDPPingAvg  = msg.udp_ping_avg();
 	uSource->dUDPPingVar  = msg.udp_ping_var();
@@ -2006,10 +2074,10 @@ void Server::msgPing(ServerUser *uSource, MumbleProto::Ping &msg) {
 
 	msg.Clear();
 	msg.set_timestamp(ts);
-	msg.set_good(uSource->csCrypt->uiGood);
-	msg.set_late(uSource->csCrypt->uiLate);
-	msg.set_lost(uSource->csCrypt->uiLost);
-	msg.set_resync(uSource->csCrypt->uiResync);
+	msg.set_good(uSource->voiceCrypt.uiGood);
+	msg.set_late(uSource->voiceCrypt.uiLate);
+	msg.set_lost(uSource->voiceCrypt.uiLost);
+	msg.set_resync(uSource->voiceCrypt.uiResync);
 
 	sendMessage(uSource, msg);
 }
@@ -2019,16 +2087,14 @@ void Server::msgCryptSetup(ServerUser *uSource, MumbleProto::CryptSetup &msg) {
 
 	MSG_SETUP_NO_UNIDLE(ServerUser::Authenticated);
 
-	QMutexLocker l(&uSource->qmCrypt);
-
 	if (!msg.has_client_nonce()) {
 		log(uSource, "Requested crypt-nonce resync");
-		msg.set_server_nonce(uSource->csCrypt->getEncryptIV());
+		msg.set_server_nonce(uSource->voiceCrypt.getEncryptIV());
 		sendMessage(uSource, msg);
 	} else {
 		const std::string &str = msg.client_nonce();
-		uSource->csCrypt->uiResync++;
-		if (!uSource->csCrypt->setDecryptIV(str)) {
+		uSource->voiceCrypt.uiResync++;
+		if (!uSource->voiceCrypt.setDecryptIV(str)) {
 			qWarning("Messages: Cipher resync failed: Invalid nonce from the client!");
 		}
 	}
@@ -2175,7 +2241,7 @@ void Server::msgVoiceTarget(ServerUser *uSource, MumbleProto::VoiceTarget &msg)
 	if ((target < 1) || (target >= 0x1f))
 		return;
 
-	QWriteLocker lock(&qrwlVoiceThread);
+	VoiceThreadWriteLocker lock(this);
 
 	uSource->qmTargetCache.remove(target);
 
@@ -2265,19 +2331,19 @@ void Server::msgUserStats(ServerUser *uSource, MumbleProto::UserStats &msg) {
 	if (local) {
 		MumbleProto::UserStats_Stats *mpusss;
 
-		QMutexLocker l(&pDstServerUser->qmCrypt);
+		const VoiceCryptState &crypt = pDstServerUser->voiceCrypt;
 
 		mpusss = msg.mutable_from_client();
-		mpusss->set_good(pDstServerUser->csCrypt->uiGood);
-		mpusss->set_late(pDstServerUser->csCrypt->uiLate);
-		mpusss->set_lost(pDstServerUser->csCrypt->uiLost);
-		mpusss->set_resync(pDstServerUser->csCrypt->uiResync);
+		mpusss->set_good(crypt.uiGood);
+		mpusss->set_late(crypt.uiLate);
+		mpusss->set_lost(crypt.uiLost);
+		mpusss->set_resync(crypt.uiResync);
 
 		mpusss = msg.mutable_from_server();
-		mpusss->set_good(pDstServerUser->csCrypt->uiRemoteGood);
-		mpusss->set_late(pDstServerUser->csCrypt->uiRemoteLate);
-		mpusss->set_lost(pDstServerUser->csCrypt->uiRemoteLost);
-		mpusss->set_resync(pDstServerUser->csCrypt->uiRemoteResync);
+		mpusss->set_good(crypt.uiRemoteGood);
+		mpusss->set_late(crypt.uiRemoteLate);
+		mpusss->set_lost(crypt.uiRemoteLost);
+		mpusss->set_resync(crypt.uiRemoteResync);
 	}
 
 	msg.set_udp_packets(pDstServerUser->uiUDPPackets);
@@ -2327,13 +2393,18 @@ void Server::msgRequestBlob(ServerUser *uSource, MumbleProto::RequestBlob &msg)
 	int ntextures     = msg.session_texture_size();
 	int ncomments     = msg.session_comment_size();
 	int ndescriptions = msg.channel_description_size();
+	int nimages       = msg.text_message_image_size();
 
 	if (ndescriptions) {
 		MumbleProto::ChannelState mpcs;
 		for (int i = 0; i < ndescriptions; ++i) {
 			unsigned int id = msg.channel_description(i);
 			Channel *c      = qhChannels.value(id);
-			if (c && !c->qsDesc.isEmpty()) {
+			if (c && !c->qbaDescHash.isEmpty()) {
+				mpcs.set_channel_id(id);
+				mpcs.set_description(blob(c->m_descriptionBlob.data()));
+				sendMessage(uSource, mpcs);
+			} else if (c && !c->qsDesc.isEmpty()) {
 				mpcs.set_channel_id(id);
 				mpcs.set_description(u8(c->qsDesc));
 				sendMessage(uSource, mpcs);
@@ -2343,11 +2414,12 @@ void Server::msgRequestBlob(ServerUser *uSource, MumbleProto::RequestBlob &msg)
 	if (ntextures || ncomments) {
 		MumbleProto::UserState mpus;
 		for (int i = 0; i < ntextures; ++i) {
-			unsigned int session = msg.session_texture(i);
-			ServerUser *su       = qhUsers.value(session);
-			if (su && !su->qbaTexture.isEmpty()) {
+			unsigned int session     = msg.session_texture(i);
+			ServerUser *su           = qhUsers.value(session);
+			const QByteArray texture = su ? su->texture() : QByteArray();
+			if (!texture.isEmpty()) {
 				mpus.set_session(session);
-				mpus.set_texture(blob(su->qbaTexture));
+				mpus.set_texture(blob(texture));
 				sendMessage(uSource, mpus);
 			}
 		}
@@ -2356,18 +2428,40 @@ void Server::msgRequestBlob(ServerUser *uSource, MumbleProto::RequestBlob &msg)
 		for (int i = 0; i < ncomments; ++i) {
 			unsigned int session = msg.session_comment(i);
 			ServerUser *su       = qhUsers.value(session);
-			if (su && !su->qsComment.isEmpty()) {
+			if (su && !su->qbaCommentHash.isEmpty()) {
+				mpus.set_session(session);
+				mpus.set_comment(blob(su->m_commentBlob.data()));
+				sendMessage(uSource, mpus);
+			} else if (su && !su->qsComment.isEmpty()) {
 				mpus.set_session(session);
 				mpus.set_comment(u8(su->qsComment));
 				sendMessage(uSource, mpus);
 			}
 		}
 	}
+	if (nimages) {
+		MumbleProto::TextMessageImage mptmi;
+		for (int i = 0; i < nimages; ++i) {
+			const std::string &hash = msg.text_message_image(i);
+			mptmi.set_hash(hash);
+			// Answered even if the image isn't kept anymore, so that the client stops waiting for it
+			const QByteArray image = m_textMessageImages->find(blob(hash));
+			if (!image.isEmpty()) {
+				mptmi.set_image(blob(image));
+			} else {
+				mptmi.clear_image();
+			}
+			sendMessage(uSource, mptmi);
+		}
+	}
 }
 
 void Server::msgServerConfig(ServerUser *, MumbleProto::ServerConfig &) {
 }
 
+void Server::msgTextMessageImage(ServerUser *, MumbleProto::TextMessageImage &) {
+}
+
 void Server::msgSuggestConfig(ServerUser *, MumbleProto::SuggestConfig &) {
 }
 
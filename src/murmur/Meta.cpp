@@ -6,6 +6,7 @@
 #include "Meta.h"
 
 #include "Connection.h"
+#include "ControlThread.h"
 #include "EnvUtils.h"
 #include "FFDHE.h"
 #include "Net.h"
@@ -71,7 +72,12 @@ MetaParams::MetaParams() {
 	qsDBDriver                 = "QSQLITE";
 	qsLogfile                  = "mumble-server.log";
 
-	iLogDays = 31;
+	iLogDays        = 31;
+	iLogSegmentSize = 4096;
+
+	iBlobMemory        = 65536;
+	qsBlobDir          = QString();
+	iTextMessageImages = 256;
 
 	iObfuscate         = 0;
 	bSendVersion       = true;
@@ -80,10 +86,14 @@ MetaParams::MetaParams() {
 	bCertRequired      = false;
 	bForceExternalAuth = false;
 
-	iBanTries      = 10;
-	iBanTimeframe  = 120;
-	iBanTime       = 300;
-	bBanSuccessful = true;
+	iBanTries       = 10;
+	iBanTimeframe   = 120;
+	iBanTime        = 300;
+	bBanSuccessful  = true;
+	iBanSubnetTries = 0;
+	iBanIPv4Subnet  = 24;
+	iBanIPv6Subnet  = 64;
+	iBanTableSize   = 65536;
 
 #ifdef Q_OS_UNIX
 	uiUid = uiGid = 0;
@@ -105,6 +115,23 @@ MetaParams::MetaParams() {
 
 	broadcastListenerVolumeAdjustments = false;
 
+	iUDPBatchSize     = 1;
+	iVoiceThreads     = 1;
+	iHandshakeThreads = 0;
+	iHandshakeLimit   = 64;
+	iAuthThreads      = 0;
+	iAuthLimit        = 256;
+	iAuthTimeout      = 15;
+	bControlThreads   = false;
+	iDBWriteQueue     = 0;
+	iDBWriteInterval  = 50;
+
+	iIceCallbackQueue   = 1000;
+	iIceCallbackTimeout = 30;
+
+	qhaMetricsAddress = QHostAddress(QHostAddress::LocalHost);
+	usMetricsPort     = 0;
+
 	qsCiphers = MumbleSSL::defaultOpenSSLCipherString();
 
 	bLogGroupChanges = false;
@@ -297,7 +324,23 @@ void MetaParams::read(QString fname) {
 	qsIceSecretRead  = typeCheckedFromSettings("icesecretread", qsIceSecretRead);
 	qsIceSecretWrite = typeCheckedFromSettings("icesecretwrite", qsIceSecretRead);
 
-	iLogDays = typeCheckedFromSettings("logdays", iLogDays);
+	iIceCallbackQueue   = typeCheckedFromSettings("icecallbackqueue", iIceCallbackQueue);
+	iIceCallbackTimeout = typeCheckedFromSettings("icecallbacktimeout", iIceCallbackTimeout);
+
+	usMetricsPort =
+		static_cast< unsigned short >(typeCheckedFromSettings("metricsport", static_cast< uint >(usMetricsPort)));
+	const QString metricsAddress = typeCheckedFromSettings("metricsaddress", qhaMetricsAddress.toString());
+	if (!qhaMetricsAddress.setAddress(metricsAddress)) {
+		qFatal("MetaParams: Invalid metricsaddress: %s", qPrintable(metricsAddress));
+	}
+
+	iLogDays        = typeCheckedFromSettings("logdays", iLogDays);
+	qsLogDir        = typeCheckedFromSettings("logdir", qsLogDir);
+	iLogSegmentSize = typeCheckedFromSettings("logsegmentsize", iLogSegmentSize);
+
+	iBlobMemory        = typeCheckedFromSettings("blobmemory", iBlobMemory);
+	qsBlobDir          = typeCheckedFromSettings("blobdir", qsBlobDir);
+	iTextMessageImages = typeCheckedFromSettings("textmessageimages", iTextMessageImages);
 
 	qsLogfile = typeCheckedFromSettings("logfile", qsLogfile);
 	qsPid     = typeCheckedFromSettings("pidfile", qsPid);
@@ -309,10 +352,14 @@ void MetaParams::read(QString fname) {
 	qurlRegWeb    = QUrl(typeCheckedFromSettings("registerUrl", qurlRegWeb).toString());
 	bBonjour      = typeCheckedFromSettings("bonjour", bBonjour);
 
-	iBanTries      = typeCheckedFromSettings("autobanAttempts", iBanTries);
-	iBanTimeframe  = typeCheckedFromSettings("autobanTimeframe", iBanTimeframe);
-	iBanTime       = typeCheckedFromSettings("autobanTime", iBanTime);
-	bBanSuccessful = typeCheckedFromSettings("autobanSuccessfulConnections", bBanSuccessful);
+	iBanTries       = typeCheckedFromSettings("autobanAttempts", iBanTries);
+	iBanTimeframe   = typeCheckedFromSettings("autobanTimeframe", iBanTimeframe);
+	iBanTime        = typeCheckedFromSettings("autobanTime", iBanTime);
+	bBanSuccessful  = typeCheckedFromSettings("autobanSuccessfulConnections", bBanSuccessful);
+	iBanSubnetTries = typeCheckedFromSettings("autobanSubnetAttempts", iBanSubnetTries);
+	iBanIPv4Subnet  = typeCheckedFromSettings("autobanIPv4Subnet", iBanIPv4Subnet);
+	iBanIPv6Subnet  = typeCheckedFromSettings("autobanIPv6Subnet", iBanIPv6Subnet);
+	iBanTableSize   = typeCheckedFromSettings("autobanTableSize", iBanTableSize);
 
 	m_suggestVersion = Version::fromConfig(qsSettings->value("suggestVersion"));
 
@@ -367,6 +414,17 @@ void MetaParams::read(QString fname) {
 
 	broadcastListenerVolumeAdjustments = typeCheckedFromSettings("broadcastlistenervolumeadjustments", false);
 
+	iUDPBatchSize     = typeCheckedFromSettings("udpbatchsize", iUDPBatchSize);
+	iVoiceThreads     = typeCheckedFromSettings("voicethreads", iVoiceThreads);
+	iHandshakeThreads = typeCheckedFromSettings("handshakethreads", iHandshakeThreads);
+	iHandshakeLimit   = typeCheckedFromSettings("handshakelimit", iHandshakeLimit);
+	iAuthThreads      = typeCheckedFromSettings("auththreads", iAuthThreads);
+	iAuthLimit        = typeCheckedFromSettings("authlimit", iAuthLimit);
+	iAuthTimeout      = typeCheckedFromSettings("authtimeout", iAuthTimeout);
+	bControlThreads   = typeCheckedFromSettings("controlthreads", bControlThreads);
+	iDBWriteQueue     = typeCheckedFromSettings("dbwritequeue", iDBWriteQueue);
+	iDBWriteInterval  = typeCheckedFromSettings("dbwriteinterval", iDBWriteInterval);
+
 	bool bObfuscate = typeCheckedFromSettings("obfuscate", false);
 	if (bObfuscate) {
 		qWarning("IP address obfuscation enabled.");
@@ -419,6 +477,13 @@ void MetaParams::read(QString fname) {
 	qmConfig.insert(QLatin1String("opusthreshold"), QString::number(iOpusThreshold));
 	qmConfig.insert(QLatin1String("channelnestinglimit"), QString::number(iChannelNestingLimit));
 	qmConfig.insert(QLatin1String("channelcountlimit"), QString::number(iChannelCountLimit));
+	qmConfig.insert(QLatin1String("udpbatchsize"), QString::number(iUDPBatchSize));
+	qmConfig.insert(QLatin1String("voicethreads"), QString::number(iVoiceThreads));
+	qmConfig.insert(QLatin1String("handshakethreads"), QString::number(iHandshakeThreads));
+	qmConfig.insert(QLatin1String("handshakelimit"), QString::number(iHandshakeLimit));
+	qmConfig.insert(QLatin1String("auththreads"), QString::number(iAuthThreads));
+	qmConfig.insert(QLatin1String("authlimit"), QString::number(iAuthLimit));
+	qmConfig.insert(QLatin1String("authtimeout"), QString::number(iAuthTimeout));
 	qmConfig.insert(QLatin1String("sslCiphers"), qsCiphers);
 	qmConfig.insert(QLatin1String("sslDHParams"), QString::fromLatin1(qbaDHParams.constData()));
 }
@@ -620,6 +685,19 @@ bool MetaParams::loadSSLSettings() {
 }
 
 Meta::Meta() {
+	ConnectionRateLimiter::Settings settings;
+	settings.attempts       = static_cast< unsigned int >(qMax(mp.iBanTries, 0));
+	settings.subnetAttempts = static_cast< unsigned int >(qMax(mp.iBanSubnetTries, 0));
+	settings.ipv4Prefix     = static_cast< unsigned int >(qMax(mp.iBanIPv4Subnet, 0));
+	settings.ipv6Prefix     = static_cast< unsigned int >(qMax(mp.iBanIPv6Subnet, 0));
+	settings.timeframe      = 1000000ULL * static_cast< unsigned long long >(qMax(mp.iBanTimeframe, 0));
+	settings.banTime        = 1000000ULL * static_cast< unsigned long long >(qMax(mp.iBanTime, 0));
+	m_connectionLimiter =
+		std::make_unique< ConnectionRateLimiter >(settings, static_cast< std::size_t >(qMax(mp.iBanTableSize, 1)));
+
+	m_blobStore =
+		std::make_unique< BlobStore >(1024ULL * static_cast< std::uint64_t >(qMax(mp.iBlobMemory, 0)), mp.qsBlobDir);
+
 #ifdef Q_OS_WIN
 	QOS_VERSION qvVer;
 	qvVer.MajorVersion = 1;
@@ -661,7 +739,7 @@ bool Meta::reloadSSLSettings() {
 	foreach (Server *s, qhServers) {
 		if (s->bUsingMetaCert) {
 			s->log("Reloading certificates...");
-			s->initializeCert();
+			ControlThread::runOnThreadOf(s, [s]() { s->initializeCert(); });
 		} else {
 			s->log("Not reloading certificates; server does not use Meta certificate");
 		}
@@ -686,10 +764,22 @@ bool Meta::boot(int srvnum) {
 		return false;
 	if (!ServerDB::serverExists(srvnum))
 		return false;
-	Server *s = new Server(srvnum, this);
-	if (!s->bValid) {
-		delete s;
-		return false;
+
+	Server *s;
+	if (mp.bControlThreads) {
+		ControlThread *thread = new ControlThread(srvnum);
+		s                     = thread->server();
+		if (!s) {
+			delete thread;
+			return false;
+		}
+		qhControlThreads.insert(srvnum, thread);
+	} else {
+		s = new Server(srvnum, this);
+		if (!s->bValid) {
+			delete s;
+			return false;
+		}
 	}
 	qhServers.insert(srvnum, s);
 	emit started(s);
@@ -732,27 +822,32 @@ void Meta::kill(int srvnum) {
 	if (!s)
 		return;
 	emit stopped(s);
-	delete s;
+	destroyServer(srvnum, s);
 }
 
 void Meta::killAll() {
-	foreach (Server *s, qhServers) {
-		emit stopped(s);
-		delete s;
+	QHash< int, Server * >::const_iterator i;
+	for (i = qhServers.constBegin(); i != qhServers.constEnd(); ++i) {
+		emit stopped(i.value());
+		destroyServer(i.key(), i.value());
 	}
 	qhServers.clear();
 }
 
+void Meta::destroyServer(int srvnum, Server *s) {
+	if (ControlThread *thread = qhControlThreads.take(srvnum)) {
+		// Destroys the server on its own thread
+		delete thread;
+	} else {
+		delete s;
+	}
+}
+
 void Meta::successfulConnectionFrom(const QHostAddress &addr) {
 	if (!mp.bBanSuccessful) {
-		QList< Timer > &ql = qhAttempts[addr];
-		// Seems like this is the most efficient way to clear the list, given:
-		// 1. ql.clear() allocates a new array
-		// 2. ql has less than iBanAttempts members
-		// 3. seems like ql.removeFirst() might actually copy elements to shift to the front
-		while (!ql.empty()) {
-			ql.removeLast();
-		}
+		QMutexLocker lock(&qmBans);
+
+		m_connectionLimiter->succeeded(HostAddress(addr), tUptime.elapsed());
 	}
 }
 
@@ -760,22 +855,13 @@ bool Meta::banCheck(const QHostAddress &addr) {
 	if ((mp.iBanTries <= 0) || (mp.iBanTimeframe <= 0))
 		return false;
 
-	if (qhBans.contains(addr)) {
-		Timer t = qhBans.value(addr);
-		if (t.elapsed() < (1000000ULL * static_cast< unsigned long long >(mp.iBanTime)))
-			return true;
-		qhBans.remove(addr);
-	}
+	QMutexLocker lock(&qmBans);
 
-	QList< Timer > &ql = qhAttempts[addr];
+	return m_connectionLimiter->check(HostAddress(addr), tUptime.elapsed());
+}
 
-	ql.append(Timer());
-	while (!ql.isEmpty() && (ql.at(0).elapsed() > (1000000ULL * static_cast< unsigned long long >(mp.iBanTimeframe))))
-		ql.removeFirst();
+ConnectionRateLimiterMetrics Meta::autobanMetrics() {
+	QMutexLocker lock(&qmBans);
 
-	if (ql.count() > mp.iBanTries) {
-		qhBans.insert(addr, Timer());
-		return true;
-	}
-	return false;
+	return m_connectionLimiter->metrics(tUptime.elapsed());
 }
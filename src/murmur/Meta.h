@@ -8,6 +8,8 @@
 
 #include "Timer.h"
 
+#include "BlobStore.h"
+#include "ConnectionRateLimiter.h"
 #include "Version.h"
 
 #ifdef Q_OS_WIN
@@ -16,6 +18,7 @@
 
 #include <QtCore/QDir>
 #include <QtCore/QList>
+#include <QtCore/QMutex>
 #include <QtCore/QRegularExpression>
 #include <QtCore/QUrl>
 #include <QtCore/QVariant>
@@ -24,6 +27,9 @@
 #include <QtNetwork/QSslCipher>
 #include <QtNetwork/QSslKey>
 
+#include <memory>
+
+class ControlThread;
 class Server;
 class QSettings;
 
@@ -65,6 +71,12 @@ public:
 	int iBanTimeframe;
 	int iBanTime;
 	bool bBanSuccessful;
+	/// The number of connection attempts per subnet that lead to a ban (0 disables banning subnets)
+	int iBanSubnetTries;
+	int iBanIPv4Subnet;
+	int iBanIPv6Subnet;
+	/// The number of addresses and subnets whose connection attempts can be tracked at the same time
+	int iBanTableSize;
 
 	QString qsDatabase;
 	int iSQLiteWAL;
@@ -77,6 +89,19 @@ public:
 	int iDBPort;
 
 	int iLogDays;
+	/// The directory holding the LogStore of every server (the log is stored in the database if empty)
+	QString qsLogDir;
+	/// The size in KiB at which the LogStore starts a new segment
+	int iLogSegmentSize;
+
+	/// The size in KiB of the textures, comments and channel descriptions the BlobStore keeps in memory
+	int iBlobMemory;
+	/// The directory the BlobStore spills textures, comments and channel descriptions to (all are kept in memory if
+	/// empty)
+	QString qsBlobDir;
+	/// The number of images of recent text messages every server keeps for clients fetching them by reference (0 to
+	/// always send images inline)
+	int iTextMessageImages;
 
 	int iObfuscate;
 	bool bSendVersion;
@@ -86,6 +111,15 @@ public:
 	QString qsPid;
 	QString qsIceEndpoint;
 	QString qsIceSecretRead, qsIceSecretWrite;
+	/// The number of calls of an Ice ServerCallback that may wait to be sent
+	unsigned int iIceCallbackQueue;
+	/// The time in seconds a call of an Ice ServerCallback may take to be sent before the callback is removed (0 for
+	/// no limit)
+	int iIceCallbackTimeout;
+
+	/// The address and port of the HTTP endpoint exposing the voice metrics (disabled if the port is 0)
+	QHostAddress qhaMetricsAddress;
+	unsigned short usMetricsPort;
 
 	QString qsRegName;
 	QString qsRegPassword;
@@ -105,6 +139,33 @@ public:
 
 	bool broadcastListenerVolumeAdjustments;
 
+	/// The maximum amount of UDP datagrams to receive/send with a single system call (Linux only)
+	unsigned int iUDPBatchSize;
+
+	/// The amount of threads processing UDP packets per virtual server (Linux only)
+	unsigned int iVoiceThreads;
+
+	/// The amount of threads performing TLS handshakes per virtual server (0 to perform them on the server's thread)
+	unsigned int iHandshakeThreads;
+	/// The maximum amount of TLS handshakes performed at the same time per virtual server (0 for no limit)
+	unsigned int iHandshakeLimit;
+
+	/// The amount of threads authenticating users per virtual server (0 to authenticate them on the server's thread)
+	unsigned int iAuthThreads;
+	/// The maximum amount of pending authentication attempts per virtual server (0 for no limit)
+	unsigned int iAuthLimit;
+	/// The time in seconds an authentication attempt may take
+	int iAuthTimeout;
+
+	/// The maximum amount of database writes waiting to be committed by the DBWriter (0 to write synchronously)
+	unsigned int iDBWriteQueue;
+	/// The time in milliseconds the DBWriter waits for further writes before committing them
+	int iDBWriteInterval;
+
+	/// Whether every virtual server gets a thread of its own for its control plane (see ControlThread) instead of
+	/// running on the main thread
+	bool bControlThreads;
+
 	QSslCertificate qscCert;
 	QSslKey qskKey;
 
@@ -178,9 +239,15 @@ private:
 
 public:
 	static MetaParams mp;
+	/// Only modified by the main thread
 	QHash< int, Server * > qhServers;
-	QHash< QHostAddress, QList< Timer > > qhAttempts;
-	QHash< QHostAddress, Timer > qhBans;
+	/// The control threads of the servers in qhServers (only used if the controlthreads setting is enabled)
+	QHash< int, ControlThread * > qhControlThreads;
+	/// Protects m_connectionLimiter, which is accessed by the control threads of all servers
+	QMutex qmBans;
+	std::unique_ptr< ConnectionRateLimiter > m_connectionLimiter;
+	/// Holds the textures, comments and channel descriptions of all servers. It has to outlive them.
+	std::unique_ptr< BlobStore > m_blobStore;
 	QString qsOS, qsOSVersion;
 	Timer tUptime;
 
@@ -204,6 +271,8 @@ public:
 	/// Called whenever we get a successful connection from a client.
 	/// Used to reset autoban tracking for the address.
 	void successfulConnectionFrom(const QHostAddress &);
+	/// @returns The counters of the autoban
+	ConnectionRateLimiterMetrics autobanMetrics();
 	void kill(int);
 	void killAll();
 	void getOSInfo();
@@ -213,6 +282,10 @@ public:
 signals:
 	void started(Server *);
 	void stopped(Server *);
+
+protected:
+	/// Destroys the given (already removed from qhServers) server along with its control thread, if any
+	void destroyServer(int srvnum, Server *s);
 };
 
 extern Meta *meta;
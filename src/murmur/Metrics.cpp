@@ -0,0 +1,61 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "Metrics.h"
+
+#include <cstdio>
+
+void Prometheus::appendHeader(std::string &out, const char *name, const char *help, const char *type) {
+	out += "# HELP ";
+	out += name;
+	out += ' ';
+	out += help;
+	out += "\n# TYPE ";
+	out += name;
+	out += ' ';
+	out += type;
+	out += '\n';
+}
+
+void Prometheus::appendSample(std::string &out, const char *name, const char *suffix, int serverID, const char *le,
+							  const std::string &value) {
+	out += name;
+	out += suffix;
+	out += "{server=\"";
+	out += std::to_string(serverID);
+	if (le) {
+		out += "\",le=\"";
+		out += le;
+	}
+	out += "\"} ";
+	out += value;
+	out += '\n';
+}
+
+void Prometheus::appendSample(std::string &out, const char *name, const std::string &value) {
+	out += name;
+	out += ' ';
+	out += value;
+	out += '\n';
+}
+
+std::string Prometheus::formatValue(std::uint64_t value, double scale) {
+	if (scale == 1.0) {
+		return std::to_string(value);
+	}
+
+	char buffer[32];
+	std::snprintf(buffer, sizeof(buffer), "%.10g", static_cast< double >(value) / scale);
+	return buffer;
+}
+
+std::uint64_t HistogramSnapshot::count() const {
+	std::uint64_t total = 0;
+	for (std::uint64_t bucket : buckets) {
+		total += bucket;
+	}
+
+	return total;
+}
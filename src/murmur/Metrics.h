@@ -0,0 +1,142 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_METRICS_H_
+#define MUMBLE_MURMUR_METRICS_H_
+
+#include <QtCore/QtAlgorithms>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// A counter that is only ever incremented by a single thread, but may be read by any thread. As there is only one
+/// writer, incrementing doesn't need an atomic read-modify-write operation.
+class MetricsCounter {
+public:
+	void add(std::uint64_t amount = 1) {
+		m_value.store(m_value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	std::uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+protected:
+	std::atomic< std::uint64_t > m_value{ 0 };
+};
+
+/// Helpers for rendering metrics in the Prometheus text exposition format
+namespace Prometheus {
+void appendHeader(std::string &out, const char *name, const char *help, const char *type);
+/// Appends a sample labelled with the given virtual server and (if not null) bucket boundary
+void appendSample(std::string &out, const char *name, const char *suffix, int serverID, const char *le,
+				  const std::string &value);
+/// Appends a sample without any labels (for metrics of the whole process)
+void appendSample(std::string &out, const char *name, const std::string &value);
+/// Formats the given value divided by the given scale (e.g. to convert microseconds to seconds)
+std::string formatValue(std::uint64_t value, double scale);
+
+/// Describes a metric whose value is the given member of the struct T. Tables of these are rendered by appendMetrics.
+template< typename T, typename Value = std::uint64_t > struct Metric {
+	const char *name;
+	const char *help;
+	/// "counter" or "gauge"
+	const char *type;
+	Value T::*member;
+	/// The value is divided by this (e.g. to convert microseconds to seconds)
+	double scale = 1.0;
+};
+
+/// Appends the given metrics of the whole process
+template< typename T, typename Value, std::size_t N >
+void appendMetrics(std::string &out, const Metric< T, Value > (&metrics)[N], const T &values) {
+	for (const Metric< T, Value > &metric : metrics) {
+		appendHeader(out, metric.name, metric.help, metric.type);
+		appendSample(out, metric.name, formatValue(values.*metric.member, metric.scale));
+	}
+}
+
+/// Appends the given metrics of every virtual server, labelled with the server's ID
+template< typename T, typename Value, std::size_t N >
+void appendMetrics(std::string &out, const Metric< T, Value > (&metrics)[N],
+				   const std::vector< std::pair< int, T > > &servers) {
+	for (const Metric< T, Value > &metric : metrics) {
+		appendHeader(out, metric.name, metric.help, metric.type);
+
+		for (const std::pair< int, T > &server : servers) {
+			appendSample(out, metric.name, "", server.first, nullptr,
+						 formatValue(server.second.*metric.member, metric.scale));
+		}
+	}
+}
+} // namespace Prometheus
+
+/// The buckets of a histogram summed up over all threads
+struct HistogramSnapshot {
+	std::vector< std::uint64_t > buckets;
+	std::uint64_t sum = 0;
+
+	std::uint64_t count() const;
+};
+
+/// A histogram with log-linear buckets (in the style of HDR histograms): every power of two is split into two
+/// buckets, which bounds the relative error of a recorded value to 50% regardless of its magnitude. Values of
+/// 2^MAX_EXPONENT or more end up in the last bucket. Just like MetricsCounter, it must only be written to by a
+/// single thread.
+template< unsigned int MAX_EXPONENT > class MetricsHistogram {
+public:
+	static_assert(MAX_EXPONENT >= 2 && MAX_EXPONENT < 64, "Unsupported range");
+
+	static constexpr unsigned int BUCKET_COUNT = 2 * MAX_EXPONENT;
+	static constexpr std::uint64_t MAX_VALUE   = (std::uint64_t(1) << MAX_EXPONENT) - 1;
+
+	void record(std::uint64_t value) {
+		m_buckets[bucketIndex(value)].add();
+		m_sum.add(value);
+	}
+
+	static unsigned int bucketIndex(std::uint64_t value) {
+		if (value > MAX_VALUE) {
+			value = MAX_VALUE;
+		}
+		if (value < 4) {
+			return static_cast< unsigned int >(value);
+		}
+
+		const unsigned int exponent = 63 - static_cast< unsigned int >(qCountLeadingZeroBits(value));
+
+		// The two most significant bits select the bucket within the power of two
+		return ((exponent - 1) << 1) + static_cast< unsigned int >(value >> (exponent - 1));
+	}
+
+	/// @returns The largest value that ends up in the given bucket
+	static std::uint64_t bucketUpperBound(unsigned int index) {
+		if (index < 4) {
+			return index;
+		}
+
+		const unsigned int exponent         = index >> 1;
+		const std::uint64_t mostSignificant = index - ((exponent - 1) << 1);
+
+		return ((mostSignificant + 1) << (exponent - 1)) - 1;
+	}
+
+	void addTo(HistogramSnapshot &snapshot) const {
+		snapshot.buckets.resize(BUCKET_COUNT, 0);
+		for (unsigned int i = 0; i < BUCKET_COUNT; ++i) {
+			snapshot.buckets[i] += m_buckets[i].value();
+		}
+		snapshot.sum += m_sum.value();
+	}
+
+protected:
+	std::array< MetricsCounter, BUCKET_COUNT > m_buckets;
+	MetricsCounter m_sum;
+};
+
+#endif // MUMBLE_MURMUR_METRICS_H_
@@ -0,0 +1,153 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "MetricsServer.h"
+
+#include "BlobStore.h"
+#include "Connection.h"
+#include "DBWriter.h"
+#include "HandshakePool.h"
+#include "Meta.h"
+#include "Metrics.h"
+#include "Server.h"
+#include "ServerDB.h"
+#include "VoiceMetrics.h"
+
+#include <QtCore/QTimer>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#ifdef USE_ICE
+std::string IceMetrics();
+#endif
+
+namespace {
+/// Renders the metrics of the TCP connections, which live in the code shared with the client
+std::string connectionMetrics(const ConnectionOutputMetrics &metrics) {
+	static const Prometheus::Metric< ConnectionOutputMetrics, quint64 > metricList[] = {
+		{ "murmur_tcp_messages_sent_total", "Messages sent through TCP", "counter",
+		  &ConnectionOutputMetrics::messages },
+		{ "murmur_tcp_writes_total", "Writes to the TLS sockets, each of which is encrypted into records of its own",
+		  "counter", &ConnectionOutputMetrics::writes },
+		{ "murmur_tcp_written_bytes_total", "Bytes written to the TLS sockets", "counter",
+		  &ConnectionOutputMetrics::bytes },
+		{ "murmur_tcp_coalesced_messages_total",
+		  "Messages written together with preceding ones, saving a TLS record and a write each", "counter",
+		  &ConnectionOutputMetrics::coalescedMessages },
+	};
+
+	std::string out;
+	Prometheus::appendMetrics(out, metricList, metrics);
+
+	return out;
+}
+} // namespace
+
+MetricsServer::MetricsServer(Meta *meta, const QHostAddress &address, unsigned short port)
+	: QObject(meta), m_meta(meta), m_server(new QTcpServer(this)) {
+	connect(m_server, &QTcpServer::newConnection, this, &MetricsServer::newConnection);
+
+	if (m_server->listen(address, port)) {
+		qWarning("MetricsServer: Serving metrics on %s port %d", qPrintable(address.toString()), port);
+	} else {
+		qWarning("MetricsServer: Failed to listen on %s port %d: %s", qPrintable(address.toString()), port,
+				 qPrintable(m_server->errorString()));
+	}
+}
+
+bool MetricsServer::isListening() const {
+	return m_server->isListening();
+}
+
+void MetricsServer::newConnection() {
+	while (QTcpSocket *socket = m_server->nextPendingConnection()) {
+		connect(socket, &QTcpSocket::readyRead, this, &MetricsServer::readRequest);
+		connect(socket, &QTcpSocket::disconnected, socket, &QTcpSocket::deleteLater);
+
+		// Clients that never complete their request (or never read the response) must not keep the socket open
+		// forever. The timer is discarded together with the socket.
+		QTimer::singleShot(CONNECTION_TIMEOUT, socket, [socket]() { socket->abort(); });
+	}
+}
+
+void MetricsServer::readRequest() {
+	QTcpSocket *socket = qobject_cast< QTcpSocket * >(sender());
+	if (!socket) {
+		return;
+	}
+
+	// Wait for the complete header. Only the request line is of interest, the remaining headers are ignored.
+	const QByteArray pending = socket->peek(MAX_REQUEST_SIZE + 1);
+	if (!pending.contains("\r\n\r\n")) {
+		if (pending.size() > MAX_REQUEST_SIZE) {
+			// The rest of the request is of no interest, the response is the last thing sent
+			disconnect(socket, &QTcpSocket::readyRead, this, &MetricsServer::readRequest);
+			respond(socket, "431 Request Header Fields Too Large", QByteArray());
+		}
+		return;
+	}
+
+	disconnect(socket, &QTcpSocket::readyRead, this, &MetricsServer::readRequest);
+
+	const QList< QByteArray > requestLine = socket->readLine(MAX_REQUEST_SIZE).trimmed().split(' ');
+	if (requestLine.size() != 3 || !requestLine[2].startsWith("HTTP/")) {
+		respond(socket, "400 Bad Request", QByteArray());
+	} else if (requestLine[0] != "GET") {
+		respond(socket, "405 Method Not Allowed", QByteArray());
+	} else if (requestLine[1] != "/metrics") {
+		respond(socket, "404 Not Found", QByteArray());
+	} else {
+		respond(socket, "200 OK", renderMetrics());
+	}
+}
+
+void MetricsServer::respond(QTcpSocket *socket, const QByteArray &status, const QByteArray &body) {
+	QByteArray response = "HTTP/1.0 " + status + "\r\n";
+	if (!body.isEmpty()) {
+		response += "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n";
+	}
+	response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+	response += "Connection: close\r\n\r\n";
+	response += body;
+
+	socket->write(response);
+	socket->disconnectFromHost();
+}
+
+QByteArray MetricsServer::renderMetrics() const {
+	std::vector< std::pair< int, VoiceMetricsSnapshot > > servers;
+	std::vector< std::pair< int, HandshakeMetricsSnapshot > > handshakes;
+	for (Server *server : m_meta->qhServers) {
+		servers.emplace_back(server->iServerNum, server->voiceMetrics().snapshot());
+
+		if (const HandshakePool *pool = server->handshakePool()) {
+			handshakes.emplace_back(server->iServerNum, pool->metrics());
+		}
+	}
+
+	const auto byServer = [](const auto &lhs, const auto &rhs) { return lhs.first < rhs.first; };
+	std::sort(servers.begin(), servers.end(), byServer);
+	std::sort(handshakes.begin(), handshakes.end(), byServer);
+
+	std::string metrics = VoiceMetrics::toPrometheus(servers);
+	if (!handshakes.empty()) {
+		metrics += HandshakePool::toPrometheus(handshakes);
+	}
+	metrics += ConnectionRateLimiter::toPrometheus(m_meta->autobanMetrics());
+	metrics += BlobStore::toPrometheus(m_meta->m_blobStore->metrics());
+	metrics += connectionMetrics(Connection::outputMetrics());
+	if (ServerDB::writer) {
+		metrics += DBWriter::toPrometheus(ServerDB::writer->metrics());
+	}
+#ifdef USE_ICE
+	metrics += IceMetrics();
+#endif
+
+	return QByteArray::fromStdString(metrics);
+}
@@ -0,0 +1,48 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_METRICSSERVER_H_
+#define MUMBLE_MURMUR_METRICSSERVER_H_
+
+#include <QtCore/QByteArray>
+#include <QtCore/QObject>
+#include <QtNetwork/QHostAddress>
+
+class Meta;
+class QTcpServer;
+class QTcpSocket;
+
+/// A minimal HTTP server exposing the VoiceMetrics (and the metrics of the HandshakePool, if any) of all booted virtual
+/// servers, the counters of the autoban and the BlobStore, those of the DBWriter (if any) and those of the Ice server
+/// callbacks (if Ice is enabled) at /metrics in the Prometheus text format (see the metricsport setting). It lives in
+/// the main thread; gathering the metrics never blocks the voice threads.
+class MetricsServer : public QObject {
+private:
+	Q_OBJECT
+	Q_DISABLE_COPY(MetricsServer)
+public:
+	MetricsServer(Meta *meta, const QHostAddress &address, unsigned short port);
+
+	bool isListening() const;
+
+protected:
+	/// Requests are never expected to be larger than this. Larger ones are rejected.
+	static constexpr int MAX_REQUEST_SIZE = 8192;
+	/// The time in milliseconds a connection may stay open, i.e. in which the client has to send its request and
+	/// receive the response. Connections that take longer are aborted.
+	static constexpr int CONNECTION_TIMEOUT = 5000;
+
+	Meta *m_meta;
+	QTcpServer *m_server;
+
+	void respond(QTcpSocket *socket, const QByteArray &status, const QByteArray &body);
+	QByteArray renderMetrics() const;
+
+protected slots:
+	void newConnection();
+	void readRequest();
+};
+
+#endif // MUMBLE_MURMUR_METRICSSERVER_H_
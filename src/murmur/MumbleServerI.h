@@ -46,6 +46,9 @@ public:
 
 	virtual void getLogLen_async(const ::MumbleServer::AMD_Server_getLogLenPtr &, const Ice::Current &);
 
+	virtual void getLogIndex_async(const ::MumbleServer::AMD_Server_getLogIndexPtr &, ::Ice::Int,
+								   const Ice::Current &);
+
 	virtual void getUsers_async(const ::MumbleServer::AMD_Server_getUsersPtr &, const Ice::Current &);
 
 	virtual void getChannels_async(const ::MumbleServer::AMD_Server_getChannelsPtr &, const Ice::Current &);
@@ -5,9 +5,11 @@
 
 #include "MumbleServerIce.h"
 
+#include "AuthPool.h"
 #include "Ban.h"
 #include "Channel.h"
 #include "ChannelListenerManager.h"
+#include "ControlThread.h"
 #include "Group.h"
 #include "Meta.h"
 #include "MumbleServer.h"
@@ -19,6 +21,7 @@
 #include "Utils.h"
 
 #include <QtCore/QCoreApplication>
+#include <QtCore/QMutexLocker>
 #include <QtCore/QSettings>
 #include <QtCore/QStack>
 
@@ -50,6 +53,34 @@ void IceStop() {
 	mi = nullptr;
 }
 
+std::string IceMetrics() {
+	if (!mi) {
+		return std::string();
+	}
+	return CallbackQueue::toPrometheus(mi->serverCallbackMetrics());
+}
+
+/// Reports the outcome of an asynchronous call of a ServerCallback to its CallbackQueue
+class ServerCallbackCompletion : public IceUtil::Shared {
+public:
+	explicit ServerCallbackCompletion(const CallbackQueue::Done &done) : m_done(done) {}
+
+	void completed(const Ice::AsyncResultPtr &result) {
+		try {
+			result->throwLocalException();
+			m_done(true);
+		} catch (const Ice::Exception &) {
+			m_done(false);
+		}
+	}
+
+	void sent(const Ice::AsyncResultPtr &) { m_done(true); }
+
+private:
+	CallbackQueue::Done m_done;
+};
+typedef IceUtil::Handle< ServerCallbackCompletion > ServerCallbackCompletionPtr;
+
 /// Remove all NUL bytes from |s|.
 static std::string iceRemoveNul(std::string s) {
 	std::vector< char > newstr;
@@ -108,9 +139,9 @@ static void userToUser(const ::User *p, ::MumbleServer::User &mp) {
 	mp.selfMute        = p->bSelfMute;
 	mp.selfDeaf        = p->bSelfDeaf;
 	mp.channel         = static_cast< int >(p->cChannel->iId);
-	mp.comment         = iceString(p->qsComment);
 
 	const ServerUser *u = static_cast< const ServerUser * >(p);
+	mp.comment          = iceString(u->comment());
 	mp.onlinesecs       = u->bwr.onlineSeconds();
 	mp.bytespersec      = u->bwr.bandwidth();
 	mp.version2         = static_cast< long >(u->m_version);
@@ -138,7 +169,7 @@ static void channelToChannel(const ::Channel *c, ::MumbleServer::Channel &mc) {
 	mc.id          = static_cast< int >(c->iId);
 	mc.name        = iceString(c->qsName);
 	mc.parent      = c->cParent ? static_cast< int >(c->cParent->iId) : -1;
-	mc.description = iceString(c->qsDesc);
+	mc.description = iceString(c->description());
 	mc.position    = c->iPosition;
 	mc.links.clear();
 	foreach (::Channel *chn, c->qsPermLinks)
@@ -313,12 +344,29 @@ void MumbleServerIce::badServerProxy(const ::MumbleServer::ServerCallbackPrx &pr
 
 void MumbleServerIce::badAuthenticator(::Server *server) {
 	server->disconnectAuthenticator(this);
-	const ::MumbleServer::ServerAuthenticatorPrx &prx = qmServerAuthenticator.value(server->iServerNum);
+	const ::MumbleServer::ServerAuthenticatorPrx prx = getServerAuthenticator(server);
 	server->log(QString("Ice Authenticator %1 failed").arg(QString::fromStdString(communicator->proxyToString(prx))));
 	removeServerAuthenticator(server);
 	removeServerUpdatingAuthenticator(server);
 }
 
+::Server *MumbleServerIce::signalingServer() const {
+	// sender() doesn't work for signals emitted by another thread, which is the case for Servers living on their own
+	// control thread. The signals are delivered directly though, so the current thread tells which Server emitted it.
+	::Server *server = ControlThread::currentServer();
+	if (server) {
+		return server;
+	}
+
+	// The same applies to the authentication threads
+	server = AuthPool::currentServer();
+	if (server) {
+		return server;
+	}
+
+	return qobject_cast<::Server * >(sender());
+}
+
 void MumbleServerIce::addMetaCallback(const ::MumbleServer::MetaCallbackPrx &prx) {
 	if (!qlMetaCallbacks.contains(prx)) {
 		qWarning("Added Ice MetaCallback %s", qPrintable(QString::fromStdString(communicator->proxyToString(prx))));
@@ -333,31 +381,110 @@ void MumbleServerIce::removeMetaCallback(const ::MumbleServer::MetaCallbackPrx &
 }
 
 void MumbleServerIce::addServerCallback(const ::Server *server, const ::MumbleServer::ServerCallbackPrx &prx) {
-	QList<::MumbleServer::ServerCallbackPrx > &cbList = qmServerCallbacks[server->iServerNum];
+	QMutexLocker< QRecursiveMutex > lock(&qrmServerMaps);
 
-	if (!cbList.contains(prx)) {
-		server->log(
-			QString("Added Ice ServerCallback %1").arg(QString::fromStdString(communicator->proxyToString(prx))));
-		cbList.append(prx);
+	QList< ServerCallback > &cbList = qmServerCallbacks[server->iServerNum];
+
+	for (const ServerCallback &callback : cbList) {
+		if (callback.prx == prx) {
+			return;
+		}
 	}
+
+	server->log(QString("Added Ice ServerCallback %1").arg(QString::fromStdString(communicator->proxyToString(prx))));
+	cbList.append({ prx, std::make_shared< CallbackQueue >(Meta::mp.iIceCallbackQueue,
+														   Meta::mp.iIceCallbackTimeout * 1000) });
 }
 
 void MumbleServerIce::removeServerCallback(const ::Server *server, const ::MumbleServer::ServerCallbackPrx &prx) {
-	if (qmServerCallbacks[server->iServerNum].removeAll(prx)) {
+	QMutexLocker< QRecursiveMutex > lock(&qrmServerMaps);
+
+	QList< ServerCallback > &cbList = qmServerCallbacks[server->iServerNum];
+
+	bool removed = false;
+	for (auto it = cbList.begin(); it != cbList.end();) {
+		if (it->prx == prx) {
+			// Keep the counters of the removed callback, so that they never decrease
+			CallbackQueueMetrics metrics = it->queue->metrics();
+			metrics.subscribers          = 0;
+			metrics.queued               = 0;
+			metrics.removed              = it->queue->hasFailed() ? 1 : 0;
+			qmRemovedCallbackMetrics[server->iServerNum] += metrics;
+
+			it      = cbList.erase(it);
+			removed = true;
+		} else {
+			++it;
+		}
+	}
+
+	if (removed) {
 		server->log(
 			QString("Removed Ice ServerCallback %1").arg(QString::fromStdString(communicator->proxyToString(prx))));
 	}
 }
 
 void MumbleServerIce::removeServerCallbacks(const ::Server *server) {
+	QMutexLocker< QRecursiveMutex > lock(&qrmServerMaps);
+
 	if (qmServerCallbacks.contains(server->iServerNum)) {
 		server->log(QString("Removed all Ice ServerCallbacks"));
 		qmServerCallbacks.remove(server->iServerNum);
 	}
+	qmRemovedCallbackMetrics.remove(server->iServerNum);
+}
+
+const QList< MumbleServerIce::ServerCallback > MumbleServerIce::getServerCallbacks(const ::Server *server) const {
+	QMutexLocker< QRecursiveMutex > lock(&qrmServerMaps);
+	return qmServerCallbacks.value(server->iServerNum);
+}
+
+void MumbleServerIce::callServerCallbacks(const ::Server *server, const ServerCallbackCall &call, const QString &key) {
+	const QList< ServerCallback > callbacks = getServerCallbacks(server);
+
+	for (const ServerCallback &callback : callbacks) {
+		const ::MumbleServer::ServerCallbackPrx prx = callback.prx;
+
+		const bool alive = callback.queue->enqueue(
+			[prx, call](const CallbackQueue::Done &done) {
+				ServerCallbackCompletionPtr completion = new ServerCallbackCompletion(done);
+				const Ice::AsyncResultPtr result =
+					call(prx, Ice::newCallback(completion, &ServerCallbackCompletion::completed,
+											   &ServerCallbackCompletion::sent));
+				if (result->isSent()) {
+					done(true);
+				}
+			},
+			key);
+
+		if (!alive) {
+			badServerProxy(prx, server);
+		}
+	}
+}
+
+std::vector< std::pair< int, CallbackQueueMetrics > > MumbleServerIce::serverCallbackMetrics() const {
+	QMutexLocker< QRecursiveMutex > lock(&qrmServerMaps);
+
+	QMap< int, CallbackQueueMetrics > servers = qmRemovedCallbackMetrics;
+	for (auto it = qmServerCallbacks.constBegin(); it != qmServerCallbacks.constEnd(); ++it) {
+		CallbackQueueMetrics &metrics = servers[it.key()];
+		for (const ServerCallback &callback : it.value()) {
+			metrics += callback.queue->metrics();
+		}
+	}
+
+	std::vector< std::pair< int, CallbackQueueMetrics > > result;
+	for (auto it = servers.constBegin(); it != servers.constEnd(); ++it) {
+		result.emplace_back(it.key(), it.value());
+	}
+	return result;
 }
 
 void MumbleServerIce::addServerContextCallback(const ::Server *server, int session_id, const QString &action,
 											   const ::MumbleServer::ServerContextCallbackPrx &prx) {
+	QMutexLocker< QRecursiveMutex > lock(&qrmServerMaps);
+
 	QMap< QString, ::MumbleServer::ServerContextCallbackPrx > &callbacks =
 		qmServerContextCallbacks[server->iServerNum][session_id];
 
@@ -372,10 +499,13 @@ void MumbleServerIce::addServerContextCallback(const ::Server *server, int sessi
 
 const QMap< int, QMap< QString, ::MumbleServer::ServerContextCallbackPrx > >
 	MumbleServerIce::getServerContextCallbacks(const ::Server *server) const {
+	QMutexLocker< QRecursiveMutex > lock(&qrmServerMaps);
 	return qmServerContextCallbacks[server->iServerNum];
 }
 
 void MumbleServerIce::removeServerContextCallback(const ::Server *server, int session_id, const QString &action) {
+	QMutexLocker< QRecursiveMutex > lock(&qrmServerMaps);
+
 	if (qmServerContextCallbacks[server->iServerNum][session_id].remove(action)) {
 		server->log(QString("Removed Ice ServerContextCallback for session %1, action %2").arg(session_id).arg(action));
 	}
@@ -383,6 +513,8 @@ void MumbleServerIce::removeServerContextCallback(const ::Server *server, int se
 
 void MumbleServerIce::setServerAuthenticator(const ::Server *server,
 											 const ::MumbleServer::ServerAuthenticatorPrx &prx) {
+	QMutexLocker< QRecursiveMutex > lock(&qrmServerMaps);
+
 	if (prx != qmServerAuthenticator[server->iServerNum]) {
 		server->log(
 			QString("Set Ice Authenticator to %1").arg(QString::fromStdString(communicator->proxyToString(prx))));
@@ -391,10 +523,13 @@ void MumbleServerIce::setServerAuthenticator(const ::Server *server,
 }
 
 const ::MumbleServer::ServerAuthenticatorPrx MumbleServerIce::getServerAuthenticator(const ::Server *server) const {
+	QMutexLocker< QRecursiveMutex > lock(&qrmServerMaps);
 	return qmServerAuthenticator[server->iServerNum];
 }
 
 void MumbleServerIce::removeServerAuthenticator(const ::Server *server) {
+	QMutexLocker< QRecursiveMutex > lock(&qrmServerMaps);
+
 	if (qmServerAuthenticator.remove(server->iServerNum)) {
 		server->log(QString("Removed Ice Authenticator %1")
 						.arg(QString::fromStdString(communicator->proxyToString(getServerAuthenticator(server)))));
@@ -403,6 +538,8 @@ void MumbleServerIce::removeServerAuthenticator(const ::Server *server) {
 
 void MumbleServerIce::setServerUpdatingAuthenticator(const ::Server *server,
 													 const ::MumbleServer::ServerUpdatingAuthenticatorPrx &prx) {
+	QMutexLocker< QRecursiveMutex > lock(&qrmServerMaps);
+
 	if (prx != qmServerUpdatingAuthenticator[server->iServerNum]) {
 		server->log(QString("Set Ice UpdatingAuthenticator to %1")
 						.arg(QString::fromStdString(communicator->proxyToString(prx))));
@@ -412,10 +549,13 @@ void MumbleServerIce::setServerUpdatingAuthenticator(const ::Server *server,
 
 const ::MumbleServer::ServerUpdatingAuthenticatorPrx
 	MumbleServerIce::getServerUpdatingAuthenticator(const ::Server *server) const {
+	QMutexLocker< QRecursiveMutex > lock(&qrmServerMaps);
 	return qmServerUpdatingAuthenticator[server->iServerNum];
 }
 
 void MumbleServerIce::removeServerUpdatingAuthenticator(const ::Server *server) {
+	QMutexLocker< QRecursiveMutex > lock(&qrmServerMaps);
+
 	if (qmServerUpdatingAuthenticator.contains(server->iServerNum)) {
 		server->log(
 			QString("Removed Ice UpdatingAuthenticator %1")
@@ -435,7 +575,7 @@ static ServerPrx idToProxy(int id, const Ice::ObjectAdapterPtr &adapter) {
 void MumbleServerIce::started(::Server *s) {
 	s->connectListener(mi);
 	connect(s, SIGNAL(contextAction(const User *, const QString &, unsigned int, int)), this,
-			SLOT(contextAction(const User *, const QString &, unsigned int, int)));
+			SLOT(contextAction(const User *, const QString &, unsigned int, int)), Qt::DirectConnection);
 
 	const QList<::MumbleServer::MetaCallbackPrx > &qlList = qlMetaCallbacks;
 
@@ -471,9 +611,9 @@ void MumbleServerIce::stopped(::Server *s) {
 }
 
 void MumbleServerIce::userConnected(const ::User *p) {
-	::Server *s = qobject_cast<::Server * >(sender());
+	::Server *s = signalingServer();
 
-	const QList<::MumbleServer::ServerCallbackPrx > &qmList = qmServerCallbacks[s->iServerNum];
+	const QList< ServerCallback > qmList = getServerCallbacks(s);
 
 	if (qmList.isEmpty())
 		return;
@@ -481,21 +621,20 @@ void MumbleServerIce::userConnected(const ::User *p) {
 	::MumbleServer::User mp;
 	userToUser(p, mp);
 
-	foreach (const ::MumbleServer::ServerCallbackPrx &prx, qmList) {
-		try {
-			prx->userConnected(mp);
-		} catch (...) {
-			badServerProxy(prx, s);
-		}
-	}
+	callServerCallbacks(s, [mp](const ::MumbleServer::ServerCallbackPrx &prx, const Ice::CallbackPtr &cb) {
+		return prx->begin_userConnected(mp, cb);
+	});
 }
 
 void MumbleServerIce::userDisconnected(const ::User *p) {
-	::Server *s = qobject_cast<::Server * >(sender());
+	::Server *s = signalingServer();
 
-	qmServerContextCallbacks[s->iServerNum].remove(static_cast< int >(p->uiSession));
+	{
+		QMutexLocker< QRecursiveMutex > lock(&qrmServerMaps);
+		qmServerContextCallbacks[s->iServerNum].remove(static_cast< int >(p->uiSession));
+	}
 
-	const QList<::MumbleServer::ServerCallbackPrx > &qmList = qmServerCallbacks[s->iServerNum];
+	const QList< ServerCallback > qmList = getServerCallbacks(s);
 
 	if (qmList.isEmpty())
 		return;
@@ -503,19 +642,15 @@ void MumbleServerIce::userDisconnected(const ::User *p) {
 	::MumbleServer::User mp;
 	userToUser(p, mp);
 
-	foreach (const ::MumbleServer::ServerCallbackPrx &prx, qmList) {
-		try {
-			prx->userDisconnected(mp);
-		} catch (...) {
-			badServerProxy(prx, s);
-		}
-	}
+	callServerCallbacks(s, [mp](const ::MumbleServer::ServerCallbackPrx &prx, const Ice::CallbackPtr &cb) {
+		return prx->begin_userDisconnected(mp, cb);
+	});
 }
 
 void MumbleServerIce::userStateChanged(const ::User *p) {
-	::Server *s = qobject_cast<::Server * >(sender());
+	::Server *s = signalingServer();
 
-	const QList<::MumbleServer::ServerCallbackPrx > &qmList = qmServerCallbacks[s->iServerNum];
+	const QList< ServerCallback > qmList = getServerCallbacks(s);
 
 	if (qmList.isEmpty())
 		return;
@@ -523,19 +658,18 @@ void MumbleServerIce::userStateChanged(const ::User *p) {
 	::MumbleServer::User mp;
 	userToUser(p, mp);
 
-	foreach (const ::MumbleServer::ServerCallbackPrx &prx, qmList) {
-		try {
-			prx->userStateChanged(mp);
-		} catch (...) {
-			badServerProxy(prx, s);
-		}
-	}
+	callServerCallbacks(
+		s,
+		[mp](const ::MumbleServer::ServerCallbackPrx &prx, const Ice::CallbackPtr &cb) {
+			return prx->begin_userStateChanged(mp, cb);
+		},
+		QString::fromLatin1("user/%1").arg(p->uiSession));
 }
 
 void MumbleServerIce::userTextMessage(const ::User *p, const ::TextMessage &message) {
-	::Server *s = qobject_cast<::Server * >(sender());
+	::Server *s = signalingServer();
 
-	const QList<::MumbleServer::ServerCallbackPrx > &qmList = qmServerCallbacks[s->iServerNum];
+	const QList< ServerCallback > qmList = getServerCallbacks(s);
 
 	if (qmList.isEmpty())
 		return;
@@ -546,19 +680,15 @@ void MumbleServerIce::userTextMessage(const ::User *p, const ::TextMessage &mess
 	::MumbleServer::TextMessage textMessage;
 	textmessageToTextmessage(message, textMessage);
 
-	foreach (const ::MumbleServer::ServerCallbackPrx &prx, qmList) {
-		try {
-			prx->userTextMessage(mp, textMessage);
-		} catch (...) {
-			badServerProxy(prx, s);
-		}
-	}
+	callServerCallbacks(s, [mp, textMessage](const ::MumbleServer::ServerCallbackPrx &prx, const Ice::CallbackPtr &cb) {
+		return prx->begin_userTextMessage(mp, textMessage, cb);
+	});
 }
 
 void MumbleServerIce::channelCreated(const ::Channel *c) {
-	::Server *s = qobject_cast<::Server * >(sender());
+	::Server *s = signalingServer();
 
-	const QList<::MumbleServer::ServerCallbackPrx > &qmList = qmServerCallbacks[s->iServerNum];
+	const QList< ServerCallback > qmList = getServerCallbacks(s);
 
 	if (qmList.isEmpty())
 		return;
@@ -566,19 +696,15 @@ void MumbleServerIce::channelCreated(const ::Channel *c) {
 	::MumbleServer::Channel mc;
 	channelToChannel(c, mc);
 
-	foreach (const ::MumbleServer::ServerCallbackPrx &prx, qmList) {
-		try {
-			prx->channelCreated(mc);
-		} catch (...) {
-			badServerProxy(prx, s);
-		}
-	}
+	callServerCallbacks(s, [mc](const ::MumbleServer::ServerCallbackPrx &prx, const Ice::CallbackPtr &cb) {
+		return prx->begin_channelCreated(mc, cb);
+	});
 }
 
 void MumbleServerIce::channelRemoved(const ::Channel *c) {
-	::Server *s = qobject_cast<::Server * >(sender());
+	::Server *s = signalingServer();
 
-	const QList<::MumbleServer::ServerCallbackPrx > &qmList = qmServerCallbacks[s->iServerNum];
+	const QList< ServerCallback > qmList = getServerCallbacks(s);
 
 	if (qmList.isEmpty())
 		return;
@@ -586,19 +712,15 @@ void MumbleServerIce::channelRemoved(const ::Channel *c) {
 	::MumbleServer::Channel mc;
 	channelToChannel(c, mc);
 
-	foreach (const ::MumbleServer::ServerCallbackPrx &prx, qmList) {
-		try {
-			prx->channelRemoved(mc);
-		} catch (...) {
-			badServerProxy(prx, s);
-		}
-	}
+	callServerCallbacks(s, [mc](const ::MumbleServer::ServerCallbackPrx &prx, const Ice::CallbackPtr &cb) {
+		return prx->begin_channelRemoved(mc, cb);
+	});
 }
 
 void MumbleServerIce::channelStateChanged(const ::Channel *c) {
-	::Server *s = qobject_cast<::Server * >(sender());
+	::Server *s = signalingServer();
 
-	const QList<::MumbleServer::ServerCallbackPrx > &qmList = qmServerCallbacks[s->iServerNum];
+	const QList< ServerCallback > qmList = getServerCallbacks(s);
 
 	if (qmList.isEmpty())
 		return;
@@ -606,32 +728,28 @@ void MumbleServerIce::channelStateChanged(const ::Channel *c) {
 	::MumbleServer::Channel mc;
 	channelToChannel(c, mc);
 
-	foreach (const ::MumbleServer::ServerCallbackPrx &prx, qmList) {
-		try {
-			prx->channelStateChanged(mc);
-		} catch (...) {
-			badServerProxy(prx, s);
-		}
-	}
+	callServerCallbacks(
+		s,
+		[mc](const ::MumbleServer::ServerCallbackPrx &prx, const Ice::CallbackPtr &cb) {
+			return prx->begin_channelStateChanged(mc, cb);
+		},
+		QString::fromLatin1("channel/%1").arg(c->iId));
 }
 
 void MumbleServerIce::contextAction(const ::User *pSrc, const QString &action, unsigned int session, int iChannel) {
-	::Server *s = qobject_cast<::Server * >(sender());
+	::Server *s = signalingServer();
 
-	QMap< int, QMap< int, QMap< QString, ::MumbleServer::ServerContextCallbackPrx > > > &qmAll =
-		qmServerContextCallbacks;
-	if (!qmAll.contains(s->iServerNum))
-		return;
-
-	QMap< int, QMap< QString, ::MumbleServer::ServerContextCallbackPrx > > &qmServer = qmAll[s->iServerNum];
+	const QMap< int, QMap< QString, ::MumbleServer::ServerContextCallbackPrx > > qmServer =
+		getServerContextCallbacks(s);
 	if (!qmServer.contains(static_cast< int >(pSrc->uiSession)))
 		return;
 
-	QMap< QString, ::MumbleServer::ServerContextCallbackPrx > &qmUser = qmServer[static_cast< int >(pSrc->uiSession)];
+	const QMap< QString, ::MumbleServer::ServerContextCallbackPrx > qmUser =
+		qmServer.value(static_cast< int >(pSrc->uiSession));
 	if (!qmUser.contains(action))
 		return;
 
-	const ::MumbleServer::ServerContextCallbackPrx &prx = qmUser[action];
+	const ::MumbleServer::ServerContextCallbackPrx prx = qmUser.value(action);
 
 	::MumbleServer::User mp;
 	userToUser(pSrc, mp);
@@ -656,7 +774,7 @@ void MumbleServerIce::contextAction(const ::User *pSrc, const QString &action, u
 }
 
 void MumbleServerIce::idToNameSlot(QString &name, int id) {
-	::Server *server = qobject_cast<::Server * >(sender());
+	::Server *server = signalingServer();
 
 	const ServerAuthenticatorPrx prx = getServerAuthenticator(server);
 	try {
@@ -666,7 +784,7 @@ void MumbleServerIce::idToNameSlot(QString &name, int id) {
 	}
 }
 void MumbleServerIce::idToTextureSlot(QByteArray &qba, int id) {
-	::Server *server = qobject_cast<::Server * >(sender());
+	::Server *server = signalingServer();
 
 	const ServerAuthenticatorPrx prx = getServerAuthenticator(server);
 	try {
@@ -682,7 +800,7 @@ void MumbleServerIce::idToTextureSlot(QByteArray &qba, int id) {
 }
 
 void MumbleServerIce::nameToIdSlot(int &id, const QString &name) {
-	::Server *server = qobject_cast<::Server * >(sender());
+	::Server *server = signalingServer();
 
 	const ServerAuthenticatorPrx prx = getServerAuthenticator(server);
 	try {
@@ -692,10 +810,10 @@ void MumbleServerIce::nameToIdSlot(int &id, const QString &name) {
 	}
 }
 
-void MumbleServerIce::authenticateSlot(int &res, QString &uname, int sessionId,
-									   const QList< QSslCertificate > &certlist, const QString &certhash,
-									   bool certstrong, const QString &pw) {
-	::Server *server = qobject_cast<::Server * >(sender());
+void MumbleServerIce::authenticateSlot(int &res, QString &uname, int, const QList< QSslCertificate > &certlist,
+									   const QString &certhash, bool certstrong, const QString &pw,
+									   QStringList &groupNames) {
+	::Server *server = signalingServer();
 
 	const ServerAuthenticatorPrx prx = getServerAuthenticator(server);
 	::std::string newname;
@@ -722,15 +840,13 @@ void MumbleServerIce::authenticateSlot(int &res, QString &uname, int sessionId,
 	if (res >= 0) {
 		if (newname.length() > 0)
 			uname = u8(newname);
-		QStringList qsl;
-		foreach (const ::std::string &str, groups) { qsl << u8(str); }
-		if (!qsl.isEmpty())
-			server->setTempGroups(res, sessionId, nullptr, qsl);
+		// This may be called by an authentication thread, so the Server applies the groups itself
+		foreach (const ::std::string &str, groups) { groupNames << u8(str); }
 	}
 }
 
 void MumbleServerIce::registerUserSlot(int &res, const QMap< int, QString > &info) {
-	::Server *server = qobject_cast<::Server * >(sender());
+	::Server *server = signalingServer();
 
 	const ServerUpdatingAuthenticatorPrx prx = getServerUpdatingAuthenticator(server);
 	if (!prx)
@@ -747,7 +863,7 @@ void MumbleServerIce::registerUserSlot(int &res, const QMap< int, QString > &inf
 }
 
 void MumbleServerIce::unregisterUserSlot(int &res, int id) {
-	::Server *server = qobject_cast<::Server * >(sender());
+	::Server *server = signalingServer();
 
 	const ServerUpdatingAuthenticatorPrx prx = getServerUpdatingAuthenticator(server);
 	if (!prx)
@@ -760,7 +876,7 @@ void MumbleServerIce::unregisterUserSlot(int &res, int id) {
 }
 
 void MumbleServerIce::getRegistrationSlot(int &res, int id, QMap< int, QString > &info) {
-	::Server *server = qobject_cast<::Server * >(sender());
+	::Server *server = signalingServer();
 
 	const ServerUpdatingAuthenticatorPrx prx = getServerUpdatingAuthenticator(server);
 	if (!prx)
@@ -779,7 +895,7 @@ void MumbleServerIce::getRegistrationSlot(int &res, int id, QMap< int, QString >
 }
 
 void MumbleServerIce::getRegisteredUsersSlot(const QString &filter, QMap< int, QString > &m) {
-	::Server *server = qobject_cast<::Server * >(sender());
+	::Server *server = signalingServer();
 
 	const ServerUpdatingAuthenticatorPrx prx = getServerUpdatingAuthenticator(server);
 	if (!prx)
@@ -799,7 +915,7 @@ void MumbleServerIce::getRegisteredUsersSlot(const QString &filter, QMap< int, Q
 }
 
 void MumbleServerIce::setInfoSlot(int &res, int id, const QMap< int, QString > &info) {
-	::Server *server = qobject_cast<::Server * >(sender());
+	::Server *server = signalingServer();
 
 	const ServerUpdatingAuthenticatorPrx prx = getServerUpdatingAuthenticator(server);
 	if (!prx)
@@ -816,7 +932,7 @@ void MumbleServerIce::setInfoSlot(int &res, int id, const QMap< int, QString > &
 }
 
 void MumbleServerIce::setTextureSlot(int &res, int id, const QByteArray &texture) {
-	::Server *server = qobject_cast<::Server * >(sender());
+	::Server *server = signalingServer();
 
 	const ServerUpdatingAuthenticatorPrx prx = getServerUpdatingAuthenticator(server);
 	if (!prx)
@@ -839,7 +955,24 @@ Ice::ObjectPtr ServerLocator::locate(const Ice::Current &, Ice::LocalObjectPtr &
 	return iopServer;
 }
 
-#define FIND_SERVER ::Server *server = meta->qhServers.value(server_id);
+/// @returns The booted virtual server with the given ID or nullptr. On the control thread of a virtual server, only
+/// 	that server is returned, as the others are used by their own threads.
+static ::Server *findServer(int server_id) {
+	::Server *server = ControlThread::currentServer();
+	if (server) {
+		return server->iServerNum == server_id ? server : nullptr;
+	}
+
+	return meta->qhServers.value(server_id);
+}
+
+/// Runs an RPC call referring to the given virtual server on the thread the server lives on (see the controlthreads
+/// setting). Called on the main thread.
+static void runOnServerThread(int server_id, const boost::function< void() > &call) {
+	ControlThread::runFor(meta->qhControlThreads, server_id, call);
+}
+
+#define FIND_SERVER ::Server *server = findServer(server_id);
 
 #define NEED_SERVER_EXISTS                                                     \
 	FIND_SERVER                                                                \
@@ -1007,7 +1140,7 @@ static void impl_Server_setConf(const ::MumbleServer::AMD_Server_setConfPtr cb,
 	QString v = u8(value);
 	ServerDB::setConf(server_id, k, v);
 	if (server) {
-		QWriteLocker wl(&server->qrwlVoiceThread);
+		VoiceThreadWriteLocker wl(server);
 		server->setLiveConf(k, v);
 	}
 	cb->ice_response();
@@ -1045,6 +1178,15 @@ static void impl_Server_getLogLen(const ::MumbleServer::AMD_Server_getLogLenPtr
 	cb->ice_response(len);
 }
 
+#define ACCESS_Server_getLogIndex_READ
+static void impl_Server_getLogIndex(const ::MumbleServer::AMD_Server_getLogIndexPtr cb, int server_id,
+									::Ice::Int timestamp) {
+	NEED_SERVER_EXISTS;
+
+	int index = ServerDB::getLogIndex(server_id, timestamp);
+	cb->ice_response(index);
+}
+
 #define ACCESS_Server_getUsers_READ
 static void impl_Server_getUsers(const ::MumbleServer::AMD_Server_getUsersPtr cb, int server_id) {
 	NEED_SERVER;
@@ -1144,7 +1286,7 @@ static void impl_Server_setBans(const ::MumbleServer::AMD_Server_setBansPtr cb,
 								const ::MumbleServer::BanList &bans) {
 	NEED_SERVER;
 	{
-		QWriteLocker wl(&server->qrwlVoiceThread);
+		VoiceThreadWriteLocker wl(server);
 		server->qlBans.clear();
 		foreach (const ::MumbleServer::Ban &mb, bans) {
 			::Ban ban;
@@ -1460,11 +1602,13 @@ static void impl_Server_setACL(const ::MumbleServer::AMD_Server_setACLPtr cb, in
 	NEED_CHANNEL;
 
 	{
-		QWriteLocker locker(&server->qrwlVoiceThread);
+		VoiceThreadWriteLocker locker(server);
 
 		::Group *g;
 		ChanACL *acl;
 
+		server->discardChannelACLs(channel);
+
 		QHash< QString, QSet< int > > hOldTemp;
 		foreach (g, channel->qhGroups) {
 			hOldTemp.insert(g->qsName, g->qsTemporary);
@@ -1500,7 +1644,7 @@ static void impl_Server_setACL(const ::MumbleServer::AMD_Server_setACLPtr cb, in
 		}
 	}
 
-	server->clearACLCache();
+	server->clearChannelACLCache(channel);
 	server->updateChannel(channel);
 	cb->ice_response();
 }
@@ -1664,7 +1808,7 @@ static void impl_Server_setTexture(const ::MumbleServer::AMD_Server_setTexturePt
 		if (user) {
 			MumbleProto::UserState mpus;
 			mpus.set_session(user->uiSession);
-			mpus.set_texture(blob(user->qbaTexture));
+			mpus.set_texture(blob(user->texture()));
 
 			server->sendAll(mpus, Version::fromComponents(1, 2, 2), Version::CompareMode::LessThan);
 			if (!user->qbaTextureHash.isEmpty()) {
@@ -1724,7 +1868,7 @@ static void impl_Server_updateCertificate(const ::MumbleServer::AMD_Server_updat
 	server->setConf("key", u8(privateKey));
 	server->setConf("passphrase", u8(passphrase));
 	{
-		QWriteLocker wl(&server->qrwlVoiceThread);
+		VoiceThreadWriteLocker wl(server);
 		server->initializeCert();
 	}
 
@@ -1834,16 +1978,22 @@ static void impl_Server_addUserToGroup(const ::MumbleServer::AMD_Server_addUserT
 		return;
 	}
 
+	bool groupAdded = false;
+
 	{
-		QWriteLocker wl(&server->qrwlVoiceThread);
+		VoiceThreadWriteLocker wl(server);
 
 		::Group *g = channel->qhGroups.value(qsgroup);
-		if (!g)
-			g = new ::Group(channel, qsgroup);
+		if (!g) {
+			g          = new ::Group(channel, qsgroup);
+			groupAdded = true;
+		}
 
 		g->qsTemporary.insert(-session);
 	}
 
+	if (groupAdded)
+		server->clearChannelACLCache(channel);
 	server->clearACLCache(user);
 
 	cb->ice_response();
@@ -1861,16 +2011,22 @@ static void impl_Server_removeUserFromGroup(const ::MumbleServer::AMD_Server_rem
 		return;
 	}
 
+	bool groupAdded = false;
+
 	{
-		QWriteLocker qrwl(&server->qrwlVoiceThread);
+		VoiceThreadWriteLocker qrwl(server);
 
 		::Group *g = channel->qhGroups.value(qsgroup);
-		if (!g)
-			g = new ::Group(channel, qsgroup);
+		if (!g) {
+			g          = new ::Group(channel, qsgroup);
+			groupAdded = true;
+		}
 
 		g->qsTemporary.remove(-session);
 	}
 
+	if (groupAdded)
+		server->clearChannelACLCache(channel);
 	server->clearACLCache(user);
 
 	cb->ice_response();
@@ -1886,7 +2042,7 @@ static void impl_Server_redirectWhisperGroup(const ::MumbleServer::AMD_Server_re
 	QString qstarget = u8(target);
 
 	{
-		QWriteLocker wl(&server->qrwlVoiceThread);
+		VoiceThreadWriteLocker wl(server);
 
 		if (qstarget.isEmpty())
 			user->qmWhisperRedirect.remove(qssource);
@@ -2002,6 +2158,7 @@ static void impl_Meta_getUptime(const ::MumbleServer::AMD_Meta_getUptimePtr cb,
 #undef ACCESS_Server_getAllConf_READ
 #undef ACCESS_Server_getLog_READ
 #undef ACCESS_Server_getLogLen_READ
+#undef ACCESS_Server_getLogIndex_READ
 #undef ACCESS_Server_getUsers_READ
 #undef ACCESS_Server_getChannels_READ
 #undef ACCESS_Server_getTree_READ
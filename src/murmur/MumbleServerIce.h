@@ -17,11 +17,18 @@
 #include <QtCore/QMap>
 #include <QtCore/QMutex>
 #include <QtCore/QObject>
+#include <QtCore/QRecursiveMutex>
 #include <QtCore/QWaitCondition>
 #include <QtNetwork/QSslCertificate>
 
+#include "CallbackQueue.h"
 #include "MumbleServerI.h"
 
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
 class Channel;
 class Server;
 class User;
@@ -31,6 +38,16 @@ class MumbleServerIce : public QObject {
 	friend class MurmurLocker;
 	Q_OBJECT
 
+public:
+	/// A registered ServerCallback along with the queue its calls are delivered by
+	struct ServerCallback {
+		::MumbleServer::ServerCallbackPrx prx;
+		std::shared_ptr< CallbackQueue > queue;
+	};
+	/// Starts an asynchronous call of the given callback
+	using ServerCallbackCall =
+		std::function< Ice::AsyncResultPtr(const ::MumbleServer::ServerCallbackPrx &, const Ice::CallbackPtr &) >;
+
 protected:
 	int count;
 	QMutex qmEvent;
@@ -39,8 +56,15 @@ protected:
 	void badMetaProxy(const ::MumbleServer::MetaCallbackPrx &prx);
 	void badServerProxy(const ::MumbleServer::ServerCallbackPrx &prx, const ::Server *server);
 	void badAuthenticator(::Server *);
+	/// @returns The Server that emitted the signal currently being handled
+	::Server *signalingServer() const;
 	QList<::MumbleServer::MetaCallbackPrx > qlMetaCallbacks;
-	QMap< int, QList<::MumbleServer::ServerCallbackPrx > > qmServerCallbacks;
+	/// Protects the maps below, which are used by the threads of all virtual servers (see the controlthreads
+	/// setting). qlMetaCallbacks is only ever used by the main thread.
+	mutable QRecursiveMutex qrmServerMaps;
+	QMap< int, QList< ServerCallback > > qmServerCallbacks;
+	/// The counters of the callbacks that have been removed from a server
+	QMap< int, CallbackQueueMetrics > qmRemovedCallbackMetrics;
 	QMap< int, QMap< int, QMap< QString, ::MumbleServer::ServerContextCallbackPrx > > > qmServerContextCallbacks;
 	QMap< int, ::MumbleServer::ServerAuthenticatorPrx > qmServerAuthenticator;
 	QMap< int, ::MumbleServer::ServerUpdatingAuthenticatorPrx > qmServerUpdatingAuthenticator;
@@ -56,6 +80,13 @@ public:
 	void addServerCallback(const ::Server *server, const ::MumbleServer::ServerCallbackPrx &prx);
 	void removeServerCallback(const ::Server *server, const ::MumbleServer::ServerCallbackPrx &prx);
 	void removeServerCallbacks(const ::Server *server);
+	const QList< ServerCallback > getServerCallbacks(const ::Server *server) const;
+	/// Queues the given call for every ServerCallback of the given server (see CallbackQueue) and removes the
+	/// callbacks that failed or stayed behind
+	/// @param key Identifies the user or channel the call is about if only the latest of these calls matters
+	void callServerCallbacks(const ::Server *server, const ServerCallbackCall &call, const QString &key = QString());
+	/// @returns The metrics of the ServerCallbacks of every server
+	std::vector< std::pair< int, CallbackQueueMetrics > > serverCallbackMetrics() const;
 	void addServerContextCallback(const ::Server *server, int session_id, const QString &action,
 								  const ::MumbleServer::ServerContextCallbackPrx &prx);
 	const QMap< int, QMap< QString, ::MumbleServer::ServerContextCallbackPrx > >
@@ -74,7 +105,7 @@ public slots:
 	void stopped(Server *);
 
 	void authenticateSlot(int &res, QString &uname, int sessionId, const QList< QSslCertificate > &certlist,
-						  const QString &certhash, bool certstrong, const QString &pw);
+						  const QString &certhash, bool certstrong, const QString &pw, QStringList &groupNames);
 	void registerUserSlot(int &res, const QMap< int, QString > &);
 	void unregisterUserSlot(int &res, int id);
 	void getRegisteredUsersSlot(const QString &filter, QMap< int, QString > &res);
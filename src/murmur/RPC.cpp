@@ -50,7 +50,7 @@ void Server::setUserState(User *pUser, Channel *cChannel, bool mute, bool deaf,
 		changed = true;
 		mpus.set_priority_speaker(prioritySpeaker);
 	}
-	if (comment != pUser->qsComment) {
+	if (comment != pUser->comment()) {
 		changed = true;
 		mpus.set_comment(u8(comment));
 		if (pUser->iId >= 0) {
@@ -65,7 +65,7 @@ void Server::setUserState(User *pUser, Channel *cChannel, bool mute, bool deaf,
 	}
 
 	{
-		QWriteLocker wl(&qrwlVoiceThread);
+		VoiceThreadWriteLocker wl(this);
 		pUser->bDeaf     = deaf;
 		pUser->bMute     = mute;
 		pUser->bSuppress = suppressed;
@@ -73,7 +73,7 @@ void Server::setUserState(User *pUser, Channel *cChannel, bool mute, bool deaf,
 
 	pUser->bPrioritySpeaker = prioritySpeaker;
 	pUser->qsName           = name;
-	hashAssign(pUser->qsComment, pUser->qbaCommentHash, comment);
+	hashAssign(pUser->qsComment, pUser->qbaCommentHash, pUser->m_commentBlob, comment);
 
 	if (cChannel != pUser->cChannel) {
 		changed = true;
@@ -121,11 +121,14 @@ bool Server::setChannelState(Channel *cChannel, Channel *cParent, const QString
 		}
 
 		{
-			QWriteLocker wl(&qrwlVoiceThread);
+			VoiceThreadWriteLocker wl(this);
 			cChannel->cParent->removeChannel(cChannel);
 			cParent->addChannel(cChannel);
 		}
 
+		// The permissions in the moved channels and of the users in them ("sub") depend on the channel tree
+		clearACLCache();
+
 		mpcs.set_parent(cParent->iId);
 
 		updated = true;
@@ -161,10 +164,10 @@ bool Server::setChannelState(Channel *cChannel, Channel *cParent, const QString
 		mpcs.set_position(position);
 	}
 
-	if (!desc.isNull() && desc != cChannel->qsDesc) {
+	if (!desc.isNull() && desc != cChannel->description()) {
 		updated = true;
 		changed = true;
-		hashAssign(cChannel->qsDesc, cChannel->qbaDescHash, desc);
+		hashAssign(cChannel->qsDesc, cChannel->qbaDescHash, cChannel->m_descriptionBlob, desc);
 		mpcs.set_description(u8(desc));
 	}
 
@@ -227,8 +230,10 @@ void Server::setTempGroups(int userid, int sessionId, Channel *cChannel, const Q
 	if (!cChannel)
 		cChannel = qhChannels.value(0);
 
+	bool groupAdded = false;
+
 	{
-		QWriteLocker wl(&qrwlVoiceThread);
+		VoiceThreadWriteLocker wl(this);
 
 		Group *g;
 		foreach (g, cChannel->qhGroups) {
@@ -241,7 +246,8 @@ void Server::setTempGroups(int userid, int sessionId, Channel *cChannel, const Q
 		foreach (gname, groups) {
 			g = cChannel->qhGroups.value(gname);
 			if (!g) {
-				g = new Group(cChannel, gname);
+				g          = new Group(cChannel, gname);
+				groupAdded = true;
 			}
 			g->qsTemporary.insert(userid);
 			if (sessionId != 0)
@@ -249,6 +255,11 @@ void Server::setTempGroups(int userid, int sessionId, Channel *cChannel, const Q
 		}
 	}
 
+	if (groupAdded) {
+		// The new group hides inherited groups of the same name
+		clearChannelACLCache(cChannel);
+	}
+
 	if (userid >= 0) {
 		User *p = qhUsers.value(static_cast< unsigned int >(userid));
 		if (p)
@@ -268,7 +279,7 @@ void Server::clearTempGroups(User *user, Channel *cChannel, bool recurse) {
 	qlChans.append(cChannel);
 
 	{
-		QWriteLocker wl(&qrwlVoiceThread);
+		VoiceThreadWriteLocker wl(this);
 
 		while (!qlChans.isEmpty()) {
 			Channel *chan = qlChans.takeLast();
@@ -287,26 +298,32 @@ void Server::clearTempGroups(User *user, Channel *cChannel, bool recurse) {
 }
 
 void Server::connectAuthenticator(QObject *obj) {
+	// The slots return their results through reference arguments, so they have to be called directly even if the
+	// Server lives on its own control thread
 	connect(this, SIGNAL(registerUserSig(int &, const QMap< int, QString > &)), obj,
-			SLOT(registerUserSlot(int &, const QMap< int, QString > &)));
-	connect(this, SIGNAL(unregisterUserSig(int &, int)), obj, SLOT(unregisterUserSlot(int &, int)));
+			SLOT(registerUserSlot(int &, const QMap< int, QString > &)), Qt::DirectConnection);
+	connect(this, SIGNAL(unregisterUserSig(int &, int)), obj,
+			SLOT(unregisterUserSlot(int &, int)), Qt::DirectConnection);
 	connect(this, SIGNAL(getRegisteredUsersSig(const QString &, QMap< int, QString > &)), obj,
-			SLOT(getRegisteredUsersSlot(const QString &, QMap< int, QString > &)));
+			SLOT(getRegisteredUsersSlot(const QString &, QMap< int, QString > &)), Qt::DirectConnection);
 	connect(this, SIGNAL(getRegistrationSig(int &, int, QMap< int, QString > &)), obj,
-			SLOT(getRegistrationSlot(int &, int, QMap< int, QString > &)));
+			SLOT(getRegistrationSlot(int &, int, QMap< int, QString > &)), Qt::DirectConnection);
 	connect(this,
 			SIGNAL(authenticateSig(int &, QString &, int, const QList< QSslCertificate > &, const QString &, bool,
-								   const QString &)),
+								   const QString &, QStringList &)),
 			obj,
 			SLOT(authenticateSlot(int &, QString &, int, const QList< QSslCertificate > &, const QString &, bool,
-								  const QString &)));
+								  const QString &, QStringList &)),
+			Qt::DirectConnection);
 	connect(this, SIGNAL(setInfoSig(int &, int, const QMap< int, QString > &)), obj,
-			SLOT(setInfoSlot(int &, int, const QMap< int, QString > &)));
+			SLOT(setInfoSlot(int &, int, const QMap< int, QString > &)), Qt::DirectConnection);
 	connect(this, SIGNAL(setTextureSig(int &, int, const QByteArray &)), obj,
-			SLOT(setTextureSlot(int &, int, const QByteArray &)));
-	connect(this, SIGNAL(idToNameSig(QString &, int)), obj, SLOT(idToNameSlot(QString &, int)));
-	connect(this, SIGNAL(nameToIdSig(int &, const QString &)), obj, SLOT(nameToIdSlot(int &, const QString &)));
-	connect(this, SIGNAL(idToTextureSig(QByteArray &, int)), obj, SLOT(idToTextureSlot(QByteArray &, int)));
+			SLOT(setTextureSlot(int &, int, const QByteArray &)), Qt::DirectConnection);
+	connect(this, SIGNAL(idToNameSig(QString &, int)), obj, SLOT(idToNameSlot(QString &, int)), Qt::DirectConnection);
+	connect(this, SIGNAL(nameToIdSig(int &, const QString &)), obj,
+			SLOT(nameToIdSlot(int &, const QString &)), Qt::DirectConnection);
+	connect(this, SIGNAL(idToTextureSig(QByteArray &, int)), obj,
+			SLOT(idToTextureSlot(QByteArray &, int)), Qt::DirectConnection);
 }
 
 void Server::disconnectAuthenticator(QObject *obj) {
@@ -319,10 +336,10 @@ void Server::disconnectAuthenticator(QObject *obj) {
 			   SLOT(getRegistrationSlot(int &, int, QMap< int, QString > &)));
 	disconnect(this,
 			   SIGNAL(authenticateSig(int &, QString &, int, const QList< QSslCertificate > &, const QString &, bool,
-									  const QString &)),
+									  const QString &, QStringList &)),
 			   obj,
 			   SLOT(authenticateSlot(int &, QString &, int, const QList< QSslCertificate > &, const QString &, bool,
-									 const QString &)));
+									 const QString &, QStringList &)));
 	disconnect(this, SIGNAL(setInfoSig(int &, int, const QMap< int, QString > &)), obj,
 			   SLOT(setInfoSlot(int &, int, const QMap< int, QString > &)));
 	disconnect(this, SIGNAL(setTextureSig(int &, int, const QByteArray &)), obj,
@@ -333,14 +350,21 @@ void Server::disconnectAuthenticator(QObject *obj) {
 }
 
 void Server::connectListener(QObject *obj) {
-	connect(this, SIGNAL(userStateChanged(const User *)), obj, SLOT(userStateChanged(const User *)));
+	// Called directly on the thread of the Server, as the pointers passed along may be gone by the time a queued call
+	// would be delivered
+	connect(this, SIGNAL(userStateChanged(const User *)), obj,
+			SLOT(userStateChanged(const User *)), Qt::DirectConnection);
 	connect(this, SIGNAL(userTextMessage(const User *, const TextMessage &)), obj,
-			SLOT(userTextMessage(const User *, const TextMessage &)));
-	connect(this, SIGNAL(userConnected(const User *)), obj, SLOT(userConnected(const User *)));
-	connect(this, SIGNAL(userDisconnected(const User *)), obj, SLOT(userDisconnected(const User *)));
-	connect(this, SIGNAL(channelStateChanged(const Channel *)), obj, SLOT(channelStateChanged(const Channel *)));
-	connect(this, SIGNAL(channelCreated(const Channel *)), obj, SLOT(channelCreated(const Channel *)));
-	connect(this, SIGNAL(channelRemoved(const Channel *)), obj, SLOT(channelRemoved(const Channel *)));
+			SLOT(userTextMessage(const User *, const TextMessage &)), Qt::DirectConnection);
+	connect(this, SIGNAL(userConnected(const User *)), obj, SLOT(userConnected(const User *)), Qt::DirectConnection);
+	connect(this, SIGNAL(userDisconnected(const User *)), obj,
+			SLOT(userDisconnected(const User *)), Qt::DirectConnection);
+	connect(this, SIGNAL(channelStateChanged(const Channel *)), obj,
+			SLOT(channelStateChanged(const Channel *)), Qt::DirectConnection);
+	connect(this, SIGNAL(channelCreated(const Channel *)), obj,
+			SLOT(channelCreated(const Channel *)), Qt::DirectConnection);
+	connect(this, SIGNAL(channelRemoved(const Channel *)), obj,
+			SLOT(channelRemoved(const Channel *)), Qt::DirectConnection);
 }
 
 void Server::disconnectListener(QObject *obj) {
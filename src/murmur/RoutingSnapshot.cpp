@@ -0,0 +1,175 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "RoutingSnapshot.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <map>
+
+const RoutingSnapshot::UserEntry *RoutingSnapshot::findUser(unsigned int session) const {
+	auto it = users.find(session);
+
+	return it != users.end() ? &it->second : nullptr;
+}
+
+const RoutingSnapshot::ChannelEntry *RoutingSnapshot::findChannel(unsigned int id) const {
+	auto it = channels.find(id);
+
+	return it != channels.end() ? &it->second : nullptr;
+}
+
+void RoutingSnapshot::buildFanOuts() {
+	// The channels a speaker's audio is routed to (the own channel first, followed by the linked ones) identify the
+	// fan-out
+	std::map< std::vector< unsigned int >, const FanOut * > fanOutsByChannels;
+	std::unordered_map< const UserEntry *, std::size_t > receiverIndices;
+
+	for (auto &current : users) {
+		UserEntry &speaker = current.second;
+
+		const ChannelEntry *channel = findChannel(speaker.channel);
+		if (!speaker.canSpeak || !channel) {
+			speaker.fanOut = nullptr;
+			continue;
+		}
+
+		std::vector< const ChannelEntry * > routedChannels = { channel };
+		routedChannels.insert(routedChannels.end(), speaker.speakLinks.begin(), speaker.speakLinks.end());
+
+		std::vector< unsigned int > key;
+		key.reserve(routedChannels.size());
+		for (const ChannelEntry *routed : routedChannels) {
+			key.push_back(routed->id);
+		}
+		std::sort(key.begin() + 1, key.end());
+
+		auto it = fanOutsByChannels.find(key);
+		if (it != fanOutsByChannels.end()) {
+			speaker.fanOut = it->second;
+			continue;
+		}
+
+		std::unique_ptr< FanOut > fanOut = std::make_unique< FanOut >();
+		receiverIndices.clear();
+
+		auto addReceiver = [&](const UserEntry *receiver, Mumble::Protocol::audio_context_t context,
+							   const VolumeAdjustment &volumeAdjustment) {
+			auto index = receiverIndices.find(receiver);
+
+			if (index == receiverIndices.end()) {
+				receiverIndices[receiver] = fanOut->receivers.size();
+				fanOut->receivers.push_back({ receiver, context, volumeAdjustment });
+			} else {
+				FanOutEntry &entry = fanOut->receivers[index->second];
+
+				entry.context = std::min(entry.context, context);
+				if (entry.volumeAdjustment.factor < volumeAdjustment.factor) {
+					entry.volumeAdjustment = volumeAdjustment;
+				}
+			}
+		};
+
+		for (const ChannelEntry *routed : routedChannels) {
+			for (const ListenerEntry &listener : routed->listeners) {
+				addReceiver(listener.user, Mumble::Protocol::AudioContext::LISTEN, listener.volumeAdjustment);
+			}
+			for (const UserEntry *member : routed->members) {
+				addReceiver(member, Mumble::Protocol::AudioContext::NORMAL, VolumeAdjustment::fromFactor(1.0f));
+			}
+		}
+
+		speaker.fanOut = fanOut.get();
+		fanOutsByChannels.emplace(std::move(key), fanOut.get());
+		fanOuts.push_back(std::move(fanOut));
+	}
+}
+
+
+RoutingTable::ReadGuard::ReadGuard(RoutingTable &table, unsigned int readerIndex)
+	: m_slot(table.m_readers[readerIndex].epoch) {
+	assert(readerIndex < MAX_READERS);
+	assert(m_slot.load(std::memory_order_relaxed) == 0);
+
+	// The announcement has to be visible to the writer before we load the snapshot pointer (store-load ordering),
+	// which is why both operations are sequentially consistent. Either the writer sees our slot when checking for
+	// active readers, or we see the pointer the writer has swapped in before checking.
+	m_slot.store(table.m_epoch.load(std::memory_order_acquire), std::memory_order_seq_cst);
+	m_snapshot = table.m_current.load(std::memory_order_seq_cst);
+}
+
+RoutingTable::ReadGuard::~ReadGuard() {
+	m_slot.store(0, std::memory_order_release);
+}
+
+
+RoutingTable::RoutingTable() : m_current(new RoutingSnapshot()) {
+}
+
+RoutingTable::~RoutingTable() {
+	delete m_current.load();
+
+	for (RetiredEntry &entry : m_retired) {
+		entry.disposal();
+	}
+	for (std::function< void() > &disposal : m_pending) {
+		disposal();
+	}
+}
+
+const RoutingSnapshot &RoutingTable::current() const {
+	return *m_current.load(std::memory_order_relaxed);
+}
+
+void RoutingTable::publish(std::unique_ptr< RoutingSnapshot > snapshot) {
+	snapshot->version = m_nextVersion++;
+
+	const RoutingSnapshot *previous = m_current.exchange(snapshot.release(), std::memory_order_seq_cst);
+
+	// Readers entering from now on can only see the new snapshot. Everything that has been unlinked so far can only be
+	// seen by readers that entered in an epoch up to and including the current one.
+	const std::uint64_t epoch = m_epoch.fetch_add(1, std::memory_order_seq_cst);
+
+	m_retired.push_back({ epoch, [previous]() { delete previous; } });
+	for (std::function< void() > &disposal : m_pending) {
+		m_retired.push_back({ epoch, std::move(disposal) });
+	}
+	m_pending.clear();
+
+	reclaim();
+}
+
+void RoutingTable::retire(std::function< void() > disposal) {
+	m_pending.push_back(std::move(disposal));
+}
+
+bool RoutingTable::reclaim() {
+	const std::uint64_t oldest = oldestActiveEpoch();
+
+	while (!m_retired.empty() && m_retired.front().epoch < oldest) {
+		// Move the entry out first, as the disposal might (indirectly) call back into this table
+		std::function< void() > disposal = std::move(m_retired.front().disposal);
+		m_retired.pop_front();
+
+		disposal();
+	}
+
+	return !m_retired.empty() || !m_pending.empty();
+}
+
+std::uint64_t RoutingTable::oldestActiveEpoch() const {
+	std::uint64_t oldest = std::numeric_limits< std::uint64_t >::max();
+
+	for (const ReaderSlot &reader : m_readers) {
+		const std::uint64_t epoch = reader.epoch.load(std::memory_order_seq_cst);
+
+		if (epoch != 0 && epoch < oldest) {
+			oldest = epoch;
+		}
+	}
+
+	return oldest;
+}
@@ -0,0 +1,189 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_ROUTINGSNAPSHOT_H_
+#define MUMBLE_MURMUR_ROUTINGSNAPSHOT_H_
+
+#include "HostAddress.h"
+#include "MumbleProtocol.h"
+#include "VolumeAdjustment.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QPair>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class ServerUser;
+
+/// An immutable copy of everything the voice threads need in order to route regular speech: which users exist,
+/// which channel they are in, who is listening to which channel and into which linked channels a user may speak.
+/// A snapshot is built by the main thread, published through a RoutingTable and never modified afterwards, which
+/// is why it can be read without holding any lock.
+struct RoutingSnapshot {
+	struct ChannelEntry;
+	struct FanOut;
+
+	struct UserEntry {
+		ServerUser *user;
+		unsigned int session;
+		unsigned int channel;
+		/// Whether the user's audio may be forwarded at all (authenticated and neither muted nor suppressed)
+		bool canSpeak;
+		/// Whether the user is (self-)deafened and therefore must not receive any audio
+		bool deaf;
+		/// The user's positional audio context
+		std::string context;
+		/// The channels linked to the user's channel in which the user has Speak permission (excluding the
+		/// user's own channel)
+		std::vector< const ChannelEntry * > speakLinks;
+		/// Everyone receiving the user's regular speech or nullptr if the user can't speak (see buildFanOuts)
+		const FanOut *fanOut = nullptr;
+	};
+
+	struct ListenerEntry {
+		const UserEntry *user;
+		VolumeAdjustment volumeAdjustment;
+	};
+
+	struct ChannelEntry {
+		unsigned int id;
+		/// The users in this channel that are not deafened
+		std::vector< const UserEntry * > members;
+		/// The users listening to this channel that are not deafened
+		std::vector< ListenerEntry > listeners;
+	};
+
+	struct FanOutEntry {
+		const UserEntry *user;
+		Mumble::Protocol::audio_context_t context;
+		VolumeAdjustment volumeAdjustment;
+	};
+
+	/// The receivers of regular speech spoken in a given channel by users with the same set of linked channels they
+	/// may speak into: the members and listeners of all these channels. Every receiver is contained exactly once (with
+	/// the entries merged the same way AudioReceiverBuffer merges duplicates) and the speaker has to be skipped.
+	struct FanOut {
+		std::vector< FanOutEntry > receivers;
+	};
+
+	RoutingSnapshot()                        = default;
+	RoutingSnapshot(const RoutingSnapshot &) = delete;
+	RoutingSnapshot &operator=(const RoutingSnapshot &) = delete;
+
+	/// Increases with every snapshot published by the same RoutingTable
+	std::uint64_t version = 0;
+	/// The amount of connected users, not counting bots (as reported in pings)
+	unsigned int userCount = 0;
+
+	/// Maps session IDs to users. Entries (and thus pointers to them) stay valid for the snapshot's lifetime.
+	std::unordered_map< unsigned int, UserEntry > users;
+	/// Maps channel IDs to channels. Entries (and thus pointers to them) stay valid for the snapshot's lifetime.
+	std::unordered_map< unsigned int, ChannelEntry > channels;
+	/// A (shallow) copy of Server::qhPeerUsers at the time the snapshot was built
+	QHash< QPair< HostAddress, quint16 >, ServerUser * > peers;
+	/// The fan-outs referenced by the users (usually one per channel in which someone may speak)
+	std::vector< std::unique_ptr< FanOut > > fanOuts;
+
+	const UserEntry *findUser(unsigned int session) const;
+	const ChannelEntry *findChannel(unsigned int id) const;
+
+	/// Computes the fan-out of every user that can speak, based on the users, channels and speakLinks. Users sharing
+	/// the same channel and speakLinks share the same fan-out. Has to be called after everything else has been set
+	/// up and before the snapshot gets published.
+	void buildFanOuts();
+};
+
+/// Publishes RoutingSnapshots from a single writer thread (the main thread) to a fixed set of reader threads (the
+/// voice threads) using epoch-based reclamation.
+///
+/// A reader announces the epoch it entered in its own slot before loading the current snapshot and clears the
+/// slot once it is done. Objects that have been unlinked by the writer are retired together with the epoch at which
+/// they became unreachable and are only destroyed once no reader is left that entered at or before that epoch.
+/// Readers therefore never block and never wait for the writer.
+///
+/// Besides the snapshots themselves, any other object that readers may reach through a snapshot (e.g. the
+/// ServerUser objects) must be disposed of via retire().
+class RoutingTable {
+public:
+	/// The maximum number of concurrent reader threads
+	static constexpr const unsigned int MAX_READERS = 64;
+
+	/// Keeps the snapshot that was current when the guard was created alive for as long as the guard exists.
+	/// Every reader thread must only ever hold a single guard at a time.
+	class ReadGuard {
+	public:
+		ReadGuard(RoutingTable &table, unsigned int readerIndex);
+		~ReadGuard();
+
+		ReadGuard(const ReadGuard &) = delete;
+		ReadGuard &operator=(const ReadGuard &) = delete;
+
+		const RoutingSnapshot &operator*() const { return *m_snapshot; }
+		const RoutingSnapshot *operator->() const { return m_snapshot; }
+
+	protected:
+		std::atomic< std::uint64_t > &m_slot;
+		const RoutingSnapshot *m_snapshot;
+	};
+
+	RoutingTable();
+	/// Destroys the current snapshot and runs all pending disposals. No reader may be active anymore.
+	~RoutingTable();
+
+	RoutingTable(const RoutingTable &) = delete;
+	RoutingTable &operator=(const RoutingTable &) = delete;
+
+	/// The currently published snapshot. Must only be used by the writer thread, which may do so without a
+	/// ReadGuard as it is the only thread that ever destroys snapshots.
+	const RoutingSnapshot &current() const;
+
+	/// Replaces the current snapshot. The previous snapshot as well as everything passed to retire() since the last
+	/// call to publish() will be disposed of once all readers that might still see them are done.
+	void publish(std::unique_ptr< RoutingSnapshot > snapshot);
+
+	/// Schedules the given function to be called once no reader can reach the object it disposes of anymore. As the
+	/// object might still be referenced by the current snapshot, the grace period only starts with the next call to
+	/// publish().
+	void retire(std::function< void() > disposal);
+
+	/// Runs the disposals whose grace period has passed.
+	///
+	/// @returns Whether there are disposals left that have to wait for readers (or for the next publish())
+	bool reclaim();
+
+protected:
+	struct alignas(64) ReaderSlot {
+		/// The epoch the reader entered in or 0 if the reader is currently not reading
+		std::atomic< std::uint64_t > epoch{ 0 };
+	};
+
+	struct RetiredEntry {
+		std::uint64_t epoch;
+		std::function< void() > disposal;
+	};
+
+	std::atomic< const RoutingSnapshot * > m_current;
+	std::atomic< std::uint64_t > m_epoch{ 1 };
+	std::array< ReaderSlot, MAX_READERS > m_readers;
+
+	std::uint64_t m_nextVersion = 1;
+	/// Disposals waiting for the next publish()
+	std::vector< std::function< void() > > m_pending;
+	/// Disposals waiting for their grace period to pass (ordered by epoch)
+	std::deque< RetiredEntry > m_retired;
+
+	/// The smallest epoch any reader is currently in, or UINT64_MAX if there are no active readers
+	std::uint64_t oldestActiveEpoch() const;
+};
+
+#endif // MUMBLE_MURMUR_ROUTINGSNAPSHOT_H_
@@ -6,12 +6,14 @@
 #include "Server.h"
 
 #include "ACL.h"
+#include "AuthPool.h"
 #include "Channel.h"
 #include "ClientType.h"
 #include "Connection.h"
 #include "EnvUtils.h"
 #include "Group.h"
 #include "HTMLFilter.h"
+#include "HandshakePool.h"
 #include "HostAddress.h"
 #include "Meta.h"
 #include "MumbleProtocol.h"
@@ -19,8 +21,11 @@
 #include "QtUtils.h"
 #include "ServerDB.h"
 #include "ServerUser.h"
+#include "TextMessageImages.h"
+#include "UDPBatch.h"
 #include "User.h"
 #include "Version.h"
+#include "crypto/CryptographicRandom.h"
 
 #ifdef USE_ZEROCONF
 #	include "Zeroconf.h"
@@ -31,7 +36,6 @@
 #include <QtCore/QCoreApplication>
 #include <QtCore/QRegularExpression>
 #include <QtCore/QSet>
-#include <QtCore/QXmlStreamAttributes>
 #include <QtCore/QtEndian>
 #include <QtNetwork/QHostInfo>
 #include <QtNetwork/QSslConfiguration>
@@ -44,6 +48,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <vector>
 
 #ifdef Q_OS_WIN
@@ -122,88 +127,17 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 		return;
 
 	foreach (SslServer *ss, qlServer) {
-		sockaddr_storage addr;
+		for (unsigned int i = 0; i < iVoiceThreads; ++i) {
 #ifdef Q_OS_UNIX
-		int tcpsock   = static_cast< int >(ss->socketDescriptor());
-		socklen_t len = sizeof(addr);
+			int sock = createUDPSocket(ss, iVoiceThreads > 1);
 #else
-		SOCKET tcpsock        = ss->socketDescriptor();
-		int len               = sizeof(addr);
+			SOCKET sock = createUDPSocket(ss, iVoiceThreads > 1);
 #endif
-		memset(&addr, 0, sizeof(addr));
-		getsockname(tcpsock, reinterpret_cast< struct sockaddr * >(&addr), &len);
-#ifdef Q_OS_UNIX
-		int sock = ::socket(addr.ss_family, SOCK_DGRAM, 0);
-#	ifdef Q_OS_LINUX
-		int sockopt = 1;
-		if (setsockopt(sock, IPPROTO_IP, IP_PKTINFO, &sockopt, sizeof(sockopt)))
-			log(QString("Failed to set IP_PKTINFO for %1").arg(addressToString(ss->serverAddress(), usPort)));
-		sockopt = 1;
-		if (setsockopt(sock, IPPROTO_IPV6, IPV6_RECVPKTINFO, &sockopt, sizeof(sockopt)))
-			log(QString("Failed to set IPV6_RECVPKTINFO for %1").arg(addressToString(ss->serverAddress(), usPort)));
-#	endif
-#else
-#	ifndef SIO_UDP_CONNRESET
-#		define SIO_UDP_CONNRESET _WSAIOW(IOC_VENDOR, 12)
-#	endif
-		SOCKET sock           = ::WSASocket(addr.ss_family, SOCK_DGRAM, IPPROTO_UDP, nullptr, 0, WSA_FLAG_OVERLAPPED);
-		DWORD dwBytesReturned = 0;
-		BOOL bNewBehaviour    = FALSE;
-		if (WSAIoctl(sock, SIO_UDP_CONNRESET, &bNewBehaviour, sizeof(bNewBehaviour), nullptr, 0, &dwBytesReturned,
-					 nullptr, nullptr)
-			== SOCKET_ERROR) {
-			log(QString("Failed to set SIO_UDP_CONNRESET: %1").arg(WSAGetLastError()));
-		}
-#endif
-		if (sock == INVALID_SOCKET) {
-			log("Failed to create UDP Socket");
-			bValid = false;
-			return;
-		} else {
-			if (addr.ss_family == AF_INET6) {
-				// Copy IPV6_V6ONLY attribute from tcp socket, it defaults to nonzero on Windows
-				// See https://msdn.microsoft.com/en-us/library/windows/desktop/ms738574%28v=vs.85%29.aspx
-				// This will fail for WindowsXP which is ok. Our TCP code will have split that up
-				// into two sockets.
-				int ipv6only     = 0;
-				socklen_t optlen = sizeof(ipv6only);
-				if (::getsockopt(tcpsock, IPPROTO_IPV6, IPV6_V6ONLY, reinterpret_cast< char * >(&ipv6only), &optlen)
-					== 0) {
-					if (::setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, reinterpret_cast< const char * >(&ipv6only),
-									 optlen)
-						== SOCKET_ERROR) {
-						log(QString("Failed to copy IPV6_V6ONLY socket attribute from tcp to udp socket"));
-					}
-				}
+			if (sock == INVALID_SOCKET) {
+				bValid = false;
+				return;
 			}
 
-			if (::bind(sock, reinterpret_cast< sockaddr * >(&addr), len) == SOCKET_ERROR) {
-#ifdef Q_OS_WIN
-				log(QString("Failed to bind UDP Socket to %1: %2")
-						.arg(addressToString(ss->serverAddress(), usPort), WSAGetLastError()));
-#else
-				log(QString("Failed to bind UDP Socket to %1: %2")
-						.arg(addressToString(ss->serverAddress(), usPort), errno));
-#endif
-			} else {
-#ifdef Q_OS_UNIX
-				int val = 0xe0;
-				if (setsockopt(sock, IPPROTO_IP, IP_TOS, &val, sizeof(val))) {
-					val = 0x80;
-					if (setsockopt(sock, IPPROTO_IP, IP_TOS, &val, sizeof(val)))
-						log("Server: Failed to set TOS for UDP Socket");
-				}
-#	if defined(SO_PRIORITY)
-				socklen_t optlen = sizeof(val);
-				if (getsockopt(sock, SOL_SOCKET, SO_PRIORITY, &val, &optlen) == 0) {
-					if (val == 0) {
-						val = 6;
-						setsockopt(sock, SOL_SOCKET, SO_PRIORITY, &val, sizeof(val));
-					}
-				}
-#	endif
-#endif
-			}
 			QSocketNotifier *qsn = new QSocketNotifier(sock, QSocketNotifier::Read, this);
 			connect(qsn, SIGNAL(activated(int)), this, SLOT(udpActivated(int)));
 			qlUdpSocket << sock;
@@ -211,7 +145,8 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 		}
 	}
 
-	bValid = bValid && (qlServer.count() == qlBind.count()) && (qlUdpSocket.count() == qlBind.count());
+	bValid = bValid && (qlServer.count() == qlBind.count())
+			 && (qlUdpSocket.count() == qlBind.count() * static_cast< int >(iVoiceThreads));
 	if (!bValid)
 		return;
 
@@ -225,8 +160,6 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 	hNotify = CreateEvent(nullptr, FALSE, FALSE, nullptr);
 #endif
 
-	connect(this, SIGNAL(tcpTransmit(QByteArray, unsigned int)), this, SLOT(tcpTransmitData(QByteArray, unsigned int)),
-			Qt::QueuedConnection);
 	connect(this, SIGNAL(reqSync(unsigned int)), this, SLOT(doSync(unsigned int)));
 
 	for (unsigned int i = 1; i < iMaxUsers * 2; ++i)
@@ -234,6 +167,24 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 
 	connect(qtTimeout, SIGNAL(timeout()), this, SLOT(checkTimeout()));
 
+	if (iHandshakeThreads > 0) {
+		m_handshakePool = std::make_unique< HandshakePool >(iHandshakeThreads, iHandshakeLimit, iTimeout * 1000);
+		connect(m_handshakePool.get(), &HandshakePool::handshakeCompleted, this, &Server::handshakeCompleted);
+		connect(m_handshakePool.get(), &HandshakePool::handshakeFailed, this,
+				[this](const QHostAddress &address, quint16 port, const QString &reason) {
+					log(QString("TLS handshake with %1 failed: %2").arg(addressToString(address, port), reason));
+				});
+	}
+
+	if (iAuthThreads > 0) {
+		// Every authentication thread opens its own database connection, which has to be closed by that thread
+		m_authPool = std::make_unique< AuthPool >(this, iAuthThreads, iAuthLimit, iAuthTimeout * 1000,
+												  &ServerDB::releaseThreadConnection);
+	}
+
+	m_textMessageImages = std::make_unique< TextMessageImages >(
+		*meta->m_blobStore, static_cast< unsigned int >(qMax(Meta::mp.iTextMessageImages, 0)));
+
 	getBans();
 	readChannels();
 	readLinks();
@@ -248,6 +199,104 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 	}
 }
 
+#ifdef Q_OS_UNIX
+int Server::createUDPSocket(SslServer *ss, bool reusePort) {
+#else
+SOCKET Server::createUDPSocket(SslServer *ss, bool reusePort) {
+#endif
+	sockaddr_storage addr;
+#ifdef Q_OS_UNIX
+	int tcpsock   = static_cast< int >(ss->socketDescriptor());
+	socklen_t len = sizeof(addr);
+#else
+	SOCKET tcpsock = ss->socketDescriptor();
+	int len        = sizeof(addr);
+#endif
+	memset(&addr, 0, sizeof(addr));
+	getsockname(tcpsock, reinterpret_cast< struct sockaddr * >(&addr), &len);
+#ifdef Q_OS_UNIX
+	int sock = ::socket(addr.ss_family, SOCK_DGRAM, 0);
+#	ifdef Q_OS_LINUX
+	int sockopt = 1;
+	if (setsockopt(sock, IPPROTO_IP, IP_PKTINFO, &sockopt, sizeof(sockopt)))
+		log(QString("Failed to set IP_PKTINFO for %1").arg(addressToString(ss->serverAddress(), usPort)));
+	sockopt = 1;
+	if (setsockopt(sock, IPPROTO_IPV6, IPV6_RECVPKTINFO, &sockopt, sizeof(sockopt)))
+		log(QString("Failed to set IPV6_RECVPKTINFO for %1").arg(addressToString(ss->serverAddress(), usPort)));
+	if (reusePort) {
+		// Multiple voice threads: the kernel distributes the incoming datagrams among all sockets bound to the same
+		// address (hashing by the sender's address)
+		sockopt = 1;
+		if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &sockopt, sizeof(sockopt)))
+			log(QString("Failed to set SO_REUSEPORT for %1").arg(addressToString(ss->serverAddress(), usPort)));
+	}
+#	else
+	Q_UNUSED(reusePort);
+#	endif
+#else
+#	ifndef SIO_UDP_CONNRESET
+#		define SIO_UDP_CONNRESET _WSAIOW(IOC_VENDOR, 12)
+#	endif
+	Q_UNUSED(reusePort);
+	SOCKET sock           = ::WSASocket(addr.ss_family, SOCK_DGRAM, IPPROTO_UDP, nullptr, 0, WSA_FLAG_OVERLAPPED);
+	DWORD dwBytesReturned = 0;
+	BOOL bNewBehaviour    = FALSE;
+	if (WSAIoctl(sock, SIO_UDP_CONNRESET, &bNewBehaviour, sizeof(bNewBehaviour), nullptr, 0, &dwBytesReturned,
+				 nullptr, nullptr)
+		== SOCKET_ERROR) {
+		log(QString("Failed to set SIO_UDP_CONNRESET: %1").arg(WSAGetLastError()));
+	}
+#endif
+	if (sock == INVALID_SOCKET) {
+		log("Failed to create UDP Socket");
+		return sock;
+	}
+
+	if (addr.ss_family == AF_INET6) {
+		// Copy IPV6_V6ONLY attribute from tcp socket, it defaults to nonzero on Windows
+		// See https://msdn.microsoft.com/en-us/library/windows/desktop/ms738574%28v=vs.85%29.aspx
+		// This will fail for WindowsXP which is ok. Our TCP code will have split that up
+		// into two sockets.
+		int ipv6only     = 0;
+		socklen_t optlen = sizeof(ipv6only);
+		if (::getsockopt(tcpsock, IPPROTO_IPV6, IPV6_V6ONLY, reinterpret_cast< char * >(&ipv6only), &optlen) == 0) {
+			if (::setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, reinterpret_cast< const char * >(&ipv6only), optlen)
+				== SOCKET_ERROR) {
+				log(QString("Failed to copy IPV6_V6ONLY socket attribute from tcp to udp socket"));
+			}
+		}
+	}
+
+	if (::bind(sock, reinterpret_cast< sockaddr * >(&addr), len) == SOCKET_ERROR) {
+#ifdef Q_OS_WIN
+		log(QString("Failed to bind UDP Socket to %1: %2")
+				.arg(addressToString(ss->serverAddress(), usPort), WSAGetLastError()));
+#else
+		log(QString("Failed to bind UDP Socket to %1: %2").arg(addressToString(ss->serverAddress(), usPort), errno));
+#endif
+	} else {
+#ifdef Q_OS_UNIX
+		int val = 0xe0;
+		if (setsockopt(sock, IPPROTO_IP, IP_TOS, &val, sizeof(val))) {
+			val = 0x80;
+			if (setsockopt(sock, IPPROTO_IP, IP_TOS, &val, sizeof(val)))
+				log("Server: Failed to set TOS for UDP Socket");
+		}
+#	if defined(SO_PRIORITY)
+		socklen_t optlen = sizeof(val);
+		if (getsockopt(sock, SOL_SOCKET, SO_PRIORITY, &val, &optlen) == 0) {
+			if (val == 0) {
+				val = 6;
+				setsockopt(sock, SOL_SOCKET, SO_PRIORITY, &val, sizeof(val));
+			}
+		}
+#	endif
+#endif
+	}
+
+	return sock;
+}
+
 void Server::startThread() {
 	if (!isRunning()) {
 		log("Starting voice thread");
@@ -255,7 +304,16 @@ void Server::startThread() {
 
 		foreach (QSocketNotifier *qsn, qlUdpNotifier)
 			qsn->setEnabled(false);
+#ifdef Q_OS_LINUX
+		m_udpState.udpSendBatch = std::make_unique< UDPSendBatch >(udpSendBatchCapacity(iUDPBatchSize));
+		m_tcpSendBatch          = std::make_unique< UDPSendBatch >(udpSendBatchCapacity(iUDPBatchSize));
+#endif
 		start(QThread::HighestPriority);
+
+		for (unsigned int i = 1; i < iVoiceThreads; ++i) {
+			m_voiceWorkers.push_back(std::make_unique< VoiceWorker >(*this, i));
+			m_voiceWorkers.back()->start(QThread::HighestPriority);
+		}
 #ifdef Q_OS_LINUX
 		// QThread::HighestPriority == Same as everything else...
 		int policy;
@@ -287,6 +345,17 @@ void Server::stopThread() {
 #endif
 		wait();
 
+		for (std::unique_ptr< VoiceWorker > &worker : m_voiceWorkers) {
+			worker->wait();
+		}
+		m_voiceWorkers.clear();
+
+#ifdef Q_OS_UNIX
+		// The voice threads leave the notification in the pipe so that every one of them gets to see it
+		while (::recv(aiNotify[0], &val, 1, MSG_DONTWAIT) == 1) {
+		};
+#endif
+
 		foreach (QSocketNotifier *qsn, qlUdpNotifier)
 			qsn->setEnabled(true);
 	}
@@ -300,6 +369,10 @@ Server::~Server() {
 
 	stopThread();
 
+	// Waits for the authentication threads, which may still be using this Server
+	m_authPool.reset();
+	m_handshakePool.reset();
+
 	foreach (QSocketNotifier *qsn, qlUdpNotifier)
 		delete qsn;
 
@@ -361,6 +434,13 @@ void Server::readParams() {
 	iOpusThreshold                     = Meta::mp.iOpusThreshold;
 	iChannelNestingLimit               = Meta::mp.iChannelNestingLimit;
 	iChannelCountLimit                 = Meta::mp.iChannelCountLimit;
+	iUDPBatchSize                      = Meta::mp.iUDPBatchSize;
+	iVoiceThreads                      = Meta::mp.iVoiceThreads;
+	iHandshakeThreads                  = Meta::mp.iHandshakeThreads;
+	iHandshakeLimit                    = Meta::mp.iHandshakeLimit;
+	iAuthThreads                       = Meta::mp.iAuthThreads;
+	iAuthLimit                         = Meta::mp.iAuthLimit;
+	iAuthTimeout                       = Meta::mp.iAuthTimeout;
 
 	QString qsHost = getConf("host", QString()).toString();
 	if (!qsHost.isEmpty()) {
@@ -470,6 +550,32 @@ void Server::readParams() {
 	}
 	broadcastListenerVolumeAdjustments =
 		getConf("broadcastlistenervolumeadjustments", broadcastListenerVolumeAdjustments).toBool();
+
+	iUDPBatchSize = getConf("udpbatchsize", iUDPBatchSize).toUInt();
+#ifdef Q_OS_LINUX
+	iUDPBatchSize = qBound(1U, iUDPBatchSize, static_cast< unsigned int >(UDP_MAX_BATCH_SIZE));
+#else
+	// Batched UDP I/O relies on recvmmsg/sendmmsg
+	iUDPBatchSize = 1;
+#endif
+
+	iVoiceThreads = getConf("voicethreads", iVoiceThreads).toUInt();
+#ifdef Q_OS_LINUX
+	// Every voice thread uses its index as its slot in the routing table as well as in the users' crypt states
+	static_assert(RoutingTable::MAX_READERS <= VoiceCryptState::MAX_VOICE_THREADS,
+				  "Every voice thread needs its own slot in VoiceCryptState");
+	iVoiceThreads = qBound(1U, iVoiceThreads, RoutingTable::MAX_READERS);
+#else
+	// Distributing the UDP traffic among multiple threads relies on the load balancing of SO_REUSEPORT
+	iVoiceThreads = 1;
+#endif
+
+	iHandshakeThreads = qMin(getConf("handshakethreads", iHandshakeThreads).toUInt(), HandshakePool::MAX_THREADS);
+	iHandshakeLimit   = getConf("handshakelimit", iHandshakeLimit).toUInt();
+
+	iAuthThreads = qMin(getConf("auththreads", iAuthThreads).toUInt(), AuthPool::MAX_THREADS);
+	iAuthLimit   = getConf("authlimit", iAuthLimit).toUInt();
+	iAuthTimeout = qMax(getConf("authtimeout", iAuthTimeout).toInt(), 1);
 }
 
 void Server::setLiveConf(const QString &key, const QString &value) {
@@ -639,15 +745,14 @@ void Server::removeZeroconf() {
 gsl::span< const Mumble::Protocol::byte >
 	Server::handlePing(const Mumble::Protocol::UDPDecoder< Mumble::Protocol::Role::Server > &decoder,
 					   Mumble::Protocol::UDPPingEncoder< Mumble::Protocol::Role::Server > &encoder,
-					   bool expectExtended) {
+					   bool expectExtended, const RoutingSnapshot &routing) {
 	Mumble::Protocol::PingData pingData = decoder.getPingData();
 
 	if (pingData.requestAdditionalInformation) {
 		pingData.requestAdditionalInformation = false;
 
-		pingData.serverVersion = Version::get();
-		assert(qhUsers.size() >= static_cast< int >(m_botCount));
-		pingData.userCount                     = static_cast< unsigned int >(qhUsers.size()) - m_botCount;
+		pingData.serverVersion                 = Version::get();
+		pingData.userCount                     = routing.userCount;
 		pingData.maxUserCount                  = iMaxUsers;
 		pingData.maxBandwidthPerUser           = static_cast< unsigned int >(iMaxBandwidth);
 		pingData.containsAdditionalInformation = true;
@@ -669,9 +774,12 @@ void Server::customEvent(QEvent *evt) {
 }
 
 void Server::udpActivated(int socket) {
+	// The voice threads are not running, so we can make use of the voice thread's state
+	Mumble::Protocol::UDPDecoder< Mumble::Protocol::Role::Server > &decoder = m_udpState.udpDecoder;
+
 	// At this part we are only expecting pings of clients we don't know yet -> thus we also don't know which protocol
 	// version they are using.
-	m_udpDecoder.setProtocolVersion(Version::UNKNOWN);
+	decoder.setProtocolVersion(Version::UNKNOWN);
 
 	qint32 len;
 
@@ -681,8 +789,8 @@ void Server::udpActivated(int socket) {
 	struct msghdr msg;
 	struct iovec iov[1];
 
-	iov[0].iov_base = m_udpDecoder.getBuffer().data();
-	iov[0].iov_len  = m_udpDecoder.getBuffer().size();
+	iov[0].iov_base = decoder.getBuffer().data();
+	iov[0].iov_len  = decoder.getBuffer().size();
 
 	uint8_t controldata[CMSG_SPACE(std::max(sizeof(struct in6_pktinfo), sizeof(struct in_pktinfo)))];
 
@@ -699,22 +807,23 @@ void Server::udpActivated(int socket) {
 #	else
 	socklen_t fromlen = sizeof(from);
 	int &sock         = socket;
-	len = static_cast< qint32 >(::recvfrom(sock, m_udpDecoder.getBuffer().data(), m_udpDecoder.getBuffer().size(),
+	len = static_cast< qint32 >(::recvfrom(sock, decoder.getBuffer().data(), decoder.getBuffer().size(),
 										   MSG_TRUNC, reinterpret_cast< struct sockaddr * >(&from), &fromlen));
 #	endif
 #else
 	int fromlen = static_cast< int >(sizeof(from));
 	SOCKET sock = static_cast< SOCKET >(socket);
-	len         = ::recvfrom(sock, reinterpret_cast< char * >(m_udpDecoder.getBuffer().data()),
-                     static_cast< int >(m_udpDecoder.getBuffer().size()), 0,
+	len         = ::recvfrom(sock, reinterpret_cast< char * >(decoder.getBuffer().data()),
+                     static_cast< int >(decoder.getBuffer().size()), 0,
                      reinterpret_cast< struct sockaddr * >(&from), &fromlen);
 #endif
 
-	gsl::span< Mumble::Protocol::byte > inputData(&m_udpDecoder.getBuffer()[0], static_cast< std::size_t >(len));
+	gsl::span< Mumble::Protocol::byte > inputData(&decoder.getBuffer()[0], static_cast< std::size_t >(len));
 
-	if (bAllowPing && m_udpDecoder.decodePing(inputData)
-		&& m_udpDecoder.getMessageType() == Mumble::Protocol::UDPMessageType::Ping) {
-		gsl::span< const Mumble::Protocol::byte > encodedPing = handlePing(m_udpDecoder, m_udpPingEncoder, true);
+	if (bAllowPing && decoder.decodePing(inputData)
+		&& decoder.getMessageType() == Mumble::Protocol::UDPMessageType::Ping) {
+		gsl::span< const Mumble::Protocol::byte > encodedPing =
+			handlePing(decoder, m_udpState.udpPingEncoder, true, m_routingTable.current());
 
 		if (!encodedPing.empty()) {
 #ifdef Q_OS_LINUX
@@ -740,6 +849,10 @@ void Server::udpActivated(int socket) {
 void Server::run() {
 	tracy::SetThreadName("Audio");
 
+	runVoiceLoop(0, m_udpState);
+}
+
+void Server::runVoiceLoop(unsigned int workerIndex, VoiceWorkerState &state) {
 	qint32 len;
 #if defined(__LP64__)
 	unsigned char encbuff[Mumble::Protocol::MAX_UDP_PACKET_SIZE + 8];
@@ -747,10 +860,28 @@ void Server::run() {
 #else
 	unsigned char encrypt[Mumble::Protocol::MAX_UDP_PACKET_SIZE];
 #endif
-	unsigned char buffer[Mumble::Protocol::MAX_UDP_PACKET_SIZE];
 
 	sockaddr_storage from;
-	unsigned int nfds = static_cast< unsigned int >(qlUdpSocket.count());
+
+#ifdef Q_OS_UNIX
+	QList< int > sockets;
+#else
+	QList< SOCKET > sockets;
+#endif
+	for (int i = 0; i < qlUdpSocket.count(); ++i) {
+		if (static_cast< unsigned int >(i) % iVoiceThreads == workerIndex) {
+			sockets << qlUdpSocket.at(i);
+		}
+	}
+
+	unsigned int nfds = static_cast< unsigned int >(sockets.count());
+
+#ifdef Q_OS_LINUX
+	std::unique_ptr< UDPReceiveBatch > receiveBatch;
+	if (iUDPBatchSize > 1) {
+		receiveBatch = std::make_unique< UDPReceiveBatch >(iUDPBatchSize);
+	}
+#endif
 
 #ifdef Q_OS_UNIX
 	socklen_t fromlen;
@@ -758,7 +889,7 @@ void Server::run() {
 	fds.resize(static_cast< std::size_t >(nfds + 1));
 
 	for (unsigned int i = 0; i < nfds; ++i) {
-		fds[i].fd      = qlUdpSocket.at(static_cast< int >(i));
+		fds[i].fd      = sockets.at(static_cast< int >(i));
 		fds[i].events  = POLLIN;
 		fds[i].revents = 0;
 	}
@@ -773,7 +904,7 @@ void Server::run() {
 	std::vector< HANDLE > events;
 	events.resize(nfds + 1);
 	for (unsigned int i = 0; i < nfds; ++i) {
-		fds[i]    = qlUdpSocket.at(i);
+		fds[i]    = sockets.at(i);
 		events[i] = CreateEvent(nullptr, FALSE, FALSE, nullptr);
 		::WSAEventSelect(fds[i], events[i], FD_READ);
 	}
@@ -796,10 +927,7 @@ void Server::run() {
 		}
 
 		if (fds[nfds - 1].revents) {
-			// Drain pipe
-			unsigned char val;
-			while (::recv(aiNotify[0], &val, 1, MSG_DONTWAIT) == 1) {
-			};
+			// The pipe is drained by stopThread once all voice threads have seen the notification
 			break;
 		}
 
@@ -827,6 +955,23 @@ void Server::run() {
 				SOCKET sock = fds[ret - WAIT_OBJECT_0];
 #endif
 
+#ifdef Q_OS_LINUX
+				if (receiveBatch) {
+					int count = receiveBatch->receive(sock);
+					if (count <= 0) {
+						break;
+					}
+
+					for (std::size_t j = 0; j < static_cast< std::size_t >(count); ++j) {
+						processUDPDatagram(sock, receiveBatch->data(j), receiveBatch->length(j),
+										   receiveBatch->from(j), receiveBatch->header(j), state);
+					}
+
+					fds[i].revents = 0;
+					continue;
+				}
+#endif
+
 				fromlen = sizeof(from);
 #ifdef Q_OS_WIN
 				len = ::recvfrom(sock, reinterpret_cast< char * >(encrypt), Mumble::Protocol::MAX_UDP_PACKET_SIZE, 0,
@@ -839,7 +984,7 @@ void Server::run() {
 				iov[0].iov_base = encrypt;
 				iov[0].iov_len  = Mumble::Protocol::MAX_UDP_PACKET_SIZE;
 
-				uint8_t controldata[CMSG_SPACE(std::max(sizeof(struct in6_pktinfo), sizeof(struct in_pktinfo)))];
+				uint8_t controldata[UDP_PKTINFO_SPACE];
 
 				memset(&msg, 0, sizeof(msg));
 				msg.msg_name       = reinterpret_cast< struct sockaddr * >(&from);
@@ -857,184 +1002,339 @@ void Server::run() {
 #	endif
 #endif
 
-				// Capture only the processing without the polling
-				ZoneScopedN(TracyConstants::UDP_PACKET_PROCESSING_ZONE);
-
 				if (len == 0) {
 					break;
 				} else if (len == SOCKET_ERROR) {
 					break;
-				} else if (len < 5) {
-					// 4 bytes crypt header + type + session
-					continue;
-				} else if (static_cast< unsigned int >(len) > Mumble::Protocol::MAX_UDP_PACKET_SIZE) {
-					// This will also catch the len == -1 case (indicating error)
-					static_assert(static_cast< unsigned int >(-1) > Mumble::Protocol::MAX_UDP_PACKET_SIZE,
-								  "Invalid assumption");
-					continue;
 				}
 
-				QReadLocker rl(&qrwlVoiceThread);
+#ifdef Q_OS_LINUX
+				processUDPDatagram(sock, encrypt, len, from, msg, state);
+#else
+				processUDPDatagram(sock, encrypt, len, from, fromlen, state);
+#endif
 
-				quint16 port = (from.ss_family == AF_INET6) ? (reinterpret_cast< sockaddr_in6 * >(&from)->sin6_port)
-															: (reinterpret_cast< sockaddr_in * >(&from)->sin_port);
-				const HostAddress &ha = HostAddress(from);
+#ifdef Q_OS_UNIX
+				fds[i].revents = 0;
+#endif
+			}
+		}
+	}
+#ifdef Q_OS_WIN
+	for (unsigned int i = 0; i < nfds - 1; ++i) {
+		::WSAEventSelect(fds[i], nullptr, 0);
+		CloseHandle(events[i]);
+	}
+#endif
+}
 
-				const QPair< HostAddress, quint16 > &key = QPair< HostAddress, quint16 >(ha, port);
+#ifdef Q_OS_LINUX
+void Server::processUDPDatagram(int sock, unsigned char *encrypt, qint32 len, sockaddr_storage &from,
+								struct msghdr &msg, VoiceWorkerState &state) {
+#elif defined(Q_OS_UNIX)
+void Server::processUDPDatagram(int sock, unsigned char *encrypt, qint32 len, sockaddr_storage &from,
+								socklen_t fromlen, VoiceWorkerState &state) {
+#else
+void Server::processUDPDatagram(SOCKET sock, unsigned char *encrypt, qint32 len, sockaddr_storage &from,
+								int fromlen, VoiceWorkerState &state) {
+#endif
+	// Capture only the processing without the polling
+	ZoneScopedN(TracyConstants::UDP_PACKET_PROCESSING_ZONE);
 
-				ServerUser *u = qhPeerUsers.value(key);
+	const std::chrono::steady_clock::time_point received = std::chrono::steady_clock::now();
 
-				if (u) {
-					m_udpDecoder.setProtocolVersion(u->m_version);
-				} else {
-					m_udpDecoder.setProtocolVersion(Version::UNKNOWN);
-				}
-				// This may be a general ping requesting server details, unencrypted.
-				if (bAllowPing
-					&& m_udpDecoder.decodePing(
-						gsl::span< Mumble::Protocol::byte >(encrypt, static_cast< std::size_t >(len)))
-					&& m_udpDecoder.getMessageType() == Mumble::Protocol::UDPMessageType::Ping) {
-					ZoneScopedN(TracyConstants::PING_PROCESSING_ZONE);
+	unsigned char buffer[Mumble::Protocol::MAX_UDP_PACKET_SIZE];
 
-					gsl::span< const Mumble::Protocol::byte > encodedPing =
-						handlePing(m_udpDecoder, m_udpPingEncoder, true);
+	VoiceThreadMetrics &metrics = m_voiceMetrics.forSlot(state.index);
+	metrics.add(VoiceCounter::UDPPacketsReceived);
+	metrics.add(VoiceCounter::UDPBytesReceived, static_cast< std::uint64_t >(std::max(len, 0)));
+
+	if (len < 5) {
+		// 4 bytes crypt header + type + session
+		return;
+	} else if (static_cast< unsigned int >(len) > Mumble::Protocol::MAX_UDP_PACKET_SIZE) {
+		// This will also catch the len == -1 case (indicating error)
+		static_assert(static_cast< unsigned int >(-1) > Mumble::Protocol::MAX_UDP_PACKET_SIZE, "Invalid assumption");
+		return;
+	}
+
+	// Everything (including the ServerUser objects) reachable through the snapshot stays alive until we're done
+	RoutingTable::ReadGuard routing(m_routingTable, state.index);
+
+	quint16 port = (from.ss_family == AF_INET6) ? (reinterpret_cast< sockaddr_in6 * >(&from)->sin6_port)
+												: (reinterpret_cast< sockaddr_in * >(&from)->sin_port);
+	const HostAddress &ha = HostAddress(from);
+
+	const QPair< HostAddress, quint16 > &key = QPair< HostAddress, quint16 >(ha, port);
+
+	ServerUser *u = routing->peers.value(key);
+	if (!u) {
+		// The peer might have been bound after the snapshot has been built
+		QReadLocker rl(&qrwlVoiceThread);
+		u = qhPeerUsers.value(key);
+	}
+
+	if (u) {
+		state.udpDecoder.setProtocolVersion(u->m_version);
+	} else {
+		state.udpDecoder.setProtocolVersion(Version::UNKNOWN);
+	}
+	// This may be a general ping requesting server details, unencrypted.
+	if (bAllowPing
+		&& state.udpDecoder.decodePing(gsl::span< Mumble::Protocol::byte >(encrypt, static_cast< std::size_t >(len)))
+		&& state.udpDecoder.getMessageType() == Mumble::Protocol::UDPMessageType::Ping) {
+		ZoneScopedN(TracyConstants::PING_PROCESSING_ZONE);
 
-					if (!encodedPing.empty()) {
+		gsl::span< const Mumble::Protocol::byte > encodedPing =
+			handlePing(state.udpDecoder, state.udpPingEncoder, true, *routing);
+
+		if (!encodedPing.empty()) {
 #ifdef Q_OS_LINUX
-						// We are only reading from the buffer and thus the const_cast should be fine
-						iov[0].iov_base = const_cast< Mumble::Protocol::byte * >(encodedPing.data());
-						iov[0].iov_len  = encodedPing.size();
-						::sendmsg(sock, &msg, 0);
+			// There is space for only one iovec and the only control data we have asked for is the incoming
+			// address. So we can reuse the received msg for the reply.
+			// We are only reading from the buffer and thus the const_cast should be fine
+			msg.msg_iov[0].iov_base = const_cast< Mumble::Protocol::byte * >(encodedPing.data());
+			msg.msg_iov[0].iov_len  = encodedPing.size();
+			::sendmsg(sock, &msg, 0);
 #else
 #	ifdef Q_OS_WIN
-						using size_type = int;
+			using size_type = int;
 #	else
-						using size_type = std::size_t;
+			using size_type = std::size_t;
 #	endif
-						::sendto(sock, reinterpret_cast< const char * >(encodedPing.data()),
-								 static_cast< size_type >(encodedPing.size()), 0,
-								 reinterpret_cast< struct sockaddr * >(&from), fromlen);
+			::sendto(sock, reinterpret_cast< const char * >(encodedPing.data()),
+					 static_cast< size_type >(encodedPing.size()), 0, reinterpret_cast< struct sockaddr * >(&from),
+					 fromlen);
 #endif
-					}
+		}
 
-					continue;
-				}
+		return;
+	}
 
 
-				if (u) {
-					if (!checkDecrypt(u, encrypt, buffer, static_cast< unsigned int >(len))) {
-						continue;
-					}
-				} else {
-					ZoneScopedN(TracyConstants::DECRYPT_UNKNOWN_PEER_ZONE);
-
-					// Unknown peer
-					foreach (ServerUser *usr, qhHostUsers.value(ha)) {
-						if (checkDecrypt(
-								usr, encrypt, buffer,
-								static_cast< unsigned int >(len))) { // checkDecrypt takes the User's qrwlCrypt lock.
-							// Every time we relock, reverify users' existence.
-							// The main thread might delete the user while the lock isn't held.
-							unsigned int uiSession = usr->uiSession;
-							rl.unlock();
-							qrwlVoiceThread.lockForWrite();
-							if (qhUsers.contains(uiSession)) {
-								u             = usr;
-								u->sUdpSocket = sock;
-								memcpy(&u->saiUdpAddress, &from, sizeof(from));
-								qhHostUsers[from].remove(u);
-								qhPeerUsers.insert(key, u);
-							}
-							qrwlVoiceThread.unlock();
-							rl.relock();
-							if (u && !qhUsers.contains(uiSession))
-								u = nullptr;
-							break;
-						}
-					}
-					if (!u) {
-						continue;
-					}
+	if (u) {
+		// The client might not have noticed yet that its endpoint has been bound and still prefix its packets with its
+		// token. Checking for the prefix up front means that every datagram is decrypted only once (a failed attempt
+		// would also be counted as a lost packet by the crypt state).
+		const qint32 tokenSize = static_cast< qint32 >(Mumble::Protocol::UDP_TOKEN_SIZE);
+		if (len > tokenSize + 4 && qFromLittleEndian< quint64 >(encrypt) == u->uiUdpToken.load()) {
+			encrypt += tokenSize;
+			len -= tokenSize;
+		}
+
+		if (!checkDecrypt(u, encrypt, buffer, static_cast< unsigned int >(len))) {
+			metrics.add(VoiceCounter::DecryptFailures);
+			return;
+		}
+	} else {
+		ZoneScopedN(TracyConstants::DECRYPT_UNKNOWN_PEER_ZONE);
+
+		u = bindUnknownPeer(sock, encrypt, buffer, len, from, key, metrics);
+		if (!u) {
+			metrics.add(VoiceCounter::DecryptFailures);
+			return;
+		}
+
+		// Make the new peer known to the routing snapshot
+		invalidateRoutingSnapshot();
+	}
+	len -= 4;
+
+	if (state.udpDecoder.decode(gsl::span< Mumble::Protocol::byte >(buffer, static_cast< std::size_t >(len)))) {
+		switch (state.udpDecoder.getMessageType()) {
+			case Mumble::Protocol::UDPMessageType::Audio: {
+				Mumble::Protocol::AudioData audioData = state.udpDecoder.getAudioData();
+
+				// Allow all voice packets through by default.
+				bool ok = true;
+				// ...Unless we're in Opus mode. In Opus mode, only Opus packets are allowed.
+				if (bOpus && audioData.usedCodec != Mumble::Protocol::AudioCodec::Opus) {
+					ok = false;
 				}
-				len -= 4;
-
-				if (m_udpDecoder.decode(gsl::span< Mumble::Protocol::byte >(buffer, static_cast< std::size_t >(len)))) {
-					switch (m_udpDecoder.getMessageType()) {
-						case Mumble::Protocol::UDPMessageType::Audio: {
-							Mumble::Protocol::AudioData audioData = m_udpDecoder.getAudioData();
-
-							// Allow all voice packets through by default.
-							bool ok = true;
-							// ...Unless we're in Opus mode. In Opus mode, only Opus packets are allowed.
-							if (bOpus && audioData.usedCodec != Mumble::Protocol::AudioCodec::Opus) {
-								ok = false;
-							}
 
-							if (ok) {
-								u->aiUdpFlag = 1;
+				if (ok) {
+					u->aiUdpFlag = 1;
 
-								// Add session id
-								audioData.senderSession = u->uiSession;
+					// Add session id
+					audioData.senderSession = u->uiSession;
 
-								processMsg(u, audioData, m_udpAudioReceivers, m_udpAudioEncoder);
-							}
-							break;
-						}
-						case Mumble::Protocol::UDPMessageType::Ping: {
-							ZoneScopedN(TracyConstants::UDP_PING_PROCESSING_ZONE);
-
-							Mumble::Protocol::PingData pingData = m_udpDecoder.getPingData();
-							if (!pingData.requestAdditionalInformation && !pingData.containsAdditionalInformation) {
-								// At this point here, we only want to handle connectivity pings
-								gsl::span< const Mumble::Protocol::byte > encodedPing =
-									handlePing(m_udpDecoder, m_udpPingEncoder, false);
-
-								QByteArray cache;
-								sendMessage(*u, encodedPing.data(), static_cast< int >(encodedPing.size()), cache,
-											true);
-							}
-							break;
-						}
-					}
+					UDPSendBatch *sendBatch = nullptr;
+#ifdef Q_OS_LINUX
+					sendBatch = state.udpSendBatch.get();
+#endif
+					processMsg(u, *routing, audioData, state.index, state.udpAudioReceivers, state.udpAudioEncoder,
+							   sendBatch);
+
+					const std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - received;
+					metrics.latency.record(static_cast< std::uint64_t >(
+						std::chrono::duration_cast< std::chrono::microseconds >(elapsed).count()));
 				}
+				break;
+			}
+			case Mumble::Protocol::UDPMessageType::Ping: {
+				ZoneScopedN(TracyConstants::UDP_PING_PROCESSING_ZONE);
+
+				Mumble::Protocol::PingData pingData = state.udpDecoder.getPingData();
+				if (!pingData.requestAdditionalInformation && !pingData.containsAdditionalInformation) {
+					// At this point here, we only want to handle connectivity pings
+					gsl::span< const Mumble::Protocol::byte > encodedPing =
+						handlePing(state.udpDecoder, state.udpPingEncoder, false, *routing);
+
+					sendMessage(*u, state.index, encodedPing.data(), static_cast< int >(encodedPing.size()), true);
+				}
+				break;
+			}
+		}
+	}
+}
+
 #ifdef Q_OS_UNIX
-				fds[i].revents = 0;
+ServerUser *Server::bindUnknownPeer(int sock, const unsigned char *encrypt, unsigned char *plain, qint32 &len,
+									const sockaddr_storage &from, const QPair< HostAddress, quint16 > &key,
+									VoiceThreadMetrics &metrics) {
+#else
+ServerUser *Server::bindUnknownPeer(SOCKET sock, const unsigned char *encrypt, unsigned char *plain, qint32 &len,
+									const sockaddr_storage &from, const QPair< HostAddress, quint16 > &key,
+									VoiceThreadMetrics &metrics) {
 #endif
+	const qint32 tokenSize = static_cast< qint32 >(Mumble::Protocol::UDP_TOKEN_SIZE);
+
+	ServerUser *usr = nullptr;
+	qint32 cryptLen = len;
+
+	QReadLocker rl(&qrwlVoiceThread);
+
+	// Clients supporting tokens prefix their packets with it until their endpoint has been bound, which identifies the
+	// user right away. The packet still has to be decrypted successfully, so knowing the token alone isn't enough.
+	// Just like with legacy clients, the datagrams have to come from the address of the TCP connection.
+	if (len > tokenSize + 4) {
+		ServerUser *candidate = qhUdpTokenUsers.value(qFromLittleEndian< quint64 >(encrypt));
+		if (candidate && candidate->haAddress == key.first
+			&& checkDecrypt(candidate, encrypt + tokenSize, plain, static_cast< unsigned int >(len - tokenSize))) {
+			usr      = candidate;
+			cryptLen = len - tokenSize;
+			metrics.add(VoiceCounter::UDPTokenBindings);
+		}
+	}
+
+	if (!usr) {
+		// Legacy clients don't send a token, so the packet has to be tried with the keys of all users connected from
+		// the same address
+		for (ServerUser *candidate : qhHostUsers.value(key.first)) {
+			metrics.add(VoiceCounter::UDPTrialDecryptions);
+
+			if (checkDecrypt(candidate, encrypt, plain, static_cast< unsigned int >(len))) {
+				usr = candidate;
+				metrics.add(VoiceCounter::UDPTrialBindings);
+				break;
 			}
 		}
 	}
-#ifdef Q_OS_WIN
-	for (unsigned int i = 0; i < nfds - 1; ++i) {
-		::WSAEventSelect(fds[i], nullptr, 0);
-		CloseHandle(events[i]);
+
+	if (!usr) {
+		return nullptr;
 	}
-#endif
+
+	// Reverify the user's existence after relocking. The main thread might have removed the user while the lock
+	// wasn't held (the object itself is kept alive by the caller's read guard though). Another voice thread might also
+	// have bound the user in the meantime (if the client's packets arrived from multiple ports), in which case we keep
+	// the existing binding.
+	unsigned int uiSession = usr->uiSession;
+	rl.unlock();
+
+	ServerUser *bound = nullptr;
+
+	qrwlVoiceThread.lockForWrite();
+	if (qhUsers.contains(uiSession) && usr->sUdpSocket.load() == INVALID_SOCKET) {
+		bound = usr;
+		// Voice threads that don't hold qrwlVoiceThread only read the UDP address once they see the socket, so the
+		// address has to be written first
+		memcpy(&bound->saiUdpAddress, &from, sizeof(from));
+		bound->sUdpSocket.store(sock, std::memory_order_release);
+		qhHostUsers[bound->haAddress].remove(bound);
+		qhUdpTokenUsers.remove(bound->uiUdpToken.load());
+		qhPeerUsers.insert(key, bound);
+	}
+	qrwlVoiceThread.unlock();
+
+	if (bound) {
+		len = cryptLen;
+	}
+
+	return bound;
+}
+
+std::string Server::assignUdpToken(ServerUser *u) {
+	qhUdpTokenUsers.remove(u->uiUdpToken.load());
+
+	quint64 token;
+	do {
+		CryptographicRandom::fillBuffer(&token, sizeof(token));
+		// The first byte of the token is always >= 0x80, so that packets prefixed with it can't be mistaken for
+		// unencrypted pings
+		token |= 0x80;
+	} while (qhUdpTokenUsers.contains(token));
+
+	u->uiUdpToken.store(token);
+	qhUdpTokenUsers.insert(token, u);
+
+	std::string encoded(Mumble::Protocol::UDP_TOKEN_SIZE, '\0');
+	qToLittleEndian< quint64 >(token, encoded.data());
+
+	return encoded;
 }
 
 bool Server::checkDecrypt(ServerUser *u, const unsigned char *encrypt, unsigned char *plain, unsigned int len) {
 	ZoneScoped;
 
-	QMutexLocker l(&u->qmCrypt);
+	bool requestResync = false;
 
-	if (u->csCrypt->isValid() && u->csCrypt->decrypt(encrypt, plain, len)) {
+	if (u->voiceCrypt.decrypt(encrypt, plain, len, requestResync)) {
 		return true;
 	}
 
-	if (u->csCrypt->tLastGood.elapsed() > 5000000ULL) {
-		if (u->csCrypt->tLastRequest.elapsed() > 5000000ULL) {
-			u->csCrypt->tLastRequest.restart();
-			emit reqSync(u->uiSession);
-		}
+	if (requestResync) {
+		emit reqSync(u->uiSession);
 	}
 	return false;
 }
 
-void Server::sendMessage(ServerUser &u, const unsigned char *data, int len, QByteArray &cache, bool force) {
+void Server::sendMessage(ServerUser &u, unsigned int cryptSlot, const unsigned char *data, int len, bool force,
+						 UDPSendBatch *sendBatch) {
 	ZoneScoped;
 
-	if ((u.aiUdpFlag.loadRelaxed() == 1 || force) && (u.sUdpSocket != INVALID_SOCKET)) {
+	// The UDP endpoint may be bound by a voice thread at any time, but it never changes once it has been bound
+#ifdef Q_OS_UNIX
+	const int udpSocket = u.sUdpSocket.load(std::memory_order_acquire);
+#else
+	const SOCKET udpSocket = u.sUdpSocket.load(std::memory_order_acquire);
+#endif
+
+	VoiceThreadMetrics &metrics = m_voiceMetrics.forSlot(cryptSlot);
+
+	if ((u.aiUdpFlag.loadRelaxed() == 1 || force) && (udpSocket != INVALID_SOCKET)) {
+		struct sockaddr_storage udpAddress = u.saiUdpAddress;
+#ifdef Q_OS_LINUX
+		if (sendBatch) {
+			unsigned char *buffer = sendBatch->nextBuffer();
+
+			if (!u.voiceCrypt.encrypt(cryptSlot, data, buffer, static_cast< unsigned int >(len))) {
+				return;
+			}
+
+			if (!sendBatch->commit(udpSocket, static_cast< std::size_t >(len + 4), udpAddress, u.haTcpLocalAddress)) {
+				return;
+			}
+			metrics.add(VoiceCounter::UDPPacketsSent);
+			metrics.add(VoiceCounter::UDPBytesSent, static_cast< std::uint64_t >(len + 4));
+			return;
+		}
+#else
+		Q_UNUSED(sendBatch);
+#endif
 #if defined(__LP64__)
-		static std::vector< char > ebuffer;
+		// Multiple voice threads may send at the same time
+		thread_local std::vector< char > ebuffer;
 		ebuffer.resize(static_cast< std::size_t >(len + 4 + 16));
 		char *buffer = reinterpret_cast< char * >(
 			((reinterpret_cast< quint64 >(ebuffer.data()) + 8) & static_cast< quint64 >(~7)) + 4);
@@ -1043,22 +1343,14 @@ void Server::sendMessage(ServerUser &u, const unsigned char *data, int len, QByt
 		bufVec.resize(static_cast< std::size_t >(len + 4));
 		char *buffer    = bufVec.data();
 #endif
-		{
-			QMutexLocker wl(&u.qmCrypt);
-
-			if (!u.csCrypt->isValid()) {
-				return;
-			}
-
-			if (!u.csCrypt->encrypt(reinterpret_cast< const unsigned char * >(data),
-									reinterpret_cast< unsigned char * >(buffer), static_cast< unsigned int >(len))) {
-				return;
-			}
+		if (!u.voiceCrypt.encrypt(cryptSlot, reinterpret_cast< const unsigned char * >(data),
+								  reinterpret_cast< unsigned char * >(buffer), static_cast< unsigned int >(len))) {
+			return;
 		}
 #ifdef Q_OS_WIN
 		DWORD dwFlow = 0;
 		if (Meta::hQoS)
-			QOSAddSocketToFlow(Meta::hQoS, u.sUdpSocket, reinterpret_cast< struct sockaddr * >(&u.saiUdpAddress),
+			QOSAddSocketToFlow(Meta::hQoS, udpSocket, reinterpret_cast< struct sockaddr * >(&udpAddress),
 							   QOSTrafficTypeVoice, QOS_NON_ADAPTIVE_FLOW, reinterpret_cast< PQOS_FLOWID >(&dwFlow));
 #endif
 #ifdef Q_OS_LINUX
@@ -1068,68 +1360,60 @@ void Server::sendMessage(ServerUser &u, const unsigned char *data, int len, QByt
 		iov[0].iov_base = buffer;
 		iov[0].iov_len  = static_cast< unsigned int >(len + 4);
 
-		uint8_t controldata[CMSG_SPACE(std::max(sizeof(struct in6_pktinfo), sizeof(struct in_pktinfo)))];
-		memset(controldata, 0, sizeof(controldata));
+		uint8_t controldata[UDP_PKTINFO_SPACE];
 
 		memset(&msg, 0, sizeof(msg));
-		msg.msg_name    = reinterpret_cast< struct sockaddr * >(&u.saiUdpAddress);
+		msg.msg_name    = reinterpret_cast< struct sockaddr * >(&udpAddress);
 		msg.msg_namelen = static_cast< socklen_t >(
-			(u.saiUdpAddress.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
-		msg.msg_iov        = iov;
-		msg.msg_iovlen     = 1;
-		msg.msg_control    = controldata;
-		msg.msg_controllen = CMSG_SPACE((u.saiUdpAddress.ss_family == AF_INET6) ? sizeof(struct in6_pktinfo)
-																				: sizeof(struct in_pktinfo));
-
-		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
-		HostAddress tcpha(u.saiTcpLocalAddress);
-		if (u.saiUdpAddress.ss_family == AF_INET6) {
-			cmsg->cmsg_level            = IPPROTO_IPV6;
-			cmsg->cmsg_type             = IPV6_PKTINFO;
-			cmsg->cmsg_len              = CMSG_LEN(sizeof(struct in6_pktinfo));
-			struct in6_pktinfo *pktinfo = reinterpret_cast< struct in6_pktinfo * >(CMSG_DATA(cmsg));
-			memset(pktinfo, 0, sizeof(*pktinfo));
-			memcpy(&pktinfo->ipi6_addr.s6_addr[0], tcpha.getByteRepresentation().data(),
-				   sizeof(pktinfo->ipi6_addr.s6_addr));
-		} else {
-			cmsg->cmsg_level           = IPPROTO_IP;
-			cmsg->cmsg_type            = IP_PKTINFO;
-			cmsg->cmsg_len             = CMSG_LEN(sizeof(struct in_pktinfo));
-			struct in_pktinfo *pktinfo = reinterpret_cast< struct in_pktinfo * >(CMSG_DATA(cmsg));
-			memset(pktinfo, 0, sizeof(*pktinfo));
-			if (tcpha.isV6())
-				return;
-			pktinfo->ipi_spec_dst.s_addr = tcpha.toIPv4();
-		}
+			(udpAddress.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+		msg.msg_iov     = iov;
+		msg.msg_iovlen  = 1;
+		msg.msg_control = controldata;
 
+		if (!setUDPPacketInfo(msg, udpAddress, u.haTcpLocalAddress)) {
+			return;
+		}
 
-		::sendmsg(u.sUdpSocket, &msg, 0);
+		::sendmsg(udpSocket, &msg, 0);
 #else
 #	ifdef Q_OS_WIN
 		using size_type = int;
 #	else
 		using size_type = std::size_t;
 #	endif
-		::sendto(u.sUdpSocket, buffer, static_cast< size_type >(len + 4), 0,
-				 reinterpret_cast< struct sockaddr * >(&u.saiUdpAddress),
-				 (u.saiUdpAddress.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+		::sendto(udpSocket, buffer, static_cast< size_type >(len + 4), 0,
+				 reinterpret_cast< struct sockaddr * >(&udpAddress),
+				 (udpAddress.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
 #endif
 #ifdef Q_OS_WIN
 		if (Meta::hQoS && dwFlow)
 			QOSRemoveSocketFromFlow(Meta::hQoS, 0, dwFlow, 0);
 #else
 #endif
+		metrics.add(VoiceCounter::UDPPacketsSent);
+		metrics.add(VoiceCounter::UDPBytesSent, static_cast< std::uint64_t >(len + 4));
 	} else {
-		if (cache.isEmpty())
-			cache = QByteArray(reinterpret_cast< const char * >(data), len);
-		emit tcpTransmit(cache, u.uiSession);
+		TunnelQueue &queue = u.tunnelQueue();
+		if (!queue.push(data, static_cast< std::size_t >(len))) {
+			metrics.add(VoiceCounter::TCPTunnelPacketsDropped);
+			return;
+		}
+		metrics.add(VoiceCounter::TCPTunnelPacketsSent);
+
+		// Only the first packet queued since the last drain has to make sure that another one is going to happen
+		if (queue.markPending()) {
+			if (!m_pendingTunnelSessions.push(u.uiSession)) {
+				m_tunnelDrainAll = true;
+			}
+			if (!m_tunnelDrainScheduled.exchange(true)) {
+				QMetaObject::invokeMethod(this, &Server::drainTunnelQueues, Qt::QueuedConnection);
+			}
+		}
 	}
 }
 
-void Server::addListener(QHash< ServerUser *, VolumeAdjustment > &listeners, ServerUser &user, const Channel &channel) {
-	const VolumeAdjustment &volumeAdjustment =
-		m_channelListenerManager.getListenerVolumeAdjustment(user.uiSession, channel.iId);
-
+void Server::addListener(QHash< ServerUser *, VolumeAdjustment > &listeners, ServerUser &user,
+						 const VolumeAdjustment &volumeAdjustment) {
 	auto it = listeners.find(&user);
 
 	if (it == listeners.end() || it->factor < volumeAdjustment.factor) {
@@ -1137,16 +1421,16 @@ void Server::addListener(QHash< ServerUser *, VolumeAdjustment > &listeners, Ser
 	}
 }
 
-void Server::processMsg(ServerUser *u, Mumble::Protocol::AudioData audioData, AudioReceiverBuffer &buffer,
-						Mumble::Protocol::UDPAudioEncoder< Mumble::Protocol::Role::Server > &encoder) {
+void Server::processMsg(ServerUser *u, const RoutingSnapshot &routing, Mumble::Protocol::AudioData audioData,
+						unsigned int cryptSlot, AudioReceiverBuffer &buffer,
+						Mumble::Protocol::UDPAudioEncoder< Mumble::Protocol::Role::Server > &encoder,
+						UDPSendBatch *sendBatch) {
 	ZoneScoped;
 
-	// Note that in this function we never have to acquire a read-lock on qrwlVoiceThread
-	// as all places that call this function will hold that lock at the point of calling
-	// this function.
-	// This function is currently called from Server::msgUDPTunnel, Server::run and
-	// Server::message
-	if (u->sState != ServerUser::Authenticated || u->bMute || u->bSuppress || u->bSelfMute)
+	// Regular speech is routed purely based on the given snapshot, so there is no need to hold qrwlVoiceThread.
+	// This function is currently called from Server::processUDPDatagram and Server::message
+	const RoutingSnapshot::UserEntry *sender = routing.findUser(u->uiSession);
+	if (!sender || !sender->canSpeak)
 		return;
 
 	// Check the voice data rate limit.
@@ -1158,6 +1442,7 @@ void Server::processMsg(ServerUser *u, Mumble::Protocol::AudioData audioData, Au
 
 		if (!bw->addFrame(static_cast< int >(packetsize), iMaxBandwidth / 8)) {
 			// Suppress packet.
+			m_voiceMetrics.forSlot(cryptSlot).add(VoiceCounter::BandwidthSuppressed);
 			return;
 		}
 	}
@@ -1167,110 +1452,82 @@ void Server::processMsg(ServerUser *u, Mumble::Protocol::AudioData audioData, Au
 	if (audioData.targetOrContext == Mumble::Protocol::ReservedTargetIDs::SERVER_LOOPBACK) {
 		buffer.forceAddReceiver(*u, Mumble::Protocol::AudioContext::NORMAL, audioData.containsPositionalData);
 	} else if (audioData.targetOrContext == Mumble::Protocol::ReservedTargetIDs::REGULAR_SPEECH) {
-		Channel *c = u->cChannel;
-
-		// Send audio to all users that are listening to the channel
-		foreach (unsigned int currentSession, m_channelListenerManager.getListenersForChannel(c->iId)) {
-			ServerUser *pDst = static_cast< ServerUser * >(qhUsers.value(currentSession));
-			if (pDst) {
-				buffer.addReceiver(*u, *pDst, Mumble::Protocol::AudioContext::LISTEN, audioData.containsPositionalData,
-								   m_channelListenerManager.getListenerVolumeAdjustment(pDst->uiSession, c->iId));
+		// The fan-out already contains the members and listeners of the sender's channel and of all linked channels
+		// the sender has speak-permission in, without any duplicates and without deafened users.
+		if (sender->fanOut) {
+			for (const RoutingSnapshot::FanOutEntry &receiver : sender->fanOut->receivers) {
+				if (receiver.user != sender) {
+					buffer.addUniqueReceiver(*receiver.user->user, receiver.context,
+											 audioData.containsPositionalData
+												 && sender->context == receiver.user->context,
+											 receiver.volumeAdjustment);
+				}
 			}
 		}
+	} else {
+		// Whisper/Shout targets are resolved from the live data (protected by qrwlVoiceThread), as the whisper target
+		// cache is maintained on the fly. The ServerUser objects are kept alive by the caller's read guard even after
+		// the lock is released.
+		QReadLocker rl(&qrwlVoiceThread);
 
-		// Send audio to all users in the same channel
-		for (User *p : c->qlUsers) {
-			ServerUser *pDst = static_cast< ServerUser * >(p);
-
-			buffer.addReceiver(*u, *pDst, Mumble::Protocol::AudioContext::NORMAL, audioData.containsPositionalData);
-		}
-
-		// Send audio to all linked channels the user has speak-permission
-		if (!c->qhLinks.isEmpty()) {
-			QSet< Channel * > chans = c->allLinks();
-			chans.remove(c);
+		if (u->qmTargets.contains(static_cast< int >(audioData.targetOrContext))) {
+			QSet< ServerUser * > channel;
+			QSet< ServerUser * > direct;
+			QHash< ServerUser *, VolumeAdjustment > cachedListeners;
 
-			QMutexLocker qml(&qmCache);
+			if (u->qmTargetCache.contains(static_cast< int >(audioData.targetOrContext))) {
+				ZoneScopedN(TracyConstants::AUDIO_WHISPER_CACHE_STORE);
 
-			for (Channel *l : chans) {
-				if (ChanACL::hasPermission(u, l, ChanACL::Speak, &acCache)) {
-					// Send the audio stream to all users that are listening to the linked channel
-					for (unsigned int currentSession : m_channelListenerManager.getListenersForChannel(l->iId)) {
-						ServerUser *pDst = static_cast< ServerUser * >(qhUsers.value(currentSession));
-						if (pDst) {
-							buffer.addReceiver(
-								*u, *pDst, Mumble::Protocol::AudioContext::LISTEN, audioData.containsPositionalData,
-								m_channelListenerManager.getListenerVolumeAdjustment(pDst->uiSession, l->iId));
-						}
-					}
+				const WhisperTargetCache &cache = u->qmTargetCache.value(static_cast< int >(audioData.targetOrContext));
+				channel                         = cache.channelTargets;
+				direct                          = cache.directTargets;
+				cachedListeners                 = cache.listeningTargets;
+			} else {
+				ZoneScopedN(TracyConstants::AUDIO_WHISPER_CACHE_CREATE);
 
-					// Send audio to users in the linked channel
-					for (User *p : l->qlUsers) {
-						ServerUser *pDst = static_cast< ServerUser * >(p);
+				const unsigned int uiSession = u->uiSession;
+				qrwlVoiceThread.unlock();
+				qrwlVoiceThread.lockForWrite();
 
-						buffer.addReceiver(*u, *pDst, Mumble::Protocol::AudioContext::NORMAL,
-										   audioData.containsPositionalData);
-					}
+				if (!qhUsers.contains(uiSession)) {
+					return;
 				}
-			}
-		}
-	} else if (u->qmTargets.contains(static_cast< int >(audioData.targetOrContext))) { // Whisper/Shout
-		QSet< ServerUser * > channel;
-		QSet< ServerUser * > direct;
-		QHash< ServerUser *, VolumeAdjustment > cachedListeners;
 
-		if (u->qmTargetCache.contains(static_cast< int >(audioData.targetOrContext))) {
-			ZoneScopedN(TracyConstants::AUDIO_WHISPER_CACHE_STORE);
+				// Create cache entry for the given target
+				// Note: We have to compute the cache entry and add it to the user's cache store in an atomic
+				// transaction (ensured by the lock) to avoid running into situations in which a user from the cache
+				// gets deleted without this particular cache entry being purged (which happens, if the cache entry is
+				// in the store at the point of deleting the user).
+				const WhisperTarget &wt  = u->qmTargets.value(static_cast< int >(audioData.targetOrContext));
+				WhisperTargetCache cache = createWhisperTargetCacheFor(*u, wt);
 
-			const WhisperTargetCache &cache = u->qmTargetCache.value(static_cast< int >(audioData.targetOrContext));
-			channel                         = cache.channelTargets;
-			direct                          = cache.directTargets;
-			cachedListeners                 = cache.listeningTargets;
-		} else {
-			ZoneScopedN(TracyConstants::AUDIO_WHISPER_CACHE_CREATE);
+				u->qmTargetCache.insert(static_cast< int >(audioData.targetOrContext), std::move(cache));
 
-			const unsigned int uiSession = u->uiSession;
-			qrwlVoiceThread.unlock();
-			qrwlVoiceThread.lockForWrite();
 
-			if (!qhUsers.contains(uiSession)) {
-				return;
+				qrwlVoiceThread.unlock();
+				qrwlVoiceThread.lockForRead();
+				if (!qhUsers.contains(uiSession))
+					return;
 			}
 
-			// Create cache entry for the given target
-			// Note: We have to compute the cache entry and add it to the user's cache store in an atomic
-			// transaction (ensured by the lock) to avoid running into situations in which a user from the cache
-			// gets deleted without this particular cache entry being purged (which happens, if the cache entry is
-			// in the store at the point of deleting the user).
-			const WhisperTarget &wt  = u->qmTargets.value(static_cast< int >(audioData.targetOrContext));
-			WhisperTargetCache cache = createWhisperTargetCacheFor(*u, wt);
-
-			u->qmTargetCache.insert(static_cast< int >(audioData.targetOrContext), std::move(cache));
-
-
-			qrwlVoiceThread.unlock();
-			qrwlVoiceThread.lockForRead();
-			if (!qhUsers.contains(uiSession))
-				return;
-		}
-
-		// These users receive the audio because someone is shouting to their channel
-		for (ServerUser *pDst : channel) {
-			buffer.addReceiver(*u, *pDst, Mumble::Protocol::AudioContext::SHOUT, audioData.containsPositionalData);
-		}
-		// These users receive audio because someone is whispering to them
-		for (ServerUser *pDst : direct) {
-			buffer.addReceiver(*u, *pDst, Mumble::Protocol::AudioContext::WHISPER, audioData.containsPositionalData);
-		}
-		// These users receive audio because someone is sending audio to one of their listeners
-		QHashIterator< ServerUser *, VolumeAdjustment > it(cachedListeners);
-		while (it.hasNext()) {
-			it.next();
-			ServerUser *user                         = it.key();
-			const VolumeAdjustment &volumeAdjustment = it.value();
-
-			buffer.addReceiver(*u, *user, Mumble::Protocol::AudioContext::LISTEN, audioData.containsPositionalData,
-							   volumeAdjustment);
+			// These users receive the audio because someone is shouting to their channel
+			for (ServerUser *pDst : channel) {
+				buffer.addReceiver(*u, *pDst, Mumble::Protocol::AudioContext::SHOUT, audioData.containsPositionalData);
+			}
+			// These users receive audio because someone is whispering to them
+			for (ServerUser *pDst : direct) {
+				buffer.addReceiver(*u, *pDst, Mumble::Protocol::AudioContext::WHISPER, audioData.containsPositionalData);
+			}
+			// These users receive audio because someone is sending audio to one of their listeners
+			QHashIterator< ServerUser *, VolumeAdjustment > it(cachedListeners);
+			while (it.hasNext()) {
+				it.next();
+				ServerUser *user                         = it.key();
+				const VolumeAdjustment &volumeAdjustment = it.value();
+
+				buffer.addReceiver(*u, *user, Mumble::Protocol::AudioContext::LISTEN, audioData.containsPositionalData,
+								   volumeAdjustment);
+			}
 		}
 	}
 
@@ -1278,8 +1535,10 @@ void Server::processMsg(ServerUser *u, Mumble::Protocol::AudioData audioData, Au
 
 	buffer.preprocessBuffer();
 
+	m_voiceMetrics.forSlot(cryptSlot).receivers.record(buffer.getReceivers(true).size()
+													   + buffer.getReceivers(false).size());
+
 	bool isFirstIteration = true;
-	QByteArray tcpCache;
 	for (bool includePositionalData : { true, false }) {
 		std::vector< AudioReceiver > &receiverList = buffer.getReceivers(includePositionalData);
 
@@ -1321,19 +1580,24 @@ void Server::processMsg(ServerUser *u, Mumble::Protocol::AudioData audioData, Au
 			gsl::span< const Mumble::Protocol::byte > encodedPacket = encoder.updateAudioPacket(audioData);
 			TracyCZoneEnd(__tracy_zone);
 
-			// Clear TCP cache
-			tcpCache.clear();
-
 			// Send encoded packet to all receivers of this range
 			for (auto it = currentRange.begin; it != currentRange.end; ++it) {
-				sendMessage(it->getReceiver(), encodedPacket.data(), static_cast< int >(encodedPacket.size()),
-							tcpCache);
+				sendMessage(it->getReceiver(), cryptSlot, encodedPacket.data(),
+							static_cast< int >(encodedPacket.size()), false, sendBatch);
 			}
 
 			// Find next range
 			currentRange = AudioReceiverBuffer::getReceiverRange(currentRange.end, receiverList.end());
 		}
 	}
+
+#ifdef Q_OS_LINUX
+	if (sendBatch) {
+		ZoneScopedN(TracyConstants::UDP_BATCH_FLUSH_ZONE);
+
+		sendBatch->flush();
+	}
+#endif
 }
 
 void Server::log(ServerUser *u, const QString &str) const {
@@ -1367,25 +1631,22 @@ void Server::newClient() {
 
 		HostAddress ha(adr);
 
-		QList< Ban > tmpBans = qlBans;
-		foreach (const Ban &ban, qlBans) {
-			if (ban.isExpired())
-				tmpBans.removeOne(ban);
-		}
-		if (qlBans.count() != tmpBans.count()) {
-			qlBans = tmpBans;
-			saveBans();
+		const QList< Ban > expired = m_banIndex.takeExpired(QDateTime::currentDateTimeUtc());
+		if (!expired.isEmpty()) {
+			// A single pass over the list, however many bans expired
+			const QSet< Ban > expiredSet(expired.cbegin(), expired.cend());
+			qlBans.removeIf([&expiredSet](const Ban &ban) { return expiredSet.contains(ban); });
+			removeBans(expired);
 		}
 
-		foreach (const Ban &ban, qlBans) {
-			if (ban.haAddress.match(ha, static_cast< unsigned int >(ban.iMask))) {
-				log(QString("Ignoring connection: %1, Reason: %2, Username: %3, Hash: %4 (Server ban)")
-						.arg(addressToString(sock->peerAddress(), sock->peerPort()), ban.qsReason, ban.qsUsername,
-							 ban.qsHash));
-				sock->disconnectFromHost();
-				sock->deleteLater();
-				return;
-			}
+		const Ban *ban = m_banIndex.match(ha);
+		if (ban) {
+			log(QString("Ignoring connection: %1, Reason: %2, Username: %3, Hash: %4 (Server ban)")
+					.arg(addressToString(sock->peerAddress(), sock->peerPort()), ban->qsReason, ban->qsUsername,
+						 ban->qsHash));
+			sock->disconnectFromHost();
+			sock->deleteLater();
+			return;
 		}
 
 #ifdef Q_OS_MAC
@@ -1426,6 +1687,12 @@ void Server::newClient() {
 #endif
 		sock->setSslConfiguration(config);
 
+#if QT_VERSION >= QT_VERSION_CHECK(6, 3, 0)
+		sock->setProtocol(QSsl::TlsV1_2OrLater);
+#else
+		sock->setProtocol(QSsl::TlsV1_0OrLater);
+#endif
+
 		if (qqIds.isEmpty()) {
 			log(QString("Session ID pool (%1) empty, rejecting connection").arg(iMaxUsers));
 			sock->disconnectFromHost();
@@ -1433,34 +1700,67 @@ void Server::newClient() {
 			return;
 		}
 
-		ServerUser *u = new ServerUser(this, sock);
-		u->haAddress  = ha;
-		HostAddress(sock->localAddress()).toSockaddr(&u->saiTcpLocalAddress);
+		if (m_handshakePool) {
+			// The ServerUser is created once the handshake completed (see handshakeCompleted)
+			m_handshakePool->enqueue(sock);
+		} else {
+			addConnection(sock);
+			sock->startServerEncryption();
+		}
 
-		connect(u, &ServerUser::connectionClosed, this, &Server::connectionClosed);
-		connect(u, SIGNAL(message(Mumble::Protocol::TCPMessageType, const QByteArray &)), this,
-				SLOT(message(Mumble::Protocol::TCPMessageType, const QByteArray &)));
-		connect(u, &ServerUser::handleSslErrors, this, &Server::sslError);
-		connect(u, &ServerUser::encrypted, this, &Server::encrypted);
+		meta->successfulConnectionFrom(adr);
+	}
+}
 
-		log(u, QString("New connection: %1").arg(addressToString(sock->peerAddress(), sock->peerPort())));
+ServerUser *Server::addConnection(QSslSocket *sock) {
+	ServerUser *u        = new ServerUser(this, sock);
+	u->haAddress         = HostAddress(sock->peerAddress());
+	u->haTcpLocalAddress = HostAddress(sock->localAddress());
 
-		u->setToS();
+	connect(u, &ServerUser::connectionClosed, this, &Server::connectionClosed);
+	connect(u, SIGNAL(message(Mumble::Protocol::TCPMessageType, const QByteArray &)), this,
+			SLOT(message(Mumble::Protocol::TCPMessageType, const QByteArray &)));
+	connect(u, &ServerUser::handleSslErrors, this, &Server::sslError);
+	connect(u, &ServerUser::encrypted, this, &Server::encrypted);
 
-#if QT_VERSION >= QT_VERSION_CHECK(6, 3, 0)
-		sock->setProtocol(QSsl::TlsV1_2OrLater);
-#else
-		sock->setProtocol(QSsl::TlsV1_0OrLater);
-#endif
-		sock->startServerEncryption();
+	log(u, QString("New connection: %1").arg(addressToString(sock->peerAddress(), sock->peerPort())));
 
-		meta->successfulConnectionFrom(adr);
+	u->setToS();
+
+	return u;
+}
+
+void Server::handshakeCompleted(QSslSocket *sock, bool verified) {
+	if (sock->state() != QAbstractSocket::ConnectedState) {
+		// Without a ServerUser listening to the socket, nothing would notice the disconnect and the session would
+		// never be released
+		log(QString("Connection from %1 closed right after the TLS handshake")
+				.arg(addressToString(sock->peerAddress(), sock->peerPort())));
+		sock->deleteLater();
+		return;
 	}
+
+	if (qqIds.isEmpty()) {
+		log(QString("Session ID pool (%1) empty, rejecting connection").arg(iMaxUsers));
+		sock->disconnectFromHost();
+		sock->deleteLater();
+		return;
+	}
+
+	ServerUser *u = addConnection(sock);
+	u->bVerified  = verified;
+
+	clientEncrypted(u);
+
+	// The client may have sent its first messages while the socket was still owned by the handshake thread
+	QMetaObject::invokeMethod(u, "socketRead", Qt::QueuedConnection);
 }
 
 void Server::encrypted() {
-	ServerUser *uSource = qobject_cast< ServerUser * >(sender());
+	clientEncrypted(qobject_cast< ServerUser * >(sender()));
+}
 
+void Server::clientEncrypted(ServerUser *uSource) {
 	MumbleProto::Version mpv;
 	MumbleProto::setVersion(mpv, Version::get());
 	if (Meta::mp.bSendVersion) {
@@ -1496,12 +1796,11 @@ void Server::encrypted() {
 							 .arg(issuer));
 		}
 
-		foreach (const Ban &ban, qlBans) {
-			if (ban.qsHash == uSource->qsHash) {
-				log(uSource, QString("Certificate hash is banned: %1, Username: %2, Reason: %3.")
-								 .arg(ban.qsHash, ban.qsUsername, ban.qsReason));
-				uSource->disconnectSocket();
-			}
+		const Ban *ban = m_banIndex.matchHash(uSource->qsHash);
+		if (ban) {
+			log(uSource, QString("Certificate hash is banned: %1, Username: %2, Reason: %3.")
+							 .arg(ban->qsHash, ban->qsUsername, ban->qsReason));
+			uSource->disconnectSocket();
 		}
 	}
 }
@@ -1511,26 +1810,10 @@ void Server::sslError(const QList< QSslError > &errors) {
 	if (!u)
 		return;
 
-	bool ok = true;
-	foreach (QSslError e, errors) {
-		switch (e.error()) {
-			case QSslError::InvalidPurpose:
-				// Allow email certificates.
-				break;
-			case QSslError::NoPeerCertificate:
-			case QSslError::SelfSignedCertificate:
-			case QSslError::SelfSignedCertificateInChain:
-			case QSslError::UnableToGetLocalIssuerCertificate:
-			case QSslError::UnableToVerifyFirstCertificate:
-			case QSslError::HostNameMismatch:
-			case QSslError::CertificateNotYetValid:
-			case QSslError::CertificateExpired:
-				u->bVerified = false;
-				break;
-			default:
-				log(u, QString("SSL Error: %1").arg(e.errorString()));
-				ok = false;
-		}
+	QStringList fatalErrors;
+	const bool ok = HandshakePool::checkSslErrors(errors, u->bVerified, fatalErrors);
+	foreach (const QString &error, fatalErrors) {
+		log(u, QString("SSL Error: %1").arg(error));
 	}
 
 	if (ok) {
@@ -1622,10 +1905,11 @@ void Server::connectionClosed(QAbstractSocket::SocketError err, const QString &r
 	Channel *old = u->cChannel;
 
 	{
-		QWriteLocker wl(&qrwlVoiceThread);
+		VoiceThreadWriteLocker wl(this);
 
 		qhUsers.remove(u->uiSession);
 		qhHostUsers[u->haAddress].remove(u);
+		qhUdpTokenUsers.remove(u->uiUdpToken.load());
 
 		quint16 port = (u->saiUdpAddress.ss_family == AF_INET6)
 						   ? (reinterpret_cast< sockaddr_in6 * >(&u->saiUdpAddress)->sin6_port)
@@ -1649,7 +1933,7 @@ void Server::connectionClosed(QAbstractSocket::SocketError err, const QString &r
 		recheckCodecVersions(); // Maybe can choose a better codec now
 	}
 
-	u->deleteLater();
+	disposeUser(u);
 
 	if (qhUsers.isEmpty())
 		stopThread();
@@ -1673,10 +1957,10 @@ void Server::message(Mumble::Protocol::TCPMessageType type, const QByteArray &qb
 			return;
 		}
 
-		QReadLocker rl(&qrwlVoiceThread);
-
 		u->aiUdpFlag = 0;
 
+		m_voiceMetrics.forSlot(VoiceCryptState::MAIN_THREAD_SLOT).add(VoiceCounter::TCPTunnelPacketsReceived);
+
 		m_tcpTunnelDecoder.setProtocolVersion(u->m_version);
 
 		if (m_tcpTunnelDecoder.decode(gsl::span< const Mumble::Protocol::byte >(
@@ -1695,7 +1979,13 @@ void Server::message(Mumble::Protocol::TCPMessageType type, const QByteArray &qb
 					// Add session id
 					audioData.senderSession = u->uiSession;
 
-					processMsg(u, std::move(audioData), m_tcpAudioReceivers, m_tcpAudioEncoder);
+					UDPSendBatch *sendBatch = nullptr;
+#ifdef Q_OS_LINUX
+					sendBatch = m_tcpSendBatch.get();
+#endif
+					// The main thread is the one publishing the snapshots, so it may use the current one without a guard
+					processMsg(u, m_routingTable.current(), std::move(audioData), VoiceCryptState::MAIN_THREAD_SLOT,
+							   m_tcpAudioReceivers, m_tcpAudioEncoder, sendBatch);
 				}
 			}
 		}
@@ -1749,21 +2039,32 @@ void Server::checkTimeout() {
 		u->disconnectSocket(true);
 }
 
-void Server::tcpTransmitData(QByteArray a, unsigned int id) {
-	Connection *c = qhUsers.value(id);
-	if (c) {
-		QByteArray qba;
-		const auto len = a.size();
+void Server::drainTunnelQueues() {
+	// Reset the flag before draining, so that packets queued in the meantime get another drain scheduled
+	m_tunnelDrainScheduled = false;
 
-		qba.resize(len + 6);
-		unsigned char *uc = reinterpret_cast< unsigned char * >(qba.data());
-		*reinterpret_cast< quint16 * >(&uc[0]) =
-			qToBigEndian(static_cast< quint16 >(Mumble::Protocol::TCPMessageType::UDPTunnel));
-		*reinterpret_cast< quint32 * >(&uc[2]) = qToBigEndian(static_cast< quint32 >(len));
-		memcpy(uc + 6, a.constData(), static_cast< std::size_t >(len));
+	// Only the users that have packets pending are visited
+	unsigned int session;
+	while (m_pendingTunnelSessions.pop(session)) {
+		drainTunnelQueue(qhUsers.value(session));
+	}
+
+	if (m_tunnelDrainAll.exchange(false)) {
+		foreach (ServerUser *u, qhUsers) { drainTunnelQueue(u); }
+	}
+}
 
-		c->sendMessage(qba);
-		c->forceFlush();
+void Server::drainTunnelQueue(ServerUser *u) {
+	TunnelQueue *queue = u ? u->existingTunnelQueue() : nullptr;
+	if (!queue || !queue->takePending()) {
+		return;
+	}
+
+	// All packets queued for the user since the last drain are written at once
+	m_tunnelBuffer.resize(0);
+	if (queue->drain(m_tunnelBuffer) > 0) {
+		u->sendMessage(m_tunnelBuffer);
+		u->forceFlush();
 	}
 }
 
@@ -1818,15 +2119,16 @@ void Server::removeChannel(Channel *chan, Channel *dest) {
 		dest = chan->cParent;
 
 	{
-		QWriteLocker wl(&qrwlVoiceThread);
+		VoiceThreadWriteLocker wl(this);
 		chan->unlink(nullptr);
+		++m_linkGeneration;
 	}
 
 	foreach (c, chan->qlChannels) { removeChannel(c, dest); }
 
 	foreach (p, chan->qlUsers) {
 		{
-			QWriteLocker wl(&qrwlVoiceThread);
+			VoiceThreadWriteLocker wl(this);
 			chan->removeUser(p);
 		}
 
@@ -1868,10 +2170,13 @@ void Server::removeChannel(Channel *chan, Channel *dest) {
 	emit channelRemoved(chan);
 
 	if (chan->cParent) {
-		QWriteLocker wl(&qrwlVoiceThread);
+		VoiceThreadWriteLocker wl(this);
 		chan->cParent->removeChannel(chan);
 	}
 
+	// Nothing may refer to the channel once it has been deleted
+	discardChannelACLs(chan);
+
 	delete chan;
 }
 
@@ -1892,6 +2197,10 @@ bool Server::unregisterUser(int id) {
 					write = true;
 				}
 			}
+			if (write) {
+				// The compiled ACLs contain the removed ones
+				acCache.invalidateChannel(c);
+			}
 			foreach (Group *g, c->qhGroups) {
 				bool addrem = g->qsAdd.remove(id);
 				bool remrem = g->qsRemove.remove(id);
@@ -1928,7 +2237,7 @@ void Server::userEnterChannel(User *p, Channel *c, MumbleProto::UserState &mpus)
 	Channel *old = p->cChannel;
 
 	{
-		QWriteLocker wl(&qrwlVoiceThread);
+		VoiceThreadWriteLocker wl(this);
 		c->addUser(p);
 
 		bool mayspeak = ChanACL::hasPermission(static_cast< ServerUser * >(p), c, ChanACL::Speak, nullptr);
@@ -1978,10 +2287,7 @@ void Server::sendClientPermission(ServerUser *u, Channel *c, bool explicitlyRequ
 
 	{
 		QMutexLocker qml(&qmCache);
-		// Abuse that hasPermission will update acCache with the latest permissions (all of them,
-		// not only the requested one) so that we can pull this information out of it afterwards.
-		ChanACL::hasPermission(u, c, ChanACL::Enter, &acCache);
-		perm = acCache.value(u)->value(c);
+		perm = acCache.cachedPermissions(u->aclSubject(), c);
 	}
 
 	if (explicitlyRequested) {
@@ -2018,8 +2324,7 @@ void Server::flushClientPermissionCache(ServerUser *u, MumbleProto::PermissionQu
 		if (!c) {
 			match = false;
 		} else {
-			ChanACL::hasPermission(u, c, ChanACL::Enter, &acCache);
-			unsigned int perm = acCache.value(u)->value(c);
+			unsigned int perm = acCache.cachedPermissions(u->aclSubject(), c);
 			if (perm != i.value())
 				match = false;
 		}
@@ -2036,8 +2341,7 @@ void Server::flushClientPermissionCache(ServerUser *u, MumbleProto::PermissionQu
 		u->iLastPermissionCheck = static_cast< int >(c->iId);
 	}
 
-	ChanACL::hasPermission(u, c, ChanACL::Enter, &acCache);
-	unsigned int perm = acCache.value(u)->value(c);
+	unsigned int perm = acCache.cachedPermissions(u->aclSubject(), c);
 	u->qmPermissionSent.insert(static_cast< int >(c->iId), perm);
 
 	mppq.Clear();
@@ -2048,6 +2352,21 @@ void Server::flushClientPermissionCache(ServerUser *u, MumbleProto::PermissionQu
 	sendMessage(u, mppq);
 }
 
+void Server::updateSuppression(ServerUser *u) {
+	bool maySpeak = ChanACL::hasPermission(u, u->cChannel, ChanACL::Speak, &acCache);
+
+	if (maySpeak == u->bSuppress) {
+		// Mirror a user's ability to speak in the current channel (by means of the ACLs) in the suppress
+		// property (not being allowed to speak -> suppressed and vice versa)
+		u->bSuppress = !maySpeak;
+
+		MumbleProto::UserState mpus;
+		mpus.set_session(u->uiSession);
+		mpus.set_suppress(true);
+		sendAll(mpus);
+	}
+}
+
 void Server::clearACLCache(User *p) {
 	MumbleProto::PermissionQuery mppq;
 
@@ -2055,13 +2374,10 @@ void Server::clearACLCache(User *p) {
 		QMutexLocker qml(&qmCache);
 
 		if (p) {
-			ChanACL::ChanCache *h = acCache.take(p);
-			delete h;
+			acCache.invalidateUser(p);
 
 			flushClientPermissionCache(static_cast< ServerUser * >(p), mppq);
 		} else {
-			foreach (ChanACL::ChanCache *h, acCache)
-				delete h;
 			acCache.clear();
 
 			foreach (ServerUser *u, qhUsers)
@@ -2070,27 +2386,11 @@ void Server::clearACLCache(User *p) {
 		}
 
 		// A change in ACLs could also change a user's suppression state
-		MumbleProto::UserState mpus;
-		auto processingFunction = [&](ServerUser *user) {
-			bool maySpeak = ChanACL::hasPermission(user, user->cChannel, ChanACL::Speak, &acCache);
-
-			if (maySpeak == user->bSuppress) {
-				// Mirror a user's ability to speak in the current channel (by means of the ACLs) in the suppress
-				// property (not being allowed to speak -> suppressed and vice versa)
-				user->bSuppress = !maySpeak;
-
-				mpus.Clear();
-				mpus.set_session(user->uiSession);
-				mpus.set_suppress(true);
-				sendAll(mpus);
-			}
-		};
-
 		if (p) {
-			processingFunction(static_cast< ServerUser * >(p));
+			updateSuppression(static_cast< ServerUser * >(p));
 		} else {
 			for (ServerUser *currentUser : qhUsers) {
-				processingFunction(currentUser);
+				updateSuppression(currentUser);
 			}
 		}
 	}
@@ -2098,14 +2398,214 @@ void Server::clearACLCache(User *p) {
 	// A change in ACLs means that the user might be able to whisper
 	// to users it didn't have permission to do before (or vice versa)
 	clearWhisperTargetCache();
+	// ... or to speak into other linked channels
+	invalidateRoutingSnapshot();
+}
+
+void Server::clearChannelACLCache(Channel *c) {
+	MumbleProto::PermissionQuery mppq;
+
+	{
+		QMutexLocker qml(&qmCache);
+
+		const QSet< const Channel * > affected = acCache.invalidateChannel(c);
+
+		// Only the permissions in the affected channels may have changed, so only users that have been told about
+		// these or that are in one of them have to be updated
+		for (ServerUser *u : qhUsers) {
+			if (u->sState != ServerUser::Authenticated) {
+				continue;
+			}
+
+			for (auto it = u->qmPermissionSent.constBegin(); it != u->qmPermissionSent.constEnd(); ++it) {
+				if (affected.contains(qhChannels.value(static_cast< unsigned int >(it.key())))) {
+					flushClientPermissionCache(u, mppq);
+					break;
+				}
+			}
+		}
+
+		for (ServerUser *u : qhUsers) {
+			if (affected.contains(u->cChannel)) {
+				updateSuppression(u);
+			}
+		}
+	}
+
+	clearWhisperTargetCache();
+	invalidateRoutingSnapshot();
+}
+
+void Server::discardChannelACLs(Channel *c) {
+	QMutexLocker qml(&qmCache);
+
+	acCache.invalidateChannel(c);
 }
 
 void Server::clearWhisperTargetCache() {
-	QWriteLocker lock(&qrwlVoiceThread);
+	// Whisper targets aren't part of the routing snapshot
+	VoiceThreadWriteLocker lock(this, false);
 
 	foreach (ServerUser *u, qhUsers) { u->qmTargetCache.clear(); }
 }
 
+void Server::invalidateRoutingSnapshot() {
+	if (!m_routingSnapshotPending.exchange(true)) {
+		QMetaObject::invokeMethod(this, &Server::publishRoutingSnapshot, Qt::QueuedConnection);
+	}
+}
+
+void Server::publishRoutingSnapshot() {
+	ZoneScopedN(TracyConstants::ROUTING_SNAPSHOT_PUBLISH_ZONE);
+
+	// Reset the flag before building, so that changes made by the voice threads in the meantime aren't lost
+	m_routingSnapshotPending = false;
+
+	m_routingTable.publish(buildRoutingSnapshot());
+
+	reclaimRouting();
+}
+
+void Server::reclaimRouting() {
+	m_routingReclaimScheduled = false;
+
+	if (m_routingTable.reclaim() && !m_routingReclaimScheduled) {
+		// Some voice thread is still processing a packet based on an old snapshot. This is only a matter of
+		// microseconds, so just try again a bit later.
+		m_routingReclaimScheduled = true;
+		QTimer::singleShot(10, this, &Server::reclaimRouting);
+	}
+}
+
+void Server::disposeUser(ServerUser *u) {
+	// The voice threads might still be using the user through the current routing snapshot
+	m_routingTable.retire([u]() { u->deleteLater(); });
+
+	invalidateRoutingSnapshot();
+}
+
+std::unique_ptr< RoutingSnapshot > Server::buildRoutingSnapshot() {
+	std::unique_ptr< RoutingSnapshot > snapshot = std::make_unique< RoutingSnapshot >();
+
+	snapshot->users.reserve(static_cast< std::size_t >(qhUsers.size()));
+	for (ServerUser *u : qhUsers) {
+		RoutingSnapshot::UserEntry entry;
+		entry.user     = u;
+		entry.session  = u->uiSession;
+		entry.channel  = u->cChannel ? u->cChannel->iId : 0;
+		entry.canSpeak = u->sState == ServerUser::Authenticated && !u->bMute && !u->bSuppress && !u->bSelfMute;
+		entry.deaf     = u->bDeaf || u->bSelfDeaf;
+		entry.context  = u->ssContext;
+
+		snapshot->users.emplace(u->uiSession, std::move(entry));
+	}
+
+	assert(qhUsers.size() >= static_cast< int >(m_botCount));
+	snapshot->userCount = static_cast< unsigned int >(qhUsers.size()) - m_botCount;
+
+	snapshot->channels.reserve(static_cast< std::size_t >(qhChannels.size()));
+	for (const Channel *c : qhChannels) {
+		RoutingSnapshot::ChannelEntry &entry = snapshot->channels[c->iId];
+		entry.id                             = c->iId;
+
+		for (const User *p : c->qlUsers) {
+			const RoutingSnapshot::UserEntry *member = snapshot->findUser(p->uiSession);
+
+			if (member && !member->deaf) {
+				entry.members.push_back(member);
+			}
+		}
+
+		m_channelListenerManager.forEachListener(
+			c->iId, [&](unsigned int session, const VolumeAdjustment &volumeAdjustment) {
+				const RoutingSnapshot::UserEntry *listener = snapshot->findUser(session);
+
+				if (listener && !listener->deaf) {
+					entry.listeners.push_back({ listener, volumeAdjustment });
+				}
+			});
+	}
+
+	// Evaluating the Speak permission in linked channels used to happen for every single audio packet
+	{
+		QMutexLocker qml(&qmCache);
+
+		// Most snapshots are built because of changes that don't affect any permissions or links (e.g. a user muting
+		// itself), in which case the speakLinks of the current snapshot are still valid
+		const RoutingSnapshot &previous = m_routingTable.current();
+		const bool reusable =
+			m_routingACLGeneration == acCache.generation() && m_routingLinkGeneration == m_linkGeneration;
+
+		// The linked channels of every channel are only collected once
+		QHash< Channel *, QSet< Channel * > > links;
+
+		for (auto &current : snapshot->users) {
+			RoutingSnapshot::UserEntry &entry = current.second;
+			Channel *c                        = entry.user->cChannel;
+
+			if (!entry.canSpeak || !c || c->qhLinks.isEmpty()) {
+				continue;
+			}
+
+			if (reusable) {
+				const RoutingSnapshot::UserEntry *old = previous.findUser(entry.session);
+
+				if (old && old->user == entry.user && old->channel == entry.channel && old->canSpeak) {
+					for (const RoutingSnapshot::ChannelEntry *oldLink : old->speakLinks) {
+						if (const RoutingSnapshot::ChannelEntry *link = snapshot->findChannel(oldLink->id)) {
+							entry.speakLinks.push_back(link);
+						}
+					}
+					continue;
+				}
+			}
+
+			auto it = links.find(c);
+			if (it == links.end()) {
+				QSet< Channel * > chans = c->allLinks();
+				chans.remove(c);
+				it = links.insert(c, chans);
+			}
+
+			for (Channel *l : it.value()) {
+				const RoutingSnapshot::ChannelEntry *link = snapshot->findChannel(l->iId);
+
+				if (link && ChanACL::hasPermission(entry.user, l, ChanACL::Speak, &acCache)) {
+					entry.speakLinks.push_back(link);
+				}
+			}
+		}
+
+		m_routingACLGeneration  = acCache.generation();
+		m_routingLinkGeneration = m_linkGeneration;
+	}
+
+	{
+		// The voice threads modify qhPeerUsers when binding the UDP address of a peer. Copying the hash is cheap
+		// thanks to implicit sharing.
+		QReadLocker rl(&qrwlVoiceThread);
+
+		snapshot->peers = qhPeerUsers;
+	}
+
+	snapshot->buildFanOuts();
+
+	return snapshot;
+}
+
+VoiceThreadWriteLocker::VoiceThreadWriteLocker(Server *server, bool invalidateRouting)
+	: m_server(server), m_invalidateRouting(invalidateRouting) {
+	m_server->qrwlVoiceThread.lockForWrite();
+}
+
+VoiceThreadWriteLocker::~VoiceThreadWriteLocker() {
+	m_server->qrwlVoiceThread.unlock();
+
+	if (m_invalidateRouting) {
+		m_server->invalidateRoutingSnapshot();
+	}
+}
+
 QString Server::addressToString(const QHostAddress &adr, unsigned short port) {
 	HostAddress ha(adr);
 
@@ -2253,79 +2753,54 @@ void Server::recheckCodecVersions(ServerUser *connectingUser) {
 			.arg(bOpus));
 }
 
-void Server::hashAssign(QString &dest, QByteArray &hash, const QString &src) {
-	dest = src;
-	if (src.length() >= 128)
-		hash = sha1(src);
-	else
+void Server::hashAssign(QString &dest, QByteArray &hash, BlobRef &blobRef, const QString &src) {
+	if (src.length() >= 128) {
+		blobRef = meta->m_blobStore->insert(src.toUtf8());
+		hash    = blobRef.hash();
+		dest    = QString();
+	} else {
+		dest = src;
 		hash = QByteArray();
+		blobRef.reset();
+	}
 }
 
-void Server::hashAssign(QByteArray &dest, QByteArray &hash, const QByteArray &src) {
-	dest = src;
-	if (src.length() >= 128)
-		hash = sha1(src);
-	else
+void Server::hashAssign(QByteArray &dest, QByteArray &hash, BlobRef &blobRef, const QByteArray &src) {
+	if (src.length() >= 128) {
+		blobRef = meta->m_blobStore->insert(src);
+		hash    = blobRef.hash();
+		dest    = QByteArray();
+	} else {
+		dest = src;
 		hash = QByteArray();
+		blobRef.reset();
+	}
 }
 
-bool Server::isTextAllowed(QString &text, bool &changed) {
-	changed = false;
-
+bool Server::isTextAllowed(std::string &text) {
 	if (!bAllowHTML) {
-		QString out;
-		if (HTMLFilter::filter(text, out)) {
-			changed = true;
-			text    = out;
-		}
-		return ((iMaxTextMessageLength == 0) || (text.length() <= iMaxTextMessageLength));
+		std::string plainText;
+		const HTMLScan scan = HTMLFilter::scan(text, &plainText);
+		text.swap(plainText);
+		return ((iMaxTextMessageLength == 0) || (scan.plainTextLength <= iMaxTextMessageLength));
 	} else {
-		auto length = text.length();
-
 		// No limits
 		if ((iMaxTextMessageLength == 0) && (iMaxImageMessageLength == 0))
 			return true;
 
+		const HTMLScan scan = HTMLFilter::scan(text);
+
 		// Over Image limit? (If so, always fail)
-		if ((iMaxImageMessageLength != 0) && (length > iMaxImageMessageLength))
+		if ((iMaxImageMessageLength != 0) && (scan.length > iMaxImageMessageLength))
 			return false;
 
 		// Under textlength?
-		if ((iMaxTextMessageLength == 0) || (length <= iMaxTextMessageLength))
+		if ((iMaxTextMessageLength == 0) || (scan.length <= iMaxTextMessageLength))
 			return true;
 
-		// Over textlength, under imagelength. If no XML, this is a fail.
-		if (!text.contains(QLatin1Char('<')))
-			return false;
-
-		// Strip value from <img>s src attributes to check text-length only -
-		// we already ensured the img-length requirement is met
-		QString qsOut;
-		QXmlStreamReader qxsr(QString::fromLatin1("<document>%1</document>").arg(text));
-		QXmlStreamWriter qxsw(&qsOut);
-		while (!qxsr.atEnd()) {
-			switch (qxsr.readNext()) {
-				case QXmlStreamReader::Invalid:
-					return false;
-				case QXmlStreamReader::StartElement: {
-					if (qxsr.name() == QLatin1String("img")) {
-						qxsw.writeStartElement(qxsr.namespaceUri().toString(), qxsr.name().toString());
-						foreach (const QXmlStreamAttribute &a, qxsr.attributes())
-							if (a.name() != QLatin1String("src"))
-								qxsw.writeAttribute(a);
-					} else {
-						qxsw.writeCurrentToken(qxsr);
-					}
-				} break;
-				default:
-					qxsw.writeCurrentToken(qxsr);
-					break;
-			}
-		}
-
-		length = qsOut.length();
-
-		return (length <= iMaxTextMessageLength);
+		// Over textlength, under imagelength. Only the src attributes of <img>s may make up the difference, which
+		// requires the HTML to be well-formed.
+		return scan.wellFormed && (scan.textLength <= iMaxTextMessageLength);
 	}
 }
 
@@ -2373,16 +2848,17 @@ WhisperTargetCache Server::createWhisperTargetCacheFor(ServerUser &speaker, cons
 							cache.channelTargets.insert(static_cast< ServerUser * >(p));
 						}
 
-						for (unsigned int currentSession :
-							 m_channelListenerManager.getListenersForChannel(targetChannel->iId)) {
-							// Add users that listen to the target channel (duplicates with users directly
-							// in this channel are handled further down)
-							ServerUser *pDst = static_cast< ServerUser * >(qhUsers.value(currentSession));
+						m_channelListenerManager.forEachListener(
+							targetChannel->iId,
+							[&](unsigned int currentSession, const VolumeAdjustment &volumeAdjustment) {
+								// Add users that listen to the target channel (duplicates with users directly
+								// in this channel are handled further down)
+								ServerUser *pDst = static_cast< ServerUser * >(qhUsers.value(currentSession));
 
-							if (pDst) {
-								addListener(cache.listeningTargets, *pDst, *targetChannel);
-							}
-						}
+								if (pDst) {
+									addListener(cache.listeningTargets, *pDst, volumeAdjustment);
+								}
+							});
 					}
 				} else {
 					QSet< Channel * > channels;
@@ -2414,18 +2890,20 @@ WhisperTargetCache Server::createWhisperTargetCacheFor(ServerUser &speaker, cons
 								}
 							}
 
-							for (unsigned int currentSession :
-								 m_channelListenerManager.getListenersForChannel(subTargetChan->iId)) {
-								ServerUser *pDst = static_cast< ServerUser * >(qhUsers.value(currentSession));
-
-								if (pDst
-									&& (!restrictToGroup
-										|| Group::appliesToUser(*subTargetChan, *subTargetChan, targetGroup, *pDst))) {
-									// Only send audio to listener if the user exists and it is in the group the
-									// speech is directed at (if any)
-									addListener(cache.listeningTargets, *pDst, *subTargetChan);
-								}
-							}
+							m_channelListenerManager.forEachListener(
+								subTargetChan->iId,
+								[&](unsigned int currentSession, const VolumeAdjustment &volumeAdjustment) {
+									ServerUser *pDst = static_cast< ServerUser * >(qhUsers.value(currentSession));
+
+									if (pDst
+										&& (!restrictToGroup
+											|| Group::appliesToUser(*subTargetChan, *subTargetChan, targetGroup,
+																	*pDst))) {
+										// Only send audio to listener if the user exists and it is in the group the
+										// speech is directed at (if any)
+										addListener(cache.listeningTargets, *pDst, volumeAdjustment);
+									}
+								});
 						}
 					}
 				}
@@ -13,15 +13,22 @@
 #endif
 
 #include "ACL.h"
+#include "ACLProgram.h"
 #include "AudioReceiverBuffer.h"
 #include "Ban.h"
+#include "BanIndex.h"
 #include "ChannelListenerManager.h"
 #include "HostAddress.h"
 #include "Mumble.pb.h"
 #include "MumbleProtocol.h"
+#include "RoutingSnapshot.h"
 #include "Timer.h"
+#include "TunnelQueue.h"
 #include "User.h"
 #include "Version.h"
+#include "VoiceCryptState.h"
+#include "VoiceMetrics.h"
+#include "VoiceWorker.h"
 #include "VolumeAdjustment.h"
 
 #ifndef Q_MOC_RUN
@@ -48,15 +55,30 @@
 
 #ifdef Q_OS_WIN
 #	include <winsock2.h>
+#else
+#	include <sys/socket.h>
 #endif
 
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
 class Zeroconf;
+class AuthPool;
+class BlobRef;
 class Channel;
+class HandshakePool;
 class PacketDataStream;
 class ServerUser;
+class TextMessageImages;
+class UDPSendBatch;
 class User;
 class QNetworkAccessManager;
 
+struct AuthRequest;
+struct AuthResult;
+
 struct TextMessage {
 	QList< unsigned int > qlSessions;
 	QList< unsigned int > qlChannels;
@@ -149,6 +171,29 @@ public:
 
 	bool broadcastListenerVolumeAdjustments;
 
+	/// The maximum amount of UDP datagrams received or sent with a single system call. A value of 1
+	/// disables batching.
+	unsigned int iUDPBatchSize;
+
+	/// The amount of threads processing incoming UDP packets. If this is greater than 1, every thread gets its own
+	/// SO_REUSEPORT socket per bind address.
+	unsigned int iVoiceThreads;
+
+	/// The amount of threads performing the TLS handshakes of new connections. With 0, the handshakes are
+	/// performed by the Server's own thread.
+	unsigned int iHandshakeThreads;
+	/// The maximum amount of TLS handshakes performed at the same time by the handshake threads (0 for no limit)
+	unsigned int iHandshakeLimit;
+
+	/// The amount of threads authenticating users (hashing passwords, looking up accounts and calling the RPC
+	/// authenticator). With 0, the Server's own thread authenticates the users.
+	unsigned int iAuthThreads;
+	/// The maximum amount of authentication attempts waiting for or being processed by the authentication threads.
+	/// Further attempts are rejected right away (0 for no limit).
+	unsigned int iAuthLimit;
+	/// The time in seconds an authentication attempt may take before it is rejected
+	int iAuthTimeout;
+
 	Version::full_t m_suggestVersion;
 
 	QVariant qvSuggestPositional;
@@ -178,15 +223,15 @@ public:
 	ChannelListenerManager m_channelListenerManager;
 
 
-	Mumble::Protocol::UDPDecoder< Mumble::Protocol::Role::Server > m_udpDecoder;
+	/// The state of the Server's own voice thread (respectively of udpActivated, if the voice thread isn't running)
+	VoiceWorkerState m_udpState;
 	Mumble::Protocol::UDPDecoder< Mumble::Protocol::Role::Server > m_tcpTunnelDecoder;
-	Mumble::Protocol::UDPPingEncoder< Mumble::Protocol::Role::Server > m_udpPingEncoder;
-	Mumble::Protocol::UDPAudioEncoder< Mumble::Protocol::Role::Server > m_udpAudioEncoder;
 	Mumble::Protocol::UDPAudioEncoder< Mumble::Protocol::Role::Server > m_tcpAudioEncoder;
 
 	gsl::span< const Mumble::Protocol::byte >
 		handlePing(const Mumble::Protocol::UDPDecoder< Mumble::Protocol::Role::Server > &decoder,
-				   Mumble::Protocol::UDPPingEncoder< Mumble::Protocol::Role::Server > &encoder, bool expectExtended);
+				   Mumble::Protocol::UDPPingEncoder< Mumble::Protocol::Role::Server > &encoder, bool expectExtended,
+				   const RoutingSnapshot &routing);
 
 	void readParams();
 
@@ -210,9 +255,88 @@ private:
 	int iChannelNestingLimit;
 	int iChannelCountLimit;
 
-	AudioReceiverBuffer m_udpAudioReceivers;
 	AudioReceiverBuffer m_tcpAudioReceivers;
 
+#ifdef Q_OS_LINUX
+	/// Outgoing datagrams produced by audio that has been tunneled through TCP (main thread)
+	std::unique_ptr< UDPSendBatch > m_tcpSendBatch;
+#endif
+
+	/// The voice threads in addition to the Server's own one (only used if iVoiceThreads > 1)
+	std::vector< std::unique_ptr< VoiceWorker > > m_voiceWorkers;
+
+	/// The routing data used by the voice threads (see invalidateRoutingSnapshot)
+	RoutingTable m_routingTable;
+	/// Whether a new routing snapshot has already been requested but not yet published
+	std::atomic< bool > m_routingSnapshotPending{ false };
+	/// Whether a deferred call to reclaimRouting has already been scheduled
+	bool m_routingReclaimScheduled = false;
+	/// Changes whenever channels are linked or unlinked (main thread)
+	std::uint64_t m_linkGeneration = 0;
+	/// The generations of acCache and of the links the current routing snapshot has been built with. As long as they
+	/// don't change, the speakLinks of users that are still in the same channel are taken over from the current
+	/// snapshot instead of evaluating the ACLs again.
+	std::uint64_t m_routingACLGeneration  = 0;
+	std::uint64_t m_routingLinkGeneration = 0;
+
+	/// Whether a call to drainTunnelQueues has already been scheduled but not yet started
+	std::atomic< bool > m_tunnelDrainScheduled{ false };
+	/// The sessions of the users whose tunnel queue has become pending since the last drain. A session may be
+	/// contained more than once or belong to a user that is gone by now.
+	PendingTunnelSessions m_pendingTunnelSessions{ 1024 };
+	/// Whether m_pendingTunnelSessions has been full, so that the next drain has to check the queues of all users
+	std::atomic< bool > m_tunnelDrainAll{ false };
+	/// The buffer the tunnel queue of a user is drained into (main thread)
+	QByteArray m_tunnelBuffer;
+
+	/// Hot-path statistics of the voice processing. Every thread records into the slot it also uses for encrypting
+	/// (see VoiceCryptState).
+	VoiceMetrics m_voiceMetrics{ VoiceCryptState::SLOT_COUNT };
+
+	/// Performs the TLS handshakes of new connections if iHandshakeThreads is greater than 0
+	std::unique_ptr< HandshakePool > m_handshakePool;
+
+	/// Performs the authentication of users if iAuthThreads is greater than 0
+	std::unique_ptr< AuthPool > m_authPool;
+	/// The last ticket handed out for an authentication attempt (see ServerUser::uiAuthTicket)
+	quint64 m_lastAuthTicket = 0;
+
+	/// The images of recent text messages, which clients with ServerUser::m_imageReferences fetch on demand
+	std::unique_ptr< TextMessageImages > m_textMessageImages;
+
+	/// Creates the ServerUser for a new connection
+	ServerUser *addConnection(QSslSocket *sock);
+	/// Continues the handling of the given Authenticate message once the user's credentials have been looked up
+	void completeAuthentication(ServerUser *uSource, const MumbleProto::Authenticate &msg, const AuthResult &result);
+	/// Sends the server's version and checks the client's certificate once the TLS handshake completed
+	void clientEncrypted(ServerUser *u);
+
+	std::unique_ptr< RoutingSnapshot > buildRoutingSnapshot();
+	void disposeUser(ServerUser *u);
+#ifdef Q_OS_UNIX
+	/// Finds the user the given packet of an unknown peer belongs to and binds its UDP endpoint to the peer. On
+	/// success, the decrypted packet is stored in plain and len is reduced to the length of the encrypted packet
+	/// (without the token, if any). How the user has been found is recorded in the given metrics.
+	///
+	/// @returns The user or nullptr if the packet couldn't be associated with any user
+	ServerUser *bindUnknownPeer(int sock, const unsigned char *encrypt, unsigned char *plain, qint32 &len,
+								const sockaddr_storage &from, const QPair< HostAddress, quint16 > &key,
+								VoiceThreadMetrics &metrics);
+#else
+	ServerUser *bindUnknownPeer(SOCKET sock, const unsigned char *encrypt, unsigned char *plain, qint32 &len,
+								const sockaddr_storage &from, const QPair< HostAddress, quint16 > &key,
+								VoiceThreadMetrics &metrics);
+#endif
+
+private slots:
+	void publishRoutingSnapshot();
+	void reclaimRouting();
+	/// Writes the voice packets queued by the voice threads for users that are tunneling voice through TCP (see
+	/// TunnelQueue) to their connections
+	void drainTunnelQueues();
+	/// Writes the packets in the given user's tunnel queue to its connection, if the queue is pending
+	void drainTunnelQueue(ServerUser *u);
+
 public slots:
 	void regSslError(const QList< QSslError > &);
 	void finished();
@@ -235,13 +359,12 @@ public slots:
 	void sslError(const QList< QSslError > &);
 	void message(Mumble::Protocol::TCPMessageType, const QByteArray &, ServerUser *cCon = nullptr);
 	void checkTimeout();
-	void tcpTransmitData(QByteArray, unsigned int);
 	void doSync(unsigned int);
 	void encrypted();
+	void handshakeCompleted(QSslSocket *sock, bool verified);
 	void udpActivated(int);
 signals:
 	void reqSync(unsigned int);
-	void tcpTransmit(QByteArray, unsigned int id);
 
 public:
 	int iServerNum;
@@ -249,12 +372,19 @@ public:
 	QList< SslServer * > qlServer;
 	QTimer *qtTimeout;
 
+	/// The UDP sockets of this server. If there are multiple voice threads, this contains iVoiceThreads
+	/// consecutive sockets per bind address and voice thread i handles the sockets whose index modulo
+	/// iVoiceThreads equals i.
 #ifdef Q_OS_UNIX
-	int aiNotify[2];
 	QList< int > qlUdpSocket;
+	int aiNotify[2];
+
+	int createUDPSocket(SslServer *ss, bool reusePort);
 #else
-	HANDLE hNotify;
 	QList< SOCKET > qlUdpSocket;
+	HANDLE hNotify;
+
+	SOCKET createUDPSocket(SslServer *ss, bool reusePort);
 #endif
 	QList< QSocketNotifier * > qlUdpNotifier;
 
@@ -262,8 +392,20 @@ public:
 	/// main thread (where control channel messages and
 	/// RPC happens), and the Server's voice thread.
 	///
+	/// Note that the voice threads route regular speech
+	/// based on the routing snapshot (see
+	/// invalidateRoutingSnapshot) and only take this lock
+	/// on the cold paths (binding the UDP address of a
+	/// peer and whispering/shouting). Thus, the main thread
+	/// must use a VoiceThreadWriteLocker instead of locking
+	/// this lock for writing directly.
+	///
 	/// These are the only two threads in Murmur that
-	/// access a Server's data.
+	/// access a Server's data. If the server uses multiple
+	/// voice threads (see iVoiceThreads), all of them follow
+	/// the same rules as the Server's voice thread. Since
+	/// the lock admits any number of concurrent readers,
+	/// they do not exclude each other on the hot path.
 	///
 	/// The easiest way to understand the locking strategy
 	/// and synchronization between the main thread and the
@@ -307,32 +449,92 @@ public:
 	QHash< unsigned int, ServerUser * > qhUsers;
 	QHash< QPair< HostAddress, quint16 >, ServerUser * > qhPeerUsers;
 	QHash< HostAddress, QSet< ServerUser * > > qhHostUsers;
+	/// The users whose UDP endpoint hasn't been bound yet by the token they have been assigned (see assignUdpToken)
+	QHash< quint64, ServerUser * > qhUdpTokenUsers;
 	QHash< unsigned int, Channel * > qhChannels;
 
+	/// Protects acCache and the access tokens of the users
 	QMutex qmCache;
-	ChanACL::ACLCache acCache;
+	PermissionCache acCache;
 
 	QHash< int, QString > qhUserNameCache;
 	QHash< QString, int > qhUserIDCache;
 
 	QList< Ban > qlBans;
+	/// Indexes qlBans for checking connecting clients. Rebuilt whenever the bans are read from or written to the
+	/// database (see getBans() and saveBans()).
+	BanIndex m_banIndex;
 
-	void addListener(QHash< ServerUser *, VolumeAdjustment > &listeners, ServerUser &user, const Channel &channel);
-	void processMsg(ServerUser *u, Mumble::Protocol::AudioData audioData, AudioReceiverBuffer &buffer,
-					Mumble::Protocol::UDPAudioEncoder< Mumble::Protocol::Role::Server > &encoder);
-	void sendMessage(ServerUser &u, const unsigned char *data, int len, QByteArray &cache, bool force = false);
+	/// Requests a new routing snapshot to be built and published. The main thread has to call this after every
+	/// change to data that affects the routing of regular speech (users, channel membership, links, listeners, ACLs,
+	/// mute and deaf states). VoiceThreadWriteLocker does so automatically.
+	///
+	/// The snapshot is published asynchronously (coalescing all changes made while processing the current event), so
+	/// the voice threads may route a few more packets based on the previous state. This function may also be called
+	/// by the voice threads.
+	void invalidateRoutingSnapshot();
+
+	/// May be read by any thread at any time
+	const VoiceMetrics &voiceMetrics() const { return m_voiceMetrics; }
+	/// @returns The handshake pool or nullptr if the handshakes are performed by the Server's thread. Its metrics may
+	/// 	be read by any thread at any time.
+	const HandshakePool *handshakePool() const { return m_handshakePool.get(); }
+
+	void addListener(QHash< ServerUser *, VolumeAdjustment > &listeners, ServerUser &user,
+					 const VolumeAdjustment &volumeAdjustment);
+	/// Forwards the given audio of u. routing has to be the snapshot the caller is currently holding a read guard
+	/// for (or the current snapshot, if called from the main thread). cryptSlot is the calling thread's slot in the
+	/// receivers' VoiceCryptState.
+	void processMsg(ServerUser *u, const RoutingSnapshot &routing, Mumble::Protocol::AudioData audioData,
+					unsigned int cryptSlot, AudioReceiverBuffer &buffer,
+					Mumble::Protocol::UDPAudioEncoder< Mumble::Protocol::Role::Server > &encoder,
+					UDPSendBatch *sendBatch = nullptr);
+	/// Sends the given data to the given user. cryptSlot is the calling thread's slot in the user's VoiceCryptState.
+	/// If sendBatch is not null and the data is to be sent via UDP, the encrypted datagram is only queued in that
+	/// batch and the caller is responsible for flushing it. If the data is to be sent via TCP, it is queued in the
+	/// user's TunnelQueue, which is drained by the main thread.
+	void sendMessage(ServerUser &u, unsigned int cryptSlot, const unsigned char *data, int len, bool force = false,
+					 UDPSendBatch *sendBatch = nullptr);
 	void run();
+	/// Receives and processes datagrams until the voice threads are stopped. This is the body of every voice
+	/// thread; workerIndex selects the subset of qlUdpSocket the calling thread is responsible for.
+	void runVoiceLoop(unsigned int workerIndex, VoiceWorkerState &state);
+	/// Processes a single datagram received by a voice thread. encrypt has to point to a buffer
+	/// that is aligned the same way as the one used in Server::runVoiceLoop.
+#ifdef Q_OS_LINUX
+	void processUDPDatagram(int sock, unsigned char *encrypt, qint32 len, sockaddr_storage &from,
+							struct msghdr &msg, VoiceWorkerState &state);
+#elif defined(Q_OS_UNIX)
+	void processUDPDatagram(int sock, unsigned char *encrypt, qint32 len, sockaddr_storage &from,
+							socklen_t fromlen, VoiceWorkerState &state);
+#else
+	void processUDPDatagram(SOCKET sock, unsigned char *encrypt, qint32 len, sockaddr_storage &from, int fromlen,
+							VoiceWorkerState &state);
+#endif
 
 	bool validateChannelName(const QString &name);
 	bool validateUserName(const QString &name);
 
 	bool checkDecrypt(ServerUser *u, const unsigned char *encrypted, unsigned char *plain, unsigned int cryptlen);
+	/// Assigns a new UDP token (see MumbleProto::CryptSetup::udp_token) to the given user. Has to be called by the
+	/// main thread while holding a write lock on qrwlVoiceThread.
+	///
+	/// @returns The token in the form it is sent to the client
+	std::string assignUdpToken(ServerUser *u);
 
 	bool hasPermission(ServerUser *p, Channel *c, QFlags< ChanACL::Perm > perm);
 	QFlags< ChanACL::Perm > effectivePermissions(ServerUser *p, Channel *c);
 	void sendClientPermission(ServerUser *u, Channel *c, bool explicitlyRequested = false);
 	void flushClientPermissionCache(ServerUser *u, MumbleProto::PermissionQuery &mpqq);
+	/// Updates the suppression state of the given user according to its permissions. Assumes qmCache is held.
+	void updateSuppression(ServerUser *u);
 	void clearACLCache(User *p = nullptr);
+	/// Clears the cached ACLs and permissions of the given channel and its subchannels. Has to be called whenever the
+	/// ACLs or groups of the channel change.
+	void clearChannelACLCache(Channel *c);
+	/// Discards the compiled ACLs of the given channel and its subchannels without updating the users. As these refer
+	/// to the groups of the channels, this has to be called before any of them is deleted.
+	void discardChannelACLs(Channel *c);
 	void clearWhisperTargetCache();
 
 	void sendProtoAll(const ::google::protobuf::Message &msg, Mumble::Protocol::TCPMessageType type,
@@ -359,9 +561,13 @@ public:
 	MUMBLE_ALL_TCP_MESSAGES
 #undef PROCESS_MUMBLE_TCP_MESSAGE
 
-	static void hashAssign(QString &destination, QByteArray &hash, const QString &str);
-	static void hashAssign(QByteArray &destination, QByteArray &hash, const QByteArray &source);
-	bool isTextAllowed(QString &str, bool &changed);
+	/// Assigns the given text along with its hash. Texts that are large enough to be requested by their hash are kept
+	/// in the BlobStore, leaving destination empty.
+	static void hashAssign(QString &destination, QByteArray &hash, BlobRef &blobRef, const QString &str);
+	static void hashAssign(QByteArray &destination, QByteArray &hash, BlobRef &blobRef, const QByteArray &source);
+	/// Checks the length of the given UTF-8 encoded text message, comment or channel description against the configured
+	/// limits. If HTML isn't allowed, the text is converted to plain text first.
+	bool isTextAllowed(std::string &text);
 
 	void setLiveConf(const QString &key, const QString &value);
 
@@ -397,8 +603,9 @@ signals:
 	void unregisterUserSig(int &, int);
 	void getRegisteredUsersSig(const QString &, QMap< int, QString > &);
 	void getRegistrationSig(int &, int, QMap< int, QString > &);
+	/// May be emitted by the authentication threads (see AuthPool)
 	void authenticateSig(int &, QString &, int, const QList< QSslCertificate > &, const QString &, bool,
-						 const QString &);
+						 const QString &, QStringList &);
 	void setInfoSig(int &, int, const QMap< int, QString > &);
 	void setTextureSig(int &, int, const QByteArray &);
 	void idToNameSig(QString &, int);
@@ -435,13 +642,18 @@ public:
 	int authenticate(QString &name, const QString &pw, int sessionId = 0, const QStringList &emails = QStringList(),
 					 const QString &certhash = QString(), bool bStrongCert = false,
 					 const QList< QSslCertificate > & = QList< QSslCertificate >());
+	/// The part of authenticate() that doesn't touch the state of the Server and may thus be called by any thread
+	AuthResult lookupAuthentication(const AuthRequest &request);
+	/// Applies the given result of lookupAuthentication() (account updates, temporary groups, caches) on the
+	/// Server's thread
+	/// @returns The user ID (see authenticate())
+	int applyAuthentication(const AuthResult &result, int sessionId);
 	Channel *addChannel(Channel *c, const QString &name, bool temporary = false, int position = 0,
 						unsigned int maxUsers = 0);
 	void removeChannelDB(const Channel *c);
-	void readChannels(Channel *p = nullptr);
+	void readChannels();
 	void readLinks();
 	void updateChannel(const Channel *c);
-	void readChannelPrivs(Channel *c);
 	void setLastChannel(const User *u);
 	int readLastChannel(int id);
 
@@ -463,6 +675,9 @@ public:
 	void removeLink(Channel *c, Channel *l);
 	void getBans();
 	void saveBans();
+	/// Deletes the given bans from the database without rewriting the others. qlBans and the ban index have to be
+	/// updated by the caller.
+	void removeBans(const QList< Ban > &bans);
 	QVariant getConf(const QString &key, QVariant def);
 	void setConf(const QString &key, const QVariant &value);
 	void dblog(const QString &str) const;
@@ -482,4 +697,21 @@ public:
 #undef PROCESS_MUMBLE_TCP_MESSAGE
 };
 
+/// Holds a write lock on Server::qrwlVoiceThread (just like a QWriteLocker) and invalidates the Server's routing
+/// snapshot once the lock is released. The main thread has to use this for all changes to data owned by it that is
+/// accessed by the voice threads.
+class VoiceThreadWriteLocker {
+public:
+	/// @param invalidateRouting Whether the change made under the lock affects the routing snapshot
+	explicit VoiceThreadWriteLocker(Server *server, bool invalidateRouting = true);
+	~VoiceThreadWriteLocker();
+
+	VoiceThreadWriteLocker(const VoiceThreadWriteLocker &) = delete;
+	VoiceThreadWriteLocker &operator=(const VoiceThreadWriteLocker &) = delete;
+
+protected:
+	Server *m_server;
+	bool m_invalidateRouting;
+};
+
 #endif
@@ -10,9 +10,13 @@
 #endif
 
 #include "ACL.h"
+#include "AuthPool.h"
 #include "Channel.h"
+#include "ChannelTreeBuilder.h"
 #include "Connection.h"
+#include "DBWriter.h"
 #include "Group.h"
+#include "LogStore.h"
 #include "Meta.h"
 #include "PBKDF2.h"
 #include "PasswordGenerator.h"
@@ -20,9 +24,15 @@
 #include "ServerUser.h"
 #include "User.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <limits>
 
 #include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
 #include <QtCore/QTimeZone>
 #include <QtCore/QtGlobal>
 #include <QtSql/QSqlError>
@@ -46,22 +56,33 @@
 
 class TransactionHolder {
 public:
+	QMutexLocker< QRecursiveMutex > qmlDatabase;
+	QSqlDatabase connection;
 	QSqlQuery *qsqQuery;
-	TransactionHolder() {
-		ServerDB::db->transaction();
-		qsqQuery = new QSqlQuery();
+	TransactionHolder() : qmlDatabase(&ServerDB::qrmDatabase), connection(ServerDB::connection()) {
+		connection.transaction();
+		qsqQuery = new QSqlQuery(connection);
+
+		// Whatever this transaction reads has to reflect the writes queued before
+		if (ServerDB::writer) {
+			ServerDB::writer->drain();
+		}
 	}
 
 	~TransactionHolder() {
 		qsqQuery->clear();
 		delete qsqQuery;
-		ServerDB::db->commit();
+		connection.commit();
 	}
 };
 
 QSqlDatabase *ServerDB::db = nullptr;
+QRecursiveMutex ServerDB::qrmDatabase;
 Timer ServerDB::tLogClean;
 QString ServerDB::qsUpgradeSuffix;
+DBWriter *ServerDB::writer = nullptr;
+QMutex ServerDB::qmLogStores;
+QHash< int, LogStore * > ServerDB::qhLogStores;
 
 void ServerDB::loadOrSetupMetaPBKDF2IterationCount(QSqlQuery &query) {
 	if (!Meta::mp.legacyPasswordHash) {
@@ -869,16 +890,89 @@ ServerDB::ServerDB() {
 		}
 	}
 	query.clear();
+
+	if (Meta::mp.iDBWriteQueue > 0) {
+		// Unlike TransactionHolder, the transactions of the writer don't execute the queued writes by themselves, so
+		// that the writer can tell how many it committed
+		const auto transaction = [](const std::function< void() > &body) {
+			QMutexLocker< QRecursiveMutex > lock(&qrmDatabase);
+			QSqlDatabase database = connection();
+			database.transaction();
+			body();
+			database.commit();
+		};
+
+		writer = new DBWriter(transaction, Meta::mp.iDBWriteQueue, Meta::mp.iDBWriteInterval,
+							  &ServerDB::releaseThreadConnection);
+	}
 }
 
 ServerDB::~ServerDB() {
+	// Commits the queued writes
+	delete writer;
+	writer = nullptr;
+
+	qDeleteAll(qhLogStores);
+	qhLogStores.clear();
+
 	db->close();
 	delete db;
 	db = nullptr;
 }
 
+/// @returns The name of the connection the calling thread uses, unless it is the main thread
+static QString threadConnectionName() {
+	return QString::fromLatin1("mumble-server-%1").arg(reinterpret_cast< quintptr >(QThread::currentThread()), 0, 16);
+}
+
+QSqlDatabase ServerDB::connection() {
+	QMutexLocker< QRecursiveMutex > lock(&qrmDatabase);
+
+	if (db->driver()->thread() == QThread::currentThread()) {
+		return *db;
+	}
+
+	const QString name = threadConnectionName();
+	if (QSqlDatabase::contains(name)) {
+		return QSqlDatabase::database(name, false);
+	}
+
+	QSqlDatabase clone = QSqlDatabase::cloneDatabase(*db, name);
+	if (!clone.open()) {
+		qFatal("ServerDB: Failed to open connection for thread: %s", qPrintable(clone.lastError().text()));
+	}
+
+	// journal_mode is a property of the database file, but synchronous has to be set for every connection
+	if (Meta::mp.qsDBDriver == "QSQLITE" && Meta::mp.iSQLiteWAL > 0) {
+		QSqlQuery query(clone);
+		query.exec(QLatin1String(Meta::mp.iSQLiteWAL == 1 ? "PRAGMA synchronous=NORMAL;" : "PRAGMA synchronous=FULL;"));
+	}
+
+	return clone;
+}
+
+void ServerDB::releaseThreadConnection() {
+	QMutexLocker< QRecursiveMutex > lock(&qrmDatabase);
+
+	const QString name = threadConnectionName();
+	if (QSqlDatabase::contains(name)) {
+		QSqlDatabase::database(name, false).close();
+		QSqlDatabase::removeDatabase(name);
+	}
+}
+
+void ServerDB::queueWrite(const std::function< void() > &write, const QString &key) {
+	if (writer) {
+		writer->enqueue(write, key);
+	} else {
+		TransactionHolder th;
+		write();
+	}
+}
+
 bool ServerDB::prepare(QSqlQuery &query, const QString &str, bool fatal, bool warn) {
-	if (!db->isValid()) {
+	QSqlDatabase database = connection();
+	if (!database.isValid()) {
 		qWarning("SQL [%s] rejected: Database is gone", qPrintable(str));
 		return false;
 	}
@@ -899,11 +993,11 @@ bool ServerDB::prepare(QSqlQuery &query, const QString &str, bool fatal, bool wa
 	if (query.prepare(q)) {
 		return true;
 	} else {
-		db->close();
-		if (!db->open()) {
-			qFatal("Lost connection to SQL Database: Reconnect: %s", qPrintable(db->lastError().text()));
+		database.close();
+		if (!database.open()) {
+			qFatal("Lost connection to SQL Database: Reconnect: %s", qPrintable(database.lastError().text()));
 		}
-		query = QSqlQuery();
+		query = QSqlQuery(database);
 		if (query.prepare(q)) {
 			qWarning("SQL Connection lost, reconnection OK");
 			return true;
@@ -921,7 +1015,7 @@ bool ServerDB::prepare(QSqlQuery &query, const QString &str, bool fatal, bool wa
 
 bool ServerDB::query(QSqlQuery &query, const QString &str, bool fatal, bool warn) {
 	if (!str.isEmpty()) {
-		if (!db->isValid()) {
+		if (!connection().isValid()) {
 			qWarning("SQL [%s] rejected: Database is gone", qPrintable(str));
 			return false;
 		}
@@ -1303,64 +1397,73 @@ QMap< int, QString > Server::getRegistration(int id) {
 ///         -3 for authentication failures where the data could (temporarily) not be verified.
 int Server::authenticate(QString &name, const QString &password, int sessionId, const QStringList &emails,
 						 const QString &certhash, bool bStrongCert, const QList< QSslCertificate > &certs) {
-	int res = bForceExternalAuth ? -3 : -2;
+	AuthRequest request;
+	request.name          = name;
+	request.password      = password;
+	request.sessionId     = sessionId;
+	request.emails        = emails;
+	request.certHash      = certhash;
+	request.strongCert    = bStrongCert;
+	request.certs         = certs;
+	request.forceExternal = bForceExternalAuth;
+
+	const AuthResult result = lookupAuthentication(request);
+	name                    = result.name;
+
+	return applyAuthentication(result, sessionId);
+}
 
-	emit authenticateSig(res, name, sessionId, certs, certhash, bStrongCert, password);
+AuthResult Server::lookupAuthentication(const AuthRequest &request) {
+	AuthResult result;
+	result.name = request.name;
+
+	int res = request.forceExternal ? -3 : -2;
+
+	emit authenticateSig(res, result.name, request.sessionId, request.certs, request.certHash, request.strongCert,
+						 request.password, result.groups);
 
 	if (res != -2) {
 		// External authentication handled it. Ignore certificate completely.
-		if (res != -1) {
-			TransactionHolder th;
-			QSqlQuery &query = *th.qsqQuery;
-
-			int lchan = readLastChannel(res);
-			if (lchan < 0)
-				lchan = 0;
+		result.id       = res;
+		result.external = true;
+		return result;
+	}
+
+	const QString &password   = request.password;
+	const QString &certhash   = request.certHash;
+	const QStringList &emails = request.emails;
+	const bool bStrongCert    = request.strongCert;
+	QString &name             = result.name;
+
+	bool userFound = false;
+	int userId     = 0;
+	QString storedName;
+	QString storedPasswordHash;
+	QString storedSalt;
+	int storedKdfIterations = 0;
+	{
+		// The hash is computed after the transaction (and thus the database lock) has been released, so that the
+		// authentication threads don't serialize on the (deliberately slow) key derivation
+		TransactionHolder th;
+		QSqlQuery &query = *th.qsqQuery;
 
-			if (Meta::mp.qsDBDriver == "QPSQL") {
-				SQLPREP("INSERT INTO `%1users` (`server_id`, `user_id`, `name`, `lastchannel`) VALUES "
-						"(:server_id,:user_id,:name,:lastchannel) ON CONFLICT (`server_id`, `user_id`) DO UPDATE SET "
-						"`name` = :u_name, `lastchannel` = :u_lastchannel WHERE `%1users`.`server_id` = :u_server_id "
-						"AND `%1users`.`user_id` = :u_user_id");
-				query.bindValue(":server_id", iServerNum);
-				query.bindValue(":user_id", res);
-				query.bindValue(":name", name);
-				query.bindValue(":lastchannel", lchan);
-				query.bindValue(":u_server_id", iServerNum);
-				query.bindValue(":u_user_id", res);
-				query.bindValue(":u_name", name);
-				query.bindValue(":u_lastchannel", lchan);
-				SQLEXEC();
-			} else {
-				SQLPREP("REPLACE INTO `%1users` (`server_id`, `user_id`, `name`, `lastchannel`) VALUES (?,?,?,?)");
-				query.addBindValue(iServerNum);
-				query.addBindValue(res);
-				query.addBindValue(name);
-				query.addBindValue(lchan);
-				SQLEXEC();
-			}
-		}
-		if (res >= 0) {
-			qhUserNameCache.remove(res);
-			qhUserIDCache.remove(name);
+		SQLPREP("SELECT `user_id`,`name`,`pw`, `salt`, `kdfiterations` FROM `%1users` WHERE `server_id` = ? AND "
+				"LOWER(`name`) = LOWER(?)");
+		query.addBindValue(iServerNum);
+		query.addBindValue(name);
+		SQLEXEC();
+		if (query.next()) {
+			userFound           = true;
+			userId              = query.value(0).toInt();
+			storedName          = query.value(1).toString();
+			storedPasswordHash  = query.value(2).toString();
+			storedSalt          = query.value(3).toString();
+			storedKdfIterations = query.value(4).toInt();
 		}
-		return res;
 	}
 
-	TransactionHolder th;
-	QSqlQuery &query = *th.qsqQuery;
-
-	SQLPREP("SELECT `user_id`,`name`,`pw`, `salt`, `kdfiterations` FROM `%1users` WHERE `server_id` = ? AND "
-			"LOWER(`name`) = LOWER(?)");
-	query.addBindValue(iServerNum);
-	query.addBindValue(name);
-	SQLEXEC();
-	if (query.next()) {
-		const int userId                 = query.value(0).toInt();
-		const QString storedPasswordHash = query.value(2).toString();
-		const QString storedSalt         = query.value(3).toString();
-		const int storedKdfIterations    = query.value(4).toInt();
-		res                              = -1;
+	if (userFound) {
+		res = -1;
 
 		if (!storedPasswordHash.isEmpty()) {
 			// A user has password authentication enabled if there is a password hash.
@@ -1369,46 +1472,34 @@ int Server::authenticate(QString &name, const QString &password, int sessionId,
 				// If storedKdfIterations is <=0 this means this is an old-style SHA1 hash
 				// that hasn't been converted yet. Or we are operating in legacy mode.
 				if (ServerDB::getLegacySHA1Hash(password) == storedPasswordHash) {
-					name = query.value(1).toString();
-					res  = query.value(0).toInt();
+					name = storedName;
+					res  = userId;
 
 					if (!Meta::mp.legacyPasswordHash) {
 						// Unless disabled upgrade the user password hash
-						QMap< int, QString > info;
-						info.insert(ServerDB::User_Password, password);
-						info.insert(ServerDB::User_KDFIterations, QString::number(Meta::mp.kdfIterations));
-
-						if (!setInfo(userId, info)) {
-							qWarning("ServerDB: Failed to upgrade user account to PBKDF2 hash, rejecting login.");
-							return -1;
-						}
+						result.update.insert(ServerDB::User_Password, password);
+						result.update.insert(ServerDB::User_KDFIterations, QString::number(Meta::mp.kdfIterations));
+						result.updateError =
+							QLatin1String("ServerDB: Failed to upgrade user account to PBKDF2 hash, rejecting login.");
 					}
 				}
 			} else {
 				if (PBKDF2::getHash(storedSalt, password, storedKdfIterations) == storedPasswordHash) {
-					name = query.value(1).toString();
-					res  = query.value(0).toInt();
+					name = storedName;
+					res  = userId;
 
 					if (Meta::mp.legacyPasswordHash) {
 						// Downgrade the password to the legacy hash
-						QMap< int, QString > info;
-						info.insert(ServerDB::User_Password, password);
-
-						if (!setInfo(userId, info)) {
-							qWarning("ServerDB: Failed to downgrade user account to legacy hash, rejecting login.");
-							return -1;
-						}
+						result.update.insert(ServerDB::User_Password, password);
+						result.updateError = QLatin1String(
+							"ServerDB: Failed to downgrade user account to legacy hash, rejecting login.");
 					} else if (storedKdfIterations != Meta::mp.kdfIterations) {
 						// User kdfiterations not equal to the global one. Update it.
-						QMap< int, QString > info;
-						info.insert(ServerDB::User_Password, password);
-						info.insert(ServerDB::User_KDFIterations, QString::number(Meta::mp.kdfIterations));
-
-						if (!setInfo(userId, info)) {
-							qWarning() << "ServerDB: Failed to update user PBKDF2 to new iteration count"
-									   << Meta::mp.kdfIterations << ", rejecting login.";
-							return -1;
-						}
+						result.update.insert(ServerDB::User_Password, password);
+						result.update.insert(ServerDB::User_KDFIterations, QString::number(Meta::mp.kdfIterations));
+						result.updateError = QString::fromLatin1("ServerDB: Failed to update user PBKDF2 to new "
+																 "iteration count %1, rejecting login.")
+												 .arg(Meta::mp.kdfIterations);
 					}
 				}
 			}
@@ -1418,10 +1509,21 @@ int Server::authenticate(QString &name, const QString &password, int sessionId,
 			// For SuperUser only password based authentication is allowed.
 			// If we couldn't verify the password don't proceed to cert auth
 			// and instead reject the login attempt.
-			return -1;
+			result.id = -1;
+			return result;
 		}
 	}
 
+	if (certhash.isEmpty()) {
+		result.id = res;
+		return result;
+	}
+
+	// A second short transaction for the certificate lookup and for storing the certificate hash. Rehashed
+	// passwords are stored by applyAuthentication().
+	TransactionHolder th;
+	QSqlQuery &query = *th.qsqQuery;
+
 	// No password match. Try cert or email match, but only for non-SuperUser.
 	if (!certhash.isEmpty() && (res < 0)) {
 		SQLPREP("SELECT `user_id` FROM `%1user_info` WHERE `server_id` = ? AND `key` = ? AND `value` = ?");
@@ -1501,9 +1603,58 @@ int Server::authenticate(QString &name, const QString &password, int sessionId,
 			}
 		}
 	}
+	result.id = res;
+	return result;
+}
+
+int Server::applyAuthentication(const AuthResult &result, int sessionId) {
+	const int res = result.id;
+
+	if (result.external) {
+		if (res != -1) {
+			TransactionHolder th;
+			QSqlQuery &query = *th.qsqQuery;
+
+			int lchan = readLastChannel(res);
+			if (lchan < 0)
+				lchan = 0;
+
+			if (Meta::mp.qsDBDriver == "QPSQL") {
+				SQLPREP("INSERT INTO `%1users` (`server_id`, `user_id`, `name`, `lastchannel`) VALUES "
+						"(:server_id,:user_id,:name,:lastchannel) ON CONFLICT (`server_id`, `user_id`) DO UPDATE SET "
+						"`name` = :u_name, `lastchannel` = :u_lastchannel WHERE `%1users`.`server_id` = :u_server_id "
+						"AND `%1users`.`user_id` = :u_user_id");
+				query.bindValue(":server_id", iServerNum);
+				query.bindValue(":user_id", res);
+				query.bindValue(":name", result.name);
+				query.bindValue(":lastchannel", lchan);
+				query.bindValue(":u_server_id", iServerNum);
+				query.bindValue(":u_user_id", res);
+				query.bindValue(":u_name", result.name);
+				query.bindValue(":u_lastchannel", lchan);
+				SQLEXEC();
+			} else {
+				SQLPREP("REPLACE INTO `%1users` (`server_id`, `user_id`, `name`, `lastchannel`) VALUES (?,?,?,?)");
+				query.addBindValue(iServerNum);
+				query.addBindValue(res);
+				query.addBindValue(result.name);
+				query.addBindValue(lchan);
+				SQLEXEC();
+			}
+		}
+		if (res >= 0 && !result.groups.isEmpty()) {
+			setTempGroups(res, sessionId, nullptr, result.groups);
+		}
+	} else if (res >= 0 && !result.update.isEmpty()) {
+		if (!setInfo(res, result.update)) {
+			qWarning("%s", qPrintable(result.updateError));
+			return -1;
+		}
+	}
+
 	if (res >= 0) {
 		qhUserNameCache.remove(res);
-		qhUserIDCache.remove(name);
+		qhUserIDCache.remove(result.name);
 	}
 	return res;
 }
@@ -1529,16 +1680,16 @@ bool Server::setInfo(int id, const QMap< int, QString > &setinfo) {
 	if (res >= 0)
 		return (res > 0);
 
-	TransactionHolder th;
-	QSqlQuery &query = *th.qsqQuery;
-
 	if (info.contains(ServerDB::User_LastActive)) {
 		info.remove(ServerDB::User_LastActive);
 	}
+
+	// The password is hashed right away, so that the (deliberately slow) hashing doesn't hold the database lock
+	bool setPassword = false;
+	QString passwordHash, salt;
+	int kdfIterations = -1;
 	if (info.contains(ServerDB::User_Password)) {
 		const QString password = info.value(ServerDB::User_Password);
-		QString passwordHash, salt;
-		int kdfIterations = -1;
 
 		if (Meta::mp.legacyPasswordHash) {
 			passwordHash = ServerDB::getLegacySHA1Hash(password);
@@ -1555,57 +1706,67 @@ bool Server::setInfo(int id, const QMap< int, QString > &setinfo) {
 			passwordHash = PBKDF2::getHash(salt, password, kdfIterations);
 		}
 
-		SQLPREP("UPDATE `%1users` SET `pw`=?, `salt`=?, `kdfiterations`=? WHERE `server_id` = ? AND `user_id`=?");
-		query.addBindValue(passwordHash);
-		query.addBindValue(salt);
-		query.addBindValue(kdfIterations);
-		query.addBindValue(iServerNum);
-		query.addBindValue(id);
-		SQLEXEC();
+		setPassword = true;
 		info.remove(ServerDB::User_Password);
 	}
-	if (info.contains(ServerDB::User_Name)) {
-		const QString &name = info.value(ServerDB::User_Name);
-		SQLPREP("UPDATE `%1users` SET `name`=? WHERE `server_id` = ? AND `user_id`=?");
-		query.addBindValue(name);
-		query.addBindValue(iServerNum);
-		query.addBindValue(id);
-		SQLEXEC();
-		info.remove(ServerDB::User_Name);
-	}
-	if (!info.isEmpty()) {
-		QMap< int, QString >::const_iterator i;
-		QVariantList serverids, userids, keys, values;
 
-		for (i = info.constBegin(); i != info.constEnd(); ++i) {
-			serverids << iServerNum;
-			userids << id;
-			keys << i.key();
-			values << i.value();
+	const int serverNum = iServerNum;
+	ServerDB::queueWrite([serverNum, id, info, setPassword, passwordHash, salt, kdfIterations]() {
+		QSqlQuery query(ServerDB::connection());
+		QMap< int, QString > remaining = info;
+
+		if (setPassword) {
+			SQLPREP("UPDATE `%1users` SET `pw`=?, `salt`=?, `kdfiterations`=? WHERE `server_id` = ? AND `user_id`=?");
+			query.addBindValue(passwordHash);
+			query.addBindValue(salt);
+			query.addBindValue(kdfIterations);
+			query.addBindValue(serverNum);
+			query.addBindValue(id);
+			SQLEXEC();
 		}
-		if (Meta::mp.qsDBDriver == "QPSQL") {
-			SQLPREP("INSERT INTO `%1user_info` (`server_id`, `user_id`, `key`, `value`) VALUES (:server_id, :user_id, "
-					":key, :value) ON CONFLICT (`server_id`, `user_id`, `key`) DO UPDATE SET `value` = :u_value WHERE "
-					"`%1user_info`.`server_id` = :u_server_id AND `%1user_info`.`user_id` = :u_user_id AND "
-					"`%1user_info`.`key` = :u_key");
-			query.bindValue(":server_id", serverids);
-			query.bindValue(":user_id", userids);
-			query.bindValue(":key", keys);
-			query.bindValue(":value", values);
-			query.bindValue(":u_server_id", serverids);
-			query.bindValue(":u_user_id", userids);
-			query.bindValue(":u_key", keys);
-			query.bindValue(":u_value", values);
-			SQLEXECBATCH();
-		} else {
-			SQLPREP("REPLACE INTO `%1user_info` (`server_id`, `user_id`, `key`, `value`) VALUES (?,?,?,?)");
-			query.addBindValue(serverids);
-			query.addBindValue(userids);
-			query.addBindValue(keys);
-			query.addBindValue(values);
-			SQLEXECBATCH();
+		if (remaining.contains(ServerDB::User_Name)) {
+			const QString &name = remaining.value(ServerDB::User_Name);
+			SQLPREP("UPDATE `%1users` SET `name`=? WHERE `server_id` = ? AND `user_id`=?");
+			query.addBindValue(name);
+			query.addBindValue(serverNum);
+			query.addBindValue(id);
+			SQLEXEC();
+			remaining.remove(ServerDB::User_Name);
 		}
-	}
+		if (!remaining.isEmpty()) {
+			QMap< int, QString >::const_iterator i;
+			QVariantList serverids, userids, keys, values;
+
+			for (i = remaining.constBegin(); i != remaining.constEnd(); ++i) {
+				serverids << serverNum;
+				userids << id;
+				keys << i.key();
+				values << i.value();
+			}
+			if (Meta::mp.qsDBDriver == "QPSQL") {
+				SQLPREP("INSERT INTO `%1user_info` (`server_id`, `user_id`, `key`, `value`) VALUES (:server_id, "
+						":user_id, :key, :value) ON CONFLICT (`server_id`, `user_id`, `key`) DO UPDATE SET `value` = "
+						":u_value WHERE `%1user_info`.`server_id` = :u_server_id AND `%1user_info`.`user_id` = "
+						":u_user_id AND `%1user_info`.`key` = :u_key");
+				query.bindValue(":server_id", serverids);
+				query.bindValue(":user_id", userids);
+				query.bindValue(":key", keys);
+				query.bindValue(":value", values);
+				query.bindValue(":u_server_id", serverids);
+				query.bindValue(":u_user_id", userids);
+				query.bindValue(":u_key", keys);
+				query.bindValue(":u_value", values);
+				SQLEXECBATCH();
+			} else {
+				SQLPREP("REPLACE INTO `%1user_info` (`server_id`, `user_id`, `key`, `value`) VALUES (?,?,?,?)");
+				query.addBindValue(serverids);
+				query.addBindValue(userids);
+				query.addBindValue(keys);
+				query.addBindValue(values);
+				SQLEXECBATCH();
+			}
+		}
+	});
 
 	return true;
 }
@@ -1622,7 +1783,7 @@ bool Server::setTexture(int id, const QByteArray &texture) {
 
 	foreach (ServerUser *u, qhUsers) {
 		if (u->iId == id)
-			hashAssign(u->qbaTexture, u->qbaTextureHash, tex);
+			hashAssign(u->qbaTexture, u->qbaTextureHash, u->m_textureBlob, tex);
 	}
 
 	int res = -2;
@@ -1770,8 +1931,9 @@ QByteArray Server::getUserTexture(int id) {
 
 void Server::addLink(Channel *c, Channel *l) {
 	{
-		QWriteLocker wl(&qrwlVoiceThread);
+		VoiceThreadWriteLocker wl(this);
 		c->link(l);
+		++m_linkGeneration;
 	}
 
 	if (c->bTemporary || l->bTemporary)
@@ -1793,8 +1955,9 @@ void Server::addLink(Channel *c, Channel *l) {
 
 void Server::removeLink(Channel *c, Channel *l) {
 	{
-		QWriteLocker wl(&qrwlVoiceThread);
+		VoiceThreadWriteLocker wl(this);
 		c->unlink(l);
+		++m_linkGeneration;
 	}
 
 	if (c->bTemporary || l->bTemporary)
@@ -1885,267 +2048,257 @@ void Server::removeChannelDB(const Channel *c) {
 void Server::updateChannel(const Channel *c) {
 	if (c->bTemporary)
 		return;
-	TransactionHolder th;
-	Group *g;
-	ChanACL *acl;
 
-	QSqlQuery &query = *th.qsqQuery;
-	SQLPREP("UPDATE `%1channels` SET `name` = ?, `parent_id` = ?, `inheritacl` = ? WHERE `server_id` = ? AND "
-			"`channel_id` = ?");
-	query.addBindValue(c->qsName);
-	query.addBindValue(c->cParent ? c->cParent->iId : QVariant());
-	query.addBindValue(c->bInheritACL ? 1 : 0);
-	query.addBindValue(iServerNum);
-	query.addBindValue(c->iId);
-	SQLEXEC();
-
-	// Update channel description information
-	if (Meta::mp.qsDBDriver == "QPSQL") {
-		SQLPREP("INSERT INTO `%1channel_info` (`server_id`, `channel_id`, `key`, `value`) VALUES (:server_id, "
-				":channel_id, :key, :value) ON CONFLICT (`server_id`, `channel_id`, `key`) DO UPDATE SET `value` = "
-				":u_value WHERE `%1channel_info`.`server_id` = :u_server_id AND `%1channel_info`.`channel_id` = "
-				":u_channel_id AND `%1channel_info`.`key` = :u_key");
-		query.bindValue(":server_id", iServerNum);
-		query.bindValue(":channel_id", c->iId);
-		query.bindValue(":key", ServerDB::Channel_Description);
-		query.bindValue(":value", c->qsDesc);
-		query.bindValue(":u_server_id", iServerNum);
-		query.bindValue(":u_channel_id", c->iId);
-		query.bindValue(":u_key", ServerDB::Channel_Description);
-		query.bindValue(":u_value", c->qsDesc);
-		SQLEXEC();
-	} else {
-		SQLPREP("REPLACE INTO `%1channel_info` (`server_id`, `channel_id`, `key`, `value`) VALUES (?, ?, ?, ?)");
-		query.addBindValue(iServerNum);
-		query.addBindValue(c->iId);
-		query.addBindValue(ServerDB::Channel_Description);
-		query.addBindValue(c->qsDesc);
-		SQLEXEC();
-	}
-	// Update channel position information
-	if (Meta::mp.qsDBDriver == "QPSQL") {
-		query.bindValue(":server_id", iServerNum);
-		query.bindValue(":channel_id", c->iId);
-		query.bindValue(":key", ServerDB::Channel_Position);
-		query.bindValue(":value", QVariant(c->iPosition).toString());
-		query.bindValue(":u_server_id", iServerNum);
-		query.bindValue(":u_channel_id", c->iId);
-		query.bindValue(":u_key", ServerDB::Channel_Position);
-		query.bindValue(":u_value", QVariant(c->iPosition).toString());
-		SQLEXEC();
-	} else {
-		query.addBindValue(iServerNum);
-		query.addBindValue(c->iId);
-		query.addBindValue(ServerDB::Channel_Position);
-		query.addBindValue(QVariant(c->iPosition).toString());
-		SQLEXEC();
-	}
-	// Update channel maximum channels
-	if (Meta::mp.qsDBDriver == "QPSQL") {
-		query.bindValue(":server_id", iServerNum);
-		query.bindValue(":channel_id", c->iId);
-		query.bindValue(":key", ServerDB::Channel_Max_Users);
-		query.bindValue(":value", QVariant(c->uiMaxUsers).toString());
-		query.bindValue(":u_server_id", iServerNum);
-		query.bindValue(":u_channel_id", c->iId);
-		query.bindValue(":u_key", ServerDB::Channel_Max_Users);
-		query.bindValue(":u_value", QVariant(c->uiMaxUsers).toString());
-		SQLEXEC();
-	} else {
-		query.addBindValue(iServerNum);
-		query.addBindValue(c->iId);
-		query.addBindValue(ServerDB::Channel_Max_Users);
-		query.addBindValue(QVariant(c->uiMaxUsers).toString());
-		SQLEXEC();
-	}
-
-	SQLPREP("DELETE FROM `%1groups` WHERE `server_id` = ? AND `channel_id` = ?");
-	query.addBindValue(iServerNum);
-	query.addBindValue(c->iId);
-	SQLEXEC();
-
-	SQLPREP("DELETE FROM `%1acl` WHERE `server_id` = ? AND `channel_id` = ?");
-	query.addBindValue(iServerNum);
-	query.addBindValue(c->iId);
-	SQLEXEC();
-
-	foreach (g, c->qhGroups) {
-		int id = 0;
-		int pid;
-
-		if (Meta::mp.qsDBDriver == "QPSQL") {
-			SQLPREP("INSERT INTO `%1groups` (`server_id`, `channel_id`, `name`, `inherit`, `inheritable`) VALUES "
-					"(?,?,?,?,?) RETURNING group_id");
-			query.addBindValue(iServerNum);
-			query.addBindValue(g->c->iId);
-			query.addBindValue(g->qsName);
-			query.addBindValue(g->bInherit ? 1 : 0);
-			query.addBindValue(g->bInheritable ? 1 : 0);
+	// The write may be executed after the channel changed again or has been deleted, so it works on a copy
+	struct GroupData {
+		QString name;
+		bool inherit;
+		bool inheritable;
+		QList< int > add;
+		QList< int > remove;
+	};
+	struct ACLData {
+		QVariant userID;
+		QVariant group;
+		bool applyHere;
+		bool applySubs;
+		int allow;
+		int deny;
+	};
+
+	const int serverNum       = iServerNum;
+	const unsigned int id     = c->iId;
+	const QString name        = c->qsName;
+	const QVariant parentID   = c->cParent ? c->cParent->iId : QVariant();
+	const bool inheritACL     = c->bInheritACL;
+	const QString description = c->description();
+	const QString position    = QVariant(c->iPosition).toString();
+	const QString maxUsers    = QVariant(c->uiMaxUsers).toString();
+	QList< GroupData > groups;
+	QList< ACLData > acls;
+
+	for (const Group *g : c->qhGroups) {
+		groups.append({ g->qsName, g->bInherit, g->bInheritable, g->qsAdd.values(), g->qsRemove.values() });
+	}
+	for (const ChanACL *acl : c->qlACL) {
+		acls.append({ (acl->iUserId == -1) ? QVariant() : acl->iUserId,
+					  (acl->qsGroup.isEmpty()) ? QVariant() : acl->qsGroup, acl->bApplyHere, acl->bApplySubs,
+					  static_cast< int >(acl->pAllow), static_cast< int >(acl->pDeny) });
+	}
+
+	// Replaces everything stored about the channel, so only the latest update of a channel has to be written
+	ServerDB::queueWrite(
+		[serverNum, id, name, parentID, inheritACL, description, position, maxUsers, groups, acls]() {
+			QSqlQuery query(ServerDB::connection());
+
+			SQLPREP("UPDATE `%1channels` SET `name` = ?, `parent_id` = ?, `inheritacl` = ? WHERE `server_id` = ? AND "
+					"`channel_id` = ?");
+			query.addBindValue(name);
+			query.addBindValue(parentID);
+			query.addBindValue(inheritACL ? 1 : 0);
+			query.addBindValue(serverNum);
+			query.addBindValue(id);
 			SQLEXEC();
 
-			if (query.next()) {
-				id = query.value(0).toInt();
+			// Update channel description, position and maximum users
+			const QList< QPair< int, QString > > info = { { ServerDB::Channel_Description, description },
+														  { ServerDB::Channel_Position, position },
+														  { ServerDB::Channel_Max_Users, maxUsers } };
+			if (Meta::mp.qsDBDriver == "QPSQL") {
+				SQLPREP("INSERT INTO `%1channel_info` (`server_id`, `channel_id`, `key`, `value`) VALUES (:server_id, "
+						":channel_id, :key, :value) ON CONFLICT (`server_id`, `channel_id`, `key`) DO UPDATE SET "
+						"`value` = :u_value WHERE `%1channel_info`.`server_id` = :u_server_id AND "
+						"`%1channel_info`.`channel_id` = :u_channel_id AND `%1channel_info`.`key` = :u_key");
+				for (const auto &entry : info) {
+					query.bindValue(":server_id", serverNum);
+					query.bindValue(":channel_id", id);
+					query.bindValue(":key", entry.first);
+					query.bindValue(":value", entry.second);
+					query.bindValue(":u_server_id", serverNum);
+					query.bindValue(":u_channel_id", id);
+					query.bindValue(":u_key", entry.first);
+					query.bindValue(":u_value", entry.second);
+					SQLEXEC();
+				}
 			} else {
-				qFatal(
-					"ServerDB: internal query failure: PostgreSQL query did not return the inserted group's group_id");
+				SQLPREP(
+					"REPLACE INTO `%1channel_info` (`server_id`, `channel_id`, `key`, `value`) VALUES (?, ?, ?, ?)");
+				for (const auto &entry : info) {
+					query.addBindValue(serverNum);
+					query.addBindValue(id);
+					query.addBindValue(entry.first);
+					query.addBindValue(entry.second);
+					SQLEXEC();
+				}
 			}
-		} else {
-			SQLPREP("REPLACE INTO `%1groups` (`server_id`, `channel_id`, `name`, `inherit`, `inheritable`) VALUES "
-					"(?,?,?,?,?)");
-			query.addBindValue(iServerNum);
-			query.addBindValue(g->c->iId);
-			query.addBindValue(g->qsName);
-			query.addBindValue(g->bInherit ? 1 : 0);
-			query.addBindValue(g->bInheritable ? 1 : 0);
-			SQLEXEC();
 
-			id = query.lastInsertId().toInt();
-		}
-
-		foreach (pid, g->qsAdd) {
-			SQLPREP("INSERT INTO `%1group_members` (`group_id`, `server_id`, `user_id`, `addit`) VALUES (?, ?, ?, ?)");
+			SQLPREP("DELETE FROM `%1groups` WHERE `server_id` = ? AND `channel_id` = ?");
+			query.addBindValue(serverNum);
 			query.addBindValue(id);
-			query.addBindValue(iServerNum);
-			query.addBindValue(pid);
-			query.addBindValue(1);
 			SQLEXEC();
-		}
-		foreach (pid, g->qsRemove) {
-			SQLPREP("INSERT INTO `%1group_members` (`group_id`, `server_id`, `user_id`, `addit`) VALUES (?, ?, ?, ?)");
+
+			SQLPREP("DELETE FROM `%1acl` WHERE `server_id` = ? AND `channel_id` = ?");
+			query.addBindValue(serverNum);
 			query.addBindValue(id);
-			query.addBindValue(iServerNum);
-			query.addBindValue(pid);
-			query.addBindValue(0);
 			SQLEXEC();
-		}
-	}
 
-	int pri = 5;
+			for (const GroupData &g : groups) {
+				int groupID = 0;
+
+				if (Meta::mp.qsDBDriver == "QPSQL") {
+					SQLPREP("INSERT INTO `%1groups` (`server_id`, `channel_id`, `name`, `inherit`, `inheritable`) "
+							"VALUES (?,?,?,?,?) RETURNING group_id");
+					query.addBindValue(serverNum);
+					query.addBindValue(id);
+					query.addBindValue(g.name);
+					query.addBindValue(g.inherit ? 1 : 0);
+					query.addBindValue(g.inheritable ? 1 : 0);
+					SQLEXEC();
 
-	foreach (acl, c->qlACL) {
-		SQLPREP("INSERT INTO `%1acl` (`server_id`, `channel_id`, `priority`, `user_id`, `group_name`, `apply_here`, "
-				"`apply_sub`, `grantpriv`, `revokepriv`) VALUES (?,?,?,?,?,?,?,?,?)");
-		query.addBindValue(iServerNum);
-		query.addBindValue(acl->c->iId);
-		query.addBindValue(pri++);
-
-		query.addBindValue((acl->iUserId == -1) ? QVariant() : acl->iUserId);
-		query.addBindValue((acl->qsGroup.isEmpty()) ? QVariant() : acl->qsGroup);
-		query.addBindValue(acl->bApplyHere ? 1 : 0);
-		query.addBindValue(acl->bApplySubs ? 1 : 0);
-		query.addBindValue(static_cast< int >(acl->pAllow));
-		query.addBindValue(static_cast< int >(acl->pDeny));
-		SQLEXEC();
-	}
+					if (query.next()) {
+						groupID = query.value(0).toInt();
+					} else {
+						qFatal("ServerDB: internal query failure: PostgreSQL query did not return the inserted group's "
+							   "group_id");
+					}
+				} else {
+					SQLPREP("REPLACE INTO `%1groups` (`server_id`, `channel_id`, `name`, `inherit`, `inheritable`) "
+							"VALUES (?,?,?,?,?)");
+					query.addBindValue(serverNum);
+					query.addBindValue(id);
+					query.addBindValue(g.name);
+					query.addBindValue(g.inherit ? 1 : 0);
+					query.addBindValue(g.inheritable ? 1 : 0);
+					SQLEXEC();
+
+					groupID = query.lastInsertId().toInt();
+				}
+
+				for (int pid : g.add) {
+					SQLPREP("INSERT INTO `%1group_members` (`group_id`, `server_id`, `user_id`, `addit`) VALUES (?, "
+							"?, ?, ?)");
+					query.addBindValue(groupID);
+					query.addBindValue(serverNum);
+					query.addBindValue(pid);
+					query.addBindValue(1);
+					SQLEXEC();
+				}
+				for (int pid : g.remove) {
+					SQLPREP("INSERT INTO `%1group_members` (`group_id`, `server_id`, `user_id`, `addit`) VALUES (?, "
+							"?, ?, ?)");
+					query.addBindValue(groupID);
+					query.addBindValue(serverNum);
+					query.addBindValue(pid);
+					query.addBindValue(0);
+					SQLEXEC();
+				}
+			}
+
+			int pri = 5;
+
+			for (const ACLData &acl : acls) {
+				SQLPREP("INSERT INTO `%1acl` (`server_id`, `channel_id`, `priority`, `user_id`, `group_name`, "
+						"`apply_here`, `apply_sub`, `grantpriv`, `revokepriv`) VALUES (?,?,?,?,?,?,?,?,?)");
+				query.addBindValue(serverNum);
+				query.addBindValue(id);
+				query.addBindValue(pri++);
+
+				query.addBindValue(acl.userID);
+				query.addBindValue(acl.group);
+				query.addBindValue(acl.applyHere ? 1 : 0);
+				query.addBindValue(acl.applySubs ? 1 : 0);
+				query.addBindValue(acl.allow);
+				query.addBindValue(acl.deny);
+				SQLEXEC();
+			}
+		},
+		QString::fromLatin1("channel/%1/%2").arg(serverNum).arg(id));
 }
 
-/** Reads the channel privileges (group and acl) as well as the channel information key/value pairs from the database.
- * @param c Channel to fetch information for
+/** Reads the channels of this server along with their groups, ACLs and information key/value pairs from the database.
+ * Every table is read with a single query and the channel tree is assembled afterwards.
  */
-void Server::readChannelPrivs(Channel *c) {
-	TransactionHolder th;
+void Server::readChannels() {
+	QElapsedTimer total;
+	QElapsedTimer phase;
+	total.start();
+	phase.start();
 
-	unsigned int cid = c->iId;
+	// The time spent in every phase in milliseconds
+	qint64 channelTime, infoTime, groupTime, memberTime, aclTime;
 
-	QSqlQuery &query = *th.qsqQuery;
+	ChannelTreeBuilder builder;
 
-	SQLPREP("SELECT `key`, `value` FROM `%1channel_info` WHERE `server_id` = ? AND `channel_id` = ?");
-	query.addBindValue(iServerNum);
-	query.addBindValue(cid);
-	SQLEXEC();
-	while (query.next()) {
-		int key              = query.value(0).toInt();
-		const QString &value = query.value(1).toString();
-		if (key == ServerDB::Channel_Description) {
-			hashAssign(c->qsDesc, c->qbaDescHash, value);
-		} else if (key == ServerDB::Channel_Position) {
-			c->iPosition = QVariant(value).toInt(); // If the conversion fails it'll return the default value 0
-		} else if (key == ServerDB::Channel_Max_Users) {
-			c->uiMaxUsers = QVariant(value).toUInt(); // If the conversion fails it'll return the default value 0
-		}
-	}
+	{
+		TransactionHolder th;
+		QSqlQuery &query = *th.qsqQuery;
+		// The rows are only read once, so they don't have to be kept around
+		query.setForwardOnly(true);
 
-	SQLPREP("SELECT `group_id`, `name`, `inherit`, `inheritable` FROM `%1groups` WHERE `server_id` = ? AND "
-			"`channel_id` = ?");
-	query.addBindValue(iServerNum);
-	query.addBindValue(cid);
-	SQLEXEC();
-	while (query.next()) {
-		int gid         = query.value(0).toInt();
-		QString name    = query.value(1).toString();
-		Group *g        = new Group(c, name);
-		g->bInherit     = query.value(2).toBool();
-		g->bInheritable = query.value(3).toBool();
-
-		QSqlQuery mem;
-		mem.prepare(QString::fromLatin1("SELECT user_id, addit FROM %1group_members WHERE group_id = ?")
-						.arg(Meta::mp.qsDBPrefix));
-		mem.addBindValue(gid);
-		mem.exec();
-		while (mem.next()) {
-			int uid = mem.value(0).toInt();
-			if (mem.value(1).toBool())
-				g->qsAdd << uid;
-			else
-				g->qsRemove << uid;
+		SQLPREP("SELECT `channel_id`, `parent_id`, `name`, `inheritacl` FROM `%1channels` WHERE `server_id` = ? "
+				"ORDER BY `name`");
+		query.addBindValue(iServerNum);
+		SQLEXEC();
+		while (query.next()) {
+			builder.addChannel(query.value(0).toUInt(), query.value(1).isNull() ? -1 : query.value(1).toInt(),
+							   query.value(2).toString(), query.value(3).toBool());
 		}
-	}
-
-	SQLPREP("SELECT `user_id`, `group_name`, `apply_here`, `apply_sub`, `grantpriv`, `revokepriv` FROM `%1acl` WHERE "
-			"`server_id` = ? AND `channel_id` = ? ORDER BY `priority`");
-	query.addBindValue(iServerNum);
-	query.addBindValue(cid);
-	SQLEXEC();
-	while (query.next()) {
-		ChanACL *acl    = new ChanACL(c);
-		acl->iUserId    = query.value(0).isNull() ? -1 : query.value(0).toInt();
-		acl->qsGroup    = query.value(1).toString();
-		acl->bApplyHere = query.value(2).toBool();
-		acl->bApplySubs = query.value(3).toBool();
-		acl->pAllow     = static_cast< ChanACL::Permissions >(query.value(4).toInt());
-		acl->pDeny      = static_cast< ChanACL::Permissions >(query.value(5).toInt());
-	}
-}
-
-void Server::readChannels(Channel *p) {
-	QList< Channel * > kids;
-	Channel *c;
-	QSqlQuery query;
-	int parentid = -1;
+		channelTime = phase.restart();
 
-	if (p) {
-		parentid = static_cast< int >(p->iId);
-		readChannelPrivs(qhChannels.value(p->iId));
-	}
+		SQLPREP("SELECT `channel_id`, `key`, `value` FROM `%1channel_info` WHERE `server_id` = ?");
+		query.addBindValue(iServerNum);
+		SQLEXEC();
+		while (query.next()) {
+			builder.addInfo(query.value(0).toUInt(), query.value(1).toInt(), query.value(2).toString());
+		}
+		infoTime = phase.restart();
 
-	{
-		TransactionHolder th;
-		if (parentid == -1) {
-			SQLPREP("SELECT `channel_id`, `name`, `inheritacl` FROM `%1channels` WHERE `server_id` = ? AND `parent_id` "
-					"IS NULL ORDER BY `name`");
-			query.addBindValue(iServerNum);
-		} else {
-			SQLPREP("SELECT `channel_id`, `name`, `inheritacl` FROM `%1channels` WHERE `server_id` = ? AND "
-					"`parent_id`=? ORDER BY `name`");
-			query.addBindValue(iServerNum);
-			query.addBindValue(parentid);
+		SQLPREP("SELECT `group_id`, `channel_id`, `name`, `inherit`, `inheritable` FROM `%1groups` WHERE "
+				"`server_id` = ?");
+		query.addBindValue(iServerNum);
+		SQLEXEC();
+		while (query.next()) {
+			builder.addGroup(query.value(0).toInt(), query.value(1).toUInt(), query.value(2).toString(),
+							 query.value(3).toBool(), query.value(4).toBool());
 		}
+		groupTime = phase.restart();
+
+		SQLPREP("SELECT `group_id`, `user_id`, `addit` FROM `%1group_members` WHERE `server_id` = ?");
+		query.addBindValue(iServerNum);
 		SQLEXEC();
+		while (query.next()) {
+			builder.addGroupMember(query.value(0).toInt(), query.value(1).toInt(), query.value(2).toBool());
+		}
+		memberTime = phase.restart();
 
+		SQLPREP("SELECT `channel_id`, `user_id`, `group_name`, `apply_here`, `apply_sub`, `grantpriv`, `revokepriv` "
+				"FROM `%1acl` WHERE `server_id` = ? ORDER BY `channel_id`, `priority`");
+		query.addBindValue(iServerNum);
+		SQLEXEC();
 		while (query.next()) {
-			c = new Channel(query.value(0).toUInt(), query.value(1).toString(), p);
-			if (!p)
-				c->setParent(this);
-			qhChannels.insert(c->iId, c);
-			c->bInheritACL = query.value(2).toBool();
-			kids << c;
+			builder.addACL(query.value(0).toUInt(), query.value(1).isNull() ? -1 : query.value(1).toInt(),
+						   query.value(2).toString(), query.value(3).toBool(), query.value(4).toBool(),
+						   query.value(5).toInt(), query.value(6).toInt());
 		}
+		aclTime = phase.restart();
 	}
 
-	query.clear();
+	const QHash< unsigned int, Channel * > channels = builder.build(this);
+	for (Channel *c : channels) {
+		hashAssign(c->qsDesc, c->qbaDescHash, c->m_descriptionBlob, c->qsDesc);
+	}
+	qhChannels.insert(channels);
 
-	foreach (c, kids)
-		readChannels(c);
+	log(QString("Loaded %1 channels in %2 ms (channels: %3 ms, channel info: %4 ms, groups: %5 ms, group members: %6 "
+				"ms, ACLs: %7 ms, assembling: %8 ms)")
+			.arg(channels.size())
+			.arg(total.elapsed())
+			.arg(channelTime)
+			.arg(infoTime)
+			.arg(groupTime)
+			.arg(memberTime)
+			.arg(aclTime)
+			.arg(phase.elapsed()));
 }
 
 void Server::readLinks() {
@@ -2163,8 +2316,9 @@ void Server::readLinks() {
 		Channel *c = qhChannels.value(cid);
 		Channel *l = qhChannels.value(lid);
 		if (c && l) {
-			QWriteLocker wl(&qrwlVoiceThread);
+			VoiceThreadWriteLocker wl(this);
 			c->link(l);
+			++m_linkGeneration;
 		}
 	}
 }
@@ -2176,18 +2330,25 @@ void Server::setLastChannel(const User *p) {
 	if (p->cChannel->bTemporary)
 		return;
 
-	TransactionHolder th;
-	QSqlQuery &query = *th.qsqQuery;
+	const int serverNum          = iServerNum;
+	const int userID             = p->iId;
+	const unsigned int channelID = p->cChannel->iId;
+	ServerDB::queueWrite(
+		[serverNum, userID, channelID]() {
+			QSqlQuery query(ServerDB::connection());
 
-	if (Meta::mp.qsDBDriver == "QSQLITE") {
-		SQLPREP("UPDATE `%1users` SET `lastchannel`=? WHERE `server_id` = ? AND `user_id` = ?");
-	} else {
-		SQLPREP("UPDATE `%1users` SET `lastchannel`=?, `last_active` = now() WHERE `server_id` = ? AND `user_id` = ?");
-	}
-	query.addBindValue(p->cChannel->iId);
-	query.addBindValue(iServerNum);
-	query.addBindValue(p->iId);
-	SQLEXEC();
+			if (Meta::mp.qsDBDriver == "QSQLITE") {
+				SQLPREP("UPDATE `%1users` SET `lastchannel`=? WHERE `server_id` = ? AND `user_id` = ?");
+			} else {
+				SQLPREP("UPDATE `%1users` SET `lastchannel`=?, `last_active` = now() WHERE `server_id` = ? AND "
+						"`user_id` = ?");
+			}
+			query.addBindValue(channelID);
+			query.addBindValue(serverNum);
+			query.addBindValue(userID);
+			SQLEXEC();
+		},
+		QString::fromLatin1("lastchannel/%1/%2").arg(serverNum).arg(userID));
 }
 
 int Server::readLastChannel(int id) {
@@ -2263,18 +2424,24 @@ void Server::setLastDisconnect(const User *p) {
 	if (p->iId < 0)
 		return;
 
-	TransactionHolder th;
-	QSqlQuery &query = *th.qsqQuery;
+	const int serverNum = iServerNum;
+	const int userID    = p->iId;
+	ServerDB::queueWrite(
+		[serverNum, userID]() {
+			QSqlQuery query(ServerDB::connection());
 
-	if (Meta::mp.qsDBDriver == "QSQLITE") {
-		SQLPREP("UPDATE `%1users` SET `last_disconnect` = datetime('now') WHERE `server_id` = ? AND `user_id` = ?");
-	} else {
-		// MySQL or PostgreSQL
-		SQLPREP("UPDATE `%1users` SET `last_disconnect` = now() WHERE `server_id` = ? AND `user_id` = ?");
-	}
-	query.addBindValue(iServerNum);
-	query.addBindValue(p->iId);
-	SQLEXEC();
+			if (Meta::mp.qsDBDriver == "QSQLITE") {
+				SQLPREP(
+					"UPDATE `%1users` SET `last_disconnect` = datetime('now') WHERE `server_id` = ? AND `user_id` = ?");
+			} else {
+				// MySQL or PostgreSQL
+				SQLPREP("UPDATE `%1users` SET `last_disconnect` = now() WHERE `server_id` = ? AND `user_id` = ?");
+			}
+			query.addBindValue(serverNum);
+			query.addBindValue(userID);
+			SQLEXEC();
+		},
+		QString::fromLatin1("lastdisconnect/%1/%2").arg(serverNum).arg(userID));
 }
 
 void Server::dumpChannel(const Channel *c) {
@@ -2287,7 +2454,7 @@ void Server::dumpChannel(const Channel *c) {
 	}
 
 	qWarning("Channel %s (ACLInherit %d)", qPrintable(c->qsName), c->bInheritACL);
-	qWarning("Description: %s", qPrintable(c->qsDesc));
+	qWarning("Description: %s", qPrintable(c->description()));
 	foreach (g, c->qhGroups) {
 		qWarning("Group %s (Inh %d  Able %d)", qPrintable(g->qsName), g->bInherit, g->bInheritable);
 		foreach (pid, g->qsAdd)
@@ -2334,6 +2501,8 @@ void Server::getBans() {
 		if (ban.isValid())
 			qlBans << ban;
 	}
+
+	m_banIndex.rebuild(qlBans);
 }
 
 void Server::saveBans() {
@@ -2357,6 +2526,41 @@ void Server::saveBans() {
 		query.addBindValue(ban.iDuration);
 		SQLEXEC();
 	}
+
+	m_banIndex.rebuild(qlBans);
+}
+
+void Server::removeBans(const QList< Ban > &bans) {
+	if (bans.isEmpty()) {
+		return;
+	}
+
+	TransactionHolder th;
+
+	// Depending on the database, the start may be stored with less precision than it has in memory (MySQL's DATETIME
+	// even rounds to whole seconds), so it is only compared at second precision
+	QVariantList serverIDs, bases, masks, durations, startsFrom, startsTo;
+	for (const Ban &ban : bans) {
+		const QDateTime second = ban.qdtStart.addMSecs(-ban.qdtStart.time().msec());
+
+		serverIDs << iServerNum;
+		bases << ban.haAddress.toByteArray();
+		masks << ban.iMask;
+		durations << ban.iDuration;
+		startsFrom << second;
+		startsTo << second.addSecs(1);
+	}
+
+	QSqlQuery &query = *th.qsqQuery;
+	SQLPREP("DELETE FROM `%1bans` WHERE `server_id` = ? AND `base` = ? AND `mask` = ? AND `duration` = ? AND "
+			"`start` >= ? AND `start` <= ?");
+	query.addBindValue(serverIDs);
+	query.addBindValue(bases);
+	query.addBindValue(masks);
+	query.addBindValue(durations);
+	query.addBindValue(startsFrom);
+	query.addBindValue(startsTo);
+	SQLEXECBATCH();
 }
 
 QVariant Server::getConf(const QString &key, QVariant def) {
@@ -2397,33 +2601,46 @@ void Server::setConf(const QString &key, const QVariant &value) {
 }
 
 void Server::dblog(const QString &str) const {
-	TransactionHolder th;
-	QSqlQuery &query = *th.qsqQuery;
-
 	// Is logging disabled?
 	if (Meta::mp.iLogDays < 0)
 		return;
 
-	// Once per hour
-	if (Meta::mp.iLogDays > 0) {
-		if (ServerDB::tLogClean.isElapsed(3600ULL * 1000000ULL)) {
-			QString qstr;
-			if (Meta::mp.qsDBDriver == "QSQLITE") {
-				qstr = QString::fromLatin1("msgtime < datetime('now','-%1 days')").arg(Meta::mp.iLogDays);
-			} else if (Meta::mp.qsDBDriver == "QPSQL") {
-				qstr = QString::fromLatin1("msgtime < now() - INTERVAL '%1 day'").arg(Meta::mp.iLogDays);
-			} else {
-				qstr = QString::fromLatin1("msgtime < now() - INTERVAL %1 day").arg(Meta::mp.iLogDays);
-			}
-			ServerDB::prepare(query, QString::fromLatin1("DELETE FROM %1slog WHERE ") + qstr);
-			SQLEXEC();
+	if (LogStore *store = ServerDB::logStore(iServerNum)) {
+		const std::int64_t now = QDateTime::currentSecsSinceEpoch();
+		store->append(now, str);
+
+		// Only looks at the oldest segment, so there is no need to do this only once per hour
+		if (Meta::mp.iLogDays > 0) {
+			store->removeOlderThan(now - Meta::mp.iLogDays * 24LL * 60 * 60);
 		}
+		return;
 	}
 
-	SQLPREP("INSERT INTO `%1slog` (`server_id`, `msg`) VALUES(?,?)");
-	query.addBindValue(iServerNum);
-	query.addBindValue(str);
-	SQLEXEC();
+	const int serverNum = iServerNum;
+	ServerDB::queueWrite([serverNum, str]() {
+		QSqlQuery query(ServerDB::connection());
+
+		// Once per hour
+		if (Meta::mp.iLogDays > 0) {
+			if (ServerDB::tLogClean.isElapsed(3600ULL * 1000000ULL)) {
+				QString qstr;
+				if (Meta::mp.qsDBDriver == "QSQLITE") {
+					qstr = QString::fromLatin1("msgtime < datetime('now','-%1 days')").arg(Meta::mp.iLogDays);
+				} else if (Meta::mp.qsDBDriver == "QPSQL") {
+					qstr = QString::fromLatin1("msgtime < now() - INTERVAL '%1 day'").arg(Meta::mp.iLogDays);
+				} else {
+					qstr = QString::fromLatin1("msgtime < now() - INTERVAL %1 day").arg(Meta::mp.iLogDays);
+				}
+				ServerDB::prepare(query, QString::fromLatin1("DELETE FROM %1slog WHERE ") + qstr);
+				SQLEXEC();
+			}
+		}
+
+		SQLPREP("INSERT INTO `%1slog` (`server_id`, `msg`) VALUES(?,?)");
+		query.addBindValue(serverNum);
+		query.addBindValue(str);
+		SQLEXEC();
+	});
 }
 
 void Server::loadChannelListenersOf(const ServerUser &user) {
@@ -2455,39 +2672,47 @@ void Server::loadChannelListenersOf(const ServerUser &user) {
 		m_channelListenerManager.setListenerVolumeAdjustment(user.uiSession, channelID,
 															 VolumeAdjustment::fromFactor(volume));
 	}
+
+	invalidateRoutingSnapshot();
 }
 
 void Server::addChannelListener(const ServerUser &user, const Channel &channel) {
 	if (user.iId >= 0) {
-		TransactionHolder th;
-		QSqlQuery &query = *th.qsqQuery;
-
-		// Update or insert entry
-		SQLPREP(
-			"SELECT COUNT(*) FROM `%1channel_listeners` WHERE `server_id` = ? AND `user_id` = ? AND `channel_id` = ?");
-		query.addBindValue(iServerNum);
-		query.addBindValue(user.iId);
-		query.addBindValue(channel.iId);
+		const int serverNum          = iServerNum;
+		const int userID             = user.iId;
+		const unsigned int channelID = channel.iId;
+		ServerDB::queueWrite([serverNum, userID, channelID]() {
+			QSqlQuery query(ServerDB::connection());
+
+			// Update or insert entry
+			SQLPREP("SELECT COUNT(*) FROM `%1channel_listeners` WHERE `server_id` = ? AND `user_id` = ? AND "
+					"`channel_id` = ?");
+			query.addBindValue(serverNum);
+			query.addBindValue(userID);
+			query.addBindValue(channelID);
 
-		SQLEXEC();
+			SQLEXEC();
 
-		bool entryAlreadyExists = query.next() && query.value(0).toInt() > 0;
+			bool entryAlreadyExists = query.next() && query.value(0).toInt() > 0;
 
-		if (entryAlreadyExists) {
-			SQLPREP("UPDATE `%1channel_listeners` SET `enabled` = 1 WHERE `server_id` = ? AND `user_id`= ? AND "
-					"`channel_id` = ?");
-		} else {
-			SQLPREP("INSERT INTO `%1channel_listeners` (`server_id`, `user_id`, `channel_id`) VALUES (?, ?, ?)");
-		}
+			if (entryAlreadyExists) {
+				SQLPREP("UPDATE `%1channel_listeners` SET `enabled` = 1 WHERE `server_id` = ? AND `user_id`= ? AND "
+						"`channel_id` = ?");
+			} else {
+				SQLPREP("INSERT INTO `%1channel_listeners` (`server_id`, `user_id`, `channel_id`) VALUES (?, ?, ?)");
+			}
 
-		query.addBindValue(iServerNum);
-		query.addBindValue(user.iId);
-		query.addBindValue(channel.iId);
+			query.addBindValue(serverNum);
+			query.addBindValue(userID);
+			query.addBindValue(channelID);
 
-		SQLEXEC();
+			SQLEXEC();
+		});
 	}
 
 	m_channelListenerManager.addListener(user.uiSession, channel.iId);
+
+	invalidateRoutingSnapshot();
 }
 
 void Server::disableChannelListener(const ServerUser &user, const Channel &channel) {
@@ -2496,20 +2721,26 @@ void Server::disableChannelListener(const ServerUser &user, const Channel &chann
 	}
 
 	if (user.iId >= 0) {
-		TransactionHolder th;
-		QSqlQuery &query = *th.qsqQuery;
+		const int serverNum          = iServerNum;
+		const int userID             = user.iId;
+		const unsigned int channelID = channel.iId;
+		ServerDB::queueWrite([serverNum, userID, channelID]() {
+			QSqlQuery query(ServerDB::connection());
 
-		SQLPREP("UPDATE `%1channel_listeners` SET `enabled` = ? WHERE `server_id` = ? AND `user_id` = ? AND "
-				"`channel_id` = ?");
-		// Explicit cast to int is required for Postgresql
-		query.addBindValue(static_cast< int >(false));
-		query.addBindValue(iServerNum);
-		query.addBindValue(user.iId);
-		query.addBindValue(channel.iId);
-		SQLEXEC();
+			SQLPREP("UPDATE `%1channel_listeners` SET `enabled` = ? WHERE `server_id` = ? AND `user_id` = ? AND "
+					"`channel_id` = ?");
+			// Explicit cast to int is required for Postgresql
+			query.addBindValue(static_cast< int >(false));
+			query.addBindValue(serverNum);
+			query.addBindValue(userID);
+			query.addBindValue(channelID);
+			SQLEXEC();
+		});
 	}
 
 	m_channelListenerManager.removeListener(user.uiSession, channel.iId);
+
+	invalidateRoutingSnapshot();
 }
 
 void Server::deleteChannelListener(const ServerUser &user, const Channel &channel) {
@@ -2518,38 +2749,80 @@ void Server::deleteChannelListener(const ServerUser &user, const Channel &channe
 	}
 
 	if (user.iId >= 0) {
-		TransactionHolder th;
-		QSqlQuery &query = *th.qsqQuery;
-
-		SQLPREP("DELETE FROM `%1channel_listeners` WHERE `server_id` = ? AND `user_id` = ? AND `channel_id` = ?");
-		query.addBindValue(iServerNum);
-		query.addBindValue(user.iId);
-		query.addBindValue(channel.iId);
-		SQLEXEC();
+		const int serverNum          = iServerNum;
+		const int userID             = user.iId;
+		const unsigned int channelID = channel.iId;
+		ServerDB::queueWrite([serverNum, userID, channelID]() {
+			QSqlQuery query(ServerDB::connection());
+
+			SQLPREP("DELETE FROM `%1channel_listeners` WHERE `server_id` = ? AND `user_id` = ? AND `channel_id` = ?");
+			query.addBindValue(serverNum);
+			query.addBindValue(userID);
+			query.addBindValue(channelID);
+			SQLEXEC();
+		});
 	}
 
 	m_channelListenerManager.removeListener(user.uiSession, channel.iId);
+
+	invalidateRoutingSnapshot();
 }
 
 void Server::setChannelListenerVolume(const ServerUser &user, const Channel &channel, float volumeAdjustment) {
 	if (user.iId >= 0) {
-		TransactionHolder th;
-		QSqlQuery &query = *th.qsqQuery;
-
-		SQLPREP("UPDATE `%1channel_listeners` SET `volume_adjustment` = ? WHERE `server_id` = ? AND `user_id` = ? AND "
-				"`channel_id` = ?");
-		query.addBindValue(volumeAdjustment);
-		query.addBindValue(iServerNum);
-		query.addBindValue(user.iId);
-		query.addBindValue(channel.iId);
-		SQLEXEC();
+		const int serverNum          = iServerNum;
+		const int userID             = user.iId;
+		const unsigned int channelID = channel.iId;
+		// Unlike enabling, disabling and deleting the listener, setting the volume only sets a column, so only the
+		// latest volume has to be written
+		ServerDB::queueWrite(
+			[serverNum, userID, channelID, volumeAdjustment]() {
+				QSqlQuery query(ServerDB::connection());
+
+				SQLPREP("UPDATE `%1channel_listeners` SET `volume_adjustment` = ? WHERE `server_id` = ? AND "
+						"`user_id` = ? AND `channel_id` = ?");
+				query.addBindValue(volumeAdjustment);
+				query.addBindValue(serverNum);
+				query.addBindValue(userID);
+				query.addBindValue(channelID);
+				SQLEXEC();
+			},
+			QString::fromLatin1("listenervolume/%1/%2/%3").arg(serverNum).arg(userID).arg(channelID));
 	}
 
 	m_channelListenerManager.setListenerVolumeAdjustment(user.uiSession, channel.iId,
 														 VolumeAdjustment::fromFactor(volumeAdjustment));
+
+	invalidateRoutingSnapshot();
+}
+
+LogStore *ServerDB::logStore(int server_id) {
+	if (Meta::mp.qsLogDir.isEmpty()) {
+		return nullptr;
+	}
+
+	QMutexLocker lock(&qmLogStores);
+
+	LogStore *store = qhLogStores.value(server_id);
+	if (!store) {
+		store = new LogStore(QDir(Meta::mp.qsLogDir).filePath(QString::number(server_id)),
+							 static_cast< std::int64_t >(Meta::mp.iLogSegmentSize) * 1024);
+		// If the directory can't be opened, the log entries are discarded, just like the database discards them if
+		// logging is disabled
+		store->open();
+		qhLogStores.insert(server_id, store);
+	}
+
+	return store;
 }
 
 void ServerDB::wipeLogs() {
+	if (!Meta::mp.qsLogDir.isEmpty()) {
+		for (int server_id : getAllServers()) {
+			logStore(server_id)->clear();
+		}
+	}
+
 	TransactionHolder th;
 	QSqlQuery &query = *th.qsqQuery;
 
@@ -2557,6 +2830,14 @@ void ServerDB::wipeLogs() {
 }
 
 QList< ServerDB::LogRecord > ServerDB::getLog(int server_id, unsigned int offs_min, unsigned int offs_max) {
+	if (LogStore *store = logStore(server_id)) {
+		QList< LogRecord > ql;
+		for (const LogStore::Record &record : store->read(offs_min, offs_max)) {
+			ql << LogRecord(record.time, record.message);
+		}
+		return ql;
+	}
+
 	TransactionHolder th;
 	QSqlQuery &query = *th.qsqQuery;
 
@@ -2584,6 +2865,10 @@ QList< ServerDB::LogRecord > ServerDB::getLog(int server_id, unsigned int offs_m
 }
 
 int ServerDB::getLogLen(int server_id) {
+	if (LogStore *store = logStore(server_id)) {
+		return static_cast< int >(std::min< std::uint64_t >(store->size(), std::numeric_limits< int >::max()));
+	}
+
 	TransactionHolder th;
 	QSqlQuery &query = *th.qsqQuery;
 
@@ -2598,6 +2883,34 @@ int ServerDB::getLogLen(int server_id) {
 	return -1;
 }
 
+int ServerDB::getLogIndex(int server_id, std::int64_t time) {
+	if (LogStore *store = logStore(server_id)) {
+		return static_cast< int >(
+			std::min< std::uint64_t >(store->countNewerThan(time), std::numeric_limits< int >::max()));
+	}
+
+	TransactionHolder th;
+	QSqlQuery &query = *th.qsqQuery;
+
+	if (Meta::mp.qsDBDriver == "QSQLITE") {
+		SQLPREP(
+			"SELECT COUNT(`msgtime`) FROM `%1slog` WHERE `server_id` = ? AND `msgtime` > datetime(?, 'unixepoch')");
+	} else if (Meta::mp.qsDBDriver == "QPSQL") {
+		SQLPREP("SELECT COUNT(`msgtime`) FROM `%1slog` WHERE `server_id` = ? AND `msgtime` > to_timestamp(?)");
+	} else {
+		SQLPREP("SELECT COUNT(`msgtime`) FROM `%1slog` WHERE `server_id` = ? AND `msgtime` > FROM_UNIXTIME(?)");
+	}
+	query.addBindValue(server_id);
+	query.addBindValue(static_cast< qint64 >(time));
+	SQLEXEC();
+
+	while (query.next()) {
+		return query.value(0).toInt();
+	}
+
+	return -1;
+}
+
 void ServerDB::setConf(int server_id, const QString &k, const QVariant &value) {
 	TransactionHolder th;
 
@@ -2686,6 +2999,13 @@ int ServerDB::addServer() {
 }
 
 void ServerDB::deleteServer(int server_id) {
+	if (LogStore *store = logStore(server_id)) {
+		store->remove();
+
+		QMutexLocker lock(&qmLogStores);
+		delete qhLogStores.take(server_id);
+	}
+
 	TransactionHolder th;
 	QSqlQuery &query = *th.qsqQuery;
 	SQLPREP("DELETE FROM `%1servers` WHERE `server_id` = ?");
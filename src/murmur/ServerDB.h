@@ -6,10 +6,17 @@
 #ifndef MUMBLE_MURMUR_DATABASE_H_
 #define MUMBLE_MURMUR_DATABASE_H_
 
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QRecursiveMutex>
 #include <QtCore/QVariant>
 
 #include "Timer.h"
 
+#include <functional>
+
+class DBWriter;
+class LogStore;
 class Server;
 class Channel;
 class User;
@@ -42,8 +49,26 @@ public:
 	~ServerDB();
 	typedef QPair< std::int64_t, QString > LogRecord;
 	static Timer tLogClean;
+	/// The connection opened by the main thread
 	static QSqlDatabase *db;
+	/// Serializes all database access. Has to be held while using a connection (TransactionHolder takes care of
+	/// that).
+	static QRecursiveMutex qrmDatabase;
 	static QString qsUpgradeSuffix;
+	/// Commits the writes queued with queueWrite() in the background, unless disabled by the dbwritequeue setting
+	static DBWriter *writer;
+	/// @returns The connection to be used by the calling thread. A Qt database connection may only be used by the
+	/// 	thread that created it, so every thread other than the main thread (see the controlthreads setting) gets a
+	/// 	connection of its own.
+	static QSqlDatabase connection();
+	/// Closes the connection of the calling thread. Has to be called by every thread (other than the main thread)
+	/// that accessed the database before it exits.
+	static void releaseThreadConnection();
+	/// Executes the given write on the thread of the DBWriter, or right away if there is none. Meant for writes whose
+	/// completion nobody waits for. Reads (in fact all transactions) still see the write, as every transaction
+	/// executes the queued writes first.
+	/// @param key If not empty, discards a queued write with the same key (see DBWriter::enqueue())
+	static void queueWrite(const std::function< void() > &write, const QString &key = QString());
 	static void setSUPW(int iServNum, const QString &pw);
 	static void disableSU(int srvnum);
 	static QList< int > getBootServers();
@@ -54,9 +79,15 @@ public:
 	static QMap< QString, QString > getAllConf(int server_id);
 	static QVariant getConf(int server_id, const QString &key, QVariant def = QVariant());
 	static void setConf(int server_id, const QString &key, const QVariant &value = QVariant());
+	/// @returns The store holding the log of the given server, or nullptr if the log is stored in the database (see
+	/// 	the logdir setting)
+	static LogStore *logStore(int server_id);
 	static QList< LogRecord > getLog(int server_id, unsigned int offs_min, unsigned int offs_max);
 	static QString getLegacySHA1Hash(const QString &password);
 	static int getLogLen(int server_id);
+	/// @returns The number of log entries newer than the given time (in seconds since the epoch), i.e. the index
+	/// 	(see getLog()) of the latest entry that is not newer
+	static int getLogIndex(int server_id, std::int64_t time);
 	static void wipeLogs();
 	static bool prepare(QSqlQuery &, const QString &, bool fatal = true, bool warn = true);
 	static bool query(QSqlQuery &, const QString &, bool fatal = true, bool warn = true);
@@ -69,6 +100,10 @@ private:
 
 	static void loadOrSetupMetaPBKDF2IterationCount(QSqlQuery &query);
 	static void writeSUPW(int srvnum, const QString &pwHash, const QString &saltHash, const QVariant &kdfIterations);
+
+	/// Protects qhLogStores
+	static QMutex qmLogStores;
+	static QHash< int, LogStore * > qhLogStores;
 };
 
 #endif
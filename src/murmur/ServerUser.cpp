@@ -19,9 +19,9 @@ ServerUser::ServerUser(Server *p, QSslSocket *socket)
 	sState       = ServerUser::Connected;
 	m_clientType = ClientType::REGULAR;
 	sUdpSocket   = INVALID_SOCKET;
+	uiUdpToken   = 0;
 
 	memset(&saiUdpAddress, 0, sizeof(saiUdpAddress));
-	memset(&saiTcpLocalAddress, 0, sizeof(saiTcpLocalAddress));
 
 	dUDPPingAvg = dUDPPingVar = 0.0f;
 	dTCPPingAvg = dTCPPingVar = 0.0f;
@@ -30,15 +30,47 @@ ServerUser::ServerUser(Server *p, QSslSocket *socket)
 	aiUdpFlag            = 1;
 	m_version            = Version::UNKNOWN;
 	bVerified            = true;
+	uiAuthTicket         = 0;
 	iLastPermissionCheck = -1;
 
-	bOpus = false;
+	bOpus             = false;
+	m_imageReferences = false;
 }
 
+ServerUser::~ServerUser() {
+	delete m_tunnelQueue.load();
+}
+
+TunnelQueue &ServerUser::tunnelQueue() {
+	TunnelQueue *queue = m_tunnelQueue.load(std::memory_order_acquire);
+	if (!queue) {
+		// Several voice threads may get here at once, only one of the queues is kept
+		TunnelQueue *created = new TunnelQueue(TUNNEL_QUEUE_CAPACITY);
+		if (m_tunnelQueue.compare_exchange_strong(queue, created, std::memory_order_acq_rel)) {
+			queue = created;
+		} else {
+			delete created;
+		}
+	}
+	return *queue;
+}
 
 ServerUser::operator QString() const {
 	return QString::fromLatin1("%1:%2(%3)").arg(qsName).arg(uiSession).arg(iId);
 }
+
+ACLSubject ServerUser::aclSubject() const {
+	return { this, bVerified, &qslAccessTokens };
+}
+
+QByteArray ServerUser::texture() const {
+	return m_textureBlob.isNull() ? qbaTexture : m_textureBlob.data();
+}
+
+QString ServerUser::comment() const {
+	return m_commentBlob.isNull() ? qsComment : QString::fromUtf8(m_commentBlob.data());
+}
+
 BandwidthRecord::BandwidthRecord() {
 	iRecNum = 0;
 	iSum    = 0;
@@ -12,11 +12,15 @@
 #	include "win.h"
 #endif
 
+#include "ACLProgram.h"
+#include "BlobStore.h"
 #include "ClientType.h"
 #include "Connection.h"
 #include "HostAddress.h"
 #include "Timer.h"
+#include "TunnelQueue.h"
 #include "User.h"
+#include "VoiceCryptState.h"
 
 #include <QtCore/QElapsedTimer>
 #include <QtCore/QStringList>
@@ -27,6 +31,7 @@
 #	include <sys/socket.h>
 #endif
 
+#include <atomic>
 #include <vector>
 
 // Unfortunately, this needs to be "large enough" to hold
@@ -115,6 +120,19 @@ public:
 	ClientType m_clientType;
 	operator QString() const;
 
+	/// @returns The properties of this user the ACLs are evaluated for
+	ACLSubject aclSubject() const;
+
+	/// The texture and comment of the user, if they are large enough to be requested by their hash (see
+	/// Server::hashAssign). qbaTexture and qsComment are empty then.
+	BlobRef m_textureBlob;
+	BlobRef m_commentBlob;
+
+	/// @returns The texture of the user, wherever it is kept
+	QByteArray texture() const;
+	/// @returns The comment of the user, wherever it is kept
+	QString comment() const;
+
 	float dUDPPingAvg, dUDPPingVar;
 	float dTCPPingAvg, dTCPPingVar;
 	quint32 uiUDPPackets, uiTCPPackets;
@@ -130,6 +148,10 @@ public:
 	bool bVerified;
 	QStringList qslEmail;
 
+	/// Identifies the authentication attempt of this user that is in progress on the authentication threads (see
+	/// AuthPool), 0 if there is none
+	quint64 uiAuthTicket;
+
 	HostAddress haAddress;
 
 	/// Holds whether the user is using TCP
@@ -142,8 +164,18 @@ public:
 	/// UDP.
 	QAtomicInt aiUdpFlag;
 
+	/// The number of voice packets the tunnel queue of a user holds
+	static constexpr std::size_t TUNNEL_QUEUE_CAPACITY = 32;
+	/// @returns The queue of the voice packets to be sent to this user through TCP, which is created the first time
+	/// it is needed. May be called by any thread.
+	TunnelQueue &tunnelQueue();
+	/// @returns The tunnel queue of this user, or nullptr if nothing has been tunneled to the user yet
+	TunnelQueue *existingTunnelQueue() const { return m_tunnelQueue.load(std::memory_order_acquire); }
+
 	QList< int > qlCodecs;
 	bool bOpus;
+	/// Whether the client fetches the images of text messages on demand (see TextMessageImages)
+	bool m_imageReferences;
 
 	QStringList qslAccessTokens;
 
@@ -156,15 +188,28 @@ public:
 
 	int iLastPermissionCheck;
 	QMap< int, unsigned int > qmPermissionSent;
+	/// The crypt state used for UDP
+	VoiceCryptState voiceCrypt;
+	/// The socket the user's UDP endpoint has been bound to (or INVALID_SOCKET). The endpoint is only ever bound once,
+	/// so once this is valid, saiUdpAddress won't change anymore and may be read without synchronisation.
 #ifdef Q_OS_UNIX
-	int sUdpSocket;
+	std::atomic< int > sUdpSocket;
 #else
-	SOCKET sUdpSocket;
+	std::atomic< SOCKET > sUdpSocket;
 #endif
+	/// The token the user's client prefixes its UDP packets with until it knows that the server has bound its UDP
+	/// endpoint (0 if none has been assigned). Only modified by the main thread.
+	std::atomic< quint64 > uiUdpToken;
 	BandwidthRecord bwr;
 	struct sockaddr_storage saiUdpAddress;
-	struct sockaddr_storage saiTcpLocalAddress;
+	/// The local address of the TCP connection, which is also used as the source address of UDP datagrams sent to
+	/// this user
+	HostAddress haTcpLocalAddress;
 	ServerUser(Server *parent, QSslSocket *socket);
+	~ServerUser() override;
+
+protected:
+	std::atomic< TunnelQueue * > m_tunnelQueue{ nullptr };
 };
 
 #endif
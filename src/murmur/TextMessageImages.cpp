@@ -0,0 +1,87 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "TextMessageImages.h"
+
+#include "MumbleProtocol.h"
+
+#include <QtCore/QRegularExpression>
+
+#include <algorithm>
+#include <utility>
+
+TextMessageImages::TextMessageImages(BlobStore &store, unsigned int capacity) : m_store(store), m_capacity(capacity) {
+}
+
+bool TextMessageImages::isEnabled() const {
+	return m_capacity > 0;
+}
+
+QString TextMessageImages::offload(const QString &html) {
+	if (!isEnabled()) {
+		return QString();
+	}
+
+	// The quoted src attribute of an img element holding a base64 data URL, which is how clients embed images (see
+	// Log::imageToImg). Anything else is left alone.
+	static const QRegularExpression imagePattern(
+		QLatin1String(R"((<img\b[^>]*?\bsrc\s*=\s*)(["'])data:image/[^;,"']*;base64,([^"']*)\2)"),
+		QRegularExpression::CaseInsensitiveOption);
+
+	QString result;
+	qsizetype copied = 0;
+
+	QRegularExpressionMatchIterator it = imagePattern.globalMatch(html);
+	while (it.hasNext()) {
+		const QRegularExpressionMatch match = it.next();
+
+		const QByteArray::FromBase64Result image = QByteArray::fromBase64Encoding(
+			match.capturedView(3).toLatin1(), QByteArray::AbortOnBase64DecodingErrors);
+		if (!image || image.decoded.size() < MIN_IMAGE_SIZE) {
+			continue;
+		}
+
+		BlobRef ref = m_store.insert(image.decoded);
+
+		result += QStringView(html).mid(copied, match.capturedStart() - copied);
+		result += match.captured(1) + match.captured(2) + reference(ref.hash()) + match.captured(2);
+		copied = match.capturedEnd();
+
+		keep(std::move(ref));
+	}
+
+	if (copied == 0) {
+		return QString();
+	}
+
+	result += QStringView(html).mid(copied);
+	return result;
+}
+
+QByteArray TextMessageImages::find(const QByteArray &hash) const {
+	return m_images.value(hash).data();
+}
+
+QString TextMessageImages::reference(const QByteArray &hash) {
+	return QLatin1String(Mumble::Protocol::TEXT_MESSAGE_IMAGE_SCHEME) + QLatin1Char(':')
+		   + QString::fromLatin1(hash.toHex());
+}
+
+void TextMessageImages::keep(BlobRef image) {
+	const QByteArray hash = image.hash();
+
+	if (m_images.contains(hash)) {
+		// Sent again, so it is one of the most recent images now
+		m_order.erase(std::find(m_order.begin(), m_order.end(), hash));
+	} else {
+		m_images.insert(hash, std::move(image));
+	}
+	m_order.push_back(hash);
+
+	while (m_order.size() > m_capacity) {
+		m_images.remove(m_order.front());
+		m_order.pop_front();
+	}
+}
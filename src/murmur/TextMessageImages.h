@@ -0,0 +1,60 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_TEXTMESSAGEIMAGES_H_
+#define MUMBLE_MURMUR_TEXTMESSAGEIMAGES_H_
+
+#include "BlobStore.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QString>
+
+#include <deque>
+
+/// Takes the images embedded as base64 data URLs out of text messages, for clients that fetch them on demand (see
+/// MumbleProto::Authenticate::image_references). An image is replaced by a reference to its SHA1 hash, so that a
+/// message carrying a large image only costs the bandwidth of the image for the clients actually displaying it, and
+/// the image is sent to each of them at most once.
+///
+/// The images are kept in a BlobStore. Only the most recent ones are kept, references to older ones can't be resolved
+/// anymore.
+///
+/// Not thread-safe: a server only uses it on the thread handling its messages.
+class TextMessageImages {
+private:
+	Q_DISABLE_COPY(TextMessageImages)
+
+public:
+	/// Images smaller than this (in bytes, after decoding) stay inline, as their reference wouldn't save much
+	static constexpr int MIN_IMAGE_SIZE = 1024;
+
+	/// @param capacity The number of images kept (0 disables offloading)
+	TextMessageImages(BlobStore &store, unsigned int capacity);
+
+	bool isEnabled() const;
+
+	/// Replaces the images in the given message by references
+	/// @returns The message with the references, or a null string if it doesn't contain any image to replace
+	QString offload(const QString &html);
+
+	/// @returns The image with the given SHA1 hash, or an empty array if it isn't kept anymore
+	QByteArray find(const QByteArray &hash) const;
+
+	/// @returns The URL that references the image with the given SHA1 hash
+	static QString reference(const QByteArray &hash);
+
+protected:
+	BlobStore &m_store;
+	unsigned int m_capacity;
+
+	QHash< QByteArray, BlobRef > m_images;
+	/// The hashes of the kept images, from the oldest to the most recent one
+	std::deque< QByteArray > m_order;
+
+	void keep(BlobRef image);
+};
+
+#endif // MUMBLE_MURMUR_TEXTMESSAGEIMAGES_H_
@@ -12,6 +12,7 @@ static constexpr const char *TCP_PACKET_PROCESSING_ZONE = "tcp_packet_processing
 static constexpr const char *PING_PROCESSING_ZONE       = "tcp_ping";
 static constexpr const char *UDP_PING_PROCESSING_ZONE   = "udp_ping";
 static constexpr const char *DECRYPT_UNKNOWN_PEER_ZONE  = "decrypt_unknown_peer";
+static constexpr const char *UDP_BATCH_FLUSH_ZONE       = "udp_batch_flush";
 
 static constexpr const char *UDP_FRAME = "udp_frame";
 
@@ -20,6 +21,8 @@ static constexpr const char *AUDIO_ENCODE               = "audio_encode";
 static constexpr const char *AUDIO_UPDATE               = "audio_update";
 static constexpr const char *AUDIO_WHISPER_CACHE_STORE  = "audio_whisper_cache_restore";
 static constexpr const char *AUDIO_WHISPER_CACHE_CREATE = "audio_whisper_cache_create";
+
+static constexpr const char *ROUTING_SNAPSHOT_PUBLISH_ZONE = "routing_snapshot_publish";
 } // namespace TracyConstants
 
 #endif // MUMBLE_MURMUR_TRACYCONSTANTS_H_
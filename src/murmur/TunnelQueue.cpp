@@ -0,0 +1,128 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "TunnelQueue.h"
+
+#include <QtCore/QtEndian>
+
+#include <cstring>
+
+TunnelQueue::TunnelQueue(std::size_t capacity) {
+	std::size_t size = 2;
+	while (size < capacity) {
+		size <<= 1;
+	}
+
+	m_cells = std::make_unique< Cell[] >(size);
+	m_mask  = size - 1;
+
+	for (std::size_t i = 0; i < size; ++i) {
+		m_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+bool TunnelQueue::push(const unsigned char *data, std::size_t size) {
+	if (size > MAX_PACKET_SIZE) {
+		return false;
+	}
+
+	// Reserves a cell (see Dmitry Vyukov's bounded MPMC queue)
+	std::size_t position = m_appendPosition.load(std::memory_order_relaxed);
+	Cell *cell;
+	while (true) {
+		cell                       = &m_cells[position & m_mask];
+		const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+
+		if (sequence == position) {
+			if (m_appendPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (sequence < position) {
+			// The cell still holds the packet appended one round earlier
+			return false;
+		} else {
+			position = m_appendPosition.load(std::memory_order_relaxed);
+		}
+	}
+
+	qToBigEndian< quint16 >(static_cast< quint16 >(Mumble::Protocol::TCPMessageType::UDPTunnel), cell->data);
+	qToBigEndian< quint32 >(static_cast< quint32 >(size), cell->data + 2);
+	std::memcpy(cell->data + HEADER_SIZE, data, size);
+	cell->size = static_cast< std::uint16_t >(size);
+
+	cell->sequence.store(position + 1, std::memory_order_release);
+	return true;
+}
+
+std::size_t TunnelQueue::drain(QByteArray &out) {
+	std::size_t count = 0;
+
+	while (true) {
+		Cell &cell = m_cells[m_drainPosition & m_mask];
+		if (cell.sequence.load(std::memory_order_acquire) != m_drainPosition + 1) {
+			// Empty, or the next packet is still being appended (it sets the pending flag once it is done)
+			break;
+		}
+
+		out.append(reinterpret_cast< const char * >(cell.data), static_cast< qsizetype >(HEADER_SIZE + cell.size));
+
+		cell.sequence.store(m_drainPosition + m_mask + 1, std::memory_order_release);
+		++m_drainPosition;
+		++count;
+	}
+
+	return count;
+}
+
+PendingTunnelSessions::PendingTunnelSessions(std::size_t capacity) {
+	std::size_t size = 2;
+	while (size < capacity) {
+		size <<= 1;
+	}
+
+	m_cells = std::make_unique< Cell[] >(size);
+	m_mask  = size - 1;
+
+	for (std::size_t i = 0; i < size; ++i) {
+		m_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+bool PendingTunnelSessions::push(unsigned int session) {
+	// The same algorithm as TunnelQueue::push
+	std::size_t position = m_appendPosition.load(std::memory_order_relaxed);
+	Cell *cell;
+	while (true) {
+		cell                       = &m_cells[position & m_mask];
+		const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+
+		if (sequence == position) {
+			if (m_appendPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (sequence < position) {
+			return false;
+		} else {
+			position = m_appendPosition.load(std::memory_order_relaxed);
+		}
+	}
+
+	cell->session = session;
+	cell->sequence.store(position + 1, std::memory_order_release);
+	return true;
+}
+
+bool PendingTunnelSessions::pop(unsigned int &session) {
+	Cell &cell = m_cells[m_drainPosition & m_mask];
+	if (cell.sequence.load(std::memory_order_acquire) != m_drainPosition + 1) {
+		return false;
+	}
+
+	session = cell.session;
+
+	cell.sequence.store(m_drainPosition + m_mask + 1, std::memory_order_release);
+	++m_drainPosition;
+	return true;
+}
@@ -0,0 +1,106 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_TUNNELQUEUE_H_
+#define MUMBLE_MURMUR_TUNNELQUEUE_H_
+
+#include "MumbleProtocol.h"
+
+#include <QtCore/QByteArray>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/// A bounded queue of the voice packets to be sent through the TCP connection of a user who can't be reached via UDP.
+/// Any number of voice threads append packets without locking, already framed as UDPTunnel messages, while the thread
+/// owning the connection takes them out in batches and writes them with a single call.
+///
+/// The queue also carries a pending flag, which lets the appending threads make sure that the queue is drained
+/// without scheduling a drain for every packet.
+class TunnelQueue {
+private:
+	Q_DISABLE_COPY(TunnelQueue)
+
+public:
+	/// The size of the header of a TCP message
+	static constexpr std::size_t HEADER_SIZE = 6;
+	/// The largest packet the queue holds, which is the largest one the protocol allows to be sent via UDP
+	static constexpr std::size_t MAX_PACKET_SIZE = Mumble::Protocol::MAX_UDP_PACKET_SIZE;
+
+	/// @param capacity The number of packets the queue holds, rounded up to a power of two
+	explicit TunnelQueue(std::size_t capacity);
+
+	/// Appends the given packet. May be called by any thread.
+	/// @returns false if the packet has been dropped because the queue is full or the packet too large
+	bool push(const unsigned char *data, std::size_t size);
+
+	/// Appends the framed messages of all packets that have been appended completely to the given buffer. Must not be
+	/// called by more than one thread at a time.
+	/// @returns The number of packets taken out
+	std::size_t drain(QByteArray &out);
+
+	/// Sets the pending flag. Has to be called after appending packets.
+	/// @returns Whether the flag wasn't set, i.e. whether the caller is responsible for getting the queue drained
+	bool markPending() { return !m_pending.exchange(true, std::memory_order_acq_rel); }
+	/// Clears the pending flag. Has to be called before draining the queue, so that packets appended during the drain
+	/// set the flag again.
+	/// @returns Whether the flag was set
+	bool takePending() { return m_pending.exchange(false, std::memory_order_acq_rel); }
+
+protected:
+	struct Cell {
+		/// Equal to the position of the cell while it is free, and to the position + 1 once it holds a packet
+		std::atomic< std::size_t > sequence;
+		std::uint16_t size;
+		unsigned char data[HEADER_SIZE + MAX_PACKET_SIZE];
+	};
+
+	std::unique_ptr< Cell[] > m_cells;
+	std::size_t m_mask;
+
+	/// The position the next packet is appended at. On its own cache line, as all appending threads write it.
+	alignas(64) std::atomic< std::size_t > m_appendPosition{ 0 };
+	/// The position the next packet is taken out from. Only used by the draining thread.
+	alignas(64) std::size_t m_drainPosition = 0;
+	std::atomic< bool > m_pending{ false };
+};
+
+/// A bounded list of the sessions whose TunnelQueue has packets pending. Any thread may add sessions, while a single
+/// thread takes them out. This lets the draining thread visit only the queues that have to be drained instead of
+/// those of all users.
+class PendingTunnelSessions {
+private:
+	Q_DISABLE_COPY(PendingTunnelSessions)
+
+public:
+	/// @param capacity The number of sessions the list holds, rounded up to a power of two
+	explicit PendingTunnelSessions(std::size_t capacity);
+
+	/// Adds the given session. May be called by any thread.
+	/// @returns false if the list is full
+	bool push(unsigned int session);
+
+	/// Takes out the next session, if it has been added completely. Must not be called by more than one thread at a
+	/// time.
+	/// @returns false if there is none
+	bool pop(unsigned int &session);
+
+protected:
+	struct Cell {
+		/// Same as TunnelQueue::Cell::sequence
+		std::atomic< std::size_t > sequence;
+		unsigned int session;
+	};
+
+	std::unique_ptr< Cell[] > m_cells;
+	std::size_t m_mask;
+
+	alignas(64) std::atomic< std::size_t > m_appendPosition{ 0 };
+	alignas(64) std::size_t m_drainPosition = 0;
+};
+
+#endif // MUMBLE_MURMUR_TUNNELQUEUE_H_
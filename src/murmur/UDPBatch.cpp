@@ -0,0 +1,145 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "UDPBatch.h"
+
+#ifdef Q_OS_LINUX
+
+#	include "HostAddress.h"
+
+#	include <cassert>
+#	include <cstring>
+
+namespace {
+/// The space reserved for a single datagram: 4 bytes of padding in front (used to align the payload) plus the
+/// datagram itself, rounded up to a multiple of 8.
+constexpr std::size_t slotStride() {
+	return (Mumble::Protocol::MAX_UDP_PACKET_SIZE + 8 + 7) & ~static_cast< std::size_t >(7);
+}
+
+socklen_t addressLength(const sockaddr_storage &address) {
+	return static_cast< socklen_t >((address.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6)
+																	 : sizeof(struct sockaddr_in));
+}
+} // namespace
+
+bool setUDPPacketInfo(struct msghdr &msg, const sockaddr_storage &destination, const HostAddress &localAddress) {
+	memset(msg.msg_control, 0, UDP_PKTINFO_SPACE);
+	msg.msg_controllen =
+		CMSG_SPACE((destination.ss_family == AF_INET6) ? sizeof(struct in6_pktinfo) : sizeof(struct in_pktinfo));
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (destination.ss_family == AF_INET6) {
+		cmsg->cmsg_level            = IPPROTO_IPV6;
+		cmsg->cmsg_type             = IPV6_PKTINFO;
+		cmsg->cmsg_len              = CMSG_LEN(sizeof(struct in6_pktinfo));
+		struct in6_pktinfo *pktinfo = reinterpret_cast< struct in6_pktinfo * >(CMSG_DATA(cmsg));
+		memcpy(&pktinfo->ipi6_addr.s6_addr[0], localAddress.getByteRepresentation().data(),
+			   sizeof(pktinfo->ipi6_addr.s6_addr));
+	} else {
+		if (localAddress.isV6()) {
+			return false;
+		}
+
+		cmsg->cmsg_level             = IPPROTO_IP;
+		cmsg->cmsg_type              = IP_PKTINFO;
+		cmsg->cmsg_len               = CMSG_LEN(sizeof(struct in_pktinfo));
+		struct in_pktinfo *pktinfo   = reinterpret_cast< struct in_pktinfo * >(CMSG_DATA(cmsg));
+		pktinfo->ipi_spec_dst.s_addr = localAddress.toIPv4();
+	}
+
+	return true;
+}
+
+
+UDPReceiveBatch::UDPReceiveBatch(std::size_t capacity)
+	: m_stride(slotStride()), m_buffer(new unsigned char[capacity * slotStride()]), m_headers(capacity),
+	  m_iovecs(capacity), m_addresses(capacity), m_control(capacity * UDP_PKTINFO_SPACE) {
+	assert(capacity > 0 && capacity <= UDP_MAX_BATCH_SIZE);
+}
+
+int UDPReceiveBatch::receive(int sock) {
+	// recvmmsg overwrites some of the fields and the previous batch's content might have been modified in order
+	// to send replies, so the headers have to be set up from scratch every time.
+	for (std::size_t i = 0; i < m_headers.size(); ++i) {
+		m_iovecs[i].iov_base = data(i);
+		m_iovecs[i].iov_len  = Mumble::Protocol::MAX_UDP_PACKET_SIZE;
+
+		struct msghdr &msg = m_headers[i].msg_hdr;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name       = reinterpret_cast< struct sockaddr * >(&m_addresses[i]);
+		msg.msg_namelen    = sizeof(sockaddr_storage);
+		msg.msg_iov        = &m_iovecs[i];
+		msg.msg_iovlen     = 1;
+		msg.msg_control    = &m_control[i * UDP_PKTINFO_SPACE];
+		msg.msg_controllen = UDP_PKTINFO_SPACE;
+
+		m_headers[i].msg_len = 0;
+	}
+
+	// MSG_WAITFORONE: block for the first datagram only and then return whatever else is already queued
+	return ::recvmmsg(sock, m_headers.data(), static_cast< unsigned int >(m_headers.size()),
+					  MSG_WAITFORONE | MSG_TRUNC, nullptr);
+}
+
+
+UDPSendBatch::UDPSendBatch(std::size_t capacity)
+	: m_stride(slotStride()), m_buffer(new unsigned char[capacity * slotStride()]), m_headers(capacity),
+	  m_iovecs(capacity), m_addresses(capacity), m_sockets(capacity), m_control(capacity * UDP_PKTINFO_SPACE) {
+	assert(capacity > 0 && capacity <= UDP_MAX_BATCH_SIZE);
+}
+
+bool UDPSendBatch::commit(int sock, std::size_t length, const sockaddr_storage &destination,
+						  const HostAddress &localAddress) {
+	assert(length <= Mumble::Protocol::MAX_UDP_PACKET_SIZE);
+
+	m_addresses[m_size] = destination;
+	m_sockets[m_size]   = sock;
+
+	m_iovecs[m_size].iov_base = nextBuffer();
+	m_iovecs[m_size].iov_len  = length;
+
+	struct msghdr &msg = m_headers[m_size].msg_hdr;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name    = reinterpret_cast< struct sockaddr * >(&m_addresses[m_size]);
+	msg.msg_namelen = addressLength(destination);
+	msg.msg_iov     = &m_iovecs[m_size];
+	msg.msg_iovlen  = 1;
+	msg.msg_control = &m_control[m_size * UDP_PKTINFO_SPACE];
+
+	if (!setUDPPacketInfo(msg, destination, localAddress)) {
+		return false;
+	}
+
+	++m_size;
+
+	if (m_size == m_headers.size()) {
+		flush();
+	}
+
+	return true;
+}
+
+void UDPSendBatch::flush() {
+	std::size_t begin = 0;
+	while (begin < m_size) {
+		// Consecutive datagrams for the same socket are sent with one sendmmsg call
+		std::size_t end = begin + 1;
+		while (end < m_size && m_sockets[end] == m_sockets[begin]) {
+			++end;
+		}
+
+		while (begin < end) {
+			int sent = ::sendmmsg(m_sockets[begin], &m_headers[begin], static_cast< unsigned int >(end - begin), 0);
+
+			// If the very first datagram could not be sent, we skip it just as a failed sendmsg would be ignored.
+			begin += (sent > 0) ? static_cast< std::size_t >(sent) : 1;
+		}
+	}
+
+	m_size = 0;
+}
+
+#endif
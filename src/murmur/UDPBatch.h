@@ -0,0 +1,123 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_UDPBATCH_H_
+#define MUMBLE_MURMUR_UDPBATCH_H_
+
+#include <QtCore/QtGlobal>
+
+#ifdef Q_OS_LINUX
+
+#	include "MumbleProtocol.h"
+
+#	include <netinet/in.h>
+#	include <sys/socket.h>
+
+#	include <algorithm>
+#	include <cstddef>
+#	include <cstdint>
+#	include <memory>
+#	include <vector>
+
+class HostAddress;
+
+/// The amount of control data required to hold either an IP_PKTINFO or an IPV6_PKTINFO message
+constexpr std::size_t UDP_PKTINFO_SPACE = CMSG_SPACE(std::max(sizeof(struct in6_pktinfo), sizeof(struct in_pktinfo)));
+
+/// The maximum amount of datagrams the kernel accepts in a single recvmmsg/sendmmsg call (UIO_MAXIOV)
+constexpr std::size_t UDP_MAX_BATCH_SIZE = 1024;
+
+/// The minimum capacity of a UDPSendBatch used for forwarding audio. The copies of a single audio packet going to
+/// different receivers are always sent as a batch (even if the udpbatchsize setting disables batching), as this
+/// reduces the amount of system calls without delaying any datagram.
+constexpr std::size_t UDP_FAN_OUT_BATCH_SIZE = 64;
+
+/// @returns The capacity of the send batches to use for the given udpbatchsize setting
+inline std::size_t udpSendBatchCapacity(unsigned int batchSize) {
+	return std::max(static_cast< std::size_t >(batchSize), UDP_FAN_OUT_BATCH_SIZE);
+}
+
+/// Sets up the control data of the given msghdr such that the datagram is sent from the given local address
+/// (using IP_PKTINFO or IPV6_PKTINFO depending on the address family of the destination). msg.msg_control has
+/// to point to at least UDP_PKTINFO_SPACE bytes.
+///
+/// @returns Whether the packet info could be set up. This fails, if the destination is an IPv4 address but the
+/// 	local address is an IPv6 one.
+bool setUDPPacketInfo(struct msghdr &msg, const sockaddr_storage &destination, const HostAddress &localAddress);
+
+/// Storage for receiving up to capacity() datagrams with a single recvmmsg call.
+///
+/// Every datagram buffer starts 4 bytes past an 8-byte boundary so that the plaintext following the 4-byte crypt
+/// header ends up properly aligned (mirroring what Server::run does for its single receive buffer).
+class UDPReceiveBatch {
+public:
+	explicit UDPReceiveBatch(std::size_t capacity);
+
+	std::size_t capacity() const { return m_headers.size(); }
+
+	/// Receives as many pending datagrams from the given socket as fit into this batch. Blocks until at least
+	/// one datagram is available.
+	///
+	/// @returns The amount of received datagrams or -1 on error
+	int receive(int sock);
+
+	unsigned char *data(std::size_t index) { return m_buffer.get() + index * m_stride + 4; }
+	/// @returns The (untruncated) length of the datagram at the given index
+	qint32 length(std::size_t index) const { return static_cast< qint32 >(m_headers[index].msg_len); }
+	sockaddr_storage &from(std::size_t index) { return m_addresses[index]; }
+	struct msghdr &header(std::size_t index) { return m_headers[index].msg_hdr; }
+
+private:
+	std::size_t m_stride;
+	std::unique_ptr< unsigned char[] > m_buffer;
+	std::vector< struct mmsghdr > m_headers;
+	std::vector< struct iovec > m_iovecs;
+	std::vector< sockaddr_storage > m_addresses;
+	std::vector< uint8_t > m_control;
+};
+
+/// Collects encrypted outgoing datagrams (possibly for different sockets) in order to send them with as few
+/// sendmmsg calls as possible.
+///
+/// Usage: encrypt the datagram into nextBuffer(), then queue it via commit(). The batch is flushed automatically
+/// once it is full and has to be flushed explicitly once the caller is done queuing packets.
+class UDPSendBatch {
+public:
+	explicit UDPSendBatch(std::size_t capacity);
+
+	std::size_t capacity() const { return m_headers.size(); }
+	std::size_t size() const { return m_size; }
+	bool isEmpty() const { return m_size == 0; }
+
+	/// @returns The buffer the next datagram has to be written into. It can hold up to
+	/// 	Mumble::Protocol::MAX_UDP_PACKET_SIZE bytes.
+	unsigned char *nextBuffer() { return m_buffer.get() + m_size * m_stride + 4; }
+
+	/// Queues the datagram that has previously been written into nextBuffer()
+	///
+	/// @param sock The socket to send the datagram on
+	/// @param length The length of the datagram
+	/// @param destination The address the datagram is to be sent to
+	/// @param localAddress The local address the datagram is to be sent from
+	/// @returns Whether the datagram has been queued
+	bool commit(int sock, std::size_t length, const sockaddr_storage &destination, const HostAddress &localAddress);
+
+	/// Sends all queued datagrams
+	void flush();
+
+private:
+	std::size_t m_stride;
+	std::size_t m_size = 0;
+	std::unique_ptr< unsigned char[] > m_buffer;
+	std::vector< struct mmsghdr > m_headers;
+	std::vector< struct iovec > m_iovecs;
+	std::vector< sockaddr_storage > m_addresses;
+	std::vector< int > m_sockets;
+	std::vector< uint8_t > m_control;
+};
+
+#endif
+
+#endif // MUMBLE_MURMUR_UDPBATCH_H_
@@ -0,0 +1,217 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "VoiceCryptState.h"
+
+#include "crypto/CryptographicRandom.h"
+
+#include <QtCore/QtEndian>
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+/// Computes the IV that is the given amount of packets after base. IVs are little-endian 128-bit counters.
+void advanceIV(const unsigned char *base, std::uint64_t packets, unsigned char *iv) {
+	const std::uint64_t low = qFromLittleEndian< quint64 >(base);
+	std::uint64_t high      = qFromLittleEndian< quint64 >(base + sizeof(quint64));
+
+	const std::uint64_t sum = low + packets;
+	if (sum < low) {
+		++high;
+	}
+
+	qToLittleEndian< quint64 >(sum, iv);
+	qToLittleEndian< quint64 >(high, iv + sizeof(quint64));
+}
+
+/// Adds delta to counter, but doesn't let the counter drop below zero
+void addClamped(std::atomic< unsigned int > &counter, int delta) {
+	// Only the thread holding the decrypting flag ever modifies the counter, so there is no need for a CAS loop
+	const unsigned int value = counter.load(std::memory_order_relaxed);
+
+	if (delta > 0) {
+		counter.store(value + static_cast< unsigned int >(delta), std::memory_order_relaxed);
+	} else if (static_cast< int >(value) > std::abs(delta)) {
+		counter.store(value - static_cast< unsigned int >(std::abs(delta)), std::memory_order_relaxed);
+	}
+}
+} // namespace
+
+VoiceCryptState::VoiceCryptState() {
+	for (std::atomic< std::uint64_t > &word : m_resyncIV) {
+		word.store(0, std::memory_order_relaxed);
+	}
+}
+
+VoiceCryptState::~VoiceCryptState() = default;
+
+bool VoiceCryptState::isValid() const {
+	return m_current.load(std::memory_order_relaxed) != nullptr;
+}
+
+void VoiceCryptState::genKey() {
+	std::unique_ptr< KeyGeneration > generation = std::make_unique< KeyGeneration >();
+
+	CryptographicRandom::fillBuffer(generation->rawKey, AES_KEY_SIZE_BYTES);
+	CryptographicRandom::fillBuffer(generation->encryptIV, AES_BLOCK_SIZE);
+	CryptographicRandom::fillBuffer(generation->decryptIV, AES_BLOCK_SIZE);
+	generation->firstPacket    = m_packetCounter.load(std::memory_order_relaxed);
+	generation->resyncSequence = m_resyncSequence.load(std::memory_order_relaxed);
+
+	m_current.store(generation.get(), std::memory_order_release);
+	m_generations.push_back(std::move(generation));
+}
+
+std::string VoiceCryptState::getRawKey() const {
+	const KeyGeneration *generation = m_current.load(std::memory_order_relaxed);
+	if (!generation) {
+		return std::string();
+	}
+
+	return std::string(reinterpret_cast< const char * >(generation->rawKey), AES_KEY_SIZE_BYTES);
+}
+
+std::string VoiceCryptState::getEncryptIV() const {
+	const KeyGeneration *generation = m_current.load(std::memory_order_relaxed);
+	if (!generation) {
+		return std::string();
+	}
+
+	unsigned char iv[AES_BLOCK_SIZE];
+	advanceIV(generation->encryptIV, m_packetCounter.load(std::memory_order_relaxed) - generation->firstPacket, iv);
+
+	return std::string(reinterpret_cast< const char * >(iv), AES_BLOCK_SIZE);
+}
+
+std::string VoiceCryptState::getDecryptIV() const {
+	const KeyGeneration *generation = m_current.load(std::memory_order_relaxed);
+	if (!generation) {
+		return std::string();
+	}
+
+	return std::string(reinterpret_cast< const char * >(generation->decryptIV), AES_BLOCK_SIZE);
+}
+
+bool VoiceCryptState::setDecryptIV(const std::string &iv) {
+	if (iv.length() != AES_BLOCK_SIZE) {
+		return false;
+	}
+
+	std::uint64_t words[RESYNC_IV_WORDS];
+	memcpy(words, iv.data(), AES_BLOCK_SIZE);
+
+	// There is only a single writer (the main thread), so the sequence can't change in between
+	m_resyncSequence.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	for (std::size_t i = 0; i < RESYNC_IV_WORDS; ++i) {
+		m_resyncIV[i].store(words[i], std::memory_order_relaxed);
+	}
+
+	m_resyncSequence.fetch_add(1, std::memory_order_release);
+
+	return true;
+}
+
+bool VoiceCryptState::encrypt(unsigned int slot, const unsigned char *source, unsigned char *dst,
+							  unsigned int plain_length) {
+	assert(slot < SLOT_COUNT);
+
+	const KeyGeneration *generation = m_current.load(std::memory_order_acquire);
+	if (!generation) {
+		return false;
+	}
+
+	std::unique_ptr< EncryptSlot > &encryptSlot = m_encryptSlots[slot];
+	if (!encryptSlot) {
+		encryptSlot = std::make_unique< EncryptSlot >();
+	}
+	if (encryptSlot->generation != generation) {
+		encryptSlot->encryptor.setKey(generation->rawKey);
+		encryptSlot->generation = generation;
+	}
+
+	// The counter is shared by all generations, but as it never repeats a value, neither does any generation's IV
+	const std::uint64_t packet = m_packetCounter.fetch_add(1, std::memory_order_relaxed) + 1;
+
+	unsigned char iv[AES_BLOCK_SIZE];
+	advanceIV(generation->encryptIV, packet - generation->firstPacket, iv);
+
+	return encryptSlot->encryptor.encrypt(source, dst, plain_length, iv);
+}
+
+bool VoiceCryptState::decrypt(const unsigned char *source, unsigned char *dst, unsigned int crypted_length,
+							  bool &requestResync) {
+	requestResync = false;
+
+	if (m_decrypting.exchange(true, std::memory_order_acquire)) {
+		// Another thread is decrypting a packet of this user right now
+		return false;
+	}
+
+	int lost      = 0;
+	int late      = 0;
+	const bool ok = updateDecryptor() && m_decryptor.decrypt(source, dst, crypted_length, lost, late);
+
+	if (ok) {
+		recordGoodPacket(lost, late);
+	} else if (m_lastGood.elapsed() > 5000000ULL && m_lastRequest.elapsed() > 5000000ULL) {
+		m_lastRequest.restart();
+		requestResync = true;
+	}
+
+	m_decrypting.store(false, std::memory_order_release);
+
+	return ok;
+}
+
+bool VoiceCryptState::updateDecryptor() {
+	const KeyGeneration *generation = m_current.load(std::memory_order_acquire);
+	if (!generation) {
+		return false;
+	}
+
+	if (generation != m_decryptGeneration) {
+		m_decryptor.setKey(generation->rawKey);
+		m_decryptor.setIV(generation->decryptIV);
+		m_decryptGeneration = generation;
+		m_appliedResync     = generation->resyncSequence;
+	}
+
+	const std::uint32_t sequence = m_resyncSequence.load(std::memory_order_acquire);
+	if (sequence == m_appliedResync || (sequence & 1) != 0) {
+		// Either there is no new IV or the main thread is writing it right now (in which case the next packet will
+		// pick it up)
+		return true;
+	}
+
+	std::uint64_t words[RESYNC_IV_WORDS];
+	for (std::size_t i = 0; i < RESYNC_IV_WORDS; ++i) {
+		words[i] = m_resyncIV[i].load(std::memory_order_relaxed);
+	}
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (m_resyncSequence.load(std::memory_order_relaxed) != sequence) {
+		return true;
+	}
+
+	unsigned char iv[AES_BLOCK_SIZE];
+	memcpy(iv, words, AES_BLOCK_SIZE);
+
+	m_decryptor.setIV(iv);
+	m_appliedResync = sequence;
+
+	return true;
+}
+
+void VoiceCryptState::recordGoodPacket(int lost, int late) {
+	uiGood.store(uiGood.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	addClamped(uiLate, late);
+	addClamped(uiLost, lost);
+
+	m_lastGood.restart();
+}
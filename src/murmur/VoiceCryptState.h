@@ -0,0 +1,138 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_VOICECRYPTSTATE_H_
+#define MUMBLE_MURMUR_VOICECRYPTSTATE_H_
+
+#include "Timer.h"
+#include "crypto/CryptStateOCB2.h"
+
+#include <QtCore/QtGlobal>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// The UDP crypt state of a ServerUser. In contrast to CryptStateOCB2, it can be used by multiple threads at once
+/// without any locking:
+///
+/// - Every thread encrypting packets uses its own slot (the index of a voice thread or MAIN_THREAD_SLOT), which holds
+///   its own copy of the encrypting half of the state. The IVs are handed out by a single atomic counter.
+/// - The decrypting half is only ever used by the voice thread receiving the user's packets. If another thread tries
+///   to decrypt at the same time (which can only happen while the user's UDP endpoint is being bound), its packet
+///   is rejected instead of waiting.
+/// - Keys and IVs are only set by the main thread, which hands them over to the voice threads: a new key is
+///   published as a new (immutable) generation and a new decrypt IV via a sequence counter.
+class VoiceCryptState {
+private:
+	Q_DISABLE_COPY(VoiceCryptState)
+public:
+	/// The maximum number of voice threads that may encrypt (using their index as the slot)
+	static constexpr unsigned int MAX_VOICE_THREADS = 64;
+	/// The slot to be used by the main thread
+	static constexpr unsigned int MAIN_THREAD_SLOT = MAX_VOICE_THREADS;
+	static constexpr unsigned int SLOT_COUNT       = MAX_VOICE_THREADS + 1;
+
+	/// Updated by the thread decrypting the user's packets
+	std::atomic< unsigned int > uiGood{ 0 };
+	std::atomic< unsigned int > uiLate{ 0 };
+	std::atomic< unsigned int > uiLost{ 0 };
+	/// Only accessed by the main thread
+	unsigned int uiResync = 0;
+
+	/// As reported by the client. Only accessed by the main thread.
+	unsigned int uiRemoteGood   = 0;
+	unsigned int uiRemoteLate   = 0;
+	unsigned int uiRemoteLost   = 0;
+	unsigned int uiRemoteResync = 0;
+
+	VoiceCryptState();
+	~VoiceCryptState();
+
+	// The following functions must only be called by the main thread
+
+	bool isValid() const;
+	/// Generates a new key as well as new IVs for both directions and hands them over to the voice threads
+	void genKey();
+	std::string getRawKey() const;
+	/// @returns The IV of the packet sent most recently
+	std::string getEncryptIV() const;
+	/// @returns The IV the client starts with when using the key generated by genKey
+	std::string getDecryptIV() const;
+	/// Hands the given IV over to the thread decrypting the user's packets, which will use it from the next packet on
+	bool setDecryptIV(const std::string &iv);
+
+	// The following functions may be called by any voice thread (and the main thread)
+
+	/// Encrypts a packet the same way CryptStateOCB2::encrypt does.
+	///
+	/// @param slot The slot of the calling thread. Different threads must never use the same slot.
+	bool encrypt(unsigned int slot, const unsigned char *source, unsigned char *dst, unsigned int plain_length);
+	/// Decrypts a packet the same way CryptStateOCB2::decrypt does.
+	///
+	/// @param[out] requestResync Set to true if no packet could be decrypted for a while, which means that the
+	/// 	client should be asked to resync its IV. Never set more than once in a few seconds.
+	bool decrypt(const unsigned char *source, unsigned char *dst, unsigned int crypted_length, bool &requestResync);
+
+protected:
+	/// A key and the IVs it started with. Never modified after having been published.
+	struct KeyGeneration {
+		unsigned char rawKey[AES_KEY_SIZE_BYTES];
+		unsigned char encryptIV[AES_BLOCK_SIZE];
+		unsigned char decryptIV[AES_BLOCK_SIZE];
+		/// The value of m_packetCounter at the time the generation was created
+		std::uint64_t firstPacket;
+		/// The value of m_resyncSequence at the time the generation was created. IVs handed over before that belong
+		/// to the previous key.
+		std::uint32_t resyncSequence;
+	};
+
+	struct EncryptSlot {
+		CryptStateOCB2Encryptor encryptor;
+		/// The generation whose key the encryptor has been set up with
+		const KeyGeneration *generation = nullptr;
+	};
+
+	/// The current generation (or nullptr if there is no key yet)
+	std::atomic< const KeyGeneration * > m_current{ nullptr };
+	/// All generations ever created. They are kept alive until the state gets destroyed, as other threads may still
+	/// use an older one (genKey is only called once per connection in practice). Only accessed by the main thread.
+	std::vector< std::unique_ptr< const KeyGeneration > > m_generations;
+	/// Counts the packets encrypted so far (using any key). Every packet uses a different value, which is added to
+	/// the initial encrypt IV of the generation to obtain the packet's IV.
+	std::atomic< std::uint64_t > m_packetCounter{ 0 };
+	/// Every slot is only accessed by the thread using it
+	std::array< std::unique_ptr< EncryptSlot >, SLOT_COUNT > m_encryptSlots;
+
+	/// Whether a thread is currently decrypting. Everything below up to (and excluding) m_resyncSequence may only
+	/// be accessed while this flag is held.
+	std::atomic< bool > m_decrypting{ false };
+	CryptStateOCB2Decryptor m_decryptor;
+	const KeyGeneration *m_decryptGeneration = nullptr;
+	std::uint32_t m_appliedResync            = 0;
+	Timer m_lastGood;
+	Timer m_lastRequest;
+
+	static constexpr std::size_t RESYNC_IV_WORDS = AES_BLOCK_SIZE / sizeof(std::uint64_t);
+
+	/// A sequence lock protecting m_resyncIV: odd while the main thread is writing, incremented by two for every
+	/// new IV
+	std::atomic< std::uint32_t > m_resyncSequence{ 0 };
+	std::array< std::atomic< std::uint64_t >, RESYNC_IV_WORDS > m_resyncIV;
+
+	/// Adopts the key and IV handed over by the main thread, if there are new ones. The decrypting flag has to be
+	/// held.
+	///
+	/// @returns Whether there is a key at all
+	bool updateDecryptor();
+	/// Updates the statistics after a packet has been decrypted successfully. The decrypting flag has to be held.
+	void recordGoodPacket(int lost, int late);
+};
+
+#endif // MUMBLE_MURMUR_VOICECRYPTSTATE_H_
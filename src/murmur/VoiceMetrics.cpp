@@ -0,0 +1,103 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "VoiceMetrics.h"
+
+namespace {
+struct CounterDescription {
+	const char *name;
+	const char *help;
+};
+
+constexpr std::array< CounterDescription, static_cast< std::size_t >(VoiceCounter::Count) > COUNTERS = { {
+	{ "murmur_udp_received_packets_total", "UDP datagrams received" },
+	{ "murmur_udp_received_bytes_total", "Bytes received via UDP (payload only)" },
+	{ "murmur_udp_sent_packets_total", "UDP datagrams sent" },
+	{ "murmur_udp_sent_bytes_total", "Bytes sent via UDP (payload only)" },
+	{ "murmur_udp_decrypt_failures_total",
+	  "UDP datagrams that could not be decrypted or associated with a user" },
+	{ "murmur_voice_bandwidth_suppressed_total",
+	  "Audio packets dropped because their sender exceeded the bandwidth limit" },
+	{ "murmur_tcp_tunnel_received_packets_total", "Voice packets clients tunneled through TCP" },
+	{ "murmur_tcp_tunnel_sent_packets_total",
+	  "Packets sent through TCP because the receiver could not be reached via UDP" },
+	{ "murmur_tcp_tunnel_dropped_packets_total",
+	  "Packets to be sent through TCP that were dropped because the receiver's queue was full" },
+	{ "murmur_udp_token_bindings_total", "UDP endpoints bound by the token prefixed to the client's packets" },
+	{ "murmur_udp_trial_bindings_total",
+	  "UDP endpoints bound by trying the keys of all users connected from the peer's address" },
+	{ "murmur_udp_trial_decryptions_total",
+	  "Decryptions attempted to find the user a packet of an unknown peer belongs to" },
+} };
+
+template< typename Histogram >
+void appendHistogram(std::string &out, const char *name, const char *help, double scale,
+					 const std::vector< std::pair< int, VoiceMetricsSnapshot > > &servers,
+					 HistogramSnapshot VoiceMetricsSnapshot::*member) {
+	Prometheus::appendHeader(out, name, help, "histogram");
+
+	for (const std::pair< int, VoiceMetricsSnapshot > &server : servers) {
+		const HistogramSnapshot &histogram = server.second.*member;
+
+		std::uint64_t cumulative = 0;
+		// The last bucket also holds all values exceeding the histogram's range, so it is reported as +Inf
+		for (unsigned int i = 0; i + 1 < Histogram::BUCKET_COUNT; ++i) {
+			cumulative += i < histogram.buckets.size() ? histogram.buckets[i] : 0;
+
+			Prometheus::appendSample(out, name, "_bucket", server.first,
+									 Prometheus::formatValue(Histogram::bucketUpperBound(i), scale).c_str(),
+									 std::to_string(cumulative));
+		}
+		Prometheus::appendSample(out, name, "_bucket", server.first, "+Inf", std::to_string(histogram.count()));
+
+		Prometheus::appendSample(out, name, "_sum", server.first, nullptr,
+								 Prometheus::formatValue(histogram.sum, scale));
+		Prometheus::appendSample(out, name, "_count", server.first, nullptr, std::to_string(histogram.count()));
+	}
+}
+} // namespace
+
+VoiceMetrics::VoiceMetrics(unsigned int slotCount)
+	: m_slots(std::make_unique< VoiceThreadMetrics[] >(slotCount)), m_slotCount(slotCount) {
+}
+
+VoiceMetricsSnapshot VoiceMetrics::snapshot() const {
+	VoiceMetricsSnapshot snapshot;
+
+	for (unsigned int slot = 0; slot < m_slotCount; ++slot) {
+		const VoiceThreadMetrics &metrics = m_slots[slot];
+
+		for (std::size_t i = 0; i < snapshot.counters.size(); ++i) {
+			snapshot.counters[i] += metrics.counters[i].value();
+		}
+		metrics.receivers.addTo(snapshot.receivers);
+		metrics.latency.addTo(snapshot.latency);
+	}
+
+	return snapshot;
+}
+
+std::string VoiceMetrics::toPrometheus(const std::vector< std::pair< int, VoiceMetricsSnapshot > > &servers) {
+	std::string out;
+
+	for (std::size_t i = 0; i < COUNTERS.size(); ++i) {
+		Prometheus::appendHeader(out, COUNTERS[i].name, COUNTERS[i].help, "counter");
+
+		for (const std::pair< int, VoiceMetricsSnapshot > &server : servers) {
+			Prometheus::appendSample(out, COUNTERS[i].name, "", server.first, nullptr,
+									 std::to_string(server.second.counters[i]));
+		}
+	}
+
+	appendHistogram< VoiceThreadMetrics::ReceiverHistogram >(out, "murmur_voice_receivers_per_packet",
+															 "Number of users an audio packet has been forwarded to",
+															 1.0, servers, &VoiceMetricsSnapshot::receivers);
+	appendHistogram< VoiceThreadMetrics::LatencyHistogram >(
+		out, "murmur_voice_processing_seconds",
+		"Time from receiving an audio packet to having sent the last copy of it", 1000000.0, servers,
+		&VoiceMetricsSnapshot::latency);
+
+	return out;
+}
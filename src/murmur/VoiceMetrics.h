@@ -0,0 +1,92 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_VOICEMETRICS_H_
+#define MUMBLE_MURMUR_VOICEMETRICS_H_
+
+#include "Metrics.h"
+
+#include <QtCore/QtGlobal>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// The counters kept for every virtual server
+enum class VoiceCounter {
+	UDPPacketsReceived,
+	UDPBytesReceived,
+	UDPPacketsSent,
+	UDPBytesSent,
+	/// Received datagrams that couldn't be decrypted (or associated with a user)
+	DecryptFailures,
+	/// Audio packets dropped because their sender exceeded the bandwidth limit (see BandwidthRecord::addFrame)
+	BandwidthSuppressed,
+	/// Voice packets (audio or pings) that clients tunneled through TCP
+	TCPTunnelPacketsReceived,
+	/// Packets sent through the TCP connection because the receiver couldn't be reached via UDP
+	TCPTunnelPacketsSent,
+	/// Packets to be sent through the TCP connection that were dropped because the receiver's TunnelQueue was full
+	TCPTunnelPacketsDropped,
+	/// UDP endpoints bound by the token prefixed to the client's packets
+	UDPTokenBindings,
+	/// UDP endpoints bound by trying the keys of all users connected from the peer's address (which is what happens
+	/// for clients that don't support tokens)
+	UDPTrialBindings,
+	/// Decryptions attempted in order to find the user a packet of an unknown peer belongs to
+	UDPTrialDecryptions,
+	Count
+};
+
+/// The metrics recorded by a single thread. Aligned to a cache line, so that threads never write to the same one.
+struct alignas(64) VoiceThreadMetrics {
+	/// Receivers per audio packet
+	using ReceiverHistogram = MetricsHistogram< 16 >;
+	/// Time in microseconds from receiving an audio packet to having sent the last copy of it
+	using LatencyHistogram = MetricsHistogram< 24 >;
+
+	std::array< MetricsCounter, static_cast< std::size_t >(VoiceCounter::Count) > counters;
+	ReceiverHistogram receivers;
+	LatencyHistogram latency;
+
+	void add(VoiceCounter counter, std::uint64_t amount = 1) {
+		counters[static_cast< std::size_t >(counter)].add(amount);
+	}
+};
+
+/// The metrics of a virtual server summed up over all threads
+struct VoiceMetricsSnapshot {
+	std::array< std::uint64_t, static_cast< std::size_t >(VoiceCounter::Count) > counters = {};
+	HistogramSnapshot receivers;
+	HistogramSnapshot latency;
+};
+
+/// The metrics about the voice processing of a virtual server. Every thread records into its own slot without any
+/// synchronisation (the slots are numbered the same way as the ones of VoiceCryptState), while snapshot may be called
+/// by any thread at any time.
+class VoiceMetrics {
+private:
+	Q_DISABLE_COPY(VoiceMetrics)
+public:
+	explicit VoiceMetrics(unsigned int slotCount);
+
+	VoiceThreadMetrics &forSlot(unsigned int slot) { return m_slots[slot]; }
+
+	VoiceMetricsSnapshot snapshot() const;
+
+	/// Renders the given snapshots in the Prometheus text exposition format. Every metric is labelled with the ID
+	/// of the virtual server it belongs to.
+	static std::string toPrometheus(const std::vector< std::pair< int, VoiceMetricsSnapshot > > &servers);
+
+protected:
+	std::unique_ptr< VoiceThreadMetrics[] > m_slots;
+	unsigned int m_slotCount;
+};
+
+#endif // MUMBLE_MURMUR_VOICEMETRICS_H_
@@ -0,0 +1,26 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "VoiceWorker.h"
+
+#include "Server.h"
+
+#include <tracy/Tracy.hpp>
+
+#include <string>
+
+VoiceWorker::VoiceWorker(Server &server, unsigned int index) : m_server(server), m_index(index) {
+	m_state.index = index;
+#ifdef Q_OS_LINUX
+	m_state.udpSendBatch = std::make_unique< UDPSendBatch >(udpSendBatchCapacity(m_server.iUDPBatchSize));
+#endif
+}
+
+void VoiceWorker::run() {
+	const std::string threadName = "Audio " + std::to_string(m_index);
+	tracy::SetThreadName(threadName.c_str());
+
+	m_server.runVoiceLoop(m_index, m_state);
+}
@@ -0,0 +1,54 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_VOICEWORKER_H_
+#define MUMBLE_MURMUR_VOICEWORKER_H_
+
+#include "AudioReceiverBuffer.h"
+#include "MumbleProtocol.h"
+#include "UDPBatch.h"
+
+#include <QtCore/QThread>
+
+#include <memory>
+
+class Server;
+
+/// The state that is private to a single thread processing incoming UDP packets. Every such thread (the Server's
+/// own voice thread as well as every additional VoiceWorker) has to use its own instance.
+struct VoiceWorkerState {
+	/// The index of the thread using this state (0 for the Server's own voice thread). Also selects the thread's
+	/// reader slot in the Server's RoutingTable.
+	unsigned int index = 0;
+	Mumble::Protocol::UDPDecoder< Mumble::Protocol::Role::Server > udpDecoder;
+	Mumble::Protocol::UDPPingEncoder< Mumble::Protocol::Role::Server > udpPingEncoder;
+	Mumble::Protocol::UDPAudioEncoder< Mumble::Protocol::Role::Server > udpAudioEncoder;
+	AudioReceiverBuffer udpAudioReceivers;
+#ifdef Q_OS_LINUX
+	/// Outgoing datagrams produced by this thread (the copies of an audio packet are always sent as a batch)
+	std::unique_ptr< UDPSendBatch > udpSendBatch;
+#endif
+};
+
+/// An additional voice thread of a Server (see the voicethreads setting). Every worker owns one SO_REUSEPORT
+/// socket per bind address and processes the datagrams the kernel distributes onto these sockets. As the kernel
+/// hashes by the sender's address, all packets of a given client end up on the same worker.
+class VoiceWorker : public QThread {
+private:
+	Q_DISABLE_COPY(VoiceWorker)
+
+public:
+	VoiceWorker(Server &server, unsigned int index);
+
+	void run() override;
+
+protected:
+	Server &m_server;
+	/// The index of this worker. Index 0 is the Server's own voice thread.
+	unsigned int m_index;
+	VoiceWorkerState m_state;
+};
+
+#endif // MUMBLE_MURMUR_VOICEWORKER_H_
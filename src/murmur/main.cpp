@@ -7,11 +7,14 @@
 #include "License.h"
 #include "LogEmitter.h"
 #include "Meta.h"
+#include "MetricsServer.h"
 #include "SSL.h"
 #include "Server.h"
 #include "ServerDB.h"
 #include "Version.h"
 
+#include <QtCore/QMutexLocker>
+
 #include <csignal>
 #include <iostream>
 
@@ -53,6 +56,8 @@ Meta *meta = nullptr;
 static LogEmitter le;
 
 static QStringList qlErrors;
+/// Serializes writing to the log, as messages may be logged by any thread (see the controlthreads setting)
+static QMutex qmLog;
 
 static void murmurMessageOutputQString(QtMsgType type, const QString &msg) {
 #ifdef Q_OS_UNIX
@@ -81,6 +86,8 @@ static void murmurMessageOutputQString(QtMsgType type, const QString &msg) {
 	}
 #endif
 
+	QMutexLocker lock(&qmLog);
+
 	char c;
 	switch (type) {
 		case QtDebugMsg:
@@ -570,6 +577,11 @@ int main(int argc, char **argv) {
 	IceStart();
 #endif
 
+	if (Meta::mp.usMetricsPort != 0) {
+		// Owned (and thus deleted) by meta
+		new MetricsServer(meta, Meta::mp.qhaMetricsAddress, Meta::mp.usMetricsPort);
+	}
+
 	meta->getOSInfo();
 
 	qWarning("Murmur %s running on %s: %s: Booting servers", qPrintable(Version::toString(Version::get())),
@@ -0,0 +1,293 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "ACL.h"
+#include "ACLProgram.h"
+#include "Channel.h"
+#include "Group.h"
+#include "User.h"
+
+#include <cstdint>
+#include <memory>
+
+using Permissions = ChanACL::Permissions;
+
+static const Permissions DEFAULT_PERMISSIONS = ChanACL::Traverse | ChanACL::Enter | ChanACL::Speak | ChanACL::Whisper
+											   | ChanACL::TextMessage | ChanACL::Listen;
+
+static ChanACL *addACL(Channel *channel, const QString &group, Permissions allow, Permissions deny,
+					   bool applyHere = true, bool applySubs = true) {
+	ChanACL *acl    = new ChanACL(channel);
+	acl->qsGroup    = group;
+	acl->pAllow     = allow;
+	acl->pDeny      = deny;
+	acl->bApplyHere = applyHere;
+	acl->bApplySubs = applySubs;
+
+	return acl;
+}
+
+/// A user along with the properties the ACLs are evaluated for
+struct TestUser {
+	User user;
+	bool verified = false;
+	QStringList accessTokens;
+
+	TestUser(int id, unsigned int session, Channel *channel) {
+		user.iId       = id;
+		user.uiSession = session;
+		user.cChannel  = channel;
+	}
+
+	ACLSubject subject() const { return { &user, verified, &accessTokens }; }
+};
+
+static Permissions evaluate(const Channel *channel, const TestUser &user) {
+	return ACLProgram(channel).evaluate(user.subject());
+}
+
+class TestACLProgram : public QObject {
+	Q_OBJECT
+private slots:
+	void init();
+	void cleanup();
+
+	void defaults();
+	void denyAndInherit();
+	void rootPermissions();
+	void groups();
+	void tokensAndHashes();
+	void channelGroups();
+	void cache();
+	void invalidation();
+
+private:
+	/// root -> a -> b, root -> c
+	std::unique_ptr< Channel > root;
+	Channel *a;
+	Channel *b;
+	Channel *c;
+};
+
+void TestACLProgram::init() {
+	root = std::make_unique< Channel >(0, QLatin1String("Root"));
+	a    = new Channel(1, QLatin1String("A"), root.get());
+	b    = new Channel(2, QLatin1String("B"), a);
+	c    = new Channel(3, QLatin1String("C"), root.get());
+}
+
+void TestACLProgram::cleanup() {
+	root.reset();
+}
+
+void TestACLProgram::defaults() {
+	TestUser user(5, 1, root.get());
+
+	QCOMPARE(evaluate(root.get(), user), DEFAULT_PERMISSIONS);
+	QCOMPARE(evaluate(b, user), DEFAULT_PERMISSIONS);
+
+	TestUser superUser(0, 2, root.get());
+	QCOMPARE(evaluate(b, superUser), static_cast< Permissions >(ChanACL::All & ~(ChanACL::Speak | ChanACL::Whisper)));
+}
+
+void TestACLProgram::denyAndInherit() {
+	TestUser user(5, 1, root.get());
+
+	addACL(root.get(), QLatin1String("all"), ChanACL::MakeTempChannel, ChanACL::Whisper);
+	addACL(a, QLatin1String("all"), ChanACL::None, ChanACL::Enter, true, false);
+
+	const Permissions inherited = (DEFAULT_PERMISSIONS | ChanACL::MakeTempChannel) & ~ChanACL::Whisper;
+	QCOMPARE(evaluate(root.get(), user), inherited);
+	QCOMPARE(evaluate(a, user), inherited & ~ChanACL::Enter);
+	QCOMPARE(evaluate(b, user), inherited);
+
+	b->bInheritACL = false;
+	QCOMPARE(evaluate(b, user), DEFAULT_PERMISSIONS);
+
+	// Without Traverse, nothing below is accessible. This is the case even if the channel doesn't inherit ACLs.
+	addACL(a, QLatin1String("auth"), ChanACL::None, ChanACL::Traverse);
+	QCOMPARE(evaluate(a, user), Permissions(ChanACL::None));
+	QCOMPARE(evaluate(b, user), Permissions(ChanACL::None));
+	QCOMPARE(evaluate(c, user), inherited);
+
+	TestUser guest(-1, 2, root.get());
+	QCOMPARE(evaluate(b, guest), DEFAULT_PERMISSIONS);
+}
+
+void TestACLProgram::rootPermissions() {
+	TestUser user(5, 1, root.get());
+
+	addACL(root.get(), QLatin1String("all"), ChanACL::Kick | ChanACL::MakeChannel, ChanACL::None);
+	QCOMPARE(evaluate(root.get(), user), DEFAULT_PERMISSIONS | ChanACL::Kick | ChanACL::MakeChannel);
+	// Permissions that only apply to the root channel aren't inherited
+	QCOMPARE(evaluate(a, user), DEFAULT_PERMISSIONS | ChanACL::MakeChannel);
+
+	addACL(a, QLatin1String("all"), ChanACL::Write, ChanACL::None);
+	QVERIFY(evaluate(a, user) & ChanACL::Move);
+	QVERIFY(!(evaluate(a, user) & ChanACL::Ban));
+}
+
+void TestACLProgram::groups() {
+	TestUser member(5, 1, root.get());
+	TestUser temporary(6, 2, root.get());
+	TestUser other(7, 3, root.get());
+
+	Group *admin = new Group(root.get(), QLatin1String("admin"));
+	admin->qsAdd << 5 << 7;
+	admin->qsTemporary << -2;
+	addACL(root.get(), QLatin1String("admin"), ChanACL::Write, ChanACL::None);
+	addACL(c, QLatin1String("!admin"), ChanACL::None, ChanACL::Enter);
+
+	QVERIFY(evaluate(b, member) & ChanACL::Write);
+	QVERIFY(evaluate(b, temporary) & ChanACL::Write);
+	QVERIFY(evaluate(b, other) & ChanACL::Write);
+
+	TestUser guest(-1, 4, root.get());
+	QCOMPARE(evaluate(c, guest), DEFAULT_PERMISSIONS & ~ChanACL::Enter);
+	QCOMPARE(evaluate(c, member), Permissions(ChanACL::All & ~(ChanACL::Kick | ChanACL::Ban | ChanACL::ResetUserContent
+																| ChanACL::Register | ChanACL::SelfRegister)));
+
+	// Members can be removed in subchannels
+	Group *local = new Group(a, QLatin1String("admin"));
+	local->qsRemove << 7;
+	QVERIFY(evaluate(b, member) & ChanACL::Write);
+	QVERIFY(!(evaluate(b, other) & ChanACL::Write));
+	QVERIFY(evaluate(root.get(), other) & ChanACL::Write);
+
+	// Groups that don't inherit their members hide the ones of their parents
+	local->bInherit = false;
+	QVERIFY(!(evaluate(a, member) & ChanACL::Write));
+
+	// Groups that aren't inheritable don't apply to subchannels
+	local->bInherit     = true;
+	admin->bInheritable = false;
+	local->qsRemove     = {};
+	QVERIFY(!(evaluate(b, member) & ChanACL::Write));
+	QVERIFY(evaluate(root.get(), member) & ChanACL::Write);
+}
+
+void TestACLProgram::tokensAndHashes() {
+	TestUser user(5, 1, root.get());
+
+	addACL(root.get(), QLatin1String("#Secret"), ChanACL::MakeChannel, ChanACL::None);
+	addACL(root.get(), QLatin1String("$0123abcd"), ChanACL::LinkChannel, ChanACL::None);
+	addACL(root.get(), QLatin1String("strong"), ChanACL::MakeTempChannel, ChanACL::None);
+	addACL(root.get(), QLatin1String("!"), ChanACL::Move, ChanACL::None);
+
+	QCOMPARE(evaluate(a, user), DEFAULT_PERMISSIONS);
+
+	// Access tokens are case-insensitive
+	user.accessTokens << QLatin1String("secret");
+	user.user.qsHash = QLatin1String("0123abcd");
+	user.verified    = true;
+	QCOMPARE(evaluate(a, user),
+			 DEFAULT_PERMISSIONS | ChanACL::MakeChannel | ChanACL::LinkChannel | ChanACL::MakeTempChannel);
+}
+
+void TestACLProgram::channelGroups() {
+	TestUser inA(5, 1, a);
+	TestUser inB(6, 2, b);
+	TestUser inC(7, 3, c);
+
+	// "in" refers to the channel the permissions are evaluated for, "~in" to the channel defining the ACL
+	addACL(root.get(), QLatin1String("in"), ChanACL::MakeChannel, ChanACL::None);
+	addACL(a, QLatin1String("~in"), ChanACL::LinkChannel, ChanACL::None);
+	addACL(a, QLatin1String("~sub,0,1,1"), ChanACL::MakeTempChannel, ChanACL::None);
+	addACL(root.get(), QLatin1String("!sub,0,2"), ChanACL::None, ChanACL::Speak);
+
+	QVERIFY(evaluate(a, inA) & ChanACL::MakeChannel);
+	QVERIFY(!(evaluate(b, inA) & ChanACL::MakeChannel));
+	QVERIFY(evaluate(b, inA) & ChanACL::LinkChannel);
+	QVERIFY(!(evaluate(b, inB) & ChanACL::LinkChannel));
+
+	// Only users exactly one level below A
+	QVERIFY(!(evaluate(b, inA) & ChanACL::MakeTempChannel));
+	QVERIFY(evaluate(b, inB) & ChanACL::MakeTempChannel);
+	QVERIFY(!(evaluate(b, inC) & ChanACL::MakeTempChannel));
+
+	// Users that are at least two levels below the channel may speak
+	QVERIFY(!(evaluate(root.get(), inA) & ChanACL::Speak));
+	QVERIFY(evaluate(root.get(), inB) & ChanACL::Speak);
+	QVERIFY(!(evaluate(a, inB) & ChanACL::Speak));
+}
+
+void TestACLProgram::cache() {
+	TestUser user(5, 1, root.get());
+	PermissionCache cache;
+
+	addACL(a, QLatin1String("all"), ChanACL::MakeChannel, ChanACL::None);
+
+	QCOMPARE(cache.permissions(user.subject(), b), DEFAULT_PERMISSIONS | ChanACL::MakeChannel);
+	QCOMPARE(cache.permissions(user.subject(), b), DEFAULT_PERMISSIONS | ChanACL::MakeChannel | ChanACL::Cached);
+	QCOMPARE(cache.cachedPermissions(user.subject(), c), DEFAULT_PERMISSIONS | ChanACL::Cached);
+	QCOMPARE(cache.programCount(), std::size_t(2));
+
+	// Programs are shared by all users
+	TestUser other(6, 2, root.get());
+	QCOMPARE(cache.permissions(other.subject(), b), DEFAULT_PERMISSIONS | ChanACL::MakeChannel);
+	QCOMPARE(cache.programCount(), std::size_t(2));
+
+	// Looking up permissions doesn't change the generation, every invalidation does
+	const std::uint64_t generation = cache.generation();
+	cache.permissions(user.subject(), c);
+	QCOMPARE(cache.generation(), generation);
+
+	// Changes of a user only discard the permissions of that user
+	cache.invalidateUser(&user.user);
+	QVERIFY(!(cache.permissions(user.subject(), b) & ChanACL::Cached));
+	QVERIFY(cache.permissions(other.subject(), b) & ChanACL::Cached);
+	QCOMPARE(cache.programCount(), std::size_t(2));
+	QCOMPARE(cache.generation(), generation + 1);
+
+	cache.invalidateChannel(c);
+	QCOMPARE(cache.generation(), generation + 2);
+
+	cache.clear();
+	QCOMPARE(cache.programCount(), std::size_t(0));
+	QVERIFY(!(cache.permissions(other.subject(), b) & ChanACL::Cached));
+	QCOMPARE(cache.generation(), generation + 3);
+}
+
+void TestACLProgram::invalidation() {
+	TestUser user(5, 1, root.get());
+	PermissionCache cache;
+
+	for (const Channel *channel : { root.get(), a, b, c }) {
+		cache.permissions(user.subject(), channel);
+	}
+	QCOMPARE(cache.programCount(), std::size_t(4));
+
+	addACL(a, QLatin1String("all"), ChanACL::None, ChanACL::Speak);
+
+	const QSet< const Channel * > affected = cache.invalidateChannel(a);
+	QCOMPARE(affected, (QSet< const Channel * >{ a, b }));
+	QCOMPARE(cache.programCount(), std::size_t(2));
+
+	// Only the permissions in the subtree have to be evaluated again
+	QCOMPARE(cache.permissions(user.subject(), root.get()), DEFAULT_PERMISSIONS | ChanACL::Cached);
+	QCOMPARE(cache.permissions(user.subject(), c), DEFAULT_PERMISSIONS | ChanACL::Cached);
+	QCOMPARE(cache.permissions(user.subject(), a), DEFAULT_PERMISSIONS & ~ChanACL::Speak);
+	QCOMPARE(cache.permissions(user.subject(), b), DEFAULT_PERMISSIONS & ~ChanACL::Speak);
+
+	// Creating a group hides the groups of the same name in the parents
+	Group *group = new Group(root.get(), QLatin1String("speakers"));
+	group->qsAdd << 5;
+	addACL(root.get(), QLatin1String("speakers"), ChanACL::MuteDeafen, ChanACL::None);
+	cache.invalidateChannel(root.get());
+	QVERIFY(cache.permissions(user.subject(), c) & ChanACL::MuteDeafen);
+
+	Group *hiding    = new Group(c, QLatin1String("speakers"));
+	hiding->bInherit = false;
+	QVERIFY(cache.permissions(user.subject(), c) & ChanACL::MuteDeafen);
+	cache.invalidateChannel(c);
+	QVERIFY(!(cache.permissions(user.subject(), c) & ChanACL::MuteDeafen));
+	QVERIFY(cache.permissions(user.subject(), root.get()) & ChanACL::MuteDeafen);
+}
+
+QTEST_MAIN(TestACLProgram)
+#include "TestACLProgram.moc"
@@ -0,0 +1,133 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "AuthPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+class TestAuthPool : public QObject {
+	Q_OBJECT
+private slots:
+	void results();
+	void timeout();
+	void limit();
+	void workerThreads();
+};
+
+void TestAuthPool::results() {
+	AuthPool pool(nullptr, 2, 0, 10000);
+
+	std::vector< int > ids;
+	for (int i = 0; i < 10; ++i) {
+		QVERIFY(pool.submit(
+			[i]() {
+				AuthResult result;
+				result.id = i;
+				return result;
+			},
+			[&ids](const AuthResult &result) {
+				// Delivered to the pool's thread
+				QCOMPARE(QThread::currentThread(), QCoreApplication::instance()->thread());
+				ids.push_back(result.id);
+			}));
+	}
+
+	QTRY_COMPARE(ids.size(), std::size_t(10));
+	QCOMPARE(pool.pending(), 0U);
+
+	std::sort(ids.begin(), ids.end());
+	for (int i = 0; i < 10; ++i) {
+		QCOMPARE(ids[static_cast< std::size_t >(i)], i);
+	}
+}
+
+void TestAuthPool::timeout() {
+	AuthPool pool(nullptr, 1, 0, 100);
+
+	QSemaphore release;
+	std::vector< int > ids;
+
+	// Blocks the only thread, so that the second attempt times out while waiting for it
+	for (int i = 0; i < 2; ++i) {
+		QVERIFY(pool.submit(
+			[&release]() {
+				release.acquire();
+				AuthResult result;
+				result.id = 1;
+				return result;
+			},
+			[&ids](const AuthResult &result) { ids.push_back(result.id); }));
+	}
+
+	QTRY_COMPARE(ids.size(), std::size_t(2));
+	QCOMPARE(ids[0], -3);
+	QCOMPARE(ids[1], -3);
+	QCOMPARE(pool.pending(), 0U);
+
+	// The late result of the first attempt is discarded and the second one is skipped
+	release.release(2);
+	QTest::qWait(50);
+	QCOMPARE(ids.size(), std::size_t(2));
+}
+
+void TestAuthPool::limit() {
+	AuthPool pool(nullptr, 1, 2, 10000);
+
+	QSemaphore release;
+	int completed = 0;
+
+	const AuthPool::Work work = [&release]() {
+		release.acquire();
+		return AuthResult();
+	};
+	const AuthPool::Callback done = [&completed](const AuthResult &) { ++completed; };
+
+	QVERIFY(pool.submit(work, done));
+	QVERIFY(pool.submit(work, done));
+	QVERIFY(!pool.submit(work, done));
+	QCOMPARE(pool.pending(), 2U);
+
+	release.release(2);
+	QTRY_COMPARE(completed, 2);
+
+	QVERIFY(pool.submit(work, done));
+	release.release(1);
+	QTRY_COMPARE(completed, 3);
+}
+
+void TestAuthPool::workerThreads() {
+	std::atomic< int > cleanups{ 0 };
+	Server *const server = reinterpret_cast< Server * >(0x1);
+
+	{
+		AuthPool pool(server, 3, 0, 10000, [&cleanups]() { ++cleanups; });
+
+		bool done = false;
+		QVERIFY(pool.submit(
+			[server]() {
+				AuthResult result;
+				result.id = AuthPool::currentServer() == server ? 1 : 0;
+				return result;
+			},
+			[&done](const AuthResult &result) {
+				QCOMPARE(result.id, 1);
+				done = true;
+			}));
+
+		QTRY_VERIFY(done);
+		QCOMPARE(AuthPool::currentServer(), nullptr);
+	}
+
+	// Every thread cleans up once it has been stopped
+	QCOMPARE(cleanups.load(), 3);
+}
+
+QTEST_MAIN(TestAuthPool)
+#include "TestAuthPool.moc"
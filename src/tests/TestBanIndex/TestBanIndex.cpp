@@ -0,0 +1,178 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtNetwork/QHostAddress>
+#include <QtTest>
+
+#include "BanIndex.h"
+
+#include <random>
+
+static Ban makeBan(const QString &address, int prefixLength, unsigned int duration = 0) {
+	const QHostAddress qha(address);
+
+	Ban ban;
+	ban.haAddress = HostAddress(qha);
+	// IPv4 addresses are stored as IPv4-mapped IPv6 addresses
+	ban.iMask     = qha.protocol() == QAbstractSocket::IPv4Protocol ? 96 + prefixLength : prefixLength;
+	ban.qsReason  = address;
+	ban.qdtStart  = QDateTime::fromSecsSinceEpoch(1000000).toUTC();
+	ban.iDuration = duration;
+
+	return ban;
+}
+
+static HostAddress hostAddress(const QString &address) {
+	return HostAddress(QHostAddress(address));
+}
+
+class TestBanIndex : public QObject {
+	Q_OBJECT
+private slots:
+	void empty();
+	void ipv4();
+	void ipv6();
+	void mappedIPv4();
+	void expiry();
+	void hashes();
+	void matchesLinearScan();
+};
+
+void TestBanIndex::empty() {
+	BanIndex index;
+	QCOMPARE(index.match(hostAddress("192.168.0.1")), nullptr);
+	QCOMPARE(index.size(), std::size_t(0));
+
+	index.rebuild({});
+	QCOMPARE(index.match(hostAddress("::1")), nullptr);
+}
+
+void TestBanIndex::ipv4() {
+	BanIndex index;
+	index.rebuild({ makeBan("10.0.0.0", 8), makeBan("192.168.1.0", 24), makeBan("192.168.1.7", 32) });
+	QCOMPARE(index.size(), std::size_t(3));
+
+	QVERIFY(index.match(hostAddress("10.200.3.4")));
+	QCOMPARE(index.match(hostAddress("10.200.3.4"))->qsReason, QLatin1String("10.0.0.0"));
+	QVERIFY(index.match(hostAddress("192.168.1.200")));
+	QVERIFY(index.match(hostAddress("192.168.1.7")));
+
+	QCOMPARE(index.match(hostAddress("11.0.0.1")), nullptr);
+	QCOMPARE(index.match(hostAddress("192.168.2.1")), nullptr);
+	QCOMPARE(index.match(hostAddress("192.168.0.255")), nullptr);
+}
+
+void TestBanIndex::ipv6() {
+	BanIndex index;
+	index.rebuild({ makeBan("2001:db8::", 32), makeBan("2a00:1450:4001:81a::200e", 128) });
+
+	QVERIFY(index.match(hostAddress("2001:db8:1234::1")));
+	QVERIFY(index.match(hostAddress("2a00:1450:4001:81a::200e")));
+
+	QCOMPARE(index.match(hostAddress("2001:db9::1")), nullptr);
+	QCOMPARE(index.match(hostAddress("2a00:1450:4001:81a::200f")), nullptr);
+	// An IPv4 address never matches an IPv6 range
+	QCOMPARE(index.match(hostAddress("32.1.13.184")), nullptr);
+}
+
+void TestBanIndex::mappedIPv4() {
+	BanIndex index;
+	index.rebuild({ makeBan("::ffff:172.16.0.0", 108) });
+
+	// Clients connecting through an IPv6 socket appear as IPv4-mapped addresses, but these are the same addresses
+	QVERIFY(index.match(hostAddress("172.16.5.5")));
+	QVERIFY(index.match(hostAddress("::ffff:172.31.255.255")));
+	QCOMPARE(index.match(hostAddress("172.32.0.1")), nullptr);
+}
+
+void TestBanIndex::expiry() {
+	BanIndex index;
+	index.rebuild({ makeBan("10.0.0.1", 32, 100), makeBan("10.0.0.2", 32, 50), makeBan("10.0.0.3", 32) });
+
+	const QDateTime start = QDateTime::fromSecsSinceEpoch(1000000).toUTC();
+
+	QVERIFY(index.takeExpired(start.addSecs(10)).isEmpty());
+
+	const QList< Ban > expired = index.takeExpired(start.addSecs(75));
+	QCOMPARE(expired.size(), 1);
+	QCOMPARE(expired.first().qsReason, QLatin1String("10.0.0.2"));
+	QCOMPARE(index.match(hostAddress("10.0.0.2")), nullptr);
+	QVERIFY(index.match(hostAddress("10.0.0.1")));
+	QCOMPARE(index.size(), std::size_t(2));
+
+	QCOMPARE(index.takeExpired(start.addSecs(1000)).size(), 1);
+	QCOMPARE(index.match(hostAddress("10.0.0.1")), nullptr);
+	// Permanent bans never expire
+	QVERIFY(index.match(hostAddress("10.0.0.3")));
+	QCOMPARE(index.size(), std::size_t(1));
+}
+
+void TestBanIndex::hashes() {
+	Ban hashBan     = makeBan("10.0.0.1", 32, 10);
+	hashBan.qsHash  = QLatin1String("0123456789abcdef");
+	Ban otherBan    = makeBan("10.0.0.2", 32);
+	otherBan.qsHash = QLatin1String("fedcba9876543210");
+
+	BanIndex index;
+	index.rebuild({ hashBan, otherBan });
+
+	QVERIFY(index.matchHash(QLatin1String("0123456789abcdef")));
+	QVERIFY(index.matchHash(QLatin1String("fedcba9876543210")));
+	QCOMPARE(index.matchHash(QLatin1String("0000")), nullptr);
+	QCOMPARE(index.matchHash(QString()), nullptr);
+
+	index.takeExpired(hashBan.qdtStart.addSecs(100));
+	QCOMPARE(index.matchHash(QLatin1String("0123456789abcdef")), nullptr);
+}
+
+void TestBanIndex::matchesLinearScan() {
+	std::mt19937 rng(1);
+
+	// Few distinct bits, so that the ranges overlap a lot
+	const auto randomAddress = [&rng]() {
+		HostAddress address;
+		if (rng() % 2) {
+			address.fromIPv4(static_cast< std::uint32_t >(rng() % 4 << 30 | rng() % 4 << 20 | rng() % 4));
+		} else {
+			address.reset();
+			for (std::size_t i = 0; i < 16; ++i) {
+				address.setByte(i, static_cast< std::uint8_t >(rng() % 2 ? 0 : rng() % 4));
+			}
+		}
+		return address;
+	};
+
+	for (int round = 0; round < 20; ++round) {
+		QList< Ban > bans;
+		for (int i = 0; i < 100; ++i) {
+			Ban ban;
+			ban.haAddress = randomAddress();
+			ban.iMask     = static_cast< int >(rng() % 129);
+			bans << ban;
+		}
+
+		BanIndex index;
+		index.rebuild(bans);
+
+		for (int i = 0; i < 1000; ++i) {
+			const HostAddress address = randomAddress();
+
+			bool banned = false;
+			for (const Ban &ban : bans) {
+				banned = banned || address.match(ban.haAddress, static_cast< unsigned int >(ban.iMask));
+			}
+
+			const Ban *match = index.match(address);
+			QCOMPARE(match != nullptr, banned);
+			if (match) {
+				QVERIFY(address.match(match->haAddress, static_cast< unsigned int >(match->iMask)));
+			}
+		}
+	}
+}
+
+QTEST_MAIN(TestBanIndex)
+#include "TestBanIndex.moc"
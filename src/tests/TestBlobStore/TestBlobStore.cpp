@@ -0,0 +1,180 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "BlobStore.h"
+
+#include <utility>
+
+class TestBlobStore : public QObject {
+	Q_OBJECT
+private slots:
+	void deduplicate();
+	void references();
+	void find();
+	void spill();
+	void leastRecentlyUsed();
+	void keepInMemory();
+	void spillFiles();
+};
+
+/// @returns The number of spill files in the given directory
+static int spillFileCount(const QTemporaryDir &dir) {
+	return static_cast< int >(QDir(dir.path()).entryList({ "*.blob" }, QDir::Files).size());
+}
+
+void TestBlobStore::deduplicate() {
+	BlobStore store(1 << 20, QString());
+
+	const QByteArray data(200, 'a');
+	BlobRef first  = store.insert(data);
+	BlobRef second = store.insert(data);
+	BlobRef other  = store.insert(QByteArray(200, 'b'));
+
+	QCOMPARE(first.hash(), QCryptographicHash::hash(data, QCryptographicHash::Sha1));
+	QCOMPARE(second.hash(), first.hash());
+	QVERIFY(other.hash() != first.hash());
+	QCOMPARE(first.data(), data);
+
+	BlobStoreMetrics metrics = store.metrics();
+	QCOMPARE(metrics.blobs, std::uint64_t(2));
+	QCOMPARE(metrics.bytes, std::uint64_t(400));
+	QCOMPARE(metrics.references, std::uint64_t(3));
+	QCOMPARE(metrics.deduplicated, std::uint64_t(1));
+
+	// The blob is kept as long as it is referenced
+	first.reset();
+	QCOMPARE(second.data(), data);
+	second.reset();
+	QVERIFY(second.isNull());
+	QVERIFY(second.data().isEmpty());
+
+	metrics = store.metrics();
+	QCOMPARE(metrics.blobs, std::uint64_t(1));
+	QCOMPARE(metrics.bytes, std::uint64_t(200));
+	QCOMPARE(metrics.references, std::uint64_t(1));
+}
+
+void TestBlobStore::references() {
+	BlobStore store(1 << 20, QString());
+
+	{
+		BlobRef ref = store.insert(QByteArray(200, 'a'));
+
+		BlobRef copy(ref);
+		QCOMPARE(store.metrics().references, std::uint64_t(2));
+
+		BlobRef moved(std::move(copy));
+		QVERIFY(copy.isNull());
+		QCOMPARE(store.metrics().references, std::uint64_t(2));
+
+		// Assigning a reference to the same blob keeps the blob
+		moved = ref;
+		ref   = moved;
+		QCOMPARE(store.metrics().references, std::uint64_t(2));
+		QCOMPARE(ref.data(), QByteArray(200, 'a'));
+
+		ref = store.insert(QByteArray(200, 'b'));
+		QCOMPARE(store.metrics().blobs, std::uint64_t(2));
+	}
+
+	QCOMPARE(store.metrics().blobs, std::uint64_t(0));
+	QCOMPARE(store.metrics().references, std::uint64_t(0));
+}
+
+void TestBlobStore::find() {
+	BlobStore store(1 << 20, QString());
+
+	BlobRef ref = store.insert(QByteArray(200, 'a'));
+
+	BlobRef found = store.find(ref.hash());
+	QVERIFY(!found.isNull());
+	QCOMPARE(found.data(), QByteArray(200, 'a'));
+	QCOMPARE(store.metrics().references, std::uint64_t(2));
+
+	QVERIFY(store.find(QByteArray(20, 'x')).isNull());
+}
+
+void TestBlobStore::spill() {
+	QTemporaryDir dir;
+	BlobStore store(250, dir.path());
+
+	BlobRef a = store.insert(QByteArray(100, 'a'));
+	BlobRef b = store.insert(QByteArray(100, 'b'));
+	QCOMPARE(spillFileCount(dir), 0);
+
+	BlobRef c = store.insert(QByteArray(100, 'c'));
+
+	BlobStoreMetrics metrics = store.metrics();
+	QCOMPARE(metrics.spilledBlobs, std::uint64_t(1));
+	QCOMPARE(metrics.residentBytes, std::uint64_t(200));
+	QCOMPARE(metrics.bytes, std::uint64_t(300));
+	QCOMPARE(metrics.spills, std::uint64_t(1));
+	QCOMPARE(spillFileCount(dir), 1);
+
+	// Spilled blobs are read from their file
+	QCOMPARE(a.data(), QByteArray(100, 'a'));
+	QCOMPARE(store.metrics().residentBytes, std::uint64_t(200));
+
+	// Storing a spilled blob again doesn't bring it back into memory
+	BlobRef again = store.insert(QByteArray(100, 'a'));
+	QCOMPARE(store.metrics().spilledBlobs, std::uint64_t(1));
+
+	a.reset();
+	again.reset();
+	QCOMPARE(spillFileCount(dir), 0);
+	QCOMPARE(store.metrics().residentBytes, std::uint64_t(200));
+}
+
+void TestBlobStore::leastRecentlyUsed() {
+	QTemporaryDir dir;
+	BlobStore store(250, dir.path());
+
+	BlobRef a = store.insert(QByteArray(100, 'a'));
+	BlobRef b = store.insert(QByteArray(100, 'b'));
+
+	// Reading a makes b the least recently used blob
+	QCOMPARE(a.data(), QByteArray(100, 'a'));
+	BlobRef c = store.insert(QByteArray(100, 'c'));
+
+	QVERIFY(QFile::exists(QDir(dir.path()).filePath(QString::fromLatin1(b.hash().toHex()) + ".blob")));
+	QVERIFY(!QFile::exists(QDir(dir.path()).filePath(QString::fromLatin1(a.hash().toHex()) + ".blob")));
+	QCOMPARE(b.data(), QByteArray(100, 'b'));
+}
+
+void TestBlobStore::keepInMemory() {
+	BlobStore store(0, QString());
+
+	BlobRef a = store.insert(QByteArray(100, 'a'));
+	BlobRef b = store.insert(QByteArray(100, 'b'));
+
+	const BlobStoreMetrics metrics = store.metrics();
+	QCOMPARE(metrics.spilledBlobs, std::uint64_t(0));
+	QCOMPARE(metrics.residentBytes, std::uint64_t(200));
+}
+
+void TestBlobStore::spillFiles() {
+	QTemporaryDir dir;
+
+	QFile stale(QDir(dir.path()).filePath("0123.blob"));
+	QVERIFY(stale.open(QIODevice::WriteOnly));
+	stale.close();
+
+	{
+		BlobStore store(0, dir.path());
+		QVERIFY(!stale.exists());
+
+		BlobRef a = store.insert(QByteArray(100, 'a'));
+		QCOMPARE(spillFileCount(dir), 1);
+		QCOMPARE(a.data(), QByteArray(100, 'a'));
+	}
+
+	QCOMPARE(spillFileCount(dir), 0);
+}
+
+QTEST_MAIN(TestBlobStore)
+#include "TestBlobStore.moc"
@@ -0,0 +1,257 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "CallbackQueue.h"
+
+#include <memory>
+#include <stdexcept>
+
+class TestCallbackQueue : public QObject {
+	Q_OBJECT
+private slots:
+	void order();
+	void coalesce();
+	void coalesceOrder();
+	void coalesceFull();
+	void drop();
+	void synchronous();
+	void failure();
+	void failureAfterSend();
+	void exception();
+	void timeout();
+	void prometheus();
+};
+
+/// Records the calls started by a CallbackQueue, so that the test decides when they are done
+struct Subscriber {
+	QStringList started;
+	QList< CallbackQueue::Done > pending;
+
+	CallbackQueue::Call call(const QString &name) {
+		return [this, name](const CallbackQueue::Done &done) {
+			started << name;
+			pending << done;
+		};
+	}
+
+	void complete(bool success = true) { pending.takeFirst()(success); }
+};
+
+void TestCallbackQueue::order() {
+	auto queue = std::make_shared< CallbackQueue >(10, 0);
+	Subscriber subscriber;
+
+	QVERIFY(queue->enqueue(subscriber.call("a")));
+	QVERIFY(queue->enqueue(subscriber.call("b")));
+	QVERIFY(queue->enqueue(subscriber.call("c")));
+
+	// Only one call is in flight at a time
+	QCOMPARE(subscriber.started, QStringList{ "a" });
+	QCOMPARE(queue->metrics().queued, std::uint64_t(2));
+
+	subscriber.complete();
+	QCOMPARE(subscriber.started, (QStringList{ "a", "b" }));
+	subscriber.complete();
+	subscriber.complete();
+	QCOMPARE(subscriber.started, (QStringList{ "a", "b", "c" }));
+
+	const CallbackQueueMetrics metrics = queue->metrics();
+	QCOMPARE(metrics.enqueued, std::uint64_t(3));
+	QCOMPARE(metrics.delivered, std::uint64_t(3));
+	QCOMPARE(metrics.queued, std::uint64_t(0));
+}
+
+void TestCallbackQueue::coalesce() {
+	auto queue = std::make_shared< CallbackQueue >(10, 0);
+	Subscriber subscriber;
+
+	queue->enqueue(subscriber.call("user1-a"), "user/1");
+	queue->enqueue(subscriber.call("user1-b"), "user/1");
+	queue->enqueue(subscriber.call("user2"), "user/2");
+	queue->enqueue(subscriber.call("text"));
+	queue->enqueue(subscriber.call("user1-c"), "user/1");
+
+	// The call in flight isn't replaced. The waiting one is dropped and its replacement queued after the calls queued
+	// in the meantime.
+	QCOMPARE(subscriber.started, QStringList{ "user1-a" });
+	QCOMPARE(queue->metrics().queued, std::uint64_t(3));
+	while (!subscriber.pending.isEmpty()) {
+		subscriber.complete();
+	}
+	QCOMPARE(subscriber.started, (QStringList{ "user1-a", "user2", "text", "user1-c" }));
+	QCOMPARE(queue->metrics().coalesced, std::uint64_t(1));
+	QCOMPARE(queue->metrics().queued, std::uint64_t(0));
+
+	// Once started, a call no longer takes part in coalescing
+	queue->enqueue(subscriber.call("user2-b"), "user/2");
+	queue->enqueue(subscriber.call("user2-c"), "user/2");
+	subscriber.complete();
+	subscriber.complete();
+	QCOMPARE(subscriber.started.mid(4), (QStringList{ "user2-b", "user2-c" }));
+}
+
+void TestCallbackQueue::coalesceOrder() {
+	auto queue = std::make_shared< CallbackQueue >(10, 0);
+	Subscriber subscriber;
+
+	queue->enqueue(subscriber.call("busy"));
+	queue->enqueue(subscriber.call("user5-in-X"), "user/5");
+	queue->enqueue(subscriber.call("channelY-created"));
+	queue->enqueue(subscriber.call("user5-in-Y"), "user/5");
+
+	// The user's latest state must not arrive before the channel it refers to
+	while (!subscriber.pending.isEmpty()) {
+		subscriber.complete();
+	}
+	QCOMPARE(subscriber.started, (QStringList{ "busy", "channelY-created", "user5-in-Y" }));
+}
+
+void TestCallbackQueue::coalesceFull() {
+	auto queue = std::make_shared< CallbackQueue >(2, 0);
+	Subscriber subscriber;
+
+	queue->enqueue(subscriber.call("busy"));
+	queue->enqueue(subscriber.call("user1-a"), "user/1");
+	queue->enqueue(subscriber.call("text"));
+
+	// The queue is full, but the replaced call makes room for its replacement
+	queue->enqueue(subscriber.call("user1-b"), "user/1");
+	queue->enqueue(subscriber.call("user1-c"), "user/1");
+	QCOMPARE(queue->metrics().queued, std::uint64_t(2));
+
+	while (!subscriber.pending.isEmpty()) {
+		subscriber.complete();
+	}
+	QCOMPARE(subscriber.started, (QStringList{ "busy", "text", "user1-c" }));
+
+	const CallbackQueueMetrics metrics = queue->metrics();
+	QCOMPARE(metrics.coalesced, std::uint64_t(2));
+	QCOMPARE(metrics.dropped, std::uint64_t(0));
+}
+
+void TestCallbackQueue::drop() {
+	auto queue = std::make_shared< CallbackQueue >(2, 0);
+	Subscriber subscriber;
+
+	for (int i = 0; i < 5; ++i) {
+		QVERIFY(queue->enqueue(subscriber.call(QString::number(i))));
+	}
+	// A keyed call is dropped as well, unless it replaces a waiting one
+	queue->enqueue(subscriber.call("x"), "key");
+
+	while (!subscriber.pending.isEmpty()) {
+		subscriber.complete();
+	}
+	QCOMPARE(subscriber.started, (QStringList{ "0", "1", "2" }));
+
+	const CallbackQueueMetrics metrics = queue->metrics();
+	QCOMPARE(metrics.enqueued, std::uint64_t(6));
+	QCOMPARE(metrics.dropped, std::uint64_t(3));
+	QCOMPARE(metrics.delivered, std::uint64_t(3));
+}
+
+void TestCallbackQueue::synchronous() {
+	auto queue = std::make_shared< CallbackQueue >(10, 0);
+	QStringList started;
+
+	// Calls that are done right away (e.g. because Ice sent them synchronously) don't pile up
+	for (int i = 0; i < 100; ++i) {
+		QVERIFY(queue->enqueue([&started, i](const CallbackQueue::Done &done) {
+			started << QString::number(i);
+			done(true);
+			// Repeated invocations are ignored
+			done(false);
+		}));
+	}
+
+	QCOMPARE(started.size(), 100);
+	QCOMPARE(queue->metrics().delivered, std::uint64_t(100));
+	QVERIFY(!queue->hasFailed());
+}
+
+void TestCallbackQueue::failure() {
+	auto queue = std::make_shared< CallbackQueue >(10, 0);
+	Subscriber subscriber;
+
+	queue->enqueue(subscriber.call("a"));
+	queue->enqueue(subscriber.call("b"));
+	const CallbackQueue::Done first = subscriber.pending.first();
+	subscriber.complete(false);
+
+	QVERIFY(queue->hasFailed());
+	QCOMPARE(subscriber.started, QStringList{ "a" });
+	QCOMPARE(queue->metrics().queued, std::uint64_t(0));
+	QVERIFY(!queue->enqueue(subscriber.call("c")));
+
+	// A late invocation for the failed call changes nothing
+	first(true);
+	QVERIFY(queue->hasFailed());
+	QCOMPARE(queue->metrics().delivered, std::uint64_t(0));
+}
+
+void TestCallbackQueue::failureAfterSend() {
+	auto queue = std::make_shared< CallbackQueue >(10, 0);
+	Subscriber subscriber;
+
+	queue->enqueue(subscriber.call("a"));
+	const CallbackQueue::Done first = subscriber.pending.first();
+
+	// The call has been sent, which starts the next one
+	subscriber.complete(true);
+	queue->enqueue(subscriber.call("b"));
+	QCOMPARE(subscriber.started, QStringList({ "a", "b" }));
+	QVERIFY(!queue->hasFailed());
+
+	// The remote end reports a failure for the first call later on
+	first(false);
+	QVERIFY(queue->hasFailed());
+	QVERIFY(!queue->enqueue(subscriber.call("c")));
+	QCOMPARE(queue->metrics().delivered, std::uint64_t(1));
+}
+
+void TestCallbackQueue::exception() {
+	auto queue = std::make_shared< CallbackQueue >(10, 0);
+
+	QVERIFY(!queue->enqueue([](const CallbackQueue::Done &) { throw std::runtime_error("unreachable"); }));
+	QVERIFY(queue->hasFailed());
+}
+
+void TestCallbackQueue::timeout() {
+	auto queue = std::make_shared< CallbackQueue >(10, 50);
+	Subscriber subscriber;
+
+	QVERIFY(queue->enqueue(subscriber.call("a")));
+	QVERIFY(queue->enqueue(subscriber.call("b")));
+	QVERIFY(!queue->hasFailed());
+
+	QTest::qWait(100);
+
+	QVERIFY(queue->hasFailed());
+	QVERIFY(!queue->enqueue(subscriber.call("c")));
+
+	// Without a timeout, a call may take forever
+	auto patient = std::make_shared< CallbackQueue >(10, 0);
+	QVERIFY(patient->enqueue(subscriber.call("d")));
+	QTest::qWait(100);
+	QVERIFY(!patient->hasFailed());
+}
+
+void TestCallbackQueue::prometheus() {
+	CallbackQueueMetrics metrics;
+	metrics.subscribers = 2;
+	metrics.dropped     = 7;
+
+	const std::string out = CallbackQueue::toPrometheus({ { 1, metrics } });
+
+	QVERIFY(out.find("# TYPE murmur_ice_callbacks gauge\n") != std::string::npos);
+	QVERIFY(out.find("murmur_ice_callbacks{server=\"1\"} 2\n") != std::string::npos);
+	QVERIFY(out.find("murmur_ice_callback_calls_dropped_total{server=\"1\"} 7\n") != std::string::npos);
+}
+
+QTEST_MAIN(TestCallbackQueue)
+#include "TestCallbackQueue.moc"
@@ -0,0 +1,145 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "ChannelListenerManager.h"
+
+#include <utility>
+#include <vector>
+
+class TestChannelListenerManager : public QObject {
+	Q_OBJECT
+private slots:
+	void addRemove();
+	void forEachListenerIsSorted();
+	void volumeAdjustments();
+	void forEachListenedChannel();
+	void clear();
+};
+
+using Listeners = std::vector< std::pair< unsigned int, float > >;
+
+Listeners collectListeners(const ChannelListenerManager &manager, unsigned int channelID) {
+	Listeners listeners;
+
+	manager.forEachListener(channelID, [&listeners](unsigned int userSession, const VolumeAdjustment &adjustment) {
+		listeners.push_back({ userSession, adjustment.factor });
+	});
+
+	return listeners;
+}
+
+void TestChannelListenerManager::addRemove() {
+	ChannelListenerManager manager;
+
+	QVERIFY(!manager.isListenedByAny(1));
+	QCOMPARE(manager.getListenerCountForChannel(1), 0);
+
+	manager.addListener(5, 1);
+	manager.addListener(3, 1);
+	// Adding the same listener twice must not create a duplicate
+	manager.addListener(5, 1);
+	manager.addListener(5, 2);
+
+	QVERIFY(manager.isListening(5, 1));
+	QVERIFY(manager.isListening(3, 1));
+	QVERIFY(!manager.isListening(3, 2));
+	QVERIFY(manager.isListenedByAny(1));
+	QVERIFY(manager.isListeningToAny(5));
+	QCOMPARE(manager.getListenerCountForChannel(1), 2);
+	QCOMPARE(manager.getListenedChannelCountForUser(5), 2);
+	QCOMPARE(manager.getListenersForChannel(1), QSet< unsigned int >({ 3, 5 }));
+	QCOMPARE(manager.getListenedChannelsForUser(5), QSet< unsigned int >({ 1, 2 }));
+
+	manager.removeListener(5, 1);
+	QVERIFY(!manager.isListening(5, 1));
+	QCOMPARE(manager.getListenersForChannel(1), QSet< unsigned int >({ 3 }));
+
+	manager.removeListener(3, 1);
+	QVERIFY(!manager.isListenedByAny(1));
+	QCOMPARE(manager.getListenerCountForChannel(1), 0);
+	QVERIFY(collectListeners(manager, 1).empty());
+
+	// Removing a listener that doesn't exist is a no-op
+	manager.removeListener(3, 1);
+	manager.removeListener(7, 9);
+	QVERIFY(manager.isListening(5, 2));
+}
+
+void TestChannelListenerManager::forEachListenerIsSorted() {
+	ChannelListenerManager manager;
+
+	for (unsigned int session : { 8, 2, 6, 4, 10 }) {
+		manager.addListener(session, 1);
+	}
+
+	Listeners expected = { { 2, 1.0f }, { 4, 1.0f }, { 6, 1.0f }, { 8, 1.0f }, { 10, 1.0f } };
+	QCOMPARE(collectListeners(manager, 1), expected);
+
+	QVERIFY(collectListeners(manager, 2).empty());
+}
+
+void TestChannelListenerManager::volumeAdjustments() {
+	ChannelListenerManager manager;
+
+	// Volume adjustments may be known before the listener is added
+	manager.setListenerVolumeAdjustment(1, 1, VolumeAdjustment::fromFactor(0.5f));
+	manager.addListener(1, 1);
+	manager.addListener(2, 1);
+
+	QCOMPARE(collectListeners(manager, 1), Listeners({ { 1, 0.5f }, { 2, 1.0f } }));
+
+	// Changing the adjustment of an existing listener has to update the copy visible to forEachListener
+	manager.setListenerVolumeAdjustment(2, 1, VolumeAdjustment::fromFactor(2.0f));
+	QCOMPARE(collectListeners(manager, 1), Listeners({ { 1, 0.5f }, { 2, 2.0f } }));
+	QCOMPARE(manager.getListenerVolumeAdjustment(2, 1).factor, 2.0f);
+
+	// The adjustment outlives the listener
+	manager.removeListener(2, 1);
+	manager.addListener(2, 1);
+	QCOMPARE(collectListeners(manager, 1), Listeners({ { 1, 0.5f }, { 2, 2.0f } }));
+
+	QCOMPARE(manager.getListenerVolumeAdjustment(3, 1).factor, 1.0f);
+}
+
+void TestChannelListenerManager::forEachListenedChannel() {
+	ChannelListenerManager manager;
+
+	manager.addListener(1, 4);
+	manager.addListener(1, 7);
+	manager.addListener(2, 7);
+	manager.setListenerVolumeAdjustment(1, 7, VolumeAdjustment::fromFactor(1.5f));
+
+	QHash< unsigned int, float > channels;
+	manager.forEachListenedChannel(1, [&channels](unsigned int channelID, const VolumeAdjustment &adjustment) {
+		channels.insert(channelID, adjustment.factor);
+	});
+
+	QCOMPARE(channels.size(), static_cast< qsizetype >(2));
+	QCOMPARE(channels.value(4), 1.0f);
+	QCOMPARE(channels.value(7), 1.5f);
+
+	int calls = 0;
+	manager.forEachListenedChannel(3, [&calls](unsigned int, const VolumeAdjustment &) { ++calls; });
+	QCOMPARE(calls, 0);
+}
+
+void TestChannelListenerManager::clear() {
+	ChannelListenerManager manager;
+
+	manager.addListener(1, 1);
+	manager.setListenerVolumeAdjustment(1, 1, VolumeAdjustment::fromFactor(0.5f));
+
+	manager.clear();
+
+	QVERIFY(!manager.isListening(1, 1));
+	QVERIFY(collectListeners(manager, 1).empty());
+	QCOMPARE(manager.getListenerVolumeAdjustment(1, 1).factor, 1.0f);
+}
+
+QTEST_MAIN(TestChannelListenerManager)
+#include "TestChannelListenerManager.moc"
@@ -0,0 +1,153 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "ACL.h"
+#include "Channel.h"
+#include "ChannelTreeBuilder.h"
+#include "Group.h"
+#include "ServerDB.h"
+
+class TestChannelTreeBuilder : public QObject {
+	Q_OBJECT
+private slots:
+	void tree();
+	void unreachable();
+	void info();
+	void groups();
+	void acls();
+};
+
+void TestChannelTreeBuilder::tree() {
+	ChannelTreeBuilder builder;
+	// Ordered by name
+	builder.addChannel(3, 1, QLatin1String("Alpha"), true);
+	builder.addChannel(2, 0, QLatin1String("Lobby"), false);
+	builder.addChannel(0, -1, QLatin1String("Root"), true);
+	builder.addChannel(1, 0, QLatin1String("Rooms"), true);
+	builder.addChannel(4, 1, QLatin1String("Zulu"), true);
+
+	QObject parent;
+	const QHash< unsigned int, Channel * > channels = builder.build(&parent);
+	QCOMPARE(channels.size(), qsizetype(5));
+
+	Channel *root = channels.value(0);
+	QVERIFY(root);
+	QVERIFY(!root->cParent);
+	QCOMPARE(root->parent(), &parent);
+
+	QCOMPARE(root->qlChannels, (QList< Channel * >{ channels.value(2), channels.value(1) }));
+	QCOMPARE(channels.value(1)->qlChannels, (QList< Channel * >{ channels.value(3), channels.value(4) }));
+	QCOMPARE(channels.value(4)->cParent, channels.value(1));
+	QCOMPARE(channels.value(4)->qsName, QLatin1String("Zulu"));
+	QVERIFY(!channels.value(2)->bInheritACL);
+	QVERIFY(channels.value(3)->bInheritACL);
+}
+
+void TestChannelTreeBuilder::unreachable() {
+	ChannelTreeBuilder builder;
+	builder.addChannel(0, -1, QLatin1String("Root"), true);
+	builder.addChannel(1, 0, QLatin1String("A"), true);
+	// The parent doesn't exist
+	builder.addChannel(2, 42, QLatin1String("Orphan"), true);
+	builder.addChannel(3, 2, QLatin1String("Below orphan"), true);
+	// The channels are each other's parents
+	builder.addChannel(4, 5, QLatin1String("Cycle 1"), true);
+	builder.addChannel(5, 4, QLatin1String("Cycle 2"), true);
+
+	builder.addGroup(1, 2, QLatin1String("admin"), true, true);
+	builder.addGroupMember(1, 7, true);
+	builder.addACL(3, -1, QLatin1String("all"), true, true, ChanACL::Enter, ChanACL::None);
+
+	QObject parent;
+	const QHash< unsigned int, Channel * > channels = builder.build(&parent);
+	QCOMPARE(channels.size(), qsizetype(2));
+	QVERIFY(channels.contains(0));
+	QVERIFY(channels.contains(1));
+}
+
+void TestChannelTreeBuilder::info() {
+	ChannelTreeBuilder builder;
+	builder.addInfo(1, ServerDB::Channel_Position, QLatin1String("-5"));
+	builder.addInfo(1, ServerDB::Channel_Description, QLatin1String("Description"));
+	builder.addInfo(0, ServerDB::Channel_Max_Users, QLatin1String("12"));
+	builder.addInfo(1, ServerDB::Channel_Max_Users, QLatin1String("invalid"));
+	builder.addChannel(0, -1, QLatin1String("Root"), true);
+	builder.addChannel(1, 0, QLatin1String("A"), true);
+
+	QObject parent;
+	const QHash< unsigned int, Channel * > channels = builder.build(&parent);
+	QCOMPARE(channels.value(1)->iPosition, -5);
+	QCOMPARE(channels.value(1)->qsDesc, QLatin1String("Description"));
+	QCOMPARE(channels.value(1)->uiMaxUsers, 0U);
+	QCOMPARE(channels.value(0)->uiMaxUsers, 12U);
+	QCOMPARE(channels.value(0)->iPosition, 0);
+}
+
+void TestChannelTreeBuilder::groups() {
+	ChannelTreeBuilder builder;
+	// Members may be read before their groups
+	builder.addGroupMember(20, 5, true);
+	builder.addGroupMember(20, 6, false);
+	builder.addGroupMember(21, 5, true);
+	builder.addGroupMember(99, 5, true);
+	builder.addGroup(20, 0, QLatin1String("admin"), true, false);
+	builder.addGroup(21, 1, QLatin1String("admin"), false, true);
+	builder.addChannel(0, -1, QLatin1String("Root"), true);
+	builder.addChannel(1, 0, QLatin1String("A"), true);
+
+	QObject parent;
+	const QHash< unsigned int, Channel * > channels = builder.build(&parent);
+
+	const Group *rootAdmin = channels.value(0)->qhGroups.value(QLatin1String("admin"));
+	QVERIFY(rootAdmin);
+	QVERIFY(rootAdmin->bInherit);
+	QVERIFY(!rootAdmin->bInheritable);
+	QCOMPARE(rootAdmin->qsAdd, QSet< int >{ 5 });
+	QCOMPARE(rootAdmin->qsRemove, QSet< int >{ 6 });
+
+	const Group *admin = channels.value(1)->qhGroups.value(QLatin1String("admin"));
+	QVERIFY(admin);
+	QCOMPARE(admin->c, channels.value(1));
+	QVERIFY(!admin->bInherit);
+	QCOMPARE(admin->qsAdd, QSet< int >{ 5 });
+	QVERIFY(admin->qsRemove.isEmpty());
+}
+
+void TestChannelTreeBuilder::acls() {
+	ChannelTreeBuilder builder;
+	builder.addChannel(0, -1, QLatin1String("Root"), true);
+	builder.addChannel(1, 0, QLatin1String("A"), true);
+	// Ordered by priority
+	builder.addACL(1, -1, QLatin1String("all"), true, false, ChanACL::None, ChanACL::Enter);
+	builder.addACL(0, 3, QString(), true, true, ChanACL::Write, ChanACL::None);
+	builder.addACL(1, -1, QLatin1String("admin"), false, true, ChanACL::Enter | ChanACL::Speak, ChanACL::None);
+
+	QObject parent;
+	const QHash< unsigned int, Channel * > channels = builder.build(&parent);
+
+	QCOMPARE(channels.value(0)->qlACL.size(), qsizetype(1));
+	const ChanACL *write = channels.value(0)->qlACL.first();
+	QCOMPARE(write->iUserId, 3);
+	QVERIFY(write->qsGroup.isEmpty());
+	QCOMPARE(write->pAllow, ChanACL::Permissions(ChanACL::Write));
+
+	const QList< ChanACL * > &acls = channels.value(1)->qlACL;
+	QCOMPARE(acls.size(), qsizetype(2));
+	QCOMPARE(acls[0]->qsGroup, QLatin1String("all"));
+	QCOMPARE(acls[0]->iUserId, -1);
+	QVERIFY(acls[0]->bApplyHere);
+	QVERIFY(!acls[0]->bApplySubs);
+	QCOMPARE(acls[0]->pDeny, ChanACL::Permissions(ChanACL::Enter));
+	QCOMPARE(acls[1]->qsGroup, QLatin1String("admin"));
+	QVERIFY(!acls[1]->bApplyHere);
+	QCOMPARE(acls[1]->pAllow, ChanACL::Enter | ChanACL::Speak);
+	QCOMPARE(acls[1]->c, channels.value(1));
+}
+
+QTEST_MAIN(TestChannelTreeBuilder)
+#include "TestChannelTreeBuilder.moc"
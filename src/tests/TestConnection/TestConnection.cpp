@@ -0,0 +1,172 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtNetwork>
+#include <QtTest>
+
+#include "Connection.h"
+
+#include <memory>
+
+namespace {
+/// Frames the given payload the way messages are sent through TCP
+QByteArray frame(Mumble::Protocol::TCPMessageType type, const QByteArray &payload) {
+	QByteArray message(6, '\0');
+	qToBigEndian< quint16 >(static_cast< quint16 >(type), message.data());
+	qToBigEndian< quint32 >(static_cast< quint32 >(payload.size()), message.data() + 2);
+
+	return message + payload;
+}
+
+/// A framed message of exactly the given size
+QByteArray frameOfSize(qsizetype size) {
+	return frame(Mumble::Protocol::TCPMessageType::TextMessage, QByteArray(size - 6, 'x'));
+}
+} // namespace
+
+/// Exposes the output buffer of a Connection
+class BufferedConnection : public Connection {
+public:
+	explicit BufferedConnection(QSslSocket *socket) : Connection(nullptr, socket) {}
+
+	qsizetype bufferedBytes() const { return m_outputBuffer.size(); }
+};
+
+class TestConnection : public QObject {
+	Q_OBJECT
+private slots:
+	void init();
+	void cleanup();
+	void orderAcrossFlush();
+	void forceFlush();
+	void disconnectFlushes();
+	void unbufferedThreshold();
+
+private:
+	QTcpServer m_server;
+	/// The connection under test, whose socket is connected to m_peer
+	std::unique_ptr< BufferedConnection > m_connection;
+	QTcpSocket *m_peer = nullptr;
+	/// Everything m_peer has received
+	QByteArray m_received;
+};
+
+void TestConnection::init() {
+	QVERIFY(m_server.listen(QHostAddress::LocalHost));
+
+	// The socket isn't encrypted, so the messages arrive at the peer exactly as they have been written
+	std::unique_ptr< QSslSocket > socket = std::make_unique< QSslSocket >();
+	socket->connectToHost(QHostAddress::LocalHost, m_server.serverPort());
+	QVERIFY(socket->waitForConnected());
+	QVERIFY(m_server.waitForNewConnection(5000));
+
+	m_peer = m_server.nextPendingConnection();
+	QVERIFY(m_peer);
+	connect(m_peer, &QTcpSocket::readyRead, this, [this]() { m_received += m_peer->readAll(); });
+
+	m_connection = std::make_unique< BufferedConnection >(socket.release());
+	m_received.clear();
+}
+
+void TestConnection::cleanup() {
+	m_connection.reset();
+	delete m_peer;
+	m_peer = nullptr;
+	m_server.close();
+}
+
+void TestConnection::orderAcrossFlush() {
+	const ConnectionOutputMetrics before = Connection::outputMetrics();
+
+	const QByteArray first = frame(Mumble::Protocol::TCPMessageType::Ping, "first");
+	const QByteArray large = frameOfSize(Connection::OUTPUT_FLUSH_THRESHOLD);
+	const QByteArray last  = frame(Mumble::Protocol::TCPMessageType::Ping, "last");
+
+	m_connection->sendMessage(first);
+	QCOMPARE(m_connection->bufferedBytes(), first.size());
+
+	// The buffer isn't empty, so the large message is appended to it, which then exceeds the threshold and is written
+	// right away
+	m_connection->sendMessage(large);
+	QCOMPARE(m_connection->bufferedBytes(), 0);
+
+	m_connection->sendMessage(last);
+	QCOMPARE(m_connection->bufferedBytes(), last.size());
+
+	QTRY_COMPARE(m_received.size(), first.size() + large.size() + last.size());
+	QCOMPARE(m_received, first + large + last);
+
+	const ConnectionOutputMetrics after = Connection::outputMetrics();
+	QCOMPARE(after.messages - before.messages, quint64(3));
+	QCOMPARE(after.writes - before.writes, quint64(2));
+	QCOMPARE(after.coalescedMessages - before.coalescedMessages, quint64(1));
+	QCOMPARE(after.bytes - before.bytes, static_cast< quint64 >(m_received.size()));
+}
+
+void TestConnection::forceFlush() {
+	const ConnectionOutputMetrics before = Connection::outputMetrics();
+
+	const QByteArray first  = frame(Mumble::Protocol::TCPMessageType::Ping, "first");
+	const QByteArray second = frame(Mumble::Protocol::TCPMessageType::Ping, "second");
+
+	m_connection->sendMessage(first);
+	m_connection->sendMessage(second);
+	QCOMPARE(Connection::outputMetrics().writes, before.writes);
+
+	// Writes the buffered messages without waiting for the event loop
+	m_connection->forceFlush();
+	QCOMPARE(m_connection->bufferedBytes(), 0);
+	QCOMPARE(Connection::outputMetrics().writes - before.writes, quint64(1));
+
+	QTRY_COMPARE(m_received, first + second);
+
+	// The flush that had been scheduled finds nothing left to write
+	QCoreApplication::processEvents();
+	QCOMPARE(Connection::outputMetrics().writes - before.writes, quint64(1));
+}
+
+void TestConnection::disconnectFlushes() {
+	const QByteArray first  = frame(Mumble::Protocol::TCPMessageType::Ping, "first");
+	const QByteArray reason = frame(Mumble::Protocol::TCPMessageType::Reject, "reason");
+
+	m_connection->sendMessage(first);
+	m_connection->sendMessage(reason);
+	m_connection->disconnectSocket(false);
+	QCOMPARE(m_connection->bufferedBytes(), 0);
+
+	// The messages sent right before disconnecting still arrive
+	QTRY_COMPARE(m_peer->state(), QAbstractSocket::UnconnectedState);
+	m_received += m_peer->readAll();
+	QCOMPARE(m_received, first + reason);
+}
+
+void TestConnection::unbufferedThreshold() {
+	ConnectionOutputMetrics before = Connection::outputMetrics();
+
+	// Large enough to be written right away as there is nothing to combine it with
+	const QByteArray large = frameOfSize(Connection::OUTPUT_FLUSH_THRESHOLD);
+	m_connection->sendMessage(large);
+	QCOMPARE(m_connection->bufferedBytes(), 0);
+	QCOMPARE(Connection::outputMetrics().writes - before.writes, quint64(1));
+
+	QTRY_COMPARE(m_received, large);
+	m_received.clear();
+
+	// One byte less is buffered until the event loop runs
+	before                 = Connection::outputMetrics();
+	const QByteArray small = frameOfSize(Connection::OUTPUT_FLUSH_THRESHOLD - 1);
+	m_connection->sendMessage(small);
+	QCOMPARE(m_connection->bufferedBytes(), small.size());
+	QCOMPARE(Connection::outputMetrics().writes, before.writes);
+
+	QTRY_COMPARE(m_received, small);
+	QCOMPARE(m_connection->bufferedBytes(), 0);
+	QCOMPARE(Connection::outputMetrics().writes - before.writes, quint64(1));
+	QCOMPARE(Connection::outputMetrics().coalescedMessages, before.coalescedMessages);
+}
+
+QTEST_MAIN(TestConnection)
+#include "TestConnection.moc"
@@ -0,0 +1,176 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtNetwork/QHostAddress>
+#include <QtTest>
+
+#include "ConnectionRateLimiter.h"
+
+constexpr quint64 SECOND = 1000000;
+
+static HostAddress hostAddress(const QString &address) {
+	return HostAddress(QHostAddress(address));
+}
+
+static ConnectionRateLimiter::Settings settings(unsigned int attempts, unsigned int subnetAttempts = 0) {
+	ConnectionRateLimiter::Settings settings;
+	settings.attempts       = attempts;
+	settings.subnetAttempts = subnetAttempts;
+	settings.timeframe      = 10 * SECOND;
+	settings.banTime        = 60 * SECOND;
+
+	return settings;
+}
+
+class TestConnectionRateLimiter : public QObject {
+	Q_OBJECT
+private slots:
+	void addressLimit();
+	void slidingWindow();
+	void banExpiry();
+	void subnetLimit();
+	void succeeded();
+	void boundedMemory();
+};
+
+void TestConnectionRateLimiter::addressLimit() {
+	ConnectionRateLimiter limiter(settings(3), 1024);
+	const HostAddress address = hostAddress("192.168.0.1");
+
+	for (int i = 0; i < 3; ++i) {
+		QVERIFY(!limiter.check(address, SECOND));
+	}
+	QVERIFY(limiter.check(address, SECOND));
+	QVERIFY(limiter.check(address, 2 * SECOND));
+
+	// Other addresses aren't affected
+	QVERIFY(!limiter.check(hostAddress("192.168.0.2"), 2 * SECOND));
+	QVERIFY(!limiter.check(hostAddress("::1"), 2 * SECOND));
+
+	const ConnectionRateLimiterMetrics metrics = limiter.metrics(2 * SECOND);
+	QCOMPARE(metrics.throttled, std::uint64_t(2));
+	QCOMPARE(metrics.addressBans, std::uint64_t(1));
+	QCOMPARE(metrics.subnetBans, std::uint64_t(0));
+	QCOMPARE(metrics.tracked, std::uint64_t(3));
+	QCOMPARE(metrics.banned, std::uint64_t(1));
+}
+
+void TestConnectionRateLimiter::slidingWindow() {
+	ConnectionRateLimiter limiter(settings(4), 1024);
+	const HostAddress address = hostAddress("2001:db8::1");
+
+	// 4 attempts at the end of the first timeframe
+	for (int i = 0; i < 4; ++i) {
+		QVERIFY(!limiter.check(address, 9 * SECOND));
+	}
+	// Shortly after, these still count almost completely
+	QVERIFY(limiter.check(address, 11 * SECOND));
+
+	ConnectionRateLimiter other(settings(4), 1024);
+	for (int i = 0; i < 4; ++i) {
+		QVERIFY(!other.check(address, 0));
+	}
+	// Half of the previous timeframe still overlaps the window, so 2 of the 4 attempts count
+	QVERIFY(!other.check(address, 15 * SECOND));
+	QVERIFY(!other.check(address, 15 * SECOND));
+	QVERIFY(other.check(address, 15 * SECOND));
+
+	ConnectionRateLimiter idle(settings(4), 1024);
+	for (int i = 0; i < 4; ++i) {
+		QVERIFY(!idle.check(address, 0));
+	}
+	// Nothing counts once two timeframes passed
+	for (int i = 0; i < 4; ++i) {
+		QVERIFY(!idle.check(address, 25 * SECOND));
+	}
+}
+
+void TestConnectionRateLimiter::banExpiry() {
+	ConnectionRateLimiter limiter(settings(1), 1024);
+	const HostAddress address = hostAddress("10.0.0.1");
+
+	QVERIFY(!limiter.check(address, 0));
+	QVERIFY(limiter.check(address, 0));
+	QVERIFY(limiter.check(address, 59 * SECOND));
+	QCOMPARE(limiter.metrics(59 * SECOND).banned, std::uint64_t(1));
+
+	QVERIFY(!limiter.check(address, 60 * SECOND));
+	QCOMPARE(limiter.metrics(60 * SECOND).banned, std::uint64_t(0));
+}
+
+void TestConnectionRateLimiter::subnetLimit() {
+	ConnectionRateLimiter limiter(settings(3, 5), 1024);
+
+	// Every address only attempts once, but the subnet exceeds its limit
+	for (int i = 1; i <= 5; ++i) {
+		QVERIFY(!limiter.check(hostAddress(QString("203.0.113.%1").arg(i)), SECOND));
+	}
+	QVERIFY(limiter.check(hostAddress("203.0.113.6"), SECOND));
+	QVERIFY(limiter.check(hostAddress("203.0.113.200"), SECOND));
+	QVERIFY(!limiter.check(hostAddress("203.0.114.1"), SECOND));
+
+	// IPv6 subnets are /64 by default
+	for (int i = 1; i <= 5; ++i) {
+		QVERIFY(!limiter.check(hostAddress(QString("2001:db8:0:1::%1").arg(i)), SECOND));
+	}
+	QVERIFY(limiter.check(hostAddress("2001:db8:0:1:ffff::1"), SECOND));
+	QVERIFY(!limiter.check(hostAddress("2001:db8:0:2::1"), SECOND));
+
+	QCOMPARE(limiter.metrics(SECOND).subnetBans, std::uint64_t(2));
+	QCOMPARE(limiter.metrics(SECOND).addressBans, std::uint64_t(0));
+}
+
+void TestConnectionRateLimiter::succeeded() {
+	ConnectionRateLimiter limiter(settings(2, 3), 1024);
+	const HostAddress address = hostAddress("198.51.100.1");
+
+	// Successful connections don't count towards the limit of the address
+	for (int i = 0; i < 10; ++i) {
+		QVERIFY(!limiter.check(address, SECOND));
+		limiter.succeeded(address, SECOND);
+	}
+
+	// Nor towards the limit of the subnet
+	for (int i = 0; i < 3; ++i) {
+		QVERIFY(!limiter.check(hostAddress(QString("198.51.100.%1").arg(10 + i)), SECOND));
+	}
+	QVERIFY(limiter.check(address, SECOND));
+}
+
+void TestConnectionRateLimiter::boundedMemory() {
+	ConnectionRateLimiter limiter(settings(1), 1000);
+	QCOMPARE(limiter.capacity(), std::size_t(1024));
+
+	const HostAddress banned = hostAddress("192.0.2.1");
+	QVERIFY(!limiter.check(banned, 0));
+	QVERIFY(limiter.check(banned, 0));
+
+	// A flood of addresses that only attempt to connect once
+	for (std::uint32_t i = 0; i < 100000; ++i) {
+		HostAddress address;
+		address.fromIPv4(0x0A000000 + i);
+		QVERIFY(!limiter.check(address, SECOND));
+	}
+
+	const ConnectionRateLimiterMetrics metrics = limiter.metrics(SECOND);
+	QCOMPARE(metrics.tracked, std::uint64_t(1024));
+	QVERIFY(metrics.evictions >= 100000 - 1024);
+
+	// Banned addresses are evicted last
+	QVERIFY(limiter.check(banned, 2 * SECOND));
+
+	// Entries whose attempts don't count anymore are reused before any others are evicted
+	const std::uint64_t evictions = metrics.evictions;
+	for (std::uint32_t i = 0; i < 512; ++i) {
+		HostAddress address;
+		address.fromIPv4(0x0B000000 + i);
+		QVERIFY(!limiter.check(address, 30 * SECOND));
+	}
+	QVERIFY(limiter.metrics(30 * SECOND).evictions - evictions < 512);
+}
+
+QTEST_MAIN(TestConnectionRateLimiter)
+#include "TestConnectionRateLimiter.moc"
@@ -0,0 +1,33 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+
+// NOTE: This is merely a mock of the Server class
+
+#include <QtCore/QObject>
+#include <QtCore/QThread>
+
+#include <atomic>
+
+class Server : public QObject {
+public:
+	/// Servers with a negative number fail to boot
+	Server(int snum, QObject *parent = nullptr) : QObject(parent), bValid(snum >= 0), iServerNum(snum) {
+		constructedOn = QThread::currentThread();
+		++alive;
+	}
+
+	~Server() override {
+		destroyedOn = QThread::currentThread();
+		--alive;
+	}
+
+	bool bValid;
+	int iServerNum;
+
+	static inline std::atomic< QThread * > constructedOn{ nullptr };
+	static inline std::atomic< QThread * > destroyedOn{ nullptr };
+	static inline std::atomic< int > alive{ 0 };
+};
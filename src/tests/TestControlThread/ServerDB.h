@@ -0,0 +1,18 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+
+// NOTE: This is merely a mock of the ServerDB class
+
+#include <QtCore/QThread>
+
+#include <atomic>
+
+class ServerDB {
+public:
+	static void releaseThreadConnection() { releasedOn = QThread::currentThread(); }
+
+	static inline std::atomic< QThread * > releasedOn{ nullptr };
+};
@@ -0,0 +1,127 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "ControlThread.h"
+#include "Server.h"
+#include "ServerDB.h"
+
+#include <atomic>
+#include <memory>
+
+class TestControlThread : public QObject {
+	Q_OBJECT
+private slots:
+	void init();
+	void bootAndDestroy();
+	void failedBoot();
+	void rpcCalls();
+	void callsQueuedBeforeDestruction();
+};
+
+void TestControlThread::init() {
+	Server::constructedOn = nullptr;
+	Server::destroyedOn   = nullptr;
+	ServerDB::releasedOn  = nullptr;
+	QCOMPARE(Server::alive.load(), 0);
+}
+
+void TestControlThread::bootAndDestroy() {
+	std::unique_ptr< ControlThread > thread = std::make_unique< ControlThread >(1);
+	QThread *controlThread                  = thread.get();
+
+	Server *server = thread->server();
+	QVERIFY(server);
+	QCOMPARE(server->iServerNum, 1);
+	QVERIFY(thread->isRunning());
+
+	// The server is constructed on and lives on its control thread
+	QCOMPARE(Server::constructedOn.load(), controlThread);
+	QCOMPARE(server->thread(), controlThread);
+
+	// Only the control thread knows it as its current server
+	QCOMPARE(ControlThread::currentServer(), nullptr);
+	Server *current = nullptr;
+	ControlThread::runOnThreadOf(server, [&current]() { current = ControlThread::currentServer(); });
+	QCOMPARE(current, server);
+
+	thread.reset();
+
+	// The server and the thread's database connection are destroyed on the control thread
+	QCOMPARE(Server::alive.load(), 0);
+	QCOMPARE(Server::destroyedOn.load(), controlThread);
+	QCOMPARE(ServerDB::releasedOn.load(), controlThread);
+}
+
+void TestControlThread::failedBoot() {
+	std::unique_ptr< ControlThread > thread = std::make_unique< ControlThread >(-1);
+	QThread *controlThread                  = thread.get();
+
+	QCOMPARE(thread->server(), nullptr);
+	QCOMPARE(Server::destroyedOn.load(), controlThread);
+	QCOMPARE(Server::alive.load(), 0);
+
+	thread.reset();
+	QCOMPARE(ServerDB::releasedOn.load(), controlThread);
+}
+
+void TestControlThread::rpcCalls() {
+	ControlThread thread(1);
+	QThread *controlThread = &thread;
+	QVERIFY(thread.server());
+
+	QHash< int, ControlThread * > threads;
+	threads.insert(1, &thread);
+
+	std::atomic< QThread * > calledOn{ nullptr };
+	std::atomic< Server * > calledFor{ nullptr };
+	ControlThread::runFor(threads, 1, [&calledOn, &calledFor]() {
+		calledFor = ControlThread::currentServer();
+		calledOn  = QThread::currentThread();
+	});
+	QTRY_COMPARE(calledOn.load(), controlThread);
+	QCOMPARE(calledFor.load(), thread.server());
+
+	// Calls referring to a server without a control thread run right away on the calling thread
+	calledOn  = nullptr;
+	calledFor = nullptr;
+	ControlThread::runFor(threads, 2, [&calledOn, &calledFor]() {
+		calledFor = ControlThread::currentServer();
+		calledOn  = QThread::currentThread();
+	});
+	QCOMPARE(calledOn.load(), QThread::currentThread());
+	QCOMPARE(calledFor.load(), nullptr);
+}
+
+void TestControlThread::callsQueuedBeforeDestruction() {
+	std::unique_ptr< ControlThread > thread = std::make_unique< ControlThread >(1);
+
+	QHash< int, ControlThread * > threads;
+	threads.insert(1, thread.get());
+
+	// Every call queued before the thread is destroyed still finds its server
+	constexpr int CALLS = 100;
+	std::atomic< int > calls{ 0 };
+	std::atomic< bool > valid{ true };
+	for (int i = 0; i < CALLS; ++i) {
+		ControlThread::runFor(threads, 1, [&calls, &valid]() {
+			if (!ControlThread::currentServer() || Server::alive.load() != 1) {
+				valid = false;
+			}
+			++calls;
+		});
+	}
+
+	thread.reset();
+
+	QCOMPARE(calls.load(), CALLS);
+	QVERIFY(valid.load());
+	QCOMPARE(Server::alive.load(), 0);
+}
+
+QTEST_MAIN(TestControlThread)
+#include "TestControlThread.moc"
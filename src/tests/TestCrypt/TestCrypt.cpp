@@ -10,7 +10,13 @@
 #include "Timer.h"
 #include "Utils.h"
 #include "crypto/CryptStateOCB2.h"
+
+#include <openssl/evp.h>
+
+#include <array>
+#include <random>
 #include <string>
+#include <vector>
 
 class TestCrypt : public QObject {
 	Q_OBJECT
@@ -23,8 +29,198 @@ private slots:
 	void ivrecovery();
 	void reverserecovery();
 	void tamper();
+	void matchesReference();
+	void matchesReferenceAfterRekey();
 };
 
+namespace {
+/// A straightforward block-by-block implementation of OCB2-AES128 (including the counter-cryptanalysis against the
+/// XEX* attack) that CryptStateOCB2 has to be bit-exact with
+class ReferenceOCB2 {
+public:
+	using Block = std::array< unsigned char, AES_BLOCK_SIZE >;
+
+	explicit ReferenceOCB2(const std::string &rawKey) { memcpy(m_key, rawKey.data(), AES_KEY_SIZE_BYTES); }
+
+	bool encrypt(const unsigned char *plain, unsigned char *encrypted, unsigned int len, const unsigned char *nonce,
+				 unsigned char *tag, bool modifyPlainOnXEXStarAttack) const {
+		Block delta    = aes(toBlock(nonce), true);
+		Block checksum = {};
+		bool success   = true;
+
+		while (len > AES_BLOCK_SIZE) {
+			Block block = toBlock(plain);
+
+			if (len <= 2 * AES_BLOCK_SIZE && isCritical(block)) {
+				if (modifyPlainOnXEXStarAttack) {
+					block[0] ^= 1;
+				} else {
+					success = false;
+				}
+			}
+
+			times2(delta);
+			checksum = xorBlocks(checksum, block);
+			block    = xorBlocks(delta, aes(xorBlocks(delta, block), true));
+			memcpy(encrypted, block.data(), AES_BLOCK_SIZE);
+
+			len -= AES_BLOCK_SIZE;
+			plain += AES_BLOCK_SIZE;
+			encrypted += AES_BLOCK_SIZE;
+		}
+
+		times2(delta);
+		const Block pad = aes(xorBlocks(delta, lengthBlock(len)), true);
+		Block last      = pad;
+		memcpy(last.data(), plain, len);
+		checksum = xorBlocks(checksum, last);
+		last     = xorBlocks(last, pad);
+		memcpy(encrypted, last.data(), len);
+
+		finish(delta, checksum, tag);
+
+		return success;
+	}
+
+	bool decrypt(const unsigned char *encrypted, unsigned char *plain, unsigned int len, const unsigned char *nonce,
+				 unsigned char *tag) const {
+		Block delta    = aes(toBlock(nonce), true);
+		Block checksum = {};
+
+		while (len > AES_BLOCK_SIZE) {
+			times2(delta);
+			const Block block = xorBlocks(delta, aes(xorBlocks(delta, toBlock(encrypted)), false));
+			checksum          = xorBlocks(checksum, block);
+			memcpy(plain, block.data(), AES_BLOCK_SIZE);
+
+			len -= AES_BLOCK_SIZE;
+			plain += AES_BLOCK_SIZE;
+			encrypted += AES_BLOCK_SIZE;
+		}
+
+		times2(delta);
+		const Block pad = aes(xorBlocks(delta, lengthBlock(len)), true);
+		Block last      = {};
+		memcpy(last.data(), encrypted, len);
+		last     = xorBlocks(last, pad);
+		checksum = xorBlocks(checksum, last);
+		memcpy(plain, last.data(), len);
+
+		const bool success = memcmp(last.data(), delta.data(), AES_BLOCK_SIZE - 1) != 0;
+
+		finish(delta, checksum, tag);
+
+		return success;
+	}
+
+protected:
+	unsigned char m_key[AES_KEY_SIZE_BYTES];
+
+	static Block toBlock(const unsigned char *data) {
+		Block block;
+		memcpy(block.data(), data, AES_BLOCK_SIZE);
+		return block;
+	}
+
+	static Block xorBlocks(const Block &a, const Block &b) {
+		Block result;
+		for (int i = 0; i < AES_BLOCK_SIZE; ++i) {
+			result[i] = a[i] ^ b[i];
+		}
+		return result;
+	}
+
+	static Block lengthBlock(unsigned int len) {
+		Block block               = {};
+		block[AES_BLOCK_SIZE - 1] = static_cast< unsigned char >(len * 8);
+		return block;
+	}
+
+	/// Multiplication by x in GF(2^128)
+	static void times2(Block &block) {
+		const unsigned char carry = block[0] >> 7;
+		for (int i = 0; i < AES_BLOCK_SIZE - 1; ++i) {
+			block[i] = static_cast< unsigned char >((block[i] << 1) | (block[i + 1] >> 7));
+		}
+		block[AES_BLOCK_SIZE - 1] = static_cast< unsigned char >((block[AES_BLOCK_SIZE - 1] << 1) ^ (carry * 0x87));
+	}
+
+	static bool isCritical(const Block &block) {
+		for (int i = 0; i < AES_BLOCK_SIZE - 1; ++i) {
+			if (block[i] != 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void finish(Block delta, const Block &checksum, unsigned char *tag) const {
+		// Multiplication by x + 1
+		Block doubled = delta;
+		times2(doubled);
+		delta = xorBlocks(delta, doubled);
+
+		const Block result = aes(xorBlocks(delta, checksum), true);
+		memcpy(tag, result.data(), AES_BLOCK_SIZE);
+	}
+
+	Block aes(const Block &src, bool encrypt) const {
+		Block dst;
+		int outlen = 0;
+
+		EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+		EVP_CipherInit_ex(ctx, EVP_aes_128_ecb(), nullptr, m_key, nullptr, encrypt ? 1 : 0);
+		EVP_CIPHER_CTX_set_padding(ctx, 0);
+		EVP_CipherUpdate(ctx, dst.data(), &outlen, src.data(), AES_BLOCK_SIZE);
+		EVP_CIPHER_CTX_free(ctx);
+
+		return dst;
+	}
+};
+
+std::vector< unsigned char > randomBytes(std::mt19937 &rng, std::size_t size) {
+	std::uniform_int_distribution< int > byte(0, 0xFF);
+
+	std::vector< unsigned char > data(size);
+	for (unsigned char &current : data) {
+		current = static_cast< unsigned char >(byte(rng));
+	}
+
+	return data;
+}
+
+void verifyMatchesReference(CryptStateOCB2 &cs, std::mt19937 &rng, unsigned int len) {
+	const ReferenceOCB2 reference(cs.getRawKey());
+	const std::vector< unsigned char > nonce = randomBytes(rng, AES_BLOCK_SIZE);
+	std::vector< unsigned char > plain       = randomBytes(rng, len);
+
+	// Every third message has a last full block that triggers the counter-cryptanalysis against the XEX* attack
+	if (len > AES_BLOCK_SIZE && len % 3 == 0) {
+		const unsigned int lastFullBlock = ((len - 1) / AES_BLOCK_SIZE - 1) * AES_BLOCK_SIZE;
+		memset(plain.data() + lastFullBlock, 0, AES_BLOCK_SIZE - 1);
+	}
+
+	std::vector< unsigned char > actual(len);
+	std::vector< unsigned char > expected(len);
+	unsigned char actualTag[AES_BLOCK_SIZE];
+	unsigned char expectedTag[AES_BLOCK_SIZE];
+
+	for (bool modifyPlain : { true, false }) {
+		QCOMPARE(cs.ocb_encrypt(plain.data(), actual.data(), len, nonce.data(), actualTag, modifyPlain),
+				 reference.encrypt(plain.data(), expected.data(), len, nonce.data(), expectedTag, modifyPlain));
+		QCOMPARE(actual, expected);
+		QVERIFY(memcmp(actualTag, expectedTag, AES_BLOCK_SIZE) == 0);
+	}
+
+	// Decrypting arbitrary data has to yield the same result as well
+	const std::vector< unsigned char > garbage = randomBytes(rng, len);
+	QCOMPARE(cs.ocb_decrypt(garbage.data(), actual.data(), len, nonce.data(), actualTag),
+			 reference.decrypt(garbage.data(), expected.data(), len, nonce.data(), expectedTag));
+	QCOMPARE(actual, expected);
+	QVERIFY(memcmp(actualTag, expectedTag, AES_BLOCK_SIZE) == 0);
+}
+} // namespace
+
 void TestCrypt::initTestCase() {
 	MumbleSSL::initialize();
 }
@@ -301,5 +497,39 @@ void TestCrypt::tamper() {
 	QVERIFY(cs.decrypt(encrypted.data(), decrypted.data(), len + 4));
 }
 
+void TestCrypt::matchesReference() {
+	std::mt19937 rng(42);
+
+	CryptStateOCB2 cs;
+	cs.genKey();
+
+	// Covers messages that need more than one pass through AES (which happens in chunks of multiple blocks) as well
+	// as all possible lengths of the final block
+	for (unsigned int len = 0; len <= 1100; ++len) {
+		verifyMatchesReference(cs, rng, len);
+	}
+}
+
+void TestCrypt::matchesReferenceAfterRekey() {
+	std::mt19937 rng(1337);
+
+	CryptStateOCB2 cs;
+	cs.genKey();
+	verifyMatchesReference(cs, rng, 100);
+
+	// The cipher contexts have to pick up a changed key
+	std::vector< unsigned char > key = randomBytes(rng, AES_KEY_SIZE_BYTES);
+	QVERIFY(cs.setRawKey(std::string(reinterpret_cast< const char * >(key.data()), key.size())));
+	verifyMatchesReference(cs, rng, 100);
+
+	key = randomBytes(rng, AES_KEY_SIZE_BYTES);
+	QVERIFY(cs.setKey(std::string(reinterpret_cast< const char * >(key.data()), key.size()), cs.getEncryptIV(),
+					  cs.getDecryptIV()));
+	verifyMatchesReference(cs, rng, 100);
+
+	cs.genKey();
+	verifyMatchesReference(cs, rng, 100);
+}
+
 QTEST_MAIN(TestCrypt)
 #include "TestCrypt.moc"
@@ -0,0 +1,195 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "DBWriter.h"
+
+#include <memory>
+#include <vector>
+
+/// Stands in for the database: records the values written and the number of transactions
+struct FakeDatabase {
+	QRecursiveMutex mutex;
+	std::vector< int > values;
+	std::vector< QThread * > threads;
+	int transactions = 0;
+
+	DBWriter::Transaction transaction() {
+		return [this](const std::function< void() > &body) {
+			QMutexLocker< QRecursiveMutex > lock(&mutex);
+			++transactions;
+			body();
+		};
+	}
+
+	DBWriter::Write write(int value) {
+		return [this, value]() {
+			values.push_back(value);
+			threads.push_back(QThread::currentThread());
+		};
+	}
+
+	std::size_t size() {
+		QMutexLocker< QRecursiveMutex > lock(&mutex);
+		return values.size();
+	}
+};
+
+class TestDBWriter : public QObject {
+	Q_OBJECT
+private slots:
+	void order();
+	void batching();
+	void coalescing();
+	void drain();
+	void overflow();
+	void shutdown();
+	void prometheus();
+};
+
+void TestDBWriter::order() {
+	FakeDatabase db;
+	DBWriter writer(db.transaction(), 1000, 0);
+
+	for (int i = 0; i < 100; ++i) {
+		writer.enqueue(db.write(i));
+	}
+
+	QTRY_COMPARE(db.size(), std::size_t(100));
+	QMutexLocker< QRecursiveMutex > lock(&db.mutex);
+	for (int i = 0; i < 100; ++i) {
+		QCOMPARE(db.values[static_cast< std::size_t >(i)], i);
+		QVERIFY(db.threads[static_cast< std::size_t >(i)] != QThread::currentThread());
+	}
+}
+
+void TestDBWriter::batching() {
+	FakeDatabase db;
+	DBWriter writer(db.transaction(), 1000, 500);
+
+	for (int i = 0; i < 10; ++i) {
+		writer.enqueue(db.write(i));
+	}
+
+	QTRY_COMPARE(db.size(), std::size_t(10));
+	QMutexLocker< QRecursiveMutex > lock(&db.mutex);
+	QCOMPARE(db.transactions, 1);
+
+	const DBWriterMetrics metrics = writer.metrics();
+	QCOMPARE(metrics.enqueued, std::uint64_t(10));
+	QCOMPARE(metrics.committed, std::uint64_t(10));
+	QCOMPARE(metrics.queued, std::uint64_t(0));
+	QCOMPARE(metrics.commitTime.count(), std::uint64_t(1));
+}
+
+void TestDBWriter::coalescing() {
+	FakeDatabase db;
+	DBWriter writer(db.transaction(), 100, 60000);
+
+	writer.enqueue(db.write(1), QLatin1String("a"));
+	writer.enqueue(db.write(2));
+	writer.enqueue(db.write(3), QLatin1String("b"));
+	writer.enqueue(db.write(4), QLatin1String("a"));
+	writer.enqueue(db.write(5), QLatin1String("a"));
+	QCOMPARE(writer.metrics().queued, std::uint64_t(3));
+
+	writer.flush();
+
+	// A replaced write takes the place of the latest one
+	QCOMPARE(db.values, (std::vector< int >{ 2, 3, 5 }));
+
+	// The same key may be used again once the write has been committed
+	writer.enqueue(db.write(6), QLatin1String("a"));
+	writer.flush();
+	QCOMPARE(db.values, (std::vector< int >{ 2, 3, 5, 6 }));
+
+	const DBWriterMetrics metrics = writer.metrics();
+	QCOMPARE(metrics.enqueued, std::uint64_t(6));
+	QCOMPARE(metrics.coalesced, std::uint64_t(2));
+	QCOMPARE(metrics.committed, std::uint64_t(4));
+}
+
+void TestDBWriter::drain() {
+	FakeDatabase db;
+	DBWriter writer(db.transaction(), 100, 60000);
+
+	writer.enqueue(db.write(1));
+	writer.enqueue(db.write(2));
+
+	// Any transaction executes the queued writes before doing anything else
+	unsigned int executed = 0;
+	db.transaction()([&]() {
+		executed = writer.drain();
+		db.values.push_back(3);
+	});
+
+	QCOMPARE(executed, 2U);
+	QCOMPARE(db.values, (std::vector< int >{ 1, 2, 3 }));
+	QCOMPARE(db.threads[0], QThread::currentThread());
+	QCOMPARE(writer.metrics().queued, std::uint64_t(0));
+}
+
+void TestDBWriter::overflow() {
+	FakeDatabase db;
+	DBWriter writer(db.transaction(), 2, 0);
+
+	{
+		// Keeps the writer from committing
+		QMutexLocker< QRecursiveMutex > lock(&db.mutex);
+
+		writer.enqueue(db.write(1));
+		writer.enqueue(db.write(2));
+		QVERIFY(db.values.empty());
+
+		// Executes the queued writes first
+		writer.enqueue(db.write(3));
+		QCOMPARE(db.values, (std::vector< int >{ 1, 2, 3 }));
+		QCOMPARE(db.threads[2], QThread::currentThread());
+	}
+
+	const DBWriterMetrics metrics = writer.metrics();
+	QCOMPARE(metrics.overflows, std::uint64_t(1));
+	QCOMPARE(metrics.committed, std::uint64_t(3));
+}
+
+void TestDBWriter::shutdown() {
+	FakeDatabase db;
+	QThread *cleanedUp = nullptr;
+
+	auto writer = std::make_unique< DBWriter >(db.transaction(), 100, 60000,
+												[&cleanedUp]() { cleanedUp = QThread::currentThread(); });
+	writer->enqueue(db.write(1));
+	writer->enqueue(db.write(2));
+	writer.reset();
+
+	// The writer's thread commits everything before it exits
+	QCOMPARE(db.values, (std::vector< int >{ 1, 2 }));
+	QCOMPARE(db.transactions, 1);
+	QVERIFY(cleanedUp);
+	QCOMPARE(db.threads[0], cleanedUp);
+}
+
+void TestDBWriter::prometheus() {
+	DBWriterMetrics metrics;
+	metrics.queued    = 3;
+	metrics.coalesced = 7;
+	metrics.commitTime.buckets.resize(DBWriter::CommitHistogram::BUCKET_COUNT, 0);
+	metrics.commitTime.buckets[DBWriter::CommitHistogram::bucketIndex(1500)] = 2;
+	metrics.commitTime.sum                                                     = 3000;
+
+	const QString text = QString::fromStdString(DBWriter::toPrometheus(metrics));
+	QVERIFY(text.contains(QLatin1String("# TYPE murmur_db_writes_queued gauge\nmurmur_db_writes_queued 3\n")));
+	QVERIFY(text.contains(QLatin1String("murmur_db_writes_coalesced_total 7\n")));
+	QVERIFY(text.contains(QLatin1String("murmur_db_write_commit_seconds_bucket{le=\"0.001023\"} 0\n")));
+	QVERIFY(text.contains(QLatin1String("murmur_db_write_commit_seconds_bucket{le=\"0.001535\"} 2\n")));
+	QVERIFY(text.contains(QLatin1String("murmur_db_write_commit_seconds_bucket{le=\"+Inf\"} 2\n")));
+	QVERIFY(text.contains(QLatin1String("murmur_db_write_commit_seconds_sum 0.003\n")));
+	QVERIFY(text.contains(QLatin1String("murmur_db_write_commit_seconds_count 2\n")));
+}
+
+QTEST_MAIN(TestDBWriter)
+#include "TestDBWriter.moc"
@@ -0,0 +1,197 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QRandomGenerator>
+#include <QXmlStreamReader>
+#include <QtCore>
+#include <QtTest>
+
+#include "HTMLFilter.h"
+
+#include <string>
+
+class TestHTMLFilter : public QObject {
+	Q_OBJECT
+private slots:
+	void wellFormed_data();
+	void wellFormed();
+	void lengths();
+	void plainText_data();
+	void plainText();
+	void fuzz();
+	void benchmark_data();
+	void benchmark();
+};
+
+void TestHTMLFilter::wellFormed_data() {
+	QTest::addColumn< QString >("html");
+	QTest::addColumn< bool >("wellFormed");
+
+	QTest::newRow("text") << QString::fromLatin1("Hello > world") << true;
+	QTest::newRow("elements") << QString::fromLatin1("<p>a<b>b</b><br/><br /></p>") << true;
+	QTest::newRow("attributes") << QString::fromLatin1("<a href=\"x\" title = 'y'>a</a>") << true;
+	QTest::newRow("references") << QString::fromLatin1("&amp;&lt;&#60;&#x3c;&nbsp;") << true;
+	QTest::newRow("references in attributes") << QString::fromLatin1("<a title=\"&quot;&#34;\">a</a>") << true;
+	QTest::newRow("comment") << QString::fromLatin1("a<!-- <b> -->b") << true;
+	QTest::newRow("cdata") << QString::fromLatin1("<![CDATA[<b>]]>") << true;
+	QTest::newRow("processing instruction") << QString::fromLatin1("<?pi x?>") << true;
+	QTest::newRow("empty") << QString() << true;
+
+	QTest::newRow("unclosed element") << QString::fromLatin1("<p>a") << false;
+	QTest::newRow("wrong end tag") << QString::fromLatin1("<b><i>a</b></i>") << false;
+	QTest::newRow("stray end tag") << QString::fromLatin1("a</p>") << false;
+	QTest::newRow("unquoted attribute") << QString::fromLatin1("<a href=x>a</a>") << false;
+	QTest::newRow("attribute without value") << QString::fromLatin1("<input disabled/>") << false;
+	QTest::newRow("attributes without space") << QString::fromLatin1("<a x='1'y='2'/>") << false;
+	QTest::newRow("< in attribute") << QString::fromLatin1("<a title='<'/>") << false;
+	QTest::newRow("bare &") << QString::fromLatin1("a & b") << false;
+	QTest::newRow("unterminated reference") << QString::fromLatin1("&amp") << false;
+	QTest::newRow("empty character reference") << QString::fromLatin1("&#;") << false;
+	QTest::newRow("bare <") << QString::fromLatin1("a < b") << false;
+	QTest::newRow("unterminated tag") << QString::fromLatin1("<b") << false;
+	QTest::newRow("unterminated comment") << QString::fromLatin1("<!-- a") << false;
+	QTest::newRow("doctype") << QString::fromLatin1("<!DOCTYPE html>") << false;
+}
+
+void TestHTMLFilter::wellFormed() {
+	QFETCH(QString, html);
+	QFETCH(bool, wellFormed);
+
+	QCOMPARE(HTMLFilter::scan(html.toStdString()).wellFormed, wellFormed);
+}
+
+void TestHTMLFilter::lengths() {
+	// Lengths are counted like QString::length() does
+	const QString text = QString::fromUtf8("h\xc3\xa9llo \xe2\x82\xac \xf0\x9f\x98\x80");
+	HTMLScan scan      = HTMLFilter::scan(text.toStdString());
+	QCOMPARE(scan.length, text.length());
+	QCOMPARE(scan.textLength, text.length());
+
+	// Without embedded images
+	const QString image   = QString::fromLatin1("src=\"data:image/png;base64,") + QString(1000, QLatin1Char('A'))
+						  + QString::fromLatin1("\"");
+	const QString message = QString::fromLatin1("<p>Look: <img ") + image + QString::fromLatin1(" alt='x' /></p>");
+	scan                  = HTMLFilter::scan(message.toStdString());
+	QVERIFY(scan.wellFormed);
+	QCOMPARE(scan.length, message.length());
+	QCOMPARE(scan.textLength, message.length() - image.length());
+
+	// Only the src attributes of images count as images
+	const QString link =
+		QString::fromLatin1("<a src=\"") + QString(1000, QLatin1Char('A')) + QString::fromLatin1("\">a</a>");
+	scan = HTMLFilter::scan(link.toStdString());
+	QCOMPARE(scan.textLength, link.length());
+
+	// As do images in well-formed documents only
+	scan = HTMLFilter::scan((QString::fromLatin1("<p><img ") + image + QString::fromLatin1("/>")).toStdString());
+	QVERIFY(!scan.wellFormed);
+	QCOMPARE(scan.textLength, scan.length);
+}
+
+void TestHTMLFilter::plainText_data() {
+	QTest::addColumn< QString >("html");
+	QTest::addColumn< QString >("plainText");
+
+	QTest::newRow("text") << QString::fromLatin1("  Hello \t\n  world ") << QString::fromLatin1("Hello world");
+	QTest::newRow("no-break space") << QString::fromUtf8("a\xc2\xa0 b") << QString::fromLatin1("a b");
+	QTest::newRow("elements") << QString::fromLatin1("<p>Hello <b>world</b></p>")
+							  << QString::fromLatin1("Hello world");
+	QTest::newRow("line breaks") << QString::fromLatin1("<p>a</p><p>b<br/>c</p>") << QString::fromLatin1("a b c");
+	QTest::newRow("references") << QString::fromLatin1("<b>&lt;b&gt; &amp;</b>")
+								<< QString::fromLatin1("&lt;b&gt; &amp;");
+	QTest::newRow("comment") << QString::fromLatin1("a<!-- b -->c") << QString::fromLatin1("ac");
+	QTest::newRow("cdata") << QString::fromLatin1("<![CDATA[<b>]]>") << QString::fromLatin1("&lt;b&gt;");
+	QTest::newRow(">") << QString::fromLatin1("a > b") << QString::fromLatin1("a &gt; b");
+	QTest::newRow("not well-formed") << QString::fromLatin1(" <b>a  b ") << QString::fromLatin1("&lt;b&gt;a b");
+}
+
+void TestHTMLFilter::plainText() {
+	QFETCH(QString, html);
+	QFETCH(QString, plainText);
+
+	std::string out;
+	const HTMLScan scan = HTMLFilter::scan(html.toStdString(), &out);
+
+	QCOMPARE(QString::fromStdString(out), plainText);
+	QCOMPARE(scan.plainTextLength, plainText.length());
+}
+
+void TestHTMLFilter::fuzz() {
+	// Random documents made of the building blocks of HTML, which are checked against Qt's XML parser and against the
+	// properties the plain-text representation has to have
+	static const char *const pieces[] = {
+		// Markup
+		"<", ">", "/", "=", "\"", "'", "&", ";", "#", "<!--", "-->", "<?", "?>", "<![CDATA[", "]]>",
+		// Names, text and whitespace
+		"x", "p", "br", "img", "src", "a", "60", "amp", " ", "\n", "\xc3\xa9", "\xc2\xa0", "\xf0\x9f\x98\x80",
+	};
+	constexpr int pieceCount = sizeof(pieces) / sizeof(pieces[0]);
+
+	QRandomGenerator random(42);
+	for (int i = 0; i < 100000; ++i) {
+		std::string html;
+		const int length = random.bounded(40);
+		for (int j = 0; j < length; ++j) {
+			html += pieces[random.bounded(pieceCount)];
+		}
+
+		std::string plainText;
+		const HTMLScan scan = HTMLFilter::scan(html, &plainText);
+		const QString text  = QString::fromStdString(html);
+		const QString plain = QString::fromStdString(plainText);
+
+		QCOMPARE(scan.length, text.length());
+		QVERIFY(scan.textLength >= 0 && scan.textLength <= scan.length);
+		QCOMPARE(scan.plainTextLength, plain.length());
+		QCOMPARE(plain, plain.simplified());
+		QVERIFY(!plain.contains(QLatin1Char('<')) && !plain.contains(QLatin1Char('>')));
+
+		// Everything Qt's XML parser accepts is well-formed. The scanner is more lenient, e.g. it accepts HTML
+		// entities.
+		QXmlStreamReader reader(QString::fromLatin1("<document>%1</document>").arg(text));
+		while (!reader.atEnd()) {
+			reader.readNext();
+		}
+		if (!reader.hasError()) {
+			QVERIFY2(scan.wellFormed, html.c_str());
+		}
+	}
+}
+
+void TestHTMLFilter::benchmark_data() {
+	QTest::addColumn< QByteArray >("html");
+
+	QByteArray nested;
+	for (int i = 0; i < 20000; ++i) {
+		nested += "<b>";
+	}
+	for (int i = 0; i < 20000; ++i) {
+		nested += "</b>";
+	}
+	QTest::newRow("nested elements") << nested;
+
+	QByteArray attributes("<a");
+	for (int i = 0; i < 10000; ++i) {
+		attributes += " title='&amp;&#60;'";
+	}
+	QTest::newRow("attributes") << attributes;
+
+	QTest::newRow("bare <") << QByteArray(100000, '<');
+	QTest::newRow("bare &") << QByteArray(100000, '&');
+	QTest::newRow("unterminated comments") << QByteArray("<!--").repeated(25000);
+	QTest::newRow("image") << (QByteArray("<img src=\"data:image/png;base64,") + QByteArray(128 * 1024, 'A')
+							   + QByteArray("\" />"));
+}
+
+void TestHTMLFilter::benchmark() {
+	QFETCH(QByteArray, html);
+
+	const std::string in = html.toStdString();
+	std::string plainText;
+	QBENCHMARK { HTMLFilter::scan(in, &plainText); }
+}
+
+QTEST_MAIN(TestHTMLFilter)
+#include "TestHTMLFilter.moc"
@@ -0,0 +1,187 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtNetwork>
+#include <QtTest>
+
+#include "HandshakePool.h"
+#include "SelfSignedCertificate.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// Hands every incoming connection to a HandshakePool
+class PoolServer : public QTcpServer {
+public:
+	PoolServer(HandshakePool &pool, const QSslCertificate &certificate, const QSslKey &key)
+		: m_pool(pool), m_certificate(certificate), m_key(key) {}
+
+protected:
+	HandshakePool &m_pool;
+	QSslCertificate m_certificate;
+	QSslKey m_key;
+
+	void incomingConnection(qintptr descriptor) override {
+		QSslSocket *socket = new QSslSocket(this);
+		socket->setSocketDescriptor(descriptor);
+		socket->setPrivateKey(m_key);
+		socket->setLocalCertificate(m_certificate);
+		socket->setProtocol(QSsl::TlsV1_2OrLater);
+
+		m_pool.enqueue(socket);
+	}
+};
+
+class TestHandshakePool : public QObject {
+	Q_OBJECT
+private slots:
+	void initTestCase();
+	void checkSslErrors();
+	void handshake();
+	void timeout();
+	void disconnectAfterHandshake();
+	void prometheusFormat();
+
+private:
+	QSslCertificate m_certificate;
+	QSslKey m_key;
+};
+
+void TestHandshakePool::initTestCase() {
+	qRegisterMetaType< QHostAddress >();
+
+	QVERIFY(SelfSignedCertificate::generateMurmurV2Certificate(m_certificate, m_key));
+}
+
+void TestHandshakePool::checkSslErrors() {
+	bool verified = true;
+	QStringList fatalErrors;
+
+	QVERIFY(HandshakePool::checkSslErrors({ QSslError(QSslError::InvalidPurpose) }, verified, fatalErrors));
+	QVERIFY(verified);
+
+	QVERIFY(HandshakePool::checkSslErrors(
+		{ QSslError(QSslError::InvalidPurpose), QSslError(QSslError::SelfSignedCertificate) }, verified, fatalErrors));
+	QVERIFY(!verified);
+	QVERIFY(fatalErrors.isEmpty());
+
+	QVERIFY(!HandshakePool::checkSslErrors(
+		{ QSslError(QSslError::CertificateExpired), QSslError(QSslError::CertificateRevoked) }, verified, fatalErrors));
+	QCOMPARE(fatalErrors.size(), 1);
+}
+
+void TestHandshakePool::handshake() {
+	HandshakePool pool(2, 1, 10000);
+	QSignalSpy completed(&pool, &HandshakePool::handshakeCompleted);
+	QSignalSpy failed(&pool, &HandshakePool::handshakeFailed);
+
+	PoolServer server(pool, m_certificate, m_key);
+	QVERIFY(server.listen(QHostAddress::LocalHost));
+
+	// More clients than the limit permits at once, so that some of them have to be queued
+	std::vector< std::unique_ptr< QSslSocket > > clients;
+	for (int i = 0; i < 3; ++i) {
+		clients.push_back(std::make_unique< QSslSocket >());
+		clients.back()->setPeerVerifyMode(QSslSocket::VerifyNone);
+		clients.back()->connectToHostEncrypted(QStringLiteral("127.0.0.1"), server.serverPort());
+	}
+
+	QTRY_COMPARE(completed.size(), 3);
+	QCOMPARE(failed.size(), 0);
+
+	for (const QList< QVariant > &arguments : completed) {
+		QSslSocket *socket = arguments.at(0).value< QSslSocket * >();
+		QVERIFY(socket->isEncrypted());
+		QCOMPARE(socket->thread(), QThread::currentThread());
+		QCOMPARE(socket->parent(), nullptr);
+		// The clients don't present a certificate
+		QVERIFY(!arguments.at(1).toBool());
+		delete socket;
+	}
+
+	const HandshakeMetricsSnapshot metrics = pool.metrics();
+	QCOMPARE(metrics.completed, std::uint64_t(3));
+	QCOMPARE(metrics.failed, std::uint64_t(0));
+	QCOMPARE(metrics.queued, std::uint64_t(0));
+	QCOMPARE(metrics.inProgress, std::uint64_t(0));
+}
+
+void TestHandshakePool::timeout() {
+	HandshakePool pool(1, 0, 200);
+	QSignalSpy completed(&pool, &HandshakePool::handshakeCompleted);
+	QSignalSpy failed(&pool, &HandshakePool::handshakeFailed);
+
+	PoolServer server(pool, m_certificate, m_key);
+	QVERIFY(server.listen(QHostAddress::LocalHost));
+
+	// Never starts a handshake
+	QTcpSocket client;
+	client.connectToHost(QHostAddress::LocalHost, server.serverPort());
+
+	QTRY_COMPARE(failed.size(), 1);
+	QCOMPARE(completed.size(), 0);
+	QCOMPARE(pool.metrics().failed, std::uint64_t(1));
+}
+
+void TestHandshakePool::disconnectAfterHandshake() {
+	constexpr int CLIENTS = 10;
+
+	HandshakePool pool(2, 0, 10000);
+	QSignalSpy failed(&pool, &HandshakePool::handshakeFailed);
+
+	int completed  = 0;
+	bool connected = true;
+	connect(&pool, &HandshakePool::handshakeCompleted, this, [&completed, &connected](QSslSocket *socket, bool) {
+		// Only sockets that are still connected may be handed over, as nobody would notice them being disconnected
+		// otherwise
+		connected = connected && socket->state() == QAbstractSocket::ConnectedState;
+		++completed;
+		delete socket;
+	});
+
+	PoolServer server(pool, m_certificate, m_key);
+	QVERIFY(server.listen(QHostAddress::LocalHost));
+
+	// The clients disconnect as soon as their handshake completed, so that the disconnect races with the socket
+	// being handed back to the pool's thread
+	std::vector< std::unique_ptr< QSslSocket > > clients;
+	for (int i = 0; i < CLIENTS; ++i) {
+		clients.push_back(std::make_unique< QSslSocket >());
+		QSslSocket *client = clients.back().get();
+		client->setPeerVerifyMode(QSslSocket::VerifyNone);
+		connect(client, &QSslSocket::encrypted, client, &QSslSocket::abort);
+		client->connectToHostEncrypted(QStringLiteral("127.0.0.1"), server.serverPort());
+	}
+
+	QTRY_COMPARE(completed + static_cast< int >(failed.size()), CLIENTS);
+	QVERIFY(connected);
+
+	const HandshakeMetricsSnapshot metrics = pool.metrics();
+	QCOMPARE(metrics.completed + metrics.failed, std::uint64_t(CLIENTS));
+	QCOMPARE(metrics.inProgress, std::uint64_t(0));
+}
+
+void TestHandshakePool::prometheusFormat() {
+	HandshakeMetricsSnapshot snapshot;
+	snapshot.queued        = 4;
+	snapshot.completed     = 10;
+	snapshot.handshakeTime = 2500000;
+
+	const std::vector< std::pair< int, HandshakeMetricsSnapshot > > servers = { { 1, snapshot } };
+	const QString output = QString::fromStdString(HandshakePool::toPrometheus(servers));
+
+	QVERIFY(output.contains("# TYPE murmur_tls_handshakes_queued gauge\n"));
+	QVERIFY(output.contains("murmur_tls_handshakes_queued{server=\"1\"} 4\n"));
+	QVERIFY(output.contains("# TYPE murmur_tls_handshakes_completed_total counter\n"));
+	QVERIFY(output.contains("murmur_tls_handshakes_completed_total{server=\"1\"} 10\n"));
+	QVERIFY(output.contains("murmur_tls_handshake_seconds_total{server=\"1\"} 2.5"));
+}
+
+QTEST_MAIN(TestHandshakePool)
+#include "TestHandshakePool.moc"
@@ -0,0 +1,234 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "LogStore.h"
+
+class TestLogStore : public QObject {
+	Q_OBJECT
+private slots:
+	void readNewestFirst();
+	void segments();
+	void countNewerThan();
+	void retention();
+	void reopen();
+	void recovery();
+	void recoveryOfOlderSegment();
+	void clear();
+};
+
+/// @returns The messages of the given records
+static QStringList messages(const QList< LogStore::Record > &records) {
+	QStringList list;
+	for (const LogStore::Record &record : records) {
+		list << record.message;
+	}
+	return list;
+}
+
+void TestLogStore::readNewestFirst() {
+	QTemporaryDir dir;
+	LogStore store(dir.path(), 1 << 20);
+	QVERIFY(store.open());
+
+	QCOMPARE(store.size(), std::uint64_t(0));
+	QVERIFY(store.read(0, 10).isEmpty());
+
+	store.append(100, QLatin1String("a"));
+	store.append(101, QString::fromUtf8("b\xc3\xa4"));
+	store.append(102, QLatin1String("c"));
+
+	QCOMPARE(store.size(), std::uint64_t(3));
+	QCOMPARE(messages(store.read(0, 10)), (QStringList{ "c", QString::fromUtf8("b\xc3\xa4"), "a" }));
+	QCOMPARE(messages(store.read(1, 1)), QStringList{ QString::fromUtf8("b\xc3\xa4") });
+	QCOMPARE(store.read(2, 1).first().time, std::int64_t(100));
+	QVERIFY(store.read(3, 1).isEmpty());
+}
+
+void TestLogStore::segments() {
+	QTemporaryDir dir;
+	// Every segment holds two records of this size
+	LogStore store(dir.path(), 26);
+	QVERIFY(store.open());
+
+	for (int i = 0; i < 9; ++i) {
+		store.append(i, QString::number(i));
+	}
+
+	QCOMPARE(QDir(dir.path()).entryList({ "*.log" }, QDir::Files).size(), 5);
+	QCOMPARE(store.size(), std::uint64_t(9));
+	QCOMPARE(messages(store.read(2, 5)), (QStringList{ "6", "5", "4", "3", "2" }));
+	QCOMPARE(messages(store.read(8, 5)), QStringList{ "0" });
+}
+
+void TestLogStore::countNewerThan() {
+	QTemporaryDir dir;
+	LogStore store(dir.path(), 26);
+	QVERIFY(store.open());
+
+	QCOMPARE(store.countNewerThan(0), std::uint64_t(0));
+
+	store.append(10, QLatin1String("a"));
+	store.append(20, QLatin1String("b"));
+	store.append(20, QLatin1String("c"));
+	store.append(30, QLatin1String("d"));
+	// Gets the time of the previous record
+	store.append(25, QLatin1String("e"));
+
+	QCOMPARE(store.read(0, 1).first().time, std::int64_t(30));
+
+	QCOMPARE(store.countNewerThan(5), std::uint64_t(5));
+	QCOMPARE(store.countNewerThan(10), std::uint64_t(4));
+	QCOMPARE(store.countNewerThan(19), std::uint64_t(4));
+	QCOMPARE(store.countNewerThan(20), std::uint64_t(2));
+	QCOMPARE(store.countNewerThan(30), std::uint64_t(0));
+
+	// The offset can be passed to read() right away
+	QCOMPARE(messages(store.read(store.countNewerThan(20), 1)), QStringList{ "c" });
+}
+
+void TestLogStore::retention() {
+	QTemporaryDir dir;
+	LogStore store(dir.path(), 26);
+	QVERIFY(store.open());
+
+	for (int i = 0; i < 6; ++i) {
+		store.append(i, QString::number(i));
+	}
+
+	// The segment holding 2 and 3 also holds a record that is new enough
+	store.removeOlderThan(3);
+	QCOMPARE(store.size(), std::uint64_t(4));
+	QCOMPARE(messages(store.read(0, 10)), (QStringList{ "5", "4", "3", "2" }));
+	QCOMPARE(store.countNewerThan(0), std::uint64_t(4));
+
+	// The segment that is appended to is kept
+	store.removeOlderThan(100);
+	QCOMPARE(messages(store.read(0, 10)), (QStringList{ "5", "4" }));
+	QCOMPARE(QDir(dir.path()).entryList({ "*.log" }, QDir::Files).size(), 1);
+}
+
+void TestLogStore::reopen() {
+	QTemporaryDir dir;
+	{
+		LogStore store(dir.path(), 26);
+		QVERIFY(store.open());
+		for (int i = 0; i < 5; ++i) {
+			store.append(i, QString::number(i));
+		}
+		store.removeOlderThan(2);
+	}
+
+	LogStore store(dir.path(), 26);
+	QVERIFY(store.open());
+	QCOMPARE(messages(store.read(0, 10)), (QStringList{ "4", "3", "2" }));
+
+	store.append(5, QLatin1String("5"));
+	QCOMPARE(messages(store.read(0, 2)), (QStringList{ "5", "4" }));
+	QCOMPARE(store.countNewerThan(3), std::uint64_t(2));
+}
+
+void TestLogStore::recovery() {
+	QTemporaryDir dir;
+	QString logPath, indexPath;
+	{
+		LogStore store(dir.path(), 1 << 20);
+		QVERIFY(store.open());
+		for (int i = 0; i < 3; ++i) {
+			store.append(i, QString::number(i));
+		}
+
+		logPath   = dir.filePath(QDir(dir.path()).entryList({ "*.log" }, QDir::Files).first());
+		indexPath = dir.filePath(QDir(dir.path()).entryList({ "*.idx" }, QDir::Files).first());
+	}
+
+	// The last index entry got lost and the last record was only written partially
+	QFile index(indexPath);
+	QVERIFY(index.open(QIODevice::ReadWrite));
+	QVERIFY(index.resize(index.size() - 12));
+	index.close();
+
+	QFile log(logPath);
+	QVERIFY(log.open(QIODevice::Append));
+	log.write(QByteArray(6, '\0'));
+	log.close();
+
+	LogStore store(dir.path(), 1 << 20);
+	QVERIFY(store.open());
+	QCOMPARE(messages(store.read(0, 10)), (QStringList{ "2", "1", "0" }));
+	QCOMPARE(store.countNewerThan(1), std::uint64_t(1));
+
+	store.append(3, QLatin1String("3"));
+	QCOMPARE(messages(store.read(0, 2)), (QStringList{ "3", "2" }));
+}
+
+void TestLogStore::recoveryOfOlderSegment() {
+	QTemporaryDir dir;
+	QStringList logPaths;
+	{
+		LogStore store(dir.path(), 26);
+		QVERIFY(store.open());
+		for (int i = 0; i < 6; ++i) {
+			store.append(i, QString::number(i));
+		}
+
+		for (const QString &name : QDir(dir.path()).entryList({ "*.log" }, QDir::Files)) {
+			logPaths << dir.filePath(name);
+		}
+		QCOMPARE(logPaths.size(), 3);
+	}
+
+	// The second record of the first segment was only written partially and garbage follows the records of the
+	// second one
+	QFile first(logPaths[0]);
+	QVERIFY(first.open(QIODevice::ReadWrite));
+	QVERIFY(first.resize(first.size() - 3));
+	first.close();
+
+	QFile second(logPaths[1]);
+	QVERIFY(second.open(QIODevice::Append));
+	second.write(QByteArray(6, 'x'));
+	second.close();
+
+	LogStore store(dir.path(), 26);
+	QVERIFY(store.open());
+	QCOMPARE(store.size(), std::uint64_t(5));
+	QCOMPARE(messages(store.read(0, 10)), (QStringList{ "5", "4", "3", "2", "0" }));
+	QCOMPARE(messages(store.read(3, 2)), (QStringList{ "2", "0" }));
+	QCOMPARE(store.countNewerThan(1), std::uint64_t(4));
+	QCOMPARE(store.countNewerThan(0), std::uint64_t(4));
+
+	store.append(6, QLatin1String("6"));
+	QCOMPARE(store.size(), std::uint64_t(6));
+	QCOMPARE(messages(store.read(0, 2)), (QStringList{ "6", "5" }));
+
+	// Segments older than the damaged ones are removed as usual
+	store.removeOlderThan(4);
+	QCOMPARE(messages(store.read(0, 10)), (QStringList{ "6", "5", "4" }));
+}
+
+void TestLogStore::clear() {
+	QTemporaryDir dir;
+	LogStore store(dir.path(), 26);
+	QVERIFY(store.open());
+
+	for (int i = 0; i < 5; ++i) {
+		store.append(i, QString::number(i));
+	}
+	store.clear();
+
+	QCOMPARE(store.size(), std::uint64_t(0));
+	store.append(10, QLatin1String("a"));
+	QCOMPARE(messages(store.read(0, 10)), QStringList{ "a" });
+
+	store.remove();
+	QCOMPARE(store.size(), std::uint64_t(0));
+	QVERIFY(!QDir(dir.path()).exists());
+}
+
+QTEST_MAIN(TestLogStore)
+#include "TestLogStore.moc"
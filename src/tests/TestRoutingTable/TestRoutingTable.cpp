@@ -0,0 +1,162 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "RoutingSnapshot.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+class TestRoutingTable : public QObject {
+	Q_OBJECT
+private slots:
+	void publish();
+	void retireWaitsForPublish();
+	void retireWaitsForReaders();
+	void newReadersDontBlockReclamation();
+	void concurrentReaders();
+};
+
+void TestRoutingTable::publish() {
+	RoutingTable table;
+
+	QCOMPARE(table.current().version, static_cast< std::uint64_t >(0));
+	QVERIFY(table.current().users.empty());
+
+	std::unique_ptr< RoutingSnapshot > snapshot = std::make_unique< RoutingSnapshot >();
+	snapshot->userCount                         = 42;
+	table.publish(std::move(snapshot));
+
+	QCOMPARE(table.current().version, static_cast< std::uint64_t >(1));
+	QCOMPARE(table.current().userCount, 42U);
+
+	RoutingTable::ReadGuard guard(table, 0);
+	QCOMPARE(guard->userCount, 42U);
+}
+
+void TestRoutingTable::retireWaitsForPublish() {
+	RoutingTable table;
+	bool disposed = false;
+
+	table.retire([&disposed]() { disposed = true; });
+
+	// The object might still be referenced by the current snapshot
+	QVERIFY(table.reclaim());
+	QVERIFY(!disposed);
+
+	table.publish(std::make_unique< RoutingSnapshot >());
+	QVERIFY(disposed);
+	QVERIFY(!table.reclaim());
+}
+
+void TestRoutingTable::retireWaitsForReaders() {
+	RoutingTable table;
+	bool disposed = false;
+
+	{
+		RoutingTable::ReadGuard guard(table, 3);
+
+		table.retire([&disposed]() { disposed = true; });
+		table.publish(std::make_unique< RoutingSnapshot >());
+
+		// The reader might still see the retired object (and does still see the previous snapshot)
+		QVERIFY(!disposed);
+		QCOMPARE(guard->version, static_cast< std::uint64_t >(0));
+		QVERIFY(table.reclaim());
+	}
+
+	QVERIFY(!table.reclaim());
+	QVERIFY(disposed);
+}
+
+void TestRoutingTable::newReadersDontBlockReclamation() {
+	RoutingTable table;
+	bool disposed = false;
+
+	table.retire([&disposed]() { disposed = true; });
+	table.publish(std::make_unique< RoutingSnapshot >());
+	QVERIFY(disposed);
+
+	disposed = false;
+	table.retire([&disposed]() { disposed = true; });
+
+	std::unique_ptr< RoutingTable::ReadGuard > oldReader = std::make_unique< RoutingTable::ReadGuard >(table, 0);
+	table.publish(std::make_unique< RoutingSnapshot >());
+	QVERIFY(!disposed);
+
+	// A reader that entered after the publish can't see the retired object
+	RoutingTable::ReadGuard newReader(table, 1);
+	QCOMPARE(newReader->version, static_cast< std::uint64_t >(2));
+
+	oldReader.reset();
+	QVERIFY(!table.reclaim());
+	QVERIFY(disposed);
+}
+
+void TestRoutingTable::concurrentReaders() {
+	constexpr unsigned int READER_COUNT = 4;
+	constexpr unsigned int PUBLISHES    = 2000;
+
+	// Every snapshot contains exactly one user whose session matches the snapshot's user count
+	auto createSnapshot = [](unsigned int session) {
+		std::unique_ptr< RoutingSnapshot > snapshot = std::make_unique< RoutingSnapshot >();
+		snapshot->userCount                         = session;
+
+		RoutingSnapshot::UserEntry entry;
+		entry.user     = nullptr;
+		entry.session  = session;
+		entry.channel  = 0;
+		entry.canSpeak = true;
+		entry.deaf     = false;
+		snapshot->users.emplace(session, std::move(entry));
+
+		return snapshot;
+	};
+
+	RoutingTable table;
+	table.publish(createSnapshot(0));
+
+	std::atomic< bool > stop(false);
+	std::atomic< bool > failed(false);
+
+	std::vector< std::thread > readers;
+	for (unsigned int i = 0; i < READER_COUNT; ++i) {
+		readers.emplace_back([&table, &stop, &failed, i]() {
+			std::uint64_t lastVersion = 0;
+
+			while (!stop.load()) {
+				RoutingTable::ReadGuard guard(table, i);
+
+				// Reading a snapshot that has already been disposed of would (most likely) break this
+				const RoutingSnapshot::UserEntry *user = guard->findUser(guard->userCount);
+				if (!user || user->session != guard->userCount || guard->version < lastVersion) {
+					failed = true;
+				}
+
+				lastVersion = guard->version;
+			}
+		});
+	}
+
+	for (unsigned int i = 1; i <= PUBLISHES; ++i) {
+		table.publish(createSnapshot(i));
+	}
+
+	stop = true;
+	for (std::thread &reader : readers) {
+		reader.join();
+	}
+
+	QVERIFY(!failed.load());
+	QVERIFY(!table.reclaim());
+	QCOMPARE(table.current().version, static_cast< std::uint64_t >(PUBLISHES + 1));
+}
+
+QTEST_MAIN(TestRoutingTable)
+#include "TestRoutingTable.moc"
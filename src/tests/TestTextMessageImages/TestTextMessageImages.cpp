@@ -0,0 +1,118 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "BlobStore.h"
+#include "TextMessageImages.h"
+
+class TestTextMessageImages : public QObject {
+	Q_OBJECT
+private slots:
+	void offload();
+	void keepSmallImages();
+	void leaveOtherContent();
+	void disabled();
+	void capacity();
+};
+
+/// @returns The given image embedded the way clients do it
+static QString img(const QByteArray &image, const QString &quote = QLatin1String("\"")) {
+	return QString::fromLatin1("<img src=%1data:image/png;base64,%2%1 />")
+		.arg(quote, QString::fromLatin1(image.toBase64()));
+}
+
+/// @returns The reference to the given image
+static QString reference(const QByteArray &image) {
+	return TextMessageImages::reference(QCryptographicHash::hash(image, QCryptographicHash::Sha1));
+}
+
+void TestTextMessageImages::offload() {
+	BlobStore store(1 << 20, QString());
+	TextMessageImages images(store, 10);
+
+	const QByteArray first(2000, 'a');
+	const QByteArray second(3000, 'b');
+
+	const QString message = QLatin1String("<p>Look:</p>") + img(first) + QLatin1String(" and ")
+							+ img(second, QLatin1String("'")) + QLatin1String("<b>!</b>");
+	const QString compact = images.offload(message);
+
+	QCOMPARE(compact, QLatin1String("<p>Look:</p><img src=\"") + reference(first)
+						  + QLatin1String("\" /> and <img src='") + reference(second) + QLatin1String("' /><b>!</b>"));
+	QVERIFY(reference(first).startsWith(QLatin1String("mumble-image:")));
+
+	QCOMPARE(images.find(QCryptographicHash::hash(first, QCryptographicHash::Sha1)), first);
+	QCOMPARE(images.find(QCryptographicHash::hash(second, QCryptographicHash::Sha1)), second);
+	QVERIFY(images.find(QByteArray(20, 'x')).isEmpty());
+	QCOMPARE(store.metrics().blobs, std::uint64_t(2));
+}
+
+void TestTextMessageImages::keepSmallImages() {
+	BlobStore store(1 << 20, QString());
+	TextMessageImages images(store, 10);
+
+	const QByteArray small(TextMessageImages::MIN_IMAGE_SIZE - 1, 'a');
+	const QByteArray large(TextMessageImages::MIN_IMAGE_SIZE, 'b');
+
+	QVERIFY(images.offload(img(small)).isNull());
+	QCOMPARE(images.offload(img(small) + img(large)), img(small) + QLatin1String("<img src=\"") + reference(large)
+														  + QLatin1String("\" />"));
+	QCOMPARE(store.metrics().blobs, std::uint64_t(1));
+}
+
+void TestTextMessageImages::leaveOtherContent() {
+	BlobStore store(1 << 20, QString());
+	TextMessageImages images(store, 10);
+
+	const QString base64 = QString::fromLatin1(QByteArray(2000, 'a').toBase64());
+
+	// Not an image, not a data URL, not valid base64, not within an img element
+	QVERIFY(images.offload(QLatin1String("<img src=\"data:text/plain;base64,") + base64 + QLatin1String("\" />"))
+				.isNull());
+	QVERIFY(images.offload(QLatin1String("<img src=\"https://example.com/a.png\" />")).isNull());
+	QVERIFY(images.offload(QLatin1String("<img src=\"data:image/png;base64,#") + base64 + QLatin1String("\" />"))
+				.isNull());
+	QVERIFY(images.offload(QLatin1String("<a href=\"data:image/png;base64,") + base64 + QLatin1String("\">a</a>"))
+				.isNull());
+	QVERIFY(images.offload(QLatin1String("data:image/png;base64,") + base64).isNull());
+
+	QCOMPARE(store.metrics().blobs, std::uint64_t(0));
+}
+
+void TestTextMessageImages::disabled() {
+	BlobStore store(1 << 20, QString());
+	TextMessageImages images(store, 0);
+
+	QVERIFY(!images.isEnabled());
+	QVERIFY(images.offload(img(QByteArray(2000, 'a'))).isNull());
+	QCOMPARE(store.metrics().blobs, std::uint64_t(0));
+}
+
+void TestTextMessageImages::capacity() {
+	BlobStore store(1 << 20, QString());
+	TextMessageImages images(store, 2);
+
+	const QByteArray a(2000, 'a');
+	const QByteArray b(2000, 'b');
+	const QByteArray c(2000, 'c');
+
+	images.offload(img(a));
+	images.offload(img(b));
+	// Sending a again makes b the oldest image
+	images.offload(img(a));
+	images.offload(img(c));
+
+	QCOMPARE(images.find(QCryptographicHash::hash(a, QCryptographicHash::Sha1)), a);
+	QVERIFY(images.find(QCryptographicHash::hash(b, QCryptographicHash::Sha1)).isEmpty());
+	QCOMPARE(images.find(QCryptographicHash::hash(c, QCryptographicHash::Sha1)), c);
+
+	// Images that aren't kept anymore are removed from the store
+	QCOMPARE(store.metrics().blobs, std::uint64_t(2));
+}
+
+QTEST_MAIN(TestTextMessageImages)
+#include "TestTextMessageImages.moc"
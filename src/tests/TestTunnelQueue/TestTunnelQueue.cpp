@@ -0,0 +1,309 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "TunnelQueue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+namespace {
+/// Splits the framed messages in the given buffer into their payloads, which are appended to packets
+/// @returns false if the buffer contains anything but complete UDPTunnel messages
+bool parse(const QByteArray &buffer, QList< QByteArray > &packets) {
+	qsizetype offset = 0;
+	while (offset < buffer.size()) {
+		if (buffer.size() - offset < static_cast< qsizetype >(TunnelQueue::HEADER_SIZE)) {
+			return false;
+		}
+
+		const unsigned char *header = reinterpret_cast< const unsigned char * >(buffer.constData() + offset);
+		const quint16 type          = qFromBigEndian< quint16 >(header);
+		const quint32 length        = qFromBigEndian< quint32 >(header + 2);
+		offset += static_cast< qsizetype >(TunnelQueue::HEADER_SIZE);
+
+		if (type != static_cast< quint16 >(Mumble::Protocol::TCPMessageType::UDPTunnel)
+			|| buffer.size() - offset < static_cast< qsizetype >(length)) {
+			return false;
+		}
+
+		packets << buffer.mid(offset, static_cast< qsizetype >(length));
+		offset += static_cast< qsizetype >(length);
+	}
+
+	return true;
+}
+
+constexpr qsizetype MAX_SIZE = static_cast< qsizetype >(TunnelQueue::MAX_PACKET_SIZE);
+
+bool push(TunnelQueue &queue, const QByteArray &packet) {
+	return queue.push(reinterpret_cast< const unsigned char * >(packet.constData()),
+					  static_cast< std::size_t >(packet.size()));
+}
+} // namespace
+
+class TestTunnelQueue : public QObject {
+	Q_OBJECT
+private slots:
+	void framing();
+	void full();
+	void oversized();
+	void wraparound();
+	void pending();
+	void concurrentProducers();
+	void pendingSessions();
+	void concurrentPendingSessions();
+};
+
+void TestTunnelQueue::framing() {
+	TunnelQueue queue(8);
+
+	QVERIFY(push(queue, QByteArray("first")));
+	QVERIFY(push(queue, QByteArray()));
+	QVERIFY(push(queue, QByteArray(MAX_SIZE, 'x')));
+
+	QByteArray buffer("existing");
+	QCOMPARE(queue.drain(buffer), static_cast< std::size_t >(3));
+	QVERIFY(buffer.startsWith("existing"));
+
+	QList< QByteArray > packets;
+	QVERIFY(parse(buffer.mid(8), packets));
+	QCOMPARE(packets.size(), 3);
+	QCOMPARE(packets[0], QByteArray("first"));
+	QCOMPARE(packets[1], QByteArray());
+	QCOMPARE(packets[2], QByteArray(MAX_SIZE, 'x'));
+
+	// Drained packets are gone
+	buffer.clear();
+	QCOMPARE(queue.drain(buffer), static_cast< std::size_t >(0));
+	QVERIFY(buffer.isEmpty());
+}
+
+void TestTunnelQueue::full() {
+	// The capacity is rounded up to a power of two
+	TunnelQueue queue(3);
+
+	for (int i = 0; i < 4; ++i) {
+		QVERIFY(push(queue, QByteArray::number(i)));
+	}
+	QVERIFY(!push(queue, QByteArray("dropped")));
+
+	QByteArray buffer;
+	QCOMPARE(queue.drain(buffer), static_cast< std::size_t >(4));
+
+	QList< QByteArray > packets;
+	QVERIFY(parse(buffer, packets));
+	QCOMPARE(packets, QList< QByteArray >({ "0", "1", "2", "3" }));
+
+	// Draining makes room again
+	QVERIFY(push(queue, QByteArray("accepted")));
+}
+
+void TestTunnelQueue::oversized() {
+	TunnelQueue queue(4);
+
+	QVERIFY(!push(queue, QByteArray(MAX_SIZE + 1, 'x')));
+
+	QByteArray buffer;
+	QCOMPARE(queue.drain(buffer), static_cast< std::size_t >(0));
+}
+
+void TestTunnelQueue::wraparound() {
+	TunnelQueue queue(4);
+
+	int next = 0;
+	for (int round = 0; round < 100; ++round) {
+		// Varying numbers of packets, so that the positions don't stay aligned with the cells
+		const int count = 1 + round % 4;
+		for (int i = 0; i < count; ++i) {
+			QVERIFY(push(queue, QByteArray::number(next + i)));
+		}
+
+		QByteArray buffer;
+		QCOMPARE(queue.drain(buffer), static_cast< std::size_t >(count));
+
+		QList< QByteArray > packets;
+		QVERIFY(parse(buffer, packets));
+		QCOMPARE(packets.size(), count);
+		for (int i = 0; i < count; ++i) {
+			QCOMPARE(packets[i], QByteArray::number(next + i));
+		}
+
+		next += count;
+	}
+}
+
+void TestTunnelQueue::pending() {
+	TunnelQueue queue(4);
+
+	QVERIFY(!queue.takePending());
+
+	// Only the first mark asks for a drain
+	QVERIFY(queue.markPending());
+	QVERIFY(!queue.markPending());
+
+	QVERIFY(queue.takePending());
+	QVERIFY(!queue.takePending());
+
+	QVERIFY(queue.markPending());
+}
+
+void TestTunnelQueue::concurrentProducers() {
+	constexpr int PRODUCERS = 4;
+	constexpr int PACKETS   = 20000;
+
+	TunnelQueue queue(64);
+	std::atomic< int > dropped(0);
+
+	std::vector< std::thread > producers;
+	for (int p = 0; p < PRODUCERS; ++p) {
+		producers.emplace_back([&queue, &dropped, p]() {
+			for (int i = 0; i < PACKETS; ++i) {
+				// Packets of varying sizes that identify their producer and their position
+				QByteArray packet(i % 200, static_cast< char >('a' + p));
+				packet.prepend(QByteArray::number(p) + ":" + QByteArray::number(i) + ":");
+				if (!push(queue, packet)) {
+					++dropped;
+				}
+				queue.markPending();
+			}
+		});
+	}
+
+	std::atomic< bool > done(false);
+	std::thread joiner([&producers, &done]() {
+		for (std::thread &producer : producers) {
+			producer.join();
+		}
+		done = true;
+	});
+
+	int received = 0;
+	int last[PRODUCERS];
+	std::fill(std::begin(last), std::end(last), -1);
+	bool valid = true;
+
+	while (true) {
+		const bool finished = done.load();
+
+		queue.takePending();
+		QByteArray buffer;
+		queue.drain(buffer);
+
+		QList< QByteArray > packets;
+		valid = valid && parse(buffer, packets);
+		for (const QByteArray &packet : packets) {
+			const QList< QByteArray > parts = packet.split(':');
+			const int p                     = parts.value(0).toInt();
+			const int i                     = parts.value(1).toInt();
+
+			// Every producer's packets arrive intact and in order
+			if (parts.size() != 3 || p < 0 || p >= PRODUCERS || i <= last[p]
+				|| parts[2] != QByteArray(i % 200, static_cast< char >('a' + p))) {
+				valid = false;
+				continue;
+			}
+			last[p] = i;
+		}
+		received += static_cast< int >(packets.size());
+
+		if (finished) {
+			break;
+		}
+	}
+	joiner.join();
+
+	QVERIFY(valid);
+	QCOMPARE(received + dropped.load(), PRODUCERS * PACKETS);
+	QVERIFY(received > 0);
+}
+
+void TestTunnelQueue::pendingSessions() {
+	PendingTunnelSessions sessions(4);
+
+	unsigned int session;
+	QVERIFY(!sessions.pop(session));
+
+	for (unsigned int i = 1; i <= 4; ++i) {
+		QVERIFY(sessions.push(i));
+	}
+	QVERIFY(!sessions.push(5));
+
+	for (unsigned int i = 1; i <= 4; ++i) {
+		QVERIFY(sessions.pop(session));
+		QCOMPARE(session, i);
+	}
+	QVERIFY(!sessions.pop(session));
+
+	// Taking sessions out makes room again
+	QVERIFY(sessions.push(6));
+	QVERIFY(sessions.pop(session));
+	QCOMPARE(session, 6U);
+}
+
+void TestTunnelQueue::concurrentPendingSessions() {
+	constexpr unsigned int PRODUCERS = 4;
+	constexpr unsigned int SESSIONS  = 20000;
+
+	PendingTunnelSessions sessions(16);
+	std::atomic< unsigned int > rejected(0);
+
+	std::vector< std::thread > producers;
+	for (unsigned int p = 0; p < PRODUCERS; ++p) {
+		producers.emplace_back([&sessions, &rejected, p]() {
+			for (unsigned int i = 0; i < SESSIONS; ++i) {
+				if (!sessions.push(p * SESSIONS + i)) {
+					++rejected;
+				}
+			}
+		});
+	}
+
+	std::atomic< bool > done(false);
+	std::thread joiner([&producers, &done]() {
+		for (std::thread &producer : producers) {
+			producer.join();
+		}
+		done = true;
+	});
+
+	unsigned int taken = 0;
+	long long last[PRODUCERS];
+	std::fill(std::begin(last), std::end(last), -1);
+	bool valid = true;
+
+	while (true) {
+		const bool finished = done.load();
+
+		unsigned int session;
+		while (sessions.pop(session)) {
+			// Every producer's sessions are taken out in order
+			const unsigned int p = session / SESSIONS;
+			const long long i    = session % SESSIONS;
+			if (p >= PRODUCERS || i <= last[p]) {
+				valid = false;
+			} else {
+				last[p] = i;
+			}
+			++taken;
+		}
+
+		if (finished) {
+			break;
+		}
+	}
+	joiner.join();
+
+	QVERIFY(valid);
+	QCOMPARE(taken + rejected.load(), PRODUCERS * SESSIONS);
+}
+
+QTEST_MAIN(TestTunnelQueue)
+#include "TestTunnelQueue.moc"
@@ -0,0 +1,264 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "SSL.h"
+#include "VoiceCryptState.h"
+#include "crypto/CryptStateOCB2.h"
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TestVoiceCryptState : public QObject {
+	Q_OBJECT
+private slots:
+	void initTestCase();
+	void cleanupTestCase();
+	void noKey();
+	void serverToClient();
+	void clientToServer();
+	void resync();
+	void newKey();
+	void concurrentEncrypt();
+};
+
+namespace {
+constexpr unsigned int PLAIN_LENGTH = 50;
+
+/// Sets up a client's crypt state the same way the client does after having received the server's CryptSetup
+void setUpClient(CryptStateOCB2 &client, const VoiceCryptState &server) {
+	QVERIFY(client.setKey(server.getRawKey(), server.getDecryptIV(), server.getEncryptIV()));
+}
+
+/// Creates a unique plaintext for every value. It never contains a block of zeros, which would be modified by the
+/// countermeasure against the XEX* attack.
+std::vector< unsigned char > makePlain(unsigned char value) {
+	std::vector< unsigned char > plain(PLAIN_LENGTH);
+	for (unsigned int i = 0; i < PLAIN_LENGTH; ++i) {
+		plain[i] = static_cast< unsigned char >(value ^ (i + 1));
+	}
+
+	return plain;
+}
+
+/// Encrypts a packet on the server side (using the given slot) and verifies that the client decrypts it correctly
+bool sendToClient(VoiceCryptState &server, unsigned int slot, CryptStateOCB2 &client, unsigned char value) {
+	const std::vector< unsigned char > plain = makePlain(value);
+	std::vector< unsigned char > encrypted(PLAIN_LENGTH + 4);
+	std::vector< unsigned char > decrypted(PLAIN_LENGTH);
+
+	return server.encrypt(slot, plain.data(), encrypted.data(), PLAIN_LENGTH)
+		   && client.decrypt(encrypted.data(), decrypted.data(), PLAIN_LENGTH + 4) && decrypted == plain;
+}
+
+/// Encrypts a packet on the client side and verifies that the server decrypts it correctly
+bool sendToServer(CryptStateOCB2 &client, VoiceCryptState &server, unsigned char value) {
+	const std::vector< unsigned char > plain = makePlain(value);
+	std::vector< unsigned char > encrypted(PLAIN_LENGTH + 4);
+	std::vector< unsigned char > decrypted(PLAIN_LENGTH);
+
+	bool requestResync = false;
+	return client.encrypt(plain.data(), encrypted.data(), PLAIN_LENGTH)
+		   && server.decrypt(encrypted.data(), decrypted.data(), PLAIN_LENGTH + 4, requestResync) && decrypted == plain;
+}
+} // namespace
+
+void TestVoiceCryptState::initTestCase() {
+	MumbleSSL::initialize();
+}
+
+void TestVoiceCryptState::cleanupTestCase() {
+	MumbleSSL::destroy();
+}
+
+void TestVoiceCryptState::noKey() {
+	VoiceCryptState server;
+
+	QVERIFY(!server.isValid());
+	QVERIFY(server.getRawKey().empty());
+	QVERIFY(server.getEncryptIV().empty());
+
+	const std::vector< unsigned char > plain = makePlain(1);
+	std::vector< unsigned char > buffer(PLAIN_LENGTH + 4);
+	bool requestResync = true;
+
+	QVERIFY(!server.encrypt(0, plain.data(), buffer.data(), PLAIN_LENGTH));
+	QVERIFY(!server.decrypt(buffer.data(), buffer.data(), PLAIN_LENGTH + 4, requestResync));
+	QVERIFY(!requestResync);
+}
+
+void TestVoiceCryptState::serverToClient() {
+	VoiceCryptState server;
+	server.genKey();
+	QVERIFY(server.isValid());
+
+	CryptStateOCB2 client;
+	setUpClient(client, server);
+
+	// All slots share the same sequence of IVs, so the client can't tell which thread encrypted a packet
+	for (unsigned char i = 0; i < 10; ++i) {
+		QVERIFY(sendToClient(server, i % 3, client, i));
+	}
+	QVERIFY(sendToClient(server, VoiceCryptState::MAIN_THREAD_SLOT, client, 42));
+
+	QCOMPARE(client.uiGood, 11u);
+	QCOMPARE(client.uiLost, 0u);
+
+	// The encrypt IV reported to the client during a resync has to be the one of the last packet
+	CryptStateOCB2 resyncedClient;
+	QVERIFY(resyncedClient.setKey(server.getRawKey(), server.getDecryptIV(), server.getEncryptIV()));
+	QVERIFY(sendToClient(server, 0, resyncedClient, 7));
+	QCOMPARE(resyncedClient.uiLost, 0u);
+}
+
+void TestVoiceCryptState::clientToServer() {
+	VoiceCryptState server;
+	server.genKey();
+
+	CryptStateOCB2 client;
+	setUpClient(client, server);
+
+	for (unsigned char i = 0; i < 10; ++i) {
+		QVERIFY(sendToServer(client, server, i));
+	}
+	QCOMPARE(server.uiGood.load(), 10u);
+	QCOMPARE(server.uiLost.load(), 0u);
+
+	// Skipping packets has to be reflected in the statistics
+	const std::vector< unsigned char > plain = makePlain(0);
+	std::vector< unsigned char > dropped(PLAIN_LENGTH + 4);
+	for (int i = 0; i < 3; ++i) {
+		QVERIFY(client.encrypt(plain.data(), dropped.data(), PLAIN_LENGTH));
+	}
+	QVERIFY(sendToServer(client, server, 11));
+	QCOMPARE(server.uiGood.load(), 11u);
+	QCOMPARE(server.uiLost.load(), 3u);
+
+	// Replayed packets must be rejected
+	std::vector< unsigned char > encrypted(PLAIN_LENGTH + 4);
+	std::vector< unsigned char > decrypted(PLAIN_LENGTH);
+	bool requestResync = false;
+	QVERIFY(client.encrypt(plain.data(), encrypted.data(), PLAIN_LENGTH));
+	QVERIFY(server.decrypt(encrypted.data(), decrypted.data(), PLAIN_LENGTH + 4, requestResync));
+	QVERIFY(!server.decrypt(encrypted.data(), decrypted.data(), PLAIN_LENGTH + 4, requestResync));
+	QCOMPARE(server.uiGood.load(), 12u);
+}
+
+void TestVoiceCryptState::resync() {
+	VoiceCryptState server;
+	server.genKey();
+
+	CryptStateOCB2 client;
+	setUpClient(client, server);
+	QVERIFY(sendToServer(client, server, 1));
+
+	// The client loses track of its IV (e.g. after having been suspended)...
+	const std::string key = client.getRawKey();
+	std::string newIV     = client.getEncryptIV();
+	newIV[5]              = static_cast< char >(newIV[5] + 100);
+	newIV[12]             = static_cast< char >(newIV[12] ^ 0x55);
+	QVERIFY(client.setKey(key, newIV, client.getDecryptIV()));
+	QVERIFY(!sendToServer(client, server, 2));
+
+	// ... and sends its current IV, which the server hands over to the decrypting thread
+	QVERIFY(!server.setDecryptIV(std::string(3, '\0')));
+	QVERIFY(server.setDecryptIV(client.getEncryptIV()));
+
+	QVERIFY(sendToServer(client, server, 3));
+	QVERIFY(sendToServer(client, server, 4));
+
+	// Sending to the client is unaffected
+	QVERIFY(sendToClient(server, 0, client, 5));
+}
+
+void TestVoiceCryptState::newKey() {
+	VoiceCryptState server;
+	server.genKey();
+
+	CryptStateOCB2 client;
+	setUpClient(client, server);
+	QVERIFY(sendToServer(client, server, 1));
+	QVERIFY(sendToClient(server, 0, client, 1));
+
+	const std::string oldKey = server.getRawKey();
+	server.genKey();
+	QVERIFY(server.getRawKey() != oldKey);
+
+	// Packets using the old key are no longer accepted...
+	QVERIFY(!sendToServer(client, server, 2));
+
+	// ... but the ones of a client that received the new key are, in both directions and by all slots
+	CryptStateOCB2 newClient;
+	setUpClient(newClient, server);
+	QVERIFY(sendToServer(newClient, server, 3));
+	QVERIFY(sendToClient(server, 0, newClient, 3));
+	QVERIFY(sendToClient(server, 1, newClient, 4));
+	QVERIFY(sendToClient(server, VoiceCryptState::MAIN_THREAD_SLOT, newClient, 5));
+}
+
+void TestVoiceCryptState::concurrentEncrypt() {
+	constexpr unsigned int THREADS = 4;
+	constexpr unsigned int PACKETS = 1000;
+
+	VoiceCryptState server;
+	server.genKey();
+
+	CryptStateOCB2 client;
+	setUpClient(client, server);
+
+	std::vector< std::vector< std::vector< unsigned char > > > encrypted(THREADS);
+	std::vector< std::thread > threads;
+
+	for (unsigned int slot = 0; slot < THREADS; ++slot) {
+		threads.emplace_back([&server, &encrypted, slot]() {
+			const std::vector< unsigned char > plain = makePlain(static_cast< unsigned char >(slot));
+
+			for (unsigned int i = 0; i < PACKETS; ++i) {
+				std::vector< unsigned char > packet(PLAIN_LENGTH + 4);
+				server.encrypt(slot, plain.data(), packet.data(), PLAIN_LENGTH);
+				encrypted[slot].push_back(std::move(packet));
+			}
+		});
+	}
+
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+
+	// The packets have to use consecutive IVs, i.e. the client has to be able to decrypt all of them in some order
+	// without losing any. The packet using the next IV is the one among those with the matching first byte that the
+	// client accepts (failed attempts don't change the client's state).
+	std::vector< std::vector< unsigned char > > pending;
+	for (std::vector< std::vector< unsigned char > > &packets : encrypted) {
+		pending.insert(pending.end(), packets.begin(), packets.end());
+	}
+
+	std::vector< unsigned char > decrypted(PLAIN_LENGTH);
+	unsigned char nextIV = static_cast< unsigned char >(client.getDecryptIV()[0]);
+	while (!pending.empty()) {
+		++nextIV;
+
+		bool found = false;
+		for (auto it = pending.begin(); it != pending.end(); ++it) {
+			if ((*it)[0] == nextIV && client.decrypt(it->data(), decrypted.data(), PLAIN_LENGTH + 4)) {
+				pending.erase(it);
+				found = true;
+				break;
+			}
+		}
+		QVERIFY(found);
+	}
+
+	QCOMPARE(client.uiGood, THREADS * PACKETS);
+	QCOMPARE(client.uiLost, 0u);
+	QCOMPARE(client.uiLate, 0u);
+}
+
+QTEST_MAIN(TestVoiceCryptState)
+#include "TestVoiceCryptState.moc"
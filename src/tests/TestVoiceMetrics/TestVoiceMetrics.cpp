@@ -0,0 +1,183 @@
+// Copyright The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "Metrics.h"
+#include "VoiceMetrics.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+class TestVoiceMetrics : public QObject {
+	Q_OBJECT
+private slots:
+	void histogramBuckets();
+	void histogramOverflow();
+	void snapshotSumsSlots();
+	void prometheusFormat();
+	void metricTables();
+};
+
+using Histogram = MetricsHistogram< 10 >;
+
+namespace {
+struct TableMetrics {
+	std::uint64_t connections = 0;
+	std::uint64_t time        = 0;
+	quint64 requests          = 0;
+};
+} // namespace
+
+void TestVoiceMetrics::histogramBuckets() {
+	// Every value has to end up in the first bucket whose upper bound isn't smaller than the value
+	for (std::uint64_t value = 0; value <= Histogram::MAX_VALUE; ++value) {
+		const unsigned int index = Histogram::bucketIndex(value);
+
+		QVERIFY(index < Histogram::BUCKET_COUNT);
+		QVERIFY(value <= Histogram::bucketUpperBound(index));
+		if (index > 0) {
+			QVERIFY(value > Histogram::bucketUpperBound(index - 1));
+		}
+	}
+
+	QCOMPARE(Histogram::bucketUpperBound(Histogram::BUCKET_COUNT - 1), Histogram::MAX_VALUE);
+
+	// Two buckets per power of two
+	QCOMPARE(Histogram::bucketUpperBound(4), std::uint64_t(5));
+	QCOMPARE(Histogram::bucketUpperBound(5), std::uint64_t(7));
+	QCOMPARE(Histogram::bucketUpperBound(6), std::uint64_t(11));
+	QCOMPARE(Histogram::bucketUpperBound(7), std::uint64_t(15));
+}
+
+void TestVoiceMetrics::histogramOverflow() {
+	Histogram histogram;
+	histogram.record(Histogram::MAX_VALUE + 1);
+	histogram.record(std::uint64_t(1) << 40);
+
+	HistogramSnapshot snapshot;
+	histogram.addTo(snapshot);
+
+	QCOMPARE(snapshot.buckets.size(), static_cast< std::size_t >(Histogram::BUCKET_COUNT));
+	QCOMPARE(snapshot.buckets.back(), std::uint64_t(2));
+	QCOMPARE(snapshot.count(), std::uint64_t(2));
+	// The sum isn't affected by the clamping
+	QCOMPARE(snapshot.sum, Histogram::MAX_VALUE + 1 + (std::uint64_t(1) << 40));
+}
+
+void TestVoiceMetrics::snapshotSumsSlots() {
+	VoiceMetrics metrics(3);
+
+	metrics.forSlot(0).add(VoiceCounter::UDPPacketsReceived);
+	metrics.forSlot(0).add(VoiceCounter::UDPBytesReceived, 100);
+	metrics.forSlot(2).add(VoiceCounter::UDPPacketsReceived, 2);
+	metrics.forSlot(2).add(VoiceCounter::UDPBytesReceived, 50);
+	metrics.forSlot(1).add(VoiceCounter::DecryptFailures);
+
+	metrics.forSlot(0).receivers.record(3);
+	metrics.forSlot(1).receivers.record(3);
+	metrics.forSlot(2).latency.record(250);
+
+	const VoiceMetricsSnapshot snapshot = metrics.snapshot();
+
+	QCOMPARE(snapshot.counters[static_cast< std::size_t >(VoiceCounter::UDPPacketsReceived)], std::uint64_t(3));
+	QCOMPARE(snapshot.counters[static_cast< std::size_t >(VoiceCounter::UDPBytesReceived)], std::uint64_t(150));
+	QCOMPARE(snapshot.counters[static_cast< std::size_t >(VoiceCounter::DecryptFailures)], std::uint64_t(1));
+	QCOMPARE(snapshot.counters[static_cast< std::size_t >(VoiceCounter::UDPPacketsSent)], std::uint64_t(0));
+
+	QCOMPARE(snapshot.receivers.count(), std::uint64_t(2));
+	QCOMPARE(snapshot.receivers.sum, std::uint64_t(6));
+	QCOMPARE(snapshot.receivers.buckets[3], std::uint64_t(2));
+
+	QCOMPARE(snapshot.latency.count(), std::uint64_t(1));
+	QCOMPARE(snapshot.latency.sum, std::uint64_t(250));
+}
+
+void TestVoiceMetrics::prometheusFormat() {
+	VoiceMetrics first(1);
+	first.forSlot(0).add(VoiceCounter::UDPPacketsSent, 42);
+	first.forSlot(0).receivers.record(1);
+	first.forSlot(0).receivers.record(5);
+	first.forSlot(0).latency.record(1500);
+
+	VoiceMetrics second(1);
+
+	const std::vector< std::pair< int, VoiceMetricsSnapshot > > servers = { { 1, first.snapshot() },
+																			{ 7, second.snapshot() } };
+	const QString output = QString::fromStdString(VoiceMetrics::toPrometheus(servers));
+
+	QVERIFY(output.contains("# TYPE murmur_udp_sent_packets_total counter\n"));
+	QVERIFY(output.contains("murmur_udp_sent_packets_total{server=\"1\"} 42\n"));
+	QVERIFY(output.contains("murmur_udp_sent_packets_total{server=\"7\"} 0\n"));
+
+	// Buckets are cumulative
+	QVERIFY(output.contains("# TYPE murmur_voice_receivers_per_packet histogram\n"));
+	QVERIFY(output.contains("murmur_voice_receivers_per_packet_bucket{server=\"1\",le=\"0\"} 0\n"));
+	QVERIFY(output.contains("murmur_voice_receivers_per_packet_bucket{server=\"1\",le=\"1\"} 1\n"));
+	QVERIFY(output.contains("murmur_voice_receivers_per_packet_bucket{server=\"1\",le=\"5\"} 2\n"));
+	QVERIFY(output.contains("murmur_voice_receivers_per_packet_bucket{server=\"1\",le=\"+Inf\"} 2\n"));
+	QVERIFY(output.contains("murmur_voice_receivers_per_packet_sum{server=\"1\"} 6\n"));
+	QVERIFY(output.contains("murmur_voice_receivers_per_packet_count{server=\"1\"} 2\n"));
+
+	// Latencies are recorded in microseconds but exported in seconds
+	QVERIFY(output.contains("murmur_voice_processing_seconds_bucket{server=\"1\",le=\"0.001535\"} 1\n"));
+	QVERIFY(output.contains("murmur_voice_processing_seconds_sum{server=\"1\"} 0.0015\n"));
+	QVERIFY(output.contains("murmur_voice_processing_seconds_count{server=\"7\"} 0\n"));
+
+	// Every line is either a comment or a sample
+	for (const QString &line : output.split('\n', Qt::SkipEmptyParts)) {
+		QVERIFY(line.startsWith("# ") || line.startsWith("murmur_"));
+	}
+}
+
+void TestVoiceMetrics::metricTables() {
+	static const Prometheus::Metric< TableMetrics > metrics[] = {
+		{ "test_connections", "Open connections", "gauge", &TableMetrics::connections },
+		{ "test_seconds_total", "Time spent", "counter", &TableMetrics::time, 1000000.0 },
+	};
+	// Members of a type other than std::uint64_t
+	static const Prometheus::Metric< TableMetrics, quint64 > requestMetrics[] = {
+		{ "test_requests_total", "Requests served", "counter", &TableMetrics::requests },
+	};
+
+	TableMetrics values;
+	values.connections = 3;
+	values.time        = 2500000;
+	values.requests    = 12;
+
+	std::string out;
+	Prometheus::appendMetrics(out, metrics, values);
+	Prometheus::appendMetrics(out, requestMetrics, values);
+	QCOMPARE(QString::fromStdString(out), QString("# HELP test_connections Open connections\n"
+												  "# TYPE test_connections gauge\n"
+												  "test_connections 3\n"
+												  "# HELP test_seconds_total Time spent\n"
+												  "# TYPE test_seconds_total counter\n"
+												  "test_seconds_total 2.5\n"
+												  "# HELP test_requests_total Requests served\n"
+												  "# TYPE test_requests_total counter\n"
+												  "test_requests_total 12\n"));
+
+	TableMetrics other;
+	other.connections = 1;
+
+	const std::vector< std::pair< int, TableMetrics > > servers = { { 1, values }, { 7, other } };
+	out.clear();
+	Prometheus::appendMetrics(out, metrics, servers);
+	QCOMPARE(QString::fromStdString(out), QString("# HELP test_connections Open connections\n"
+												  "# TYPE test_connections gauge\n"
+												  "test_connections{server=\"1\"} 3\n"
+												  "test_connections{server=\"7\"} 1\n"
+												  "# HELP test_seconds_total Time spent\n"
+												  "# TYPE test_seconds_total counter\n"
+												  "test_seconds_total{server=\"1\"} 2.5\n"
+												  "test_seconds_total{server=\"7\"} 0\n"));
+}
+
+QTEST_MAIN(TestVoiceMetrics)
+#include "TestVoiceMetrics.moc"